@@ -24,7 +24,9 @@ extern "C" {
  */
 
 # include <zpc/aes_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
+# include <sys/uio.h>
 
 struct zpc_aes_cbc;
 
@@ -94,6 +96,114 @@ int zpc_aes_cbc_encrypt(struct zpc_aes_cbc *ctx, unsigned char *ct,
 __attribute__((visibility("default")))
 int zpc_aes_cbc_decrypt(struct zpc_aes_cbc *ctx, unsigned char *pt,
     const unsigned char *ct, size_t ctlen);
+/**
+ * Do an AES-CBC encryption operation on a plaintext scattered over
+ * several buffers, as zpc_aes_cbc_encrypt would do on the concatenated
+ * buffers. The ciphertext is written to the buffers of ct, whose total
+ * length must equal that of pt. Blocks that span buffers are handled
+ * internally, so the buffers can be of any length.
+ * \param[in,out] ctx AES-CBC context
+ * \param[out] ct ciphertext buffers
+ * \param[in] pt plaintext buffers
+ * \param[in] iovcnt number of buffers in ct and pt
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_encryptv(struct zpc_aes_cbc *ctx, const struct iovec *ct,
+    const struct iovec *pt, int iovcnt);
+/**
+ * Do an AES-CBC decryption operation on a ciphertext scattered over
+ * several buffers, as zpc_aes_cbc_decrypt would do on the concatenated
+ * buffers. The plaintext is written to the buffers of pt, whose total
+ * length must equal that of ct.
+ * \param[in,out] ctx AES-CBC context
+ * \param[out] pt plaintext buffers
+ * \param[in] ct ciphertext buffers
+ * \param[in] iovcnt number of buffers in pt and ct
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_decryptv(struct zpc_aes_cbc *ctx, const struct iovec *pt,
+    const struct iovec *ct, int iovcnt);
+/**
+ * Do an AES-CBC encryption operation with PKCS#7 padding on a
+ * plaintext streamed in chunks of any length. The complete blocks so far
+ * are encrypted, a trailing partial block is kept in the context. The
+ * ciphertext is at most ptlen + 15 bytes long. The buffers must not
+ * overlap.
+ * \param[in,out] ctx AES-CBC context
+ * \param[out] ct ciphertext
+ * \param[out] ctlen ciphertext length [bytes]
+ * \param[in] pt plaintext
+ * \param[in] ptlen plaintext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_encrypt_pad_update(struct zpc_aes_cbc *ctx,
+    unsigned char *ct, size_t *ctlen, const unsigned char *pt, size_t ptlen);
+/**
+ * Finish an AES-CBC encryption operation with PKCS#7 padding: pad and
+ * encrypt the pending partial block. The last ciphertext block is
+ * always 16 bytes long.
+ * \param[in,out] ctx AES-CBC context
+ * \param[out] ct 16 byte ciphertext buffer
+ * \param[out] ctlen ciphertext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_encrypt_pad_final(struct zpc_aes_cbc *ctx,
+    unsigned char *ct, size_t *ctlen);
+/**
+ * Do an AES-CBC decryption operation with PKCS#7 padding on a
+ * ciphertext streamed in chunks of any length. The last block, which
+ * holds the padding, is kept in the context until
+ * zpc_aes_cbc_decrypt_pad_final. The plaintext is at most ctlen + 15
+ * bytes long. The buffers must not overlap.
+ * \param[in,out] ctx AES-CBC context
+ * \param[out] pt plaintext
+ * \param[out] ptlen plaintext length [bytes]
+ * \param[in] ct ciphertext
+ * \param[in] ctlen ciphertext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_decrypt_pad_update(struct zpc_aes_cbc *ctx,
+    unsigned char *pt, size_t *ptlen, const unsigned char *ct, size_t ctlen);
+/**
+ * Finish an AES-CBC decryption operation with PKCS#7 padding: decrypt
+ * the last block and strip the padding in constant time. The block is
+ * written to pt in full, of which the first ptlen bytes are plaintext.
+ * ZPC_ERROR_CLEN is returned if the ciphertext is not a positive
+ * multiple of 16 bytes long, ZPC_ERROR_PADDING if the padding is invalid.
+ * \param[in,out] ctx AES-CBC context
+ * \param[out] pt 16 byte plaintext buffer
+ * \param[out] ptlen plaintext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_decrypt_pad_final(struct zpc_aes_cbc *ctx,
+    unsigned char *pt, size_t *ptlen);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-CBC operation, see zpc/stats.h.
+ * \param[in] ctx AES-CBC context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_get_stats(const struct zpc_aes_cbc *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an AES-CBC operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * The copy continues where ctx stands (chaining value).
+ * \param[in,out] ctx new AES-CBC context
+ * \param[in] src AES-CBC context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cbc_dup(struct zpc_aes_cbc **ctx,
+    const struct zpc_aes_cbc *src);
 /**
  * Free an AES-CBC context.
  * \param[in,out] ctx AES-CBC context
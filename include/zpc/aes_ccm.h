@@ -23,6 +23,7 @@ extern "C" {
  */
 
 # include <zpc/aes_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
 
 struct zpc_aes_ccm;
@@ -85,6 +86,93 @@ __attribute__((visibility("default")))
 int zpc_aes_ccm_decrypt(struct zpc_aes_ccm *ctx, unsigned char *pt,
     const unsigned char *mac, size_t maclen, const unsigned char *aad,
     size_t aadlen, const unsigned char *ct, size_t ctlen);
+/**
+ * Start a multi-part AES-CCM operation with the context's iv. CCM
+ * authenticates the lengths first, so the total lengths of the additional
+ * authenticated data and of the payload are declared here. The additional
+ * authenticated data is then passed with zpc_aes_ccm_update_aad, the
+ * payload with zpc_aes_ccm_encrypt_update or zpc_aes_ccm_decrypt_update,
+ * in chunks of any length, and the operation is completed by
+ * zpc_aes_ccm_encrypt_final or zpc_aes_ccm_decrypt_final. Only a partial
+ * block is kept in the context. A one-shot operation, zpc_aes_ccm_set_iv
+ * or zpc_aes_ccm_set_key abort a multi-part operation.
+ * \param[in,out] ctx AES-CCM context
+ * \param[in] aadlen total additional authenticated data length [bytes]
+ * \param[in] msglen total payload length [bytes]
+ * \param[in] maclen message authentication code length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_init(struct zpc_aes_ccm *ctx, unsigned long long aadlen,
+    unsigned long long msglen, size_t maclen);
+/**
+ * Pass the next chunk of the additional authenticated data of a
+ * multi-part AES-CCM operation.
+ * \param[in,out] ctx AES-CCM context
+ * \param[in] aad additional authenticated data
+ * \param[in] aadlen additional authenticated data length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_update_aad(struct zpc_aes_ccm *ctx, const unsigned char *aad,
+    size_t aadlen);
+/**
+ * Encrypt the next chunk of the payload of a multi-part AES-CCM operation.
+ * All additional authenticated data must have been passed.
+ * \param[in,out] ctx AES-CCM context
+ * \param[out] ct ciphertext
+ * \param[in] pt plaintext
+ * \param[in] ptlen plaintext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_encrypt_update(struct zpc_aes_ccm *ctx, unsigned char *ct,
+    const unsigned char *pt, size_t ptlen);
+/**
+ * Decrypt the next chunk of the payload of a multi-part AES-CCM operation.
+ * All additional authenticated data must have been passed. The plaintext
+ * is not authentic before zpc_aes_ccm_decrypt_final succeeded.
+ * \param[in,out] ctx AES-CCM context
+ * \param[out] pt plaintext
+ * \param[in] ct ciphertext
+ * \param[in] ctlen ciphertext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_decrypt_update(struct zpc_aes_ccm *ctx, unsigned char *pt,
+    const unsigned char *ct, size_t ctlen);
+/**
+ * Complete a multi-part AES-CCM encryption and compute the message
+ * authentication code of the length passed to zpc_aes_ccm_init.
+ * \param[in,out] ctx AES-CCM context
+ * \param[out] mac message authentication code
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_encrypt_final(struct zpc_aes_ccm *ctx, unsigned char *mac);
+/**
+ * Complete a multi-part AES-CCM decryption and verify the message
+ * authentication code of the length passed to zpc_aes_ccm_init.
+ * \param[in,out] ctx AES-CCM context
+ * \param[in] mac message authentication code
+ * \return 0 if the message authentication code is valid,
+ * ZPC_ERROR_TAGMISMATCH if it is not, in which case the plaintext
+ * returned by zpc_aes_ccm_decrypt_update must be discarded. Otherwise,
+ * a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_decrypt_final(struct zpc_aes_ccm *ctx,
+    const unsigned char *mac);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-CCM operation, see zpc/stats.h.
+ * \param[in] ctx AES-CCM context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ccm_get_stats(const struct zpc_aes_ccm *ctx,
+    struct zpc_stats_counters *stats);
 /**
  * Free an AES-CCM context.
  * \param[in,out] ctx AES-CCM context
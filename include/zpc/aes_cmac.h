@@ -24,7 +24,9 @@ extern "C" {
  */
 
 # include <zpc/aes_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
+# include <sys/uio.h>
 
 struct zpc_aes_cmac;
 
@@ -44,9 +46,14 @@ int zpc_aes_cmac_alloc(struct zpc_aes_cmac **ctx);
 __attribute__((visibility("default")))
 int zpc_aes_cmac_set_key(struct zpc_aes_cmac *ctx, struct zpc_aes_key *key);
 /**
- * Do an AES-CMAC signing operation.
+ * Do an AES-CMAC signing operation. If mac is NULL, msg is an intermediate
+ * chunk of a message and further calls with more chunks follow; chunks can
+ * be of any length. Whole blocks are processed from the caller's buffer,
+ * the last block so far is kept in the context. If mac is not NULL, msg is
+ * the last chunk and the message authentication code is computed.
  * \param[in,out] ctx AES-CMAC context
- * \param[out] mac message authentication code
+ * \param[out] mac message authentication code, NULL for an intermediate
+ * chunk
  * \param[in] maclen message authentication code length [bytes]
  * \param[in] msg message
  * \param[in] msglen message length [bytes]
@@ -56,9 +63,11 @@ __attribute__((visibility("default")))
 int zpc_aes_cmac_sign(struct zpc_aes_cmac *ctx, unsigned char *mac,
     size_t maclen, const unsigned char *msg, size_t msglen);
 /**
- * Do an AES-CMAC verify operation.
+ * Do an AES-CMAC verify operation. Intermediate chunks (mac is NULL)
+ * are passed as for zpc_aes_cmac_sign.
  * \param[in,out] ctx AES-CMAC context
- * \param[in] mac message authentication code
+ * \param[in] mac message authentication code, NULL for an intermediate
+ * chunk
  * \param[in] maclen message authentication code length [bytes]
  * \param[in] msg message
  * \param[in] msglen message length [bytes]
@@ -67,6 +76,106 @@ int zpc_aes_cmac_sign(struct zpc_aes_cmac *ctx, unsigned char *mac,
 __attribute__((visibility("default")))
 int zpc_aes_cmac_verify(struct zpc_aes_cmac *ctx, const unsigned char *mac,
     size_t maclen, const unsigned char *msg, size_t msglen);
+/**
+ * Do an AES-CMAC signing operation on a message scattered over several
+ * buffers, as zpc_aes_cmac_sign would do on the concatenated buffers.
+ * Blocks that span buffers are handled internally, so the buffers can
+ * be of any length.
+ * \param[in,out] ctx AES-CMAC context
+ * \param[out] mac message authentication code
+ * \param[in] maclen message authentication code length [bytes]
+ * \param[in] msg message buffers
+ * \param[in] iovcnt number of message buffers
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cmac_signv(struct zpc_aes_cmac *ctx, unsigned char *mac,
+    size_t maclen, const struct iovec *msg, int iovcnt);
+/**
+ * Do an AES-CMAC verify operation on a message scattered over several
+ * buffers, as zpc_aes_cmac_verify would do on the concatenated buffers.
+ * \param[in,out] ctx AES-CMAC context
+ * \param[in] mac message authentication code
+ * \param[in] maclen message authentication code length [bytes]
+ * \param[in] msg message buffers
+ * \param[in] iovcnt number of message buffers
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cmac_verifyv(struct zpc_aes_cmac *ctx, const unsigned char *mac,
+    size_t maclen, const struct iovec *msg, int iovcnt);
+/**
+ * Message of an AES-CMAC batch operation, see zpc_aes_cmac_sign_batch and
+ * zpc_aes_cmac_verify_batch.
+ */
+struct zpc_aes_cmac_msg {
+	const unsigned char *msg;	/**< message */
+	size_t msglen;			/**< message length [bytes] */
+	unsigned char *mac;		/**< message authentication code, written by sign, read by verify */
+};
+
+/**
+ * Compute the message authentication codes of independent short messages
+ * in one call, as if by one zpc_aes_cmac_sign call per message. The
+ * context is checked once and its protected key is reused for all
+ * messages. A message started by intermediate zpc_aes_cmac_sign calls
+ * is discarded.
+ * \param[in,out] ctx AES-CMAC context
+ * \param[in] msgs messages
+ * \param[in] nmsgs number of messages
+ * \param[in] maclen message authentication code length of all
+ * messages [bytes] (8 to 16)
+ * \return 0 on success. ZPC_ERROR_ARG2NULL if a message buffer is NULL
+ * although its length is non-zero or a mac buffer is NULL, in which case
+ * no message is processed. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cmac_sign_batch(struct zpc_aes_cmac *ctx,
+    const struct zpc_aes_cmac_msg *msgs, size_t nmsgs, size_t maclen);
+/**
+ * Verify the message authentication codes of independent short messages
+ * in one call, as if by one zpc_aes_cmac_verify call per message. The
+ * context is checked once and its protected key is reused for all
+ * messages. A message started by intermediate zpc_aes_cmac_sign calls
+ * is discarded.
+ * \param[in,out] ctx AES-CMAC context
+ * \param[in] msgs messages
+ * \param[in] nmsgs number of messages
+ * \param[in] maclen message authentication code length of all
+ * messages [bytes] (8 to 16)
+ * \param[out] valid bitmap of (nmsgs + 7) / 8 bytes: bit i % 8 (least
+ * significant first) of byte i / 8 is set if the message authentication
+ * code of message i is valid
+ * \return 0 if all message authentication codes are valid,
+ * ZPC_ERROR_TAGMISMATCH if at least one is not, ZPC_ERROR_ARG2NULL as for
+ * zpc_aes_cmac_sign_batch. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cmac_verify_batch(struct zpc_aes_cmac *ctx,
+    const struct zpc_aes_cmac_msg *msgs, size_t nmsgs, size_t maclen,
+    unsigned char *valid);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-CMAC operation, see zpc/stats.h.
+ * \param[in] ctx AES-CMAC context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cmac_get_stats(const struct zpc_aes_cmac *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an AES-CMAC operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * The copy continues where ctx stands, e.g. after a common message
+ * prefix.
+ * \param[in,out] ctx new AES-CMAC context
+ * \param[in] src AES-CMAC context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_cmac_dup(struct zpc_aes_cmac **ctx,
+    const struct zpc_aes_cmac *src);
 /**
  * Free an AES-CMAC context.
  * \param[in,out] ctx AES-CMAC context
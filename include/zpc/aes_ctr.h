@@ -0,0 +1,131 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef ZPC_AES_CTR_H
+# define ZPC_AES_CTR_H
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+# endif
+
+/**
+ * \file zpc/aes_ctr.h
+ *
+ * \brief AES-CTR API
+ *
+ * Encryption API for the Advanced Encryption Standard (AES)
+ * block cipher \cite AES in Counter (CTR) mode of operation \cite MODES .
+ *
+ * The initialization vector is the counter block of the first block of
+ * the stream. The counter block of each following block is the previous
+ * one incremented by one as a 128-bit big-endian integer (modulo 2^128).
+ *
+ * Since each block's keystream only depends on its counter block, any
+ * byte range of a stream can be en- or decrypted on its own via
+ * zpc_aes_ctr_seek(), e.g. by several contexts in parallel.
+ */
+
+# include <zpc/aes_key.h>
+# include <zpc/stats.h>
+# include <stddef.h>
+
+struct zpc_aes_ctr;
+
+/**
+ * Allocate a new context for an AES-CTR operation.
+ * \param[in,out] ctx AES-CTR context
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_alloc(struct zpc_aes_ctr **ctx);
+/**
+ * Set the key to be used in the context of an AES-CTR operation.
+ * \param[in,out] ctx AES-CTR context
+ * \param[in] key AES key
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_set_key(struct zpc_aes_ctr *ctx, struct zpc_aes_key *key);
+/**
+ * Set the initialization vector to be used in the context
+ * of an AES-CTR operation. The stream position is set to 0.
+ * \param[in,out] ctx AES-CTR context
+ * \param[in] iv 16 byte initial counter block
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_set_iv(struct zpc_aes_ctr *ctx, const unsigned char *iv);
+/**
+ * Set the stream position of an AES-CTR operation: the next
+ * zpc_aes_ctr_encrypt() or zpc_aes_ctr_decrypt() starts at byte offset
+ * of the stream started by the initialization vector. Offsets need not
+ * be multiples of the block size.
+ * \param[in,out] ctx AES-CTR context
+ * \param[in] offset stream position [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_seek(struct zpc_aes_ctr *ctx, unsigned long long offset);
+/**
+ * Do an AES-CTR encryption operation at the current stream position,
+ * which is advanced by ptlen bytes.
+ * \param[in,out] ctx AES-CTR context
+ * \param[out] ct ciphertext
+ * \param[in] pt plaintext
+ * \param[in] ptlen plaintext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_encrypt(struct zpc_aes_ctr *ctx, unsigned char *ct,
+    const unsigned char *pt, size_t ptlen);
+/**
+ * Do an AES-CTR decryption operation at the current stream position,
+ * which is advanced by ctlen bytes.
+ * \param[in,out] ctx AES-CTR context
+ * \param[out] pt plaintext
+ * \param[in] ct ciphertext
+ * \param[in] ctlen ciphertext length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_decrypt(struct zpc_aes_ctr *ctx, unsigned char *pt,
+    const unsigned char *ct, size_t ctlen);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-CTR operation, see zpc/stats.h.
+ * \param[in] ctx AES-CTR context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_get_stats(const struct zpc_aes_ctr *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an AES-CTR operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * The copy continues where ctx stands (stream position).
+ * \param[in,out] ctx new AES-CTR context
+ * \param[in] src AES-CTR context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_ctr_dup(struct zpc_aes_ctr **ctx,
+    const struct zpc_aes_ctr *src);
+/**
+ * Free an AES-CTR context.
+ * \param[in,out] ctx AES-CTR context
+ */
+__attribute__((visibility("default")))
+void zpc_aes_ctr_free(struct zpc_aes_ctr **ctx);
+
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+# endif
+#endif
@@ -23,7 +23,9 @@ extern "C" {
  */
 
 # include <zpc/aes_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
+# include <sys/uio.h>
 
 struct zpc_aes_gcm;
 
@@ -45,6 +47,10 @@ int zpc_aes_gcm_set_key(struct zpc_aes_gcm *ctx, struct zpc_aes_key *key);
 /**
  * Create the initialization vector to be used in the context
  * of an AES-GCM operation. The minimum and recommended iv length is 12 bytes.
+ * If a fixed field is set (see zpc_aes_gcm_set_iv_fixed), the iv length must
+ * be 12 bytes and the iv is the fixed field followed by the context's
+ * invocation counter (big-endian), which is then incremented. Otherwise,
+ * the iv is random.
  * \param[in,out] ctx AES-GCM context
  * \param[in/out] iv application provided buffer of at least ivlen bytes to
  * receive the internally created initialization vector
@@ -54,6 +60,34 @@ int zpc_aes_gcm_set_key(struct zpc_aes_gcm *ctx, struct zpc_aes_key *key);
 __attribute__((visibility("default")))
 int zpc_aes_gcm_create_iv(struct zpc_aes_gcm *ctx, unsigned char *iv,
     size_t ivlen);
+/**
+ * Make zpc_aes_gcm_create_iv create deterministic 12 byte initialization
+ * vectors (NIST SP 800-38D, 8.2.1): a 4 byte fixed field, which identifies
+ * the device or thread using the key, followed by an 8 byte invocation
+ * counter. The counter values 0 to 2^64 - 2 can be used. Once they are
+ * used up, zpc_aes_gcm_create_iv fails with ZPC_ERROR_GCM_IV_EXHAUSTED.
+ * The fixed field and counter are kept when the key is changed. To
+ * continue with a key across restarts, persist the counter returned by
+ * zpc_aes_gcm_get_iv_counter and pass it here.
+ * \param[in,out] ctx AES-GCM context
+ * \param[in] fixed fixed field, or NULL to create random ivs again
+ * \param[in] fixedlen fixed field length [bytes], must be 4
+ * \param[in] counter invocation counter of the next created iv
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_set_iv_fixed(struct zpc_aes_gcm *ctx,
+    const unsigned char *fixed, size_t fixedlen, unsigned long long counter);
+/**
+ * Get the invocation counter of the next initialization vector created
+ * with the fixed field set by zpc_aes_gcm_set_iv_fixed.
+ * \param[in] ctx AES-GCM context
+ * \param[out] counter invocation counter
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_get_iv_counter(struct zpc_aes_gcm *ctx,
+    unsigned long long *counter);
 /**
  * Set the initialization vector to be used in the context
  * of an AES-GCM operation.
@@ -67,6 +101,10 @@ int zpc_aes_gcm_set_iv(struct zpc_aes_gcm *ctx, const unsigned char *iv,
     size_t ivlen);
 /**
  * Do an AES-GCM authenticated encryption operation.
+ * A message can be encrypted in several calls: calls with a NULL mac are
+ * intermediate, the call with a non-NULL mac computes it. Intermediate
+ * chunks of aad and pt can be of any length; the context keeps the
+ * pending partial block.
  * \param[in,out] ctx AES-GCM context
  * \param[out] ct ciphertext
  * \param[out] mac message authentication code
@@ -83,6 +121,10 @@ int zpc_aes_gcm_encrypt(struct zpc_aes_gcm *ctx, unsigned char *ct,
     const unsigned char *pt, size_t ptlen);
 /**
  * Do an AES-GCM authenticated decryption operation.
+ * A message can be decrypted in several calls: calls with a NULL mac are
+ * intermediate, the call with a non-NULL mac verifies it. Intermediate
+ * chunks of aad and ct can be of any length; the context keeps the
+ * pending partial block.
  * \param[in,out] ctx AES-GCM context
  * \param[out] pt plaintext
  * \param[in] mac message authentication code
@@ -97,6 +139,127 @@ __attribute__((visibility("default")))
 int zpc_aes_gcm_decrypt(struct zpc_aes_gcm *ctx, unsigned char *pt,
     const unsigned char *mac, size_t maclen, const unsigned char *aad,
     size_t aadlen, const unsigned char *ct, size_t ctlen);
+/**
+ * Do an AES-GCM authenticated encryption operation on a plaintext
+ * scattered over several buffers, as zpc_aes_gcm_encrypt would do on the
+ * concatenated buffers. The ciphertext is written to the buffers of ct,
+ * whose total length must equal that of pt. Blocks that span buffers are
+ * handled internally, so the buffers can be of any length.
+ * \param[in,out] ctx AES-GCM context
+ * \param[out] ct ciphertext buffers
+ * \param[out] mac message authentication code
+ * \param[in] maclen message authentication code length [bytes]
+ * \param[in] aad additional authenticated data
+ * \param[in] aadlen additional authenticated data length [bytes]
+ * \param[in] pt plaintext buffers
+ * \param[in] iovcnt number of buffers in ct and pt
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_encryptv(struct zpc_aes_gcm *ctx, const struct iovec *ct,
+    unsigned char *mac, size_t maclen, const unsigned char *aad, size_t aadlen,
+    const struct iovec *pt, int iovcnt);
+/**
+ * Do an AES-GCM authenticated decryption operation on a ciphertext
+ * scattered over several buffers, as zpc_aes_gcm_decrypt would do on the
+ * concatenated buffers. The plaintext is written to the buffers of pt,
+ * whose total length must equal that of ct.
+ * \param[in,out] ctx AES-GCM context
+ * \param[out] pt plaintext buffers
+ * \param[in] mac message authentication code
+ * \param[in] maclen message authentication code length [bytes]
+ * \param[in] aad additional authenticated data
+ * \param[in] aadlen additional authenticated data length [bytes]
+ * \param[in] ct ciphertext buffers
+ * \param[in] iovcnt number of buffers in pt and ct
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_decryptv(struct zpc_aes_gcm *ctx, const struct iovec *pt,
+    const unsigned char *mac, size_t maclen, const unsigned char *aad,
+    size_t aadlen, const struct iovec *ct, int iovcnt);
+/**
+ * Message of an AES-GCM batch operation, see zpc_aes_gcm_seal_batch and
+ * zpc_aes_gcm_open_batch.
+ */
+struct zpc_aes_gcm_msg {
+	const unsigned char *iv;	/**< initialization vector */
+	size_t ivlen;			/**< initialization vector length [bytes] */
+	const unsigned char *aad;	/**< additional authenticated data */
+	size_t aadlen;			/**< additional authenticated data length [bytes] */
+	const unsigned char *in;	/**< plaintext (seal) or ciphertext (open) */
+	unsigned char *out;		/**< ciphertext (seal) or plaintext (open) */
+	size_t len;			/**< plaintext/ciphertext length [bytes] */
+	unsigned char *tag;		/**< message authentication code, written by seal, read by open */
+	size_t taglen;			/**< message authentication code length [bytes] */
+	int rc;				/**< status of the message, set by the batch operation */
+};
+
+/**
+ * Do AES-GCM authenticated encryptions of independent messages in one call.
+ * Each message is encrypted as if by zpc_aes_gcm_set_iv followed by
+ * zpc_aes_gcm_encrypt with its own initialization vector, additional
+ * authenticated data and plaintext. The status of each message is stored
+ * in its rc member: ZPC_ERROR_ARG2NULL if one of its buffers is NULL
+ * although its length is non-zero, ZPC_ERROR_IVSIZE, ZPC_ERROR_TAGSIZE
+ * (the message authentication code is mandatory), ZPC_ERROR_AADLEN or
+ * ZPC_ERROR_MLEN for invalid lengths, or the error of the encryption.
+ * After the call, the context has no initialization vector set.
+ * \param[in,out] ctx AES-GCM context
+ * \param[in,out] msgs messages
+ * \param[in] nmsgs number of messages
+ * \return 0 if all messages were encrypted. If a context argument is
+ * invalid, its error code is returned and no message is processed.
+ * Otherwise, the error code of the first failed message is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_seal_batch(struct zpc_aes_gcm *ctx,
+    struct zpc_aes_gcm_msg *msgs, size_t nmsgs);
+
+/**
+ * Do AES-GCM authenticated decryptions of independent messages in one call.
+ * Each message is decrypted and its message authentication code is verified
+ * as if by zpc_aes_gcm_set_iv followed by zpc_aes_gcm_decrypt. The status
+ * of each message is stored in its rc member as for zpc_aes_gcm_seal_batch,
+ * with ZPC_ERROR_CLEN for an invalid ciphertext length and
+ * ZPC_ERROR_TAGMISMATCH if the message authentication code does not match.
+ * After the call, the context has no initialization vector set.
+ * \param[in,out] ctx AES-GCM context
+ * \param[in,out] msgs messages
+ * \param[in] nmsgs number of messages
+ * \return 0 if all messages were decrypted and verified. If a context
+ * argument is invalid, its error code is returned and no message is
+ * processed. Otherwise, the error code of the first failed message is
+ * returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_open_batch(struct zpc_aes_gcm *ctx,
+    struct zpc_aes_gcm_msg *msgs, size_t nmsgs);
+
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-GCM operation, see zpc/stats.h.
+ * \param[in] ctx AES-GCM context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_get_stats(const struct zpc_aes_gcm *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an AES-GCM operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * The copy continues where ctx stands, e.g. after a common prefix of
+ * additional authenticated data. An iv created by zpc_aes_gcm_create_iv
+ * is not copied. A caller-provided iv is, so at most one of the contexts
+ * may be used for encryption.
+ * \param[in,out] ctx new AES-GCM context
+ * \param[in] src AES-GCM context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gcm_dup(struct zpc_aes_gcm **ctx,
+    const struct zpc_aes_gcm *src);
 /**
  * Free an AES-CCM context.
  * \param[in,out] ctx AES-GCM context
@@ -0,0 +1,136 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef ZPC_AES_GMAC_H
+# define ZPC_AES_GMAC_H
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+# endif
+
+/**
+ * \file zpc/aes_gmac.h
+ *
+ * \brief AES-GMAC API
+ *
+ * Message authentication code API for the Advanced Encryption Standard (AES)
+ * block cipher \cite AES in Galois/Counter Mode mode of operation \cite GCM
+ * without encryption (GMAC): the message is the additional authenticated
+ * data of an AES-GCM operation with an empty plaintext.
+ *
+ * A message is authenticated by any number of zpc_aes_gmac_update() calls
+ * with chunks of any length, followed by zpc_aes_gmac_final() or
+ * zpc_aes_gmac_verify(). An initialization vector must be set for
+ * each message.
+ */
+
+# include <zpc/aes_key.h>
+# include <zpc/stats.h>
+# include <stddef.h>
+
+struct zpc_aes_gmac;
+
+/**
+ * Allocate a new context for an AES-GMAC operation.
+ * \param[in,out] ctx AES-GMAC context
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_alloc(struct zpc_aes_gmac **ctx);
+/**
+ * Set the key to be used in the context of an AES-GMAC operation.
+ * The initialization vector is unset.
+ * \param[in,out] ctx AES-GMAC context
+ * \param[in] key AES key
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_set_key(struct zpc_aes_gmac *ctx, struct zpc_aes_key *key);
+/**
+ * Set the initialization vector to be used in the context
+ * of an AES-GMAC operation and start a new message.
+ * The recommended iv length is 12 bytes.
+ * \param[in,out] ctx AES-GMAC context
+ * \param[in] iv initialization vector
+ * \param[in] ivlen initialization vector length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_set_iv(struct zpc_aes_gmac *ctx, const unsigned char *iv,
+    size_t ivlen);
+/**
+ * Authenticate the next chunk of a message. Chunks can be of any length.
+ * Whole blocks are processed from the caller's buffer; only a trailing
+ * partial block is kept in the context.
+ * \param[in,out] ctx AES-GMAC context
+ * \param[in] msg message chunk
+ * \param[in] msglen message chunk length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_update(struct zpc_aes_gmac *ctx, const unsigned char *msg,
+    size_t msglen);
+/**
+ * Complete a message and compute its message authentication code.
+ * The initialization vector is unset.
+ * \param[in,out] ctx AES-GMAC context
+ * \param[out] mac message authentication code
+ * \param[in] maclen message authentication code length [bytes]:
+ * 4, 8 or 12 to 16
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_final(struct zpc_aes_gmac *ctx, unsigned char *mac,
+    size_t maclen);
+/**
+ * Complete a message and verify its message authentication code.
+ * The initialization vector is unset.
+ * \param[in,out] ctx AES-GMAC context
+ * \param[in] mac message authentication code
+ * \param[in] maclen message authentication code length [bytes]:
+ * 4, 8 or 12 to 16
+ * \return 0 if the message authentication code is valid,
+ * ZPC_ERROR_TAGMISMATCH if it is not. Otherwise, a non-zero error code
+ * is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_verify(struct zpc_aes_gmac *ctx, const unsigned char *mac,
+    size_t maclen);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-GMAC operation, see zpc/stats.h.
+ * \param[in] ctx AES-GMAC context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_get_stats(const struct zpc_aes_gmac *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an AES-GMAC operation. The copy
+ * holds its own key reference and continues the message where ctx stands.
+ * \param[in,out] ctx new AES-GMAC context
+ * \param[in] src AES-GMAC context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_gmac_dup(struct zpc_aes_gmac **ctx,
+    const struct zpc_aes_gmac *src);
+/**
+ * Free an AES-GMAC context.
+ * \param[in,out] ctx AES-GMAC context
+ */
+__attribute__((visibility("default")))
+void zpc_aes_gmac_free(struct zpc_aes_gmac **ctx);
+
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+# endif
+#endif
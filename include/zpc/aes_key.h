@@ -141,6 +141,35 @@ int zpc_aes_key_generate(struct zpc_aes_key *key);
  */
 __attribute__((visibility("default")))
 int zpc_aes_key_reencipher(struct zpc_aes_key *key, int reenc);
+/**
+ * Enable or disable non-blocking protected key re-derivation.
+ * \param[in,out] key AES key
+ * \param[in] nonblock non-zero to enable, zero to disable
+ * When the protected key of a key in non-blocking mode has to be
+ * re-derived (e.g. after a wrapping key change), an operation on a context
+ * using the key queues the re-derivation to a background thread and returns
+ * ZPC_ERROR_AGAIN instead of waiting for the crypto cards. Contexts that
+ * do not need the new protected key are not held up meanwhile. Repeat the
+ * operation when the file descriptor from zpc_aes_key_get_eventfd() is
+ * readable. If the re-derivation failed, operations return its error until
+ * a backoff time that grows with each consecutive failure has passed.
+ * Operations that may have written output already when the protected key
+ * turns out to be outdated, such as those split across threads (see
+ * zpc_parallel_set_threads()), wait for the re-derivation instead.
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_key_set_nonblock(struct zpc_aes_key *key, int nonblock);
+/**
+ * Get an eventfd(2) file descriptor that becomes readable when a
+ * background re-derivation of the key's protected key has ended.
+ * \param[in,out] key AES key
+ * \param[out] fd file descriptor, owned by the key. It is reset when the
+ *     next background re-derivation is queued.
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_key_get_eventfd(struct zpc_aes_key *key, int *fd);
 /**
  * Decrease the reference count of an AES key object
  * and free it the count reaches 0.
@@ -24,7 +24,9 @@ extern "C" {
  */
 
 # include <zpc/aes_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
+# include <sys/uio.h>
 
 struct zpc_aes_xts;
 
@@ -96,6 +98,91 @@ int zpc_aes_xts_encrypt(struct zpc_aes_xts *ctx, unsigned char *ct,
 __attribute__((visibility("default")))
 int zpc_aes_xts_decrypt(struct zpc_aes_xts *ctx, unsigned char *pt,
     const unsigned char *ct, size_t ctlen);
+/**
+ * Do an AES-XTS encryption operation on a plaintext scattered over
+ * several buffers, as zpc_aes_xts_encrypt would do on the concatenated
+ * buffers. The ciphertext is written to the buffers of ct, whose total
+ * length must equal that of pt. Blocks that span buffers are handled
+ * internally, so the buffers can be of any length. The total length must be at least 16 bytes; a final partial block is handled by ciphertext stealing.
+ * \param[in,out] ctx AES-XTS context
+ * \param[out] ct ciphertext buffers
+ * \param[in] pt plaintext buffers
+ * \param[in] iovcnt number of buffers in ct and pt
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_encryptv(struct zpc_aes_xts *ctx, const struct iovec *ct,
+    const struct iovec *pt, int iovcnt);
+/**
+ * Do an AES-XTS decryption operation on a ciphertext scattered over
+ * several buffers, as zpc_aes_xts_decrypt would do on the concatenated
+ * buffers. The plaintext is written to the buffers of pt, whose total
+ * length must equal that of ct.
+ * \param[in,out] ctx AES-XTS context
+ * \param[out] pt plaintext buffers
+ * \param[in] ct ciphertext buffers
+ * \param[in] iovcnt number of buffers in pt and ct
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_decryptv(struct zpc_aes_xts *ctx, const struct iovec *pt,
+    const struct iovec *ct, int iovcnt);
+/**
+ * Do AES-XTS encryption operations on consecutive sectors, as
+ * zpc_aes_xts_set_iv and zpc_aes_xts_encrypt would do on each sector.
+ * The iv of a sector is its sector number, encoded as 16 byte
+ * little-endian integer. No iv needs to be set before; the context's
+ * iv is left as after the last sector.
+ * \param[in,out] ctx AES-XTS context
+ * \param[out] ct ciphertext, nsectors * sector_size bytes
+ * \param[in] pt plaintext, nsectors * sector_size bytes
+ * \param[in] sector_size sector length [bytes], at least 16
+ * \param[in] first_sector number of the first sector
+ * \param[in] nsectors number of sectors
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_encrypt_sectors(struct zpc_aes_xts *ctx, unsigned char *ct,
+    const unsigned char *pt, size_t sector_size,
+    unsigned long long first_sector, size_t nsectors);
+/**
+ * Do AES-XTS decryption operations on consecutive sectors, as
+ * zpc_aes_xts_set_iv and zpc_aes_xts_decrypt would do on each sector.
+ * The iv of a sector is its sector number, encoded as 16 byte
+ * little-endian integer.
+ * \param[in,out] ctx AES-XTS context
+ * \param[out] pt plaintext, nsectors * sector_size bytes
+ * \param[in] ct ciphertext, nsectors * sector_size bytes
+ * \param[in] sector_size sector length [bytes], at least 16
+ * \param[in] first_sector number of the first sector
+ * \param[in] nsectors number of sectors
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_decrypt_sectors(struct zpc_aes_xts *ctx, unsigned char *pt,
+    const unsigned char *ct, size_t sector_size,
+    unsigned long long first_sector, size_t nsectors);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-XTS operation, see zpc/stats.h.
+ * \param[in] ctx AES-XTS context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_get_stats(const struct zpc_aes_xts *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an AES-XTS operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * The copy continues where ctx stands (tweak).
+ * \param[in,out] ctx new AES-XTS context
+ * \param[in] src AES-XTS context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_dup(struct zpc_aes_xts **ctx,
+    const struct zpc_aes_xts *src);
 /**
  * Free an AES-XTS context.
  * \param[in,out] ctx AES-XTS context
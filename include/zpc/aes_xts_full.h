@@ -29,6 +29,7 @@ extern "C" {
  */
 
 # include "aes_xts_key.h"
+# include "stats.h"
 # include <stddef.h>
 
 struct zpc_aes_xts_full;
@@ -100,6 +101,51 @@ int zpc_aes_xts_full_encrypt(struct zpc_aes_xts_full *ctx, unsigned char *ct,
 __attribute__((visibility("default")))
 int zpc_aes_xts_full_decrypt(struct zpc_aes_xts_full *ctx, unsigned char *pt,
     const unsigned char *ct, size_t ctlen);
+/**
+ * Do AES-XTS encryption operations on consecutive sectors, as
+ * zpc_aes_xts_full_set_iv and zpc_aes_xts_full_encrypt would do on each
+ * sector. The iv of a sector is its sector number, encoded as 16 byte
+ * little-endian integer. No iv needs to be set before; the context's
+ * state is left as after the last sector.
+ * \param[in,out] ctx AES-FULL-XTS context
+ * \param[out] ct ciphertext, nsectors * sector_size bytes
+ * \param[in] pt plaintext, nsectors * sector_size bytes
+ * \param[in] sector_size sector length [bytes], at least 16
+ * \param[in] first_sector number of the first sector
+ * \param[in] nsectors number of sectors
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_full_encrypt_sectors(struct zpc_aes_xts_full *ctx,
+    unsigned char *ct, const unsigned char *pt, size_t sector_size,
+    unsigned long long first_sector, size_t nsectors);
+/**
+ * Do AES-XTS decryption operations on consecutive sectors, as
+ * zpc_aes_xts_full_set_iv and zpc_aes_xts_full_decrypt would do on each
+ * sector. The iv of a sector is its sector number, encoded as 16 byte
+ * little-endian integer.
+ * \param[in,out] ctx AES-FULL-XTS context
+ * \param[out] pt plaintext, nsectors * sector_size bytes
+ * \param[in] ct ciphertext, nsectors * sector_size bytes
+ * \param[in] sector_size sector length [bytes], at least 16
+ * \param[in] first_sector number of the first sector
+ * \param[in] nsectors number of sectors
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_full_decrypt_sectors(struct zpc_aes_xts_full *ctx,
+    unsigned char *pt, const unsigned char *ct, size_t sector_size,
+    unsigned long long first_sector, size_t nsectors);
+/**
+ * Get the statistics of the operations done in the context
+ * of an AES-XTS-FULL operation, see zpc/stats.h.
+ * \param[in] ctx AES-XTS-FULL context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_aes_xts_full_get_stats(const struct zpc_aes_xts_full *ctx,
+    struct zpc_stats_counters *stats);
 /**
  * Free an AES-FULL-XTS context.
  * \param[in,out] ctx AES-FULL-XTS context
@@ -0,0 +1,117 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef ZPC_CTX_POOL_H
+# define ZPC_CTX_POOL_H
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+# endif
+
+/**
+ * \file zpc/ctx_pool.h
+ *
+ * \brief Context pool API
+ *
+ * A context pool hands out contexts of one type that already have the
+ * pool's key set, so a short-lived (e.g. per-request) context costs
+ * neither an allocation nor a key set operation. A released context's
+ * iv and streaming state are reset, its key is kept.
+ *
+ * Each thread keeps its own list of free contexts per pool, so
+ * zpc_ctx_pool_acquire() and zpc_ctx_pool_release() do not take locks
+ * in the common case. A context may be released by a different thread
+ * than the one that acquired it.
+ *
+ * Pooled contexts must not be freed with the context type's free
+ * function and their key must not be changed.
+ */
+
+# include <zpc/aes_key.h>
+# include <zpc/hmac_key.h>
+# include <zpc/ecc_key.h>
+# include <stddef.h>
+
+struct zpc_ctx_pool;
+
+/**
+ * Context types of a context pool.
+ */
+typedef enum {
+	ZPC_CTX_POOL_AES_ECB = 0,	/**< struct zpc_aes_ecb */
+	ZPC_CTX_POOL_AES_CBC,		/**< struct zpc_aes_cbc */
+	ZPC_CTX_POOL_AES_CMAC,		/**< struct zpc_aes_cmac */
+	ZPC_CTX_POOL_AES_CCM,		/**< struct zpc_aes_ccm */
+	ZPC_CTX_POOL_AES_GCM,		/**< struct zpc_aes_gcm */
+	ZPC_CTX_POOL_HMAC,		/**< struct zpc_hmac */
+	ZPC_CTX_POOL_ECDSA,		/**< struct zpc_ecdsa_ctx */
+} zpc_ctx_pool_type_t;
+
+/**
+ * Allocate a pool of AES contexts.
+ * \param[in,out] pool context pool
+ * \param[in] type one of ZPC_CTX_POOL_AES_ECB, ZPC_CTX_POOL_AES_CBC,
+ * ZPC_CTX_POOL_AES_CMAC, ZPC_CTX_POOL_AES_CCM or ZPC_CTX_POOL_AES_GCM
+ * \param[in] key AES key set in the pool's contexts
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ctx_pool_alloc_aes(struct zpc_ctx_pool **pool,
+    zpc_ctx_pool_type_t type, struct zpc_aes_key *key);
+/**
+ * Allocate a pool of HMAC contexts.
+ * \param[in,out] pool context pool
+ * \param[in] key HMAC key set in the pool's contexts
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ctx_pool_alloc_hmac(struct zpc_ctx_pool **pool,
+    struct zpc_hmac_key *key);
+/**
+ * Allocate a pool of ECDSA contexts.
+ * \param[in,out] pool context pool
+ * \param[in] key EC key set in the pool's contexts
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ctx_pool_alloc_ecdsa(struct zpc_ctx_pool **pool,
+    struct zpc_ec_key *key);
+/**
+ * Acquire a context from a pool. A new context is allocated if the pool
+ * has no free context.
+ * \param[in] pool context pool
+ * \param[out] ctx context of the pool's type, with the pool's key set
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ctx_pool_acquire(struct zpc_ctx_pool *pool, void **ctx);
+/**
+ * Release a context acquired from a pool. The context's iv and
+ * streaming state are reset.
+ * \param[in] pool context pool
+ * \param[in] ctx context acquired from pool
+ * \return 0 on success. ZPC_ERROR_ARG2RANGE if ctx was not acquired from
+ * pool, has been released already or its key was changed. Otherwise, a
+ * non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ctx_pool_release(struct zpc_ctx_pool *pool, void *ctx);
+/**
+ * Free a context pool and all its contexts. Contexts acquired from the
+ * pool must have been released.
+ * \param[in,out] pool context pool
+ */
+__attribute__((visibility("default")))
+void zpc_ctx_pool_free(struct zpc_ctx_pool **pool);
+
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+# endif
+#endif
@@ -23,6 +23,7 @@ extern "C" {
  */
 
 # include <zpc/ecc_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
 
 struct zpc_ecdsa_ctx;
@@ -75,6 +76,112 @@ int zpc_ecdsa_verify(struct zpc_ecdsa_ctx *ctx,
 				const unsigned char *hash, unsigned int hash_len,
 				const unsigned char *signature, unsigned int sig_len);
 
+/**
+ * Do an ECDSA sign operation on a message. For the p256, p384 and p521
+ * curves the message is hashed with SHA-256, SHA-384 and SHA-512
+ * respectively, and the digest is signed as by zpc_ecdsa_sign. For the
+ * ed25519 and ed448 curves the message is passed to zpc_ecdsa_sign as is.
+ * \param[in,out] ctx ECDSA context
+ * \param[in] msg message to sign
+ * \param[in] msg_len message length [bytes]
+ * \param[out] signature signature
+ * \param[in,out] *sig_len address of signature length field [bytes]
+ *             On input, the application must specify the buffer length
+ *             to receive the signature [bytes]. If signature is NULL,
+ *             only the length of the signature is returned.
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_sign_message(struct zpc_ecdsa_ctx *ctx,
+				const unsigned char *msg, size_t msg_len,
+				unsigned char *signature, unsigned int *sig_len);
+
+/**
+ * Do an ECDSA verify operation on a message, hashed as by
+ * zpc_ecdsa_sign_message.
+ * \param[in,out] ctx ECDSA context
+ * \param[in] msg message to verify
+ * \param[in] msg_len message length [bytes]
+ * \param[in] signature signature to verify
+ * \param[in] sig_len signature length
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_verify_message(struct zpc_ecdsa_ctx *ctx,
+				const unsigned char *msg, size_t msg_len,
+				const unsigned char *signature, unsigned int sig_len);
+
+/**
+ * Start hashing a message streamed in chunks of any length for an ECDSA
+ * sign or verify operation, discarding a message started before. The
+ * hash function is the one of zpc_ecdsa_sign_message. Only the p256,
+ * p384 and p521 curves are supported: EdDSA signs the message itself.
+ * A first zpc_ecdsa_message_update starts a message implicitly.
+ * \param[in,out] ctx ECDSA context
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_message_init(struct zpc_ecdsa_ctx *ctx);
+
+/**
+ * Hash the next chunk of a streamed message.
+ * \param[in,out] ctx ECDSA context
+ * \param[in] msg message chunk
+ * \param[in] msg_len message chunk length [bytes]
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_message_update(struct zpc_ecdsa_ctx *ctx,
+				const unsigned char *msg, size_t msg_len);
+
+/**
+ * Finish hashing a streamed message and sign the digest. The message
+ * is kept if signature is NULL or the buffer is too small.
+ * \param[in,out] ctx ECDSA context
+ * \param[out] signature signature
+ * \param[in,out] *sig_len address of signature length field [bytes]
+ *             On input, the application must specify the buffer length
+ *             to receive the signature [bytes]. If signature is NULL,
+ *             only the length of the signature is returned.
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_sign_message_final(struct zpc_ecdsa_ctx *ctx,
+				unsigned char *signature, unsigned int *sig_len);
+
+/**
+ * Finish hashing a streamed message and verify the signature of the
+ * digest.
+ * \param[in,out] ctx ECDSA context
+ * \param[in] signature signature to verify
+ * \param[in] sig_len signature length
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_verify_message_final(struct zpc_ecdsa_ctx *ctx,
+				const unsigned char *signature, unsigned int sig_len);
+
+/**
+ * Get the statistics of the operations done in the context
+ * of an ECDSA operation, see zpc/stats.h.
+ * \param[in] ctx ECDSA context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_ctx_get_stats(const struct zpc_ecdsa_ctx *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an ECDSA operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * \param[in,out] ctx new ECDSA context
+ * \param[in] src ECDSA context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_ecdsa_ctx_dup(struct zpc_ecdsa_ctx **ctx,
+    const struct zpc_ecdsa_ctx *src);
+
 /**
  * Free an ECDSA context.
  * \param[in,out] ctx ECDSA context
@@ -523,6 +523,32 @@ extern "C" {
  */
 # define ZPC_ERROR_XTS_KEYGEN_VIA_SYSFS                86
 
+/**
+ * \def ZPC_ERROR_AGAIN
+ * \brief The protected key is being re-derived in the background.
+ * Repeat the operation when the key's event file descriptor is readable.
+ */
+# define ZPC_ERROR_AGAIN                               87
+
+/**
+ * \def ZPC_ERROR_GCM_IV_EXHAUSTED
+ * \brief The invocation counter of a gcm context with a fixed iv field
+ * is exhausted.
+ */
+# define ZPC_ERROR_GCM_IV_EXHAUSTED                    88
+
+/**
+ * \def ZPC_ERROR_CCM_STATE
+ * \brief The call does not fit the state of a multi-part ccm operation.
+ */
+# define ZPC_ERROR_CCM_STATE                           89
+
+/**
+ * \def ZPC_ERROR_PADDING
+ * \brief Invalid PKCS#7 padding.
+ */
+# define ZPC_ERROR_PADDING                             90
+
 /**
  * \fn const char *zpc_error_string(int err)
  * \brief Map an error code to the corresponding error string.
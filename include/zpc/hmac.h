@@ -23,7 +23,9 @@ extern "C" {
  */
 
 # include <zpc/hmac_key.h>
+# include <zpc/stats.h>
 # include <stddef.h>
+# include <sys/uio.h>
 
 struct zpc_hmac;
 
@@ -49,7 +51,9 @@ int zpc_hmac_set_key(struct zpc_hmac *ctx, struct zpc_hmac_key *key);
  * indicates that an internal intermediate MAC is calculated and further
  * intermediate calls with additional msg data may follow. If the mac parm is
  * not NULL and the maclen is a valid MAC length (dependent on the underlying
- * hash function of the key) the final MAC is computed.
+ * hash function of the key) the final MAC is computed. Intermediate
+ * chunks can be of any length: whole blocks are processed from the
+ * caller's buffer, only a trailing partial block is kept in the context.
  * \param[in] maclen message authentication code length [bytes]
  * \param[in] msg message
  * \param[in] msglen message length [bytes]
@@ -73,6 +77,108 @@ int zpc_hmac_sign(struct zpc_hmac *ctx, unsigned char *mac,
 __attribute__((visibility("default")))
 int zpc_hmac_verify(struct zpc_hmac *ctx, const unsigned char *mac,
     size_t maclen, const unsigned char *msg, size_t msglen);
+/**
+ * Do an HMAC signing operation on a message scattered over several
+ * buffers, as zpc_hmac_sign would do on the concatenated buffers. Blocks
+ * that span buffers are handled internally, so the buffers can be of any
+ * length.
+ * \param[in,out] ctx HMAC context
+ * \param[in,out] mac message authentication code, NULL for an intermediate
+ * operation (see zpc_hmac_sign)
+ * \param[in] maclen message authentication code length [bytes]
+ * \param[in] msg message buffers
+ * \param[in] iovcnt number of message buffers
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_hmac_signv(struct zpc_hmac *ctx, unsigned char *mac,
+    size_t maclen, const struct iovec *msg, int iovcnt);
+/**
+ * Do an HMAC verify operation on a message scattered over several
+ * buffers, as zpc_hmac_verify would do on the concatenated buffers.
+ * \param[in,out] ctx HMAC context
+ * \param[in] mac message authentication code, NULL for an intermediate
+ * operation (see zpc_hmac_verify)
+ * \param[in] maclen message authentication code length [bytes]
+ * \param[in] msg message buffers
+ * \param[in] iovcnt number of message buffers
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_hmac_verifyv(struct zpc_hmac *ctx, const unsigned char *mac,
+    size_t maclen, const struct iovec *msg, int iovcnt);
+/**
+ * Message of an HMAC batch operation, see zpc_hmac_sign_batch and
+ * zpc_hmac_verify_batch.
+ */
+struct zpc_hmac_msg {
+	const unsigned char *msg;	/**< message */
+	size_t msglen;			/**< message length [bytes] */
+	unsigned char *mac;		/**< message authentication code, written by sign, read by verify */
+};
+
+/**
+ * Compute the message authentication codes of independent short messages
+ * in one call, as if by one zpc_hmac_sign call per message. The
+ * context is checked once and its protected key is reused for all
+ * messages. A message started by intermediate zpc_hmac_sign calls
+ * is discarded.
+ * \param[in,out] ctx HMAC context
+ * \param[in] msgs messages
+ * \param[in] nmsgs number of messages
+ * \param[in] maclen message authentication code length of all
+ * messages [bytes] (see zpc_hmac_sign)
+ * \return 0 on success. ZPC_ERROR_ARG2NULL if a message buffer is NULL
+ * although its length is non-zero or a mac buffer is NULL, in which case
+ * no message is processed. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_hmac_sign_batch(struct zpc_hmac *ctx,
+    const struct zpc_hmac_msg *msgs, size_t nmsgs, size_t maclen);
+/**
+ * Verify the message authentication codes of independent short messages
+ * in one call, as if by one zpc_hmac_verify call per message. The
+ * context is checked once and its protected key is reused for all
+ * messages. A message started by intermediate zpc_hmac_sign calls
+ * is discarded.
+ * \param[in,out] ctx HMAC context
+ * \param[in] msgs messages
+ * \param[in] nmsgs number of messages
+ * \param[in] maclen message authentication code length of all
+ * messages [bytes] (see zpc_hmac_sign)
+ * \param[out] valid bitmap of (nmsgs + 7) / 8 bytes: bit i % 8 (least
+ * significant first) of byte i / 8 is set if the message authentication
+ * code of message i is valid
+ * \return 0 if all message authentication codes are valid,
+ * ZPC_ERROR_TAGMISMATCH if at least one is not, ZPC_ERROR_ARG2NULL as for
+ * zpc_hmac_sign_batch. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_hmac_verify_batch(struct zpc_hmac *ctx,
+    const struct zpc_hmac_msg *msgs, size_t nmsgs, size_t maclen,
+    unsigned char *valid);
+/**
+ * Get the statistics of the operations done in the context
+ * of an HMAC operation, see zpc/stats.h.
+ * \param[in] ctx HMAC context
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_hmac_get_stats(const struct zpc_hmac *ctx,
+    struct zpc_stats_counters *stats);
+/**
+ * Allocate a copy of a context of an HMAC operation. The copy
+ * holds its own key reference and needs no key set operation.
+ * The copy continues where ctx stands, e.g. after a common message
+ * prefix.
+ * \param[in,out] ctx new HMAC context
+ * \param[in] src HMAC context to copy
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_hmac_dup(struct zpc_hmac **ctx,
+    const struct zpc_hmac *src);
 /**
  * Free an HMAC context.
  * \param[in,out] ctx HMAC context
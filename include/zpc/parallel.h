@@ -0,0 +1,57 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef ZPC_PARALLEL_H
+# define ZPC_PARALLEL_H
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+# endif
+
+/**
+ * \file zpc/parallel.h
+ *
+ * \brief Parallel bulk operations API
+ *
+ * The library can spread large AES-ECB operations, AES-CBC decryption
+ * operations and AES-XTS operations (including the multi-sector ones)
+ * over a pool of worker threads. An operation is split into chunks of
+ * a few hundred kilobytes. The calling thread and the workers take
+ * chunks until none are left, each with a private copy of the
+ * context's parameter block and the chunk's chaining value or tweak.
+ * The results and the context's state afterwards are the same as
+ * without the pool.
+ *
+ * The pool is off by default. Operations shorter than two chunks
+ * always run on the calling thread only.
+ */
+
+/**
+ * Set the number of worker threads of the library's thread pool.
+ * Running workers are stopped first. Operations in progress are
+ * completed by their calling threads.
+ * \param[in] nthreads number of worker threads, at most 256.
+ * 0 turns the pool off.
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_parallel_set_threads(unsigned int nthreads);
+/**
+ * Get the number of worker threads of the library's thread pool.
+ * \param[out] nthreads number of worker threads, 0 if the pool is off
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_parallel_get_threads(unsigned int *nthreads);
+
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+# endif
+#endif
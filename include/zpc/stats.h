@@ -0,0 +1,150 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef ZPC_STATS_H
+# define ZPC_STATS_H
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+# endif
+
+/**
+ * \file zpc/stats.h
+ *
+ * \brief Statistics API
+ *
+ * Counters and latency histograms of the library's hot paths.
+ *
+ * Statistics are disabled by default. They are enabled by setting the
+ * environment variable ZPC_STATS to a non-zero value or by calling
+ * zpc_stats_enable(). While enabled, each thread updates its own
+ * counters, so collecting them does not serialize threads. The
+ * contexts of the AES, HMAC and ECDSA APIs additionally count the
+ * events caused by their own operations, see e.g. zpc_aes_gcm_get_stats().
+ */
+
+# include <stddef.h>
+
+/**
+ * Operation types for which calls, bytes and latencies are recorded.
+ */
+typedef enum {
+	ZPC_STATS_OP_AES_ECB = 0,
+	ZPC_STATS_OP_AES_CBC,
+	ZPC_STATS_OP_AES_XTS,
+	ZPC_STATS_OP_AES_XTS_FULL,
+	ZPC_STATS_OP_AES_CMAC,
+	ZPC_STATS_OP_AES_CCM,
+	ZPC_STATS_OP_AES_GCM,
+	ZPC_STATS_OP_HMAC,
+	ZPC_STATS_OP_ECDSA_SIGN,
+	ZPC_STATS_OP_ECDSA_VERIFY,
+	ZPC_STATS_OP_AES_CTR,
+	ZPC_STATS_OP_AES_GMAC,
+	ZPC_STATS_OP_NMEMB
+} zpc_stats_op_t;
+
+/**
+ * Number of sub-buckets per power of two of a latency histogram.
+ */
+# define ZPC_STATS_HIST_SUB_BUCKETS	8
+/**
+ * Number of buckets of a latency histogram.
+ *
+ * Latencies are recorded in nanoseconds into log-linear buckets:
+ * values below ZPC_STATS_HIST_SUB_BUCKETS have a bucket each, every
+ * following power of two is split into ZPC_STATS_HIST_SUB_BUCKETS
+ * equally sized buckets, so the relative error of a recorded value is
+ * at most 12.5 percent. The last bucket also counts all larger values.
+ */
+# define ZPC_STATS_HIST_BUCKETS		320
+
+/**
+ * Event counters.
+ */
+struct zpc_stats_counters {
+	unsigned long long ops;		/**< completed operations */
+	unsigned long long bytes;	/**< bytes processed by operations */
+	unsigned long long cpacf_calls;	/**< CPACF instructions issued */
+	unsigned long long cpacf_partial;	/**< CPACF partial completions */
+	unsigned long long wkvp_mismatch;	/**< wrapping key verification
+						   pattern mismatches */
+	unsigned long long rederive;	/**< protected key re-derivations */
+	unsigned long long ioctl_retries;	/**< pkey requests repeated
+						   after EBUSY/EAGAIN */
+	unsigned long long ioctl_sleeps;	/**< sleeps before repeating
+						   a pkey request */
+	unsigned long long lock_waits;	/**< key lock acquisitions that had
+					   to wait */
+	unsigned long long lock_wait_ns;	/**< time spent waiting for
+						   key locks [ns] */
+};
+
+/**
+ * Statistics of an operation type.
+ */
+struct zpc_stats_op {
+	unsigned long long calls;	/**< completed operations */
+	unsigned long long bytes;	/**< bytes processed */
+	unsigned long long latency[ZPC_STATS_HIST_BUCKETS];	/**< latency
+								   histogram */
+};
+
+/**
+ * Library-wide statistics.
+ */
+struct zpc_stats {
+	struct zpc_stats_counters total;	/**< counters of all threads */
+	struct zpc_stats_op op[ZPC_STATS_OP_NMEMB];	/**< per operation
+							   type */
+};
+
+/**
+ * Enable or disable the collection of statistics.
+ * \param[in] enable non-zero to enable, zero to disable
+ * \return the previous setting
+ */
+__attribute__((visibility("default")))
+int zpc_stats_enable(int enable);
+/**
+ * Get the library-wide statistics collected since the library was loaded
+ * or since the last call to zpc_stats_reset().
+ * \param[out] stats statistics
+ * \return 0 on success. Otherwise, a non-zero error code is returned.
+ */
+__attribute__((visibility("default")))
+int zpc_stats_get(struct zpc_stats *stats);
+/**
+ * Reset the library-wide statistics.
+ */
+__attribute__((visibility("default")))
+void zpc_stats_reset(void);
+/**
+ * Get the smallest value a latency histogram bucket counts.
+ * \param[in] bucket bucket index
+ * \return the bucket's lower bound [ns]
+ */
+__attribute__((visibility("default")))
+unsigned long long zpc_stats_hist_value(unsigned int bucket);
+/**
+ * Get a percentile of a latency histogram.
+ * \param[in] hist histogram of ZPC_STATS_HIST_BUCKETS buckets
+ * \param[in] percentile percentile in [0, 100]
+ * \return the lower bound of the bucket containing the percentile [ns],
+ * or 0 if the histogram is empty
+ */
+__attribute__((visibility("default")))
+unsigned long long zpc_stats_hist_percentile(const unsigned long long *hist,
+    double percentile);
+
+# ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+# endif
+#endif
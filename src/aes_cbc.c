@@ -14,7 +14,10 @@
 #include "aes_key_local.h"
 #include "cpacf.h"
 #include "globals.h"
+#include "iov.h"
 #include "misc.h"
+#include "parallel.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
@@ -27,9 +30,28 @@
 static void __aes_cbc_set_iv(struct zpc_aes_cbc *, const u8 iv[16]);
 static int __aes_cbc_crypt(struct zpc_aes_cbc *, u8 *, const u8 *, size_t,
     unsigned long);
+static int __aes_cbc_cryptv(struct zpc_aes_cbc *, const struct iovec *,
+    const struct iovec *, int, unsigned long);
+static int __aes_cbc_crypt_iov(void *, u8 *, const u8 *, size_t, int);
+static int __aes_cbc_decrypt_par(struct zpc_aes_cbc *, u8 *, const u8 *,
+    size_t, size_t);
+static int __aes_cbc_decrypt_chunk(void *, size_t);
 static void __aes_cbc_reset(struct zpc_aes_cbc *);
 static void __aes_cbc_reset_iv(struct zpc_aes_cbc *);
 
+struct aes_cbc_iov {
+	struct zpc_aes_cbc *aes_cbc;
+	unsigned long flags;
+	int wait;	/* output was written, see aes_key_update_prot_wait */
+};
+
+struct aes_cbc_par {
+	const struct zpc_aes_cbc *aes_cbc;
+	u8 *out;
+	const u8 *in;
+	const u8 *cv;	/* chaining value of each chunk */
+};
+
 int
 zpc_aes_cbc_alloc(struct zpc_aes_cbc **aes_cbc)
 {
@@ -69,9 +91,7 @@ zpc_aes_cbc_alloc(struct zpc_aes_cbc **aes_cbc)
 int
 zpc_aes_cbc_set_key(struct zpc_aes_cbc *aes_cbc, struct zpc_aes_key *aes_key)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -99,9 +119,6 @@ zpc_aes_cbc_set_key(struct zpc_aes_cbc *aes_cbc, struct zpc_aes_key *aes_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
-	assert(rv == 0);
-
 	rc = aes_key_check(aes_key);
 	if (rc)
 		goto ret;
@@ -112,8 +129,7 @@ zpc_aes_cbc_set_key(struct zpc_aes_cbc *aes_cbc, struct zpc_aes_key *aes_key)
 		goto ret;
 	}
 
-	aes_key->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key, aes_key->refcount);
+	aes_key_ref(aes_key);
 
 	if (aes_cbc->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -127,7 +143,8 @@ zpc_aes_cbc_set_key(struct zpc_aes_cbc *aes_cbc, struct zpc_aes_key *aes_key)
 
 	DEBUG("aes-cbc context at %p: key at %p set", aes_cbc, aes_key);
 
-	memcpy(aes_cbc->param.protkey, aes_key->prot.protkey, sizeof(aes_cbc->param.protkey));
+	aes_key_get_prot(aes_key, aes_cbc->param.protkey,
+	    sizeof(aes_cbc->param.protkey), &aes_cbc->key_gen);
 
 	aes_cbc->fc = CPACF_KMC_ENCRYPTED_AES_128 + (aes_key->keysize - 128) / 64;
 
@@ -136,8 +153,6 @@ zpc_aes_cbc_set_key(struct zpc_aes_cbc *aes_cbc, struct zpc_aes_key *aes_key)
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&aes_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -266,11 +281,9 @@ zpc_aes_cbc_encrypt(struct zpc_aes_cbc *aes_cbc, u8 * c, const u8 * m,
     size_t mlen)
 {
 	struct cpacf_kmc_aes_param *param;
-	struct pkey_protkey *protkey;
 	unsigned long flags = 0;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	int rc, i;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -307,11 +320,11 @@ zpc_aes_cbc_encrypt(struct zpc_aes_cbc *aes_cbc, u8 * c, const u8 * m,
 		goto ret;
 	}
 
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
 	rc = -1;
 	for (i = 0; i < 2 && rc != 0; i++) {
 		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
 
-		protkey = &aes_cbc->aes_key->prot;
 		param = &aes_cbc->param;
 
 		for (;;) {
@@ -324,17 +337,9 @@ zpc_aes_cbc_encrypt(struct zpc_aes_cbc *aes_cbc, u8 * c, const u8 * m,
 					goto ret;
 				}
 				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_cbc->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-cbc context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_cbc, i == 0 ? "current" : "old", aes_cbc->aes_key);
-					rc = aes_key_sec2prot(aes_cbc->aes_key, i);
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
-
-					rv = pthread_mutex_unlock(&aes_cbc->aes_key->lock);
-					assert(rv == 0);
+					rc = aes_key_update_prot(aes_cbc->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_cbc->key_gen);
 				}
 				if (rc)
 					break;
@@ -343,6 +348,7 @@ zpc_aes_cbc_encrypt(struct zpc_aes_cbc *aes_cbc, u8 * c, const u8 * m,
 	}
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -352,11 +358,10 @@ zpc_aes_cbc_decrypt(struct zpc_aes_cbc *aes_cbc, u8 * m, const u8 * c,
     size_t clen)
 {
 	struct cpacf_kmc_aes_param *param;
-	struct pkey_protkey *protkey;
 	unsigned long flags = CPACF_M;  /* decrypt */
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc, i;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -393,11 +398,17 @@ zpc_aes_cbc_decrypt(struct zpc_aes_cbc *aes_cbc, u8 * m, const u8 * c,
 		goto ret;
 	}
 
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
+	nchunks = par_nchunks(clen, PAR_CHUNK, 0);
+	if (nchunks > 0) {
+		rc = __aes_cbc_decrypt_par(aes_cbc, m, c, clen, nchunks);
+		goto ret;
+	}
+
 	rc = -1;
 	for (i = 0; i < 2 && rc != 0; i++) {
 		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
 
-		protkey = &aes_cbc->aes_key->prot;
 		param = &aes_cbc->param;
 
 		for (;;) {
@@ -410,17 +421,9 @@ zpc_aes_cbc_decrypt(struct zpc_aes_cbc *aes_cbc, u8 * m, const u8 * c,
 					goto ret;
 				}
 				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_cbc->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-cbc context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_cbc, i == 0 ? "current" : "old", aes_cbc->aes_key);
-					rc = aes_key_sec2prot(aes_cbc->aes_key, i);
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
-
-					rv = pthread_mutex_unlock(&aes_cbc->aes_key->lock);
-					assert(rv == 0);
+					rc = aes_key_update_prot(aes_cbc->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_cbc->key_gen);
 				}
 				if (rc)
 					break;
@@ -428,6 +431,410 @@ zpc_aes_cbc_decrypt(struct zpc_aes_cbc *aes_cbc, u8 * m, const u8 * c,
 		}
 	}
 
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_encryptv(struct zpc_aes_cbc *aes_cbc, const struct iovec *c,
+    const struct iovec *m, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_cbc_cryptv(aes_cbc, c, m, iovcnt, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_decryptv(struct zpc_aes_cbc *aes_cbc, const struct iovec *m,
+    const struct iovec *c, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_cbc_cryptv(aes_cbc, m, c, iovcnt, CPACF_M);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_encrypt_pad_update(struct zpc_aes_cbc *aes_cbc, u8 * c,
+    size_t *clen, const u8 * m, size_t mlen)
+{
+	struct aes_cbc_iov arg;
+	struct stats_op st = { 0 };
+	size_t n, len = 0;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_cbc) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_cbc == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (mlen > 0 && c == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (clen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
+
+	if (!aes_cbc->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_cbc->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	arg.aes_cbc = aes_cbc;
+	arg.flags = 0;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
+	if (aes_cbc->buflen + mlen < 16) {
+		if (mlen > 0)
+			memcpy(aes_cbc->buf + aes_cbc->buflen, m, mlen);
+		aes_cbc->buflen += mlen;
+		rc = 0;
+		goto ret;
+	}
+
+	if (aes_cbc->buflen > 0) {
+		n = 16 - aes_cbc->buflen;
+		memcpy(aes_cbc->buf + aes_cbc->buflen, m, n);
+		rc = __aes_cbc_crypt_iov(&arg, c, aes_cbc->buf, 16, 1);
+		if (rc)
+			goto ret;
+		aes_cbc->buflen = 0;
+		c += 16;
+		m += n;
+		mlen -= n;
+		len = 16;
+	}
+
+	n = mlen & ~(size_t)0xf;
+	rc = __aes_cbc_crypt_iov(&arg, c, m, n, 1);
+	if (rc)
+		goto ret;
+	len += n;
+
+	memcpy(aes_cbc->buf, m + n, mlen - n);
+	aes_cbc->buflen = mlen - n;
+ret:
+	if (rc == 0)
+		*clen = len;
+	stats_op_end(&st, len);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_encrypt_pad_final(struct zpc_aes_cbc *aes_cbc, u8 * c,
+    size_t *clen)
+{
+	struct aes_cbc_iov arg;
+	struct stats_op st = { 0 };
+	size_t padlen;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_cbc) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_cbc == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (c == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (clen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (!aes_cbc->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_cbc->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	arg.aes_cbc = aes_cbc;
+	arg.flags = 0;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
+	padlen = 16 - aes_cbc->buflen;
+	memset(aes_cbc->buf + aes_cbc->buflen, (int)padlen, padlen);
+	rc = __aes_cbc_crypt_iov(&arg, c, aes_cbc->buf, 16, 1);
+	if (rc)
+		goto ret;
+
+	memzero_secure(aes_cbc->buf, sizeof(aes_cbc->buf));
+	aes_cbc->buflen = 0;
+	*clen = 16;
+ret:
+	stats_op_end(&st, 16);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_decrypt_pad_update(struct zpc_aes_cbc *aes_cbc, u8 * m,
+    size_t *mlen, const u8 * c, size_t clen)
+{
+	struct aes_cbc_iov arg;
+	struct stats_op st = { 0 };
+	size_t n, keep, nchunks, len = 0;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_cbc) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_cbc == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (clen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (mlen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+	if (clen > 0 && c == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
+
+	if (!aes_cbc->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_cbc->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	arg.aes_cbc = aes_cbc;
+	arg.flags = CPACF_M;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
+	if (aes_cbc->buflen + clen <= 16) {
+		if (clen > 0)
+			memcpy(aes_cbc->buf + aes_cbc->buflen, c, clen);
+		aes_cbc->buflen += clen;
+		rc = 0;
+		goto ret;
+	}
+
+	/* The last block may hold the padding: keep it for final. */
+	keep = (aes_cbc->buflen + clen - 1) % 16 + 1;
+
+	if (aes_cbc->buflen > 0) {
+		n = 16 - aes_cbc->buflen;
+		memcpy(aes_cbc->buf + aes_cbc->buflen, c, n);
+		rc = __aes_cbc_crypt_iov(&arg, m, aes_cbc->buf, 16, 1);
+		if (rc)
+			goto ret;
+		aes_cbc->buflen = 0;
+		m += 16;
+		c += n;
+		clen -= n;
+		len = 16;
+	}
+
+	n = clen - keep;
+	nchunks = par_nchunks(n, PAR_CHUNK, 0);
+	if (nchunks > 0)
+		rc = __aes_cbc_decrypt_par(aes_cbc, m, c, n, nchunks);
+	else
+		rc = __aes_cbc_crypt_iov(&arg, m, c, n, 1);
+	if (rc)
+		goto ret;
+	len += n;
+
+	memcpy(aes_cbc->buf, c + n, keep);
+	aes_cbc->buflen = keep;
+ret:
+	if (rc == 0)
+		*mlen = len;
+	stats_op_end(&st, len);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_decrypt_pad_final(struct zpc_aes_cbc *aes_cbc, u8 * m,
+    size_t *mlen)
+{
+	struct aes_cbc_iov arg;
+	struct stats_op st = { 0 };
+	size_t len;
+	u8 tmp[16];
+	int rc, bad;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_cbc) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_cbc == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (m == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (mlen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (!aes_cbc->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_cbc->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+	if (aes_cbc->buflen != 16) {
+		rc = ZPC_ERROR_CLEN;
+		goto ret;
+	}
+
+	arg.aes_cbc = aes_cbc;
+	arg.flags = CPACF_M;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
+	rc = __aes_cbc_crypt_iov(&arg, tmp, aes_cbc->buf, 16, 1);
+	if (rc)
+		goto ret;
+
+	bad = pkcs7_unpad(tmp, &len);
+	memcpy(m, tmp, 16);
+	memzero_secure(tmp, sizeof(tmp));
+	memzero_secure(aes_cbc->buf, sizeof(aes_cbc->buf));
+	aes_cbc->buflen = 0;
+
+	*mlen = len;
+	rc = bad ? ZPC_ERROR_PADDING : 0;
+ret:
+	stats_op_end(&st, 16);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cbc_get_stats(const struct zpc_aes_cbc *aes_cbc,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_cbc == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&aes_cbc->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+/*
+ * Unset the iv, keep the key (context pool).
+ */
+void
+aes_cbc_reset_state(struct zpc_aes_cbc *aes_cbc)
+{
+	__aes_cbc_reset_iv(aes_cbc);
+	aes_cbc->iv_set = 0;
+}
+
+int
+zpc_aes_cbc_dup(struct zpc_aes_cbc **aes_cbc, const struct zpc_aes_cbc *src)
+{
+	struct zpc_aes_cbc *new_aes_cbc = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_cbc) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_cbc == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_aes_cbc = malloc(sizeof(*new_aes_cbc));
+	if (new_aes_cbc == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_aes_cbc, src, sizeof(*new_aes_cbc));
+	memset(&new_aes_cbc->stats, 0, sizeof(new_aes_cbc->stats));
+	memset(&new_aes_cbc->pool, 0, sizeof(new_aes_cbc->pool));
+
+	if (new_aes_cbc->key_set)
+		aes_key_ref(new_aes_cbc->aes_key);
+
+	DEBUG("aes-cbc context at %p: copy of %p", new_aes_cbc, src);
+	*aes_cbc = new_aes_cbc;
+	rc = 0;
 ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
@@ -463,6 +870,166 @@ __aes_cbc_set_iv(struct zpc_aes_cbc *aes_cbc, const u8 iv[16])
 	assert(iv != NULL);
 
 	memcpy(aes_cbc->param.cv, iv, 16);
+	aes_cbc->buflen = 0;
+}
+
+/* Argument checks and segment walk of encryptv and decryptv. */
+static int
+__aes_cbc_cryptv(struct zpc_aes_cbc *aes_cbc, const struct iovec *out,
+    const struct iovec *in, int iovcnt, unsigned long flags)
+{
+	struct aes_cbc_iov arg;
+	struct stats_op st = { 0 };
+	size_t inlen, outlen;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_cbc)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_cbc == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	if (iovcnt < 0)
+		return ZPC_ERROR_ARG4RANGE;
+	if (iovcnt > 0 && out == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (iovcnt > 0 && in == NULL)
+		return ZPC_ERROR_ARG3NULL;
+	if (iov_len(in, iovcnt, &inlen) != 0)
+		return ZPC_ERROR_ARG3RANGE;
+	if (iov_len(out, iovcnt, &outlen) != 0 || outlen != inlen)
+		return ZPC_ERROR_ARG2RANGE;
+	if (inlen % 16 != 0)
+		return (flags & CPACF_M) ? ZPC_ERROR_CLEN : ZPC_ERROR_MLEN;
+
+	if (!aes_cbc->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (!aes_cbc->iv_set)
+		return ZPC_ERROR_IVNOTSET;
+
+	arg.aes_cbc = aes_cbc;
+	arg.flags = flags;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_cbc->stats, ZPC_STATS_OP_AES_CBC);
+	rc = iov_walk(out, in, iovcnt, inlen, 16, 0, __aes_cbc_crypt_iov, &arg);
+	stats_op_end(&st, inlen);
+	return rc;
+}
+
+/* iov_walk callback: __aes_cbc_crypt with protected key re-derivation. */
+static int
+__aes_cbc_crypt_iov(void *p, u8 *out, const u8 *in, size_t inlen, int last)
+{
+	struct aes_cbc_iov *arg = p;
+	struct zpc_aes_cbc *aes_cbc = arg->aes_cbc;
+	struct cpacf_kmc_aes_param *param;
+	int rc, i;
+
+	UNUSED(last);
+
+	if (inlen == 0)
+		return 0;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_cbc->param;
+
+		for (;;) {
+			rc = __aes_cbc_crypt(aes_cbc, out, in, inlen, arg->flags);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_cbc->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH && arg->wait) {
+					rc = aes_key_update_prot_wait(
+					    aes_cbc->aes_key, i, param->protkey,
+					    sizeof(param->protkey),
+					    &aes_cbc->key_gen);
+				} else if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_cbc->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_cbc->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	if (rc == 0)
+		arg->wait = 1;
+	return rc;
+}
+
+/*
+ * Whole chunks on the thread pool, the rest on the calling thread.
+ * A chunk's chaining value is the last ciphertext block before it,
+ * which is saved first since the output may overwrite it.
+ * A chunk may fail after others wrote their output, so protected keys
+ * are re-derived in the calling threads even in non-blocking mode.
+ */
+static int
+__aes_cbc_decrypt_par(struct zpc_aes_cbc *aes_cbc, u8 *out, const u8 *in,
+    size_t inlen, size_t nchunks)
+{
+	struct aes_cbc_par par;
+	struct aes_cbc_iov arg;
+	size_t done = nchunks * PAR_CHUNK, i;
+	u8 *cv, last[16];
+	int rc;
+
+	arg.aes_cbc = aes_cbc;
+	arg.flags = CPACF_M;
+	arg.wait = 1;
+
+	cv = malloc(nchunks * 16);
+	if (cv == NULL)
+		return __aes_cbc_crypt_iov(&arg, out, in, inlen, 1);
+
+	memcpy(cv, aes_cbc->param.cv, 16);
+	for (i = 1; i < nchunks; i++)
+		memcpy(cv + i * 16, in + i * PAR_CHUNK - 16, 16);
+	memcpy(last, in + done - 16, 16);
+
+	par.aes_cbc = aes_cbc;
+	par.out = out;
+	par.in = in;
+	par.cv = cv;
+
+	rc = par_run(__aes_cbc_decrypt_chunk, &par, nchunks);
+	free(cv);
+	if (rc)
+		return rc;
+
+	memcpy(aes_cbc->param.cv, last, 16);
+	return __aes_cbc_crypt_iov(&arg, out + done, in + done, inlen - done, 1);
+}
+
+/* par_run callback: one chunk on a private copy of the context. */
+static int
+__aes_cbc_decrypt_chunk(void *p, size_t i)
+{
+	struct aes_cbc_par *par = p;
+	struct zpc_aes_cbc aes_cbc;
+	struct aes_cbc_iov arg;
+	int rc;
+
+	memcpy(&aes_cbc, par->aes_cbc, sizeof(aes_cbc));
+	memcpy(aes_cbc.param.cv, par->cv + i * 16, 16);
+	arg.aes_cbc = &aes_cbc;
+	arg.flags = CPACF_M;
+	arg.wait = 1;
+
+	rc = __aes_cbc_crypt_iov(&arg, par->out + i * PAR_CHUNK,
+	    par->in + i * PAR_CHUNK, PAR_CHUNK, 0);
+
+	memzero_secure(&aes_cbc.param, sizeof(aes_cbc.param));
+	return rc;
 }
 
 static int
@@ -509,5 +1076,7 @@ __aes_cbc_reset_iv(struct zpc_aes_cbc *aes_cbc)
 	assert(aes_cbc != NULL);
 
 	memset(aes_cbc->param.cv, 0, sizeof(aes_cbc->param.cv));
+	memzero_secure(aes_cbc->buf, sizeof(aes_cbc->buf));
+	aes_cbc->buflen = 0;
 	aes_cbc->iv_set = 0;
 }
@@ -11,6 +11,7 @@
 # include "zpc/aes_key.h"
 
 # include "misc.h"
+# include "ctx_pool.h"
 # include "cpacf.h"
 
 /*
@@ -20,11 +21,20 @@
 struct zpc_aes_cbc {
 	struct cpacf_kmc_aes_param param;
 	struct zpc_aes_key *aes_key;
+	unsigned long long key_gen;	/* aes_key->prot_gen of param */
 
 	unsigned int fc;
 
+	u8 buf[16];		/* pending block of a padded operation */
+	size_t buflen;
+
 	int key_set;
 	int iv_set;
+
+	struct stats_ctx stats;
+	struct ctx_pool_mark pool;
 };
 
+void aes_cbc_reset_state(struct zpc_aes_cbc *);
+
 #endif
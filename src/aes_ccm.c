@@ -15,28 +15,42 @@
 #include "cpacf.h"
 #include "globals.h"
 #include "misc.h"
+#include "stats.h"
 #include "debug.h"
 
 #include "zkey/pkey.h"
 #include <assert.h>
+#include <endian.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct aes_ccm_flags {
-	u8 reserved:1;
-	u8 adata:1;
-	u8 m:3;
-	u8 l:3;
-} __packed;
+/* Flags octet of the B_0 and A_i blocks (RFC 3610, 2.2 and 2.3). */
+#define AES_CCM_FLAGS(adata, m, l)	\
+	((u8)(((adata) ? 0x40 : 0) | (((m) & 0x7) << 3) | ((l) & 0x7)))
+
+/* Payload bytes per CBC-MAC/CTR round, a multiple of 16 sized for L1. */
+#define AES_CCM_CHUNK	(64 * 1024)
 
 static void __aes_ccm_set_iv(struct zpc_aes_ccm *, const u8 *, size_t);
 static int __aes_ccm_crypt(struct zpc_aes_ccm *, u8 *, u8 *, size_t, const u8 *,
     size_t, const u8 *, size_t, unsigned long);
 static int __aes_ccm_cbcmac(struct zpc_aes_ccm *, const u8 *, size_t);
-static int __aes_ccm_ctr(struct zpc_aes_ccm *, u8[16], u8 *, const u8 *,
-    size_t);
+static int __aes_ccm_ctr_init(struct zpc_aes_ccm *, u8[16]);
+static int __aes_ccm_ctr(struct zpc_aes_ccm *, u8 *, const u8 *, size_t, int);
+static int __aes_ccm_kmac(struct zpc_aes_ccm *, const u8 *, size_t);
+static int __aes_ccm_kma(struct zpc_aes_ccm *, unsigned long, u8 *,
+    const u8 *, size_t);
+static int __aes_ccm_update_prot(struct zpc_aes_ccm *, int);
+static void __aes_ccm_b0(struct zpc_aes_ccm *, u8[16], int, size_t, u64);
+static size_t __aes_ccm_aad_prefix(u8 *, u64);
+static int __aes_ccm_stream_check(struct zpc_aes_ccm *, int);
+static int __aes_ccm_stream_mac(struct zpc_aes_ccm *, const u8 *, size_t);
+static int __aes_ccm_stream_crypt(struct zpc_aes_ccm *, u8 *, const u8 *,
+    size_t, int);
+static int __aes_ccm_stream_final(struct zpc_aes_ccm *, u8[16]);
+static void __aes_ccm_stream_reset(struct zpc_aes_ccm *);
 static void __aes_ccm_reset(struct zpc_aes_ccm *);
 static void __aes_ccm_reset_iv(struct zpc_aes_ccm *);
 
@@ -79,9 +93,7 @@ zpc_aes_ccm_alloc(struct zpc_aes_ccm **aes_ccm)
 int
 zpc_aes_ccm_set_key(struct zpc_aes_ccm *aes_ccm, struct zpc_aes_key *aes_key)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -109,9 +121,6 @@ zpc_aes_ccm_set_key(struct zpc_aes_ccm *aes_ccm, struct zpc_aes_key *aes_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
-	assert(rv == 0);
-
 	rc = aes_key_check(aes_key);
 	if (rc)
 		goto ret;
@@ -122,8 +131,7 @@ zpc_aes_ccm_set_key(struct zpc_aes_ccm *aes_ccm, struct zpc_aes_key *aes_key)
 		goto ret;
 	}
 
-	aes_key->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key, aes_key->refcount);
+	aes_key_ref(aes_key);
 
 	if (aes_ccm->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -137,9 +145,9 @@ zpc_aes_ccm_set_key(struct zpc_aes_ccm *aes_ccm, struct zpc_aes_key *aes_key)
 
 	DEBUG("aes-ccm context at %p: key at %p set, iv unset", aes_ccm, aes_key);
 
-	memcpy(aes_ccm->param_kma.protkey, aes_key->prot.protkey,
-	    sizeof(aes_ccm->param_kma.protkey));
-	memcpy(aes_ccm->param_kmac.protkey, aes_key->prot.protkey,
+	aes_key_get_prot(aes_key, aes_ccm->param_kma.protkey,
+	    sizeof(aes_ccm->param_kma.protkey), &aes_ccm->key_gen);
+	memcpy(aes_ccm->param_kmac.protkey, aes_ccm->param_kma.protkey,
 	    sizeof(aes_ccm->param_kmac.protkey));
 
 	/* The corresponding KMAC function codes are the same as the KMA
@@ -154,8 +162,6 @@ zpc_aes_ccm_set_key(struct zpc_aes_ccm *aes_ccm, struct zpc_aes_key *aes_key)
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&aes_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -211,13 +217,9 @@ int
 zpc_aes_ccm_encrypt(struct zpc_aes_ccm *aes_ccm, u8 * c, u8 * tag,
     size_t taglen, const u8 * aad, size_t aadlen, const u8 * m, size_t mlen)
 {
-	struct cpacf_kma_gcm_aes_param *param_kma;
-	struct cpacf_kmac_aes_param *param_kmac;
-	struct pkey_protkey *protkey;
 	unsigned long flags = 0;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -271,46 +273,15 @@ zpc_aes_ccm_encrypt(struct zpc_aes_ccm *aes_ccm, u8 * c, u8 * tag,
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0; i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+	__aes_ccm_stream_reset(aes_ccm);
+	aes_ccm->wait = 0;
 
-		protkey = &aes_ccm->aes_key->prot;
-		param_kma = &aes_ccm->param_kma;
-		param_kmac = &aes_ccm->param_kmac;
-
-		for (;;) {
-			rc = __aes_ccm_crypt(aes_ccm, c, tag, taglen, aad,
-			    aadlen, m, mlen, flags);
-			if (rc == 0) {
-				break;
-			} else {
-				if (aes_ccm->aes_key->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_ccm->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-ccm context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_ccm, i == 0 ? "current" : "old", aes_ccm->aes_key);
-					rc = aes_key_sec2prot(aes_ccm->aes_key, i);
-					memcpy(param_kma->protkey, protkey->protkey, sizeof(param_kma->protkey));
-					memcpy(param_kmac->protkey, protkey->protkey, sizeof(param_kmac->protkey));
-
-					rv = pthread_mutex_unlock(&aes_ccm->
-					    aes_key->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
-	}
+	stats_op_begin(&st, &aes_ccm->stats, ZPC_STATS_OP_AES_CCM);
+	rc = __aes_ccm_crypt(aes_ccm, c, tag, taglen, aad, aadlen, m, mlen,
+	    flags);
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -319,15 +290,11 @@ int
 zpc_aes_ccm_decrypt(struct zpc_aes_ccm *aes_ccm, u8 * m, const u8 * tag,
     size_t taglen, const u8 * aad, size_t aadlen, const u8 * c, size_t clen)
 {
-	struct cpacf_kma_gcm_aes_param *param_kma;
-	struct cpacf_kmac_aes_param *param_kmac;
-	struct pkey_protkey *protkey;
 	unsigned long flags = CPACF_M;
-	int rc, rv, i;
+	struct stats_op st = { 0 };
+	int rc;
 	u8 tmp[16];
 
-	UNUSED(rv);
-
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
 		goto ret;
@@ -380,50 +347,374 @@ zpc_aes_ccm_decrypt(struct zpc_aes_ccm *aes_ccm, u8 * m, const u8 * tag,
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0 && (rc != ZPC_ERROR_TAGMISMATCH); i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+	__aes_ccm_stream_reset(aes_ccm);
+	aes_ccm->wait = 0;
 
-		protkey = &aes_ccm->aes_key->prot;
-		param_kma = &aes_ccm->param_kma;
-		param_kmac = &aes_ccm->param_kmac;
+	stats_op_begin(&st, &aes_ccm->stats, ZPC_STATS_OP_AES_CCM);
+	memcpy(tmp, tag, taglen);
+	rc = __aes_ccm_crypt(aes_ccm, m, tmp, taglen, aad, aadlen, c, clen,
+	    flags);
 
-		for (;;) {
-			memcpy(tmp, tag, taglen);
-			rc = __aes_ccm_crypt(aes_ccm, m, tmp, taglen, aad,
-			    aadlen, c, clen, flags);
-			if (rc == 0 || rc == ZPC_ERROR_TAGMISMATCH) {
-				break;
-			} else {
-				if (aes_ccm->aes_key->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_ccm->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-ccm context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_ccm, i == 0 ? "current" : "old", aes_ccm->aes_key);
-					rc = aes_key_sec2prot(aes_ccm->aes_key, i);
-					memcpy(param_kma->protkey, protkey->protkey, sizeof(param_kma->protkey));
-					memcpy(param_kmac->protkey, protkey->protkey, sizeof(param_kmac->protkey));
-
-					rv = pthread_mutex_unlock(&aes_ccm->aes_key->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ccm_init(struct zpc_aes_ccm *aes_ccm, unsigned long long aadlen,
+    unsigned long long msglen, size_t taglen)
+{
+	u8 b0[16];
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ccm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	/* Valid tag byte-lengths: 16, 14, 12, 10, 8, 6, 4. */
+	if (taglen % 2 != 0 || taglen > 16 || taglen < 4) {
+		rc = ZPC_ERROR_TAGSIZE;
+		goto ret;
+	}
+
+	if (!aes_ccm->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_ccm->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
 	}
 
+	/* 0 <= m byte-length <= 2^(8L) - 1 */
+	if (aes_ccm->ivlen > 7
+	    && (u64) msglen > (1ULL << (8 * (15 - aes_ccm->ivlen))) - 1) {
+		rc = ZPC_ERROR_MLEN;
+		goto ret;
+	}
+
+	__aes_ccm_stream_reset(aes_ccm);
+	aes_ccm->wait = 0;
+
+	__aes_ccm_b0(aes_ccm, b0, aadlen ? 1 : 0, taglen, msglen);
+	memset(aes_ccm->param_kmac.icv, 0, sizeof(aes_ccm->param_kmac.icv));
+
+	rc = __aes_ccm_kmac(aes_ccm, b0, sizeof(b0));
+	if (rc)
+		goto ret;
+
+	if (aadlen > 0)
+		aes_ccm->buflen = __aes_ccm_aad_prefix(aes_ccm->buf, aadlen);
+
+	rc = __aes_ccm_ctr_init(aes_ccm, aes_ccm->s0);
+	if (rc)
+		goto ret;
+
+	aes_ccm->aad_left = aadlen;
+	aes_ccm->m_left = msglen;
+	aes_ccm->taglen = taglen;
+	aes_ccm->stream = AES_CCM_STREAM_INIT;
+	rc = 0;
 ret:
+	if (rc && aes_ccm != NULL)
+		__aes_ccm_stream_reset(aes_ccm);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
 
+int
+zpc_aes_ccm_update_aad(struct zpc_aes_ccm *aes_ccm, const u8 * aad,
+    size_t aadlen)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ccm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (aadlen > 0 && aad == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	rc = __aes_ccm_stream_check(aes_ccm, AES_CCM_STREAM_INIT);
+	if (rc)
+		goto ret;
+	if (aes_ccm->stream != AES_CCM_STREAM_INIT) {
+		rc = ZPC_ERROR_CCM_STATE;
+		goto ret;
+	}
+	if ((u64)aadlen > aes_ccm->aad_left) {
+		rc = ZPC_ERROR_AADLEN;
+		goto ret;
+	}
+	if (aadlen == 0) {
+		rc = 0;
+		goto ret;
+	}
+
+	aes_ccm->wait = 0;
+	rc = __aes_ccm_stream_mac(aes_ccm, aad, aadlen);
+	if (rc)
+		goto ret;
+	aes_ccm->aad_left -= aadlen;
+	aes_ccm->wait = 1;
+
+	/* Pad the last aad block, the payload starts a new one. */
+	if (aes_ccm->aad_left == 0 && aes_ccm->buflen > 0) {
+		memset(aes_ccm->buf + aes_ccm->buflen, 0, 16 - aes_ccm->buflen);
+		rc = __aes_ccm_kmac(aes_ccm, aes_ccm->buf, 16);
+		if (rc)
+			goto ret;
+		aes_ccm->buflen = 0;
+	}
+
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ccm_encrypt_update(struct zpc_aes_ccm *aes_ccm, u8 * c,
+    const u8 * m, size_t mlen)
+{
+	struct stats_op st = { 0 };
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ccm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (mlen > 0 && c == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	rc = __aes_ccm_stream_check(aes_ccm, AES_CCM_STREAM_ENCRYPT);
+	if (rc)
+		goto ret;
+	if ((u64)mlen > aes_ccm->m_left) {
+		rc = ZPC_ERROR_MLEN;
+		goto ret;
+	}
+
+	aes_ccm->stream = AES_CCM_STREAM_ENCRYPT;
+
+	aes_ccm->wait = 0;
+	stats_op_begin(&st, &aes_ccm->stats, ZPC_STATS_OP_AES_CCM);
+	rc = __aes_ccm_stream_crypt(aes_ccm, c, m, mlen, 0);
+	if (rc == 0)
+		aes_ccm->m_left -= mlen;
+
+ret:
+	stats_op_end(&st, mlen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ccm_decrypt_update(struct zpc_aes_ccm *aes_ccm, u8 * m,
+    const u8 * c, size_t clen)
+{
+	struct stats_op st = { 0 };
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ccm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (clen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (clen > 0 && c == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	rc = __aes_ccm_stream_check(aes_ccm, AES_CCM_STREAM_DECRYPT);
+	if (rc)
+		goto ret;
+	if ((u64)clen > aes_ccm->m_left) {
+		rc = ZPC_ERROR_CLEN;
+		goto ret;
+	}
+
+	aes_ccm->stream = AES_CCM_STREAM_DECRYPT;
+
+	aes_ccm->wait = 0;
+	stats_op_begin(&st, &aes_ccm->stats, ZPC_STATS_OP_AES_CCM);
+	rc = __aes_ccm_stream_crypt(aes_ccm, m, c, clen, 1);
+	if (rc == 0)
+		aes_ccm->m_left -= clen;
+
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ccm_encrypt_final(struct zpc_aes_ccm *aes_ccm, u8 * tag)
+{
+	u8 tmp[16];
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ccm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (tag == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	rc = __aes_ccm_stream_check(aes_ccm, AES_CCM_STREAM_ENCRYPT);
+	if (rc)
+		goto ret;
+	if (aes_ccm->m_left > 0) {
+		rc = ZPC_ERROR_CCM_STATE;
+		goto ret;
+	}
+
+	aes_ccm->wait = 0;
+	rc = __aes_ccm_stream_final(aes_ccm, tmp);
+	if (rc)
+		goto ret;
+
+	memcpy(tag, tmp, aes_ccm->taglen);
+	memzero_secure(tmp, sizeof(tmp));
+	__aes_ccm_stream_reset(aes_ccm);
+
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ccm_decrypt_final(struct zpc_aes_ccm *aes_ccm, const u8 * tag)
+{
+	u8 tmp[16];
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ccm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (tag == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	rc = __aes_ccm_stream_check(aes_ccm, AES_CCM_STREAM_DECRYPT);
+	if (rc)
+		goto ret;
+	if (aes_ccm->m_left > 0) {
+		rc = ZPC_ERROR_CCM_STATE;
+		goto ret;
+	}
+
+	aes_ccm->wait = 0;
+	rc = __aes_ccm_stream_final(aes_ccm, tmp);
+	if (rc)
+		goto ret;
+
+	rc = memcmp_consttime(tmp, tag, aes_ccm->taglen);
+	if (rc)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	memzero_secure(tmp, sizeof(tmp));
+	__aes_ccm_stream_reset(aes_ccm);
+
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ccm_get_stats(const struct zpc_aes_ccm *aes_ccm,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_ccm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&aes_ccm->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+/*
+ * Unset the iv, keep the key (context pool).
+ */
+void
+aes_ccm_reset_state(struct zpc_aes_ccm *aes_ccm)
+{
+	__aes_ccm_reset_iv(aes_ccm);
+	aes_ccm->iv_set = 0;
+}
+
 void
 zpc_aes_ccm_free(struct zpc_aes_ccm **aes_ccm)
 {
@@ -466,50 +757,36 @@ __aes_ccm_set_iv(struct zpc_aes_ccm *aes_ccm, const u8 * iv, size_t ivlen)
 	memset(aes_ccm->iv, 0, sizeof(aes_ccm->iv));
 	aes_ccm->ivlen = ivlen;
 	memcpy(aes_ccm->iv, iv, ivlen);
+
+	__aes_ccm_stream_reset(aes_ccm);
 }
 
+/*
+ * The payload is processed in chunks: CBC-MAC and CTR of a chunk are
+ * done back to back, so the second pass reads it from cache. The ICV
+ * and the counter carry over in the param blocks.
+ */
 static int
 __aes_ccm_crypt(struct zpc_aes_ccm *aes_ccm, u8 * out, u8 * tag, size_t taglen,
     const u8 * aad, size_t aadlen, const u8 * in, size_t inlen,
     unsigned long flags)
 {
-	struct aes_ccm_flags b0flags;
 	u8 b01[32], tmp[16];
-	int rc, cc;
-	size_t rem, i;
+	int rc, adata, last;
+	size_t rem, i, off, n;
 
 	assert(aes_ccm != NULL);
 	assert(aes_ccm->key_set == 1);
 	assert(aes_ccm->iv_set == 1);
 
-	memset(&b0flags, 0, sizeof(b0flags));
 	memset(b01, 0, sizeof(b01));
 
-	if (aadlen)
-		b0flags.adata = 1;
-	b0flags.m = taglen / 2 - 1;
-	assert(b0flags.m != 0);
-	b0flags.l = (15 - aes_ccm->ivlen) - 1;
-	assert(b0flags.l != 0);
-
-	memcpy(b01, &b0flags, 1);
-	memcpy(b01 + 1, aes_ccm->iv, aes_ccm->ivlen);
-	for (i = 0; i < 16 - 1 - aes_ccm->ivlen; i++)
-		b01[15 - i] = ((u8 *) & inlen)[sizeof(inlen) - 1 - i];
-
-	if (b0flags.adata == 1) {
-		if (aadlen < (1ULL << 16) - (1ULL << 8)) {
-			*(u16 *) (&(b01[16])) = aadlen;
-			i = 16 + 2;
-		} else if (aadlen <= 1ULL << 32) {
-			*(u16 *) (&(b01[16])) = 0xfffe;
-			*(u32 *) (&(b01[16])) = aadlen;
-			i = 16 + 6;
-		} else {
-			*(u16 *) (&(b01[16])) = 0xffff;
-			*(u64 *) (&(b01[16])) = aadlen;
-			i = 16 + 10;
-		}
+	adata = aadlen ? 1 : 0;
+
+	__aes_ccm_b0(aes_ccm, b01, adata, taglen, inlen);
+
+	if (adata) {
+		i = 16 + __aes_ccm_aad_prefix(b01 + 16, aadlen);
 		while (i < 32 && aadlen) {
 			b01[i] = *aad;
 			aad++;
@@ -524,25 +801,16 @@ __aes_ccm_crypt(struct zpc_aes_ccm *aes_ccm, u8 * out, u8 * tag, size_t taglen,
 
 	memset(aes_ccm->param_kmac.icv, 0, sizeof(aes_ccm->param_kmac.icv));
 
-	cc = cpacf_kmac(aes_ccm->fc, &aes_ccm->param_kmac, b01,
-	    b0flags.adata == 1 ? 32 : 16);
-	/* Either incomplete processing or WKaVP mismatch. */
-	assert(cc == 0 || cc == 2 || cc == 1);
-	if (cc == 1) {
-		rc = ZPC_ERROR_WKVPMISMATCH;
+	rc = __aes_ccm_kmac(aes_ccm, b01, adata ? 32 : 16);
+	if (rc)
 		goto ret;
-	}
 
 	rem = aadlen & 0xf;
 	aadlen &= ~(size_t)0xf;
 	if (aadlen) {
-		cc = cpacf_kmac(aes_ccm->fc, &aes_ccm->param_kmac, aad, aadlen);
-		/* Either incomplete processing or WKaVP mismatch. */
-		assert(cc == 0 || cc == 2 || cc == 1);
-		if (cc == 1) {
-			rc = ZPC_ERROR_WKVPMISMATCH;
+		rc = __aes_ccm_kmac(aes_ccm, aad, aadlen);
+		if (rc)
 			goto ret;
-		}
 		aad += aadlen;
 	}
 	if (rem) {
@@ -551,36 +819,46 @@ __aes_ccm_crypt(struct zpc_aes_ccm *aes_ccm, u8 * out, u8 * tag, size_t taglen,
 		for (; i < 16; i++)
 			tmp[i] = 0;
 
-		cc = cpacf_kmac(aes_ccm->fc, &aes_ccm->param_kmac, tmp, 16);
-		/* Either incomplete processing or WKaVP mismatch. */
-		assert(cc == 0 || cc == 2 || cc == 1);
-		if (cc == 1) {
-			rc = ZPC_ERROR_WKVPMISMATCH;
+		rc = __aes_ccm_kmac(aes_ccm, tmp, 16);
+		if (rc)
 			goto ret;
-		}
 	}
 
-	memset(tmp, 0, 16);
+	/* Encrypted counter block 0, the tag's key stream. */
+	rc = __aes_ccm_ctr_init(aes_ccm, tmp);
+	if (rc)
+		goto ret;
+
+	for (off = 0; off < inlen; off += n) {
+		n = inlen - off;
+		if (n > AES_CCM_CHUNK)
+			n = AES_CCM_CHUNK;
+		last = (off + n == inlen);
+
+		if (!(flags & CPACF_M)) {
+			/* mac-then-encrypt */
+			rc = __aes_ccm_cbcmac(aes_ccm, in + off, n);
+			if (rc)
+				goto ret;
+			rc = __aes_ccm_ctr(aes_ccm, out + off, in + off, n, last);
+			if (rc)
+				goto ret;
+		} else {
+			/* decrypt-then-mac */
+			rc = __aes_ccm_ctr(aes_ccm, out + off, in + off, n, last);
+			if (rc)
+				goto ret;
+			rc = __aes_ccm_cbcmac(aes_ccm, out + off, n);
+			if (rc)
+				goto ret;
+		}
+	}
 
 	if (!(flags & CPACF_M)) {
-		/* mac-then-encrypt */
-		rc = __aes_ccm_cbcmac(aes_ccm, in, inlen);
-		if (rc)
-			goto ret;
-		rc = __aes_ccm_ctr(aes_ccm, tmp, out, in, inlen);
-		if (rc)
-			goto ret;
 		for (i = 0; i < 16; i++)
 			tmp[i] ^= aes_ccm->param_kmac.icv[i];
 		memcpy(tag, tmp, taglen);
 	} else {
-		/* decrypt-then-mac */
-		rc = __aes_ccm_ctr(aes_ccm, tmp, out, in, inlen);
-		if (rc)
-			goto ret;
-		rc = __aes_ccm_cbcmac(aes_ccm, out, inlen);
-		if (rc)
-			goto ret;
 		for (i = 0; i < taglen; i++)
 			tmp[i] ^= tag[i];
 		rc = memcmp_consttime(tmp, aes_ccm->param_kmac.icv, taglen);
@@ -592,33 +870,27 @@ __aes_ccm_crypt(struct zpc_aes_ccm *aes_ccm, u8 * out, u8 * tag, size_t taglen,
 
 	rc = 0;
 ret:
+	memzero_secure(tmp, sizeof(tmp));
 	if (rc == ZPC_ERROR_TAGMISMATCH) {
 		memset(out, 0, inlen);
 	}
 	return rc;
 }
 
+/* CBC-MAC of a chunk, a partial block only at the end of the payload. */
 static int
 __aes_ccm_cbcmac(struct zpc_aes_ccm *aes_ccm, const u8 * in, size_t inlen)
 {
-	struct aes_ccm_flags aflags;
-	u8 a[16], tmp[16];
-	int rc, cc;
+	u8 tmp[16];
+	int rc;
 	size_t rem, i;
 
-	memset(&aflags, 0, sizeof(aflags));
-	memset(a, 0, sizeof(a));
-
 	rem = inlen & 0xf;
 	inlen &= ~(size_t)0xf;
 	if (inlen) {
-		cc = cpacf_kmac(aes_ccm->fc, &aes_ccm->param_kmac, in, inlen);
-		/* Either incomplete processing or WKaVP mismatch. */
-		assert(cc == 0 || cc == 2 || cc == 1);
-		if (cc == 1) {
-			rc = ZPC_ERROR_WKVPMISMATCH;
+		rc = __aes_ccm_kmac(aes_ccm, in, inlen);
+		if (rc)
 			goto ret;
-		}
 	}
 	if (rem) {
 		for (i = 0; i < rem; i++)
@@ -626,13 +898,9 @@ __aes_ccm_cbcmac(struct zpc_aes_ccm *aes_ccm, const u8 * in, size_t inlen)
 		for (; i < 16; i++)
 			tmp[i] = 0;
 
-		cc = cpacf_kmac(aes_ccm->fc, &aes_ccm->param_kmac, tmp, 16);
-		/* Either incomplete processing or WKaVP mismatch. */
-		assert(cc == 0 || cc == 2 || cc == 1);
-		if (cc == 1) {
-			rc = ZPC_ERROR_WKVPMISMATCH;
+		rc = __aes_ccm_kmac(aes_ccm, tmp, 16);
+		if (rc)
 			goto ret;
-		}
 	}
 
 	rc = 0;
@@ -640,29 +908,249 @@ ret:
 	return rc;
 }
 
+/* B_0: flags, nonce and payload length (RFC 3610, 2.2). */
+static void
+__aes_ccm_b0(struct zpc_aes_ccm *aes_ccm, u8 b0[16], int adata,
+    size_t taglen, u64 mlen)
+{
+	size_t i;
+
+	assert(taglen / 2 - 1 != 0);
+	assert((15 - aes_ccm->ivlen) - 1 != 0);
+
+	memset(b0, 0, 16);
+	b0[0] = AES_CCM_FLAGS(adata, taglen / 2 - 1, (15 - aes_ccm->ivlen) - 1);
+	memcpy(b0 + 1, aes_ccm->iv, aes_ccm->ivlen);
+	for (i = 0; i < 16 - 1 - aes_ccm->ivlen && i < sizeof(mlen); i++)
+		b0[15 - i] = (u8)(mlen >> (8 * i));
+}
+
+/*
+ * Length encoding of the associated data (RFC 3610, 2.2) into out,
+ * which has room for 10 bytes. Returns the encoding's length.
+ */
+static size_t
+__aes_ccm_aad_prefix(u8 * out, u64 aadlen)
+{
+	u16 u16be;
+	u32 u32be;
+	u64 u64be;
+
+	if (aadlen < (1ULL << 16) - (1ULL << 8)) {
+		u16be = htobe16((u16)aadlen);
+		memcpy(out, &u16be, sizeof(u16be));
+		return 2;
+	} else if (aadlen < 1ULL << 32) {
+		out[0] = 0xff;
+		out[1] = 0xfe;
+		u32be = htobe32((u32)aadlen);
+		memcpy(out + 2, &u32be, sizeof(u32be));
+		return 6;
+	} else {
+		out[0] = 0xff;
+		out[1] = 0xff;
+		u64be = htobe64(aadlen);
+		memcpy(out + 2, &u64be, sizeof(u64be));
+		return 10;
+	}
+}
+
+/*
+ * Common checks of the multi-part calls: an operation is started and,
+ * for payload calls (dir != AES_CCM_STREAM_INIT), all aad was passed
+ * and the direction is that of earlier payload calls.
+ */
+static int
+__aes_ccm_stream_check(struct zpc_aes_ccm *aes_ccm, int dir)
+{
+	if (!aes_ccm->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (!aes_ccm->iv_set)
+		return ZPC_ERROR_IVNOTSET;
+	if (aes_ccm->stream == AES_CCM_STREAM_NONE)
+		return ZPC_ERROR_CCM_STATE;
+	if (dir == AES_CCM_STREAM_INIT)
+		return 0;
+
+	if (aes_ccm->aad_left > 0)
+		return ZPC_ERROR_CCM_STATE;
+	if (aes_ccm->stream != AES_CCM_STREAM_INIT && aes_ccm->stream != dir)
+		return ZPC_ERROR_CCM_STATE;
+	return 0;
+}
+
+/* CBC-MAC over a byte stream, a partial block is kept in buf. */
 static int
-__aes_ccm_ctr(struct zpc_aes_ccm *aes_ccm, u8 tagkey[16], u8 * out,
-    const u8 * in, size_t inlen)
+__aes_ccm_stream_mac(struct zpc_aes_ccm *aes_ccm, const u8 * in,
+    size_t inlen)
+{
+	size_t n, full;
+	int rc;
+
+	if (aes_ccm->buflen > 0) {
+		n = 16 - aes_ccm->buflen;
+		if (n > inlen)
+			n = inlen;
+		memcpy(aes_ccm->buf + aes_ccm->buflen, in, n);
+		aes_ccm->buflen += n;
+		aes_ccm->wait = 1;
+		in += n;
+		inlen -= n;
+
+		if (aes_ccm->buflen < 16)
+			return 0;
+
+		rc = __aes_ccm_kmac(aes_ccm, aes_ccm->buf, 16);
+		if (rc)
+			return rc;
+		aes_ccm->buflen = 0;
+	}
+
+	full = inlen & ~(size_t)0xf;
+	if (full > 0) {
+		rc = __aes_ccm_kmac(aes_ccm, in, full);
+		if (rc)
+			return rc;
+	}
+
+	memcpy(aes_ccm->buf, in + full, inlen - full);
+	aes_ccm->buflen = inlen - full;
+	return 0;
+}
+
+/*
+ * Payload of a multi-part operation: the rest of a partial block from
+ * buf and ks, whole blocks chunk-wise as in __aes_ccm_crypt, then the
+ * key stream of a new partial block.
+ */
+static int
+__aes_ccm_stream_crypt(struct zpc_aes_ccm *aes_ccm, u8 * out, const u8 * in,
+    size_t inlen, int decrypt)
+{
+	size_t n, i, full;
+	int rc;
+	u8 b;
+
+	if (aes_ccm->buflen > 0) {
+		n = 16 - aes_ccm->buflen;
+		if (n > inlen)
+			n = inlen;
+		for (i = 0; i < n; i++) {
+			b = in[i];
+			out[i] = b ^ aes_ccm->ks[aes_ccm->buflen + i];
+			aes_ccm->buf[aes_ccm->buflen + i] = decrypt ? out[i] : b;
+		}
+		aes_ccm->buflen += n;
+		aes_ccm->wait = 1;
+		out += n;
+		in += n;
+		inlen -= n;
+
+		if (aes_ccm->buflen < 16)
+			return 0;
+
+		rc = __aes_ccm_kmac(aes_ccm, aes_ccm->buf, 16);
+		if (rc)
+			return rc;
+		memzero_secure(aes_ccm->ks, sizeof(aes_ccm->ks));
+		aes_ccm->buflen = 0;
+	}
+
+	full = inlen & ~(size_t)0xf;
+	for (i = 0; i < full; i += n) {
+		n = full - i;
+		if (n > AES_CCM_CHUNK)
+			n = AES_CCM_CHUNK;
+
+		if (!decrypt) {
+			rc = __aes_ccm_kmac(aes_ccm, in + i, n);
+			if (rc)
+				return rc;
+			rc = __aes_ccm_ctr(aes_ccm, out + i, in + i, n, 0);
+			if (rc)
+				return rc;
+		} else {
+			rc = __aes_ccm_ctr(aes_ccm, out + i, in + i, n, 0);
+			if (rc)
+				return rc;
+			rc = __aes_ccm_kmac(aes_ccm, out + i, n);
+			if (rc)
+				return rc;
+		}
+	}
+	out += full;
+	in += full;
+	inlen -= full;
+
+	if (inlen > 0) {
+		memset(aes_ccm->ks, 0, sizeof(aes_ccm->ks));
+		rc = __aes_ccm_ctr(aes_ccm, aes_ccm->ks, aes_ccm->ks, 16, 0);
+		if (rc)
+			return rc;
+		for (i = 0; i < inlen; i++) {
+			b = in[i];
+			out[i] = b ^ aes_ccm->ks[i];
+			aes_ccm->buf[i] = decrypt ? out[i] : b;
+		}
+		aes_ccm->buflen = inlen;
+	}
+
+	return 0;
+}
+
+/* MAC the last partial block, tag = icv ^ S_0. */
+static int
+__aes_ccm_stream_final(struct zpc_aes_ccm *aes_ccm, u8 tag[16])
+{
+	size_t i;
+	int rc;
+
+	if (aes_ccm->buflen > 0) {
+		memset(aes_ccm->buf + aes_ccm->buflen, 0, 16 - aes_ccm->buflen);
+		rc = __aes_ccm_kmac(aes_ccm, aes_ccm->buf, 16);
+		if (rc)
+			return rc;
+		aes_ccm->buflen = 0;
+	}
+
+	for (i = 0; i < 16; i++)
+		tag[i] = aes_ccm->s0[i] ^ aes_ccm->param_kmac.icv[i];
+	return 0;
+}
+
+static void
+__aes_ccm_stream_reset(struct zpc_aes_ccm *aes_ccm)
+{
+	aes_ccm->stream = AES_CCM_STREAM_NONE;
+	aes_ccm->aad_left = 0;
+	aes_ccm->m_left = 0;
+	aes_ccm->taglen = 0;
+	memzero_secure(aes_ccm->s0, sizeof(aes_ccm->s0));
+	memzero_secure(aes_ccm->buf, sizeof(aes_ccm->buf));
+	memzero_secure(aes_ccm->ks, sizeof(aes_ccm->ks));
+	aes_ccm->buflen = 0;
+}
+
+/*
+ * Set up the counter in param_kma and encrypt counter block 0 into
+ * tagkey. KMA with a zero hash subkey is used as CTR.
+ */
+static int
+__aes_ccm_ctr_init(struct zpc_aes_ccm *aes_ccm, u8 tagkey[16])
 {
-	struct aes_ccm_flags aflags;
-	unsigned int flags;
 	u8 a[16];
-	int rc, cc;
 	u32 ctr;
 
-	flags = CPACF_KMA_LAAD | CPACF_KMA_HS;
-
-	memset(&aflags, 0, sizeof(aflags));
 	memset(a, 0, sizeof(a));
 
-	aflags.l = (15 - aes_ccm->ivlen) - 1;
-	assert(aflags.l != 0);
+	assert((15 - aes_ccm->ivlen) - 1 != 0);
 
-	memcpy(a, &aflags, 1);
+	a[0] = AES_CCM_FLAGS(0, 0, (15 - aes_ccm->ivlen) - 1);
 	memcpy(a + 1, aes_ccm->iv, aes_ccm->ivlen);
 
+	/* The counter is big-endian. */
 	memcpy(&ctr, a + 16 - 4, 4);
-	ctr--;  /* KMA pre-inc */
+	ctr = htobe32(be32toh(ctr) - 1);  /* KMA pre-inc */
 	memcpy(a + 16 - 4, &ctr, 4);
 
 	memset(aes_ccm->param_kma.reserved, 0,
@@ -672,26 +1160,131 @@ __aes_ccm_ctr(struct zpc_aes_ccm *aes_ccm, u8 tagkey[16], u8 * out,
 
 	memset(tagkey, 0, 16);
 
-	cc = cpacf_kma(aes_ccm->fc | flags, &aes_ccm->param_kma, tagkey, NULL,
-	    0, tagkey, 16);
-	/* Either incomplete processing or WKaVP mismatch. */
-	assert(cc == 0 || cc == 2 || cc == 1);
-	if (cc == 1) {
-		rc = ZPC_ERROR_WKVPMISMATCH;
-		goto ret;
+	return __aes_ccm_kma(aes_ccm, CPACF_KMA_LAAD | CPACF_KMA_HS, tagkey,
+	    tagkey, 16);
+}
+
+/* CTR of a chunk, whose length is a multiple of 16 unless it is the last. */
+static int
+__aes_ccm_ctr(struct zpc_aes_ccm *aes_ccm, u8 * out, const u8 * in,
+    size_t inlen, int last)
+{
+	unsigned long flags;
+
+	flags = CPACF_KMA_LAAD | CPACF_KMA_HS;
+	if (last)
+		flags |= CPACF_KMA_LPC;
+
+	return __aes_ccm_kma(aes_ccm, flags, out, in, inlen);
+}
+
+/*
+ * KMAC and KMA with protected key re-derivation. An instruction that
+ * finds a wrapping key mismatch may do so after it processed part of
+ * the chunk, and the param block reflects that part. KMAC is repeated
+ * with the re-derived key from the ICV saved before the chunk. KMA may
+ * work in place, so it continues after the blocks it processed, whose
+ * number the counter tells.
+ * Once an instruction of the call changed the context or the output,
+ * the call cannot be repeated, so it waits for the re-derivation (see
+ * aes_key_update_prot_wait) instead of returning ZPC_ERROR_AGAIN.
+ */
+static int
+__aes_ccm_kmac(struct zpc_aes_ccm *aes_ccm, const u8 * in, size_t inlen)
+{
+	u8 icv[16];
+	int rc, cc, i;
+
+	memcpy(icv, aes_ccm->param_kmac.icv, sizeof(icv));
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		for (;;) {
+			cc = cpacf_kmac(aes_ccm->fc, &aes_ccm->param_kmac, in,
+			    inlen);
+			/* Either incomplete processing or WKaVP mismatch. */
+			assert(cc == 0 || cc == 2 || cc == 1);
+			if (cc != 1) {
+				aes_ccm->wait = 1;
+				rc = 0;
+				break;
+			}
+			memcpy(aes_ccm->param_kmac.icv, icv, sizeof(icv));
+			rc = __aes_ccm_update_prot(aes_ccm, i);
+			if (rc == ZPC_ERROR_PROTKEYONLY)
+				return rc;
+			if (rc)
+				break;
+		}
 	}
 
-	cc = cpacf_kma(aes_ccm->fc | flags | CPACF_KMA_LPC, &aes_ccm->param_kma,
-	    out, NULL, 0, in, inlen);
-	/* Either incomplete processing or WKaVP mismatch. */
-	assert(cc == 0 || cc == 2 || cc == 1);
-	if (cc == 1) {
-		rc = ZPC_ERROR_WKVPMISMATCH;
-		goto ret;
+	return rc;
+}
+
+static int
+__aes_ccm_kma(struct zpc_aes_ccm *aes_ccm, unsigned long flags, u8 * out,
+    const u8 * in, size_t inlen)
+{
+	size_t done;
+	u32 cv;
+	int rc, cc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		for (;;) {
+			cv = be32toh(aes_ccm->param_kma.cv);
+			cc = cpacf_kma(aes_ccm->fc | flags, &aes_ccm->param_kma,
+			    out, NULL, 0, in, inlen);
+			/* Either incomplete processing or WKaVP mismatch. */
+			assert(cc == 0 || cc == 2 || cc == 1);
+			if (cc != 1) {
+				aes_ccm->wait = 1;
+				rc = 0;
+				break;
+			}
+			/* The counter is pre-incremented once per block. */
+			done = (size_t)(be32toh(aes_ccm->param_kma.cv) - cv)
+			    * 16;
+			assert(done <= inlen);
+			if (done > 0)
+				aes_ccm->wait = 1;
+			out += done;
+			in += done;
+			inlen -= done;
+			rc = __aes_ccm_update_prot(aes_ccm, i);
+			if (rc == ZPC_ERROR_PROTKEYONLY)
+				return rc;
+			if (rc)
+				break;
+		}
 	}
 
-	rc = 0;
-ret:
+	return rc;
+}
+
+static int
+__aes_ccm_update_prot(struct zpc_aes_ccm *aes_ccm, int sec)
+{
+	int rc;
+
+	if (aes_ccm->aes_key->rand_protk)
+		return ZPC_ERROR_PROTKEYONLY;
+
+	if (aes_ccm->wait) {
+		rc = aes_key_update_prot_wait(aes_ccm->aes_key, sec,
+		    aes_ccm->param_kma.protkey,
+		    sizeof(aes_ccm->param_kma.protkey), &aes_ccm->key_gen);
+	} else {
+		rc = aes_key_update_prot(aes_ccm->aes_key, sec,
+		    aes_ccm->param_kma.protkey,
+		    sizeof(aes_ccm->param_kma.protkey), &aes_ccm->key_gen);
+	}
+	memcpy(aes_ccm->param_kmac.protkey, aes_ccm->param_kma.protkey,
+	    sizeof(aes_ccm->param_kmac.protkey));
 	return rc;
 }
 
@@ -731,5 +1324,6 @@ __aes_ccm_reset_iv(struct zpc_aes_ccm *aes_ccm)
 	memset(aes_ccm->iv, 0, sizeof(aes_ccm->iv));
 	aes_ccm->ivlen = 0;
 
+	__aes_ccm_stream_reset(aes_ccm);
 	aes_ccm->iv_set = 0;
 }
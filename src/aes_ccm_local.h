@@ -11,6 +11,7 @@
 # include "zpc/aes_key.h"
 
 # include "misc.h"
+# include "ctx_pool.h"
 # include "cpacf.h"
 
 /*
@@ -21,6 +22,7 @@ struct zpc_aes_ccm {
 	struct cpacf_kma_gcm_aes_param param_kma;
 	struct cpacf_kmac_aes_param param_kmac;
 	struct zpc_aes_key *aes_key;
+	unsigned long long key_gen;	/* aes_key->prot_gen of param */
 
 	unsigned int fc;
 
@@ -29,6 +31,28 @@ struct zpc_aes_ccm {
 
 	int key_set;
 	int iv_set;
+
+	/* Multi-part operation, see zpc_aes_ccm_init. */
+	int stream;		/* AES_CCM_STREAM_* */
+	u64 aad_left;		/* declared aad bytes still to come */
+	u64 m_left;		/* declared payload bytes still to come */
+	size_t taglen;
+	u8 s0[16];		/* encrypted counter block 0 */
+	u8 buf[16];		/* partial CBC-MAC block */
+	u8 ks[16];		/* key stream of the partial payload block */
+	size_t buflen;
+
+	int wait;		/* the call changed state, see __aes_ccm_kmac */
+
+	struct stats_ctx stats;
+	struct ctx_pool_mark pool;
 };
 
+# define AES_CCM_STREAM_NONE	0
+# define AES_CCM_STREAM_INIT	1	/* direction not known yet */
+# define AES_CCM_STREAM_ENCRYPT	2
+# define AES_CCM_STREAM_DECRYPT	3
+
+void aes_ccm_reset_state(struct zpc_aes_ccm *);
+
 #endif
@@ -14,7 +14,9 @@
 #include "aes_key_local.h"
 #include "cpacf.h"
 #include "globals.h"
+#include "iov.h"
 #include "misc.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
@@ -26,6 +28,15 @@
 
 static int __aes_cmac_crypt(struct zpc_aes_cmac *, u8 *, size_t, const u8 *,
     size_t, unsigned long);
+static int __aes_cmac_crypt_prot(struct zpc_aes_cmac *, u8 *, size_t,
+    const u8 *, size_t);
+static int __aes_cmac_update(struct zpc_aes_cmac *, const u8 *, size_t);
+static int __aes_cmac_final(struct zpc_aes_cmac *, u8 *, size_t);
+static int __aes_cmac_cryptv(struct zpc_aes_cmac *, const u8 *, size_t,
+    const struct iovec *, int, u8 *, size_t);
+static int __aes_cmac_batch(struct zpc_aes_cmac *,
+    const struct zpc_aes_cmac_msg *, size_t, size_t, u8 *);
+static int __aes_cmac_msg(struct zpc_aes_cmac *, u8 *, const u8 *, size_t);
 static void __aes_cmac_reset(struct zpc_aes_cmac *);
 static void __aes_cmac_reset_state(struct zpc_aes_cmac *);
 
@@ -68,9 +79,7 @@ zpc_aes_cmac_alloc(struct zpc_aes_cmac **aes_cmac)
 int
 zpc_aes_cmac_set_key(struct zpc_aes_cmac *aes_cmac, struct zpc_aes_key *aes_key)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -98,9 +107,6 @@ zpc_aes_cmac_set_key(struct zpc_aes_cmac *aes_cmac, struct zpc_aes_key *aes_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
-	assert(rv == 0);
-
 	rc = aes_key_check(aes_key);
 	if (rc)
 		goto ret;
@@ -112,8 +118,7 @@ zpc_aes_cmac_set_key(struct zpc_aes_cmac *aes_cmac, struct zpc_aes_key *aes_key)
 		goto ret;
 	}
 
-	aes_key->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key, aes_key->refcount);
+	aes_key_ref(aes_key);
 
 	if (aes_cmac->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -129,9 +134,9 @@ zpc_aes_cmac_set_key(struct zpc_aes_cmac *aes_cmac, struct zpc_aes_key *aes_key)
 
 	memset(&aes_cmac->param_kmac, 0, sizeof(aes_cmac->param_kmac));
 	memset(&aes_cmac->param_pcc, 0, sizeof(aes_cmac->param_pcc));
-	memcpy(aes_cmac->param_kmac.protkey, aes_key->prot.protkey,
-	    sizeof(aes_cmac->param_kmac.protkey));
-	memcpy(aes_cmac->param_pcc.protkey, aes_key->prot.protkey,
+	aes_key_get_prot(aes_key, aes_cmac->param_kmac.protkey,
+	    sizeof(aes_cmac->param_kmac.protkey), &aes_cmac->key_gen);
+	memcpy(aes_cmac->param_pcc.protkey, aes_cmac->param_kmac.protkey,
 	    sizeof(aes_cmac->param_pcc.protkey));
 
 	aes_cmac->fc = CPACF_KMAC_ENCRYPTED_AES_128 + (aes_key->keysize - 128) / 64;
@@ -141,8 +146,6 @@ zpc_aes_cmac_set_key(struct zpc_aes_cmac *aes_cmac, struct zpc_aes_key *aes_key)
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&aes_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -151,13 +154,8 @@ int
 zpc_aes_cmac_sign(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen,
     const u8 * m, size_t mlen)
 {
-	struct cpacf_kmac_aes_param *param_kmac;
-	struct cpacf_pcc_cmac_aes_param *param_pcc;
-	struct pkey_protkey *protkey;
-	unsigned long flags = 0;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -182,8 +180,8 @@ zpc_aes_cmac_sign(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen,
 		goto ret;
 	}
 
-	if (mlen > 0 && mlen % 16 != 0 && tag == NULL) {
-		rc = ZPC_ERROR_ARG5RANGE;
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
 		goto ret;
 	}
 
@@ -192,44 +190,13 @@ zpc_aes_cmac_sign(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen,
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0; i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
-
-		protkey = &aes_cmac->aes_key->prot;
-		param_kmac = &aes_cmac->param_kmac;
-		param_pcc = &aes_cmac->param_pcc;
-
-		for (;;) {
-			rc = __aes_cmac_crypt(aes_cmac, tag, taglen, m, mlen, flags);
-			if (rc == 0) {
-				break;
-			} else {
-				if (aes_cmac->aes_key->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_cmac->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-cmac context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_cmac, i == 0 ? "current" : "old", aes_cmac->aes_key);
-					rc = aes_key_sec2prot(aes_cmac->aes_key, i);
-					memcpy(param_kmac->protkey, protkey->protkey, sizeof(param_kmac->protkey));
-					memcpy(param_pcc->protkey, protkey->protkey, sizeof(param_pcc->protkey));
-
-					rv = pthread_mutex_unlock(&aes_cmac->aes_key->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
-	}
+	stats_op_begin(&st, &aes_cmac->stats, ZPC_STATS_OP_AES_CMAC);
+	rc = __aes_cmac_update(aes_cmac, m, mlen);
+	if (rc == 0 && tag != NULL)
+		rc = __aes_cmac_final(aes_cmac, tag, taglen);
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -238,15 +205,10 @@ int
 zpc_aes_cmac_verify(struct zpc_aes_cmac *aes_cmac, const u8 * tag,
     size_t taglen, const u8 * m, size_t mlen)
 {
-	struct cpacf_kmac_aes_param *param_kmac;
-	struct cpacf_pcc_cmac_aes_param *param_pcc;
-	struct pkey_protkey *protkey;
-	unsigned long flags = 0;
-	int rc, rv, i;
+	struct stats_op st = { 0 };
+	int rc;
 	u8 tmp[16];
 
-	UNUSED(rv);
-
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
 		goto ret;
@@ -270,8 +232,8 @@ zpc_aes_cmac_verify(struct zpc_aes_cmac *aes_cmac, const u8 * tag,
 		goto ret;
 	}
 
-	if (mlen > 0 && mlen % 16 != 0 && tag == NULL) {
-		rc = ZPC_ERROR_ARG5RANGE;
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
 		goto ret;
 	}
 
@@ -280,50 +242,141 @@ zpc_aes_cmac_verify(struct zpc_aes_cmac *aes_cmac, const u8 * tag,
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && (rc != 0 && rc != ZPC_ERROR_TAGMISMATCH); i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+	stats_op_begin(&st, &aes_cmac->stats, ZPC_STATS_OP_AES_CMAC);
+	rc = __aes_cmac_update(aes_cmac, m, mlen);
+	if (rc == 0 && tag != NULL) {
+		rc = __aes_cmac_final(aes_cmac, tmp, sizeof(tmp));
+		if (rc == 0 && memcmp_consttime(tmp, tag, taglen) != 0)
+			rc = ZPC_ERROR_TAGMISMATCH;
+		memzero_secure(tmp, sizeof(tmp));
+	}
 
-		protkey = &aes_cmac->aes_key->prot;
-		param_kmac = &aes_cmac->param_kmac;
-		param_pcc = &aes_cmac->param_pcc;
+ret:
+	stats_op_end(&st, mlen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
 
-		for (;;) {
-			rc = __aes_cmac_crypt(aes_cmac,
-			    tag == NULL ? NULL : tmp,
-			    tag == NULL ? 0 : sizeof(tmp), m, mlen, flags);
-			if (rc == 0) {
-				if (tag != NULL) {
-					rc = memcmp_consttime(tmp, tag, taglen);
-					if (rc != 0)
-						rc = ZPC_ERROR_TAGMISMATCH;
-				}
-				break;
-			} else {
-				if (aes_cmac->aes_key->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_cmac->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-cmac context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_cmac, i == 0 ? "current" : "old", aes_cmac->aes_key);
-					rc = aes_key_sec2prot(aes_cmac->aes_key, i);
-					memcpy(param_kmac->protkey, protkey->protkey, sizeof(param_kmac->protkey));
-					memcpy(param_pcc->protkey, protkey->protkey, sizeof(param_pcc->protkey));
-
-					rv = pthread_mutex_unlock(&aes_cmac->aes_key->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
+int
+zpc_aes_cmac_signv(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen,
+    const struct iovec *m, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_cmac_cryptv(aes_cmac, tag, taglen, m, iovcnt, tag, taglen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cmac_verifyv(struct zpc_aes_cmac *aes_cmac, const u8 * tag,
+    size_t taglen, const struct iovec *m, int iovcnt)
+{
+	u8 tmp[16];
+	int rc;
+
+	rc = __aes_cmac_cryptv(aes_cmac, tag, taglen, m, iovcnt,
+	    tag != NULL ? tmp : NULL, tag != NULL ? sizeof(tmp) : 0);
+	if (rc == 0 && tag != NULL && memcmp_consttime(tmp, tag, taglen) != 0)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cmac_sign_batch(struct zpc_aes_cmac *aes_cmac,
+    const struct zpc_aes_cmac_msg *msgs, size_t nmsgs, size_t taglen)
+{
+	int rc;
+
+	rc = __aes_cmac_batch(aes_cmac, msgs, nmsgs, taglen, NULL);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cmac_verify_batch(struct zpc_aes_cmac *aes_cmac,
+    const struct zpc_aes_cmac_msg *msgs, size_t nmsgs, size_t taglen,
+    u8 * valid)
+{
+	int rc;
+
+	if (valid == NULL && nmsgs > 0)
+		rc = ZPC_ERROR_ARG5NULL;
+	else
+		rc = __aes_cmac_batch(aes_cmac, msgs, nmsgs, taglen, valid);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_cmac_get_stats(const struct zpc_aes_cmac *aes_cmac,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_cmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&aes_cmac->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+/*
+ * Drop a partial cmac, keep the key (context pool).
+ */
+void
+aes_cmac_reset_state(struct zpc_aes_cmac *aes_cmac)
+{
+	__aes_cmac_reset_state(aes_cmac);
+}
+
+int
+zpc_aes_cmac_dup(struct zpc_aes_cmac **aes_cmac, const struct zpc_aes_cmac *src)
+{
+	struct zpc_aes_cmac *new_aes_cmac = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_cmac) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_cmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
 	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_aes_cmac = malloc(sizeof(*new_aes_cmac));
+	if (new_aes_cmac == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_aes_cmac, src, sizeof(*new_aes_cmac));
+	memset(&new_aes_cmac->stats, 0, sizeof(new_aes_cmac->stats));
+	memset(&new_aes_cmac->pool, 0, sizeof(new_aes_cmac->pool));
+
+	if (new_aes_cmac->key_set)
+		aes_key_ref(new_aes_cmac->aes_key);
 
+	DEBUG("aes-cmac context at %p: copy of %p", new_aes_cmac, src);
+	*aes_cmac = new_aes_cmac;
+	rc = 0;
 ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
@@ -350,6 +403,227 @@ zpc_aes_cmac_free(struct zpc_aes_cmac **aes_cmac)
 	DEBUG("return");
 }
 
+/*
+ * Argument checks of signv and verifyv. The buffers are passed to
+ * __aes_cmac_update one by one, blocks spanning buffers are collected
+ * in the context. For the final operation, the mac is stored in buf.
+ */
+static int
+__aes_cmac_cryptv(struct zpc_aes_cmac *aes_cmac, const u8 * tag,
+    size_t taglen, const struct iovec *in, int iovcnt, u8 * buf,
+    size_t buflen)
+{
+	struct stats_op st = { 0 };
+	size_t inlen;
+	int rc, i;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_cmac)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_cmac == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	/* Valid tag byte-lengths: >= 8, <= 16. */
+	if (taglen > 0 && tag == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (tag != NULL && (taglen > 16 || taglen < 8))
+		return ZPC_ERROR_TAGSIZE;
+	if (iovcnt < 0)
+		return ZPC_ERROR_ARG5RANGE;
+	if (iovcnt > 0 && in == NULL)
+		return ZPC_ERROR_ARG4NULL;
+	if (iov_len(in, iovcnt, &inlen) != 0)
+		return ZPC_ERROR_ARG4RANGE;
+
+	if (!aes_cmac->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+
+	stats_op_begin(&st, &aes_cmac->stats, ZPC_STATS_OP_AES_CMAC);
+	rc = 0;
+	for (i = 0; i < iovcnt && rc == 0; i++)
+		rc = __aes_cmac_update(aes_cmac, in[i].iov_base, in[i].iov_len);
+	if (rc == 0 && tag != NULL)
+		rc = __aes_cmac_final(aes_cmac, buf, buflen);
+	stats_op_end(&st, inlen);
+	return rc;
+}
+
+/*
+ * The context and all messages are checked once for the whole batch.
+ * Messages are then MACed back to back with the protected key in the
+ * parameter blocks. If valid is NULL, the macs are stored, otherwise
+ * they are verified and the result is stored in the valid bitmap.
+ */
+static int
+__aes_cmac_batch(struct zpc_aes_cmac *aes_cmac,
+    const struct zpc_aes_cmac_msg *msgs, size_t nmsgs, size_t taglen,
+    u8 * valid)
+{
+	struct stats_op st = { 0 };
+	size_t i, bytes = 0;
+	int rc, mismatch = 0;
+	u8 tmp[16];
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_cmac)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_cmac == NULL)
+		return ZPC_ERROR_ARG1NULL;
+	if (nmsgs > 0 && msgs == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	/* Valid tag byte-lengths: >= 8, <= 16. */
+	if (taglen > 16 || taglen < 8)
+		return ZPC_ERROR_TAGSIZE;
+	if (!aes_cmac->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+
+	for (i = 0; i < nmsgs; i++) {
+		if ((msgs[i].msglen > 0 && msgs[i].msg == NULL)
+		    || msgs[i].mac == NULL)
+			return ZPC_ERROR_ARG2NULL;
+	}
+
+	if (valid != NULL)
+		memset(valid, 0, (nmsgs + 7) / 8);
+
+	__aes_cmac_reset_state(aes_cmac);
+
+	stats_op_begin(&st, &aes_cmac->stats, ZPC_STATS_OP_AES_CMAC);
+	rc = 0;
+	for (i = 0; i < nmsgs; i++) {
+		rc = __aes_cmac_msg(aes_cmac, tmp, msgs[i].msg, msgs[i].msglen);
+		if (rc)
+			break;
+		bytes += msgs[i].msglen;
+
+		if (valid == NULL)
+			memcpy(msgs[i].mac, tmp, taglen);
+		else if (memcmp_consttime(tmp, msgs[i].mac, taglen) == 0)
+			valid[i / 8] |= (u8)(1 << (i % 8));
+		else
+			mismatch = 1;
+	}
+	stats_op_end(&st, bytes);
+
+	memzero_secure(tmp, sizeof(tmp));
+	if (rc == 0 && mismatch)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	return rc;
+}
+
+/* Full 16-byte mac of one message of a batch. */
+static int
+__aes_cmac_msg(struct zpc_aes_cmac *aes_cmac, u8 * tag, const u8 * m,
+    size_t mlen)
+{
+	int rc;
+
+	rc = __aes_cmac_update(aes_cmac, m, mlen);
+	if (rc == 0)
+		rc = __aes_cmac_final(aes_cmac, tag, 16);
+	return rc;
+}
+
+/*
+ * Absorb a chunk of any length. Whole blocks are MACed from the caller's
+ * buffer, the last block of the data so far, complete or not, is kept
+ * in the context: it is the input of the final pcc.
+ */
+static int
+__aes_cmac_update(struct zpc_aes_cmac *aes_cmac, const u8 * in,
+    size_t inlen)
+{
+	size_t n;
+	int rc;
+
+	if (aes_cmac->buflen + inlen <= sizeof(aes_cmac->buf)) {
+		if (inlen > 0)
+			memcpy(aes_cmac->buf + aes_cmac->buflen, in, inlen);
+		aes_cmac->buflen += inlen;
+		return 0;
+	}
+
+	if (aes_cmac->buflen > 0) {
+		n = sizeof(aes_cmac->buf) - aes_cmac->buflen;
+		memcpy(aes_cmac->buf + aes_cmac->buflen, in, n);
+		in += n;
+		inlen -= n;
+
+		rc = __aes_cmac_crypt_prot(aes_cmac, NULL, 0, aes_cmac->buf,
+		    sizeof(aes_cmac->buf));
+		if (rc)
+			return rc;
+		aes_cmac->buflen = 0;
+	}
+
+	/* inlen > 0: keep 1 to 16 bytes. */
+	n = (inlen - 1) & ~(size_t)0xf;
+	if (n > 0) {
+		rc = __aes_cmac_crypt_prot(aes_cmac, NULL, 0, in, n);
+		if (rc)
+			return rc;
+	}
+
+	memcpy(aes_cmac->buf, in + n, inlen - n);
+	aes_cmac->buflen = inlen - n;
+	return 0;
+}
+
+/* pcc of the kept block. The state is reset for the next message. */
+static int
+__aes_cmac_final(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen)
+{
+	return __aes_cmac_crypt_prot(aes_cmac, tag, taglen, aes_cmac->buf,
+	    aes_cmac->buflen);
+}
+
+/*
+ * __aes_cmac_crypt with protected key re-derivation. Callers pass either
+ * whole blocks (kmac) or a final block (pcc), so a retry repeats exactly
+ * the one instruction that failed.
+ */
+static int
+__aes_cmac_crypt_prot(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen,
+    const u8 * in, size_t inlen)
+{
+	struct cpacf_kmac_aes_param *param_kmac;
+	struct cpacf_pcc_cmac_aes_param *param_pcc;
+	int rc, i;
+
+	assert(tag == NULL || inlen <= 16);
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param_kmac = &aes_cmac->param_kmac;
+		param_pcc = &aes_cmac->param_pcc;
+
+		for (;;) {
+			rc = __aes_cmac_crypt(aes_cmac, tag, taglen, in, inlen, 0);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_cmac->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_cmac->aes_key, i,
+					    param_kmac->protkey, sizeof(param_kmac->protkey),
+					    &aes_cmac->key_gen);
+					memcpy(param_pcc->protkey, param_kmac->protkey,
+					    sizeof(param_pcc->protkey));
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	return rc;
+}
+
 static int
 __aes_cmac_crypt(struct zpc_aes_cmac *aes_cmac, u8 * tag, size_t taglen,
     const u8 * in, size_t inlen, unsigned long flags)
@@ -424,4 +698,6 @@ __aes_cmac_reset_state(struct zpc_aes_cmac *aes_cmac)
 	memset(&aes_cmac->param_pcc.icv, 0, sizeof(aes_cmac->param_pcc.icv));
 	memset(&aes_cmac->param_pcc.message, 0, sizeof(aes_cmac->param_pcc.message));
 	aes_cmac->param_pcc.ml = 0;
+	memzero_secure(aes_cmac->buf, sizeof(aes_cmac->buf));
+	aes_cmac->buflen = 0;
 }
@@ -11,6 +11,7 @@
 # include "zpc/aes_key.h"
 
 # include "misc.h"
+# include "ctx_pool.h"
 # include "cpacf.h"
 
 /*
@@ -21,10 +22,19 @@ struct zpc_aes_cmac {
 	struct cpacf_kmac_aes_param param_kmac;
 	struct cpacf_pcc_cmac_aes_param param_pcc;
 	struct zpc_aes_key *aes_key;
+	unsigned long long key_gen;	/* aes_key->prot_gen of param */
 
 	unsigned int fc;
 
+	u8 buf[16];		/* last block, complete or not, for pcc */
+	size_t buflen;
+
 	int key_set;
+
+	struct stats_ctx stats;
+	struct ctx_pool_mark pool;
 };
 
+void aes_cmac_reset_state(struct zpc_aes_cmac *);
+
 #endif
@@ -0,0 +1,675 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stdbool.h>
+
+#include "zpc/aes_ctr.h"
+#include "zpc/error.h"
+
+#include "aes_ctr_local.h"
+#include "aes_key_local.h"
+#include "cpacf.h"
+#include "globals.h"
+#include "misc.h"
+#include "parallel.h"
+#include "stats.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Counter blocks per KMCTR instruction. */
+#define AES_CTR_BLKS	256
+
+static int __aes_ctr_crypt(struct zpc_aes_ctr *, u8 *, const u8 *, size_t);
+static int __aes_ctr_crypt_blocks(struct zpc_aes_ctr *, u8 *, const u8 *,
+    size_t, int);
+static int __aes_ctr_crypt_par(struct zpc_aes_ctr *, u8 *, const u8 *,
+    size_t);
+static int __aes_ctr_crypt_chunk(void *, size_t);
+static int __aes_ctr_blocks_rederive(struct zpc_aes_ctr *, u8 *, const u8 *,
+    size_t, int);
+static int __aes_ctr_blocks(struct zpc_aes_ctr *, u8 *, const u8 *, size_t);
+static void __aes_ctr_add(u8 ctr[16], u64);
+static void __aes_ctr_reset(struct zpc_aes_ctr *);
+static void __aes_ctr_reset_iv(struct zpc_aes_ctr *);
+
+struct aes_ctr_par {
+	const struct zpc_aes_ctr *aes_ctr;
+	u8 *out;
+	const u8 *in;
+};
+
+int
+zpc_aes_ctr_alloc(struct zpc_aes_ctr **aes_ctr)
+{
+	struct zpc_aes_ctr *new_aes_ctr = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	new_aes_ctr = calloc(1, sizeof(*new_aes_ctr));
+	if (new_aes_ctr == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	DEBUG("aes-ctr context at %p: allocated", new_aes_ctr);
+	*aes_ctr = new_aes_ctr;
+	rc = 0;
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ctr_set_key(struct zpc_aes_ctr *aes_ctr, struct zpc_aes_key *aes_key)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	if (aes_key == NULL) {
+		/* If another key is already set, unset it and decrease
+		 * refcount. */
+		DEBUG("aes-ctr context at %p: key unset", aes_ctr);
+		__aes_ctr_reset(aes_ctr);
+		rc = 0;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	rc = aes_key_check(aes_key);
+	if (rc)
+		goto ret;
+
+	if (aes_ctr->aes_key == aes_key) {
+		DEBUG("aes-ctr context at %p: key at %p already set", aes_ctr, aes_key);
+		rc = 0; /* nothing to do */
+		goto ret;
+	}
+
+	aes_key_ref(aes_key);
+
+	if (aes_ctr->key_set) {
+		/* If another key is already set, unset it and decrease
+		 * refcount. */
+		DEBUG("aes-ctr context at %p: key unset", aes_ctr);
+		__aes_ctr_reset(aes_ctr);
+	}
+
+	/* Set new key. */
+	assert(!aes_ctr->key_set);
+
+	DEBUG("aes-ctr context at %p: key at %p set", aes_ctr, aes_key);
+
+	aes_key_get_prot(aes_key, aes_ctr->param.protkey,
+	    sizeof(aes_ctr->param.protkey), &aes_ctr->key_gen);
+
+	aes_ctr->fc = CPACF_KMCTR_ENCRYPTED_AES_128 + (aes_key->keysize - 128) / 64;
+
+	aes_ctr->aes_key = aes_key;
+	aes_ctr->key_set = 1;
+
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ctr_set_iv(struct zpc_aes_ctr *aes_ctr, const u8 * iv)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (iv == NULL) {
+		/* Unset iv */
+		DEBUG("aes-ctr context at %p: iv unset", aes_ctr);
+		__aes_ctr_reset_iv(aes_ctr);
+		rc = 0;
+		goto ret;
+	}
+
+	if (aes_ctr->key_set != 1) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+
+	__aes_ctr_reset_iv(aes_ctr);
+	memcpy(aes_ctr->iv, iv, 16);
+	memcpy(aes_ctr->ctr, iv, 16);
+	DEBUG("aes-ctr context at %p: iv set", aes_ctr);
+	aes_ctr->iv_set = 1;
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ctr_seek(struct zpc_aes_ctr *aes_ctr, unsigned long long offset)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (!aes_ctr->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_ctr->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	/* The block's keystream is computed by the next operation. */
+	memcpy(aes_ctr->ctr, aes_ctr->iv, 16);
+	__aes_ctr_add(aes_ctr->ctr, offset / 16);
+	memzero_secure(aes_ctr->ks, sizeof(aes_ctr->ks));
+	aes_ctr->ksoff = offset % 16;
+	aes_ctr->ks_set = 0;
+
+	DEBUG("aes-ctr context at %p: position %llu", aes_ctr, offset);
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ctr_encrypt(struct zpc_aes_ctr *aes_ctr, u8 * c, const u8 * m,
+    size_t mlen)
+{
+	struct stats_op st = { 0 };
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if ((mlen > 0 || m != NULL) && c == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if ((mlen > 0 || c != NULL) && m == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (!aes_ctr->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_ctr->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	stats_op_begin(&st, &aes_ctr->stats, ZPC_STATS_OP_AES_CTR);
+	rc = __aes_ctr_crypt(aes_ctr, c, m, mlen);
+
+ret:
+	stats_op_end(&st, mlen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ctr_decrypt(struct zpc_aes_ctr *aes_ctr, u8 * m, const u8 * c,
+    size_t clen)
+{
+	struct stats_op st = { 0 };
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if ((clen > 0 || c != NULL) && m == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if ((clen > 0 || m != NULL) && c == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (!aes_ctr->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_ctr->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	stats_op_begin(&st, &aes_ctr->stats, ZPC_STATS_OP_AES_CTR);
+	rc = __aes_ctr_crypt(aes_ctr, m, c, clen);
+
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ctr_get_stats(const struct zpc_aes_ctr *aes_ctr,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&aes_ctr->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+int
+zpc_aes_ctr_dup(struct zpc_aes_ctr **aes_ctr, const struct zpc_aes_ctr *src)
+{
+	struct zpc_aes_ctr *new_aes_ctr = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ctr) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ctr == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_aes_ctr = malloc(sizeof(*new_aes_ctr));
+	if (new_aes_ctr == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_aes_ctr, src, sizeof(*new_aes_ctr));
+	memset(&new_aes_ctr->stats, 0, sizeof(new_aes_ctr->stats));
+
+	if (new_aes_ctr->key_set)
+		aes_key_ref(new_aes_ctr->aes_key);
+
+	DEBUG("aes-ctr context at %p: copy of %p", new_aes_ctr, src);
+	*aes_ctr = new_aes_ctr;
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+void
+zpc_aes_ctr_free(struct zpc_aes_ctr **aes_ctr)
+{
+	if (aes_ctr == NULL)
+		return;
+	if (*aes_ctr == NULL)
+		return;
+
+	if ((*aes_ctr)->key_set) {
+		/* Decrease aes_key's refcount. */
+		zpc_aes_key_free(&(*aes_ctr)->aes_key);
+		(*aes_ctr)->key_set = 0;
+		__aes_ctr_reset_iv(*aes_ctr);
+	}
+
+	__aes_ctr_reset(*aes_ctr);
+
+	free(*aes_ctr);
+	*aes_ctr = NULL;
+	DEBUG("return");
+}
+
+/*
+ * The rest of a partially used keystream block, whole blocks, then
+ * a final partial block whose keystream is kept for the next call.
+ * Once output was written, protected keys are re-derived as in
+ * aes_key_update_prot_wait.
+ */
+static int
+__aes_ctr_crypt(struct zpc_aes_ctr *aes_ctr, u8 * out, const u8 * in,
+    size_t inlen)
+{
+	size_t n, i;
+	int rc, wait = 0;
+
+	if (aes_ctr->ksoff != 0 && inlen > 0) {
+		if (!aes_ctr->ks_set) {
+			memset(aes_ctr->ks, 0, sizeof(aes_ctr->ks));
+			rc = __aes_ctr_blocks_rederive(aes_ctr, aes_ctr->ks,
+			    aes_ctr->ks, 16, wait);
+			if (rc)
+				return rc;
+			aes_ctr->ks_set = 1;
+		}
+
+		n = 16 - aes_ctr->ksoff;
+		if (n > inlen)
+			n = inlen;
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ aes_ctr->ks[aes_ctr->ksoff + i];
+
+		aes_ctr->ksoff += n;
+		if (aes_ctr->ksoff == 16) {
+			memzero_secure(aes_ctr->ks, sizeof(aes_ctr->ks));
+			aes_ctr->ksoff = 0;
+			aes_ctr->ks_set = 0;
+		}
+		out += n;
+		in += n;
+		inlen -= n;
+		wait = 1;
+	}
+
+	n = inlen & ~(size_t)15;
+	if (n > 0) {
+		if (par_nchunks(n, PAR_CHUNK, 0) > 0)
+			rc = __aes_ctr_crypt_par(aes_ctr, out, in, n);
+		else
+			rc = __aes_ctr_crypt_blocks(aes_ctr, out, in, n, wait);
+		if (rc)
+			return rc;
+		out += n;
+		in += n;
+		inlen -= n;
+		wait = 1;
+	}
+
+	if (inlen > 0) {
+		memset(aes_ctr->ks, 0, sizeof(aes_ctr->ks));
+		rc = __aes_ctr_blocks_rederive(aes_ctr, aes_ctr->ks,
+		    aes_ctr->ks, 16, wait);
+		if (rc)
+			return rc;
+		aes_ctr->ks_set = 1;
+
+		for (i = 0; i < inlen; i++)
+			out[i] = in[i] ^ aes_ctr->ks[i];
+		aes_ctr->ksoff = inlen;
+	}
+
+	return 0;
+}
+
+/* Whole blocks, inlen is a multiple of 16. */
+static int
+__aes_ctr_crypt_blocks(struct zpc_aes_ctr *aes_ctr, u8 * out, const u8 * in,
+    size_t inlen, int wait)
+{
+	size_t n;
+	int rc;
+
+	while (inlen > 0) {
+		n = inlen < AES_CTR_BLKS * 16 ? inlen : AES_CTR_BLKS * 16;
+		rc = __aes_ctr_blocks_rederive(aes_ctr, out, in, n, wait);
+		if (rc)
+			return rc;
+		wait = 1;
+		out += n;
+		in += n;
+		inlen -= n;
+	}
+	return 0;
+}
+
+/*
+ * Whole chunks on the thread pool, the rest on the calling thread.
+ * The counter block of a chunk is the current one plus the chunk's
+ * block offset.
+ * A chunk may fail after others wrote their output, so protected keys
+ * are re-derived in the calling threads even in non-blocking mode.
+ */
+static int
+__aes_ctr_crypt_par(struct zpc_aes_ctr *aes_ctr, u8 * out, const u8 * in,
+    size_t inlen)
+{
+	struct aes_ctr_par par;
+	size_t nchunks, done;
+	int rc;
+
+	nchunks = inlen / PAR_CHUNK;
+	done = nchunks * PAR_CHUNK;
+
+	par.aes_ctr = aes_ctr;
+	par.out = out;
+	par.in = in;
+
+	rc = par_run(__aes_ctr_crypt_chunk, &par, nchunks);
+	if (rc)
+		return rc;
+
+	__aes_ctr_add(aes_ctr->ctr, done / 16);
+	return __aes_ctr_crypt_blocks(aes_ctr, out + done, in + done,
+	    inlen - done, 1);
+}
+
+/* par_run callback: one chunk on a private copy of the context. */
+static int
+__aes_ctr_crypt_chunk(void *p, size_t i)
+{
+	struct aes_ctr_par *par = p;
+	struct zpc_aes_ctr aes_ctr;
+	int rc;
+
+	memcpy(&aes_ctr, par->aes_ctr, sizeof(aes_ctr));
+	__aes_ctr_add(aes_ctr.ctr, (u64)i * (PAR_CHUNK / 16));
+
+	rc = __aes_ctr_crypt_blocks(&aes_ctr, par->out + i * PAR_CHUNK,
+	    par->in + i * PAR_CHUNK, PAR_CHUNK, 1);
+
+	memzero_secure(&aes_ctr.param, sizeof(aes_ctr.param));
+	memzero_secure(aes_ctr.ks, sizeof(aes_ctr.ks));
+	return rc;
+}
+
+/*
+ * __aes_ctr_blocks with protected key re-derivation. Set wait if the
+ * operation already wrote output, see aes_key_update_prot_wait.
+ */
+static int
+__aes_ctr_blocks_rederive(struct zpc_aes_ctr *aes_ctr, u8 * out,
+    const u8 * in, size_t inlen, int wait)
+{
+	struct cpacf_kmctr_aes_param *param;
+	int rc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_ctr->param;
+
+		for (;;) {
+			rc = __aes_ctr_blocks(aes_ctr, out, in, inlen);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_ctr->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH && wait) {
+					rc = aes_key_update_prot_wait(
+					    aes_ctr->aes_key, i, param->protkey,
+					    sizeof(param->protkey),
+					    &aes_ctr->key_gen);
+				} else if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_ctr->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_ctr->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * At most AES_CTR_BLKS blocks. The counter is only advanced if the
+ * instruction succeeded, so the call can be repeated.
+ */
+static int
+__aes_ctr_blocks(struct zpc_aes_ctr *aes_ctr, u8 * out, const u8 * in,
+    size_t inlen)
+{
+	u8 ctrblk[AES_CTR_BLKS * 16], ctr[16];
+	size_t i;
+	int rc, cc;
+
+	assert(inlen % 16 == 0 && inlen <= sizeof(ctrblk));
+
+	memcpy(ctr, aes_ctr->ctr, 16);
+	for (i = 0; i < inlen; i += 16) {
+		memcpy(ctrblk + i, ctr, 16);
+		__aes_ctr_add(ctr, 1);
+	}
+
+	cc = cpacf_kmctr(aes_ctr->fc, &aes_ctr->param, out, in, inlen, ctrblk);
+	assert(cc == 0 || cc == 1 || cc == 2);
+	if (cc == 1) {
+		rc = ZPC_ERROR_WKVPMISMATCH;
+		goto err;
+	}
+
+	memcpy(aes_ctr->ctr, ctr, 16);
+	rc = 0;
+err:
+	return rc;
+}
+
+/* ctr += n, big-endian modulo 2^128. */
+static void
+__aes_ctr_add(u8 ctr[16], u64 n)
+{
+	u64 carry = n;
+	int i;
+
+	for (i = 15; i >= 0 && carry != 0; i--) {
+		carry += ctr[i];
+		ctr[i] = carry & 0xff;
+		carry >>= 8;
+	}
+}
+
+static void
+__aes_ctr_reset(struct zpc_aes_ctr *aes_ctr)
+{
+	assert(aes_ctr != NULL);
+
+	memset(&aes_ctr->param, 0, sizeof(aes_ctr->param));
+
+	__aes_ctr_reset_iv(aes_ctr);
+
+	if (aes_ctr->aes_key != NULL)
+		zpc_aes_key_free(&aes_ctr->aes_key);
+	aes_ctr->key_set = 0;
+
+	aes_ctr->fc = 0;
+}
+
+static void
+__aes_ctr_reset_iv(struct zpc_aes_ctr *aes_ctr)
+{
+	assert(aes_ctr != NULL);
+
+	memset(aes_ctr->iv, 0, sizeof(aes_ctr->iv));
+	memset(aes_ctr->ctr, 0, sizeof(aes_ctr->ctr));
+	memzero_secure(aes_ctr->ks, sizeof(aes_ctr->ks));
+	aes_ctr->ksoff = 0;
+	aes_ctr->ks_set = 0;
+	aes_ctr->iv_set = 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef AES_CTR_LOCAL_H
+# define AES_CTR_LOCAL_H
+
+# include "zpc/aes_key.h"
+
+# include "misc.h"
+# include "cpacf.h"
+
+/*
+ * Internal aes_ctr interface.
+ */
+
+struct zpc_aes_ctr {
+	struct cpacf_kmctr_aes_param param;
+	struct zpc_aes_key *aes_key;
+	unsigned long long key_gen;	/* aes_key->prot_gen of param */
+
+	unsigned int fc;
+
+	u8 iv[16];		/* counter block of stream position 0 */
+	u8 ctr[16];		/* next counter block */
+	u8 ks[16];		/* keystream block of a partially used block */
+	unsigned int ksoff;	/* used bytes of ks, 0 if none */
+	int ks_set;		/* ks computed, ctr is past its block */
+
+	int key_set;
+	int iv_set;
+
+	struct stats_ctx stats;
+};
+
+#endif
@@ -14,7 +14,10 @@
 #include "aes_key_local.h"
 #include "cpacf.h"
 #include "globals.h"
+#include "iov.h"
 #include "misc.h"
+#include "parallel.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
@@ -26,8 +29,27 @@
 
 static int __aes_ecb_crypt(struct zpc_aes_ecb *, u8 *, const u8 *, size_t,
     unsigned long);
+static int __aes_ecb_cryptv(struct zpc_aes_ecb *, const struct iovec *,
+    const struct iovec *, int, unsigned long);
+static int __aes_ecb_crypt_iov(void *, u8 *, const u8 *, size_t, int);
+static int __aes_ecb_crypt_par(struct zpc_aes_ecb *, u8 *, const u8 *,
+    size_t, size_t, unsigned long);
+static int __aes_ecb_crypt_chunk(void *, size_t);
 static void __aes_ecb_reset(struct zpc_aes_ecb *);
 
+struct aes_ecb_iov {
+	struct zpc_aes_ecb *aes_ecb;
+	unsigned long flags;
+	int wait;	/* output was written, see aes_key_update_prot_wait */
+};
+
+struct aes_ecb_par {
+	const struct zpc_aes_ecb *aes_ecb;
+	u8 *out;
+	const u8 *in;
+	unsigned long flags;
+};
+
 int
 zpc_aes_ecb_alloc(struct zpc_aes_ecb **aes_ecb)
 {
@@ -67,9 +89,7 @@ zpc_aes_ecb_alloc(struct zpc_aes_ecb **aes_ecb)
 int
 zpc_aes_ecb_set_key(struct zpc_aes_ecb *aes_ecb, struct zpc_aes_key *aes_key)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -97,9 +117,6 @@ zpc_aes_ecb_set_key(struct zpc_aes_ecb *aes_ecb, struct zpc_aes_key *aes_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
-	assert(rv == 0);
-
 	rc = aes_key_check(aes_key);
 	if (rc)
 		goto ret;
@@ -110,8 +127,7 @@ zpc_aes_ecb_set_key(struct zpc_aes_ecb *aes_ecb, struct zpc_aes_key *aes_key)
 		goto ret;
 	}
 
-	aes_key->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key, aes_key->refcount);
+	aes_key_ref(aes_key);
 
 	if (aes_ecb->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -125,8 +141,8 @@ zpc_aes_ecb_set_key(struct zpc_aes_ecb *aes_ecb, struct zpc_aes_key *aes_key)
 
 	DEBUG("aes-ecb context at %p: key at %p set", aes_ecb, aes_key);
 
-	memcpy(aes_ecb->param.protkey, aes_key->prot.protkey,
-	    sizeof(aes_ecb->param.protkey));
+	aes_key_get_prot(aes_key, aes_ecb->param.protkey,
+	    sizeof(aes_ecb->param.protkey), &aes_ecb->key_gen);
 
 	aes_ecb->fc = CPACF_KM_ENCRYPTED_AES_128 + (aes_key->keysize - 128) / 64;
 
@@ -135,8 +151,6 @@ zpc_aes_ecb_set_key(struct zpc_aes_ecb *aes_ecb, struct zpc_aes_key *aes_key)
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&aes_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -146,11 +160,10 @@ zpc_aes_ecb_encrypt(struct zpc_aes_ecb *aes_ecb, u8 * c, const u8 * m,
     size_t mlen)
 {
 	struct cpacf_km_aes_param *param;
-	struct pkey_protkey *protkey;
 	unsigned long flags = 0;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc, i;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -183,11 +196,17 @@ zpc_aes_ecb_encrypt(struct zpc_aes_ecb *aes_ecb, u8 * c, const u8 * m,
 		goto ret;
 	}
 
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	nchunks = par_nchunks(mlen, PAR_CHUNK, 0);
+	if (nchunks > 0) {
+		rc = __aes_ecb_crypt_par(aes_ecb, c, m, mlen, nchunks, flags);
+		goto ret;
+	}
+
 	rc = -1;
 	for (i = 0; i < 2 && rc != 0; i++) {
 		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
 
-		protkey = &aes_ecb->aes_key->prot;
 		param = &aes_ecb->param;
 
 		for (;;) {
@@ -200,17 +219,9 @@ zpc_aes_ecb_encrypt(struct zpc_aes_ecb *aes_ecb, u8 * c, const u8 * m,
 					goto ret;
 				}
 				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_ecb->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-ecb context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_ecb, i == 0 ? "current" : "old", aes_ecb->aes_key);
-					rc = aes_key_sec2prot(aes_ecb->aes_key, i);
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
-
-					rv = pthread_mutex_unlock(&aes_ecb->aes_key->lock);
-					assert(rv == 0);
+					rc = aes_key_update_prot(aes_ecb->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_ecb->key_gen);
 				}
 				if (rc)
 					break;
@@ -219,6 +230,7 @@ zpc_aes_ecb_encrypt(struct zpc_aes_ecb *aes_ecb, u8 * c, const u8 * m,
 	}
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -228,11 +240,10 @@ zpc_aes_ecb_decrypt(struct zpc_aes_ecb *aes_ecb, u8 * m, const u8 * c,
     size_t clen)
 {
 	struct cpacf_km_aes_param *param;
-	struct pkey_protkey *protkey;
 	unsigned long flags = CPACF_M;  /* decrypt */
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc, i;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -265,11 +276,17 @@ zpc_aes_ecb_decrypt(struct zpc_aes_ecb *aes_ecb, u8 * m, const u8 * c,
 		goto ret;
 	}
 
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	nchunks = par_nchunks(clen, PAR_CHUNK, 0);
+	if (nchunks > 0) {
+		rc = __aes_ecb_crypt_par(aes_ecb, m, c, clen, nchunks, flags);
+		goto ret;
+	}
+
 	rc = -1;
 	for (i = 0; i < 2 && rc != 0; i++) {
 		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
 
-		protkey = &aes_ecb->aes_key->prot;
 		param = &aes_ecb->param;
 
 		for (;;) {
@@ -282,17 +299,9 @@ zpc_aes_ecb_decrypt(struct zpc_aes_ecb *aes_ecb, u8 * m, const u8 * c,
 					goto ret;
 				}
 				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_ecb->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-ecb context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_ecb, i == 0 ? "current" : "old", aes_ecb->aes_key);
-					rc = aes_key_sec2prot(aes_ecb->aes_key, i);
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
-
-					rv = pthread_mutex_unlock(&aes_ecb->aes_key->lock);
-					assert(rv == 0);
+					rc = aes_key_update_prot(aes_ecb->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_ecb->key_gen);
 				}
 				if (rc)
 					break;
@@ -301,10 +310,360 @@ zpc_aes_ecb_decrypt(struct zpc_aes_ecb *aes_ecb, u8 * m, const u8 * c,
 	}
 
 ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ecb_encryptv(struct zpc_aes_ecb *aes_ecb, const struct iovec *c,
+    const struct iovec *m, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_ecb_cryptv(aes_ecb, c, m, iovcnt, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ecb_decryptv(struct zpc_aes_ecb *aes_ecb, const struct iovec *m,
+    const struct iovec *c, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_ecb_cryptv(aes_ecb, m, c, iovcnt, CPACF_M);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ecb_encrypt_pad_update(struct zpc_aes_ecb *aes_ecb, u8 * c,
+    size_t *clen, const u8 * m, size_t mlen)
+{
+	struct aes_ecb_iov arg;
+	struct stats_op st = { 0 };
+	size_t n, nchunks, len = 0;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ecb) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ecb == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (mlen > 0 && c == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (clen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
+
+	if (!aes_ecb->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+
+	arg.aes_ecb = aes_ecb;
+	arg.flags = 0;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	if (aes_ecb->buflen + mlen < 16) {
+		if (mlen > 0)
+			memcpy(aes_ecb->buf + aes_ecb->buflen, m, mlen);
+		aes_ecb->buflen += mlen;
+		rc = 0;
+		goto ret;
+	}
+
+	if (aes_ecb->buflen > 0) {
+		n = 16 - aes_ecb->buflen;
+		memcpy(aes_ecb->buf + aes_ecb->buflen, m, n);
+		rc = __aes_ecb_crypt_iov(&arg, c, aes_ecb->buf, 16, 1);
+		if (rc)
+			goto ret;
+		aes_ecb->buflen = 0;
+		c += 16;
+		m += n;
+		mlen -= n;
+		len = 16;
+	}
+
+	n = mlen & ~(size_t)0xf;
+	nchunks = par_nchunks(n, PAR_CHUNK, 0);
+	if (nchunks > 0)
+		rc = __aes_ecb_crypt_par(aes_ecb, c, m, n, nchunks, 0);
+	else
+		rc = __aes_ecb_crypt_iov(&arg, c, m, n, 1);
+	if (rc)
+		goto ret;
+	len += n;
+
+	memcpy(aes_ecb->buf, m + n, mlen - n);
+	aes_ecb->buflen = mlen - n;
+ret:
+	if (rc == 0)
+		*clen = len;
+	stats_op_end(&st, len);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ecb_encrypt_pad_final(struct zpc_aes_ecb *aes_ecb, u8 * c,
+    size_t *clen)
+{
+	struct aes_ecb_iov arg;
+	struct stats_op st = { 0 };
+	size_t padlen;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ecb) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ecb == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (c == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (clen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (!aes_ecb->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+
+	arg.aes_ecb = aes_ecb;
+	arg.flags = 0;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	padlen = 16 - aes_ecb->buflen;
+	memset(aes_ecb->buf + aes_ecb->buflen, (int)padlen, padlen);
+	rc = __aes_ecb_crypt_iov(&arg, c, aes_ecb->buf, 16, 1);
+	if (rc)
+		goto ret;
+
+	memzero_secure(aes_ecb->buf, sizeof(aes_ecb->buf));
+	aes_ecb->buflen = 0;
+	*clen = 16;
+ret:
+	stats_op_end(&st, 16);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ecb_decrypt_pad_update(struct zpc_aes_ecb *aes_ecb, u8 * m,
+    size_t *mlen, const u8 * c, size_t clen)
+{
+	struct aes_ecb_iov arg;
+	struct stats_op st = { 0 };
+	size_t n, keep, nchunks, len = 0;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ecb) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ecb == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (clen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (mlen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+	if (clen > 0 && c == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
+
+	if (!aes_ecb->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+
+	arg.aes_ecb = aes_ecb;
+	arg.flags = CPACF_M;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	if (aes_ecb->buflen + clen <= 16) {
+		if (clen > 0)
+			memcpy(aes_ecb->buf + aes_ecb->buflen, c, clen);
+		aes_ecb->buflen += clen;
+		rc = 0;
+		goto ret;
+	}
+
+	/* The last block may hold the padding: keep it for final. */
+	keep = (aes_ecb->buflen + clen - 1) % 16 + 1;
+
+	if (aes_ecb->buflen > 0) {
+		n = 16 - aes_ecb->buflen;
+		memcpy(aes_ecb->buf + aes_ecb->buflen, c, n);
+		rc = __aes_ecb_crypt_iov(&arg, m, aes_ecb->buf, 16, 1);
+		if (rc)
+			goto ret;
+		aes_ecb->buflen = 0;
+		m += 16;
+		c += n;
+		clen -= n;
+		len = 16;
+	}
+
+	n = clen - keep;
+	nchunks = par_nchunks(n, PAR_CHUNK, 0);
+	if (nchunks > 0)
+		rc = __aes_ecb_crypt_par(aes_ecb, m, c, n, nchunks, CPACF_M);
+	else
+		rc = __aes_ecb_crypt_iov(&arg, m, c, n, 1);
+	if (rc)
+		goto ret;
+	len += n;
+
+	memcpy(aes_ecb->buf, c + n, keep);
+	aes_ecb->buflen = keep;
+ret:
+	if (rc == 0)
+		*mlen = len;
+	stats_op_end(&st, len);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
 
+int
+zpc_aes_ecb_decrypt_pad_final(struct zpc_aes_ecb *aes_ecb, u8 * m,
+    size_t *mlen)
+{
+	struct aes_ecb_iov arg;
+	struct stats_op st = { 0 };
+	size_t len;
+	u8 tmp[16];
+	int rc, bad;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_ecb) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_ecb == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (m == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (mlen == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (!aes_ecb->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (aes_ecb->buflen != 16) {
+		rc = ZPC_ERROR_CLEN;
+		goto ret;
+	}
+
+	arg.aes_ecb = aes_ecb;
+	arg.flags = CPACF_M;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	rc = __aes_ecb_crypt_iov(&arg, tmp, aes_ecb->buf, 16, 1);
+	if (rc)
+		goto ret;
+
+	bad = pkcs7_unpad(tmp, &len);
+	memcpy(m, tmp, 16);
+	memzero_secure(tmp, sizeof(tmp));
+	memzero_secure(aes_ecb->buf, sizeof(aes_ecb->buf));
+	aes_ecb->buflen = 0;
+
+	*mlen = len;
+	rc = bad ? ZPC_ERROR_PADDING : 0;
+ret:
+	stats_op_end(&st, 16);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_ecb_get_stats(const struct zpc_aes_ecb *aes_ecb,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_ecb == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&aes_ecb->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+/*
+ * Drop the pending block of a padded operation, keep the key (context
+ * pool).
+ */
+void
+aes_ecb_reset_state(struct zpc_aes_ecb *aes_ecb)
+{
+	memzero_secure(aes_ecb->buf, sizeof(aes_ecb->buf));
+	aes_ecb->buflen = 0;
+}
+
 void
 zpc_aes_ecb_free(struct zpc_aes_ecb **aes_ecb)
 {
@@ -326,6 +685,148 @@ zpc_aes_ecb_free(struct zpc_aes_ecb **aes_ecb)
 	DEBUG("return");
 }
 
+/* Argument checks and segment walk of encryptv and decryptv. */
+static int
+__aes_ecb_cryptv(struct zpc_aes_ecb *aes_ecb, const struct iovec *out,
+    const struct iovec *in, int iovcnt, unsigned long flags)
+{
+	struct aes_ecb_iov arg;
+	struct stats_op st = { 0 };
+	size_t inlen, outlen;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_ecb)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_ecb == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	if (iovcnt < 0)
+		return ZPC_ERROR_ARG4RANGE;
+	if (iovcnt > 0 && out == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (iovcnt > 0 && in == NULL)
+		return ZPC_ERROR_ARG3NULL;
+	if (iov_len(in, iovcnt, &inlen) != 0)
+		return ZPC_ERROR_ARG3RANGE;
+	if (iov_len(out, iovcnt, &outlen) != 0 || outlen != inlen)
+		return ZPC_ERROR_ARG2RANGE;
+	if (inlen % 16 != 0)
+		return (flags & CPACF_M) ? ZPC_ERROR_CLEN : ZPC_ERROR_MLEN;
+
+	if (!aes_ecb->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+
+	arg.aes_ecb = aes_ecb;
+	arg.flags = flags;
+	arg.wait = 0;
+
+	stats_op_begin(&st, &aes_ecb->stats, ZPC_STATS_OP_AES_ECB);
+	rc = iov_walk(out, in, iovcnt, inlen, 16, 0, __aes_ecb_crypt_iov, &arg);
+	stats_op_end(&st, inlen);
+	return rc;
+}
+
+/* iov_walk callback: __aes_ecb_crypt with protected key re-derivation. */
+static int
+__aes_ecb_crypt_iov(void *p, u8 *out, const u8 *in, size_t inlen, int last)
+{
+	struct aes_ecb_iov *arg = p;
+	struct zpc_aes_ecb *aes_ecb = arg->aes_ecb;
+	struct cpacf_km_aes_param *param;
+	int rc, i;
+
+	UNUSED(last);
+
+	if (inlen == 0)
+		return 0;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_ecb->param;
+
+		for (;;) {
+			rc = __aes_ecb_crypt(aes_ecb, out, in, inlen, arg->flags);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_ecb->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH && arg->wait) {
+					rc = aes_key_update_prot_wait(
+					    aes_ecb->aes_key, i, param->protkey,
+					    sizeof(param->protkey),
+					    &aes_ecb->key_gen);
+				} else if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_ecb->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_ecb->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	if (rc == 0)
+		arg->wait = 1;
+	return rc;
+}
+
+/*
+ * Whole chunks on the thread pool, the rest on the calling thread.
+ * ECB has no chaining value, so a chunk's context copy is used as is.
+ * A chunk may fail after others wrote their output, so protected keys
+ * are re-derived in the calling threads even in non-blocking mode.
+ */
+static int
+__aes_ecb_crypt_par(struct zpc_aes_ecb *aes_ecb, u8 *out, const u8 *in,
+    size_t inlen, size_t nchunks, unsigned long flags)
+{
+	struct aes_ecb_par par;
+	struct aes_ecb_iov arg;
+	size_t done = nchunks * PAR_CHUNK;
+	int rc;
+
+	par.aes_ecb = aes_ecb;
+	par.out = out;
+	par.in = in;
+	par.flags = flags;
+
+	rc = par_run(__aes_ecb_crypt_chunk, &par, nchunks);
+	if (rc)
+		return rc;
+
+	arg.aes_ecb = aes_ecb;
+	arg.flags = flags;
+	arg.wait = 1;
+	return __aes_ecb_crypt_iov(&arg, out + done, in + done, inlen - done, 1);
+}
+
+/* par_run callback: one chunk on a private copy of the context. */
+static int
+__aes_ecb_crypt_chunk(void *p, size_t i)
+{
+	struct aes_ecb_par *par = p;
+	struct zpc_aes_ecb aes_ecb;
+	struct aes_ecb_iov arg;
+	int rc;
+
+	memcpy(&aes_ecb, par->aes_ecb, sizeof(aes_ecb));
+	arg.aes_ecb = &aes_ecb;
+	arg.flags = par->flags;
+	arg.wait = 1;
+
+	rc = __aes_ecb_crypt_iov(&arg, par->out + i * PAR_CHUNK,
+	    par->in + i * PAR_CHUNK, PAR_CHUNK, 0);
+
+	memzero_secure(&aes_ecb.param, sizeof(aes_ecb.param));
+	return rc;
+}
+
 static int
 __aes_ecb_crypt(struct zpc_aes_ecb *aes_ecb, u8 * out, const u8 * in,
     size_t inlen, unsigned long flags)
@@ -353,6 +854,7 @@ __aes_ecb_reset(struct zpc_aes_ecb *aes_ecb)
 	assert(aes_ecb != NULL);
 
 	memset(&aes_ecb->param, 0, sizeof(aes_ecb->param));
+	aes_ecb_reset_state(aes_ecb);
 
 	if (aes_ecb->aes_key != NULL)
 		zpc_aes_key_free(&aes_ecb->aes_key);
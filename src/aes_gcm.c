@@ -13,12 +13,16 @@
 #include "aes_gcm_local.h"
 #include "aes_key_local.h"
 #include "cpacf.h"
+#include "drbg.h"
 #include "globals.h"
+#include "iov.h"
 #include "misc.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
 #include <assert.h>
+#include <endian.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -27,9 +31,29 @@
 static int __aes_gcm_set_iv(struct zpc_aes_gcm *, const u8 *, size_t);
 static int __aes_gcm_crypt(struct zpc_aes_gcm *, u8 *, u8 *, size_t, const u8 *,
     size_t, const u8 *, size_t, unsigned long);
+static int __aes_gcm_stream(struct zpc_aes_gcm *, u8 *, u8 *, size_t,
+    const u8 *, size_t, const u8 *, size_t, unsigned long);
+static int __aes_gcm_kma(struct zpc_aes_gcm *, u8 *, u8 *, size_t, const u8 *,
+    size_t, const u8 *, size_t, unsigned long);
+static int __aes_gcm_keystream(struct zpc_aes_gcm *, u8[16]);
+static int __aes_gcm_cryptv(struct zpc_aes_gcm *, const struct iovec *, u8 *,
+    size_t, const u8 *, size_t, const struct iovec *, int, unsigned long);
+static int __aes_gcm_crypt_iov(void *, u8 *, const u8 *, size_t, int);
+static int __aes_gcm_batch(struct zpc_aes_gcm *, struct zpc_aes_gcm_msg *,
+    size_t, int);
+static int __aes_gcm_msg(struct zpc_aes_gcm *, struct zpc_aes_gcm_msg *, int);
 static void __aes_gcm_reset(struct zpc_aes_gcm *);
 static void __aes_gcm_reset_iv(struct zpc_aes_gcm *);
 
+struct aes_gcm_iov {
+	struct zpc_aes_gcm *aes_gcm;
+	const u8 *aad;		/* NULL once hashed */
+	size_t aadlen;
+	u8 *tag;		/* NULL if not the final call */
+	size_t taglen;
+	unsigned long flags;
+};
+
 int
 zpc_aes_gcm_alloc(struct zpc_aes_gcm **aes_gcm)
 {
@@ -69,9 +93,7 @@ zpc_aes_gcm_alloc(struct zpc_aes_gcm **aes_gcm)
 int
 zpc_aes_gcm_set_key(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_key *aes_key)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -99,9 +121,6 @@ zpc_aes_gcm_set_key(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_key *aes_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
-	assert(rv == 0);
-
 	rc = aes_key_check(aes_key);
 	if (rc)
 		goto ret;
@@ -112,8 +131,7 @@ zpc_aes_gcm_set_key(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_key *aes_key)
 		goto ret;
 	}
 
-	aes_key->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key, aes_key->refcount);
+	aes_key_ref(aes_key);
 
 	if (aes_gcm->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -127,8 +145,8 @@ zpc_aes_gcm_set_key(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_key *aes_key)
 
 	DEBUG("aes-gcm context at %p: key at %p set, iv unset", aes_gcm, aes_key);
 
-	memcpy(aes_gcm->param.protkey, aes_key->prot.protkey,
-	    sizeof(aes_gcm->param.protkey));
+	aes_key_get_prot(aes_key, aes_gcm->param.protkey,
+	    sizeof(aes_gcm->param.protkey), &aes_gcm->key_gen);
 
 	aes_gcm->fc = CPACF_KMA_GCM_ENCRYPTED_AES_128 + (aes_key->keysize - 128) / 64;
 
@@ -140,8 +158,6 @@ zpc_aes_gcm_set_key(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_key *aes_key)
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&aes_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -149,7 +165,7 @@ ret:
 int
 zpc_aes_gcm_create_iv(struct zpc_aes_gcm *aes_gcm, u8 *iv, size_t ivlen)
 {
-	u8 *iv_tmp = NULL;
+	u64 invocation;
 	int rc;
 
 	if (pkeyfd < 0) {
@@ -179,31 +195,107 @@ zpc_aes_gcm_create_iv(struct zpc_aes_gcm *aes_gcm, u8 *iv, size_t ivlen)
 		goto ret;
 	}
 
-	iv_tmp = calloc(ivlen, 1);
-	if (!iv_tmp) {
-		rc = ZPC_ERROR_MALLOC;
-		goto ret;
-	}
-
-	if (local_rng(iv_tmp, ivlen) != 0) {
+	if (aes_gcm->iv_det) {
+		if (ivlen != GCM_RECOMMENDED_IV_LENGTH) {
+			rc = ZPC_ERROR_IVSIZE;
+			goto ret;
+		}
+		if (aes_gcm->iv_counter == GCM_IV_COUNTER_EXHAUSTED) {
+			rc = ZPC_ERROR_GCM_IV_EXHAUSTED;
+			goto ret;
+		}
+		/* An invocation field is never used twice, even on error. */
+		invocation = htobe64(aes_gcm->iv_counter++);
+		memcpy(iv, aes_gcm->iv_fixed, GCM_IV_FIXED_FIELD_LENGTH);
+		memcpy(iv + GCM_IV_FIXED_FIELD_LENGTH, &invocation,
+		    sizeof(invocation));
+	} else if (drbg_generate(iv, ivlen) != 0) {
 		rc = ZPC_ERROR_RNDGEN;
 		goto ret;
 	}
 
 	aes_gcm->iv_created = 0;
-	rc = zpc_aes_gcm_set_iv(aes_gcm, iv_tmp, ivlen);
-	if (rc != 0)
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, ivlen);
+	if (rc != 0) {
+		memzero_secure(iv, ivlen);
 		goto ret;
+	}
 
 	DEBUG("aes-gcm context at %p: iv created and set", aes_gcm);
 	aes_gcm->iv_set = 1;
 	aes_gcm->iv_created = 1;
-	memcpy(iv, iv_tmp, ivlen);
 	rc = 0;
 
 ret:
-	if (iv_tmp != NULL)
-		free(iv_tmp);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gcm_set_iv_fixed(struct zpc_aes_gcm *aes_gcm, const u8 *fixed,
+    size_t fixedlen, unsigned long long counter)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gcm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (fixed == NULL) {
+		/* Back to random ivs. */
+		DEBUG("aes-gcm context at %p: fixed field unset", aes_gcm);
+		memzero_secure(aes_gcm->iv_fixed, sizeof(aes_gcm->iv_fixed));
+		aes_gcm->iv_counter = 0;
+		aes_gcm->iv_det = 0;
+		rc = 0;
+		goto ret;
+	}
+	if (fixedlen != GCM_IV_FIXED_FIELD_LENGTH) {
+		rc = ZPC_ERROR_ARG3RANGE;
+		goto ret;
+	}
+
+	memcpy(aes_gcm->iv_fixed, fixed, GCM_IV_FIXED_FIELD_LENGTH);
+	aes_gcm->iv_counter = counter;
+	aes_gcm->iv_det = 1;
+	DEBUG("aes-gcm context at %p: fixed field set, counter %llu", aes_gcm,
+	    counter);
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gcm_get_iv_counter(struct zpc_aes_gcm *aes_gcm,
+    unsigned long long *counter)
+{
+	int rc;
+
+	if (aes_gcm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (counter == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (!aes_gcm->iv_det) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	*counter = aes_gcm->iv_counter;
+	rc = 0;
+ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -212,10 +304,7 @@ int
 zpc_aes_gcm_set_iv(struct zpc_aes_gcm *aes_gcm, const u8 * iv, size_t ivlen)
 {
 	struct cpacf_kma_gcm_aes_param *param;
-	struct pkey_protkey *protkey;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	int rc, i;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -256,7 +345,6 @@ zpc_aes_gcm_set_iv(struct zpc_aes_gcm *aes_gcm, const u8 * iv, size_t ivlen)
 	for (i = 0; i < 2 && rc != 0; i++) {
 		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
 
-		protkey = &aes_gcm->aes_key->prot;
 		param = &aes_gcm->param;
 
 		for (;;) {
@@ -269,18 +357,9 @@ zpc_aes_gcm_set_iv(struct zpc_aes_gcm *aes_gcm, const u8 * iv, size_t ivlen)
 					goto ret;
 				}
 				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_gcm->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-gcm context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_gcm, i == 0 ? "current" : "old", aes_gcm->aes_key);
-					rc = aes_key_sec2prot(aes_gcm->aes_key, i);
-
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
-
-					rv = pthread_mutex_unlock(&aes_gcm->aes_key->lock);
-					assert(rv == 0);
+					rc = aes_key_update_prot(aes_gcm->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_gcm->key_gen);
 				}
 				if (rc)
 					break;
@@ -301,12 +380,9 @@ int
 zpc_aes_gcm_encrypt(struct zpc_aes_gcm *aes_gcm, u8 * c, u8 * tag,
     size_t taglen, const u8 * aad, size_t aadlen, const u8 * m, size_t mlen)
 {
-	struct cpacf_kma_gcm_aes_param *param;
-	struct pkey_protkey *protkey;
 	unsigned long flags = 0;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -344,10 +420,6 @@ zpc_aes_gcm_encrypt(struct zpc_aes_gcm *aes_gcm, u8 * c, u8 * tag,
 		rc = ZPC_ERROR_AADLEN;
 		goto ret;
 	}
-	if (aadlen > 0 && aadlen % 16 != 0 && m == NULL && tag == NULL) {
-		rc = ZPC_ERROR_ARG6RANGE;
-		goto ret;
-	}
 	/* m bit-length <= 2^39 - 256, m bit-length % 8 == 0 */
 	if ((mlen > 0 || c != NULL) && m == NULL) {
 		rc = ZPC_ERROR_ARG7NULL;
@@ -357,10 +429,6 @@ zpc_aes_gcm_encrypt(struct zpc_aes_gcm *aes_gcm, u8 * c, u8 * tag,
 		rc = ZPC_ERROR_MLEN;
 		goto ret;
 	}
-	if (mlen > 0 && mlen % 16 != 0 && tag == NULL) {
-		rc = ZPC_ERROR_ARG8RANGE;
-		goto ret;
-	}
 
 	if (!aes_gcm->key_set) {
 		rc = ZPC_ERROR_KEYNOTSET;
@@ -379,43 +447,12 @@ zpc_aes_gcm_encrypt(struct zpc_aes_gcm *aes_gcm, u8 * c, u8 * tag,
 	aes_gcm->param.taadl += (aadlen * 8);
 	aes_gcm->param.tpcl += (mlen * 8);
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0; i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
-
-		protkey = &aes_gcm->aes_key->prot;
-		param = &aes_gcm->param;
-
-		for (;;) {
-			rc = __aes_gcm_crypt(aes_gcm, c, tag, taglen, aad,
-			    aadlen, m, mlen, flags);
-			if (rc == 0) {
-				break;
-			} else {
-				if (aes_gcm->aes_key->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_gcm->aes_key->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-gcm context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_gcm, i == 0 ? "current" : "old", aes_gcm->aes_key);
-					rc = aes_key_sec2prot(aes_gcm->aes_key, i);
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
-
-					rv = pthread_mutex_unlock(&aes_gcm->aes_key->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
-	}
+	stats_op_begin(&st, &aes_gcm->stats, ZPC_STATS_OP_AES_GCM);
+	rc = __aes_gcm_stream(aes_gcm, c, tag, taglen, aad, aadlen, m, mlen,
+	    flags);
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -424,14 +461,11 @@ int
 zpc_aes_gcm_decrypt(struct zpc_aes_gcm *aes_gcm, u8 * m, const u8 * tag,
     size_t taglen, const u8 * aad, size_t aadlen, const u8 * c, size_t clen)
 {
-	struct cpacf_kma_gcm_aes_param *param;
-	struct pkey_protkey *protkey;
 	unsigned long flags = CPACF_M;  /* decrypt */
-	int rc, rv, i;
+	struct stats_op st = { 0 };
+	int rc;
 	u8 tmp[16];
 
-	UNUSED(rv);
-
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
 		goto ret;
@@ -468,10 +502,6 @@ zpc_aes_gcm_decrypt(struct zpc_aes_gcm *aes_gcm, u8 * m, const u8 * tag,
 		rc = ZPC_ERROR_AADLEN;
 		goto ret;
 	}
-	if (aadlen > 0 && aadlen % 16 != 0 && c == NULL && tag == NULL) {
-		rc = ZPC_ERROR_ARG6RANGE;
-		goto ret;
-	}
 	/* c bit-length <= 2^39 - 256, c bit-length % 8 == 0 */
 	if ((clen > 0 || m != NULL) && c == NULL) {
 		rc = ZPC_ERROR_ARG7NULL;
@@ -481,10 +511,6 @@ zpc_aes_gcm_decrypt(struct zpc_aes_gcm *aes_gcm, u8 * m, const u8 * tag,
 		rc = ZPC_ERROR_CLEN;
 		goto ret;
 	}
-	if (clen > 0 && clen % 16 != 0 && tag == NULL) {
-		rc = ZPC_ERROR_ARG8RANGE;
-		goto ret;
-	}
 
 	if (!aes_gcm->key_set) {
 		rc = ZPC_ERROR_KEYNOTSET;
@@ -507,45 +533,156 @@ zpc_aes_gcm_decrypt(struct zpc_aes_gcm *aes_gcm, u8 * m, const u8 * tag,
 	aes_gcm->param.taadl += (aadlen * 8);
 	aes_gcm->param.tpcl += (clen * 8);
 
-	rc = -1;
-	for (i = 0; i < 2 && (rc != 0 && rc != ZPC_ERROR_TAGMISMATCH); i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+	stats_op_begin(&st, &aes_gcm->stats, ZPC_STATS_OP_AES_GCM);
+	rc = __aes_gcm_stream(aes_gcm, m, tag != NULL ? tmp : NULL,
+	    tag != NULL ? sizeof(tmp) : 0, aad, aadlen, c, clen, flags);
+	if (rc == 0 && tag != NULL && memcmp_consttime(tmp, tag, taglen) != 0)
+		rc = ZPC_ERROR_TAGMISMATCH;
 
-		protkey = &aes_gcm->aes_key->prot;
-		param = &aes_gcm->param;
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
 
-		for (;;) {
-			rc = __aes_gcm_crypt(aes_gcm, m, tmp, sizeof(tmp), aad,
-			    aadlen, c, clen, flags);
-			if (rc == 0) {
-				rc = memcmp_consttime(tmp, tag, taglen);
-				if (rc)
-					rc = ZPC_ERROR_TAGMISMATCH;
-				break;
-			} else {
-				if (aes_gcm->aes_key->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_gcm->aes_key->lock);
-					assert(rv == 0);
+int
+zpc_aes_gcm_encryptv(struct zpc_aes_gcm *aes_gcm, const struct iovec *c,
+    u8 * tag, size_t taglen, const u8 * aad, size_t aadlen,
+    const struct iovec *m, int iovcnt)
+{
+	int rc;
 
-					DEBUG
-					    ("aes-gcm context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_gcm, i == 0 ? "current" : "old", aes_gcm->aes_key);
-					rc = aes_key_sec2prot(aes_gcm->aes_key, i);
-					memcpy(param->protkey, protkey->protkey, sizeof(param->protkey));
+	rc = __aes_gcm_cryptv(aes_gcm, c, tag, taglen, aad, aadlen, m, iovcnt, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
 
-					rv = pthread_mutex_unlock(&aes_gcm->aes_key->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
+int
+zpc_aes_gcm_decryptv(struct zpc_aes_gcm *aes_gcm, const struct iovec *m,
+    const u8 * tag, size_t taglen, const u8 * aad, size_t aadlen,
+    const struct iovec *c, int iovcnt)
+{
+	u8 tmp[16];
+	int rc;
+
+	rc = __aes_gcm_cryptv(aes_gcm, m, tag != NULL ? tmp : NULL, taglen, aad,
+	    aadlen, c, iovcnt, CPACF_M);
+	if (rc == 0 && tag != NULL && memcmp_consttime(tmp, tag, taglen) != 0)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gcm_seal_batch(struct zpc_aes_gcm *aes_gcm,
+    struct zpc_aes_gcm_msg *msgs, size_t nmsgs)
+{
+	int rc;
+
+	rc = __aes_gcm_batch(aes_gcm, msgs, nmsgs, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gcm_open_batch(struct zpc_aes_gcm *aes_gcm,
+    struct zpc_aes_gcm_msg *msgs, size_t nmsgs)
+{
+	int rc;
+
+	rc = __aes_gcm_batch(aes_gcm, msgs, nmsgs, 1);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gcm_get_stats(const struct zpc_aes_gcm *aes_gcm,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_gcm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
 	}
 
+	stats_ctx_get(&aes_gcm->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+/*
+ * Unset the iv and the fixed iv field, keep the key (context pool).
+ */
+void
+aes_gcm_reset_state(struct zpc_aes_gcm *aes_gcm)
+{
+	__aes_gcm_reset_iv(aes_gcm);
+	aes_gcm->iv_set = 0;
+	aes_gcm->iv_created = 0;
+
+	memzero_secure(aes_gcm->iv_fixed, sizeof(aes_gcm->iv_fixed));
+	aes_gcm->iv_counter = 0;
+	aes_gcm->iv_det = 0;
+}
+
+int
+zpc_aes_gcm_dup(struct zpc_aes_gcm **aes_gcm, const struct zpc_aes_gcm *src)
+{
+	struct zpc_aes_gcm *new_aes_gcm = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gcm == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_aes_gcm = malloc(sizeof(*new_aes_gcm));
+	if (new_aes_gcm == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_aes_gcm, src, sizeof(*new_aes_gcm));
+	memset(&new_aes_gcm->stats, 0, sizeof(new_aes_gcm->stats));
+	memset(&new_aes_gcm->pool, 0, sizeof(new_aes_gcm->pool));
+
+	if (new_aes_gcm->key_set)
+		aes_key_ref(new_aes_gcm->aes_key);
+
+	/*
+	 * An iv created by zpc_aes_gcm_create_iv is not handed to the copy,
+	 * one encryption per created iv.
+	 */
+	if (src->iv_created || src->iv_det) {
+		__aes_gcm_reset_iv(new_aes_gcm);
+		new_aes_gcm->iv_set = 0;
+		new_aes_gcm->iv_created = 0;
+		memzero_secure(new_aes_gcm->iv_fixed,
+		    sizeof(new_aes_gcm->iv_fixed));
+		new_aes_gcm->iv_counter = 0;
+		new_aes_gcm->iv_det = 0;
+	}
+
+	DEBUG("aes-gcm context at %p: copy of %p", new_aes_gcm, src);
+	*aes_gcm = new_aes_gcm;
+	rc = 0;
 ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
@@ -574,20 +711,247 @@ zpc_aes_gcm_free(struct zpc_aes_gcm **aes_gcm)
 	DEBUG("return");
 }
 
+/*
+ * Argument checks and segment walk of encryptv and decryptv. The
+ * additional authenticated data is hashed with the first chunk, the
+ * tag is computed with the last one. An intermediate operation's
+ * trailing partial block is carried in the context.
+ */
+static int
+__aes_gcm_cryptv(struct zpc_aes_gcm *aes_gcm, const struct iovec *out,
+    u8 * tag, size_t taglen, const u8 * aad, size_t aadlen,
+    const struct iovec *in, int iovcnt, unsigned long flags)
+{
+	struct aes_gcm_iov arg;
+	struct stats_op st = { 0 };
+	size_t inlen, outlen;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_gcm)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_gcm == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	if (iovcnt < 0)
+		return ZPC_ERROR_ARG8RANGE;
+	if (iovcnt > 0 && out == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (iovcnt > 0 && in == NULL)
+		return ZPC_ERROR_ARG7NULL;
+	if (iov_len(in, iovcnt, &inlen) != 0)
+		return ZPC_ERROR_ARG7RANGE;
+	if (iov_len(out, iovcnt, &outlen) != 0 || outlen != inlen)
+		return ZPC_ERROR_ARG2RANGE;
+	/* Valid tag bit-lengths: 128, 120, 112, 104, 96, 64, 32. */
+	if (taglen > 0 && tag == NULL)
+		return ZPC_ERROR_ARG3NULL;
+	if (taglen > 16 || (taglen > 0 && taglen < 12 && taglen != 8
+	    && taglen != 4))
+		return ZPC_ERROR_TAGSIZE;
+	/* aad bit-length <= 2^64 - 1, aad bit-length % 8 == 0 */
+	if (aadlen > 0 && aad == NULL)
+		return ZPC_ERROR_ARG5NULL;
+	if (aes_gcm->param.taadl / 8 + aadlen > GCM_MAX_TOTAL_AAD_LENGTH)
+		return ZPC_ERROR_AADLEN;
+	/* m bit-length <= 2^39 - 256, m bit-length % 8 == 0 */
+	if (aes_gcm->param.tpcl / 8 + inlen > GCM_MAX_TOTAL_PLAINTEXT_LENGTH)
+		return (flags & CPACF_M) ? ZPC_ERROR_CLEN : ZPC_ERROR_MLEN;
+
+	if (!aes_gcm->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (!aes_gcm->iv_set)
+		return ZPC_ERROR_IVNOTSET;
+	if ((flags & CPACF_M) && aes_gcm->iv_created)
+		return ZPC_ERROR_GCM_IV_CREATED_INTERNALLY;
+
+	aes_gcm->param.taadl += (aadlen * 8);
+	aes_gcm->param.tpcl += (inlen * 8);
+
+	arg.aes_gcm = aes_gcm;
+	arg.aad = aadlen > 0 ? aad : NULL;
+	arg.aadlen = aadlen;
+	arg.tag = tag;
+	arg.taglen = taglen;
+	arg.flags = flags;
+
+	stats_op_begin(&st, &aes_gcm->stats, ZPC_STATS_OP_AES_GCM);
+	rc = iov_walk(out, in, iovcnt, inlen, 16, inlen % 16,
+	    __aes_gcm_crypt_iov, &arg);
+	stats_op_end(&st, inlen);
+	return rc;
+}
+
+/* iov_walk callback: __aes_gcm_stream on a run of blocks or the tail. */
 static int
-__aes_gcm_set_iv(struct zpc_aes_gcm *aes_gcm, const u8 * iv, size_t ivlen)
+__aes_gcm_crypt_iov(void *p, u8 *out, const u8 *in, size_t inlen, int last)
+{
+	struct aes_gcm_iov *arg = p;
+	unsigned long flags = arg->flags;
+	u8 *tag = NULL;
+	size_t taglen = 0;
+	int rc;
+
+	if (last && arg->tag != NULL) {
+		tag = arg->tag;
+		taglen = arg->taglen;
+		flags |= CPACF_KMA_LAAD | CPACF_KMA_LPC;
+	} else if (inlen > 0) {
+		flags |= CPACF_KMA_LAAD;
+	} else if (arg->aad == NULL) {
+		return 0;	/* nothing to do */
+	}
+
+	rc = __aes_gcm_stream(arg->aes_gcm, inlen > 0 ? out : NULL, tag, taglen,
+	    arg->aad, arg->aadlen, inlen > 0 ? in : NULL, inlen, flags);
+	if (rc == 0) {
+		arg->aad = NULL;
+		arg->aadlen = 0;
+	}
+
+	return rc;
+}
+
+/*
+ * The context is checked once for the whole batch, then each message
+ * is processed on its own and its status stored in msg->rc.
+ */
+static int
+__aes_gcm_batch(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_gcm_msg *msgs,
+    size_t nmsgs, int decrypt)
+{
+	struct stats_op st = { 0 };
+	size_t i, bytes = 0;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_gcm)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_gcm == NULL)
+		return ZPC_ERROR_ARG1NULL;
+	if (nmsgs > 0 && msgs == NULL)
+		return ZPC_ERROR_ARG2NULL;
+
+	if (!aes_gcm->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (aes_gcm->iv_created)
+		return ZPC_ERROR_GCM_IV_CREATED_INTERNALLY;
+
+	DEBUG("aes-gcm context at %p: %s batch of %zu messages", aes_gcm,
+	    decrypt ? "open" : "seal", nmsgs);
+
+	stats_op_begin(&st, &aes_gcm->stats, ZPC_STATS_OP_AES_GCM);
+	rc = 0;
+	for (i = 0; i < nmsgs; i++) {
+		msgs[i].rc = __aes_gcm_msg(aes_gcm, &msgs[i], decrypt);
+		if (msgs[i].rc == 0)
+			bytes += msgs[i].len;
+		else if (rc == 0)
+			rc = msgs[i].rc;
+	}
+	stats_op_end(&st, bytes);
+
+	__aes_gcm_reset_iv(aes_gcm);
+	return rc;
+}
+
+static int
+__aes_gcm_msg(struct zpc_aes_gcm *aes_gcm, struct zpc_aes_gcm_msg *msg,
+    int decrypt)
 {
 	struct cpacf_kma_gcm_aes_param *param;
-	size_t ivpadlen;
-	u64 *ivpad = NULL;
-	int rc, cc;
+	unsigned long flags;
+	int rc, i;
+	u8 tmp[16];
+
+	if (msg->iv == NULL || (msg->aadlen > 0 && msg->aad == NULL)
+	    || (msg->len > 0 && (msg->in == NULL || msg->out == NULL))
+	    || msg->tag == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	/* 1 <= iv bit-length <= 2^64 - 1, iv bit-length % 8 == 0 */
+	if (msg->ivlen < 1 || msg->ivlen > GCM_MAX_IV_LENGTH)
+		return ZPC_ERROR_IVSIZE;
+	/* Valid tag bit-lengths: 128, 120, 112, 104, 96, 64, 32. */
+	if (msg->taglen > 16 || (msg->taglen < 12 && msg->taglen != 8
+	    && msg->taglen != 4))
+		return ZPC_ERROR_TAGSIZE;
+	if (msg->aadlen > GCM_MAX_TOTAL_AAD_LENGTH)
+		return ZPC_ERROR_AADLEN;
+	if (msg->len > GCM_MAX_TOTAL_PLAINTEXT_LENGTH)
+		return decrypt ? ZPC_ERROR_CLEN : ZPC_ERROR_MLEN;
+
+	flags = CPACF_KMA_LAAD | CPACF_KMA_LPC;
+	if (decrypt)
+		flags |= CPACF_M;
+
+	rc = -1;
+	for (i = 0; i < 2 && (rc != 0 && rc != ZPC_ERROR_TAGMISMATCH); i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_gcm->param;
+
+		for (;;) {
+			rc = __aes_gcm_set_iv(aes_gcm, msg->iv, msg->ivlen);
+			if (rc == 0) {
+				param->taadl = msg->aadlen * 8;
+				param->tpcl = msg->len * 8;
+				rc = __aes_gcm_crypt(aes_gcm, msg->out,
+				    decrypt ? tmp : msg->tag,
+				    decrypt ? sizeof(tmp) : msg->taglen,
+				    msg->aad, msg->aadlen, msg->in, msg->len,
+				    flags);
+			}
+			if (rc == 0) {
+				if (decrypt && memcmp_consttime(tmp, msg->tag,
+				    msg->taglen) != 0)
+					rc = ZPC_ERROR_TAGMISMATCH;
+				break;
+			} else {
+				if (aes_gcm->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_gcm->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_gcm->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
 
+	return rc;
+}
+
+static int
+__aes_gcm_set_iv(struct zpc_aes_gcm *aes_gcm, const u8 * iv, size_t ivlen)
+{
 	assert(aes_gcm != NULL);
+
+	aes_gcm->aadbuflen = 0;
+	aes_gcm->pbuflen = 0;
+
+	return aes_gcm_kma_set_iv(&aes_gcm->param, &aes_gcm->fc, iv, ivlen);
+}
+
+/*
+ * Compute J0 from the iv into param and reset the tag and lengths.
+ * The fc's HS flag is set once the hash subkey is in param.
+ */
+int
+aes_gcm_kma_set_iv(struct cpacf_kma_gcm_aes_param *param, unsigned int *fc,
+    const u8 * iv, size_t ivlen)
+{
+	size_t full, padlen;
+	u64 ivpad[4];
+	int cc;
+
+	assert(param != NULL);
 	assert(iv != NULL);
 	assert(ivlen <= SIZE_MAX - 16);
 
-	param = &aes_gcm->param;
-
 	memset(param->reserved, 0, sizeof(param->reserved));
 	memset(param->t, 0, sizeof(param->t));
 	param->taadl = 0;
@@ -600,36 +964,242 @@ __aes_gcm_set_iv(struct zpc_aes_gcm *aes_gcm, const u8 * iv, size_t ivlen)
 		param->j0[14] = 0;
 		param->j0[15] = 1;
 
-		param->cv = 1;
+		memcpy(&param->cv, param->j0 + 12, sizeof(param->cv));
 	} else {
-		ivpadlen = (ivlen + 15) / 16 * 16 + 16;
-
-		ivpad = calloc(1, ivpadlen);
-		if (ivpad == NULL)
-			return ZPC_ERROR_MALLOC;
+		/*
+		 * J0 = GHASH(iv || 0-pad || 64-bit 0 || 64-bit iv bit-length):
+		 * hash the full iv blocks in place, then the last partial
+		 * block and the length block from the stack.
+		 */
+		memset(param->j0, 0, sizeof(param->j0));
 
-		memcpy(ivpad, iv, ivlen);
-		ivpad[ivpadlen / 8 - 1] = ivlen * 8;
+		full = ivlen / 16 * 16;
+		if (full > 0) {
+			cc = cpacf_kma(*fc, param, NULL, iv, full, NULL, 0);
+			/* Either incomplete processing or WKaVP mismatch. */
+			assert(cc == 2 || cc == 1);
+			if (cc == 1)
+				return ZPC_ERROR_WKVPMISMATCH;
+			*fc |= CPACF_KMA_HS;
+		}
 
-		memset(param->j0, 0, sizeof(param->j0));
+		padlen = ivlen > full ? 32 : 16;
+		memset(ivpad, 0, sizeof(ivpad));
+		memcpy(ivpad, iv + full, ivlen - full);
+		ivpad[padlen / 8 - 1] = htobe64((u64)ivlen * 8);
 
-		cc = cpacf_kma(aes_gcm->fc, param, NULL, (u8 *) ivpad, ivpadlen, NULL, 0);
+		cc = cpacf_kma(*fc, param, NULL, (u8 *)ivpad, padlen, NULL, 0);
 		/* Either incomplete processing or WKaVP mismatch. */
 		assert(cc == 2 || cc == 1);
-		if (cc == 1) {
-			rc = ZPC_ERROR_WKVPMISMATCH;
-			goto ret;
-		}
-		aes_gcm->fc |= CPACF_KMA_HS;
+		if (cc == 1)
+			return ZPC_ERROR_WKVPMISMATCH;
+		*fc |= CPACF_KMA_HS;
 
 		memcpy(&param->cv, param->t + 12, sizeof(param->cv));
 		memcpy(param->j0, param->t, sizeof(param->j0));
 		memset(param->t, 0, sizeof(param->t));
 	}
 
-	rc = 0;
+	return 0;
+}
+
+/*
+ * Process a chunk of any length. flags carry CPACF_M, CPACF_KMA_LAAD if
+ * the chunk ends the additional authenticated data and CPACF_KMA_LPC if
+ * it ends the message. Whole blocks go to kma from the caller's buffers.
+ * A trailing partial aad block is carried to the next call. Of a trailing
+ * partial payload block, the input and the key stream are carried: the
+ * block is xored with the key stream right away and hashed by kma once
+ * it is complete or the message ends.
+ */
+static int
+__aes_gcm_stream(struct zpc_aes_gcm *aes_gcm, u8 * out, u8 * tag,
+    size_t taglen, const u8 * aad, size_t aadlen, const u8 * in,
+    size_t inlen, unsigned long flags)
+{
+	u8 scratch[16], b;
+	size_t n, i;
+	int rc;
+
+	if (aes_gcm->aadbuflen > 0) {
+		n = 16 - aes_gcm->aadbuflen;
+		if (n > aadlen)
+			n = aadlen;
+		memcpy(aes_gcm->aadbuf + aes_gcm->aadbuflen, aad, n);
+		aes_gcm->aadbuflen += n;
+		aad += n;
+		aadlen -= n;
+
+		if (aadlen > 0 || (aes_gcm->aadbuflen == 16
+		    && !(flags & CPACF_KMA_LAAD))) {
+			/* A full block that is not the last one. */
+			rc = __aes_gcm_kma(aes_gcm, NULL, NULL, 0, aes_gcm->aadbuf,
+			    16, NULL, 0, flags & CPACF_M);
+			if (rc)
+				return rc;
+			aes_gcm->aadbuflen = 0;
+		} else if (flags & CPACF_KMA_LAAD) {
+			aad = aes_gcm->aadbuf;
+			aadlen = aes_gcm->aadbuflen;
+			aes_gcm->aadbuflen = 0;
+		} else {
+			return 0;
+		}
+	}
+
+	if (!(flags & CPACF_KMA_LAAD)) {
+		/* Intermediate additional authenticated data. */
+		n = aadlen & ~(size_t)0xf;
+		if (n > 0) {
+			rc = __aes_gcm_kma(aes_gcm, NULL, NULL, 0, aad, n, NULL,
+			    0, flags);
+			if (rc)
+				return rc;
+		}
+		memcpy(aes_gcm->aadbuf, aad + n, aadlen - n);
+		aes_gcm->aadbuflen = aadlen - n;
+		return 0;
+	}
+
+	if (aes_gcm->pbuflen > 0) {
+		n = 16 - aes_gcm->pbuflen;
+		if (n > inlen)
+			n = inlen;
+		for (i = 0; i < n; i++) {
+			b = in[i];
+			out[i] = b ^ aes_gcm->ks[aes_gcm->pbuflen + i];
+			aes_gcm->pbuf[aes_gcm->pbuflen + i] = b;
+		}
+		aes_gcm->pbuflen += n;
+		out += n;
+		in += n;
+		inlen -= n;
+
+		if (inlen == 0 && (flags & CPACF_KMA_LPC)) {
+			rc = __aes_gcm_kma(aes_gcm, scratch, tag, taglen, aad,
+			    aadlen, aes_gcm->pbuf, aes_gcm->pbuflen, flags);
+			aes_gcm->pbuflen = 0;
+			memzero_secure(scratch, sizeof(scratch));
+			return rc;
+		}
+		if (aes_gcm->pbuflen < 16)
+			return 0;
+
+		rc = __aes_gcm_kma(aes_gcm, scratch, NULL, 0, aad, aadlen,
+		    aes_gcm->pbuf, 16, flags & ~CPACF_KMA_LPC);
+		memzero_secure(scratch, sizeof(scratch));
+		if (rc)
+			return rc;
+		aes_gcm->pbuflen = 0;
+		aad = NULL;
+		aadlen = 0;
+	}
+
+	n = (flags & CPACF_KMA_LPC) ? inlen : inlen & ~(size_t)0xf;
+	if (n > 0 || aadlen > 0 || (flags & CPACF_KMA_LPC)) {
+		rc = __aes_gcm_kma(aes_gcm, n > 0 ? out : NULL, tag, taglen, aad,
+		    aadlen, n > 0 ? in : NULL, n, flags);
+		if (rc)
+			return rc;
+	}
+	out += n;
+	in += n;
+	inlen -= n;
+
+	if (inlen > 0) {
+		rc = __aes_gcm_keystream(aes_gcm, aes_gcm->ks);
+		if (rc)
+			return rc;
+		for (i = 0; i < inlen; i++) {
+			b = in[i];
+			out[i] = b ^ aes_gcm->ks[i];
+			aes_gcm->pbuf[i] = b;
+		}
+		aes_gcm->pbuflen = inlen;
+	}
+
+	return 0;
+}
+
+/* __aes_gcm_crypt with protected key re-derivation. */
+static int
+__aes_gcm_kma(struct zpc_aes_gcm *aes_gcm, u8 * out, u8 * tag, size_t taglen,
+    const u8 * aad, size_t aadlen, const u8 * in, size_t inlen,
+    unsigned long flags)
+{
+	struct cpacf_kma_gcm_aes_param *param;
+	int rc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_gcm->param;
+
+		for (;;) {
+			rc = __aes_gcm_crypt(aes_gcm, out, tag, taglen, aad,
+			    aadlen, in, inlen, flags);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_gcm->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_gcm->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_gcm->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Key stream of the next counter block: kma on a zero block with a copy
+ * of the parameter block, so that the real tag is not touched.
+ */
+static int
+__aes_gcm_keystream(struct zpc_aes_gcm *aes_gcm, u8 ks[16])
+{
+	struct cpacf_kma_gcm_aes_param param;
+	int rc, cc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		for (;;) {
+			memcpy(&param, &aes_gcm->param, sizeof(param));
+			memset(ks, 0, 16);
+			cc = cpacf_kma(aes_gcm->fc | CPACF_KMA_LAAD, &param, ks,
+			    NULL, 0, ks, 16);
+			assert(cc == 0 || cc == 1 || cc == 2);
+			if (cc != 1) {
+				rc = 0;
+				break;
+			}
+			if (aes_gcm->aes_key->rand_protk) {
+				rc = ZPC_ERROR_PROTKEYONLY;
+				goto ret;
+			}
+			rc = aes_key_update_prot(aes_gcm->aes_key, i,
+			    aes_gcm->param.protkey, sizeof(aes_gcm->param.protkey),
+			    &aes_gcm->key_gen);
+			if (rc)
+				break;
+		}
+	}
+	if (rc == 0 && !(aes_gcm->fc & CPACF_KMA_HS)) {
+		/* The hash subkey was computed into the copy. */
+		memcpy(aes_gcm->param.h, param.h, sizeof(aes_gcm->param.h));
+		aes_gcm->fc |= CPACF_KMA_HS;
+	}
 ret:
-	free(ivpad);
+	memzero_secure(&param, sizeof(param));
 	return rc;
 }
 
@@ -686,6 +1256,12 @@ __aes_gcm_reset_iv(struct zpc_aes_gcm *aes_gcm)
 	aes_gcm->param.taadl = 0;
 	aes_gcm->param.tpcl = 0;
 
+	memzero_secure(aes_gcm->aadbuf, sizeof(aes_gcm->aadbuf));
+	aes_gcm->aadbuflen = 0;
+	memzero_secure(aes_gcm->pbuf, sizeof(aes_gcm->pbuf));
+	memzero_secure(aes_gcm->ks, sizeof(aes_gcm->ks));
+	aes_gcm->pbuflen = 0;
+
 	aes_gcm->fc &= ~(CPACF_KMA_LAAD | CPACF_KMA_LPC);
 	aes_gcm->iv_set = 0;
 }
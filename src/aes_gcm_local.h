@@ -11,6 +11,7 @@
 # include "zpc/aes_key.h"
 
 # include "misc.h"
+# include "ctx_pool.h"
 # include "cpacf.h"
 
 /*
@@ -19,6 +20,13 @@
 
 #define GCM_RECOMMENDED_IV_LENGTH           12
 
+/*
+ * NIST SP 800-38d 8.2.1: deterministic iv = fixed field | invocation field.
+ * The invocation counter value 2^64 - 1 marks an exhausted counter.
+ */
+#define GCM_IV_FIXED_FIELD_LENGTH           4
+#define GCM_IV_COUNTER_EXHAUSTED            0xffffffffffffffffULL
+
 /*
  * NIST SP 800-38d: 1 <= bitlen(iv) <= 2^64 - 1
  *   => 1 <= bytelen(iv) <= 2^61 - 1
@@ -41,12 +49,30 @@
 struct zpc_aes_gcm {
 	struct cpacf_kma_gcm_aes_param param;
 	struct zpc_aes_key *aes_key;
+	unsigned long long key_gen;	/* aes_key->prot_gen of param */
 
 	unsigned int fc;
 
+	u8 aadbuf[16];		/* trailing partial aad block */
+	size_t aadbuflen;
+	u8 pbuf[16];		/* input of the trailing partial block */
+	u8 ks[16];		/* its key stream */
+	size_t pbuflen;
+
 	int key_set;
 	int iv_set;
 	int iv_created;
+
+	int iv_det;	/* deterministic create_iv */
+	u8 iv_fixed[GCM_IV_FIXED_FIELD_LENGTH];
+	u64 iv_counter;	/* next invocation field */
+
+	struct stats_ctx stats;
+	struct ctx_pool_mark pool;
 };
 
+void aes_gcm_reset_state(struct zpc_aes_gcm *);
+int aes_gcm_kma_set_iv(struct cpacf_kma_gcm_aes_param *, unsigned int *,
+    const u8 *, size_t);
+
 #endif
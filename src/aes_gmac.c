@@ -0,0 +1,608 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stdbool.h>
+
+#include "zpc/aes_gmac.h"
+#include "zpc/error.h"
+
+#include "aes_gmac_local.h"
+#include "aes_gcm_local.h"
+#include "aes_key_local.h"
+#include "cpacf.h"
+#include "globals.h"
+#include "misc.h"
+#include "stats.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int __aes_gmac_update(struct zpc_aes_gmac *, const u8 *, size_t);
+static int __aes_gmac_final(struct zpc_aes_gmac *, u8 *, size_t);
+static int __aes_gmac_hash_rederive(struct zpc_aes_gmac *, const u8 *,
+    size_t, unsigned long);
+static int __aes_gmac_hash(struct zpc_aes_gmac *, const u8 *, size_t,
+    unsigned long);
+static int __aes_gmac_check_maclen(size_t);
+static void __aes_gmac_reset(struct zpc_aes_gmac *);
+static void __aes_gmac_reset_iv(struct zpc_aes_gmac *);
+
+int
+zpc_aes_gmac_alloc(struct zpc_aes_gmac **aes_gmac)
+{
+	struct zpc_aes_gmac *new_aes_gmac = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	new_aes_gmac = calloc(1, sizeof(*new_aes_gmac));
+	if (new_aes_gmac == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	DEBUG("aes-gmac context at %p: allocated", new_aes_gmac);
+	*aes_gmac = new_aes_gmac;
+	rc = 0;
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gmac_set_key(struct zpc_aes_gmac *aes_gmac,
+    struct zpc_aes_key *aes_key)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	if (aes_key == NULL) {
+		/* If another key is already set, unset it and decrease
+		 * refcount. */
+		DEBUG("aes-gmac context at %p: key unset", aes_gmac);
+		__aes_gmac_reset(aes_gmac);
+		rc = 0;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	rc = aes_key_check(aes_key);
+	if (rc)
+		goto ret;
+
+	if (aes_gmac->aes_key == aes_key) {
+		DEBUG("aes-gmac context at %p: key at %p already set", aes_gmac,
+		    aes_key);
+		rc = 0; /* nothing to do */
+		goto ret;
+	}
+
+	aes_key_ref(aes_key);
+
+	if (aes_gmac->key_set) {
+		/* If another key is already set, unset it and decrease
+		 * refcount. */
+		DEBUG("aes-gmac context at %p: key unset", aes_gmac);
+		__aes_gmac_reset(aes_gmac);
+	}
+
+	/* Set new key. */
+	assert(!aes_gmac->key_set);
+
+	DEBUG("aes-gmac context at %p: key at %p set, iv unset", aes_gmac,
+	    aes_key);
+
+	aes_key_get_prot(aes_key, aes_gmac->param.protkey,
+	    sizeof(aes_gmac->param.protkey), &aes_gmac->key_gen);
+
+	aes_gmac->fc = CPACF_KMA_GCM_ENCRYPTED_AES_128 + (aes_key->keysize - 128) / 64;
+
+	aes_gmac->aes_key = aes_key;
+	aes_gmac->key_set = 1;
+
+	__aes_gmac_reset_iv(aes_gmac);
+
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gmac_set_iv(struct zpc_aes_gmac *aes_gmac, const u8 * iv,
+    size_t ivlen)
+{
+	struct cpacf_kma_gcm_aes_param *param;
+	int rc, i;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (iv == NULL) {
+		/* Unset iv */
+		DEBUG("aes-gmac context at %p: iv unset", aes_gmac);
+		__aes_gmac_reset_iv(aes_gmac);
+		rc = 0;
+		goto ret;
+	}
+	/* 1 <= iv bit-length <= 2^64 - 1, iv bit-length % 8 == 0 */
+	if (ivlen < 1 || ivlen > GCM_MAX_IV_LENGTH) {
+		rc = ZPC_ERROR_IVSIZE;
+		goto ret;
+	}
+
+	if (aes_gmac->key_set != 1) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+
+	__aes_gmac_reset_iv(aes_gmac);
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_gmac->param;
+
+		for (;;) {
+			rc = aes_gcm_kma_set_iv(param, &aes_gmac->fc, iv, ivlen);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_gmac->aes_key->rand_protk) {
+					rc = ZPC_ERROR_PROTKEYONLY;
+					goto ret;
+				}
+				if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_gmac->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_gmac->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+	if (rc)
+		goto ret;
+
+	DEBUG("aes-gmac context at %p: iv set", aes_gmac);
+	aes_gmac->iv_set = 1;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gmac_update(struct zpc_aes_gmac *aes_gmac, const u8 * msg,
+    size_t msglen)
+{
+	struct stats_op st = { 0 };
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (msglen > 0 && msg == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	if (!aes_gmac->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_gmac->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	/* aad bit-length <= 2^64 - 1 */
+	if (aes_gmac->param.taadl / 8 + msglen > GCM_MAX_TOTAL_AAD_LENGTH) {
+		rc = ZPC_ERROR_AADLEN;
+		goto ret;
+	}
+
+	stats_op_begin(&st, &aes_gmac->stats, ZPC_STATS_OP_AES_GMAC);
+	rc = __aes_gmac_update(aes_gmac, msg, msglen);
+
+ret:
+	stats_op_end(&st, msglen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gmac_final(struct zpc_aes_gmac *aes_gmac, u8 * mac, size_t maclen)
+{
+	struct stats_op st = { 0 };
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (mac == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	rc = __aes_gmac_check_maclen(maclen);
+	if (rc)
+		goto ret;
+
+	if (!aes_gmac->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_gmac->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	stats_op_begin(&st, &aes_gmac->stats, ZPC_STATS_OP_AES_GMAC);
+	rc = __aes_gmac_final(aes_gmac, mac, maclen);
+
+ret:
+	stats_op_end(&st, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gmac_verify(struct zpc_aes_gmac *aes_gmac, const u8 * mac,
+    size_t maclen)
+{
+	struct stats_op st = { 0 };
+	u8 tmp[16];
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (mac == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	rc = __aes_gmac_check_maclen(maclen);
+	if (rc)
+		goto ret;
+
+	if (!aes_gmac->key_set) {
+		rc = ZPC_ERROR_KEYNOTSET;
+		goto ret;
+	}
+	if (!aes_gmac->iv_set) {
+		rc = ZPC_ERROR_IVNOTSET;
+		goto ret;
+	}
+
+	stats_op_begin(&st, &aes_gmac->stats, ZPC_STATS_OP_AES_GMAC);
+	rc = __aes_gmac_final(aes_gmac, tmp, maclen);
+	if (rc == 0 && memcmp_consttime(tmp, mac, maclen) != 0)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	memzero_secure(tmp, sizeof(tmp));
+
+ret:
+	stats_op_end(&st, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_gmac_get_stats(const struct zpc_aes_gmac *aes_gmac,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&aes_gmac->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+int
+zpc_aes_gmac_dup(struct zpc_aes_gmac **aes_gmac,
+    const struct zpc_aes_gmac *src)
+{
+	struct zpc_aes_gmac *new_aes_gmac = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_gcm) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_gmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_aes_gmac = malloc(sizeof(*new_aes_gmac));
+	if (new_aes_gmac == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_aes_gmac, src, sizeof(*new_aes_gmac));
+	memset(&new_aes_gmac->stats, 0, sizeof(new_aes_gmac->stats));
+
+	if (new_aes_gmac->key_set)
+		aes_key_ref(new_aes_gmac->aes_key);
+
+	DEBUG("aes-gmac context at %p: copy of %p", new_aes_gmac, src);
+	*aes_gmac = new_aes_gmac;
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+void
+zpc_aes_gmac_free(struct zpc_aes_gmac **aes_gmac)
+{
+	if (aes_gmac == NULL)
+		return;
+	if (*aes_gmac == NULL)
+		return;
+
+	if ((*aes_gmac)->key_set) {
+		/* Decrease aes_key's refcount. */
+		zpc_aes_key_free(&(*aes_gmac)->aes_key);
+		(*aes_gmac)->key_set = 0;
+		__aes_gmac_reset_iv(*aes_gmac);
+	}
+
+	__aes_gmac_reset(*aes_gmac);
+
+	free(*aes_gmac);
+	*aes_gmac = NULL;
+	DEBUG("return");
+}
+
+/*
+ * Whole blocks are hashed from the caller's buffer. A partial block
+ * is completed from the next chunk or hashed as the last one. The
+ * total length is counted up front, KMA uses it with the last block.
+ */
+static int
+__aes_gmac_update(struct zpc_aes_gmac *aes_gmac, const u8 * msg,
+    size_t msglen)
+{
+	size_t n, full;
+	int rc;
+
+	aes_gmac->param.taadl += msglen * 8;
+
+	if (aes_gmac->buflen > 0) {
+		n = 16 - aes_gmac->buflen;
+		if (n > msglen)
+			n = msglen;
+		memcpy(aes_gmac->buf + aes_gmac->buflen, msg, n);
+		aes_gmac->buflen += n;
+		msg += n;
+		msglen -= n;
+
+		if (aes_gmac->buflen < 16)
+			return 0;
+
+		rc = __aes_gmac_hash_rederive(aes_gmac, aes_gmac->buf, 16, 0);
+		if (rc)
+			return rc;
+		aes_gmac->buflen = 0;
+	}
+
+	full = msglen & ~(size_t)15;
+	if (full > 0) {
+		rc = __aes_gmac_hash_rederive(aes_gmac, msg, full, 0);
+		if (rc)
+			return rc;
+	}
+
+	memcpy(aes_gmac->buf, msg + full, msglen - full);
+	aes_gmac->buflen = msglen - full;
+	return 0;
+}
+
+/* Hash the partial block and the length block, unset the iv. */
+static int
+__aes_gmac_final(struct zpc_aes_gmac *aes_gmac, u8 * mac, size_t maclen)
+{
+	int rc;
+
+	rc = __aes_gmac_hash_rederive(aes_gmac, aes_gmac->buf,
+	    aes_gmac->buflen, CPACF_KMA_LAAD | CPACF_KMA_LPC);
+	if (rc)
+		return rc;
+
+	memcpy(mac, aes_gmac->param.t, maclen);
+	__aes_gmac_reset_iv(aes_gmac);
+	return 0;
+}
+
+/* __aes_gmac_hash with protected key re-derivation. */
+static int
+__aes_gmac_hash_rederive(struct zpc_aes_gmac *aes_gmac, const u8 * aad,
+    size_t aadlen, unsigned long flags)
+{
+	struct cpacf_kma_gcm_aes_param *param;
+	int rc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = &aes_gmac->param;
+
+		for (;;) {
+			rc = __aes_gmac_hash(aes_gmac, aad, aadlen, flags);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_gmac->aes_key->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_gmac->aes_key, i,
+					    param->protkey, sizeof(param->protkey),
+					    &aes_gmac->key_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+/* KMA with additional authenticated data only. */
+static int
+__aes_gmac_hash(struct zpc_aes_gmac *aes_gmac, const u8 * aad,
+    size_t aadlen, unsigned long flags)
+{
+	struct cpacf_kma_gcm_aes_param *param;
+	int rc, cc;
+
+	param = &aes_gmac->param;
+
+	cc = cpacf_kma(aes_gmac->fc | flags, param, NULL, aad, aadlen, NULL, 0);
+	assert(cc == 0 || cc == 1 || cc == 2);
+	if (cc == 1) {
+		rc = ZPC_ERROR_WKVPMISMATCH;
+		goto err;
+	}
+	aes_gmac->fc |= CPACF_KMA_HS;
+
+	rc = 0;
+err:
+	return rc;
+}
+
+/* Valid tag bit-lengths: 128, 120, 112, 104, 96, 64, 32. */
+static int
+__aes_gmac_check_maclen(size_t maclen)
+{
+	if (maclen > 16 || maclen < 4 || (maclen < 12 && maclen != 8
+	    && maclen != 4))
+		return ZPC_ERROR_TAGSIZE;
+	return 0;
+}
+
+static void
+__aes_gmac_reset(struct zpc_aes_gmac *aes_gmac)
+{
+	assert(aes_gmac != NULL);
+
+	memset(&aes_gmac->param, 0, sizeof(aes_gmac->param));
+
+	__aes_gmac_reset_iv(aes_gmac);
+
+	if (aes_gmac->aes_key != NULL)
+		zpc_aes_key_free(&aes_gmac->aes_key);
+	aes_gmac->key_set = 0;
+
+	aes_gmac->fc = 0;
+}
+
+static void
+__aes_gmac_reset_iv(struct zpc_aes_gmac *aes_gmac)
+{
+	assert(aes_gmac != NULL);
+
+	memset(aes_gmac->param.reserved, 0, sizeof(aes_gmac->param.reserved));
+	memset(aes_gmac->param.t, 0, sizeof(aes_gmac->param.t));
+	memset(aes_gmac->param.j0, 0, sizeof(aes_gmac->param.j0));
+	aes_gmac->param.cv = 0;
+	aes_gmac->param.taadl = 0;
+	aes_gmac->param.tpcl = 0;
+
+	memzero_secure(aes_gmac->buf, sizeof(aes_gmac->buf));
+	aes_gmac->buflen = 0;
+	aes_gmac->iv_set = 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef AES_GMAC_LOCAL_H
+# define AES_GMAC_LOCAL_H
+
+# include "zpc/aes_key.h"
+
+# include "misc.h"
+# include "cpacf.h"
+
+/*
+ * Internal aes_gmac interface.
+ */
+
+struct zpc_aes_gmac {
+	struct cpacf_kma_gcm_aes_param param;
+	struct zpc_aes_key *aes_key;
+	unsigned long long key_gen;	/* aes_key->prot_gen of param */
+
+	unsigned int fc;
+
+	u8 buf[16];		/* trailing partial block */
+	size_t buflen;
+
+	int key_set;
+	int iv_set;
+
+	struct stats_ctx stats;
+};
+
+#endif
@@ -15,6 +15,9 @@
 #include "globals.h"
 #include "debug.h"
 #include "misc.h"
+#include "stats.h"
+#include "pkey_io.h"
+#include "seqlock.h"
 #include "zkey/pkey.h"
 
 #include <assert.h>
@@ -22,7 +25,9 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 
 static void __aes_key_reset(struct zpc_aes_key *);
@@ -32,7 +37,13 @@ static int aes_key_blob_is_pkey_extractable(struct zpc_aes_key *aes_key,
 								const unsigned char *buf, size_t buflen);
 static int aes_key_add_ep11_header(struct zpc_aes_key *aes_key);
 static int aes_key_blob_has_a_session(struct zpc_aes_key *aes_key);
-static int aes_key_pvsec2prot(struct zpc_aes_key *aes_key);
+static int aes_key_pvsec2prot(struct zpc_aes_key *aes_key,
+		struct pkey_protkey *prot);
+static int __aes_key_update_prot(struct zpc_aes_key *aes_key,
+		enum aes_key_sec sec, void *protkey, size_t len,
+		unsigned long long *gen, int wait);
+static void aes_key_set_prot(struct zpc_aes_key *aes_key,
+		const struct pkey_protkey *prot);
 static int aes_key_blob_is_valid_pvsecret_id(struct zpc_aes_key *aes_key,
 		const unsigned char *id);
 
@@ -73,6 +84,7 @@ zpc_aes_key_alloc(struct zpc_aes_key **aes_key)
 		rc = ZPC_ERROR_INITLOCK;
 		goto ret;
 	}
+	new_aes_key->efd = -1;
 	new_aes_key->refcount = 1;
 	DEBUG("aes key at %p: refcount %llu", new_aes_key, new_aes_key->refcount);
 
@@ -118,10 +130,10 @@ zpc_aes_key_set_size(struct zpc_aes_key *aes_key, int keysize)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -187,10 +199,10 @@ zpc_aes_key_set_type(struct zpc_aes_key *aes_key, int type)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -242,10 +254,10 @@ zpc_aes_key_set_flags(struct zpc_aes_key *aes_key, unsigned int flags)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -284,10 +296,10 @@ zpc_aes_key_set_mkvp(struct zpc_aes_key *aes_key, const char *mkvp)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -368,7 +380,7 @@ zpc_aes_key_set_apqns(struct zpc_aes_key *aes_key, const char *apqns[])
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
 	if (apqns == NULL) {
@@ -388,7 +400,7 @@ zpc_aes_key_set_apqns(struct zpc_aes_key *aes_key, const char *apqns[])
 
 	for (napqns = 0; apqns[napqns] != NULL; napqns++);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -464,10 +476,10 @@ zpc_aes_key_import_clear(struct zpc_aes_key *aes_key, const unsigned char *key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -513,14 +525,14 @@ zpc_aes_key_import_clear(struct zpc_aes_key *aes_key, const unsigned char *key)
 	 * type 6 header manually below. If successful, we end up with a type 6
 	 * key in both cases.
 	 */
-	rc = ioctl(pkeyfd, PKEY_CLR2SECK2, &clr2seck2);
+	rc = pkey_ioctl(pkeyfd, PKEY_CLR2SECK2, &clr2seck2);
 	if (rc != 0) {
 		DEBUG("ioctl PKEY_CLR2SECK2 for %s key returned %d",
 			aes_key->type == ZPC_AES_KEY_TYPE_EP11 ? "ep11 aes type 6" : "cca", rc);
 		if (aes_key->type == ZPC_AES_KEY_TYPE_EP11) {
 			/* Retry with a type 3 key */
 			clr2seck2.type = TOKVER_EP11_AES; /* 0x03 */
-			rc = ioctl(pkeyfd, PKEY_CLR2SECK2, &clr2seck2);
+			rc = pkey_ioctl(pkeyfd, PKEY_CLR2SECK2, &clr2seck2);
 			DEBUG("ioctl PKEY_CLR2SECK2 for aes ep11 type 3 key returned %d", rc);
 			if (rc != 0) {
 				rc = ZPC_ERROR_IOCTLCLR2SECK2;
@@ -537,7 +549,8 @@ zpc_aes_key_import_clear(struct zpc_aes_key *aes_key, const unsigned char *key)
 
 	rc = aes_key_clr2prot(aes_key, key, aes_key->keysize / 8);
 	if (rc) {
-		rc = aes_key_sec2prot(aes_key, AES_KEY_SEC_CUR);
+		rc = aes_key_sec2prot(aes_key, AES_KEY_SEC_CUR,
+		    PKEY_RETRY_BUDGET_NS);
 		if (rc) {
 			goto ret;
 		}
@@ -593,7 +606,7 @@ zpc_aes_key_export(struct zpc_aes_key *aes_key, unsigned char *buf,
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
 	if (aes_key->rand_protk) {
@@ -645,10 +658,10 @@ zpc_aes_key_import(struct zpc_aes_key *aes_key, const unsigned char *buf,
 		return ZPC_ERROR_ARG2NULL;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -746,10 +759,10 @@ zpc_aes_key_generate(struct zpc_aes_key *aes_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if (aes_key->refcount != 1) {
+	if (__atomic_load_n(&aes_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -783,14 +796,14 @@ zpc_aes_key_generate(struct zpc_aes_key *aes_key)
 			break;
 		}
 
-		rc = ioctl(pkeyfd, PKEY_GENPROTK, &genprotk);
+		rc = pkey_ioctl(pkeyfd, PKEY_GENPROTK, &genprotk);
 		if (rc != 0) {
 			rc = ZPC_ERROR_IOCTLGENPROTK;
 			goto ret;
 		}
 
 		DEBUG("aes key at %p: key set to generated protected key", aes_key);
-		memcpy(&aes_key->prot, &genprotk.protkey, sizeof(aes_key->prot));
+		aes_key_set_prot(aes_key, &genprotk.protkey);
 		aes_key->rand_protk = 1;
 		aes_key->key_set = 1;
 		rc = 0;
@@ -824,14 +837,14 @@ zpc_aes_key_generate(struct zpc_aes_key *aes_key)
 	 * type 6 header manually below. If successful, we end up with a type 6
 	 * key in both cases.
 	 */
-	rc = ioctl(pkeyfd, PKEY_GENSECK2, &genseck2);
+	rc = pkey_ioctl(pkeyfd, PKEY_GENSECK2, &genseck2);
 	if (rc != 0) {
 		DEBUG("ioctl PKEY_GENSECK2 for %s key returned %d",
 			aes_key->type == ZPC_AES_KEY_TYPE_EP11 ? "ep11 aes type 6" : "cca", rc);
 		if (aes_key->type == ZPC_AES_KEY_TYPE_EP11) {
 			/* Retry to generate a type 3 key */
 			genseck2.type = TOKVER_EP11_AES; /* 0x03 */;
-			rc = ioctl(pkeyfd, PKEY_GENSECK2, &genseck2);
+			rc = pkey_ioctl(pkeyfd, PKEY_GENSECK2, &genseck2);
 			DEBUG("ioctl PKEY_GENSECK2 for aes ep11 type 3 key returned %d", rc);
 			if (rc != 0) {
 				rc = ZPC_ERROR_IOCTLGENSECK2;
@@ -846,7 +859,7 @@ zpc_aes_key_generate(struct zpc_aes_key *aes_key)
 
 	aes_key->cur.seclen = genseck2.keylen;
 
-	rc = aes_key_sec2prot(aes_key, AES_KEY_SEC_CUR);
+	rc = aes_key_sec2prot(aes_key, AES_KEY_SEC_CUR, PKEY_RETRY_BUDGET_NS);
 	if (rc)
 		goto ret;
 
@@ -898,7 +911,7 @@ zpc_aes_key_reencipher(struct zpc_aes_key *aes_key, int method)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&aes_key->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
 	if (aes_key->rand_protk) {
@@ -1005,42 +1018,119 @@ ret:
 	return rc;
 }
 
-void
-zpc_aes_key_free(struct zpc_aes_key **aes_key)
+int
+zpc_aes_key_set_nonblock(struct zpc_aes_key *aes_key, int nonblock)
 {
-	int rv, free_obj = 0;
+	int rc, rv;
 
 	UNUSED(rv);
 
-	if (aes_key == NULL)
-		return;
-	if (*aes_key == NULL)
-		return;
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (aes_key == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
 
-	rv = pthread_mutex_lock(&(*aes_key)->lock);
+	rv = stats_mutex_lock(&aes_key->lock);
 	assert(rv == 0);
 
-	if ((*aes_key)->refcount == 0)
-		goto ret;
+	aes_key->nonblock = nonblock ? 1 : 0;
+	DEBUG("aes key at %p: background re-derivation %s", aes_key,
+	    nonblock ? "enabled" : "disabled");
 
-	(*aes_key)->refcount--;
-	DEBUG("aes key at %p: refcount %llu", *aes_key, (*aes_key)->refcount);
+	rv = pthread_mutex_unlock(&aes_key->lock);
+	assert(rv == 0);
 
-	if ((*aes_key)->refcount == 0) {
-		free_obj = 1;
-		__aes_key_reset(*aes_key);
+	rc = 0;
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_key_get_eventfd(struct zpc_aes_key *aes_key, int *fd)
+{
+	int rc, rv;
+
+	UNUSED(rv);
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (aes_key == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+	if (fd == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
 	}
 
+	rv = stats_mutex_lock(&aes_key->lock);
+	assert(rv == 0);
+
+	if (aes_key->efd < 0) {
+		aes_key->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (aes_key->efd < 0) {
+			DEBUG("aes key at %p: eventfd failed, errno = %d",
+			    aes_key, errno);
+			rc = ZPC_ERROR_MALLOC;
+			goto ret;
+		}
+	}
+	*fd = aes_key->efd;
+	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&(*aes_key)->lock);
+	rv = pthread_mutex_unlock(&aes_key->lock);
 	assert(rv == 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+void
+zpc_aes_key_free(struct zpc_aes_key **aes_key)
+{
+	unsigned long long refcount;
+	int rv;
+
+	UNUSED(rv);
+
+	if (aes_key == NULL)
+		return;
+	if (*aes_key == NULL)
+		return;
+
+	refcount = __atomic_load_n(&(*aes_key)->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0)
+			goto ret;
+	} while (!__atomic_compare_exchange_n(&(*aes_key)->refcount, &refcount,
+	    refcount - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	DEBUG("aes key at %p: refcount %llu", *aes_key, refcount - 1);
+
+	if (refcount == 1) {
+		rv = stats_mutex_lock(&(*aes_key)->lock);
+		assert(rv == 0);
+		__aes_key_reset(*aes_key);
+		rv = pthread_mutex_unlock(&(*aes_key)->lock);
+		assert(rv == 0);
 
-	if (free_obj == 1) {
 		rv = pthread_mutex_destroy(&(*aes_key)->lock);
 		assert(rv == 0);
 
+		if ((*aes_key)->efd >= 0)
+			close((*aes_key)->efd);
 		free(*aes_key);
 	}
+ret:
 	*aes_key = NULL;
 	DEBUG("return");
 }
@@ -1057,7 +1147,9 @@ __aes_key_reset(struct zpc_aes_key *aes_key)
 
 	memset(&aes_key->cur, 0, sizeof(aes_key->cur));
 	memset(&aes_key->old, 0, sizeof(aes_key->old));
+	seq_write_begin(&aes_key->prot_seq);
 	memset(&aes_key->prot, 0, sizeof(aes_key->prot));
+	seq_write_end(&aes_key->prot_seq);
 	aes_key->key_set = 0;
 
 	aes_key->keysize = 0;
@@ -1080,7 +1172,7 @@ __aes_key_reset(struct zpc_aes_key *aes_key)
 
 	aes_key->rand_protk = 0;
 
-	aes_key->refcount = 1;
+	__atomic_store_n(&aes_key->refcount, 1, __ATOMIC_RELAXED);
 }
 
 u16 aesprotkeylen_from_pvsectype(u16 pvsectype)
@@ -1137,7 +1229,7 @@ static int aes_key_blob_is_valid_pvsecret_id(struct zpc_aes_key *aes_key, const
 	io.keylen = sizeof(struct uvrsecrettoken);
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
 	if (rc != 0) {
 		DEBUG("aes key at %p: PKEY_VERIFYKEY2 ioctl failed, errno = %d", aes_key, errno);
 		return ZPC_ERROR_IOCTLVERIFYKEY2;
@@ -1150,7 +1242,8 @@ static int aes_key_blob_is_valid_pvsecret_id(struct zpc_aes_key *aes_key, const
  * (Re)derive protected key from a retrievable secret ID.
  * Caller must hold aes_key's wr lock.
  */
-static int aes_key_pvsec2prot(struct zpc_aes_key *aes_key)
+static int aes_key_pvsec2prot(struct zpc_aes_key *aes_key,
+		struct pkey_protkey *prot)
 {
 	struct pkey_kblob2pkey3 io;
 	unsigned char buf[sizeof(struct uvrsecrettoken)] = { 0, };
@@ -1162,11 +1255,11 @@ static int aes_key_pvsec2prot(struct zpc_aes_key *aes_key)
 	io.key = buf;
 	io.keylen = sizeof(struct uvrsecrettoken);
 	io.pkeytype = aes_key->type;
-	io.pkeylen = sizeof(aes_key->prot.protkey);
-	io.pkey = (unsigned char *)&aes_key->prot.protkey;
+	io.pkeylen = sizeof(prot->protkey);
+	io.pkey = (unsigned char *)&prot->protkey;
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
 		DEBUG("aes key at %p: PKEY_KBLOB2PROTK3 ioctl failed, errno = %d", aes_key, errno);
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
@@ -1179,11 +1272,12 @@ static int aes_key_pvsec2prot(struct zpc_aes_key *aes_key)
  * (Re)derive protected key from a secure key.
  * Caller must hold aes_key's wr lock.
  */
-int aes_key_sec2prot_without_header(struct zpc_aes_key *aes_key, enum aes_key_sec sec)
+int aes_key_sec2prot_without_header(struct zpc_aes_key *aes_key,
+		enum aes_key_sec sec, struct pkey_protkey *prot, u64 budget_ns)
 {
 	struct pkey_kblob2pkey2 io;
 	struct aes_key *key = NULL;
-	int rc, i;
+	int rc;
 
 	assert(sec == AES_KEY_SEC_OLD || sec == AES_KEY_SEC_CUR);
 
@@ -1199,17 +1293,13 @@ int aes_key_sec2prot_without_header(struct zpc_aes_key *aes_key, enum aes_key_se
 	io.apqns = aes_key->apqns;
 	io.apqn_entries = aes_key->napqns;
 
-	for (i = 0; i < 10; i++) {
-		rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK2, &io);
-		if (rc == 0 || (errno != -EBUSY && errno != -EAGAIN))
-			break;
-		sleep(1);
-	}
+	rc = pkey_ioctl_retry(pkeyfd, PKEY_KBLOB2PROTK2, &io, budget_ns);
 
 	if (rc != 0)
 		return ZPC_ERROR_IOCTLBLOB2PROTK2;
 
-	memcpy(&aes_key->prot, &io.protkey, sizeof(aes_key->prot));
+	memcpy(prot, &io.protkey, sizeof(*prot));
+	memzero_secure(&io.protkey, sizeof(io.protkey));
 	return 0;
 }
 
@@ -1218,11 +1308,12 @@ int aes_key_sec2prot_without_header(struct zpc_aes_key *aes_key, enum aes_key_se
  * prepare an overlay over the session id field and convert it as a
  * TOKVER_EP11_AES. Then restore the session id field.
  */
-int aes_key_sec2prot_with_header(struct zpc_aes_key *aes_key, enum aes_key_sec sec)
+int aes_key_sec2prot_with_header(struct zpc_aes_key *aes_key,
+		enum aes_key_sec sec, struct pkey_protkey *prot, u64 budget_ns)
 {
 	struct pkey_kblob2pkey2 io;
 	struct aes_key *key = NULL;
-	int rc, i;
+	int rc;
 	unsigned char temp[sizeof(struct ep11kblob_header)];
 	struct ep11kblob_header *hdr;
 
@@ -1244,12 +1335,7 @@ int aes_key_sec2prot_with_header(struct zpc_aes_key *aes_key, enum aes_key_sec s
 	io.apqns = aes_key->apqns;
 	io.apqn_entries = aes_key->napqns;
 
-	for (i = 0; i < 10; i++) {
-		rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK2, &io);
-		if (rc == 0 || (errno != -EBUSY && errno != -EAGAIN))
-			break;
-		sleep(1);
-	}
+	rc = pkey_ioctl_retry(pkeyfd, PKEY_KBLOB2PROTK2, &io, budget_ns);
 	if (rc == 0)
 		goto done;
 
@@ -1279,12 +1365,7 @@ int aes_key_sec2prot_with_header(struct zpc_aes_key *aes_key, enum aes_key_sec s
 	io.apqns = aes_key->apqns;
 	io.apqn_entries = aes_key->napqns;
 
-	for (i = 0; i < 10; i++) {
-		rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK2, &io);
-		if (rc == 0 || (errno != -EBUSY && errno != -EAGAIN))
-			break;
-		sleep(1);
-	}
+	rc = pkey_ioctl_retry(pkeyfd, PKEY_KBLOB2PROTK2, &io, budget_ns);
 
 	memcpy(key->sec + 16, temp, 16); // restore session id in any case
 
@@ -1292,18 +1373,26 @@ int aes_key_sec2prot_with_header(struct zpc_aes_key *aes_key, enum aes_key_sec s
 		return ZPC_ERROR_IOCTLBLOB2PROTK2;
 
 done:
-	memcpy(&aes_key->prot, &io.protkey, sizeof(aes_key->prot));
+	memcpy(prot, &io.protkey, sizeof(*prot));
+	memzero_secure(&io.protkey, sizeof(io.protkey));
 	return 0;
 }
 
 /*
- * (Re)derive protected key from a secure key.
+ * (Re)derive protected key from a secure key. Busy pkey requests are
+ * retried for up to budget_ns, see pkey_ioctl_retry.
  * Caller must hold aes_key's wr lock.
  */
-int aes_key_sec2prot(struct zpc_aes_key *aes_key, enum aes_key_sec sec)
+int aes_key_sec2prot(struct zpc_aes_key *aes_key, enum aes_key_sec sec,
+		u64 budget_ns)
 {
+	struct pkey_protkey prot;
 	struct aes_key *key = NULL;
 	size_t keylen;
+	int rc;
+
+	/* Derive aside, readers keep using the current protected key. */
+	memcpy(&prot, &aes_key->prot, sizeof(prot));
 
 	switch (aes_key->type) {
 	case ZPC_AES_KEY_TYPE_EP11:
@@ -1317,20 +1406,521 @@ int aes_key_sec2prot(struct zpc_aes_key *aes_key, enum aes_key_sec sec)
 		}
 		assert(key != NULL);
 		if (is_ep11_aes_key_with_header(key->sec, keylen))
-			return aes_key_sec2prot_with_header(aes_key, sec);
+			rc = aes_key_sec2prot_with_header(aes_key, sec, &prot,
+			    budget_ns);
 		else
-			return aes_key_sec2prot_without_header(aes_key, sec);
+			rc = aes_key_sec2prot_without_header(aes_key, sec,
+			    &prot, budget_ns);
+		break;
 	case ZPC_AES_KEY_TYPE_PVSECRET:
-		return aes_key_pvsec2prot(aes_key);
+		rc = aes_key_pvsec2prot(aes_key, &prot);
+		break;
 	default:
-		return aes_key_sec2prot_without_header(aes_key, sec);
+		rc = aes_key_sec2prot_without_header(aes_key, sec, &prot,
+		    budget_ns);
+		break;
+	}
+
+	if (rc == 0)
+		aes_key_set_prot(aes_key, &prot);
+	memzero_secure(&prot, sizeof(prot));
+	return rc;
+}
+
+/*
+ * Install a new protected key. The generation tells contexts with an
+ * older copy that they can just update it.
+ * Caller must hold aes_key's lock.
+ */
+static void aes_key_set_prot(struct zpc_aes_key *aes_key,
+		const struct pkey_protkey *prot)
+{
+	seq_write_begin(&aes_key->prot_seq);
+	memcpy(&aes_key->prot, prot, sizeof(aes_key->prot));
+	aes_key->prot_gen++;
+	seq_write_end(&aes_key->prot_seq);
+}
+
+/*
+ * Take a reference. Does not take aes_key's lock.
+ */
+void aes_key_ref(struct zpc_aes_key *aes_key)
+{
+	unsigned long long refcount;
+
+	refcount = __atomic_add_fetch(&aes_key->refcount, 1, __ATOMIC_RELAXED);
+	DEBUG("aes key at %p: refcount %llu", aes_key, refcount);
+}
+
+/*
+ * Copy the first len bytes of the protected key and its generation.
+ * Does not take aes_key's lock.
+ */
+void aes_key_get_prot(const struct zpc_aes_key *aes_key, void *protkey,
+		size_t len, unsigned long long *gen)
+{
+	unsigned int seq;
+
+	assert(len <= sizeof(aes_key->prot.protkey));
+
+	do {
+		seq = seq_read_begin(&aes_key->prot_seq);
+		memcpy(protkey, aes_key->prot.protkey, len);
+		*gen = aes_key->prot_gen;
+	} while (seq_read_retry(&aes_key->prot_seq, seq));
+}
+
+/*
+ * Update a context's copy of the protected key after a wrapping key
+ * verification pattern mismatch: take the key's protected key if it is
+ * newer than the copy, otherwise re-derive it. Only a re-derivation
+ * takes aes_key's lock.
+ */
+int aes_key_update_prot(struct zpc_aes_key *aes_key, enum aes_key_sec sec,
+		void *protkey, size_t len, unsigned long long *gen)
+{
+	return __aes_key_update_prot(aes_key, sec, protkey, len, gen, 0);
+}
+
+/*
+ * Like aes_key_update_prot, but keys in non-blocking mode are
+ * re-derived in the calling thread, too. For operations that already
+ * wrote output and so cannot return ZPC_ERROR_AGAIN.
+ */
+int aes_key_update_prot_wait(struct zpc_aes_key *aes_key,
+		enum aes_key_sec sec, void *protkey, size_t len,
+		unsigned long long *gen)
+{
+	return __aes_key_update_prot(aes_key, sec, protkey, len, gen, 1);
+}
+
+static int __aes_key_update_prot(struct zpc_aes_key *aes_key,
+		enum aes_key_sec sec, void *protkey, size_t len,
+		unsigned long long *gen, int wait)
+{
+	unsigned long long cur;
+	int rc = 0, rv;
+
+	UNUSED(rv);
+
+	aes_key_get_prot(aes_key, protkey, len, &cur);
+	if (cur != *gen) {
+		/* Another context re-derived it already. */
+		*gen = cur;
+		return 0;
+	}
+
+	rv = stats_mutex_lock(&aes_key->lock);
+	assert(rv == 0);
+
+	if (aes_key->prot_gen == *gen) {
+		DEBUG("aes key at %p: re-derive protected key from %s secure key",
+		    aes_key, sec == AES_KEY_SEC_CUR ? "current" : "old");
+		stats_inc(STATS_REDERIVE);
+		rc = aes_key_rederive(aes_key, sec, wait);
+	}
+	memcpy(protkey, aes_key->prot.protkey, len);
+	*gen = aes_key->prot_gen;
+
+	rv = pthread_mutex_unlock(&aes_key->lock);
+	assert(rv == 0);
+	return rc;
+}
+
+/*
+ * Background re-derivation for keys in non-blocking mode: a thread,
+ * started on first use, works off a queue of keys. Each queued key
+ * holds a reference. Protected keys are derived from a copy of the key
+ * without holding its lock, so contexts keep using the key meanwhile.
+ * The thread makes one pkey request per key and turn: a key that finds
+ * the crypto cards busy is queued again and not taken off the queue
+ * before its backoff time, so it does not hold up the other keys.
+ */
+static pthread_mutex_t derive_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t derive_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t derive_idle = PTHREAD_COND_INITIALIZER;
+static struct zpc_aes_key *derive_head, *derive_tail;
+static struct zpc_aes_key *derive_cur;	/* being derived by the thread */
+static pthread_t derive_thread;
+static int derive_thread_running;
+static int derive_stop;
+static int derive_forking;
+
+/* Signal the end of a background derivation. Caller holds the lock. */
+static void
+aes_key_derive_done(struct zpc_aes_key *aes_key, int rc)
+{
+	u64 one = 1;
+	ssize_t rv;
+
+	UNUSED(rv);
+
+	if (rc == 0) {
+		aes_key->derive_failures = 0;
+	} else {
+		aes_key->derive_holdoff = stats_now()
+		    + pkey_backoff_ns(aes_key->derive_failures);
+		aes_key->derive_failures++;
+	}
+	aes_key->derive_rc = rc;
+	aes_key->derive_pending = 0;
+
+	if (aes_key->efd >= 0)
+		rv = write(aes_key->efd, &one, sizeof(one));
+}
+
+/*
+ * Append to the derivation queue.
+ * Caller must hold aes_key's lock and derive_lock.
+ */
+static void
+aes_key_derive_enqueue(struct zpc_aes_key *aes_key)
+{
+	aes_key->derive_next = NULL;
+	if (derive_tail != NULL)
+		derive_tail->derive_next = aes_key;
+	else
+		derive_head = aes_key;
+	derive_tail = aes_key;
+
+	pthread_cond_signal(&derive_cond);
+}
+
+static void
+aes_key_derive(struct zpc_aes_key *aes_key)
+{
+	struct zpc_aes_key tmp;
+	struct pkey_apqn *apqns = NULL;
+	unsigned long long gen;
+	int rc, rv, busy = 0;
+
+	UNUSED(rv);
+
+	rv = stats_mutex_lock(&aes_key->lock);
+	assert(rv == 0);
+
+	memcpy(&tmp, aes_key, sizeof(tmp));
+	if (aes_key->napqns > 0) {
+		apqns = calloc(aes_key->napqns, sizeof(*apqns));
+		if (apqns != NULL)
+			memcpy(apqns, aes_key->apqns,
+			    aes_key->napqns * sizeof(*apqns));
+	}
+	tmp.apqns = apqns;
+	gen = aes_key->prot_gen;
+
+	rv = pthread_mutex_unlock(&aes_key->lock);
+	assert(rv == 0);
+
+	if (tmp.napqns > 0 && apqns == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+	} else {
+		rc = aes_key_sec2prot(&tmp, AES_KEY_SEC_CUR, 0);
+		if (rc) {
+			busy = (errno == EBUSY || errno == EAGAIN);
+			rc = aes_key_sec2prot(&tmp, AES_KEY_SEC_OLD, 0);
+			if (rc && (errno == EBUSY || errno == EAGAIN))
+				busy = 1;
+		}
+	}
+
+	rv = stats_mutex_lock(&aes_key->lock);
+	assert(rv == 0);
+
+	if (rc != 0 && busy
+	    && stats_now() - aes_key->derive_since < PKEY_RETRY_BUDGET_NS) {
+		/* Queue again, keeping the reference. */
+		stats_inc(STATS_IOCTL_RETRIES);
+		aes_key->derive_holdoff = stats_now()
+		    + pkey_backoff_ns(aes_key->derive_busy);
+		aes_key->derive_busy++;
+
+		rv = pthread_mutex_lock(&derive_lock);
+		assert(rv == 0);
+		aes_key_derive_enqueue(aes_key);
+		rv = pthread_mutex_unlock(&derive_lock);
+		assert(rv == 0);
+
+		DEBUG("aes key at %p: background re-derivation busy, requeued",
+		    aes_key);
+	} else {
+		/* Do not overwrite a protected key installed meanwhile. */
+		if (rc == 0 && aes_key->prot_gen == gen)
+			aes_key_set_prot(aes_key, &tmp.prot);
+		DEBUG("aes key at %p: background re-derivation: %d (%s)",
+		    aes_key, rc, zpc_error_string(rc));
+		aes_key_derive_done(aes_key, rc);
+		busy = 0;
+	}
+
+	rv = pthread_mutex_unlock(&aes_key->lock);
+	assert(rv == 0);
+
+	free(apqns);
+	memzero_secure(&tmp, sizeof(tmp));
+	if (!busy)
+		zpc_aes_key_free(&aes_key);
+}
+
+/*
+ * Take the first key off the queue whose backoff time has passed, or
+ * return NULL and the time to wait for one in *wait_ns (0: no key).
+ * Caller must hold derive_lock.
+ */
+static struct zpc_aes_key *
+aes_key_derive_dequeue(u64 *wait_ns)
+{
+	struct zpc_aes_key *aes_key, *prev = NULL;
+	u64 now = stats_now();
+
+	*wait_ns = 0;
+	for (aes_key = derive_head; aes_key != NULL;
+	    prev = aes_key, aes_key = aes_key->derive_next) {
+		if (aes_key->derive_holdoff <= now)
+			break;
+		if (*wait_ns == 0 || aes_key->derive_holdoff - now < *wait_ns)
+			*wait_ns = aes_key->derive_holdoff - now;
+	}
+	if (aes_key == NULL)
+		return NULL;
+
+	if (prev != NULL)
+		prev->derive_next = aes_key->derive_next;
+	else
+		derive_head = aes_key->derive_next;
+	if (derive_tail == aes_key)
+		derive_tail = prev;
+	return aes_key;
+}
+
+static void *
+aes_key_derive_worker(void *arg)
+{
+	struct zpc_aes_key *aes_key;
+	struct timespec ts;
+	u64 wait_ns;
+	int rv;
+
+	UNUSED(arg);
+	UNUSED(rv);
+
+	rv = pthread_mutex_lock(&derive_lock);
+	assert(rv == 0);
+
+	for (;;) {
+		while (!derive_stop && (derive_forking
+		    || (aes_key = aes_key_derive_dequeue(&wait_ns)) == NULL)) {
+			if (derive_forking || wait_ns == 0) {
+				pthread_cond_wait(&derive_cond, &derive_lock);
+				continue;
+			}
+			clock_gettime(CLOCK_REALTIME, &ts);
+			wait_ns += (u64)ts.tv_nsec;
+			ts.tv_sec += wait_ns / 1000000000ULL;
+			ts.tv_nsec = wait_ns % 1000000000ULL;
+			pthread_cond_timedwait(&derive_cond, &derive_lock, &ts);
+		}
+		if (derive_stop)
+			break;
+		derive_cur = aes_key;
+
+		rv = pthread_mutex_unlock(&derive_lock);
+		assert(rv == 0);
+
+		aes_key_derive(aes_key);
+
+		rv = pthread_mutex_lock(&derive_lock);
+		assert(rv == 0);
+		derive_cur = NULL;
+		pthread_cond_broadcast(&derive_idle);
+	}
+
+	rv = pthread_mutex_unlock(&derive_lock);
+	assert(rv == 0);
+	return NULL;
+}
+
+/*
+ * Queue a background derivation.
+ * Returns 0 on success, -1 if there is no background thread.
+ * Caller must hold aes_key's lock.
+ */
+static int
+aes_key_derive_start(struct zpc_aes_key *aes_key)
+{
+	sigset_t all, old;
+	u64 cnt;
+	ssize_t n;
+	int rc = 0, rv;
+
+	UNUSED(n);
+	UNUSED(rv);
+
+	rv = pthread_mutex_lock(&derive_lock);
+	assert(rv == 0);
+
+	if (!derive_thread_running && !derive_stop) {
+		/* Signals are for the application's threads. */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		if (pthread_create(&derive_thread, NULL,
+		    aes_key_derive_worker, NULL) == 0)
+			derive_thread_running = 1;
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	if (!derive_thread_running) {
+		rc = -1;
+		goto ret;
+	}
+
+	/* Reset the event. */
+	if (aes_key->efd >= 0)
+		n = read(aes_key->efd, &cnt, sizeof(cnt));
+
+	aes_key_ref(aes_key);
+	aes_key->derive_pending = 1;
+	aes_key->derive_since = stats_now();
+	aes_key->derive_busy = 0;
+	aes_key->derive_holdoff = 0;
+	aes_key_derive_enqueue(aes_key);
+
+	DEBUG("aes key at %p: background re-derivation queued", aes_key);
+ret:
+	rv = pthread_mutex_unlock(&derive_lock);
+	assert(rv == 0);
+	return rc;
+}
+
+/*
+ * Re-derive the protected key after a wrapping key verification pattern
+ * mismatch. For keys in non-blocking mode, the re-derivation is done in
+ * the background: ZPC_ERROR_AGAIN is returned while it is in progress,
+ * and the error of a failed one until its backoff time has passed.
+ * Otherwise, or if wait is set, busy pkey requests are retried for
+ * PKEY_RETRY_LOCKED_NS only, because the key's other users wait for its
+ * lock meanwhile.
+ * Caller must hold aes_key's lock.
+ */
+int aes_key_rederive(struct zpc_aes_key *aes_key, enum aes_key_sec sec,
+		int wait)
+{
+	if (aes_key->nonblock && !wait) {
+		if (aes_key->derive_pending)
+			return ZPC_ERROR_AGAIN;
+		if (aes_key->derive_rc != 0
+		    && stats_now() < aes_key->derive_holdoff)
+			return aes_key->derive_rc;
+		if (aes_key_derive_start(aes_key) == 0)
+			return ZPC_ERROR_AGAIN;
+	}
+
+	return aes_key_sec2prot(aes_key, sec, PKEY_RETRY_LOCKED_NS);
+}
+
+/*
+ * Hold the thread between derivations across fork, so that every
+ * pending key is on the queue and no key lock is held by the thread.
+ */
+static void
+aes_key_atfork_prepare(void)
+{
+	int rv;
+
+	UNUSED(rv);
+
+	rv = pthread_mutex_lock(&derive_lock);
+	assert(rv == 0);
+	derive_forking = 1;
+	while (derive_cur != NULL)
+		pthread_cond_wait(&derive_idle, &derive_lock);
+}
+
+static void
+aes_key_atfork_parent(void)
+{
+	int rv;
+
+	UNUSED(rv);
+
+	derive_forking = 0;
+	pthread_cond_signal(&derive_cond);
+	rv = pthread_mutex_unlock(&derive_lock);
+	assert(rv == 0);
+}
+
+/*
+ * The child has no background thread: drop its queue, so that the next
+ * operation on a queued key starts a derivation (and a thread) of its
+ * own instead of waiting for one that never ends. The keys' eventfds
+ * are shared with the parent and are not written here.
+ */
+static void
+aes_key_atfork_child(void)
+{
+	struct zpc_aes_key *aes_key;
+	int rv;
+
+	UNUSED(rv);
+
+	while ((aes_key = derive_head) != NULL) {
+		derive_head = aes_key->derive_next;
+		aes_key->derive_pending = 0;
+		aes_key->derive_rc = 0;
+		zpc_aes_key_free(&aes_key);
+	}
+	derive_tail = NULL;
+	derive_thread_running = 0;
+	derive_stop = 0;
+	derive_forking = 0;
+	rv = pthread_mutex_unlock(&derive_lock);
+	assert(rv == 0);
+}
+
+void aes_key_init(void)
+{
+	if (pthread_atfork(aes_key_atfork_prepare, aes_key_atfork_parent,
+	    aes_key_atfork_child) != 0)
+		DEBUG("registering background derivation fork handler failed");
+}
+
+/* Stop the background thread. Called at library unload. */
+void aes_key_fini(void)
+{
+	struct zpc_aes_key *aes_key;
+	int rv;
+
+	UNUSED(rv);
+
+	rv = pthread_mutex_lock(&derive_lock);
+	assert(rv == 0);
+	derive_stop = 1;
+	pthread_cond_signal(&derive_cond);
+	rv = pthread_mutex_unlock(&derive_lock);
+	assert(rv == 0);
+
+	if (derive_thread_running)
+		pthread_join(derive_thread, NULL);
+
+	/* Fail derivations that were still queued. */
+	while ((aes_key = derive_head) != NULL) {
+		derive_head = aes_key->derive_next;
+
+		rv = stats_mutex_lock(&aes_key->lock);
+		assert(rv == 0);
+		aes_key_derive_done(aes_key, ZPC_ERROR_IOCTLBLOB2PROTK2);
+		rv = pthread_mutex_unlock(&aes_key->lock);
+		assert(rv == 0);
+
+		zpc_aes_key_free(&aes_key);
 	}
+	derive_tail = NULL;
 }
 
 int aes_key_clr2prot(struct zpc_aes_key *aes_key, const unsigned char *key,
 					unsigned int keylen)
 {
 	struct pkey_kblob2pkey3 io;
+	struct pkey_protkey prot;
 	unsigned char buf[sizeof(struct clearkeytoken) + 32];
 	struct clearkeytoken *clrtok = (struct clearkeytoken *)&buf;
 	int rc;
@@ -1357,14 +1947,18 @@ int aes_key_clr2prot(struct zpc_aes_key *aes_key, const unsigned char *key,
 	io.apqns = aes_key->apqns;
 	io.apqn_entries = aes_key->napqns;
 	io.pkeytype = aes_key->type;
-	io.pkeylen = sizeof(aes_key->prot.protkey);
-	io.pkey = (unsigned char *)&aes_key->prot.protkey;
+	memcpy(&prot, &aes_key->prot, sizeof(prot));
+	io.pkeylen = sizeof(prot.protkey);
+	io.pkey = (unsigned char *)&prot.protkey;
 
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
+		memzero_secure(&prot, sizeof(prot));
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
 	}
 
+	aes_key_set_prot(aes_key, &prot);
+	memzero_secure(&prot, sizeof(prot));
 	return 0;
 }
 
@@ -35,6 +35,8 @@ struct zpc_aes_key {
 	struct aes_key cur;     /* old secure key is needed when */
 	struct aes_key old;     /* current is not usable yet */
 	struct pkey_protkey prot;       /* protected key derived from sec */
+	unsigned long long prot_gen;    /* incremented when prot changes */
+	unsigned int prot_seq;  /* seqlock.h counter of prot and prot_gen */
 	int key_set;
 
 	int keysize;
@@ -56,11 +58,34 @@ struct zpc_aes_key {
 
 	int rand_protk;
 
-	unsigned long long refcount;
-	pthread_mutex_t lock;
+	/* background re-derivation, see aes_key_rederive */
+	int nonblock;
+	int efd;        /* eventfd signaled when one ends, or -1 */
+	int derive_pending;
+	int derive_rc;  /* result of the last one */
+	unsigned int derive_failures;   /* consecutive failed ones */
+	unsigned long long derive_holdoff;      /* no new one before [ns] */
+	unsigned long long derive_since;        /* start of the pending one */
+	unsigned int derive_busy;       /* busy tries of the pending one */
+	/* while queued, derive_holdoff is the time of its next try */
+	struct zpc_aes_key *derive_next;        /* derivation queue */
+
+	unsigned long long refcount;    /* atomic */
+	pthread_mutex_t lock;   /* writers, readers of prot use prot_seq */
 };
 
-int aes_key_sec2prot(struct zpc_aes_key *, enum aes_key_sec sec);
+int aes_key_sec2prot(struct zpc_aes_key *, enum aes_key_sec sec,
+			u64 budget_ns);
+int aes_key_rederive(struct zpc_aes_key *, enum aes_key_sec sec, int wait);
+void aes_key_ref(struct zpc_aes_key *);
+void aes_key_get_prot(const struct zpc_aes_key *, void *protkey, size_t len,
+			unsigned long long *gen);
+int aes_key_update_prot(struct zpc_aes_key *, enum aes_key_sec sec,
+			void *protkey, size_t len, unsigned long long *gen);
+int aes_key_update_prot_wait(struct zpc_aes_key *, enum aes_key_sec sec,
+			void *protkey, size_t len, unsigned long long *gen);
+void aes_key_init(void);
+void aes_key_fini(void);
 int aes_key_check(const struct zpc_aes_key *);
 int aes_key_clr2prot(struct zpc_aes_key *, const unsigned char *key,
 			unsigned int keylen);
@@ -14,7 +14,10 @@
 #include "aes_key_local.h"
 #include "cpacf.h"
 #include "globals.h"
+#include "iov.h"
 #include "misc.h"
+#include "parallel.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
@@ -25,12 +28,44 @@
 #include <string.h>
 
 static int __aes_xts_set_iv(struct zpc_aes_xts *, const u8 *);
+static int __aes_xts_set_iv_rederive(struct zpc_aes_xts *, const u8 *, int);
 static int __aes_xts_set_intermediate_iv(struct zpc_aes_xts *, const u8 iv[16]);
 static int __aes_xts_crypt(struct zpc_aes_xts *, u8 *, const u8 *, size_t,
     unsigned long);
+static int __aes_xts_crypt_rederive(struct zpc_aes_xts *, u8 *, const u8 *,
+    size_t, unsigned long, int);
+static int __aes_xts_crypt_sectors(struct zpc_aes_xts *, u8 *, const u8 *,
+    size_t, unsigned long long, size_t, unsigned long);
+static int __aes_xts_crypt_sector_range(struct zpc_aes_xts *, u8 *,
+    const u8 *, size_t, unsigned long long, size_t, unsigned long, int);
+static int __aes_xts_crypt_par(struct zpc_aes_xts *, u8 *, const u8 *,
+    size_t, size_t, unsigned long);
+static int __aes_xts_crypt_chunk(void *, size_t);
+static int __aes_xts_sectors_par(struct zpc_aes_xts *, u8 *, const u8 *,
+    size_t, unsigned long long, size_t, size_t, unsigned long);
+static int __aes_xts_sectors_chunk(void *, size_t);
+static int __aes_xts_cryptv(struct zpc_aes_xts *, const struct iovec *,
+    const struct iovec *, int, unsigned long);
+static int __aes_xts_crypt_iov(void *, u8 *, const u8 *, size_t, int);
 static void __aes_xts_reset(struct zpc_aes_xts *);
 static void __aes_xts_reset_iv(struct zpc_aes_xts *);
 
+struct aes_xts_iov {
+	struct zpc_aes_xts *aes_xts;
+	unsigned long flags;
+	int wait;	/* output was written, see aes_key_update_prot_wait */
+};
+
+struct aes_xts_par {
+	const struct zpc_aes_xts *aes_xts;
+	u8 *out;
+	const u8 *in;
+	size_t sector_size;	/* sectors only */
+	size_t chunk_sectors;	/* sectors only */
+	unsigned long long first_sector;	/* sectors only */
+	unsigned long flags;
+};
+
 int
 zpc_aes_xts_alloc(struct zpc_aes_xts **aes_xts)
 {
@@ -71,9 +106,7 @@ int
 zpc_aes_xts_set_key(struct zpc_aes_xts *aes_xts, struct zpc_aes_key *aes_key1,
     struct zpc_aes_key *aes_key2)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -106,11 +139,6 @@ zpc_aes_xts_set_key(struct zpc_aes_xts *aes_xts, struct zpc_aes_key *aes_key1,
 		goto ret;
 	}
 
-	rv = pthread_mutex_lock(&aes_key1->lock);
-	assert(rv == 0);
-	rv = pthread_mutex_lock(&aes_key2->lock);
-	assert(rv == 0);
-
 	rc = aes_key_check(aes_key1);
 	if (rc)
 		goto ret;
@@ -133,10 +161,8 @@ zpc_aes_xts_set_key(struct zpc_aes_xts *aes_xts, struct zpc_aes_key *aes_key1,
 		goto ret;
 	}
 
-	aes_key1->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key1, aes_key1->refcount);
-	aes_key2->refcount++;
-	DEBUG("aes key at %p: refcount %llu", aes_key2, aes_key2->refcount);
+	aes_key_ref(aes_key1);
+	aes_key_ref(aes_key2);
 
 	if (aes_xts->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -151,10 +177,10 @@ zpc_aes_xts_set_key(struct zpc_aes_xts *aes_xts, struct zpc_aes_key *aes_key1,
 	DEBUG("aes-xts context at %p: keys at %p and %p set", aes_xts, aes_key1,
 	    aes_key2);
 
-	memcpy(aes_xts->param_km, aes_key1->prot.protkey,
-	    AES_XTS_PROTKEYLEN(aes_key1->keysize));
-	memcpy(aes_xts->param_pcc, aes_key2->prot.protkey,
-	    AES_XTS_PROTKEYLEN(aes_key2->keysize));
+	aes_key_get_prot(aes_key1, aes_xts->param_km,
+	    AES_XTS_PROTKEYLEN(aes_key1->keysize), &aes_xts->key1_gen);
+	aes_key_get_prot(aes_key2, aes_xts->param_pcc,
+	    AES_XTS_PROTKEYLEN(aes_key2->keysize), &aes_xts->key2_gen);
 
 	/* PCC uses the same function codes for 128 resp. 256 bit keys. */
 	aes_xts->fc = CPACF_KM_XTS_ENCRYPTED_AES_128 + (aes_key1->keysize - 128) / 64;
@@ -165,10 +191,6 @@ zpc_aes_xts_set_key(struct zpc_aes_xts *aes_xts, struct zpc_aes_key *aes_key1,
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&aes_key1->lock);
-	assert(rv == 0);
-	rv = pthread_mutex_unlock(&aes_key2->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -176,11 +198,7 @@ ret:
 int
 zpc_aes_xts_set_iv(struct zpc_aes_xts *aes_xts, const u8 * iv)
 {
-	struct pkey_protkey *protkey;
-	int rc, rv, i;
-	u8 *param;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -208,41 +226,7 @@ zpc_aes_xts_set_iv(struct zpc_aes_xts *aes_xts, const u8 * iv)
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0; i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
-
-		protkey = &aes_xts->aes_key2->prot;
-		param = aes_xts->param_pcc;
-
-		for (;;) {
-			rc = __aes_xts_set_iv(aes_xts, iv);
-			if (rc == 0) {
-				break;
-			} else {
-				if (aes_xts->aes_key2->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_xts->aes_key2->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-xts context at %p: re-derive protected key from %s secure key from aes key at %p",
-					    aes_xts, i == 0 ? "current" : "old", aes_xts->aes_key2);
-					rc = aes_key_sec2prot(aes_xts->aes_key2, i);
-
-					memcpy(param, protkey->protkey, AES_XTS_PROTKEYLEN(aes_xts->aes_key2->keysize));
-
-					rv = pthread_mutex_unlock(&aes_xts->aes_key2->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
-	}
+	rc = __aes_xts_set_iv_rederive(aes_xts, iv, 0);
 	if (rc)
 		goto ret;
 
@@ -338,12 +322,10 @@ int
 zpc_aes_xts_encrypt(struct zpc_aes_xts *aes_xts, u8 * c, const u8 * m,
     size_t mlen)
 {
-	struct pkey_protkey *protkey;
 	unsigned long flags = 0;
-	u8 *param;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -380,43 +362,15 @@ zpc_aes_xts_encrypt(struct zpc_aes_xts *aes_xts, u8 * c, const u8 * m,
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0; i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
-
-		protkey = &aes_xts->aes_key1->prot;
-		param = aes_xts->param_km;
-
-		for (;;) {
-			rc = __aes_xts_crypt(aes_xts, c, m, mlen, flags);
-			if (rc == 0) {
-				break;
-			} else {
-				if (aes_xts->aes_key1->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_xts->aes_key1->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-xts context at %p: re-derive protected key"
-						" from %s secure key from aes key at %p",
-					    aes_xts, i == 0 ? "current" : "old", aes_xts->aes_key1);
-					rc = aes_key_sec2prot(aes_xts->aes_key1, i);
-					memcpy(param, protkey->protkey, AES_XTS_PROTKEYLEN(aes_xts->aes_key1->keysize));
-
-					rv = pthread_mutex_unlock(&aes_xts->aes_key1->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
-	}
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS);
+	nchunks = par_nchunks(mlen, PAR_CHUNK, 32);
+	if (nchunks > 0)
+		rc = __aes_xts_crypt_par(aes_xts, c, m, mlen, nchunks, flags);
+	else
+		rc = __aes_xts_crypt_rederive(aes_xts, c, m, mlen, flags, 0);
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -425,12 +379,10 @@ int
 zpc_aes_xts_decrypt(struct zpc_aes_xts *aes_xts, u8 * m, const u8 * c,
     size_t clen)
 {
-	struct pkey_protkey *protkey;
 	unsigned long flags = CPACF_M;  /* decrypt */
-	u8 *param;
-	int rc, rv, i;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -467,42 +419,127 @@ zpc_aes_xts_decrypt(struct zpc_aes_xts *aes_xts, u8 * m, const u8 * c,
 		goto ret;
 	}
 
-	rc = -1;
-	for (i = 0; i < 2 && rc != 0; i++) {
-		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS);
+	nchunks = par_nchunks(clen, PAR_CHUNK, 32);
+	if (nchunks > 0)
+		rc = __aes_xts_crypt_par(aes_xts, m, c, clen, nchunks, flags);
+	else
+		rc = __aes_xts_crypt_rederive(aes_xts, m, c, clen, flags, 0);
 
-		protkey = &aes_xts->aes_key1->prot;
-		param = aes_xts->param_km;
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
 
-		for (;;) {
-			rc = __aes_xts_crypt(aes_xts, m, c, clen, flags);
-			if (rc == 0) {
-				break;
-			} else {
-				if (aes_xts->aes_key1->rand_protk) {
-					rc = ZPC_ERROR_PROTKEYONLY;
-					goto ret;
-				}
-				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&aes_xts->aes_key1->lock);
-					assert(rv == 0);
-
-					DEBUG
-					    ("aes-xts context at %p: re-derive protected key"
-					    " from %s secure key from aes key at %p",
-					    aes_xts, i == 0 ? "current" : "old", aes_xts->aes_key1);
-					rc = aes_key_sec2prot(aes_xts->aes_key1, i);
-					memcpy(param, protkey->protkey, AES_XTS_PROTKEYLEN(aes_xts->aes_key1->keysize));
-
-					rv = pthread_mutex_unlock(&aes_xts->aes_key1->lock);
-					assert(rv == 0);
-				}
-				if (rc)
-					break;
-			}
-		}
+int
+zpc_aes_xts_encryptv(struct zpc_aes_xts *aes_xts, const struct iovec *c,
+    const struct iovec *m, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_xts_cryptv(aes_xts, c, m, iovcnt, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_xts_decryptv(struct zpc_aes_xts *aes_xts, const struct iovec *m,
+    const struct iovec *c, int iovcnt)
+{
+	int rc;
+
+	rc = __aes_xts_cryptv(aes_xts, m, c, iovcnt, CPACF_M);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_xts_encrypt_sectors(struct zpc_aes_xts *aes_xts, u8 * c,
+    const u8 * m, size_t sector_size, unsigned long long first_sector,
+    size_t nsectors)
+{
+	int rc;
+
+	rc = __aes_xts_crypt_sectors(aes_xts, c, m, sector_size, first_sector,
+	    nsectors, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_xts_decrypt_sectors(struct zpc_aes_xts *aes_xts, u8 * m,
+    const u8 * c, size_t sector_size, unsigned long long first_sector,
+    size_t nsectors)
+{
+	int rc;
+
+	rc = __aes_xts_crypt_sectors(aes_xts, m, c, sector_size, first_sector,
+	    nsectors, CPACF_M);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_aes_xts_get_stats(const struct zpc_aes_xts *aes_xts,
+    struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_xts == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
 	}
 
+	stats_ctx_get(&aes_xts->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+int
+zpc_aes_xts_dup(struct zpc_aes_xts **aes_xts, const struct zpc_aes_xts *src)
+{
+	struct zpc_aes_xts *new_aes_xts = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.aes_xts) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (aes_xts == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_aes_xts = malloc(sizeof(*new_aes_xts));
+	if (new_aes_xts == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_aes_xts, src, sizeof(*new_aes_xts));
+	memset(&new_aes_xts->stats, 0, sizeof(new_aes_xts->stats));
+
+	if (new_aes_xts->key_set) {
+		aes_key_ref(new_aes_xts->aes_key1);
+		aes_key_ref(new_aes_xts->aes_key2);
+	}
+
+	DEBUG("aes-xts context at %p: copy of %p", new_aes_xts, src);
+	*aes_xts = new_aes_xts;
+	rc = 0;
 ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
@@ -584,6 +621,352 @@ __aes_xts_set_intermediate_iv(struct zpc_aes_xts *aes_xts, const u8 iv[16])
 	return rc;
 }
 
+/*
+ * Argument checks and segment walk of encryptv and decryptv. A final
+ * partial block is passed to __aes_xts_crypt together with the preceding
+ * block for ciphertext stealing.
+ */
+static int
+__aes_xts_cryptv(struct zpc_aes_xts *aes_xts, const struct iovec *out,
+    const struct iovec *in, int iovcnt, unsigned long flags)
+{
+	struct aes_xts_iov arg;
+	struct stats_op st = { 0 };
+	size_t inlen, outlen, tail;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_xts)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_xts == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	if (iovcnt < 0)
+		return ZPC_ERROR_ARG4RANGE;
+	if (iovcnt > 0 && out == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (iovcnt > 0 && in == NULL)
+		return ZPC_ERROR_ARG3NULL;
+	if (iov_len(in, iovcnt, &inlen) != 0)
+		return ZPC_ERROR_ARG3RANGE;
+	if (iov_len(out, iovcnt, &outlen) != 0 || outlen != inlen)
+		return ZPC_ERROR_ARG2RANGE;
+	if (inlen < 16)
+		return (flags & CPACF_M) ? ZPC_ERROR_CLEN : ZPC_ERROR_MLEN;
+
+	if (!aes_xts->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (!aes_xts->iv_set)
+		return ZPC_ERROR_IVNOTSET;
+
+	arg.aes_xts = aes_xts;
+	arg.flags = flags;
+	arg.wait = 0;
+	tail = (inlen % 16) ? 16 + inlen % 16 : 0;
+
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS);
+	rc = iov_walk(out, in, iovcnt, inlen, 16, tail, __aes_xts_crypt_iov, &arg);
+	stats_op_end(&st, inlen);
+	return rc;
+}
+
+/* iov_walk callback: __aes_xts_crypt with protected key re-derivation. */
+static int
+__aes_xts_crypt_iov(void *p, u8 *out, const u8 *in, size_t inlen, int last)
+{
+	struct aes_xts_iov *arg = p;
+	int rc;
+
+	UNUSED(last);
+
+	if (inlen == 0)
+		return 0;
+
+	rc = __aes_xts_crypt_rederive(arg->aes_xts, out, in, inlen,
+	    arg->flags, arg->wait);
+	if (rc == 0)
+		arg->wait = 1;
+	return rc;
+}
+
+/*
+ * __aes_xts_set_iv with protected key re-derivation. Set wait if the
+ * operation already wrote output, see aes_key_update_prot_wait.
+ */
+static int
+__aes_xts_set_iv_rederive(struct zpc_aes_xts *aes_xts, const u8 * iv,
+    int wait)
+{
+	u8 *param;
+	int rc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = aes_xts->param_pcc;
+
+		for (;;) {
+			rc = __aes_xts_set_iv(aes_xts, iv);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_xts->aes_key2->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH && wait) {
+					rc = aes_key_update_prot_wait(
+					    aes_xts->aes_key2, i, param,
+					    AES_XTS_PROTKEYLEN(aes_xts->aes_key2->keysize),
+					    &aes_xts->key2_gen);
+				} else if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_xts->aes_key2, i,
+					    param, AES_XTS_PROTKEYLEN(aes_xts->aes_key2->keysize),
+					    &aes_xts->key2_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+/* __aes_xts_crypt with protected key re-derivation, wait as above. */
+static int
+__aes_xts_crypt_rederive(struct zpc_aes_xts *aes_xts, u8 * out,
+    const u8 * in, size_t inlen, unsigned long flags, int wait)
+{
+	u8 *param;
+	int rc, i;
+
+	rc = -1;
+	for (i = 0; i < 2 && rc != 0; i++) {
+		assert(i == AES_KEY_SEC_CUR || i == AES_KEY_SEC_OLD);
+
+		param = aes_xts->param_km;
+
+		for (;;) {
+			rc = __aes_xts_crypt(aes_xts, out, in, inlen, flags);
+			if (rc == 0) {
+				break;
+			} else {
+				if (aes_xts->aes_key1->rand_protk)
+					return ZPC_ERROR_PROTKEYONLY;
+				if (rc == ZPC_ERROR_WKVPMISMATCH && wait) {
+					rc = aes_key_update_prot_wait(
+					    aes_xts->aes_key1, i, param,
+					    AES_XTS_PROTKEYLEN(aes_xts->aes_key1->keysize),
+					    &aes_xts->key1_gen);
+				} else if (rc == ZPC_ERROR_WKVPMISMATCH) {
+					rc = aes_key_update_prot(aes_xts->aes_key1, i,
+					    param, AES_XTS_PROTKEYLEN(aes_xts->aes_key1->keysize),
+					    &aes_xts->key1_gen);
+				}
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Argument checks and sector loop of encrypt_sectors and decrypt_sectors.
+ * The iv of a sector is its number, 16 bytes little-endian. The context's
+ * iv is left as after the last sector.
+ */
+static int
+__aes_xts_crypt_sectors(struct zpc_aes_xts *aes_xts, u8 * out, const u8 * in,
+    size_t sector_size, unsigned long long first_sector, size_t nsectors,
+    unsigned long flags)
+{
+	struct stats_op st = { 0 };
+	size_t chunk_sectors, nchunks;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_xts)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_xts == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	if (nsectors > 0 && out == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (nsectors > 0 && in == NULL)
+		return ZPC_ERROR_ARG3NULL;
+	if (sector_size < 16)
+		return ZPC_ERROR_ARG4RANGE;
+	if (nsectors > 0 && first_sector + (nsectors - 1) < first_sector)
+		return ZPC_ERROR_ARG5RANGE;
+	if (nsectors > SIZE_MAX / sector_size)
+		return ZPC_ERROR_ARG6RANGE;
+
+	if (!aes_xts->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS);
+	chunk_sectors = PAR_CHUNK / sector_size > 0 ? PAR_CHUNK / sector_size : 1;
+	nchunks = par_nchunks(nsectors * sector_size,
+	    chunk_sectors * sector_size, sector_size);
+	if (nchunks > 0) {
+		rc = __aes_xts_sectors_par(aes_xts, out, in, sector_size,
+		    first_sector, nsectors, nchunks, flags);
+	} else {
+		rc = __aes_xts_crypt_sector_range(aes_xts, out, in, sector_size,
+		    first_sector, nsectors, flags, 0);
+	}
+	stats_op_end(&st, nsectors * sector_size);
+	return rc;
+}
+
+static int
+__aes_xts_crypt_sector_range(struct zpc_aes_xts *aes_xts, u8 * out,
+    const u8 * in, size_t sector_size, unsigned long long first_sector,
+    size_t nsectors, unsigned long flags, int wait)
+{
+	unsigned long long sector;
+	u8 iv[16];
+	size_t k;
+	int rc, j;
+
+	rc = 0;
+	for (k = 0; k < nsectors; k++) {
+		sector = first_sector + k;
+		for (j = 0; j < 16; j++) {
+			iv[j] = sector & 0xff;
+			sector >>= 8;
+		}
+
+		aes_xts->iv_set = 0;
+		rc = __aes_xts_set_iv_rederive(aes_xts, iv, wait);
+		if (rc)
+			break;
+		aes_xts->iv_set = 1;
+
+		rc = __aes_xts_crypt_rederive(aes_xts, out, in, sector_size,
+		    flags, wait);
+		if (rc)
+			break;
+		wait = 1;
+
+		out += sector_size;
+		in += sector_size;
+	}
+	return rc;
+}
+
+/*
+ * Whole chunks on the thread pool, the rest on the calling thread.
+ * The tweak of block n of the stream is the current one times alpha^n,
+ * the rest keeps the final partial block for ciphertext stealing.
+ * A chunk may fail after others wrote their output, so protected keys
+ * are re-derived in the calling threads even in non-blocking mode.
+ */
+static int
+__aes_xts_crypt_par(struct zpc_aes_xts *aes_xts, u8 * out, const u8 * in,
+    size_t inlen, size_t nchunks, unsigned long flags)
+{
+	struct aes_xts_par par;
+	size_t done = nchunks * PAR_CHUNK;
+	int rc;
+
+	memset(&par, 0, sizeof(par));
+	par.aes_xts = aes_xts;
+	par.out = out;
+	par.in = in;
+	par.flags = flags;
+
+	rc = par_run(__aes_xts_crypt_chunk, &par, nchunks);
+	if (rc)
+		return rc;
+
+	xts_mul_alpha_pow(aes_xts->param_km
+	    + AES_XTS_KM_XTSPARAM(aes_xts->aes_key1->keysize), done / 16);
+	return __aes_xts_crypt_rederive(aes_xts, out + done, in + done,
+	    inlen - done, flags, 1);
+}
+
+/* par_run callback: one chunk on a private copy of the context. */
+static int
+__aes_xts_crypt_chunk(void *p, size_t i)
+{
+	struct aes_xts_par *par = p;
+	struct zpc_aes_xts aes_xts;
+	int rc;
+
+	memcpy(&aes_xts, par->aes_xts, sizeof(aes_xts));
+	xts_mul_alpha_pow(aes_xts.param_km
+	    + AES_XTS_KM_XTSPARAM(aes_xts.aes_key1->keysize),
+	    (u64)i * (PAR_CHUNK / 16));
+
+	rc = __aes_xts_crypt_rederive(&aes_xts, par->out + i * PAR_CHUNK,
+	    par->in + i * PAR_CHUNK, PAR_CHUNK, par->flags, 1);
+
+	memzero_secure(aes_xts.param_km, sizeof(aes_xts.param_km));
+	memzero_secure(aes_xts.param_pcc, sizeof(aes_xts.param_pcc));
+	return rc;
+}
+
+/*
+ * Whole chunks of sectors on the thread pool, the rest on the calling
+ * thread, which leaves the context's iv as after the last sector.
+ * Protected keys are re-derived as in __aes_xts_crypt_par.
+ */
+static int
+__aes_xts_sectors_par(struct zpc_aes_xts *aes_xts, u8 * out, const u8 * in,
+    size_t sector_size, unsigned long long first_sector, size_t nsectors,
+    size_t nchunks, unsigned long flags)
+{
+	struct aes_xts_par par;
+	size_t chunk_sectors, done;
+	int rc;
+
+	chunk_sectors = PAR_CHUNK / sector_size > 0 ? PAR_CHUNK / sector_size : 1;
+	done = nchunks * chunk_sectors;
+
+	memset(&par, 0, sizeof(par));
+	par.aes_xts = aes_xts;
+	par.out = out;
+	par.in = in;
+	par.sector_size = sector_size;
+	par.chunk_sectors = chunk_sectors;
+	par.first_sector = first_sector;
+	par.flags = flags;
+
+	rc = par_run(__aes_xts_sectors_chunk, &par, nchunks);
+	if (rc)
+		return rc;
+
+	return __aes_xts_crypt_sector_range(aes_xts, out + done * sector_size,
+	    in + done * sector_size, sector_size, first_sector + done,
+	    nsectors - done, flags, 1);
+}
+
+/* par_run callback: one chunk of sectors on a private copy of the context. */
+static int
+__aes_xts_sectors_chunk(void *p, size_t i)
+{
+	struct aes_xts_par *par = p;
+	struct zpc_aes_xts aes_xts;
+	size_t off = i * par->chunk_sectors;
+	int rc;
+
+	memcpy(&aes_xts, par->aes_xts, sizeof(aes_xts));
+
+	rc = __aes_xts_crypt_sector_range(&aes_xts,
+	    par->out + off * par->sector_size, par->in + off * par->sector_size,
+	    par->sector_size, par->first_sector + off, par->chunk_sectors,
+	    par->flags, 1);
+
+	memzero_secure(aes_xts.param_km, sizeof(aes_xts.param_km));
+	memzero_secure(aes_xts.param_pcc, sizeof(aes_xts.param_pcc));
+	return rc;
+}
+
 static int
 __aes_xts_crypt(struct zpc_aes_xts *aes_xts, u8 * out, const u8 * in,
     size_t inlen, unsigned long flags)
@@ -22,6 +22,8 @@
 #include "cpacf.h"
 #include "globals.h"
 #include "misc.h"
+#include "parallel.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
@@ -29,8 +31,30 @@
 static int __aes_xts_full_set_iv(struct zpc_aes_xts_full *, const u8 *);
 static int __aes_xts_full_set_intermediate_state(struct zpc_aes_xts_full *, const u8 state[32]);
 static int __aes_xts_full_crypt(struct zpc_aes_xts_full *, u8 *, const u8 *, size_t, unsigned long);
+static int __aes_xts_full_crypt_rederive(struct zpc_aes_xts_full *, u8 *, const u8 *, size_t, unsigned long);
+static int __aes_xts_full_crypt_sectors(struct zpc_aes_xts_full *, u8 *, const u8 *, size_t,
+		unsigned long long, size_t, unsigned long);
+static int __aes_xts_full_crypt_sector_range(struct zpc_aes_xts_full *, u8 *, const u8 *,
+		size_t, unsigned long long, size_t, unsigned long);
+static int __aes_xts_full_crypt_par(struct zpc_aes_xts_full *, u8 *, const u8 *, size_t,
+		size_t, unsigned long);
+static int __aes_xts_full_crypt_chunk(void *, size_t);
+static int __aes_xts_full_sectors_par(struct zpc_aes_xts_full *, u8 *, const u8 *, size_t,
+		unsigned long long, size_t, size_t, unsigned long);
+static int __aes_xts_full_sectors_chunk(void *, size_t);
 static void __aes_xts_full_reset(struct zpc_aes_xts_full *);
 static void __aes_xts_full_reset_iv(struct zpc_aes_xts_full *);
+static void __aes_xts_full_copy_protkey(u8 *, const u8 *, int);
+
+struct aes_xts_full_par {
+	const struct zpc_aes_xts_full *aes_xts;
+	u8 *out;
+	const u8 *in;
+	size_t sector_size;	/* sectors only */
+	size_t chunk_sectors;	/* sectors only */
+	unsigned long long first_sector;	/* sectors only */
+	unsigned long flags;
+};
 
 int zpc_aes_xts_full_alloc(struct zpc_aes_xts_full **aes_xts)
 {
@@ -69,6 +93,7 @@ int zpc_aes_xts_full_alloc(struct zpc_aes_xts_full **aes_xts)
 
 int zpc_aes_xts_full_set_key(struct zpc_aes_xts_full *aes_xts, struct zpc_aes_xts_key *xts_key)
 {
+	u8 protkey[MAXXTSFULLPROTKEYSIZE];
 	int rc, rv;
 
 	UNUSED(rv);
@@ -99,9 +124,6 @@ int zpc_aes_xts_full_set_key(struct zpc_aes_xts_full *aes_xts, struct zpc_aes_xt
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
-	assert(rv == 0);
-
 	rc = aes_xts_key_check(xts_key);
 	if (rc)
 		goto ret;
@@ -113,23 +135,6 @@ int zpc_aes_xts_full_set_key(struct zpc_aes_xts_full *aes_xts, struct zpc_aes_xt
 		goto ret;
 	}
 
-	xts_key->refcount++;
-	DEBUG("xts key at %p: refcount %llu", xts_key, xts_key->refcount);
-
-	if (aes_xts->key_set) {
-		/* If another key is already set, unset it and decrease refcount. */
-		DEBUG("aes-xts-full context at %p: key unset", aes_xts);
-		__aes_xts_full_reset(aes_xts);
-	}
-
-	/* Set new key. */
-	assert(!aes_xts->key_set);
-
-	DEBUG("aes-xts-full context at %p: xts-key at %p set", aes_xts, xts_key);
-
-	aes_xts->fc = (xts_key->keysize == 128) ?
-		CPACF_KM_FXTS_ENCRYPTED_AES_128 : CPACF_KM_FXTS_ENCRYPTED_AES_256;
-
 	/*
 	 * Currently, full-xts keys can only be pvsecret-type keys. These can
 	 * only be imported via their secret ID and this import does not do any
@@ -137,7 +142,11 @@ int zpc_aes_xts_full_set_key(struct zpc_aes_xts_full *aes_xts, struct zpc_aes_xt
 	 * Therefore do an explicit sec2prot here.
 	 */
 	if (xts_key->type == ZPC_AES_XTS_KEY_TYPE_PVSECRET) {
+		rv = stats_mutex_lock(&xts_key->lock);
+		assert(rv == 0);
 		rc = aes_xts_key_sec2prot(xts_key);
+		rv = pthread_mutex_unlock(&xts_key->lock);
+		assert(rv == 0);
 		if (rc != 0) {
 			DEBUG("aes-xts-full context at %p: sec2prot failed with rc=%d",
 				aes_xts, rc);
@@ -145,10 +154,25 @@ int zpc_aes_xts_full_set_key(struct zpc_aes_xts_full *aes_xts, struct zpc_aes_xt
 		}
 	}
 
-	memcpy(aes_xts->param_km, &xts_key->prot.protkey, AES_FXTS_PROTKEYLEN(xts_key->keysize));
-	memcpy(aes_xts->param_km + AES_FXTS_WKVP_OFFSET(xts_key->keysize),
-		xts_key->prot.protkey + AES_FXTS_PROTKEYLEN(xts_key->keysize),
-		32);
+	aes_xts_key_ref(xts_key);
+
+	if (aes_xts->key_set) {
+		/* If another key is already set, unset it and decrease refcount. */
+		DEBUG("aes-xts-full context at %p: key unset", aes_xts);
+		__aes_xts_full_reset(aes_xts);
+	}
+
+	/* Set new key. */
+	assert(!aes_xts->key_set);
+
+	DEBUG("aes-xts-full context at %p: xts-key at %p set", aes_xts, xts_key);
+
+	aes_xts->fc = (xts_key->keysize == 128) ?
+		CPACF_KM_FXTS_ENCRYPTED_AES_128 : CPACF_KM_FXTS_ENCRYPTED_AES_256;
+
+	aes_xts_key_get_prot(xts_key, protkey, sizeof(protkey), &aes_xts->key_gen);
+	__aes_xts_full_copy_protkey(aes_xts->param_km, protkey, xts_key->keysize);
+	memzero_secure(protkey, sizeof(protkey));
 	memset(aes_xts->param_km + AES_FXTS_NAP_OFFSET(xts_key->keysize), 0x01, 1);
 
 	aes_xts->xts_key = xts_key;
@@ -156,8 +180,6 @@ int zpc_aes_xts_full_set_key(struct zpc_aes_xts_full *aes_xts, struct zpc_aes_xt
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&xts_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -290,12 +312,10 @@ ret:
 int zpc_aes_xts_full_encrypt(struct zpc_aes_xts_full *aes_xts, u8 * c,
 		const u8 * m, size_t mlen)
 {
-	struct pkey_xts_full_protkey *protkey;
 	unsigned long flags = 0;
-	u8 *param;
-	int rc, rv;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -332,40 +352,15 @@ int zpc_aes_xts_full_encrypt(struct zpc_aes_xts_full *aes_xts, u8 * c,
 		goto ret;
 	}
 
-	rc = -1;
-	protkey = &aes_xts->xts_key->prot;
-	param = aes_xts->param_km;
-
-	for (;;) {
-		rc = __aes_xts_full_crypt(aes_xts, c, m, mlen, flags);
-		if (rc == 0) {
-			break;
-		} else {
-			if (aes_xts->xts_key->rand_protk) {
-				rc = ZPC_ERROR_PROTKEYONLY;
-				goto ret;
-			}
-			if (rc == ZPC_ERROR_WKVPMISMATCH) {
-				rv = pthread_mutex_lock(&aes_xts->xts_key->lock);
-				assert(rv == 0);
-
-				DEBUG("aes-xts-full context at %p: re-derive protected key from xts key at %p",
-					aes_xts, aes_xts->xts_key);
-				rc = aes_xts_key_sec2prot(aes_xts->xts_key);
-				memcpy(param, protkey->protkey, AES_FXTS_PROTKEYLEN(aes_xts->xts_key->keysize));
-				memcpy(param + AES_FXTS_WKVP_OFFSET(aes_xts->xts_key->keysize),
-					protkey->protkey + AES_FXTS_PROTKEYLEN(aes_xts->xts_key->keysize),
-					32);
-
-				rv = pthread_mutex_unlock(&aes_xts->xts_key->lock);
-				assert(rv == 0);
-			}
-			if (rc)
-				break;
-		}
-	}
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS_FULL);
+	nchunks = par_nchunks(mlen, PAR_CHUNK, 32);
+	if (nchunks > 0)
+		rc = __aes_xts_full_crypt_par(aes_xts, c, m, mlen, nchunks, flags);
+	else
+		rc = __aes_xts_full_crypt_rederive(aes_xts, c, m, mlen, flags);
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -373,12 +368,10 @@ ret:
 int zpc_aes_xts_full_decrypt(struct zpc_aes_xts_full *aes_xts, u8 * m,
 		const u8 * c, size_t clen)
 {
-	struct pkey_xts_full_protkey *protkey;
 	unsigned long flags = CPACF_M;  /* decrypt */
-	u8 *param;
-	int rc, rv;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	size_t nchunks;
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -415,41 +408,60 @@ int zpc_aes_xts_full_decrypt(struct zpc_aes_xts_full *aes_xts, u8 * m,
 		goto ret;
 	}
 
-	rc = -1;
-	protkey = &aes_xts->xts_key->prot;
-	param = aes_xts->param_km;
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS_FULL);
+	nchunks = par_nchunks(clen, PAR_CHUNK, 32);
+	if (nchunks > 0)
+		rc = __aes_xts_full_crypt_par(aes_xts, m, c, clen, nchunks, flags);
+	else
+		rc = __aes_xts_full_crypt_rederive(aes_xts, m, c, clen, flags);
 
-	for (;;) {
-		rc = __aes_xts_full_crypt(aes_xts, m, c, clen, flags);
-		if (rc == 0) {
-			break;
-		} else {
-			if (aes_xts->xts_key->rand_protk) {
-				rc = ZPC_ERROR_PROTKEYONLY;
-				goto ret;
-			}
-			if (rc == ZPC_ERROR_WKVPMISMATCH) {
-				rv = pthread_mutex_lock(&aes_xts->xts_key->lock);
-				assert(rv == 0);
-
-				DEBUG("aes-xts-full context at %p: re-derive protected key from xts key at %p",
-					aes_xts, aes_xts->xts_key);
-				rc = aes_xts_key_sec2prot(aes_xts->xts_key);
-				memcpy(param, protkey->protkey, AES_FXTS_PROTKEYLEN(aes_xts->xts_key->keysize));
-				memcpy(param + AES_FXTS_WKVP_OFFSET(aes_xts->xts_key->keysize),
-					protkey->protkey + AES_FXTS_PROTKEYLEN(aes_xts->xts_key->keysize),
-					32);
-
-				rv = pthread_mutex_unlock(&aes_xts->xts_key->lock);
-				assert(rv == 0);
-			}
-			if (rc)
-				break;
-		}
+ret:
+	stats_op_end(&st, clen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_aes_xts_full_encrypt_sectors(struct zpc_aes_xts_full *aes_xts, u8 * c,
+		const u8 * m, size_t sector_size, unsigned long long first_sector,
+		size_t nsectors)
+{
+	int rc;
+
+	rc = __aes_xts_full_crypt_sectors(aes_xts, c, m, sector_size,
+		first_sector, nsectors, 0);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_aes_xts_full_decrypt_sectors(struct zpc_aes_xts_full *aes_xts, u8 * m,
+		const u8 * c, size_t sector_size, unsigned long long first_sector,
+		size_t nsectors)
+{
+	int rc;
+
+	rc = __aes_xts_full_crypt_sectors(aes_xts, m, c, sector_size,
+		first_sector, nsectors, CPACF_M);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_aes_xts_full_get_stats(const struct zpc_aes_xts_full *aes_xts,
+		struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (aes_xts == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
 	}
 
+	stats_ctx_get(&aes_xts->stats, stats);
+	rc = 0;
 ret:
-	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
 
@@ -606,6 +618,218 @@ ret:
 	return rc;
 }
 
+/* __aes_xts_full_crypt with protected key re-derivation. */
+static int __aes_xts_full_crypt_rederive(struct zpc_aes_xts_full *aes_xts,
+		u8 * out, const u8 * in, size_t inlen, unsigned long flags)
+{
+	u8 protkey[MAXXTSFULLPROTKEYSIZE];
+	int rc;
+
+	for (;;) {
+		rc = __aes_xts_full_crypt(aes_xts, out, in, inlen, flags);
+		if (rc == 0) {
+			break;
+		} else {
+			if (aes_xts->xts_key->rand_protk)
+				return ZPC_ERROR_PROTKEYONLY;
+			if (rc == ZPC_ERROR_WKVPMISMATCH) {
+				rc = aes_xts_key_update_prot(aes_xts->xts_key,
+				    protkey, sizeof(protkey), &aes_xts->key_gen);
+				__aes_xts_full_copy_protkey(aes_xts->param_km, protkey,
+				    aes_xts->xts_key->keysize);
+				memzero_secure(protkey, sizeof(protkey));
+			}
+			if (rc)
+				break;
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Argument checks and sector loop of encrypt_sectors and decrypt_sectors.
+ * The iv of a sector is its number, 16 bytes little-endian. The context's
+ * tweak is left as after the last sector.
+ */
+static int __aes_xts_full_crypt_sectors(struct zpc_aes_xts_full *aes_xts,
+		u8 * out, const u8 * in, size_t sector_size,
+		unsigned long long first_sector, size_t nsectors,
+		unsigned long flags)
+{
+	struct stats_op st = { 0 };
+	size_t chunk_sectors, nchunks;
+	int rc;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.aes_xts)
+		return ZPC_ERROR_HWCAPS;
+	if (aes_xts == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	if (nsectors > 0 && out == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (nsectors > 0 && in == NULL)
+		return ZPC_ERROR_ARG3NULL;
+	if (sector_size < 16)
+		return ZPC_ERROR_ARG4RANGE;
+	if (nsectors > 0 && first_sector + (nsectors - 1) < first_sector)
+		return ZPC_ERROR_ARG5RANGE;
+	if (nsectors > SIZE_MAX / sector_size)
+		return ZPC_ERROR_ARG6RANGE;
+
+	if (!aes_xts->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+
+	stats_op_begin(&st, &aes_xts->stats, ZPC_STATS_OP_AES_XTS_FULL);
+	chunk_sectors = PAR_CHUNK / sector_size > 0 ? PAR_CHUNK / sector_size : 1;
+	nchunks = par_nchunks(nsectors * sector_size,
+			chunk_sectors * sector_size, sector_size);
+	if (nchunks > 0)
+		rc = __aes_xts_full_sectors_par(aes_xts, out, in, sector_size,
+				first_sector, nsectors, nchunks, flags);
+	else
+		rc = __aes_xts_full_crypt_sector_range(aes_xts, out, in,
+				sector_size, first_sector, nsectors, flags);
+	stats_op_end(&st, nsectors * sector_size);
+	return rc;
+}
+
+static int __aes_xts_full_crypt_sector_range(struct zpc_aes_xts_full *aes_xts,
+		u8 * out, const u8 * in, size_t sector_size,
+		unsigned long long first_sector, size_t nsectors,
+		unsigned long flags)
+{
+	unsigned long long sector;
+	u8 iv[16];
+	size_t k;
+	int rc, j;
+
+	rc = 0;
+	for (k = 0; k < nsectors; k++) {
+		sector = first_sector + k;
+		for (j = 0; j < 16; j++) {
+			iv[j] = sector & 0xff;
+			sector >>= 8;
+		}
+
+		/* Sets the tweak and the NAP, no instruction. */
+		__aes_xts_full_set_iv(aes_xts, iv);
+		aes_xts->iv_set = 1;
+
+		rc = __aes_xts_full_crypt_rederive(aes_xts, out, in,
+			sector_size, flags);
+		if (rc)
+			break;
+
+		out += sector_size;
+		in += sector_size;
+	}
+	return rc;
+}
+
+/*
+ * Whole chunks on the thread pool, the rest on the calling thread.
+ * The NAP of block n of the stream is the current one times alpha^n,
+ * the rest keeps the final partial block for ciphertext stealing.
+ */
+static int __aes_xts_full_crypt_par(struct zpc_aes_xts_full *aes_xts,
+		u8 * out, const u8 * in, size_t inlen, size_t nchunks,
+		unsigned long flags)
+{
+	struct aes_xts_full_par par;
+	size_t done = nchunks * PAR_CHUNK;
+	int rc;
+
+	memset(&par, 0, sizeof(par));
+	par.aes_xts = aes_xts;
+	par.out = out;
+	par.in = in;
+	par.flags = flags;
+
+	rc = par_run(__aes_xts_full_crypt_chunk, &par, nchunks);
+	if (rc)
+		return rc;
+
+	xts_mul_alpha_pow(aes_xts->param_km
+		+ AES_FXTS_NAP_OFFSET(aes_xts->xts_key->keysize), done / 16);
+	return __aes_xts_full_crypt_rederive(aes_xts, out + done, in + done,
+		inlen - done, flags);
+}
+
+/* par_run callback: one chunk on a private copy of the context. */
+static int __aes_xts_full_crypt_chunk(void *p, size_t i)
+{
+	struct aes_xts_full_par *par = p;
+	struct zpc_aes_xts_full aes_xts;
+	int rc;
+
+	memcpy(&aes_xts, par->aes_xts, sizeof(aes_xts));
+	xts_mul_alpha_pow(aes_xts.param_km
+		+ AES_FXTS_NAP_OFFSET(aes_xts.xts_key->keysize),
+		(u64)i * (PAR_CHUNK / 16));
+
+	rc = __aes_xts_full_crypt_rederive(&aes_xts, par->out + i * PAR_CHUNK,
+		par->in + i * PAR_CHUNK, PAR_CHUNK, par->flags);
+
+	memzero_secure(aes_xts.param_km, sizeof(aes_xts.param_km));
+	return rc;
+}
+
+/*
+ * Whole chunks of sectors on the thread pool, the rest on the calling
+ * thread, which leaves the context's tweak as after the last sector.
+ */
+static int __aes_xts_full_sectors_par(struct zpc_aes_xts_full *aes_xts,
+		u8 * out, const u8 * in, size_t sector_size,
+		unsigned long long first_sector, size_t nsectors,
+		size_t nchunks, unsigned long flags)
+{
+	struct aes_xts_full_par par;
+	size_t chunk_sectors, done;
+	int rc;
+
+	chunk_sectors = PAR_CHUNK / sector_size > 0 ? PAR_CHUNK / sector_size : 1;
+	done = nchunks * chunk_sectors;
+
+	memset(&par, 0, sizeof(par));
+	par.aes_xts = aes_xts;
+	par.out = out;
+	par.in = in;
+	par.sector_size = sector_size;
+	par.chunk_sectors = chunk_sectors;
+	par.first_sector = first_sector;
+	par.flags = flags;
+
+	rc = par_run(__aes_xts_full_sectors_chunk, &par, nchunks);
+	if (rc)
+		return rc;
+
+	return __aes_xts_full_crypt_sector_range(aes_xts,
+		out + done * sector_size, in + done * sector_size,
+		sector_size, first_sector + done, nsectors - done, flags);
+}
+
+/* par_run callback: one chunk of sectors on a private copy of the context. */
+static int __aes_xts_full_sectors_chunk(void *p, size_t i)
+{
+	struct aes_xts_full_par *par = p;
+	struct zpc_aes_xts_full aes_xts;
+	size_t off = i * par->chunk_sectors;
+	int rc;
+
+	memcpy(&aes_xts, par->aes_xts, sizeof(aes_xts));
+
+	rc = __aes_xts_full_crypt_sector_range(&aes_xts,
+		par->out + off * par->sector_size,
+		par->in + off * par->sector_size, par->sector_size,
+		par->first_sector + off, par->chunk_sectors, par->flags);
+
+	memzero_secure(aes_xts.param_km, sizeof(aes_xts.param_km));
+	return rc;
+}
+
 static void __aes_xts_full_reset(struct zpc_aes_xts_full *aes_xts)
 {
 	assert(aes_xts != NULL);
@@ -633,3 +857,14 @@ static void __aes_xts_full_reset_iv(struct zpc_aes_xts_full *aes_xts)
 	}
 	aes_xts->iv_set = 0;
 }
+
+/*
+ * Copy a full-xts protected key and its wkvp to the km parameter block.
+ */
+static void __aes_xts_full_copy_protkey(u8 *param, const u8 *protkey,
+		int keysize)
+{
+	memcpy(param, protkey, AES_FXTS_PROTKEYLEN(keysize));
+	memcpy(param + AES_FXTS_WKVP_OFFSET(keysize),
+		protkey + AES_FXTS_PROTKEYLEN(keysize), 32);
+}
@@ -28,11 +28,14 @@
 struct zpc_aes_xts_full {
 	u8 param_km[sizeof(struct cpacf_km_xts_full_aes_256_param)];
 	struct zpc_aes_xts_key *xts_key;
+	unsigned long long key_gen;	/* xts_key->prot_gen of param_km */
 
 	unsigned int fc;
 
 	int key_set;
 	int iv_set;
+
+	struct stats_ctx stats;
 };
 
 #endif
@@ -15,6 +15,9 @@
 #include "globals.h"
 #include "debug.h"
 #include "misc.h"
+#include "stats.h"
+#include "pkey_io.h"
+#include "seqlock.h"
 #include "zkey/pkey.h"
 
 #include <assert.h>
@@ -28,7 +31,10 @@
 #include "aes_xts_key_local.h"
 
 static void __aes_xts_key_reset(struct zpc_aes_xts_key *);
-static int aes_xts_key_pvsec2prot(struct zpc_aes_xts_key *xts_key);
+static int aes_xts_key_pvsec2prot(struct zpc_aes_xts_key *xts_key,
+		struct pkey_xts_full_protkey *prot);
+static void aes_xts_key_set_prot(struct zpc_aes_xts_key *xts_key,
+		const struct pkey_xts_full_protkey *prot);
 static int aes_xts_key_blob_is_valid_pvsecret_id(struct zpc_aes_xts_key *xts_key,
 		const unsigned char *id);
 static int aes_xts_key_generate(struct pkey_genfxtsprotk *genprotk);
@@ -114,10 +120,10 @@ int zpc_aes_xts_key_set_size(struct zpc_aes_xts_key *xts_key, int keysize)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
+	rv = stats_mutex_lock(&xts_key->lock);
 	assert(rv == 0);
 
-	if (xts_key->refcount != 1) {
+	if (__atomic_load_n(&xts_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -171,10 +177,10 @@ int zpc_aes_xts_key_set_type(struct zpc_aes_xts_key *xts_key, int type)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
+	rv = stats_mutex_lock(&xts_key->lock);
 	assert(rv == 0);
 
-	if (xts_key->refcount != 1) {
+	if (__atomic_load_n(&xts_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -213,10 +219,10 @@ int zpc_aes_xts_key_import_clear(struct zpc_aes_xts_key *xts_key,
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
+	rv = stats_mutex_lock(&xts_key->lock);
 	assert(rv == 0);
 
-	if (xts_key->refcount != 1) {
+	if (__atomic_load_n(&xts_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -275,7 +281,7 @@ int zpc_aes_xts_key_export(struct zpc_aes_xts_key *xts_key, unsigned char *buf,
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
+	rv = stats_mutex_lock(&xts_key->lock);
 	assert(rv == 0);
 
 	if (xts_key->rand_protk) {
@@ -329,10 +335,10 @@ int zpc_aes_xts_key_import(struct zpc_aes_xts_key *xts_key, const unsigned char
 		return ZPC_ERROR_ARG3RANGE;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
+	rv = stats_mutex_lock(&xts_key->lock);
 	assert(rv == 0);
 
-	if (xts_key->refcount != 1) {
+	if (__atomic_load_n(&xts_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -385,10 +391,10 @@ int zpc_aes_xts_key_generate(struct zpc_aes_xts_key *xts_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&xts_key->lock);
+	rv = stats_mutex_lock(&xts_key->lock);
 	assert(rv == 0);
 
-	if (xts_key->refcount != 1) {
+	if (__atomic_load_n(&xts_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -418,7 +424,7 @@ int zpc_aes_xts_key_generate(struct zpc_aes_xts_key *xts_key)
 	}
 
 	DEBUG("aes-xts key at %p: key set to generated protected key", xts_key);
-	memcpy(&xts_key->prot, &genprotk.protkey, sizeof(xts_key->prot));
+	aes_xts_key_set_prot(xts_key, &genprotk.protkey);
 	xts_key->rand_protk = 1;
 	xts_key->key_set = 1;
 
@@ -435,7 +441,8 @@ ret:
 
 void zpc_aes_xts_key_free(struct zpc_aes_xts_key **xts_key)
 {
-	int rv, free_obj = 0;
+	unsigned long long refcount;
+	int rv;
 
 	UNUSED(rv);
 
@@ -444,30 +451,27 @@ void zpc_aes_xts_key_free(struct zpc_aes_xts_key **xts_key)
 	if (*xts_key == NULL)
 		return;
 
-	rv = pthread_mutex_lock(&(*xts_key)->lock);
-	assert(rv == 0);
-
-	if ((*xts_key)->refcount == 0)
-		goto ret;
-
-	(*xts_key)->refcount--;
-	DEBUG("aes-xts key at %p: refcount %llu", *xts_key, (*xts_key)->refcount);
+	refcount = __atomic_load_n(&(*xts_key)->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0)
+			goto ret;
+	} while (!__atomic_compare_exchange_n(&(*xts_key)->refcount, &refcount,
+	    refcount - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	DEBUG("aes-xts key at %p: refcount %llu", *xts_key, refcount - 1);
 
-	if ((*xts_key)->refcount == 0) {
-		free_obj = 1;
+	if (refcount == 1) {
+		rv = stats_mutex_lock(&(*xts_key)->lock);
+		assert(rv == 0);
 		__aes_xts_key_reset(*xts_key);
-	}
-
-ret:
-	rv = pthread_mutex_unlock(&(*xts_key)->lock);
-	assert(rv == 0);
+		rv = pthread_mutex_unlock(&(*xts_key)->lock);
+		assert(rv == 0);
 
-	if (free_obj == 1) {
 		rv = pthread_mutex_destroy(&(*xts_key)->lock);
 		assert(rv == 0);
 
 		free(*xts_key);
 	}
+ret:
 	*xts_key = NULL;
 	DEBUG("return");
 }
@@ -482,7 +486,9 @@ static void __aes_xts_key_reset(struct zpc_aes_xts_key *xts_key)
 	assert(xts_key != NULL);
 
 	memset(&xts_key->cur, 0, sizeof(xts_key->cur));
+	seq_write_begin(&xts_key->prot_seq);
 	memset(&xts_key->prot, 0, sizeof(xts_key->prot));
+	seq_write_end(&xts_key->prot_seq);
 	xts_key->key_set = 0;
 
 	xts_key->keysize = 0;
@@ -493,7 +499,7 @@ static void __aes_xts_key_reset(struct zpc_aes_xts_key *xts_key)
 
 	xts_key->rand_protk = 0;
 
-	xts_key->refcount = 1;
+	__atomic_store_n(&xts_key->refcount, 1, __ATOMIC_RELAXED);
 }
 
 #define SYSFS_DIR             "/sys/devices/virtual/misc/pkey/protkey"
@@ -622,7 +628,7 @@ static int aes_xts_key_blob_is_valid_pvsecret_id(struct zpc_aes_xts_key *xts_key
 	io.keylen = sizeof(struct uvrsecrettoken);
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
 	if (rc != 0) {
 		DEBUG("aes-xts key at %p: PKEY_VERIFYKEY2 ioctl failed, errno = %d",
 			xts_key, errno);
@@ -636,7 +642,8 @@ static int aes_xts_key_blob_is_valid_pvsecret_id(struct zpc_aes_xts_key *xts_key
  * (Re)derive protected key from a retrievable secret ID.
  * Caller must hold xts_key's wr lock.
  */
-static int aes_xts_key_pvsec2prot(struct zpc_aes_xts_key *xts_key)
+static int aes_xts_key_pvsec2prot(struct zpc_aes_xts_key *xts_key,
+		struct pkey_xts_full_protkey *prot)
 {
 	struct pkey_kblob2pkey3 io;
 	unsigned char buf[sizeof(struct uvrsecrettoken)] = { 0, };
@@ -648,11 +655,11 @@ static int aes_xts_key_pvsec2prot(struct zpc_aes_xts_key *xts_key)
 	io.key = buf;
 	io.keylen = sizeof(struct uvrsecrettoken);
 	io.pkeytype = xts_key->type;
-	io.pkeylen = sizeof(xts_key->prot.protkey);
-	io.pkey = (unsigned char *)&xts_key->prot.protkey;
+	io.pkeylen = sizeof(prot->protkey);
+	io.pkey = (unsigned char *)&prot->protkey;
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
 		DEBUG("aes-xts key at %p: PKEY_KBLOB2PROTK3 ioctl failed, errno = %d",
 			xts_key, errno);
@@ -668,9 +675,18 @@ static int aes_xts_key_pvsec2prot(struct zpc_aes_xts_key *xts_key)
  */
 int aes_xts_key_sec2prot(struct zpc_aes_xts_key *xts_key)
 {
+	struct pkey_xts_full_protkey prot;
+	int rc;
+
 	switch (xts_key->type) {
 	case ZPC_AES_XTS_KEY_TYPE_PVSECRET:
-		return aes_xts_key_pvsec2prot(xts_key);
+		/* Derive aside, readers keep using the current protected key. */
+		memcpy(&prot, &xts_key->prot, sizeof(prot));
+		rc = aes_xts_key_pvsec2prot(xts_key, &prot);
+		if (rc == 0)
+			aes_xts_key_set_prot(xts_key, &prot);
+		memzero_secure(&prot, sizeof(prot));
+		return rc;
 	default:
 		break;
 	}
@@ -678,10 +694,90 @@ int aes_xts_key_sec2prot(struct zpc_aes_xts_key *xts_key)
 	return ZPC_ERROR_KEYTYPE;
 }
 
+/*
+ * Install a new protected key. The generation tells contexts with an
+ * older copy that they can just update it.
+ * Caller must hold xts_key's lock.
+ */
+static void aes_xts_key_set_prot(struct zpc_aes_xts_key *xts_key,
+		const struct pkey_xts_full_protkey *prot)
+{
+	seq_write_begin(&xts_key->prot_seq);
+	memcpy(&xts_key->prot, prot, sizeof(xts_key->prot));
+	xts_key->prot_gen++;
+	seq_write_end(&xts_key->prot_seq);
+}
+
+/*
+ * Take a reference. Does not take xts_key's lock.
+ */
+void aes_xts_key_ref(struct zpc_aes_xts_key *xts_key)
+{
+	unsigned long long refcount;
+
+	refcount = __atomic_add_fetch(&xts_key->refcount, 1, __ATOMIC_RELAXED);
+	DEBUG("aes-xts key at %p: refcount %llu", xts_key, refcount);
+}
+
+/*
+ * Copy the first len bytes of the protected key and its generation.
+ * Does not take xts_key's lock.
+ */
+void aes_xts_key_get_prot(const struct zpc_aes_xts_key *xts_key,
+		void *protkey, size_t len, unsigned long long *gen)
+{
+	unsigned int seq;
+
+	assert(len <= sizeof(xts_key->prot.protkey));
+
+	do {
+		seq = seq_read_begin(&xts_key->prot_seq);
+		memcpy(protkey, xts_key->prot.protkey, len);
+		*gen = xts_key->prot_gen;
+	} while (seq_read_retry(&xts_key->prot_seq, seq));
+}
+
+/*
+ * Update a context's copy of the protected key after a wrapping key
+ * verification pattern mismatch. Only a re-derivation takes xts_key's
+ * lock.
+ */
+int aes_xts_key_update_prot(struct zpc_aes_xts_key *xts_key, void *protkey,
+		size_t len, unsigned long long *gen)
+{
+	unsigned long long cur;
+	int rc = 0, rv;
+
+	UNUSED(rv);
+
+	aes_xts_key_get_prot(xts_key, protkey, len, &cur);
+	if (cur != *gen) {
+		/* Another context re-derived it already. */
+		*gen = cur;
+		return 0;
+	}
+
+	rv = stats_mutex_lock(&xts_key->lock);
+	assert(rv == 0);
+
+	if (xts_key->prot_gen == *gen) {
+		DEBUG("aes-xts key at %p: re-derive protected key", xts_key);
+		stats_inc(STATS_REDERIVE);
+		rc = aes_xts_key_sec2prot(xts_key);
+	}
+	memcpy(protkey, xts_key->prot.protkey, len);
+	*gen = xts_key->prot_gen;
+
+	rv = pthread_mutex_unlock(&xts_key->lock);
+	assert(rv == 0);
+	return rc;
+}
+
 int aes_xts_key_clr2prot(struct zpc_aes_xts_key *xts_key, const unsigned char *key,
 		unsigned int keylen)
 {
 	struct pkey_kblob2pkey3 io;
+	struct pkey_xts_full_protkey prot;
 	unsigned char buf[sizeof(struct clearkeytoken) + 64];
 	struct clearkeytoken *clrtok = (struct clearkeytoken *)&buf;
 	int rc;
@@ -704,14 +800,16 @@ int aes_xts_key_clr2prot(struct zpc_aes_xts_key *xts_key, const unsigned char *k
 	memset(&io, 0, sizeof(io));
 	io.key = buf;
 	io.keylen = sizeof(struct clearkeytoken) + keylen;
-	io.pkeylen = sizeof(xts_key->prot.protkey);
-	io.pkey = (unsigned char *)&xts_key->prot.protkey;
+	memcpy(&prot, &xts_key->prot, sizeof(prot));
+	io.pkeylen = sizeof(prot.protkey);
+	io.pkey = (unsigned char *)&prot.protkey;
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
 		DEBUG("aes-xts key at %p: PKEY_KBLOB2PROTK3 ioctl failed, errno = %d",
 			xts_key, errno);
+		memzero_secure(&prot, sizeof(prot));
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
 	}
 
@@ -719,9 +817,12 @@ int aes_xts_key_clr2prot(struct zpc_aes_xts_key *xts_key, const unsigned char *k
 		DEBUG("aes-xts key at %p: PKEY_KBLOB2PROTK3 ioctl returned unexpected "
 			"protected key type %d. Expected %d.",
 			xts_key, io.pkeytype, clrtok->keytype);
+		memzero_secure(&prot, sizeof(prot));
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
 	}
 
+	aes_xts_key_set_prot(xts_key, &prot);
+	memzero_secure(&prot, sizeof(prot));
 	return 0;
 }
 
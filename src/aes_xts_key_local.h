@@ -26,6 +26,8 @@ struct aes_xts_key {
 struct zpc_aes_xts_key {
 	struct aes_xts_key cur; /* current pvsecret ID */
 	struct pkey_xts_full_protkey prot;
+	unsigned long long prot_gen;	/* incremented when prot changes */
+	unsigned int prot_seq;	/* seqlock.h counter of prot and prot_gen */
 	int key_set;
 
 	int keysize;
@@ -36,11 +38,16 @@ struct zpc_aes_xts_key {
 
 	int rand_protk;
 
-	unsigned long long refcount;
-	pthread_mutex_t lock;
+	unsigned long long refcount;	/* atomic */
+	pthread_mutex_t lock;	/* writers, readers of prot use prot_seq */
 };
 
 int aes_xts_key_sec2prot(struct zpc_aes_xts_key *);
+void aes_xts_key_ref(struct zpc_aes_xts_key *);
+void aes_xts_key_get_prot(const struct zpc_aes_xts_key *, void *protkey,
+		size_t len, unsigned long long *gen);
+int aes_xts_key_update_prot(struct zpc_aes_xts_key *, void *protkey,
+		size_t len, unsigned long long *gen);
 int aes_xts_key_check(const struct zpc_aes_xts_key *);
 int aes_xts_key_clr2prot(struct zpc_aes_xts_key *, const unsigned char *key,
 		unsigned int keylen);
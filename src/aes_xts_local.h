@@ -32,11 +32,15 @@ struct zpc_aes_xts {
 	u8 param_pcc[sizeof(struct cpacf_pcc_xts_aes_256_param)];
 	struct zpc_aes_key *aes_key1;
 	struct zpc_aes_key *aes_key2;
+	unsigned long long key1_gen;	/* aes_key1->prot_gen of param_km */
+	unsigned long long key2_gen;	/* aes_key2->prot_gen of param_pcc */
 
 	unsigned int fc;
 
 	int key_set;
 	int iv_set;
+
+	struct stats_ctx stats;
 };
 
 #endif
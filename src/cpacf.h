@@ -9,6 +9,12 @@
 # define CPACF_H
 
 # include "misc.h"
+# include "stats.h"
+
+# ifdef ZPC_SOFT_CPACF
+#  include "cpacf_soft.h"
+#  include <string.h>
+# endif
 
 # define CPACF_M                      0x80      /* Modifier bit */
 
@@ -16,6 +22,9 @@
 
 /* Function codes */
 # define CPACF_KM_QUERY			         0
+# define CPACF_KM_AES_128		    18
+# define CPACF_KM_AES_192		    19
+# define CPACF_KM_AES_256		    20
 # define CPACF_KM_ENCRYPTED_AES_128	    26
 # define CPACF_KM_ENCRYPTED_AES_192	    27
 # define CPACF_KM_ENCRYPTED_AES_256	    28
@@ -28,6 +37,10 @@ struct cpacf_km_aes_param {
 	u8 protkey[64]; /* WKa(K)|WKaVP */
 };
 
+struct cpacf_km_aes_clear_param {
+	u8 key[32]; /* K */
+};
+
 struct cpacf_km_xts_aes_128_param {
 	u8 protkey[48]; /* WKa(K)|WKaVP */
 	u8 xtsparam[16];
@@ -52,6 +65,7 @@ struct cpacf_km_xts_full_aes_256_param {
 	u8 wkvp[32]; /* WKaVP */
 };
 
+# ifndef ZPC_SOFT_CPACF
 static inline int
 cpacf_km(unsigned long fc, void *param, u8 * out, const u8 * in,
     unsigned long inlen)
@@ -62,22 +76,43 @@ cpacf_km(unsigned long fc, void *param, u8 * out, const u8 * in,
 	register unsigned long r2 __asm__("2") = (unsigned long) in;
 	register unsigned long r3 __asm__("3") = (unsigned long) inlen;
 	register unsigned long r4 __asm__("4") = (unsigned long) out;
+	unsigned long partial = 0;
 	u8 cc;
 
 	__asm__ volatile(
 		"0:	.insn	rre,%[opc] << 16,%[out],%[in]\n"
-		"	brc	1,0b\n" /* handle partial completion */
-                "       ipm     %[cc]\n"
+		"	brc	14,1f\n"
+		"	aghi	%[partial],1\n" /* handle partial completion */
+		"	j	0b\n"
+                "1:     ipm     %[cc]\n"
                 "       srl     %[cc],28\n"
 		: [in] "+a" (r2), [inlen] "+d" (r3), [out] "+a" (r4),
-          [cc] "=d" (cc)
+          [cc] "=d" (cc), [partial] "+d" (partial)
 		: [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb92e)
 		: "cc", "memory"
 	);
         /* *INDENT-ON* */
 
+	stats_cpacf(partial, cc == 1);
 	return cc;
 }
+# else
+static inline int
+cpacf_km(unsigned long fc, void *param, u8 * out, const u8 * in,
+    unsigned long inlen)
+{
+	unsigned long partial = 0;
+	int cc;
+
+	cpacf_soft_wk_pin();
+	while ((cc = cpacf_soft_km(fc, param, &out, &in, &inlen)) == 3)
+		partial++;	/* handle partial completion */
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# endif
 
 /* KMC */
 
@@ -92,6 +127,7 @@ struct cpacf_kmc_aes_param {
 	u8 protkey[64]; /* WKa(K)|WKaVP */
 };
 
+# ifndef ZPC_SOFT_CPACF
 static inline int
 cpacf_kmc(unsigned long fc, void *param, u8 * out, const u8 * in, long inlen)
 {
@@ -101,22 +137,109 @@ cpacf_kmc(unsigned long fc, void *param, u8 * out, const u8 * in, long inlen)
 	register unsigned long r2 __asm__("2") = (unsigned long) in;
 	register unsigned long r3 __asm__("3") = (unsigned long) inlen;
 	register unsigned long r4 __asm__("4") = (unsigned long) out;
+	unsigned long partial = 0;
 	u8 cc;
 
 	__asm__ volatile(
 		"0:	.insn	rre,%[opc] << 16,%[out],%[in]\n"
-		"	brc	1,0b\n" /* handle partial completion */
-                "       ipm     %[cc]\n"
+		"	brc	14,1f\n"
+		"	aghi	%[partial],1\n" /* handle partial completion */
+		"	j	0b\n"
+                "1:     ipm     %[cc]\n"
                 "       srl     %[cc],28\n"
 		: [in] "+a" (r2), [inlen] "+d" (r3), [out] "+a" (r4),
-          [cc] "=d" (cc)
+          [cc] "=d" (cc), [partial] "+d" (partial)
 		: [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb92f)
 		: "cc", "memory"
 	);
         /* *INDENT-ON* */
 
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# else
+static inline int
+cpacf_kmc(unsigned long fc, void *param, u8 * out, const u8 * in, long inlen)
+{
+	unsigned long len = (unsigned long)inlen, partial = 0;
+	int cc;
+
+	cpacf_soft_wk_pin();
+	while ((cc = cpacf_soft_kmc(fc, param, &out, &in, &len)) == 3)
+		partial++;	/* handle partial completion */
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# endif
+
+/* KMCTR */
+
+/* Function codes */
+# define CPACF_KMCTR_QUERY		0
+# define CPACF_KMCTR_ENCRYPTED_AES_128	26
+# define CPACF_KMCTR_ENCRYPTED_AES_192	27
+# define CPACF_KMCTR_ENCRYPTED_AES_256	28
+
+struct cpacf_kmctr_aes_param {
+	u8 protkey[64]; /* WKa(K)|WKaVP */
+};
+
+/*
+ * KMCTR (cipher message with counter): one 16 byte counter block of ctr
+ * is encrypted per block of in, inlen must be a multiple of 16.
+ */
+# ifndef ZPC_SOFT_CPACF
+static inline int
+cpacf_kmctr(unsigned long fc, void *param, u8 * out, const u8 * in,
+    unsigned long inlen, const u8 * ctr)
+{
+        /* *INDENT-OFF* */
+	register unsigned long r0 __asm__("0") = (unsigned long) fc;
+	register unsigned long r1 __asm__("1") = (unsigned long) param;
+	register unsigned long r2 __asm__("2") = (unsigned long) in;
+	register unsigned long r3 __asm__("3") = (unsigned long) inlen;
+	register unsigned long r4 __asm__("4") = (unsigned long) out;
+	register unsigned long r6 __asm__("6") = (unsigned long) ctr;
+	unsigned long partial = 0;
+	u8 cc;
+
+	__asm__ volatile(
+		"0:	.insn	rrf,%[opc] << 16,%[out],%[in],%[ctr],0\n"
+		"	brc	14,1f\n"
+		"	aghi	%[partial],1\n" /* handle partial completion */
+		"	j	0b\n"
+                "1:     ipm     %[cc]\n"
+                "       srl     %[cc],28\n"
+		: [in] "+a" (r2), [inlen] "+d" (r3), [out] "+a" (r4),
+          [ctr] "+a" (r6), [cc] "=d" (cc), [partial] "+d" (partial)
+		: [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb92d)
+		: "cc", "memory"
+	);
+        /* *INDENT-ON* */
+
+	stats_cpacf(partial, cc == 1);
 	return cc;
 }
+# else
+static inline int
+cpacf_kmctr(unsigned long fc, void *param, u8 * out, const u8 * in,
+    unsigned long inlen, const u8 * ctr)
+{
+	unsigned long partial = 0;
+	int cc;
+
+	cpacf_soft_wk_pin();
+	while ((cc = cpacf_soft_kmctr(fc, param, &out, &in, &inlen,
+	    &ctr)) == 3)
+		partial++;	/* handle partial completion */
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# endif
 
 /* KMAC */
 
@@ -155,6 +278,7 @@ struct cpacf_kmac_hmac_param {
 	};
 };
 
+# ifndef ZPC_SOFT_CPACF
 static inline int
 cpacf_kmac(unsigned long fc, void *param, const u8 * in, unsigned long inlen)
 {
@@ -163,21 +287,42 @@ cpacf_kmac(unsigned long fc, void *param, const u8 * in, unsigned long inlen)
 	register unsigned long r1 __asm__("1") = (unsigned long)param;
 	register unsigned long r2 __asm__("2") = (unsigned long)in;
 	register unsigned long r3 __asm__("3") = (unsigned long)inlen;
+	unsigned long partial = 0;
 	u8 cc;
 
 	__asm__ volatile(
 		"0:	.insn	rre,%[opc] << 16,0,%[in]\n"
-		"	brc	1,0b\n" /* handle partial completion */
-        "   ipm     %[cc]\n"
+		"	brc	14,1f\n"
+		"	aghi	%[partial],1\n" /* handle partial completion */
+		"	j	0b\n"
+        "1: ipm     %[cc]\n"
         "   srl     %[cc],28\n"
-		: [in] "+a" (r2), [inlen] "+d" (r3), [cc] "=d" (cc)
+		: [in] "+a" (r2), [inlen] "+d" (r3), [cc] "=d" (cc),
+		  [partial] "+d" (partial)
 		: [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb91e)
 		: "cc", "memory"
 	);
         /* *INDENT-ON* */
 
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# else
+static inline int
+cpacf_kmac(unsigned long fc, void *param, const u8 * in, unsigned long inlen)
+{
+	unsigned long partial = 0;
+	int cc;
+
+	cpacf_soft_wk_pin();
+	while ((cc = cpacf_soft_kmac(&fc, param, &in, &inlen)) == 3)
+		partial++;	/* handle partial completion */
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(partial, cc == 1);
 	return cc;
 }
+# endif
 
 /* PCC */
 
@@ -214,27 +359,46 @@ struct cpacf_pcc_cmac_aes_param {
 };
 
 /* PCC (perform cryptographuc computation) */
+# ifndef ZPC_SOFT_CPACF
 static inline int
 cpacf_pcc(unsigned long fc, void *param)
 {
 	register unsigned long r0 __asm__("0") = (unsigned long)fc;
 	register unsigned long r1 __asm__("1") = (unsigned long)param;
+	unsigned long partial = 0;
 	u8 cc;
 
 	/* *INDENT-OFF* */
 	__asm__ volatile(
 		"0:     .insn   rre,%[opc] << 16,0,0\n" /* PCC opcode */
-		"       brc     1,0b\n" /* handle partial completion */
-    	"       ipm     %[cc]\n"
+		"       brc     14,1f\n"
+		"       aghi    %[partial],1\n" /* handle partial completion */
+		"       j       0b\n"
+    	"1:     ipm     %[cc]\n"
         "       srl     %[cc],28\n"
-        : [cc] "=d" (cc)
+        : [cc] "=d" (cc), [partial] "+d" (partial)
         : [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb92c)
         : "cc", "memory"
 	);
 	/* *INDENT-ON* */
 
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# else
+static inline int
+cpacf_pcc(unsigned long fc, void *param)
+{
+	int cc;
+
+	cpacf_soft_wk_pin();
+	cc = cpacf_soft_pcc(fc, param);
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(0, cc == 1);
 	return cc;
 }
+# endif
 
 /* KMA */
 
@@ -261,6 +425,7 @@ struct cpacf_kma_gcm_aes_param {
 };
 
 /*  KMA (cipher message with authentication) */
+# ifndef ZPC_SOFT_CPACF
 static inline int
 cpacf_kma(unsigned long fc, void *param, u8 * out, const u8 * aad,
     unsigned long aadlen, const u8 * in, unsigned long inlen)
@@ -273,23 +438,46 @@ cpacf_kma(unsigned long fc, void *param, u8 * out, const u8 * aad,
 	register unsigned long r4 __asm__("4") = (unsigned long)aad;
 	register unsigned long r5 __asm__("5") = (unsigned long)aadlen;
 	register unsigned long r6 __asm__("6") = (unsigned long)out;
+	unsigned long partial = 0;
 	u8 cc;
 
         __asm__ volatile(
                 "0:     .insn   rrf,%[opc]<<16,%[out],%[in],%[aad],0\n"
-                "       brc     1,0b\n"     /* partial completion */
-                "       ipm     %[cc]\n"
+                "       brc     14,1f\n"
+                "       aghi    %[partial],1\n"     /* partial completion */
+                "       j       0b\n"
+                "1:     ipm     %[cc]\n"
                 "       srl     %[cc],28\n"
                 : [out] "+a" (r6), [cc] "=d" (cc),
                     [in] "+a" (r2), [inlen] "+d" (r3),
-                    [aad] "+a" (r4), [aadlen] "+d" (r5)
+                    [aad] "+a" (r4), [aadlen] "+d" (r5),
+                    [partial] "+d" (partial)
                 : [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb929)
                 : "cc", "memory"
         );
         /* *INDENT-ON* */
 
+	stats_cpacf(partial, cc == 1);
 	return cc;
 }
+# else
+static inline int
+cpacf_kma(unsigned long fc, void *param, u8 * out, const u8 * aad,
+    unsigned long aadlen, const u8 * in, unsigned long inlen)
+{
+	unsigned long partial = 0;
+	int cc;
+
+	cpacf_soft_wk_pin();
+	while ((cc = cpacf_soft_kma(fc, param, &out, &aad, &aadlen, &in,
+	    &inlen)) == 3)
+		partial++;	/* partial completion */
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(partial, cc == 1);
+	return cc;
+}
+# endif
 
 /* KDSA */
 
@@ -391,6 +579,25 @@ typedef struct cpacf_ed448_verify_param {
 	unsigned char pub[64];
 } cpacf_ed448_verify_param_t;
 
+/*
+ * KDSA sign functions fail on a WKaVP mismatch, verify functions
+ * on an invalid signature.
+ */
+static inline int
+cpacf_kdsa_is_sign(unsigned long func)
+{
+	switch (func & ~CPACF_M) {
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P256:
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P384:
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P521:
+	case CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED25519:
+	case CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED448:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 /**
  * cpacf_kdsa:
  * @func: the function code passed to KDSA; see s390_kdsa_functions
@@ -405,6 +612,7 @@ typedef struct cpacf_ed448_verify_param {
  * invertible. Fails in case of verify if the signature is invalid or the
  * public key is not on the curve.
  */
+# ifndef ZPC_SOFT_CPACF
 static inline int
 cpacf_kdsa(unsigned long func, void *param,
 			const unsigned char *src, unsigned long srclen)
@@ -413,20 +621,89 @@ cpacf_kdsa(unsigned long func, void *param,
     register unsigned long r1 __asm__("1") = (unsigned long)param;
     register unsigned long r2 __asm__("2") = (unsigned long)src;
     register unsigned long r3 __asm__("3") = (unsigned long)srclen;
-    unsigned long rc = 1;
+    unsigned long rc = 1, partial = 0;
 
     __asm__ volatile(
         "0: .insn   rre,%[__opc] << 16,0,%[__src]\n"
-        "   brc 1,0b\n" /* handle partial completion */
-        "   brc 7,1f\n"
+        "   brc 14,1f\n"
+        "   aghi    %[__partial],1\n" /* handle partial completion */
+        "   j   0b\n"
+        "1: brc 7,2f\n"
         "   lghi    %[__rc],0\n"
-        "1:\n"
-        : [__src] "+a" (r2), [__srclen] "+d" (r3), [__rc] "+d" (rc)
+        "2:\n"
+        : [__src] "+a" (r2), [__srclen] "+d" (r3), [__rc] "+d" (rc),
+          [__partial] "+d" (partial)
         : [__fc] "d" (r0), [__param] "a" (r1), [__opc] "i" (0xb93a)
         : "cc", "memory");
 
+    stats_cpacf(partial, rc != 0 && cpacf_kdsa_is_sign(func));
     return (int)rc;
 }
+# else
+static inline int
+cpacf_kdsa(unsigned long func, void *param,
+			const unsigned char *src, unsigned long srclen)
+{
+	int rc;
+
+	cpacf_soft_wk_pin();
+	rc = cpacf_soft_kdsa(func, param, &src, &srclen) == 0 ? 0 : 1;
+	cpacf_soft_wk_unpin();
+
+	stats_cpacf(0, rc != 0 && cpacf_kdsa_is_sign(func));
+	return rc;
+}
+# endif
+
+/* KIMD */
+
+/* Function codes */
+#define CPACF_KIMD_QUERY                              0
+#define CPACF_KIMD_SHA_256                            2
+#define CPACF_KIMD_SHA_512                            3
+
+/*
+ * The parameter block is the chaining value h, i.e. a struct
+ * cpacf_klmd_param can be passed. src_len must be a multiple of the
+ * block size.
+ */
+# ifndef ZPC_SOFT_CPACF
+static inline int cpacf_kimd(unsigned long func, void *param,
+		const unsigned char *src, long src_len)
+{
+	register long __func __asm__("0") = func;
+	register void *__param __asm__("1") = param;
+	register const unsigned char *__src __asm__("2") = src;
+	register long __src_len __asm__("3") = src_len;
+	unsigned long partial = 0;
+
+	__asm__ volatile (
+		"0:	.insn	rre,0xb93e0000,%0,%0 \n" /* KIMD opcode */
+		"	brc	14,1f \n"
+		"	aghi	%2,1 \n"	/* handle partial completion */
+		"	j	0b \n"
+		"1: \n"
+		: "+a"(__src), "+d"(__src_len), "+d"(partial)
+		: "d"(__func), "a"(__param)
+		: "cc", "memory");
+
+	stats_cpacf(partial, 0);
+	return func ? src_len - __src_len : __src_len;
+}
+# else
+static inline int cpacf_kimd(unsigned long func, void *param,
+		const unsigned char *src, long src_len)
+{
+	unsigned long partial = 0;
+	long len = src_len;
+
+	while (cpacf_soft_kimd(func, param, &src, &len) == 3)
+		partial++;	/* handle partial completion */
+
+	stats_cpacf(partial, 0);
+	return func ? src_len - len : len;
+}
+# endif
 
 /* KLMD */
 
@@ -449,6 +726,7 @@ struct cpacf_klmd_param {
 	};
 };
 
+# ifndef ZPC_SOFT_CPACF
 static inline int cpacf_klmd(unsigned long func, void *param,
 		const unsigned char *src, long src_len)
 {
@@ -456,17 +734,92 @@ static inline int cpacf_klmd(unsigned long func, void *param,
 	register void *__param __asm__("1") = param;
 	register const unsigned char *__src __asm__("2") = src;
 	register long __src_len __asm__("3") = src_len;
+	unsigned long partial = 0;
 
 	__asm__ volatile (
 		"0:	.insn	rre,0xb93f0000,%0,%0 \n" /* KLMD opcode */
-		"	brc	1,0b \n"	/* handle partial completion */
-		: "+a"(__src), "+d"(__src_len)
+		"	brc	14,1f \n"
+		"	aghi	%2,1 \n"	/* handle partial completion */
+		"	j	0b \n"
+		"1: \n"
+		: "+a"(__src), "+d"(__src_len), "+d"(partial)
 		: "d"(__func), "a"(__param)
 		: "cc", "memory");
 
+	stats_cpacf(partial, 0);
 	return func ? src_len - __src_len : __src_len;
 }
+# else
+static inline int cpacf_klmd(unsigned long func, void *param,
+		const unsigned char *src, long src_len)
+{
+	unsigned long partial = 0;
+	long len = src_len;
 
+	while (cpacf_soft_klmd(func, param, &src, &len) == 3)
+		partial++;	/* handle partial completion */
+
+	stats_cpacf(partial, 0);
+	return func ? src_len - len : len;
+}
+# endif
+
+/* PRNO */
+
+/* Function codes */
+# define CPACF_PRNO_QUERY                0
+# define CPACF_PRNO_TRNG               114
+
+# ifndef ZPC_SOFT_CPACF
+static inline int
+cpacf_prno(unsigned long fc, void *param, u8 * out1, unsigned long out1len,
+    u8 * out2, unsigned long out2len)
+{
+        /* *INDENT-OFF* */
+	register unsigned long r0 __asm__("0") = (unsigned long) fc;
+	register unsigned long r1 __asm__("1") = (unsigned long) param;
+	register unsigned long r2 __asm__("2") = (unsigned long) out1;
+	register unsigned long r3 __asm__("3") = (unsigned long) out1len;
+	register unsigned long r4 __asm__("4") = (unsigned long) out2;
+	register unsigned long r5 __asm__("5") = (unsigned long) out2len;
+	unsigned long partial = 0;
+	u8 cc;
+
+	__asm__ volatile(
+		"0:	.insn	rre,%[opc] << 16,%[out1],%[out2]\n"
+		"	brc	14,1f\n"
+		"	aghi	%[partial],1\n" /* handle partial completion */
+		"	j	0b\n"
+                "1:     ipm     %[cc]\n"
+                "       srl     %[cc],28\n"
+		: [out1] "+a" (r2), [out1len] "+d" (r3), [out2] "+a" (r4),
+		  [out2len] "+d" (r5), [cc] "=d" (cc), [partial] "+d" (partial)
+		: [fc] "d" (r0), [param] "a" (r1), [opc] "i" (0xb93c)
+		: "cc", "memory"
+	);
+        /* *INDENT-ON* */
+
+	stats_cpacf(partial, 0);
+	return cc;
+}
+# else
+static inline int
+cpacf_prno(unsigned long fc, void *param, u8 * out1, unsigned long out1len,
+    u8 * out2, unsigned long out2len)
+{
+	unsigned long partial = 0;
+	int cc;
+
+	while ((cc = cpacf_soft_prno(fc, param, &out1, &out1len, &out2,
+	    &out2len)) == 3)
+		partial++;	/* handle partial completion */
+
+	stats_cpacf(partial, 0);
+	return cc;
+}
+# endif
+
+# ifndef ZPC_SOFT_CPACF
 static inline void s390_flip_endian_32(void *dest, const void *src)
 {
 	__asm__ volatile(
@@ -507,4 +860,25 @@ static inline void s390_flip_endian_64(void *dest, const void *src)
 		: "memory", "%r0", "%r1", "%r4", "%r5",
 			"%r6", "%r7", "%r8", "%r9");
 }
+# else
+static inline void s390_flip_endian_32(void *dest, const void *src)
+{
+	u8 tmp[32];
+	int i;
+
+	for (i = 0; i < 32; i++)
+		tmp[i] = ((const u8 *)src)[31 - i];
+	memcpy(dest, tmp, sizeof(tmp));
+}
+
+static inline void s390_flip_endian_64(void *dest, const void *src)
+{
+	u8 tmp[64];
+	int i;
+
+	for (i = 0; i < 64; i++)
+		tmp[i] = ((const u8 *)src)[63 - i];
+	memcpy(dest, tmp, sizeof(tmp));
+}
+# endif
 #endif
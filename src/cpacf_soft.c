@@ -0,0 +1,2426 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Software CPACF backend, see cpacf_soft.h.
+ *
+ * The AES, GHASH and XTS paths use AES-NI, VAES and PCLMULQDQ when the
+ * host supports them (x86-64) and fall back to portable C otherwise.
+ * Setting the environment variable ZPC_SOFT_CPACF_PORTABLE=1 forces the
+ * portable code paths.
+ */
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "cpacf.h"
+#include "cpacf_soft.h"
+#include "misc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+
+#if defined(__x86_64__)
+# include <immintrin.h>
+# define SOFT_X86	1
+#endif
+
+#define ENV_PORTABLE	"ZPC_SOFT_CPACF_PORTABLE"
+
+/* Map a facility bit number or function code to its bit mask/offset. */
+#define MASK64(n)	(1ULL << (63 - (n) % 64))
+#define OFF64(n)	((n) / 64)
+
+/* Function code without modifier and flag bits. */
+#define FC(fc)		((fc) & 0x7f)
+
+/*
+ * CPU-determined amount of data processed by one instance of an
+ * instruction before it ends with partial completion (cc 3).
+ */
+#define CPU_DETERMINED	(64 * 1024)
+
+/* Facility bits reported by the emulated STFLE. */
+#define MSA    17
+#define MSA3   76
+#define MSA4   77
+#define MSA5   57
+#define MSA8  146
+#define MSA9  155
+
+struct wk {
+	u8 mask[CPACF_SOFT_MAX_KEYLEN];
+	u8 wkvp[CPACF_SOFT_WKVPLEN];
+	u64 gen;		/* unique per WK, 0 is never used */
+	unsigned long users;	/* see wk_acquire */
+};
+
+struct aes_sched {
+	u8 rk[15 * 16] __attribute__((aligned(16)));
+	u8 drk[15 * 16] __attribute__((aligned(16)));	/* AES-NI only */
+	int nr;
+};
+
+struct keycache_ent {
+	u64 gen;
+	size_t off;
+	size_t keylen;
+	u8 wkakey[32];
+	struct aes_sched sched;
+};
+
+#define KEYCACHE_NMEMB	4
+
+/* Current and previous WK. */
+#define WK_NMEMB	2
+
+static pthread_once_t soft_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t wklock = PTHREAD_MUTEX_INITIALIZER;
+static struct wk wk_slot[WK_NMEMB];
+static struct wk *wk_cur;
+static u64 wk_gen;
+
+static int have_aesni;
+static int have_pclmul;
+static int have_vaes;
+
+static __thread const struct wk *wk_pinned;
+static __thread struct keycache_ent keycache[KEYCACHE_NMEMB];
+static __thread unsigned int keycache_next;
+
+static void sha256_blocks(u32 h[8], const u8 * in, size_t nblocks);
+static void sha512_blocks(u64 h[8], const u8 * in, size_t nblocks);
+
+/*
+ * Byte order helpers. Parameter-block fields that the hardware defines as
+ * big-endian are stored byte-wise. Fields that libzpc accumulates in
+ * registers (lengths) are native integers.
+ */
+
+static inline u32
+ld_be32(const u8 * p)
+{
+	return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+}
+
+static inline void
+st_be32(u8 * p, u32 v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline u64
+ld_be64(const u8 * p)
+{
+	return ((u64)ld_be32(p) << 32) | ld_be32(p + 4);
+}
+
+static inline void
+st_be64(u8 * p, u64 v)
+{
+	st_be32(p, v >> 32);
+	st_be32(p + 4, (u32)v);
+}
+
+static inline u64
+ld_le64(const u8 * p)
+{
+	u64 v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static inline void
+st_le64(u8 * p, u64 v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		p[i] = (u8)v;
+}
+
+static inline void
+xor16(u8 * out, const u8 * a, const u8 * b)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		out[i] = a[i] ^ b[i];
+}
+
+/* A specification exception terminates the program on the real machine. */
+static void
+specification_exception(void)
+{
+	abort();
+}
+
+/*
+ * Wrapping key
+ */
+
+static void
+wk_new(struct wk *wk)
+{
+	u8 seed[32], buf[128];
+	u64 h[8];
+	u32 h32[8];
+	size_t i, off;
+	ssize_t n;
+
+	for (off = 0; off < sizeof(seed); off += n) {
+		n = getrandom(seed + off, sizeof(seed) - off, 0);
+		if (n <= 0)
+			abort();
+	}
+
+	/* mask = SHA-512 compressions over (seed | counter). */
+	for (i = 0; i < sizeof(wk->mask) / 64; i++) {
+		static const u64 iv[8] = {
+			0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+			0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+			0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+			0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+		};
+		size_t j;
+
+		memcpy(h, iv, sizeof(h));
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, seed, sizeof(seed));
+		buf[sizeof(seed)] = (u8)i;
+		sha512_blocks(h, buf, 1);
+		for (j = 0; j < 8; j++)
+			st_be64(wk->mask + i * 64 + j * 8, h[j]);
+	}
+
+	/* WKaVP = SHA-256 compression over (seed | 'V'). */
+	{
+		static const u32 iv[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+			0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+		};
+
+		memcpy(h32, iv, sizeof(h32));
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, seed, sizeof(seed));
+		buf[sizeof(seed)] = 'V';
+		sha256_blocks(h32, buf, 1);
+		for (i = 0; i < 8; i++)
+			st_be32(wk->wkvp + i * 4, h32[i]);
+	}
+
+	memzero_secure(seed, sizeof(seed));
+	memzero_secure(buf, sizeof(buf));
+	wk->gen = ++wk_gen;
+}
+
+/*
+ * Returns the current WK. It is not recycled by cpacf_soft_wk_rotate
+ * before the matching wk_release.
+ */
+static const struct wk *
+wk_acquire(void)
+{
+	struct wk *wk;
+
+	for (;;) {
+		wk = __atomic_load_n(&wk_cur, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&wk->users, 1, __ATOMIC_SEQ_CST);
+		/* Still current: a concurrent rotation waits for us. */
+		if (__atomic_load_n(&wk_cur, __ATOMIC_SEQ_CST) == wk)
+			return wk;
+		__atomic_sub_fetch(&wk->users, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static inline void
+wk_release(const struct wk *wk)
+{
+	__atomic_sub_fetch(&((struct wk *)wk)->users, 1, __ATOMIC_RELEASE);
+}
+
+static void
+soft_init(void)
+{
+	const char *env;
+	int portable = 0;
+
+	env = getenv(ENV_PORTABLE);
+	if (env != NULL && env[0] != '\0' && env[0] != '0')
+		portable = 1;
+
+#ifdef SOFT_X86
+	__builtin_cpu_init();
+	if (!portable) {
+		have_aesni = __builtin_cpu_supports("aes")
+		    && __builtin_cpu_supports("sse4.1");
+		have_pclmul = __builtin_cpu_supports("pclmul")
+		    && __builtin_cpu_supports("ssse3");
+		have_vaes = have_aesni && __builtin_cpu_supports("vaes")
+		    && __builtin_cpu_supports("avx512f");
+	}
+#else
+	UNUSED(portable);
+#endif
+
+	wk_new(&wk_slot[0]);
+	__atomic_store_n(&wk_cur, &wk_slot[0], __ATOMIC_SEQ_CST);
+}
+
+static inline void
+soft_check_init(void)
+{
+	int rc;
+
+	rc = pthread_once(&soft_once, soft_init);
+	assert(rc == 0);
+	UNUSED(rc);
+}
+
+void
+cpacf_soft_wrap(u8 * wkakey, u8 wkvp[32], const u8 * key, size_t keylen)
+{
+	const struct wk *wk;
+	size_t i;
+
+	assert(keylen <= CPACF_SOFT_MAX_KEYLEN);
+
+	soft_check_init();
+	wk = wk_acquire();
+
+	for (i = 0; i < keylen; i++)
+		wkakey[i] = key[i] ^ wk->mask[i];
+	memcpy(wkvp, wk->wkvp, CPACF_SOFT_WKVPLEN);
+	wk_release(wk);
+}
+
+void
+cpacf_soft_wk_rotate(void)
+{
+	struct wk *wk;
+	int rc;
+
+	soft_check_init();
+
+	rc = pthread_mutex_lock(&wklock);
+	assert(rc == 0);
+	/*
+	 * Recycle the previous WK's slot. Threads still using it are
+	 * within a single instruction, so this wait is short.
+	 */
+	wk = wk_cur == &wk_slot[0] ? &wk_slot[1] : &wk_slot[0];
+	while (__atomic_load_n(&wk->users, __ATOMIC_SEQ_CST) != 0)
+		sched_yield();
+	wk_new(wk);
+	__atomic_store_n(&wk_cur, wk, __ATOMIC_SEQ_CST);
+	rc = pthread_mutex_unlock(&wklock);
+	assert(rc == 0);
+	UNUSED(rc);
+}
+
+void
+cpacf_soft_wk_pin(void)
+{
+	soft_check_init();
+	wk_pinned = wk_acquire();
+}
+
+void
+cpacf_soft_wk_unpin(void)
+{
+	wk_release(wk_pinned);
+	wk_pinned = NULL;
+}
+
+__attribute__((destructor))
+static void
+cpacf_soft_fini(void)
+{
+	wk_cur = NULL;
+	memzero_secure(wk_slot, sizeof(wk_slot));
+}
+
+/*
+ * Returns the thread's pinned WK if wkvp matches its WKaVP, NULL
+ * otherwise.
+ */
+static const struct wk *
+wk_verify(const u8 * wkvp)
+{
+	const struct wk *wk = wk_pinned;
+
+	assert(wk != NULL);
+
+	if (memcmp(wk->wkvp, wkvp, CPACF_SOFT_WKVPLEN) != 0)
+		return NULL;
+	return wk;
+}
+
+static void
+wk_unwrap(const struct wk *wk, u8 * key, const u8 * wkakey, size_t off,
+    size_t keylen)
+{
+	size_t i;
+
+	for (i = 0; i < keylen; i++)
+		key[i] = wkakey[i] ^ wk->mask[off + i];
+}
+
+/*
+ * SHA-2
+ */
+
+static const u32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const u64 sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+	0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+	0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+	0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+	0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+	0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+	0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+	0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+	0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+	0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+	0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+	0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+	0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+	0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static const u32 sha224_icv[8] = {
+	0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+	0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+};
+
+static const u32 sha256_icv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const u64 sha384_icv[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL,
+	0x152fecd8f70e5939ULL, 0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+	0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+};
+
+static const u64 sha512_icv[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+	0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+
+static void
+sha256_blocks(u32 h[8], const u8 * in, size_t nblocks)
+{
+	u32 w[64], a, b, c, d, e, f, g, hh, t1, t2;
+	size_t i;
+
+	for (; nblocks > 0; nblocks--, in += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = ld_be32(in + 4 * i);
+		for (i = 16; i < 64; i++) {
+			u32 s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18)
+			    ^ (w[i - 15] >> 3);
+			u32 s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19)
+			    ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		a = h[0], b = h[1], c = h[2], d = h[3];
+		e = h[4], f = h[5], g = h[6], hh = h[7];
+		for (i = 0; i < 64; i++) {
+			t1 = hh + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+			    + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))
+			    + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g, g = f, f = e, e = d + t1;
+			d = c, c = b, b = a, a = t1 + t2;
+		}
+		h[0] += a, h[1] += b, h[2] += c, h[3] += d;
+		h[4] += e, h[5] += f, h[6] += g, h[7] += hh;
+	}
+}
+
+static void
+sha512_blocks(u64 h[8], const u8 * in, size_t nblocks)
+{
+	u64 w[80], a, b, c, d, e, f, g, hh, t1, t2;
+	size_t i;
+
+	for (; nblocks > 0; nblocks--, in += 128) {
+		for (i = 0; i < 16; i++)
+			w[i] = ld_be64(in + 8 * i);
+		for (i = 16; i < 80; i++) {
+			u64 s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8)
+			    ^ (w[i - 15] >> 7);
+			u64 s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61)
+			    ^ (w[i - 2] >> 6);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		a = h[0], b = h[1], c = h[2], d = h[3];
+		e = h[4], f = h[5], g = h[6], hh = h[7];
+		for (i = 0; i < 80; i++) {
+			t1 = hh + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41))
+			    + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+			t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39))
+			    + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g, g = f, f = e, e = d + t1;
+			d = c, c = b, b = a, a = t1 + t2;
+		}
+		h[0] += a, h[1] += b, h[2] += c, h[3] += d;
+		h[4] += e, h[5] += f, h[6] += g, h[7] += hh;
+	}
+}
+
+/*
+ * Generic SHA-2 state: 32-bit words for SHA-224/256, 64-bit words for
+ * SHA-384/512.
+ */
+struct sha2 {
+	int wide;		/* SHA-384/512 */
+	size_t blksize;
+	union {
+		u32 h32[8];
+		u64 h64[8];
+	};
+};
+
+static void
+sha2_init(struct sha2 *s, int wide, const void *icv)
+{
+	s->wide = wide;
+	s->blksize = wide ? 128 : 64;
+	if (wide)
+		memcpy(s->h64, icv, sizeof(s->h64));
+	else
+		memcpy(s->h32, icv, sizeof(s->h32));
+}
+
+static void
+sha2_blocks(struct sha2 *s, const u8 * in, size_t nblocks)
+{
+	if (s->wide)
+		sha512_blocks(s->h64, in, nblocks);
+	else
+		sha256_blocks(s->h32, in, nblocks);
+}
+
+/* Load/store the chaining value from/to a big-endian byte field. */
+static void
+sha2_load(struct sha2 *s, const u8 * h)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (s->wide)
+			s->h64[i] = ld_be64(h + 8 * i);
+		else
+			s->h32[i] = ld_be32(h + 4 * i);
+	}
+}
+
+static void
+sha2_store(const struct sha2 *s, u8 * h)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (s->wide)
+			st_be64(h + 8 * i, s->h64[i]);
+		else
+			st_be32(h + 4 * i, s->h32[i]);
+	}
+}
+
+/*
+ * Process the last (partial, < blksize) message piece with padding.
+ * bitlen is the total message bit-length.
+ */
+static void
+sha2_final(struct sha2 *s, const u8 * in, size_t inlen, u128 bitlen)
+{
+	u8 buf[256];
+	size_t lenlen = s->wide ? 16 : 8, n, i;
+
+	assert(inlen < s->blksize);
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, in, inlen);
+	buf[inlen] = 0x80;
+
+	n = (inlen + 1 + lenlen <= s->blksize) ? s->blksize : 2 * s->blksize;
+	for (i = 0; i < lenlen; i++)
+		buf[n - 1 - i] = (u8)(bitlen >> (8 * i));
+
+	sha2_blocks(s, buf, n / s->blksize);
+	memzero_secure(buf, sizeof(buf));
+}
+
+/*
+ * AES, portable
+ */
+
+static const u8 sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+	0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+	0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+	0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+	0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+	0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+	0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+	0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+	0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+	0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+	0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+	0xb0, 0x54, 0xbb, 0x16,
+};
+
+static u8 inv_sbox[256];
+
+static inline u8
+xtime(u8 x)
+{
+	return (u8)((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+static inline u8
+gmul(u8 a, u8 b)
+{
+	u8 p = 0;
+
+	while (b) {
+		if (b & 1)
+			p ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+	return p;
+}
+
+static void
+aes_expand_portable(struct aes_sched *s, const u8 * key, size_t keylen)
+{
+	size_t nk = keylen / 4, i;
+	u8 rcon = 1, t[4], tmp;
+
+	s->nr = (int)nk + 6;
+	memcpy(s->rk, key, keylen);
+
+	for (i = nk; i < 4 * ((size_t)s->nr + 1); i++) {
+		memcpy(t, s->rk + 4 * (i - 1), 4);
+		if (i % nk == 0) {
+			tmp = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[tmp];
+			rcon = xtime(rcon);
+		} else if (nk > 6 && i % nk == 4) {
+			t[0] = sbox[t[0]];
+			t[1] = sbox[t[1]];
+			t[2] = sbox[t[2]];
+			t[3] = sbox[t[3]];
+		}
+		s->rk[4 * i + 0] = s->rk[4 * (i - nk) + 0] ^ t[0];
+		s->rk[4 * i + 1] = s->rk[4 * (i - nk) + 1] ^ t[1];
+		s->rk[4 * i + 2] = s->rk[4 * (i - nk) + 2] ^ t[2];
+		s->rk[4 * i + 3] = s->rk[4 * (i - nk) + 3] ^ t[3];
+	}
+}
+
+static void
+aes_enc1_portable(const struct aes_sched *s, u8 out[16], const u8 in[16])
+{
+	u8 st[16], tmp[16];
+	int r, c;
+
+	xor16(st, in, s->rk);
+	for (r = 1; r <= s->nr; r++) {
+		/* SubBytes and ShiftRows */
+		for (c = 0; c < 4; c++) {
+			tmp[4 * c + 0] = sbox[st[4 * c + 0]];
+			tmp[4 * c + 1] = sbox[st[4 * ((c + 1) % 4) + 1]];
+			tmp[4 * c + 2] = sbox[st[4 * ((c + 2) % 4) + 2]];
+			tmp[4 * c + 3] = sbox[st[4 * ((c + 3) % 4) + 3]];
+		}
+		/* MixColumns */
+		if (r != s->nr) {
+			for (c = 0; c < 4; c++) {
+				u8 a0 = tmp[4 * c], a1 = tmp[4 * c + 1];
+				u8 a2 = tmp[4 * c + 2], a3 = tmp[4 * c + 3];
+				u8 x = a0 ^ a1 ^ a2 ^ a3;
+
+				tmp[4 * c + 0] ^= x ^ xtime(a0 ^ a1);
+				tmp[4 * c + 1] ^= x ^ xtime(a1 ^ a2);
+				tmp[4 * c + 2] ^= x ^ xtime(a2 ^ a3);
+				tmp[4 * c + 3] ^= x ^ xtime(a3 ^ a0);
+			}
+		}
+		xor16(st, tmp, s->rk + 16 * r);
+	}
+	memcpy(out, st, 16);
+}
+
+static void
+aes_dec1_portable(const struct aes_sched *s, u8 out[16], const u8 in[16])
+{
+	u8 st[16], tmp[16];
+	int r, c;
+
+	xor16(st, in, s->rk + 16 * s->nr);
+	for (r = s->nr - 1; r >= 0; r--) {
+		/* InvShiftRows and InvSubBytes */
+		for (c = 0; c < 4; c++) {
+			tmp[4 * c + 0] = inv_sbox[st[4 * c + 0]];
+			tmp[4 * c + 1] = inv_sbox[st[4 * ((c + 3) % 4) + 1]];
+			tmp[4 * c + 2] = inv_sbox[st[4 * ((c + 2) % 4) + 2]];
+			tmp[4 * c + 3] = inv_sbox[st[4 * ((c + 1) % 4) + 3]];
+		}
+		xor16(st, tmp, s->rk + 16 * r);
+		/* InvMixColumns */
+		if (r != 0) {
+			for (c = 0; c < 4; c++) {
+				u8 a0 = st[4 * c], a1 = st[4 * c + 1];
+				u8 a2 = st[4 * c + 2], a3 = st[4 * c + 3];
+
+				st[4 * c + 0] = gmul(a0, 14) ^ gmul(a1, 11)
+				    ^ gmul(a2, 13) ^ gmul(a3, 9);
+				st[4 * c + 1] = gmul(a0, 9) ^ gmul(a1, 14)
+				    ^ gmul(a2, 11) ^ gmul(a3, 13);
+				st[4 * c + 2] = gmul(a0, 13) ^ gmul(a1, 9)
+				    ^ gmul(a2, 14) ^ gmul(a3, 11);
+				st[4 * c + 3] = gmul(a0, 11) ^ gmul(a1, 13)
+				    ^ gmul(a2, 9) ^ gmul(a3, 14);
+			}
+		}
+	}
+	memcpy(out, st, 16);
+}
+
+/*
+ * AES, AES-NI and VAES
+ */
+
+#ifdef SOFT_X86
+
+# define TARGET_AESNI	__attribute__((target("aes,sse4.1")))
+# define TARGET_VAES	__attribute__((target("vaes,avx512f,aes,sse4.1")))
+# define TARGET_PCLMUL	__attribute__((target("pclmul,ssse3")))
+
+TARGET_AESNI
+static void
+aes_expand_dec_aesni(struct aes_sched *s)
+{
+	const __m128i *rk = (const __m128i *)s->rk;
+	__m128i *drk = (__m128i *) s->drk;
+	int i;
+
+	drk[0] = rk[s->nr];
+	for (i = 1; i < s->nr; i++)
+		drk[i] = _mm_aesimc_si128(rk[s->nr - i]);
+	drk[s->nr] = rk[0];
+}
+
+TARGET_AESNI
+static inline __m128i
+aes_enc_aesni(const struct aes_sched *s, __m128i x)
+{
+	const __m128i *rk = (const __m128i *)s->rk;
+	int i;
+
+	x = _mm_xor_si128(x, rk[0]);
+	for (i = 1; i < s->nr; i++)
+		x = _mm_aesenc_si128(x, rk[i]);
+	return _mm_aesenclast_si128(x, rk[s->nr]);
+}
+
+TARGET_AESNI
+static inline __m128i
+aes_dec_aesni(const struct aes_sched *s, __m128i x)
+{
+	const __m128i *drk = (const __m128i *)s->drk;
+	int i;
+
+	x = _mm_xor_si128(x, drk[0]);
+	for (i = 1; i < s->nr; i++)
+		x = _mm_aesdec_si128(x, drk[i]);
+	return _mm_aesdeclast_si128(x, drk[s->nr]);
+}
+
+/* 8 blocks in parallel to hide the AES-NI latency. */
+# define AESNI_8(op, oplast, rks, x)					\
+do {									\
+	int __i, __j;							\
+									\
+	for (__j = 0; __j < 8; __j++)					\
+		(x)[__j] = _mm_xor_si128((x)[__j], (rks)[0]);		\
+	for (__i = 1; __i < s->nr; __i++)				\
+		for (__j = 0; __j < 8; __j++)				\
+			(x)[__j] = op((x)[__j], (rks)[__i]);		\
+	for (__j = 0; __j < 8; __j++)					\
+		(x)[__j] = oplast((x)[__j], (rks)[s->nr]);		\
+} while (0)
+
+TARGET_AESNI
+static size_t
+aes_ecb_aesni(const struct aes_sched *s, u8 * out, const u8 * in,
+    size_t nblocks, int dec)
+{
+	const __m128i *rks = (const __m128i *)(dec ? s->drk : s->rk);
+	__m128i x[8];
+	size_t n = 0;
+	int j;
+
+	for (; n + 8 <= nblocks; n += 8) {
+		for (j = 0; j < 8; j++)
+			x[j] = _mm_loadu_si128((const __m128i *)(in + 16 * (n + j)));
+		if (dec)
+			AESNI_8(_mm_aesdec_si128, _mm_aesdeclast_si128, rks, x);
+		else
+			AESNI_8(_mm_aesenc_si128, _mm_aesenclast_si128, rks, x);
+		for (j = 0; j < 8; j++)
+			_mm_storeu_si128((__m128i *) (out + 16 * (n + j)), x[j]);
+	}
+	for (; n < nblocks; n++) {
+		x[0] = _mm_loadu_si128((const __m128i *)(in + 16 * n));
+		x[0] = dec ? aes_dec_aesni(s, x[0]) : aes_enc_aesni(s, x[0]);
+		_mm_storeu_si128((__m128i *) (out + 16 * n), x[0]);
+	}
+	return nblocks;
+}
+
+/* 16 blocks (4 x 512 bit) per iteration. Returns the blocks processed. */
+TARGET_VAES
+static size_t
+aes_ecb_vaes(const struct aes_sched *s, u8 * out, const u8 * in,
+    size_t nblocks, int dec)
+{
+	const __m128i *rks = (const __m128i *)(dec ? s->drk : s->rk);
+	__m512i k[15], x0, x1, x2, x3;
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i <= s->nr; i++)
+		k[i] = _mm512_broadcast_i32x4(rks[i]);
+
+	for (; n + 16 <= nblocks; n += 16) {
+		x0 = _mm512_loadu_si512((const void *)(in + 16 * n));
+		x1 = _mm512_loadu_si512((const void *)(in + 16 * n + 64));
+		x2 = _mm512_loadu_si512((const void *)(in + 16 * n + 128));
+		x3 = _mm512_loadu_si512((const void *)(in + 16 * n + 192));
+		x0 = _mm512_xor_si512(x0, k[0]);
+		x1 = _mm512_xor_si512(x1, k[0]);
+		x2 = _mm512_xor_si512(x2, k[0]);
+		x3 = _mm512_xor_si512(x3, k[0]);
+		if (dec) {
+			for (i = 1; i < s->nr; i++) {
+				x0 = _mm512_aesdec_epi128(x0, k[i]);
+				x1 = _mm512_aesdec_epi128(x1, k[i]);
+				x2 = _mm512_aesdec_epi128(x2, k[i]);
+				x3 = _mm512_aesdec_epi128(x3, k[i]);
+			}
+			x0 = _mm512_aesdeclast_epi128(x0, k[s->nr]);
+			x1 = _mm512_aesdeclast_epi128(x1, k[s->nr]);
+			x2 = _mm512_aesdeclast_epi128(x2, k[s->nr]);
+			x3 = _mm512_aesdeclast_epi128(x3, k[s->nr]);
+		} else {
+			for (i = 1; i < s->nr; i++) {
+				x0 = _mm512_aesenc_epi128(x0, k[i]);
+				x1 = _mm512_aesenc_epi128(x1, k[i]);
+				x2 = _mm512_aesenc_epi128(x2, k[i]);
+				x3 = _mm512_aesenc_epi128(x3, k[i]);
+			}
+			x0 = _mm512_aesenclast_epi128(x0, k[s->nr]);
+			x1 = _mm512_aesenclast_epi128(x1, k[s->nr]);
+			x2 = _mm512_aesenclast_epi128(x2, k[s->nr]);
+			x3 = _mm512_aesenclast_epi128(x3, k[s->nr]);
+		}
+		_mm512_storeu_si512((void *)(out + 16 * n), x0);
+		_mm512_storeu_si512((void *)(out + 16 * n + 64), x1);
+		_mm512_storeu_si512((void *)(out + 16 * n + 128), x2);
+		_mm512_storeu_si512((void *)(out + 16 * n + 192), x3);
+	}
+	return n;
+}
+
+TARGET_AESNI
+static void
+aes_cbc_enc_aesni(const struct aes_sched *s, u8 iv[16], u8 * out,
+    const u8 * in, size_t nblocks)
+{
+	__m128i cv = _mm_loadu_si128((const __m128i *)iv);
+	size_t n;
+
+	for (n = 0; n < nblocks; n++) {
+		cv = _mm_xor_si128(cv,
+		    _mm_loadu_si128((const __m128i *)(in + 16 * n)));
+		cv = aes_enc_aesni(s, cv);
+		_mm_storeu_si128((__m128i *) (out + 16 * n), cv);
+	}
+	_mm_storeu_si128((__m128i *) iv, cv);
+}
+
+TARGET_AESNI
+static void
+aes_cbc_dec_aesni(const struct aes_sched *s, u8 iv[16], u8 * out,
+    const u8 * in, size_t nblocks)
+{
+	const __m128i *drk = (const __m128i *)s->drk;
+	__m128i cv = _mm_loadu_si128((const __m128i *)iv), c[8], x[8];
+	size_t n = 0;
+	int j;
+
+	for (; n + 8 <= nblocks; n += 8) {
+		/* Load all ciphertext first: in and out may overlap. */
+		for (j = 0; j < 8; j++) {
+			c[j] = _mm_loadu_si128((const __m128i *)(in + 16 * (n + j)));
+			x[j] = c[j];
+		}
+		AESNI_8(_mm_aesdec_si128, _mm_aesdeclast_si128, drk, x);
+		x[0] = _mm_xor_si128(x[0], cv);
+		for (j = 1; j < 8; j++)
+			x[j] = _mm_xor_si128(x[j], c[j - 1]);
+		cv = c[7];
+		for (j = 0; j < 8; j++)
+			_mm_storeu_si128((__m128i *) (out + 16 * (n + j)), x[j]);
+	}
+	for (; n < nblocks; n++) {
+		c[0] = _mm_loadu_si128((const __m128i *)(in + 16 * n));
+		x[0] = _mm_xor_si128(aes_dec_aesni(s, c[0]), cv);
+		cv = c[0];
+		_mm_storeu_si128((__m128i *) (out + 16 * n), x[0]);
+	}
+	_mm_storeu_si128((__m128i *) iv, cv);
+}
+
+TARGET_AESNI
+static size_t
+aes_ctr32_aesni(const struct aes_sched *s, const u8 j0[16], u32 * cv,
+    u8 * out, const u8 * in, size_t nblocks)
+{
+	const __m128i *rk = (const __m128i *)s->rk;
+	__m128i base = _mm_loadu_si128((const __m128i *)j0), x[8];
+	size_t n = 0;
+	int j;
+
+	for (; n + 8 <= nblocks; n += 8) {
+		for (j = 0; j < 8; j++)
+			x[j] = _mm_insert_epi32(base,
+			    (int)__builtin_bswap32(++*cv), 3);
+		AESNI_8(_mm_aesenc_si128, _mm_aesenclast_si128, rk, x);
+		for (j = 0; j < 8; j++)
+			_mm_storeu_si128((__m128i *) (out + 16 * (n + j)),
+			    _mm_xor_si128(x[j], _mm_loadu_si128((const __m128i *)
+			    (in + 16 * (n + j)))));
+	}
+	for (; n < nblocks; n++) {
+		x[0] = _mm_insert_epi32(base, (int)__builtin_bswap32(++*cv), 3);
+		x[0] = aes_enc_aesni(s, x[0]);
+		_mm_storeu_si128((__m128i *) (out + 16 * n),
+		    _mm_xor_si128(x[0], _mm_loadu_si128((const __m128i *)
+		    (in + 16 * n))));
+	}
+	return nblocks;
+}
+
+TARGET_VAES
+static size_t
+aes_ctr32_vaes(const struct aes_sched *s, const u8 j0[16], u32 * cv,
+    u8 * out, const u8 * in, size_t nblocks)
+{
+	const __m128i *rk = (const __m128i *)s->rk;
+	__m512i k[15], x0, x1, x2, x3;
+	u8 cb[16 * 16] __attribute__((aligned(64)));
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i <= s->nr; i++)
+		k[i] = _mm512_broadcast_i32x4(rk[i]);
+	for (i = 0; i < 16; i++)
+		memcpy(cb + 16 * i, j0, 12);
+
+	for (; n + 16 <= nblocks; n += 16) {
+		for (i = 0; i < 16; i++)
+			st_be32(cb + 16 * i + 12, ++*cv);
+		x0 = _mm512_xor_si512(_mm512_load_si512((const void *)cb), k[0]);
+		x1 = _mm512_xor_si512(_mm512_load_si512((const void *)(cb + 64)), k[0]);
+		x2 = _mm512_xor_si512(_mm512_load_si512((const void *)(cb + 128)), k[0]);
+		x3 = _mm512_xor_si512(_mm512_load_si512((const void *)(cb + 192)), k[0]);
+		for (i = 1; i < s->nr; i++) {
+			x0 = _mm512_aesenc_epi128(x0, k[i]);
+			x1 = _mm512_aesenc_epi128(x1, k[i]);
+			x2 = _mm512_aesenc_epi128(x2, k[i]);
+			x3 = _mm512_aesenc_epi128(x3, k[i]);
+		}
+		x0 = _mm512_aesenclast_epi128(x0, k[s->nr]);
+		x1 = _mm512_aesenclast_epi128(x1, k[s->nr]);
+		x2 = _mm512_aesenclast_epi128(x2, k[s->nr]);
+		x3 = _mm512_aesenclast_epi128(x3, k[s->nr]);
+		x0 = _mm512_xor_si512(x0, _mm512_loadu_si512((const void *)(in + 16 * n)));
+		x1 = _mm512_xor_si512(x1, _mm512_loadu_si512((const void *)(in + 16 * n + 64)));
+		x2 = _mm512_xor_si512(x2, _mm512_loadu_si512((const void *)(in + 16 * n + 128)));
+		x3 = _mm512_xor_si512(x3, _mm512_loadu_si512((const void *)(in + 16 * n + 192)));
+		_mm512_storeu_si512((void *)(out + 16 * n), x0);
+		_mm512_storeu_si512((void *)(out + 16 * n + 64), x1);
+		_mm512_storeu_si512((void *)(out + 16 * n + 128), x2);
+		_mm512_storeu_si512((void *)(out + 16 * n + 192), x3);
+	}
+	return n;
+}
+
+/*
+ * GHASH: Intel carry-less multiplication white paper, algorithm 5, on
+ * byte-reflected operands. The reduction is deferred so that four
+ * products can be aggregated.
+ */
+
+TARGET_PCLMUL
+static inline __m128i
+bswap128(__m128i x)
+{
+	return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+	    10, 11, 12, 13, 14, 15));
+}
+
+TARGET_PCLMUL
+static inline void
+clmul_wide(__m128i a, __m128i b, __m128i * lo, __m128i * hi)
+{
+	__m128i t0, t1, t2, t3;
+
+	t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	t3 = _mm_clmulepi64_si128(a, b, 0x11);
+	t1 = _mm_xor_si128(t1, t2);
+	*lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+	*hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+}
+
+TARGET_PCLMUL
+static inline __m128i
+gf_reduce(__m128i lo, __m128i hi)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+	return _mm_xor_si128(hi, lo);
+}
+
+TARGET_PCLMUL
+static inline __m128i
+gf_mul(__m128i a, __m128i b)
+{
+	__m128i lo, hi;
+
+	clmul_wide(a, b, &lo, &hi);
+	return gf_reduce(lo, hi);
+}
+
+TARGET_PCLMUL
+static void
+ghash_pclmul(const u8 h[16], u8 x[16], const u8 * in, size_t nblocks)
+{
+	__m128i hp[4], xx, lo, hi, l, u;
+	size_t n = 0;
+	int j;
+
+	hp[0] = bswap128(_mm_loadu_si128((const __m128i *)h));
+	xx = bswap128(_mm_loadu_si128((const __m128i *)x));
+
+	if (nblocks >= 4) {
+		hp[1] = gf_mul(hp[0], hp[0]);
+		hp[2] = gf_mul(hp[1], hp[0]);
+		hp[3] = gf_mul(hp[2], hp[0]);
+
+		/* X' = (X + C1)H^4 + C2 H^3 + C3 H^2 + C4 H */
+		for (; n + 4 <= nblocks; n += 4) {
+			lo = _mm_setzero_si128();
+			hi = _mm_setzero_si128();
+			for (j = 0; j < 4; j++) {
+				__m128i c = bswap128(_mm_loadu_si128(
+				    (const __m128i *)(in + 16 * (n + j))));
+
+				if (j == 0)
+					c = _mm_xor_si128(c, xx);
+				clmul_wide(c, hp[3 - j], &l, &u);
+				lo = _mm_xor_si128(lo, l);
+				hi = _mm_xor_si128(hi, u);
+			}
+			xx = gf_reduce(lo, hi);
+		}
+	}
+	for (; n < nblocks; n++) {
+		xx = _mm_xor_si128(xx, bswap128(_mm_loadu_si128(
+		    (const __m128i *)(in + 16 * n))));
+		xx = gf_mul(xx, hp[0]);
+	}
+	_mm_storeu_si128((__m128i *) x, bswap128(xx));
+}
+
+#endif /* SOFT_X86 */
+
+/*
+ * AES dispatch
+ */
+
+static void
+aes_expand(struct aes_sched *s, const u8 * key, size_t keylen)
+{
+	aes_expand_portable(s, key, keylen);
+#ifdef SOFT_X86
+	if (have_aesni)
+		aes_expand_dec_aesni(s);
+#endif
+}
+
+static void
+aes_enc1(const struct aes_sched *s, u8 out[16], const u8 in[16])
+{
+#ifdef SOFT_X86
+	if (have_aesni) {
+		aes_ecb_aesni(s, out, in, 1, 0);
+		return;
+	}
+#endif
+	aes_enc1_portable(s, out, in);
+}
+
+static void
+aes_ecb(const struct aes_sched *s, u8 * out, const u8 * in, size_t nblocks,
+    int dec)
+{
+	size_t n = 0;
+
+#ifdef SOFT_X86
+	if (have_vaes)
+		n = aes_ecb_vaes(s, out, in, nblocks, dec);
+	if (have_aesni) {
+		aes_ecb_aesni(s, out + 16 * n, in + 16 * n, nblocks - n, dec);
+		return;
+	}
+#endif
+	for (; n < nblocks; n++) {
+		if (dec)
+			aes_dec1_portable(s, out + 16 * n, in + 16 * n);
+		else
+			aes_enc1_portable(s, out + 16 * n, in + 16 * n);
+	}
+}
+
+static void
+aes_cbc(const struct aes_sched *s, u8 iv[16], u8 * out, const u8 * in,
+    size_t nblocks, int dec)
+{
+	u8 c[16];
+	size_t n;
+
+#ifdef SOFT_X86
+	if (have_aesni) {
+		if (dec)
+			aes_cbc_dec_aesni(s, iv, out, in, nblocks);
+		else
+			aes_cbc_enc_aesni(s, iv, out, in, nblocks);
+		return;
+	}
+#endif
+	for (n = 0; n < nblocks; n++, in += 16, out += 16) {
+		if (dec) {
+			memcpy(c, in, 16);
+			aes_dec1_portable(s, out, c);
+			xor16(out, out, iv);
+			memcpy(iv, c, 16);
+		} else {
+			xor16(iv, iv, in);
+			aes_enc1_portable(s, iv, iv);
+			memcpy(out, iv, 16);
+		}
+	}
+}
+
+/* Counter mode with a 32-bit big-endian counter: CB = j0[0..11] | ++cv. */
+static void
+aes_ctr32(const struct aes_sched *s, const u8 j0[16], u32 * cv, u8 * out,
+    const u8 * in, size_t nblocks)
+{
+	u8 cb[16], ks[16];
+	size_t n = 0;
+
+#ifdef SOFT_X86
+	if (have_vaes)
+		n = aes_ctr32_vaes(s, j0, cv, out, in, nblocks);
+	if (have_aesni) {
+		aes_ctr32_aesni(s, j0, cv, out + 16 * n, in + 16 * n,
+		    nblocks - n);
+		return;
+	}
+#endif
+	memcpy(cb, j0, 12);
+	for (; n < nblocks; n++) {
+		st_be32(cb + 12, ++*cv);
+		aes_enc1(s, ks, cb);
+		xor16(out + 16 * n, in + 16 * n, ks);
+	}
+}
+
+/*
+ * GHASH dispatch. x is the running hash, h the hash subkey.
+ */
+
+static void
+ghash_portable(const u8 h[16], u8 x[16], const u8 * in, size_t nblocks)
+{
+	u64 hhi = ld_be64(h), hlo = ld_be64(h + 8);
+	u64 xhi = ld_be64(x), xlo = ld_be64(x + 8);
+	u64 zhi, zlo, vhi, vlo, lsb;
+	size_t n;
+	int i;
+
+	for (n = 0; n < nblocks; n++, in += 16) {
+		xhi ^= ld_be64(in);
+		xlo ^= ld_be64(in + 8);
+
+		zhi = zlo = 0;
+		vhi = hhi;
+		vlo = hlo;
+		for (i = 0; i < 128; i++) {
+			u64 bit = (i < 64) ? (xhi >> (63 - i)) : (xlo >> (127 - i));
+
+			if (bit & 1) {
+				zhi ^= vhi;
+				zlo ^= vlo;
+			}
+			lsb = vlo & 1;
+			vlo = (vlo >> 1) | (vhi << 63);
+			vhi >>= 1;
+			if (lsb)
+				vhi ^= 0xe100000000000000ULL;
+		}
+		xhi = zhi;
+		xlo = zlo;
+	}
+	st_be64(x, xhi);
+	st_be64(x + 8, xlo);
+}
+
+static void
+ghash(const u8 h[16], u8 x[16], const u8 * in, size_t nblocks)
+{
+	if (nblocks == 0)
+		return;
+#ifdef SOFT_X86
+	if (have_pclmul) {
+		ghash_pclmul(h, x, in, nblocks);
+		return;
+	}
+#endif
+	ghash_portable(h, x, in, nblocks);
+}
+
+/*
+ * XTS arithmetic in GF(2^128) with the little-endian block convention of
+ * IEEE 1619: x := x * alpha, and a general product for alpha powers.
+ */
+
+static inline void
+xts_mul_alpha(u8 t[16])
+{
+	u64 lo = ld_le64(t), hi = ld_le64(t + 8), carry = hi >> 63;
+
+	hi = (hi << 1) | (lo >> 63);
+	lo = (lo << 1) ^ (carry ? 0x87 : 0);
+	st_le64(t, lo);
+	st_le64(t + 8, hi);
+}
+
+static void
+xts_gf_mul(u8 out[16], const u8 a[16], const u8 b[16])
+{
+	u8 r[16], v[16];
+	int i;
+
+	memset(r, 0, sizeof(r));
+	memcpy(v, a, 16);
+	for (i = 0; i < 128; i++) {
+		if ((b[i / 8] >> (i % 8)) & 1)
+			xor16(r, r, v);
+		xts_mul_alpha(v);
+	}
+	memcpy(out, r, 16);
+}
+
+/* out = alpha^j for a 128-bit little-endian block number j. */
+static void
+xts_alpha_pow(u8 out[16], const u8 j[16])
+{
+	u8 base[16];
+	int i, n;
+
+	/* Only square up to the most significant set bit of j. */
+	for (n = 16; n > 0 && j[n - 1] == 0; n--)
+		;
+
+	memset(out, 0, 16);
+	out[0] = 0x01;
+	memset(base, 0, 16);
+	base[0] = 0x02;
+	for (i = 0; i < 8 * n; i++) {
+		if ((j[i / 8] >> (i % 8)) & 1)
+			xts_gf_mul(out, out, base);
+		xts_gf_mul(base, base, base);
+	}
+}
+
+static void
+aes_xts(const struct aes_sched *s, u8 t[16], u8 * out, const u8 * in,
+    size_t nblocks, int dec)
+{
+	u8 tw[8 * 16], buf[8 * 16];
+	size_t n, m, i;
+
+	/* Batches of 8 tweaks such that the ECB core can run in parallel. */
+	for (n = 0; n < nblocks; n += m) {
+		m = nblocks - n < 8 ? nblocks - n : 8;
+		for (i = 0; i < m; i++) {
+			memcpy(tw + 16 * i, t, 16);
+			xor16(buf + 16 * i, in + 16 * (n + i), t);
+			xts_mul_alpha(t);
+		}
+		aes_ecb(s, buf, buf, m, dec);
+		for (i = 0; i < m; i++)
+			xor16(out + 16 * (n + i), buf + 16 * i, tw + 16 * i);
+	}
+	memzero_secure(buf, sizeof(buf));
+}
+
+/*
+ * Protected key handling
+ */
+
+/*
+ * Returns the AES key schedule for the key wrapped at wkakey (keylen
+ * bytes at mask offset off), or NULL on WKaVP mismatch. The cache entry
+ * holding keep (if not NULL) is not evicted, so a caller that needs two
+ * schedules at once can pass the first one when unwrapping the second.
+ */
+static const struct aes_sched *
+aes_unwrap(const u8 * wkakey, size_t off, size_t keylen, const u8 * wkvp,
+    const struct aes_sched *keep)
+{
+	struct keycache_ent *ent;
+	const struct wk *wk;
+	u8 key[32];
+	unsigned int i;
+
+	if (keylen > sizeof(key))
+		specification_exception();
+
+	wk = wk_verify(wkvp);
+	if (wk == NULL)
+		return NULL;
+
+	for (i = 0; i < KEYCACHE_NMEMB; i++) {
+		ent = &keycache[i];
+		if (ent->gen == wk->gen && ent->off == off && ent->keylen == keylen
+		    && memcmp(ent->wkakey, wkakey, keylen) == 0)
+			return &ent->sched;
+	}
+
+	ent = &keycache[keycache_next++ % KEYCACHE_NMEMB];
+	if (&ent->sched == keep)
+		ent = &keycache[keycache_next++ % KEYCACHE_NMEMB];
+	wk_unwrap(wk, key, wkakey, off, keylen);
+	aes_expand(&ent->sched, key, keylen);
+	memzero_secure(key, sizeof(key));
+	memcpy(ent->wkakey, wkakey, keylen);
+	ent->gen = wk->gen;
+	ent->off = off;
+	ent->keylen = keylen;
+	return &ent->sched;
+}
+
+static size_t
+aes_fc2keylen(unsigned long fc)
+{
+	switch (FC(fc)) {
+	case CPACF_KM_AES_128:
+	case CPACF_KM_ENCRYPTED_AES_128:
+	case CPACF_KM_XTS_ENCRYPTED_AES_128:
+	case CPACF_KM_FXTS_ENCRYPTED_AES_128:
+		return 16;
+	case CPACF_KM_AES_192:
+	case CPACF_KM_ENCRYPTED_AES_192:
+		return 24;
+	case CPACF_KM_AES_256:
+	case CPACF_KM_ENCRYPTED_AES_256:
+	case CPACF_KM_XTS_ENCRYPTED_AES_256:
+	case CPACF_KM_FXTS_ENCRYPTED_AES_256:
+		return 32;
+	default:
+		return 0;
+	}
+}
+
+static void
+query(void *param, const unsigned long *fcs, size_t nfcs)
+{
+	u64 *status_word = param;
+	size_t i;
+
+	memset(status_word, 0, 2 * sizeof(u64));
+	for (i = 0; i < nfcs; i++)
+		status_word[OFF64(fcs[i])] |= MASK64(fcs[i]);
+}
+
+/* Amount of the operand processed by this instance. */
+static inline unsigned long
+chunk(unsigned long len)
+{
+	return len > CPU_DETERMINED ? CPU_DETERMINED : len;
+}
+
+/*
+ * KM
+ */
+
+int
+cpacf_soft_km(unsigned long fc, void *param, u8 ** out, const u8 ** in,
+    unsigned long *inlen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KM_QUERY,
+		CPACF_KM_AES_128, CPACF_KM_AES_192, CPACF_KM_AES_256,
+		CPACF_KM_ENCRYPTED_AES_128, CPACF_KM_ENCRYPTED_AES_192,
+		CPACF_KM_ENCRYPTED_AES_256, CPACF_KM_XTS_ENCRYPTED_AES_128,
+		CPACF_KM_XTS_ENCRYPTED_AES_256, CPACF_KM_FXTS_ENCRYPTED_AES_128,
+		CPACF_KM_FXTS_ENCRYPTED_AES_256,
+	};
+	const struct aes_sched *s1, *s2;
+	struct aes_sched sched;
+	int dec = (fc & CPACF_M) ? 1 : 0;
+	size_t keylen = aes_fc2keylen(fc);
+	unsigned long len;
+	u8 *p = param, t[16];
+
+	if (FC(fc) == CPACF_KM_QUERY) {
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	}
+	if (keylen == 0 || *inlen % 16 != 0)
+		specification_exception();
+
+	len = chunk(*inlen);
+
+	switch (FC(fc)) {
+	case CPACF_KM_AES_128:
+	case CPACF_KM_AES_192:
+	case CPACF_KM_AES_256:
+		/* K */
+		aes_expand(&sched, p, keylen);
+		aes_ecb(&sched, *out, *in, len / 16, dec);
+		memzero_secure(&sched, sizeof(sched));
+		break;
+	case CPACF_KM_ENCRYPTED_AES_128:
+	case CPACF_KM_ENCRYPTED_AES_192:
+	case CPACF_KM_ENCRYPTED_AES_256:
+		/* WKa(K)|WKaVP */
+		s1 = aes_unwrap(p, 0, keylen, p + keylen, NULL);
+		if (s1 == NULL)
+			return 1;
+		aes_ecb(s1, *out, *in, len / 16, dec);
+		break;
+	case CPACF_KM_XTS_ENCRYPTED_AES_128:
+	case CPACF_KM_XTS_ENCRYPTED_AES_256:
+		/* WKa(K)|WKaVP|XTS parameter */
+		s1 = aes_unwrap(p, 0, keylen, p + keylen, NULL);
+		if (s1 == NULL)
+			return 1;
+		aes_xts(s1, p + keylen + 32, *out, *in, len / 16, dec);
+		break;
+	case CPACF_KM_FXTS_ENCRYPTED_AES_128:
+	case CPACF_KM_FXTS_ENCRYPTED_AES_256:
+		/* WKa(K1|K2)|tweak|next alpha power|WKaVP */
+		s1 = aes_unwrap(p, 0, keylen, p + 2 * keylen + 32, NULL);
+		s2 = aes_unwrap(p + keylen, keylen, keylen,
+		    p + 2 * keylen + 32, s1);
+		if (s1 == NULL || s2 == NULL)
+			return 1;
+		aes_enc1(s2, t, p + 2 * keylen);
+		xts_gf_mul(t, t, p + 2 * keylen + 16);
+		aes_xts(s1, t, *out, *in, len / 16, dec);
+		/* Advance the next alpha power past the processed blocks. */
+		{
+			u8 *nap = p + 2 * keylen + 16;
+			size_t n;
+
+			for (n = 0; n < len / 16; n++)
+				xts_mul_alpha(nap);
+		}
+		memzero_secure(t, sizeof(t));
+		break;
+	}
+
+	*out += len;
+	*in += len;
+	*inlen -= len;
+	return *inlen ? 3 : 0;
+}
+
+/*
+ * KMC
+ */
+
+int
+cpacf_soft_kmc(unsigned long fc, void *param, u8 ** out, const u8 ** in,
+    unsigned long *inlen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KMC_QUERY,
+		CPACF_KMC_ENCRYPTED_AES_128, CPACF_KMC_ENCRYPTED_AES_192,
+		CPACF_KMC_ENCRYPTED_AES_256,
+	};
+	struct cpacf_kmc_aes_param *p = param;
+	const struct aes_sched *s;
+	size_t keylen;
+	unsigned long len;
+
+	if (FC(fc) == CPACF_KMC_QUERY) {
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	}
+	keylen = aes_fc2keylen(fc);
+	if (FC(fc) > CPACF_KMC_ENCRYPTED_AES_256 || keylen == 0
+	    || *inlen % 16 != 0)
+		specification_exception();
+
+	s = aes_unwrap(p->protkey, 0, keylen, p->protkey + keylen, NULL);
+	if (s == NULL)
+		return 1;
+
+	len = chunk(*inlen);
+	aes_cbc(s, p->cv, *out, *in, len / 16, (fc & CPACF_M) ? 1 : 0);
+
+	*out += len;
+	*in += len;
+	*inlen -= len;
+	return *inlen ? 3 : 0;
+}
+
+/*
+ * KMCTR
+ */
+
+int
+cpacf_soft_kmctr(unsigned long fc, void *param, u8 ** out, const u8 ** in,
+    unsigned long *inlen, const u8 ** ctr)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KMCTR_QUERY,
+		CPACF_KMCTR_ENCRYPTED_AES_128, CPACF_KMCTR_ENCRYPTED_AES_192,
+		CPACF_KMCTR_ENCRYPTED_AES_256,
+	};
+	struct cpacf_kmctr_aes_param *p = param;
+	const struct aes_sched *s;
+	size_t keylen, i, n;
+	unsigned long len, off;
+	u8 ks[256];
+
+	if (FC(fc) == CPACF_KMCTR_QUERY) {
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	}
+	keylen = aes_fc2keylen(fc);
+	if (FC(fc) > CPACF_KMCTR_ENCRYPTED_AES_256 || keylen == 0
+	    || *inlen % 16 != 0)
+		specification_exception();
+
+	s = aes_unwrap(p->protkey, 0, keylen, p->protkey + keylen, NULL);
+	if (s == NULL)
+		return 1;
+
+	len = chunk(*inlen);
+	for (off = 0; off < len; off += n) {
+		n = len - off < sizeof(ks) ? len - off : sizeof(ks);
+		aes_ecb(s, ks, *ctr + off, n / 16, 0);
+		for (i = 0; i < n; i++)
+			(*out)[off + i] = (*in)[off + i] ^ ks[i];
+	}
+	memzero_secure(ks, sizeof(ks));
+
+	*out += len;
+	*in += len;
+	*ctr += len;
+	*inlen -= len;
+	return *inlen ? 3 : 0;
+}
+
+/*
+ * KMAC
+ */
+
+static int
+kmac_hmac(unsigned long *fc, void *param, const u8 ** in,
+    unsigned long *inlen)
+{
+	struct cpacf_kmac_hmac_param *p = param;
+	u8 *h, *protkey, key[128], buf[128], digest[64];
+	const void *icv;
+	struct sha2 s;
+	size_t bs, dlen, i;
+	unsigned long len;
+	const struct wk *wk;
+	u128 bitlen;
+	int wide;
+
+	switch (FC(*fc)) {
+	case CPACF_KMAC_ENCRYPTED_SHA_224:
+		icv = sha224_icv, dlen = 28, wide = 0;
+		break;
+	case CPACF_KMAC_ENCRYPTED_SHA_256:
+		icv = sha256_icv, dlen = 32, wide = 0;
+		break;
+	case CPACF_KMAC_ENCRYPTED_SHA_384:
+		icv = sha384_icv, dlen = 48, wide = 1;
+		break;
+	default:
+		icv = sha512_icv, dlen = 64, wide = 1;
+		break;
+	}
+
+	if (wide) {
+		h = (u8 *)p->hmac_384_512.h;
+		protkey = p->hmac_384_512.protkey;
+		bitlen = p->hmac_384_512.imbl;
+		bs = 128;
+	} else {
+		h = (u8 *)p->hmac_224_256.h;
+		protkey = p->hmac_224_256.protkey;
+		bitlen = p->hmac_224_256.imbl;
+		bs = 64;
+	}
+
+	wk = wk_verify(protkey + bs);
+	if (wk == NULL)
+		return 1;
+
+	sha2_init(&s, wide, icv);
+	if (!(*fc & CPACF_KMAC_IKP)) {
+		/* Process K xor ipad first. */
+		wk_unwrap(wk, key, protkey, 0, bs);
+		for (i = 0; i < bs; i++)
+			buf[i] = key[i] ^ 0x36;
+		sha2_blocks(&s, buf, 1);
+		*fc |= CPACF_KMAC_IKP;
+	} else {
+		sha2_load(&s, h);
+	}
+
+	if ((*fc & CPACF_KMAC_IIMP) && *inlen % bs != 0)
+		specification_exception();
+
+	/* Full blocks, keeping the last (partial) block for the padding. */
+	len = *inlen;
+	if (!(*fc & CPACF_KMAC_IIMP))
+		len = len / bs * bs == len && len ? len - bs : len / bs * bs;
+	if (len > CPU_DETERMINED)
+		len = CPU_DETERMINED / bs * bs;
+	sha2_blocks(&s, *in, len / bs);
+	*in += len;
+	*inlen -= len;
+
+	if (*fc & CPACF_KMAC_IIMP || *inlen > bs) {
+		sha2_store(&s, h);
+		memzero_secure(key, sizeof(key));
+		memzero_secure(buf, sizeof(buf));
+		return *inlen ? 3 : 0;
+	}
+
+	/* Last block: inner hash over ipad block plus message, then outer. */
+	if (*inlen == bs) {
+		sha2_blocks(&s, *in, 1);
+		*in += bs;
+		*inlen = 0;
+	}
+	sha2_final(&s, *in, *inlen, bitlen + bs * 8);
+	*in += *inlen;
+	*inlen = 0;
+	sha2_store(&s, digest);
+
+	wk_unwrap(wk, key, protkey, 0, bs);
+	for (i = 0; i < bs; i++)
+		buf[i] = key[i] ^ 0x5c;
+	sha2_init(&s, wide, icv);
+	sha2_blocks(&s, buf, 1);
+	sha2_final(&s, digest, dlen, (bs + dlen) * 8);
+	sha2_store(&s, h);
+
+	memzero_secure(key, sizeof(key));
+	memzero_secure(buf, sizeof(buf));
+	memzero_secure(digest, sizeof(digest));
+	return 0;
+}
+
+int
+cpacf_soft_kmac(unsigned long *fc, void *param, const u8 ** in,
+    unsigned long *inlen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KMAC_QUERY,
+		CPACF_KMAC_ENCRYPTED_AES_128, CPACF_KMAC_ENCRYPTED_AES_192,
+		CPACF_KMAC_ENCRYPTED_AES_256, CPACF_KMAC_ENCRYPTED_SHA_224,
+		CPACF_KMAC_ENCRYPTED_SHA_256, CPACF_KMAC_ENCRYPTED_SHA_384,
+		CPACF_KMAC_ENCRYPTED_SHA_512,
+	};
+	struct cpacf_kmac_aes_param *p = param;
+	const struct aes_sched *s;
+	size_t keylen, n;
+	unsigned long len;
+
+	switch (FC(*fc)) {
+	case CPACF_KMAC_QUERY:
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	case CPACF_KMAC_ENCRYPTED_SHA_224:
+	case CPACF_KMAC_ENCRYPTED_SHA_256:
+	case CPACF_KMAC_ENCRYPTED_SHA_384:
+	case CPACF_KMAC_ENCRYPTED_SHA_512:
+		return kmac_hmac(fc, param, in, inlen);
+	case CPACF_KMAC_ENCRYPTED_AES_128:
+	case CPACF_KMAC_ENCRYPTED_AES_192:
+	case CPACF_KMAC_ENCRYPTED_AES_256:
+		break;
+	default:
+		specification_exception();
+	}
+
+	keylen = aes_fc2keylen(*fc);
+	if (*inlen % 16 != 0)
+		specification_exception();
+
+	s = aes_unwrap(p->protkey, 0, keylen, p->protkey + keylen, NULL);
+	if (s == NULL)
+		return 1;
+
+	/* CBC-MAC into the ICV. */
+	len = chunk(*inlen);
+	for (n = 0; n < len / 16; n++) {
+		xor16(p->icv, p->icv, *in + 16 * n);
+		aes_enc1(s, p->icv, p->icv);
+	}
+
+	*in += len;
+	*inlen -= len;
+	return *inlen ? 3 : 0;
+}
+
+/*
+ * PCC
+ */
+
+int
+cpacf_soft_pcc(unsigned long fc, void *param)
+{
+	static const unsigned long fcs[] = {
+		CPACF_PCC_QUERY,
+		CPACF_PCC_CMAC_ENCRYPTED_AES_128,
+		CPACF_PCC_CMAC_ENCRYPTED_AES_192,
+		CPACF_PCC_CMAC_ENCRYPTED_AES_256,
+		CPACF_PCC_XTS_ENCRYPTED_AES_128,
+		CPACF_PCC_XTS_ENCRYPTED_AES_256,
+	};
+	const struct aes_sched *s;
+	u8 l[16], k[16], m[16], *p = param;
+	size_t keylen = aes_fc2keylen(fc);
+	unsigned int ml, i;
+
+	switch (FC(fc)) {
+	case CPACF_PCC_QUERY:
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	case CPACF_PCC_CMAC_ENCRYPTED_AES_128:
+	case CPACF_PCC_CMAC_ENCRYPTED_AES_192:
+	case CPACF_PCC_CMAC_ENCRYPTED_AES_256:
+		{
+			struct cpacf_pcc_cmac_aes_param *cp = param;
+
+			s = aes_unwrap(cp->protkey, 0, keylen,
+			    cp->protkey + keylen, NULL);
+			if (s == NULL)
+				return 1;
+
+			ml = cp->ml;
+			if (ml > 128)
+				specification_exception();
+
+			/* Subkeys K1 = L * x, K2 = L * x^2 (SP 800-38B). */
+			memset(l, 0, sizeof(l));
+			aes_enc1(s, l, l);
+			for (i = 0; i < (ml == 128 ? 1U : 2U); i++) {
+				u8 carry = l[0] & 0x80;
+				int j;
+
+				for (j = 0; j < 15; j++)
+					k[j] = (u8)(l[j] << 1) | (l[j + 1] >> 7);
+				k[15] = (u8)(l[15] << 1) ^ (carry ? 0x87 : 0);
+				memcpy(l, k, 16);
+			}
+
+			memset(m, 0, sizeof(m));
+			memcpy(m, cp->message, (ml + 7) / 8);
+			if (ml < 128) {
+				if (ml % 8)
+					m[ml / 8] &= (u8)(0xff << (8 - ml % 8));
+				m[ml / 8] |= (u8)(0x80 >> (ml % 8));
+			}
+			xor16(m, m, k);
+			xor16(cp->icv, cp->icv, m);
+			aes_enc1(s, cp->icv, cp->icv);
+
+			memzero_secure(l, sizeof(l));
+			memzero_secure(k, sizeof(k));
+			memzero_secure(m, sizeof(m));
+			return 0;
+		}
+	case CPACF_PCC_XTS_ENCRYPTED_AES_128:
+	case CPACF_PCC_XTS_ENCRYPTED_AES_256:
+		/* WKa(K)|WKaVP|i|j|t|XTS parameter */
+		s = aes_unwrap(p, 0, keylen, p + keylen, NULL);
+		if (s == NULL)
+			return 1;
+		{
+			u8 *pi = p + keylen + 32, *pj = pi + 16;
+			u8 *pt = pj + 16, *px = pt + 16;
+
+			aes_enc1(s, l, pi);
+			xts_alpha_pow(m, pj);
+			xts_gf_mul(px, l, m);
+			memset(pt, 0, 16);
+			memzero_secure(l, sizeof(l));
+		}
+		return 0;
+	default:
+		specification_exception();
+	}
+	return 0;
+}
+
+/*
+ * KMA
+ */
+
+int
+cpacf_soft_kma(unsigned long fc, void *param, u8 ** out, const u8 ** aad,
+    unsigned long *aadlen, const u8 ** in, unsigned long *inlen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KMA_QUERY,
+		CPACF_KMA_GCM_ENCRYPTED_AES_128,
+		CPACF_KMA_GCM_ENCRYPTED_AES_192,
+		CPACF_KMA_GCM_ENCRYPTED_AES_256,
+	};
+	struct cpacf_kma_gcm_aes_param *p = param;
+	const struct aes_sched *s;
+	int dec = (fc & CPACF_M) ? 1 : 0;
+	unsigned long len, full;
+	size_t keylen;
+	u8 buf[16], *cvp = (u8 *)&p->cv;
+	u32 cv;
+
+	if (FC(fc) == CPACF_KMA_QUERY) {
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	}
+	keylen = aes_fc2keylen(fc);
+	if (FC(fc) > CPACF_KMA_GCM_ENCRYPTED_AES_256 || keylen == 0)
+		specification_exception();
+	if (!(fc & CPACF_KMA_LAAD) && *aadlen % 16 != 0)
+		specification_exception();
+	if (!(fc & CPACF_KMA_LPC) && *inlen % 16 != 0)
+		specification_exception();
+
+	s = aes_unwrap(p->protkey, 0, keylen, p->protkey + keylen, NULL);
+	if (s == NULL)
+		return 1;
+
+	if (!(fc & CPACF_KMA_HS)) {
+		memset(p->h, 0, sizeof(p->h));
+		aes_enc1(s, p->h, p->h);
+	}
+
+	/* AAD */
+	if (*aadlen) {
+		len = chunk(*aadlen);
+		full = len / 16 * 16;
+		ghash(p->h, p->t, *aad, full / 16);
+		if (len != full && len == *aadlen) {
+			memset(buf, 0, sizeof(buf));
+			memcpy(buf, *aad + full, len - full);
+			ghash(p->h, p->t, buf, 1);
+		} else {
+			len = full;
+		}
+		*aad += len;
+		*aadlen -= len;
+		if (*aadlen || *inlen)
+			return 3;
+	}
+
+	/* Plaintext/ciphertext: the counter value is pre-incremented. */
+	cv = ld_be32(cvp);
+	if (*inlen) {
+		len = chunk(*inlen);
+		full = len / 16 * 16;
+		if (dec)
+			ghash(p->h, p->t, *in, full / 16);
+		aes_ctr32(s, p->j0, &cv, *out, *in, full / 16);
+		if (!dec)
+			ghash(p->h, p->t, *out, full / 16);
+		if (len != full && len == *inlen) {
+			u8 cb[16], ks[16];
+			size_t rem = len - full, i;
+
+			memcpy(cb, p->j0, 12);
+			st_be32(cb + 12, ++cv);
+			aes_enc1(s, ks, cb);
+			memset(buf, 0, sizeof(buf));
+			for (i = 0; i < rem; i++) {
+				u8 c = (*in)[full + i] ^ ks[i];
+
+				buf[i] = dec ? (*in)[full + i] : c;
+				(*out)[full + i] = c;
+			}
+			ghash(p->h, p->t, buf, 1);
+			memzero_secure(ks, sizeof(ks));
+		} else {
+			len = full;
+		}
+		st_be32(cvp, cv);
+		*out += len;
+		*in += len;
+		*inlen -= len;
+		if (*inlen)
+			return 3;
+	}
+
+	if (!(fc & CPACF_KMA_LPC))
+		return 2;
+
+	/* Final: length block, then tag = GHASH ^ E(J0). */
+	st_be64(buf, p->taadl);
+	st_be64(buf + 8, p->tpcl);
+	ghash(p->h, p->t, buf, 1);
+	aes_enc1(s, buf, p->j0);
+	xor16(p->t, p->t, buf);
+	memzero_secure(buf, sizeof(buf));
+	return 0;
+}
+
+/*
+ * KDSA
+ */
+
+static int
+ecdsa_nid(unsigned long fc, size_t *flen, size_t *olen)
+{
+	switch (FC(fc)) {
+	case CPACF_KDSA_ECDSA_VERIFY_ECP256:
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P256:
+		*flen = 32, *olen = 32;
+		return NID_X9_62_prime256v1;
+	case CPACF_KDSA_ECDSA_VERIFY_ECP384:
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P384:
+		*flen = 48, *olen = 48;
+		return NID_secp384r1;
+	default:
+		*flen = 80, *olen = 66;
+		return NID_secp521r1;
+	}
+}
+
+/* Message representative without leading zero bytes, see ecdsa_ctx.c. */
+static const u8 *
+ecdsa_hash(const u8 * field, size_t flen, size_t *hlen)
+{
+	while (flen > 1 && *field == 0)
+		field++, flen--;
+	*hlen = flen;
+	return field;
+}
+
+static int
+kdsa_ecdsa_sign(unsigned long fc, u8 * p)
+{
+	size_t flen, olen, hlen;
+	const struct wk *wk;
+	int nid = ecdsa_nid(fc, &flen, &olen), cc = 2;
+	u8 *sig_r = p, *sig_s = p + flen, *hash = p + 2 * flen;
+	u8 *prot = p + 3 * flen, *wkvp = p + 5 * flen, d[80];
+	const BIGNUM *r, *s;
+	const u8 *m;
+	ECDSA_SIG *sig = NULL;
+	EC_KEY *eckey = NULL;
+	BIGNUM *bn = NULL;
+
+	wk = wk_verify(wkvp);
+	if (wk == NULL)
+		return 1;
+	wk_unwrap(wk, d, prot, 0, flen);
+
+	eckey = EC_KEY_new_by_curve_name(nid);
+	bn = BN_bin2bn(d, flen, NULL);
+	if (eckey == NULL || bn == NULL || !EC_KEY_set_private_key(eckey, bn))
+		goto ret;
+
+	m = ecdsa_hash(hash, flen, &hlen);
+	sig = ECDSA_do_sign(m, hlen, eckey);
+	if (sig == NULL)
+		goto ret;
+	ECDSA_SIG_get0(sig, &r, &s);
+	if (BN_bn2binpad(r, sig_r, flen) < 0
+	    || BN_bn2binpad(s, sig_s, flen) < 0)
+		goto ret;
+	cc = 0;
+ret:
+	memzero_secure(d, sizeof(d));
+	ECDSA_SIG_free(sig);
+	BN_clear_free(bn);
+	EC_KEY_free(eckey);
+	return cc;
+}
+
+static int
+kdsa_ecdsa_verify(unsigned long fc, u8 * p)
+{
+	size_t flen, olen, hlen;
+	int nid = ecdsa_nid(fc, &flen, &olen), cc = 2;
+	u8 *sig_r = p, *sig_s = p + flen, *hash = p + 2 * flen;
+	u8 *pub_x = p + 3 * flen, *pub_y = p + 4 * flen;
+	BIGNUM *x = NULL, *y = NULL, *r = NULL, *s = NULL;
+	ECDSA_SIG *sig = NULL;
+	EC_KEY *eckey = NULL;
+	const u8 *m;
+
+	eckey = EC_KEY_new_by_curve_name(nid);
+	x = BN_bin2bn(pub_x, flen, NULL);
+	y = BN_bin2bn(pub_y, flen, NULL);
+	r = BN_bin2bn(sig_r, flen, NULL);
+	s = BN_bin2bn(sig_s, flen, NULL);
+	sig = ECDSA_SIG_new();
+	if (eckey == NULL || x == NULL || y == NULL || r == NULL || s == NULL
+	    || sig == NULL)
+		goto ret;
+	if (!EC_KEY_set_public_key_affine_coordinates(eckey, x, y))
+		goto ret;
+	if (!ECDSA_SIG_set0(sig, r, s))
+		goto ret;
+	r = s = NULL;
+
+	m = ecdsa_hash(hash, flen, &hlen);
+	if (ECDSA_do_verify(m, hlen, sig, eckey) == 1)
+		cc = 0;
+ret:
+	BN_free(x);
+	BN_free(y);
+	BN_free(r);
+	BN_free(s);
+	ECDSA_SIG_free(sig);
+	EC_KEY_free(eckey);
+	return cc;
+}
+
+/*
+ * EdDSA public keys and signature halves are stored byte-reversed in
+ * fields of flen bytes: field[flen - 1 - i] = value[i].
+ */
+static void
+eddsa_field(u8 * out, const u8 * in, size_t flen, size_t vlen)
+{
+	size_t i;
+
+	for (i = 0; i < vlen; i++)
+		out[i] = in[flen - 1 - i];
+}
+
+static void
+eddsa_unfield(u8 * out, const u8 * in, size_t flen, size_t vlen)
+{
+	size_t i;
+
+	memset(out, 0, flen);
+	for (i = 0; i < vlen; i++)
+		out[flen - 1 - i] = in[i];
+}
+
+static int
+kdsa_eddsa(unsigned long fc, u8 * p, const u8 * msg, size_t msglen)
+{
+	int ed448 = (FC(fc) == CPACF_KDSA_EDDSA_VERIFY_ED448
+	    || FC(fc) == CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED448);
+	int sign = (FC(fc) == CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED25519
+	    || FC(fc) == CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED448);
+	int type = ed448 ? EVP_PKEY_ED448 : EVP_PKEY_ED25519, cc = 2;
+	size_t flen = ed448 ? 64 : 32, vlen = ed448 ? 57 : 32, siglen;
+	u8 *sig_r = p, *sig_s = p + flen, *key = p + 2 * flen;
+	u8 k[64], sig[114];
+	EVP_MD_CTX *mdctx = NULL;
+	EVP_PKEY *pkey = NULL;
+	const struct wk *wk;
+
+	if (sign) {
+		wk = wk_verify(p + 3 * flen);
+		if (wk == NULL)
+			return 1;
+		/* Private keys are wrapped as-is, right-aligned in the field. */
+		wk_unwrap(wk, k, key, 0, flen);
+		pkey = EVP_PKEY_new_raw_private_key(type, NULL,
+		    k + flen - vlen, vlen);
+	} else {
+		eddsa_field(k, key, flen, vlen);
+		pkey = EVP_PKEY_new_raw_public_key(type, NULL, k, vlen);
+	}
+	mdctx = EVP_MD_CTX_new();
+	if (pkey == NULL || mdctx == NULL)
+		goto ret;
+
+	if (sign) {
+		siglen = 2 * vlen;
+		if (EVP_DigestSignInit(mdctx, NULL, NULL, NULL, pkey) != 1
+		    || EVP_DigestSign(mdctx, sig, &siglen, msg, msglen) != 1)
+			goto ret;
+		eddsa_unfield(sig_r, sig, flen, vlen);
+		eddsa_unfield(sig_s, sig + vlen, flen, vlen);
+	} else {
+		eddsa_field(sig, sig_r, flen, vlen);
+		eddsa_field(sig + vlen, sig_s, flen, vlen);
+		if (EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) != 1
+		    || EVP_DigestVerify(mdctx, sig, 2 * vlen, msg, msglen) != 1)
+			goto ret;
+	}
+	cc = 0;
+ret:
+	memzero_secure(k, sizeof(k));
+	memzero_secure(sig, sizeof(sig));
+	EVP_MD_CTX_free(mdctx);
+	EVP_PKEY_free(pkey);
+	return cc;
+}
+
+int
+cpacf_soft_kdsa(unsigned long fc, void *param, const u8 ** src,
+    unsigned long *srclen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KDSA_QUERY,
+		CPACF_KDSA_ECDSA_VERIFY_ECP256, CPACF_KDSA_ECDSA_VERIFY_ECP384,
+		CPACF_KDSA_ECDSA_VERIFY_ECP521, CPACF_KDSA_EDDSA_VERIFY_ED25519,
+		CPACF_KDSA_EDDSA_VERIFY_ED448,
+		CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P256,
+		CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P384,
+		CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P521,
+		CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED25519,
+		CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED448,
+	};
+	int cc;
+
+	switch (FC(fc)) {
+	case CPACF_KDSA_QUERY:
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	case CPACF_KDSA_ECDSA_VERIFY_ECP256:
+	case CPACF_KDSA_ECDSA_VERIFY_ECP384:
+	case CPACF_KDSA_ECDSA_VERIFY_ECP521:
+		return kdsa_ecdsa_verify(fc, param);
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P256:
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P384:
+	case CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P521:
+		return kdsa_ecdsa_sign(fc, param);
+	case CPACF_KDSA_EDDSA_VERIFY_ED25519:
+	case CPACF_KDSA_EDDSA_VERIFY_ED448:
+	case CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED25519:
+	case CPACF_KDSA_ENCRYPTED_EDDSA_SIGN_ED448:
+		/* The message is the second operand. */
+		cc = kdsa_eddsa(fc, param, *src, *srclen);
+		if (cc == 0) {
+			*src += *srclen;
+			*srclen = 0;
+		}
+		return cc;
+	default:
+		specification_exception();
+	}
+	return 0;
+}
+
+/*
+ * KIMD
+ */
+
+int
+cpacf_soft_kimd(unsigned long fc, void *param, const u8 ** src, long *srclen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KIMD_QUERY, CPACF_KIMD_SHA_256, CPACF_KIMD_SHA_512,
+	};
+	struct cpacf_klmd_param *p = param;
+	struct sha2 s;
+	u8 *h;
+	unsigned long len;
+	int wide;
+
+	switch (FC(fc)) {
+	case CPACF_KIMD_QUERY:
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	case CPACF_KIMD_SHA_256:
+		wide = 0;
+		h = p->klmd_224_256.h;
+		break;
+	case CPACF_KIMD_SHA_512:
+		wide = 1;
+		h = p->klmd_384_512.h;
+		break;
+	default:
+		specification_exception();
+		return 0;
+	}
+
+	sha2_init(&s, wide, wide ? (const void *)sha512_icv : sha256_icv);
+	if ((unsigned long)*srclen % s.blksize != 0) {
+		specification_exception();
+		return 0;
+	}
+	sha2_load(&s, h);
+
+	len = *srclen;
+	if (len > CPU_DETERMINED)
+		len = CPU_DETERMINED;
+	sha2_blocks(&s, *src, len / s.blksize);
+	*src += len;
+	*srclen -= len;
+	sha2_store(&s, h);
+	return *srclen > 0 ? 3 : 0;
+}
+
+/*
+ * KLMD
+ */
+
+int
+cpacf_soft_klmd(unsigned long fc, void *param, const u8 ** src, long *srclen)
+{
+	static const unsigned long fcs[] = {
+		CPACF_KLMD_QUERY, CPACF_KLMD_SHA_256, CPACF_KLMD_SHA_512,
+	};
+	struct cpacf_klmd_param *p = param;
+	struct sha2 s;
+	u8 *h;
+	u128 bitlen;
+	unsigned long len;
+	int wide;
+
+	switch (FC(fc)) {
+	case CPACF_KLMD_QUERY:
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	case CPACF_KLMD_SHA_256:
+		wide = 0;
+		h = p->klmd_224_256.h;
+		bitlen = p->klmd_224_256.mbl;
+		break;
+	case CPACF_KLMD_SHA_512:
+		wide = 1;
+		h = p->klmd_384_512.h;
+		bitlen = p->klmd_384_512.mbl;
+		break;
+	default:
+		specification_exception();
+		return 0;
+	}
+
+	/* The ICV is taken from the parameter block. */
+	sha2_init(&s, wide, wide ? (const void *)sha512_icv : sha256_icv);
+	sha2_load(&s, h);
+
+	len = *srclen / s.blksize * s.blksize;
+	if (len > CPU_DETERMINED)
+		len = CPU_DETERMINED;
+	sha2_blocks(&s, *src, len / s.blksize);
+	*src += len;
+	*srclen -= len;
+	if ((unsigned long)*srclen >= s.blksize) {
+		sha2_store(&s, h);
+		return 3;
+	}
+
+	sha2_final(&s, *src, *srclen, bitlen);
+	*src += *srclen;
+	*srclen = 0;
+	sha2_store(&s, h);
+	return 0;
+}
+
+/*
+ * PRNO
+ */
+
+int
+cpacf_soft_prno(unsigned long fc, void *param, u8 ** out1,
+    unsigned long *out1len, u8 ** out2, unsigned long *out2len)
+{
+	static const unsigned long fcs[] = {
+		CPACF_PRNO_QUERY, CPACF_PRNO_TRNG,
+	};
+	unsigned long len;
+	ssize_t n;
+
+	switch (FC(fc)) {
+	case CPACF_PRNO_QUERY:
+		query(param, fcs, NMEMB(fcs));
+		return 0;
+	case CPACF_PRNO_TRNG:
+		break;
+	default:
+		specification_exception();
+		return 0;
+	}
+
+	/* Raw and conditioned entropy both come from the kernel here. */
+	if (*out1len > 0) {
+		len = chunk(*out1len);
+		n = getrandom(*out1, len, 0);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			abort();
+		*out1 += n;
+		*out1len -= n;
+	} else if (*out2len > 0) {
+		len = chunk(*out2len);
+		n = getrandom(*out2, len, 0);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			abort();
+		*out2 += n;
+		*out2len -= n;
+	}
+
+	return (*out1len || *out2len) ? 3 : 0;
+}
+
+/*
+ * STFLE
+ */
+
+unsigned long
+cpacf_soft_stfle(u64 flist[], u8 nmemb)
+{
+	static const unsigned int facilities[] = {
+		MSA, MSA3, MSA4, MSA5, MSA8, MSA9,
+	};
+	size_t i;
+
+	memset(flist, 0, nmemb * sizeof(u64));
+	for (i = 0; i < NMEMB(facilities); i++) {
+		if (OFF64(facilities[i]) < nmemb)
+			flist[OFF64(facilities[i])] |= MASK64(facilities[i]);
+	}
+	return OFF64(MSA9) + 1;
+}
+
+__attribute__((constructor))
+static void
+cpacf_soft_init(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		inv_sbox[sbox[i]] = (u8)i;
+}
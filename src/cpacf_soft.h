@@ -0,0 +1,73 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef CPACF_SOFT_H
+# define CPACF_SOFT_H
+
+# include "misc.h"
+
+/*
+ * Software CPACF backend (build option SOFT_CPACF).
+ *
+ * Each cpacf_soft_* function executes one instance of the corresponding
+ * CPACF instruction: it reads and updates the parameter block and the
+ * operand "registers" passed by reference, and returns the condition
+ * code. Like the hardware, an instance may stop after a CPU-determined
+ * amount of data with cc 3 (partial completion), in which case the caller
+ * re-executes it, see the wrappers in cpacf.h.
+ *
+ * Protected keys are emulated: a key is wrapped by xor-ing it with a
+ * mask derived from a per-process random wrapping key (WK). The WK's
+ * verification pattern (WKaVP) is appended to the wrapped key as on the
+ * real machine. A parameter block whose WKaVP does not match the current
+ * WK results in cc 1. This is NOT a security boundary.
+ */
+
+/* Maximum key length (HMAC-SHA-512) that can be wrapped. */
+# define CPACF_SOFT_MAX_KEYLEN          128
+# define CPACF_SOFT_WKVPLEN             32
+
+int cpacf_soft_km(unsigned long fc, void *param, u8 ** out, const u8 ** in,
+    unsigned long *inlen);
+int cpacf_soft_kmc(unsigned long fc, void *param, u8 ** out, const u8 ** in,
+    unsigned long *inlen);
+int cpacf_soft_kmctr(unsigned long fc, void *param, u8 ** out,
+    const u8 ** in, unsigned long *inlen, const u8 ** ctr);
+int cpacf_soft_kmac(unsigned long *fc, void *param, const u8 ** in,
+    unsigned long *inlen);
+int cpacf_soft_pcc(unsigned long fc, void *param);
+int cpacf_soft_kma(unsigned long fc, void *param, u8 ** out, const u8 ** aad,
+    unsigned long *aadlen, const u8 ** in, unsigned long *inlen);
+int cpacf_soft_kdsa(unsigned long fc, void *param, const u8 ** src,
+    unsigned long *srclen);
+int cpacf_soft_kimd(unsigned long fc, void *param, const u8 ** src,
+    long *srclen);
+int cpacf_soft_klmd(unsigned long fc, void *param, const u8 ** src,
+    long *srclen);
+int cpacf_soft_prno(unsigned long fc, void *param, u8 ** out1,
+    unsigned long *out1len, u8 ** out2, unsigned long *out2len);
+unsigned long cpacf_soft_stfle(u64 flist[], u8 nmemb);
+
+/*
+ * Emulated wrapping key.
+ * cpacf_soft_wrap computes WKa(K) and the current WKaVP for a clear key K
+ * of keylen <= CPACF_SOFT_MAX_KEYLEN bytes. wkvp may point directly
+ * behind wkakey. cpacf_soft_wk_rotate replaces the WK such that all
+ * previously wrapped keys fail with cc 1. Only the current and the
+ * previous WK are kept.
+ * cpacf_soft_wk_pin makes the calling thread's instances use the current
+ * WK until cpacf_soft_wk_unpin, so an instruction re-executed after
+ * partial completion is not affected by a WK replacement in between.
+ * Instances using a WK must run pinned. cpacf_soft_wk_rotate waits for
+ * threads still pinned to the previous WK.
+ */
+void cpacf_soft_wrap(u8 * wkakey, u8 wkvp[32], const u8 * key, size_t keylen);
+void cpacf_soft_wk_rotate(void);
+void cpacf_soft_wk_pin(void);
+void cpacf_soft_wk_unpin(void);
+
+#endif
@@ -0,0 +1,690 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "zpc/ctx_pool.h"
+#include "zpc/aes_ecb.h"
+#include "zpc/aes_cbc.h"
+#include "zpc/aes_cmac.h"
+#include "zpc/aes_ccm.h"
+#include "zpc/aes_gcm.h"
+#include "zpc/hmac.h"
+#include "zpc/ecdsa_ctx.h"
+#include "zpc/error.h"
+
+#include "ctx_pool.h"
+#include "aes_ecb_local.h"
+#include "aes_cbc_local.h"
+#include "aes_cmac_local.h"
+#include "aes_ccm_local.h"
+#include "aes_gcm_local.h"
+#include "hmac_local.h"
+#include "ecdsa_ctx_local.h"
+#include "globals.h"
+#include "misc.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pools per thread with a free list, and free contexts per list. */
+#define POOL_SLOTS	8
+#define POOL_SLOT_CTXS	32
+
+struct zpc_ctx_pool {
+	u64 id;			/* never reused, 0 is an unused slot */
+	zpc_ctx_pool_type_t type;
+	void *key;
+
+	pthread_mutex_t lock;	/* protects the fields below */
+	void **all;		/* contexts allocated for the pool */
+	void **free;		/* shared free list */
+	size_t nall, nfree, max;
+
+	struct zpc_ctx_pool *next;	/* pool_list */
+};
+
+/* Per-thread free list of a pool. */
+struct pool_slot {
+	u64 id;
+	unsigned int n;
+	void *ctx[POOL_SLOT_CTXS];
+};
+
+struct pool_thread {
+	struct pool_slot slot[POOL_SLOTS];
+	unsigned int next;	/* slot to evict */
+};
+
+static __thread struct pool_thread *pool_self;
+
+static pthread_key_t pool_key;
+static int pool_key_created;
+
+/* Protects the fields below. Taken before a pool's lock. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zpc_ctx_pool *pool_list;
+static u64 pool_next_id = 1;
+
+static int
+pool_ctx_new(const struct zpc_ctx_pool *pool, void **ctx)
+{
+	int rc = ZPC_ERROR_ARG2RANGE;
+
+	*ctx = NULL;
+
+	switch (pool->type) {
+	case ZPC_CTX_POOL_AES_ECB:
+		rc = zpc_aes_ecb_alloc((struct zpc_aes_ecb **)ctx);
+		if (rc == 0)
+			rc = zpc_aes_ecb_set_key(*ctx, pool->key);
+		break;
+	case ZPC_CTX_POOL_AES_CBC:
+		rc = zpc_aes_cbc_alloc((struct zpc_aes_cbc **)ctx);
+		if (rc == 0)
+			rc = zpc_aes_cbc_set_key(*ctx, pool->key);
+		break;
+	case ZPC_CTX_POOL_AES_CMAC:
+		rc = zpc_aes_cmac_alloc((struct zpc_aes_cmac **)ctx);
+		if (rc == 0)
+			rc = zpc_aes_cmac_set_key(*ctx, pool->key);
+		break;
+	case ZPC_CTX_POOL_AES_CCM:
+		rc = zpc_aes_ccm_alloc((struct zpc_aes_ccm **)ctx);
+		if (rc == 0)
+			rc = zpc_aes_ccm_set_key(*ctx, pool->key);
+		break;
+	case ZPC_CTX_POOL_AES_GCM:
+		rc = zpc_aes_gcm_alloc((struct zpc_aes_gcm **)ctx);
+		if (rc == 0)
+			rc = zpc_aes_gcm_set_key(*ctx, pool->key);
+		break;
+	case ZPC_CTX_POOL_HMAC:
+		rc = zpc_hmac_alloc((struct zpc_hmac **)ctx);
+		if (rc == 0)
+			rc = zpc_hmac_set_key(*ctx, pool->key);
+		break;
+	case ZPC_CTX_POOL_ECDSA:
+		rc = zpc_ecdsa_ctx_alloc((struct zpc_ecdsa_ctx **)ctx);
+		if (rc == 0)
+			rc = zpc_ecdsa_ctx_set_key(*ctx, pool->key);
+		break;
+	}
+
+	return rc;
+}
+
+static void
+pool_ctx_free(const struct zpc_ctx_pool *pool, void **ctx)
+{
+	switch (pool->type) {
+	case ZPC_CTX_POOL_AES_ECB:
+		zpc_aes_ecb_free((struct zpc_aes_ecb **)ctx);
+		break;
+	case ZPC_CTX_POOL_AES_CBC:
+		zpc_aes_cbc_free((struct zpc_aes_cbc **)ctx);
+		break;
+	case ZPC_CTX_POOL_AES_CMAC:
+		zpc_aes_cmac_free((struct zpc_aes_cmac **)ctx);
+		break;
+	case ZPC_CTX_POOL_AES_CCM:
+		zpc_aes_ccm_free((struct zpc_aes_ccm **)ctx);
+		break;
+	case ZPC_CTX_POOL_AES_GCM:
+		zpc_aes_gcm_free((struct zpc_aes_gcm **)ctx);
+		break;
+	case ZPC_CTX_POOL_HMAC:
+		zpc_hmac_free((struct zpc_hmac **)ctx);
+		break;
+	case ZPC_CTX_POOL_ECDSA:
+		zpc_ecdsa_ctx_free((struct zpc_ecdsa_ctx **)ctx);
+		break;
+	}
+}
+
+/* Reset the iv and streaming state. Returns the context's key. */
+static const void *
+pool_ctx_reset(const struct zpc_ctx_pool *pool, void *ctx)
+{
+	const void *key = NULL;
+
+	switch (pool->type) {
+	case ZPC_CTX_POOL_AES_ECB:
+		aes_ecb_reset_state(ctx);
+		key = ((struct zpc_aes_ecb *)ctx)->aes_key;
+		break;
+	case ZPC_CTX_POOL_AES_CBC:
+		aes_cbc_reset_state(ctx);
+		key = ((struct zpc_aes_cbc *)ctx)->aes_key;
+		break;
+	case ZPC_CTX_POOL_AES_CMAC:
+		aes_cmac_reset_state(ctx);
+		key = ((struct zpc_aes_cmac *)ctx)->aes_key;
+		break;
+	case ZPC_CTX_POOL_AES_CCM:
+		aes_ccm_reset_state(ctx);
+		key = ((struct zpc_aes_ccm *)ctx)->aes_key;
+		break;
+	case ZPC_CTX_POOL_AES_GCM:
+		aes_gcm_reset_state(ctx);
+		key = ((struct zpc_aes_gcm *)ctx)->aes_key;
+		break;
+	case ZPC_CTX_POOL_HMAC:
+		hmac_reset_state(ctx);
+		key = ((struct zpc_hmac *)ctx)->hmac_key;
+		break;
+	case ZPC_CTX_POOL_ECDSA:
+		ecdsa_ctx_reset_state(ctx);
+		key = ((struct zpc_ecdsa_ctx *)ctx)->ec_key;
+		break;
+	}
+
+	return key;
+}
+
+/* The context's pool membership. */
+static struct ctx_pool_mark *
+pool_ctx_mark(const struct zpc_ctx_pool *pool, void *ctx)
+{
+	struct ctx_pool_mark *mark = NULL;
+
+	switch (pool->type) {
+	case ZPC_CTX_POOL_AES_ECB:
+		mark = &((struct zpc_aes_ecb *)ctx)->pool;
+		break;
+	case ZPC_CTX_POOL_AES_CBC:
+		mark = &((struct zpc_aes_cbc *)ctx)->pool;
+		break;
+	case ZPC_CTX_POOL_AES_CMAC:
+		mark = &((struct zpc_aes_cmac *)ctx)->pool;
+		break;
+	case ZPC_CTX_POOL_AES_CCM:
+		mark = &((struct zpc_aes_ccm *)ctx)->pool;
+		break;
+	case ZPC_CTX_POOL_AES_GCM:
+		mark = &((struct zpc_aes_gcm *)ctx)->pool;
+		break;
+	case ZPC_CTX_POOL_HMAC:
+		mark = &((struct zpc_hmac *)ctx)->pool;
+		break;
+	case ZPC_CTX_POOL_ECDSA:
+		mark = &((struct zpc_ecdsa_ctx *)ctx)->pool;
+		break;
+	}
+
+	return mark;
+}
+
+/* Hand out a context taken off a free list. */
+static void
+pool_ctx_take(const struct zpc_ctx_pool *pool, void *ctx)
+{
+	int was_free;
+
+	was_free = __atomic_exchange_n(&pool_ctx_mark(pool, ctx)->free, 0,
+	    __ATOMIC_ACQUIRE);
+	assert(was_free == 1);
+	UNUSED(was_free);
+}
+
+/* Move a thread's free list back to its pool, unless it has been freed. */
+static void
+pool_slot_flush(struct pool_slot *slot)
+{
+	struct zpc_ctx_pool *pool;
+	int rc;
+
+	UNUSED(rc);
+
+	if (slot->id == 0)
+		return;
+
+	rc = pthread_mutex_lock(&pool_lock);
+	assert(rc == 0);
+
+	for (pool = pool_list; pool != NULL; pool = pool->next) {
+		if (pool->id == slot->id)
+			break;
+	}
+	if (pool != NULL) {
+		rc = pthread_mutex_lock(&pool->lock);
+		assert(rc == 0);
+		assert(pool->nfree + slot->n <= pool->max);
+		memcpy(pool->free + pool->nfree, slot->ctx,
+		    slot->n * sizeof(slot->ctx[0]));
+		pool->nfree += slot->n;
+		rc = pthread_mutex_unlock(&pool->lock);
+		assert(rc == 0);
+	}
+
+	rc = pthread_mutex_unlock(&pool_lock);
+	assert(rc == 0);
+
+	slot->id = 0;
+	slot->n = 0;
+}
+
+static void
+pool_thread_exit(void *p)
+{
+	struct pool_thread *self = p;
+	size_t i;
+
+	for (i = 0; i < NMEMB(self->slot); i++)
+		pool_slot_flush(&self->slot[i]);
+
+	free(self);
+	pool_self = NULL;
+}
+
+/*
+ * The calling thread's free list of pool. If the thread has none, a
+ * slot is taken over. Returns NULL if there is no per-thread memory.
+ */
+static struct pool_slot *
+pool_slot_get(const struct zpc_ctx_pool *pool)
+{
+	struct pool_thread *self = pool_self;
+	struct pool_slot *slot;
+	size_t i;
+
+	if (self == NULL) {
+		if (!__atomic_load_n(&pool_key_created, __ATOMIC_ACQUIRE))
+			return NULL;
+		self = calloc(1, sizeof(*self));
+		if (self == NULL)
+			return NULL;
+		if (pthread_setspecific(pool_key, self) != 0) {
+			free(self);
+			return NULL;
+		}
+		pool_self = self;
+	}
+
+	for (i = 0; i < NMEMB(self->slot); i++) {
+		if (self->slot[i].id == pool->id)
+			return &self->slot[i];
+	}
+	for (i = 0; i < NMEMB(self->slot); i++) {
+		if (self->slot[i].id == 0)
+			break;
+	}
+	if (i == NMEMB(self->slot)) {
+		i = self->next++ % NMEMB(self->slot);
+		pool_slot_flush(&self->slot[i]);
+	}
+
+	slot = &self->slot[i];
+	slot->id = pool->id;
+	return slot;
+}
+
+/* Allocate a context and add it to the pool. */
+static int
+pool_grow(struct zpc_ctx_pool *pool, void **ctx)
+{
+	void **all, **free_;
+	size_t max;
+	int rc, rv;
+
+	UNUSED(rv);
+
+	rc = pool_ctx_new(pool, ctx);
+	if (rc != 0) {
+		pool_ctx_free(pool, ctx);
+		return rc;
+	}
+	pool_ctx_mark(pool, *ctx)->pool_id = pool->id;
+
+	rv = pthread_mutex_lock(&pool->lock);
+	assert(rv == 0);
+
+	if (pool->nall == pool->max) {
+		max = pool->max ? 2 * pool->max : POOL_SLOT_CTXS;
+		all = realloc(pool->all, max * sizeof(*all));
+		if (all != NULL)
+			pool->all = all;
+		free_ = realloc(pool->free, max * sizeof(*free_));
+		if (free_ != NULL)
+			pool->free = free_;
+		if (all == NULL || free_ == NULL) {
+			rv = pthread_mutex_unlock(&pool->lock);
+			assert(rv == 0);
+			pool_ctx_free(pool, ctx);
+			return ZPC_ERROR_MALLOC;
+		}
+		pool->max = max;
+	}
+	pool->all[pool->nall++] = *ctx;
+
+	rv = pthread_mutex_unlock(&pool->lock);
+	assert(rv == 0);
+	return 0;
+}
+
+static int
+pool_alloc(struct zpc_ctx_pool **pool, zpc_ctx_pool_type_t type, void *key)
+{
+	struct zpc_ctx_pool *new_pool;
+	void *ctx;
+	int rc, rv;
+
+	UNUSED(rv);
+
+	new_pool = calloc(1, sizeof(*new_pool));
+	if (new_pool == NULL)
+		return ZPC_ERROR_MALLOC;
+	rv = pthread_mutex_init(&new_pool->lock, NULL);
+	if (rv) {
+		free(new_pool);
+		return ZPC_ERROR_INITLOCK;
+	}
+	new_pool->type = type;
+	new_pool->key = key;
+
+	rv = pthread_mutex_lock(&pool_lock);
+	assert(rv == 0);
+	new_pool->id = pool_next_id++;
+	rv = pthread_mutex_unlock(&pool_lock);
+	assert(rv == 0);
+
+	/* The first context checks the key and keeps it referenced. */
+	rc = pool_grow(new_pool, &ctx);
+	if (rc != 0) {
+		free(new_pool->all);
+		free(new_pool->free);
+		pthread_mutex_destroy(&new_pool->lock);
+		free(new_pool);
+		return rc;
+	}
+	pool_ctx_mark(new_pool, ctx)->free = 1;
+	new_pool->free[new_pool->nfree++] = ctx;
+
+	rv = pthread_mutex_lock(&pool_lock);
+	assert(rv == 0);
+	new_pool->next = pool_list;
+	pool_list = new_pool;
+	rv = pthread_mutex_unlock(&pool_lock);
+	assert(rv == 0);
+
+	DEBUG("context pool at %p: type %d, key at %p", new_pool, type, key);
+	*pool = new_pool;
+	return 0;
+}
+
+int
+zpc_ctx_pool_alloc_aes(struct zpc_ctx_pool **pool, zpc_ctx_pool_type_t type,
+    struct zpc_aes_key *aes_key)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (pool == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (type != ZPC_CTX_POOL_AES_ECB && type != ZPC_CTX_POOL_AES_CBC
+	    && type != ZPC_CTX_POOL_AES_CMAC && type != ZPC_CTX_POOL_AES_CCM
+	    && type != ZPC_CTX_POOL_AES_GCM) {
+		rc = ZPC_ERROR_ARG2RANGE;
+		goto ret;
+	}
+	if (aes_key == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	rc = pool_alloc(pool, type, aes_key);
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_ctx_pool_alloc_hmac(struct zpc_ctx_pool **pool,
+    struct zpc_hmac_key *hmac_key)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (pool == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (hmac_key == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	rc = pool_alloc(pool, ZPC_CTX_POOL_HMAC, hmac_key);
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_ctx_pool_alloc_ecdsa(struct zpc_ctx_pool **pool,
+    struct zpc_ec_key *ec_key)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (pool == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ec_key == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	rc = pool_alloc(pool, ZPC_CTX_POOL_ECDSA, ec_key);
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_ctx_pool_acquire(struct zpc_ctx_pool *pool, void **ctx)
+{
+	struct pool_slot *slot;
+	size_t n;
+	int rc, rv;
+
+	UNUSED(rv);
+
+	if (pool == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	slot = pool_slot_get(pool);
+	if (slot != NULL && slot->n > 0) {
+		*ctx = slot->ctx[--slot->n];
+		pool_ctx_take(pool, *ctx);
+		rc = 0;
+		goto ret;
+	}
+
+	/* Refill the thread's list from the shared one. */
+	rv = pthread_mutex_lock(&pool->lock);
+	assert(rv == 0);
+	if (pool->nfree > 0) {
+		*ctx = pool->free[--pool->nfree];
+		if (slot != NULL) {
+			n = pool->nfree < POOL_SLOT_CTXS / 2 ?
+			    pool->nfree : POOL_SLOT_CTXS / 2;
+			pool->nfree -= n;
+			memcpy(slot->ctx, pool->free + pool->nfree,
+			    n * sizeof(slot->ctx[0]));
+			slot->n = n;
+		}
+		rv = pthread_mutex_unlock(&pool->lock);
+		assert(rv == 0);
+		pool_ctx_take(pool, *ctx);
+		rc = 0;
+		goto ret;
+	}
+	rv = pthread_mutex_unlock(&pool->lock);
+	assert(rv == 0);
+
+	rc = pool_grow(pool, ctx);
+ret:
+	return rc;
+}
+
+int
+zpc_ctx_pool_release(struct zpc_ctx_pool *pool, void *ctx)
+{
+	struct ctx_pool_mark *mark;
+	struct pool_slot *slot;
+	int rc, rv, in_use;
+
+	UNUSED(rv);
+
+	if (pool == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	/* Another pool's context, or one already released. */
+	mark = pool_ctx_mark(pool, ctx);
+	if (mark->pool_id != pool->id) {
+		rc = ZPC_ERROR_ARG2RANGE;
+		goto ret;
+	}
+	in_use = 0;
+	if (!__atomic_compare_exchange_n(&mark->free, &in_use, 1, 0,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		rc = ZPC_ERROR_ARG2RANGE;
+		goto ret;
+	}
+
+	if (pool_ctx_reset(pool, ctx) != pool->key) {
+		/* The key was changed, the context stays out of use. */
+		__atomic_store_n(&mark->free, 0, __ATOMIC_RELAXED);
+		rc = ZPC_ERROR_ARG2RANGE;
+		goto ret;
+	}
+
+	slot = pool_slot_get(pool);
+	if (slot != NULL && slot->n < POOL_SLOT_CTXS) {
+		slot->ctx[slot->n++] = ctx;
+		rc = 0;
+		goto ret;
+	}
+
+	/* Spill half of the thread's list to the shared one. */
+	rv = pthread_mutex_lock(&pool->lock);
+	assert(rv == 0);
+	if (slot != NULL) {
+		slot->n -= POOL_SLOT_CTXS / 2;
+		memcpy(pool->free + pool->nfree, slot->ctx + slot->n,
+		    POOL_SLOT_CTXS / 2 * sizeof(slot->ctx[0]));
+		pool->nfree += POOL_SLOT_CTXS / 2;
+		slot->ctx[slot->n++] = ctx;
+	} else {
+		pool->free[pool->nfree++] = ctx;
+	}
+	assert(pool->nfree <= pool->nall);
+	rv = pthread_mutex_unlock(&pool->lock);
+	assert(rv == 0);
+	rc = 0;
+ret:
+	return rc;
+}
+
+void
+zpc_ctx_pool_free(struct zpc_ctx_pool **pool)
+{
+	struct zpc_ctx_pool **p;
+	size_t i;
+	int rc;
+
+	UNUSED(rc);
+
+	if (pool == NULL)
+		return;
+	if (*pool == NULL)
+		return;
+
+	/*
+	 * Other threads' lists of the pool are dropped when they are
+	 * flushed, ids are not reused.
+	 */
+	if (pool_self != NULL) {
+		for (i = 0; i < NMEMB(pool_self->slot); i++) {
+			if (pool_self->slot[i].id == (*pool)->id) {
+				pool_self->slot[i].id = 0;
+				pool_self->slot[i].n = 0;
+			}
+		}
+	}
+
+	rc = pthread_mutex_lock(&pool_lock);
+	assert(rc == 0);
+	for (p = &pool_list; *p != NULL; p = &(*p)->next) {
+		if (*p == *pool) {
+			*p = (*pool)->next;
+			break;
+		}
+	}
+	rc = pthread_mutex_unlock(&pool_lock);
+	assert(rc == 0);
+
+	for (i = 0; i < (*pool)->nall; i++)
+		pool_ctx_free(*pool, &(*pool)->all[i]);
+
+	free((*pool)->all);
+	free((*pool)->free);
+	rc = pthread_mutex_destroy(&(*pool)->lock);
+	assert(rc == 0);
+	free(*pool);
+	*pool = NULL;
+	DEBUG("return");
+}
+
+void
+ctx_pool_init(void)
+{
+	if (pthread_key_create(&pool_key, pool_thread_exit) != 0) {
+		DEBUG("creating context pool key failed");
+		return;
+	}
+	__atomic_store_n(&pool_key_created, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Threads may still be running when the library is unloaded,
+ * so their lists are not freed.
+ */
+void
+ctx_pool_fini(void)
+{
+	if (__atomic_load_n(&pool_key_created, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&pool_key_created, 0, __ATOMIC_RELEASE);
+		pthread_key_delete(pool_key);
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef CTX_POOL_H
+# define CTX_POOL_H
+
+/*
+ * Internal context pool interface.
+ *
+ * A pool owns all contexts it has allocated (all) and a shared free
+ * list, both protected by the pool's lock. Each thread has free lists
+ * for up to POOL_SLOTS pools, identified by the pool's id. A thread's
+ * list is moved back to the shared one when the slot is taken over by
+ * another pool and when the thread exits. A pool's id is not reused,
+ * so lists of a freed pool are dropped.
+ */
+
+# include "misc.h"
+
+/* Pool membership of a context, cleared when a context is copied. */
+struct ctx_pool_mark {
+	u64 pool_id;		/* pool the context belongs to, or 0 */
+	int free;		/* atomic, 1 while on one of its free lists */
+};
+
+void ctx_pool_init(void);
+void ctx_pool_fini(void);
+
+#endif
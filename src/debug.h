@@ -10,6 +10,7 @@
 # define DEBUG_H
 
 # include "globals.h"
+# include "trace.h"
 
 # include <assert.h>
 # include <stdio.h>
@@ -20,30 +21,19 @@
 
 # include "misc.h"
 
-# define __FILENAME__ \
-	(strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-
-# define DEBUG(...)													\
-do {																\
-	if (debug) {													\
-		int __rc;													\
-																	\
-		UNUSED(__rc);												\
-																	\
-		__rc = pthread_mutex_lock(&debuglock);						\
-		assert(__rc == 0);											\
-																	\
-		fprintf(stderr, "libzpc %d.%d.%d: pid %llu: tid %llu: %s: %s:%d: ",	\
-				ZPC_VERSION_MAJOR, ZPC_VERSION_MINOR, ZPC_VERSION_PATCH,	\
-			    (unsigned long long)getpid(),						\
-				(unsigned long long)syscall(SYS_gettid),			\
-				__func__, __FILENAME__, __LINE__);					\
-		fprintf(stderr, __VA_ARGS__);								\
-		fprintf(stderr, "\n");										\
-																	\
-		__rc = pthread_mutex_unlock(&debuglock);					\
-		assert(__rc == 0);											\
-	}																\
+/*
+ * The branch is laid out for tracing being off. When it is on, the
+ * message is recorded in the calling thread's trace ring, see trace.h.
+ */
+# define DEBUG(...)							\
+do {									\
+	if (__builtin_expect(debug != 0, 0)) {				\
+		static const struct trace_site __site = {		\
+			__func__, __FILE__, __LINE__			\
+		};							\
+									\
+		trace_log(&__site, __VA_ARGS__);			\
+	}								\
 } while (0)
 
 #endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "drbg.h"
+#include "cpacf.h"
+#include "globals.h"
+#include "misc.h"
+#include "debug.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DRBG_KEYLEN	32
+#define DRBG_SEEDLEN	48	/* key length + block length */
+
+struct drbg {
+	struct cpacf_km_aes_clear_param param;	/* Key */
+	u8 v[16];
+	u64 reseed_counter;
+	unsigned long fork_gen;
+	size_t avail;		/* unused bytes at the end of buf */
+	u8 buf[DRBG_BUFLEN];
+};
+
+static __thread struct drbg *drbg_self;
+
+static pthread_key_t drbg_key;
+static int drbg_key_created;
+static unsigned long drbg_fork_gen;	/* incremented in a child */
+
+static int
+drbg_entropy(u8 *out, size_t len)
+{
+	if (hwcaps.trng) {
+		cpacf_prno(CPACF_PRNO_TRNG, NULL, NULL, 0, out, len);
+		return 0;
+	}
+	return local_rng(out, len);
+}
+
+static void
+drbg_inc(u8 v[16])
+{
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		if (++v[i] != 0)
+			break;
+	}
+}
+
+/* out = AES(Key, ++V) | AES(Key, ++V) | ..., len % 16 == 0 */
+static void
+drbg_ctr(struct drbg *drbg, u8 *out, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += 16) {
+		drbg_inc(drbg->v);
+		memcpy(out + i, drbg->v, 16);
+	}
+	cpacf_km(CPACF_KM_AES_256, &drbg->param, out, out, len);
+}
+
+/* CTR_DRBG_Update */
+static void
+drbg_update(struct drbg *drbg, const u8 provided[DRBG_SEEDLEN])
+{
+	u8 temp[DRBG_SEEDLEN];
+	size_t i;
+
+	drbg_ctr(drbg, temp, sizeof(temp));
+	if (provided != NULL) {
+		for (i = 0; i < sizeof(temp); i++)
+			temp[i] ^= provided[i];
+	}
+	memcpy(drbg->param.key, temp, DRBG_KEYLEN);
+	memcpy(drbg->v, temp + DRBG_KEYLEN, sizeof(drbg->v));
+	memzero_secure(temp, sizeof(temp));
+}
+
+/* CTR_DRBG_Reseed (and CTR_DRBG_Instantiate on a zeroed state). */
+static int
+drbg_seed(struct drbg *drbg)
+{
+	u8 seed[DRBG_SEEDLEN];
+
+	if (drbg_entropy(seed, sizeof(seed)) != 0)
+		return -1;
+	drbg_update(drbg, seed);
+	memzero_secure(seed, sizeof(seed));
+
+	drbg->reseed_counter = 1;
+	drbg->fork_gen = __atomic_load_n(&drbg_fork_gen, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* CTR_DRBG_Generate of a whole buffer. */
+static int
+drbg_refill(struct drbg *drbg)
+{
+	if (drbg->fork_gen != __atomic_load_n(&drbg_fork_gen,
+	    __ATOMIC_RELAXED) || drbg->reseed_counter > DRBG_RESEED_INTERVAL) {
+		DEBUG("drbg at %p: reseed", drbg);
+		if (drbg_seed(drbg) != 0)
+			return -1;
+	}
+
+	drbg_ctr(drbg, drbg->buf, sizeof(drbg->buf));
+	drbg_update(drbg, NULL);
+	drbg->reseed_counter++;
+	drbg->avail = sizeof(drbg->buf);
+	return 0;
+}
+
+static struct drbg *
+drbg_get(void)
+{
+	struct drbg *drbg = drbg_self;
+
+	if (drbg != NULL)
+		return drbg;
+
+	drbg = calloc(1, sizeof(*drbg));
+	if (drbg == NULL)
+		return NULL;
+	if (drbg_seed(drbg) != 0
+	    || pthread_setspecific(drbg_key, drbg) != 0) {
+		memzero_secure(drbg, sizeof(*drbg));
+		free(drbg);
+		return NULL;
+	}
+
+	DEBUG("drbg at %p: instantiated", drbg);
+	drbg_self = drbg;
+	return drbg;
+}
+
+static void
+drbg_thread_exit(void *p)
+{
+	struct drbg *drbg = p;
+
+	memzero_secure(drbg, sizeof(*drbg));
+	free(drbg);
+	drbg_self = NULL;
+}
+
+/*
+ * The child has a copy of the parent's state. Make it reseed and drop
+ * the buffered bytes before the next request.
+ */
+static void
+drbg_atfork_child(void)
+{
+	__atomic_add_fetch(&drbg_fork_gen, 1, __ATOMIC_RELAXED);
+}
+
+int
+drbg_generate(u8 *out, size_t len)
+{
+	struct drbg *drbg;
+	size_t n;
+
+	if (!__atomic_load_n(&drbg_key_created, __ATOMIC_ACQUIRE))
+		return local_rng(out, len);
+
+	drbg = drbg_get();
+	if (drbg == NULL)
+		return -1;
+
+	if (drbg->fork_gen != __atomic_load_n(&drbg_fork_gen,
+	    __ATOMIC_RELAXED)) {
+		memzero_secure(drbg->buf, sizeof(drbg->buf));
+		drbg->avail = 0;
+	}
+
+	while (len > 0) {
+		if (drbg->avail == 0 && drbg_refill(drbg) != 0)
+			return -1;
+
+		n = len < drbg->avail ? len : drbg->avail;
+		memcpy(out, drbg->buf + sizeof(drbg->buf) - drbg->avail, n);
+		memzero_secure(drbg->buf + sizeof(drbg->buf) - drbg->avail, n);
+		drbg->avail -= n;
+		out += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+void
+drbg_init(void)
+{
+	if (!hwcaps.drbg) {
+		DEBUG("drbg not available, using getrandom");
+		return;
+	}
+
+	if (pthread_key_create(&drbg_key, drbg_thread_exit) != 0) {
+		DEBUG("creating drbg key failed");
+		return;
+	}
+	if (pthread_atfork(NULL, NULL, drbg_atfork_child) != 0) {
+		DEBUG("registering drbg fork handler failed");
+		pthread_key_delete(drbg_key);
+		return;
+	}
+
+	__atomic_store_n(&drbg_key_created, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Threads may still be running when the library is unloaded,
+ * so their states are not freed.
+ */
+void
+drbg_fini(void)
+{
+	if (__atomic_load_n(&drbg_key_created, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&drbg_key_created, 0, __ATOMIC_RELEASE);
+		pthread_key_delete(drbg_key);
+	}
+}
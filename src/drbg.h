@@ -0,0 +1,34 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef DRBG_H
+# define DRBG_H
+
+/*
+ * Per-thread buffered random bit generator.
+ *
+ * Each thread has its own CTR_DRBG (NIST SP 800-90A, AES-256, no
+ * derivation function) seeded from the CPACF TRNG or getrandom(). A
+ * generate request fills a buffer of DRBG_BUFLEN bytes, which is
+ * handed out in pieces, so most requests are a memcpy. Handed out bytes
+ * are wiped from the buffer. The generator is reseeded after
+ * DRBG_RESEED_INTERVAL requests and in a child after fork.
+ *
+ * Without clear-key AES, or before drbg_init and after drbg_fini,
+ * drbg_generate reads from getrandom() directly.
+ */
+
+# include "misc.h"
+
+# define DRBG_BUFLEN			4096
+# define DRBG_RESEED_INTERVAL		4096
+
+void drbg_init(void);
+void drbg_fini(void);
+int drbg_generate(u8 *out, size_t len);
+
+#endif
@@ -16,6 +16,9 @@
 #include "globals.h"
 #include "debug.h"
 #include "misc.h"
+#include "stats.h"
+#include "pkey_io.h"
+#include "seqlock.h"
 #include "zkey/pkey.h"
 
 #include <assert.h>
@@ -55,7 +58,10 @@ static int ec_key_blob_has_valid_mkvp(struct zpc_ec_key *ec_key,
 static int ec_key_blob_is_pkey_extractable(struct zpc_ec_key *ec_key,
 						const unsigned char *buf);
 static int ec_key_apqns_have_valid_version(struct zpc_ec_key *ec_key);
-int ec_key_pvsec2prot(struct zpc_ec_key *ec_key);
+static int ec_key_pvsec2prot(struct zpc_ec_key *ec_key,
+		struct pkey_ecprotkey *prot);
+static void ec_key_set_prot(struct zpc_ec_key *ec_key,
+		const struct pkey_ecprotkey *prot);
 int ec_key_blob_is_valid_pvsecret_id(struct zpc_ec_key *ec_key,
 						const unsigned char *id);
 
@@ -143,10 +149,10 @@ int zpc_ec_key_set_curve(struct zpc_ec_key *ec_key, zpc_ec_curve_t curve)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -211,10 +217,10 @@ int zpc_ec_key_set_type(struct zpc_ec_key *ec_key, int type)
 	else if (!swcaps.uv_pvsecrets && type == ZPC_EC_KEY_TYPE_PVSECRET)
 		return ZPC_ERROR_UV_PVSECRETS_NOT_AVAILABLE;
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -265,10 +271,10 @@ int zpc_ec_key_set_flags(struct zpc_ec_key *ec_key, unsigned int flags)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -311,10 +317,10 @@ int zpc_ec_key_set_mkvp(struct zpc_ec_key *ec_key, const char *mkvp)
 	else if (!swcaps.ecdsa_ep11 && ec_key->type == ZPC_EC_KEY_TYPE_EP11)
 		return ZPC_ERROR_EP11_HOST_LIB_NOT_AVAILABLE;
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -404,7 +410,7 @@ int zpc_ec_key_set_apqns(struct zpc_ec_key *ec_key, const char *apqns[])
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
 	if (apqns == NULL) {
@@ -424,7 +430,7 @@ int zpc_ec_key_set_apqns(struct zpc_ec_key *ec_key, const char *apqns[])
 
 	for (napqns = 0; apqns[napqns] != NULL; napqns++);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -514,7 +520,7 @@ zpc_ec_key_export(struct zpc_ec_key *ec_key, unsigned char *buf,
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
 	rc = ec_key_check(ec_key);
@@ -580,7 +586,7 @@ int zpc_ec_key_export_public(struct zpc_ec_key *ec_key,
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
 	if (!ec_key->pubkey_set) {
@@ -631,10 +637,10 @@ int zpc_ec_key_import(struct zpc_ec_key *ec_key, const unsigned char *buf,
 		return ZPC_ERROR_ARG2NULL;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -823,10 +829,10 @@ int zpc_ec_key_import_clear(struct zpc_ec_key *ec_key, const unsigned char *pubk
 			return ZPC_ERROR_EP11_HOST_LIB_NOT_AVAILABLE;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -857,7 +863,9 @@ int zpc_ec_key_import_clear(struct zpc_ec_key *ec_key, const unsigned char *pubk
 	if (privkey && privlen > 0) {
 		memset(&ec_key->cur, 0, sizeof(ec_key->cur));
 		memset(&ec_key->old, 0, sizeof(ec_key->old));
+		seq_write_begin(&ec_key->prot_seq);
 		memset(&ec_key->prot, 0, sizeof(ec_key->prot));
+		seq_write_end(&ec_key->prot_seq);
 		ec_key->key_set = 0;
 
 		rc = ec_key_clr2sec(ec_key, flags, pubkey, publen, privkey, privlen);
@@ -867,7 +875,8 @@ int zpc_ec_key_import_clear(struct zpc_ec_key *ec_key, const unsigned char *pubk
 
 		rc = ec_key_clr2prot(ec_key, privkey, privlen);
 		if (rc) {
-			rc = ec_key_sec2prot(ec_key, EC_KEY_SEC_CUR);
+			rc = ec_key_sec2prot(ec_key, EC_KEY_SEC_CUR,
+			    PKEY_RETRY_BUDGET_NS);
 			if (rc) {
 				goto ret;
 			}
@@ -952,10 +961,10 @@ int zpc_ec_key_generate(struct zpc_ec_key *ec_key)
 	else if (!swcaps.ecdsa_ep11 && ec_key->type == ZPC_EC_KEY_TYPE_EP11)
 		return ZPC_ERROR_EP11_HOST_LIB_NOT_AVAILABLE;
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
-	if (ec_key->refcount != 1) {
+	if (__atomic_load_n(&ec_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -1036,7 +1045,7 @@ int zpc_ec_key_generate(struct zpc_ec_key *ec_key)
 	ec_key->pubkey_set = 1;
 
 	/* Transform secure key into protected key */
-	rc = ec_key_sec2prot(ec_key, EC_KEY_SEC_CUR);
+	rc = ec_key_sec2prot(ec_key, EC_KEY_SEC_CUR, PKEY_RETRY_BUDGET_NS);
 	if (rc)
 		goto ret;
 
@@ -1077,7 +1086,7 @@ int zpc_ec_key_reencipher(struct zpc_ec_key *ec_key, unsigned int method)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
+	rv = stats_mutex_lock(&ec_key->lock);
 	assert(rv == 0);
 
 	if (ec_key->key_set == 0) {
@@ -1182,7 +1191,8 @@ ret:
 
 void zpc_ec_key_free(struct zpc_ec_key **ec_key)
 {
-	int rv, free_obj = 0;
+	unsigned long long refcount;
+	int rv;
 
 	UNUSED(rv);
 
@@ -1191,30 +1201,27 @@ void zpc_ec_key_free(struct zpc_ec_key **ec_key)
 	if (*ec_key == NULL)
 		return;
 
-	rv = pthread_mutex_lock(&(*ec_key)->lock);
-	assert(rv == 0);
-
-	if ((*ec_key)->refcount == 0)
-		goto ret;
-
-	(*ec_key)->refcount--;
-	DEBUG("ec key at %p: refcount %llu", *ec_key, (*ec_key)->refcount);
+	refcount = __atomic_load_n(&(*ec_key)->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0)
+			goto ret;
+	} while (!__atomic_compare_exchange_n(&(*ec_key)->refcount, &refcount,
+	    refcount - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	DEBUG("ec key at %p: refcount %llu", *ec_key, refcount - 1);
 
-	if ((*ec_key)->refcount == 0) {
-		free_obj = 1;
+	if (refcount == 1) {
+		rv = stats_mutex_lock(&(*ec_key)->lock);
+		assert(rv == 0);
 		__ec_key_reset(*ec_key);
-	}
-
-ret:
-	rv = pthread_mutex_unlock(&(*ec_key)->lock);
-	assert(rv == 0);
+		rv = pthread_mutex_unlock(&(*ec_key)->lock);
+		assert(rv == 0);
 
-	if (free_obj == 1) {
 		rv = pthread_mutex_destroy(&(*ec_key)->lock);
 		assert(rv == 0);
 
 		free(*ec_key);
 	}
+ret:
 	*ec_key = NULL;
 	DEBUG("return");
 }
@@ -1230,7 +1237,9 @@ static void __ec_key_reset(struct zpc_ec_key *ec_key)
 
 	memset(&ec_key->cur, 0, sizeof(ec_key->cur));
 	memset(&ec_key->old, 0, sizeof(ec_key->old));
+	seq_write_begin(&ec_key->prot_seq);
 	memset(&ec_key->prot, 0, sizeof(ec_key->prot));
+	seq_write_end(&ec_key->prot_seq);
 	memset(&ec_key->pub, 0, sizeof(ec_key->pub));
 	ec_key->key_set = 0;
 	ec_key->pubkey_set = 0;
@@ -1253,7 +1262,7 @@ static void __ec_key_reset(struct zpc_ec_key *ec_key)
 	ec_key->napqns = 0;
 	ec_key->apqns_set = 0;
 
-	ec_key->refcount = 1;
+	__atomic_store_n(&ec_key->refcount, 1, __ATOMIC_RELAXED);
 }
 
 u16 ecprotkeylen_from_pvsectype(u16 pvsectype)
@@ -1304,7 +1313,7 @@ int ec_key_blob_is_valid_pvsecret_id(struct zpc_ec_key *ec_key, const unsigned c
 	io.keylen = sizeof(struct uvrsecrettoken);
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
 	if (rc != 0) {
 		DEBUG("ec key at %p: PKEY_VERIFYKEY2 ioctl failed, errno = %d", ec_key, errno);
 		return ZPC_ERROR_IOCTLVERIFYKEY2;
@@ -1317,7 +1326,8 @@ int ec_key_blob_is_valid_pvsecret_id(struct zpc_ec_key *ec_key, const unsigned c
  * (Re)derive protected key from a retrievable secret ID.
  * Caller must hold aes_key's wr lock.
  */
-int ec_key_pvsec2prot(struct zpc_ec_key *ec_key)
+static int ec_key_pvsec2prot(struct zpc_ec_key *ec_key,
+		struct pkey_ecprotkey *prot)
 {
 	struct pkey_kblob2pkey3 io;
 	unsigned char buf[sizeof(struct uvrsecrettoken)] = { 0, };
@@ -1329,11 +1339,11 @@ int ec_key_pvsec2prot(struct zpc_ec_key *ec_key)
 	io.key = buf;
 	io.keylen = sizeof(struct uvrsecrettoken);
 	io.pkeytype = ec_key->type;
-	io.pkeylen = sizeof(ec_key->prot.protkey);
-	io.pkey = (unsigned char *)&ec_key->prot.protkey;
+	io.pkeylen = sizeof(prot->protkey);
+	io.pkey = (unsigned char *)&prot->protkey;
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
 		DEBUG("ec key at %p: PKEY_VERIFYKEY2 ioctl failed, errno = %d", ec_key, errno);
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
@@ -1393,15 +1403,18 @@ int ec_key_clr2sec(struct zpc_ec_key *ec_key, unsigned int flags,
 }
 
 /*
- * (Re)derive protected key from a secure key.
+ * (Re)derive protected key from a secure key. Busy pkey requests are
+ * retried for up to budget_ns, see pkey_ioctl_retry.
  * Caller must hold ec_key's wr lock.
  */
-int ec_key_sec2prot(struct zpc_ec_key *ec_key, enum ec_key_sec sec)
+int ec_key_sec2prot(struct zpc_ec_key *ec_key, enum ec_key_sec sec,
+		u64 budget_ns)
 {
 	struct pkey_kblob2pkey3 io;
+	struct pkey_ecprotkey prot;
 	struct ec_key *key = NULL;
 	unsigned int keybuf_len;
-	int rc, i;
+	int rc;
 
 	assert(sec == EC_KEY_SEC_OLD || sec == EC_KEY_SEC_CUR);
 
@@ -1411,9 +1424,13 @@ int ec_key_sec2prot(struct zpc_ec_key *ec_key, enum ec_key_sec sec)
 		key = &ec_key->old;
 	assert(key != NULL);
 
-	if (ec_key->type == ZPC_EC_KEY_TYPE_PVSECRET)
-		return ec_key_pvsec2prot(ec_key);
-	else if (ec_key->type == ZPC_EC_KEY_TYPE_EP11)
+	/* Derive aside, readers keep using the current protected key. */
+	memcpy(&prot, &ec_key->prot, sizeof(prot));
+
+	if (ec_key->type == ZPC_EC_KEY_TYPE_PVSECRET) {
+		rc = ec_key_pvsec2prot(ec_key, &prot);
+		goto done;
+	} else if (ec_key->type == ZPC_EC_KEY_TYPE_EP11)
 		keybuf_len = key->seclen + sizeof(struct ep11kblob_header);
 	else
 		keybuf_len = key->seclen;
@@ -1424,27 +1441,106 @@ int ec_key_sec2prot(struct zpc_ec_key *ec_key, enum ec_key_sec sec)
 	io.apqns = ec_key->apqns;
 	io.apqn_entries = ec_key->napqns;
 	io.pkeytype = (ec_key->type == ZPC_EC_KEY_TYPE_CCA ? PKEY_TYPE_CCA_ECC : PKEY_TYPE_EP11_ECC);
-	io.pkeylen = sizeof(ec_key->prot.protkey);
-	io.pkey = (unsigned char *)&ec_key->prot.protkey;
+	io.pkeylen = sizeof(prot.protkey);
+	io.pkey = (unsigned char *)&prot.protkey;
 
-	for (i = 0; i < 10; i++) {
-		rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
-		if (rc == 0 || (errno != -EBUSY && errno != -EAGAIN))
-			break;
-		sleep(1);
+	rc = pkey_ioctl_retry(pkeyfd, PKEY_KBLOB2PROTK3, &io, budget_ns);
+
+	if (rc != 0)
+		rc = ZPC_ERROR_IOCTLBLOB2PROTK3;
+done:
+	if (rc == 0)
+		ec_key_set_prot(ec_key, &prot);
+	memzero_secure(&prot, sizeof(prot));
+	return rc;
+}
+
+/*
+ * Install a new protected key. The generation tells contexts with an
+ * older copy that they can just update it.
+ * Caller must hold ec_key's lock.
+ */
+static void ec_key_set_prot(struct zpc_ec_key *ec_key,
+		const struct pkey_ecprotkey *prot)
+{
+	seq_write_begin(&ec_key->prot_seq);
+	memcpy(&ec_key->prot, prot, sizeof(ec_key->prot));
+	ec_key->prot_gen++;
+	seq_write_end(&ec_key->prot_seq);
+}
+
+/*
+ * Take a reference. Does not take ec_key's lock.
+ */
+void ec_key_ref(struct zpc_ec_key *ec_key)
+{
+	unsigned long long refcount;
+
+	refcount = __atomic_add_fetch(&ec_key->refcount, 1, __ATOMIC_RELAXED);
+	DEBUG("ec key at %p: refcount %llu", ec_key, refcount);
+}
+
+/*
+ * Copy the first len bytes of the protected key and its generation.
+ * Does not take ec_key's lock.
+ */
+void ec_key_get_prot(const struct zpc_ec_key *ec_key, void *protkey,
+		size_t len, unsigned long long *gen)
+{
+	unsigned int seq;
+
+	assert(len <= sizeof(ec_key->prot.protkey));
+
+	do {
+		seq = seq_read_begin(&ec_key->prot_seq);
+		memcpy(protkey, ec_key->prot.protkey, len);
+		*gen = ec_key->prot_gen;
+	} while (seq_read_retry(&ec_key->prot_seq, seq));
+}
+
+/*
+ * Update a context's copy of the protected key after a wrapping key
+ * verification pattern mismatch: take the key's protected key if it is
+ * newer than the copy, otherwise re-derive it. Only a re-derivation
+ * takes ec_key's lock.
+ */
+int ec_key_update_prot(struct zpc_ec_key *ec_key, enum ec_key_sec sec,
+		void *protkey, size_t len, unsigned long long *gen)
+{
+	unsigned long long cur;
+	int rc = 0, rv;
+
+	UNUSED(rv);
+
+	ec_key_get_prot(ec_key, protkey, len, &cur);
+	if (cur != *gen) {
+		/* Another context re-derived it already. */
+		*gen = cur;
+		return 0;
 	}
 
-	if (rc != 0) {
-		return ZPC_ERROR_IOCTLBLOB2PROTK3;
+	rv = stats_mutex_lock(&ec_key->lock);
+	assert(rv == 0);
+
+	if (ec_key->prot_gen == *gen) {
+		DEBUG("ec key at %p: re-derive protected key from %s secure key",
+		    ec_key, sec == EC_KEY_SEC_CUR ? "current" : "old");
+		stats_inc(STATS_REDERIVE);
+		rc = ec_key_sec2prot(ec_key, sec, PKEY_RETRY_LOCKED_NS);
 	}
+	memcpy(protkey, ec_key->prot.protkey, len);
+	*gen = ec_key->prot_gen;
 
-	return 0;
+	rv = pthread_mutex_unlock(&ec_key->lock);
+	assert(rv == 0);
+	return rc;
 }
 
 int ec_key_clr2prot(struct zpc_ec_key *ec_key, const unsigned char *privkey,
 					unsigned int privlen)
 {
 	struct pkey_kblob2pkey3 io;
+	struct pkey_ecprotkey prot;
 	unsigned char buf[sizeof(struct clearkeytoken) + 80];
 	struct clearkeytoken *clrtok = (struct clearkeytoken *)&buf;
 	int rc;
@@ -1492,14 +1588,18 @@ int ec_key_clr2prot(struct zpc_ec_key *ec_key, const unsigned char *privkey,
 	io.apqns = ec_key->apqns;
 	io.apqn_entries = ec_key->napqns;
 	io.pkeytype = (ec_key->type == ZPC_EC_KEY_TYPE_CCA ? PKEY_TYPE_CCA_ECC : PKEY_TYPE_EP11_ECC);
-	io.pkeylen = sizeof(ec_key->prot.protkey);
-	io.pkey = (unsigned char *)&ec_key->prot.protkey;
+	memcpy(&prot, &ec_key->prot, sizeof(prot));
+	io.pkeylen = sizeof(prot.protkey);
+	io.pkey = (unsigned char *)&prot.protkey;
 
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
+		memzero_secure(&prot, sizeof(prot));
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
 	}
 
+	ec_key_set_prot(ec_key, &prot);
+	memzero_secure(&prot, sizeof(prot));
 	return 0;
 }
 
@@ -32,6 +32,8 @@ struct zpc_ec_key {
 	struct ec_key cur;     /* old secure key is needed when */
 	struct ec_key old;     /* current is not usable yet */
 	struct pkey_ecprotkey prot;     /* EC protected key derived from sec */
+	unsigned long long prot_gen;    /* incremented when prot changes */
+	unsigned int prot_seq;  /* seqlock.h counter of prot and prot_gen */
 	struct pkey_ecpubkey pub;       /* EC public key in clear form */
 
 	int key_set;
@@ -54,14 +56,20 @@ struct zpc_ec_key {
 	size_t napqns;  /* elements in apqns */
 	int apqns_set;
 
-	unsigned long long refcount;
-	pthread_mutex_t lock;
+	unsigned long long refcount;    /* atomic */
+	pthread_mutex_t lock;   /* writers, readers of prot use prot_seq */
 };
 
 int ec_key_clr2sec(struct zpc_ec_key *ec_key, unsigned int flags,
 			const unsigned char *pubkey, unsigned int publen,
 			const unsigned char *privkey, unsigned int privlen);
-int ec_key_sec2prot(struct zpc_ec_key *, enum ec_key_sec sec);
+int ec_key_sec2prot(struct zpc_ec_key *, enum ec_key_sec sec,
+			u64 budget_ns);
+void ec_key_ref(struct zpc_ec_key *);
+void ec_key_get_prot(const struct zpc_ec_key *, void *protkey, size_t len,
+			unsigned long long *gen);
+int ec_key_update_prot(struct zpc_ec_key *, enum ec_key_sec sec,
+			void *protkey, size_t len, unsigned long long *gen);
 int ec_key_check(const struct zpc_ec_key *);
 int ec_key_clr2prot(struct zpc_ec_key *ec_key, const unsigned char *privkey,
 			unsigned int privlen);
@@ -15,16 +15,21 @@
 #include "cpacf.h"
 #include "globals.h"
 #include "misc.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 extern const size_t curve2siglen[];
+extern const char icv_sha_256[];
+extern const char icv_sha_384[];
+extern const char icv_sha_512[];
 
 static int __ec_sign(struct zpc_ecdsa_ctx *, const unsigned char *hash,
 		unsigned int hash_len, unsigned char *signature, unsigned int *sig_len);
@@ -36,12 +41,18 @@ static void __copy_hash_to_sign_param(struct zpc_ecdsa_ctx *ctx,
 static void __get_signature_from_sign_param(struct zpc_ecdsa_ctx *ctx,
 		unsigned char *signature, unsigned int sig_len);
 static void __copy_pubkey_to_verify_param(struct zpc_ecdsa_ctx *ctx);
-static void __copy_protkey_to_sign_param(struct zpc_ecdsa_ctx *ctx);
+static void __copy_protkey_to_sign_param(struct zpc_ecdsa_ctx *ctx,
+		const u8 *protkey);
 static void __copy_args_to_verify_param(struct zpc_ecdsa_ctx *ctx,
 		const unsigned char *hash, unsigned int hash_len,
 		const unsigned char *signature, unsigned int sig_len);
 static void __cleanup_verify_param(struct zpc_ecdsa_ctx *ctx);
 static void __cleanup_sign_param(struct zpc_ecdsa_ctx *ctx);
+static int __ec_hash_init(struct ecdsa_hash *, zpc_ec_curve_t);
+static void __ec_hash_update(struct ecdsa_hash *, const unsigned char *,
+		size_t);
+static const unsigned char *__ec_hash_final(struct ecdsa_hash *,
+		unsigned int *);
 
 
 size_t group_size[] = { 32, 48, 66 };
@@ -83,7 +94,8 @@ int zpc_ecdsa_ctx_alloc(struct zpc_ecdsa_ctx **ec_ctx)
 
 int zpc_ecdsa_ctx_set_key(struct zpc_ecdsa_ctx *ec_ctx, struct zpc_ec_key *ec_key)
 {
-	int rc, rv;
+	u8 protkey[MAXECPROTKEYSIZE];
+	int rc;
 	const unsigned int fc_sign_from_curve[] = {
 		CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P256,
 		CPACF_KDSA_ENCRYPTED_ECDSA_SIGN_P384,
@@ -99,8 +111,6 @@ int zpc_ecdsa_ctx_set_key(struct zpc_ecdsa_ctx *ec_ctx, struct zpc_ec_key *ec_ke
 		CPACF_KDSA_EDDSA_VERIFY_ED448,
 	};
 
-	UNUSED(rv);
-
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
 		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
@@ -127,9 +137,6 @@ int zpc_ecdsa_ctx_set_key(struct zpc_ecdsa_ctx *ec_ctx, struct zpc_ec_key *ec_ke
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&ec_key->lock);
-	assert(rv == 0);
-
 	rc = ec_key_check(ec_key);
 	if (rc)
 		goto ret;
@@ -140,8 +147,7 @@ int zpc_ecdsa_ctx_set_key(struct zpc_ecdsa_ctx *ec_ctx, struct zpc_ec_key *ec_ke
 		goto ret;
 	}
 
-	ec_key->refcount++;
-	DEBUG("ec key at %p: refcount %llu", ec_key, ec_key->refcount);
+	ec_key_ref(ec_key);
 
 	if (ec_ctx->key_set) {
 		/* If another key is already set, unset it and decrease
@@ -167,16 +173,18 @@ int zpc_ecdsa_ctx_set_key(struct zpc_ecdsa_ctx *ec_ctx, struct zpc_ec_key *ec_ke
 	ec_ctx->ec_key = ec_key;
 	ec_ctx->key_set = 1;
 
-	if (ec_key->key_set)
-		__copy_protkey_to_sign_param(ec_ctx);
+	if (ec_key->key_set) {
+		ec_key_get_prot(ec_key, protkey, sizeof(protkey),
+		    &ec_ctx->key_gen);
+		__copy_protkey_to_sign_param(ec_ctx, protkey);
+		memzero_secure(protkey, sizeof(protkey));
+	}
 
 	if (ec_key->pubkey_set)
 		__copy_pubkey_to_verify_param(ec_ctx);
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&ec_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -185,9 +193,9 @@ int zpc_ecdsa_sign(struct zpc_ecdsa_ctx *ctx,
 			const unsigned char *hash, unsigned int hash_len,
 			unsigned char *signature, unsigned int *sig_len)
 {
-	int rc, rv, i;
-
-	UNUSED(rv);
+	u8 protkey[MAXECPROTKEYSIZE];
+	struct stats_op st = { 0 };
+	int rc, i;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -240,6 +248,7 @@ int zpc_ecdsa_sign(struct zpc_ecdsa_ctx *ctx,
 		goto ret;
 	}
 
+	stats_op_begin(&st, &ctx->stats, ZPC_STATS_OP_ECDSA_SIGN);
 	rc = -1;
 	for (i = 0; i < 2 && rc != 0; i++) {
 		assert(i == EC_KEY_SEC_CUR || i == EC_KEY_SEC_OLD);
@@ -250,17 +259,10 @@ int zpc_ecdsa_sign(struct zpc_ecdsa_ctx *ctx,
 				break;
 			} else {
 				if (rc == ZPC_ERROR_WKVPMISMATCH) {
-					rv = pthread_mutex_lock(&ctx->ec_key->lock);
-					assert(rv == 0);
-
-					DEBUG("ec context at %p: re-derive protected key from %s secure key from ec key at %p",
-						ctx, i == 0 ? "current" : "old", ctx->ec_key);
-					rc = ec_key_sec2prot(ctx->ec_key, i);
-
-					__copy_protkey_to_sign_param(ctx);
-
-					rv = pthread_mutex_unlock(&ctx->ec_key->lock);
-					assert(rv == 0);
+					rc = ec_key_update_prot(ctx->ec_key, i,
+					    protkey, sizeof(protkey), &ctx->key_gen);
+					__copy_protkey_to_sign_param(ctx, protkey);
+					memzero_secure(protkey, sizeof(protkey));
 				}
 				if (rc)
 					break;
@@ -269,6 +271,7 @@ int zpc_ecdsa_sign(struct zpc_ecdsa_ctx *ctx,
 	}
 
 ret:
+	stats_op_end(&st, hash_len);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -277,6 +280,7 @@ int zpc_ecdsa_verify(struct zpc_ecdsa_ctx *ctx,
 			const unsigned char *hash, unsigned int hash_len,
 			const unsigned char *signature, unsigned int sig_len)
 {
+	struct stats_op st = { 0 };
 	int rc, rv;
 
 	UNUSED(rv);
@@ -330,8 +334,373 @@ int zpc_ecdsa_verify(struct zpc_ecdsa_ctx *ctx,
 		goto ret;
 	}
 
+	stats_op_begin(&st, &ctx->stats, ZPC_STATS_OP_ECDSA_VERIFY);
 	rc = __ec_verify(ctx, hash, hash_len, signature, sig_len);
 
+ret:
+	stats_op_end(&st, hash_len);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_sign_message(struct zpc_ecdsa_ctx *ctx,
+			const unsigned char *msg, size_t msg_len,
+			unsigned char *signature, unsigned int *sig_len)
+{
+	struct ecdsa_hash hash;
+	const unsigned char *digest;
+	unsigned int digest_len;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (!ctx->key_set) {
+		rc = ZPC_ERROR_EC_PRIVKEY_NOTSET;
+		goto ret;
+	}
+
+	if (msg == NULL && msg_len > 0) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (sig_len == NULL) {
+		rc = ZPC_ERROR_ARG5NULL;
+		goto ret;
+	}
+
+	if (ctx->ec_key->curve == ZPC_EC_CURVE_ED25519 ||
+		ctx->ec_key->curve == ZPC_EC_CURVE_ED448) {
+		/* EdDSA hashes the message itself. */
+		if (msg_len > UINT_MAX) {
+			rc = ZPC_ERROR_ARG3RANGE;
+			goto ret;
+		}
+		rc = zpc_ecdsa_sign(ctx, msg, msg_len, signature, sig_len);
+		goto ret;
+	}
+
+	if (signature == NULL) {
+		*sig_len = curve2siglen[ctx->ec_key->curve];
+		rc = 0;
+		goto ret;
+	}
+	if (*sig_len < curve2siglen[ctx->ec_key->curve]) {
+		rc = ZPC_ERROR_SMALLOUTBUF;
+		goto ret;
+	}
+
+	rc = __ec_hash_init(&hash, ctx->ec_key->curve);
+	if (rc)
+		goto ret;
+	__ec_hash_update(&hash, msg, msg_len);
+	digest = __ec_hash_final(&hash, &digest_len);
+
+	rc = zpc_ecdsa_sign(ctx, digest, digest_len, signature, sig_len);
+	memzero_secure(&hash, sizeof(hash));
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_verify_message(struct zpc_ecdsa_ctx *ctx,
+			const unsigned char *msg, size_t msg_len,
+			const unsigned char *signature, unsigned int sig_len)
+{
+	struct ecdsa_hash hash;
+	const unsigned char *digest;
+	unsigned int digest_len;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ctx->ec_key == NULL) {
+		rc = ZPC_ERROR_EC_NO_KEY_PARTS;
+		goto ret;
+	}
+
+	if (msg == NULL && msg_len > 0) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+	if (signature == NULL || sig_len == 0) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
+
+	if (ctx->ec_key->curve == ZPC_EC_CURVE_ED25519 ||
+		ctx->ec_key->curve == ZPC_EC_CURVE_ED448) {
+		/* EdDSA hashes the message itself. */
+		if (msg_len > UINT_MAX) {
+			rc = ZPC_ERROR_ARG3RANGE;
+			goto ret;
+		}
+		rc = zpc_ecdsa_verify(ctx, msg, msg_len, signature, sig_len);
+		goto ret;
+	}
+
+	rc = __ec_hash_init(&hash, ctx->ec_key->curve);
+	if (rc)
+		goto ret;
+	__ec_hash_update(&hash, msg, msg_len);
+	digest = __ec_hash_final(&hash, &digest_len);
+
+	rc = zpc_ecdsa_verify(ctx, digest, digest_len, signature, sig_len);
+	memzero_secure(&hash, sizeof(hash));
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_message_init(struct zpc_ecdsa_ctx *ctx)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ctx->ec_key == NULL) {
+		rc = ZPC_ERROR_EC_NO_KEY_PARTS;
+		goto ret;
+	}
+
+	rc = __ec_hash_init(&ctx->hash, ctx->ec_key->curve);
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_message_update(struct zpc_ecdsa_ctx *ctx,
+			const unsigned char *msg, size_t msg_len)
+{
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ctx->ec_key == NULL) {
+		rc = ZPC_ERROR_EC_NO_KEY_PARTS;
+		goto ret;
+	}
+
+	if (msg == NULL && msg_len > 0) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	if (ctx->hash.fc == 0) {
+		rc = __ec_hash_init(&ctx->hash, ctx->ec_key->curve);
+		if (rc)
+			goto ret;
+	}
+
+	__ec_hash_update(&ctx->hash, msg, msg_len);
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_sign_message_final(struct zpc_ecdsa_ctx *ctx,
+			unsigned char *signature, unsigned int *sig_len)
+{
+	const unsigned char *digest;
+	unsigned int digest_len;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	if (!ctx->key_set) {
+		rc = ZPC_ERROR_EC_PRIVKEY_NOTSET;
+		goto ret;
+	}
+
+	if (sig_len == NULL) {
+		rc = ZPC_ERROR_ARG3NULL;
+		goto ret;
+	}
+
+	if (ctx->hash.fc == 0) {
+		rc = __ec_hash_init(&ctx->hash, ctx->ec_key->curve);
+		if (rc)
+			goto ret;
+	}
+
+	if (signature == NULL) {
+		*sig_len = curve2siglen[ctx->ec_key->curve];
+		rc = 0;
+		goto ret;
+	}
+	if (*sig_len < curve2siglen[ctx->ec_key->curve]) {
+		rc = ZPC_ERROR_SMALLOUTBUF;
+		goto ret;
+	}
+
+	digest = __ec_hash_final(&ctx->hash, &digest_len);
+	rc = zpc_ecdsa_sign(ctx, digest, digest_len, signature, sig_len);
+	ecdsa_ctx_reset_state(ctx);
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_verify_message_final(struct zpc_ecdsa_ctx *ctx,
+			const unsigned char *signature, unsigned int sig_len)
+{
+	const unsigned char *digest;
+	unsigned int digest_len;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (ctx->ec_key == NULL) {
+		rc = ZPC_ERROR_EC_NO_KEY_PARTS;
+		goto ret;
+	}
+
+	if (signature == NULL || sig_len == 0) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	if (ctx->hash.fc == 0) {
+		rc = __ec_hash_init(&ctx->hash, ctx->ec_key->curve);
+		if (rc)
+			goto ret;
+	}
+
+	digest = __ec_hash_final(&ctx->hash, &digest_len);
+	rc = zpc_ecdsa_verify(ctx, digest, digest_len, signature, sig_len);
+	ecdsa_ctx_reset_state(ctx);
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_ecdsa_ctx_get_stats(const struct zpc_ecdsa_ctx *ctx,
+		struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	stats_ctx_get(&ctx->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
+
+/*
+ * Drop a streamed message, keep the key (context pool).
+ */
+void ecdsa_ctx_reset_state(struct zpc_ecdsa_ctx *ctx)
+{
+	memzero_secure(&ctx->hash, sizeof(ctx->hash));
+}
+
+int zpc_ecdsa_ctx_dup(struct zpc_ecdsa_ctx **ec_ctx, const struct zpc_ecdsa_ctx *src)
+{
+	struct zpc_ecdsa_ctx *new_ec_ctx = NULL;
+	int rc;
+
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.ecc_kdsa) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (ec_ctx == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_ec_ctx = malloc(sizeof(*new_ec_ctx));
+	if (new_ec_ctx == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
+	}
+	memcpy(new_ec_ctx, src, sizeof(*new_ec_ctx));
+	memset(&new_ec_ctx->stats, 0, sizeof(new_ec_ctx->stats));
+	memset(&new_ec_ctx->pool, 0, sizeof(new_ec_ctx->pool));
+
+	if (new_ec_ctx->key_set)
+		ec_key_ref(new_ec_ctx->ec_key);
+
+	DEBUG("ec-ctx context at %p: copy of %p", new_ec_ctx, src);
+	*ec_ctx = new_ec_ctx;
+	rc = 0;
 ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
@@ -428,6 +797,94 @@ static void __ec_ctx_reset(struct zpc_ecdsa_ctx *ctx)
 
 	ctx->fc_sign = 0;
 	ctx->fc_verify = 0;
+
+	ecdsa_ctx_reset_state(ctx);
+}
+
+/*
+ * Message hashing for the curves whose signature takes a digest. The hash
+ * function matches the curve: SHA-256 for p256, SHA-384 for p384 and
+ * SHA-512 for p521. Whole blocks go to kimd from the caller's buffer,
+ * klmd pads the trailing partial block.
+ */
+static int __ec_hash_init(struct ecdsa_hash *hash, zpc_ec_curve_t curve)
+{
+	memset(hash, 0, sizeof(*hash));
+
+	/* kimd and klmd share the sha-2 function codes. */
+	switch (curve) {
+	case ZPC_EC_CURVE_P256:
+		hash->fc = CPACF_KIMD_SHA_256;
+		hash->digestlen = 32;
+		memcpy(hash->param.klmd_224_256.h, icv_sha_256, 32);
+		break;
+	case ZPC_EC_CURVE_P384:
+		hash->fc = CPACF_KIMD_SHA_512;
+		hash->digestlen = 48;
+		memcpy(hash->param.klmd_384_512.h, icv_sha_384, 64);
+		break;
+	case ZPC_EC_CURVE_P521:
+		hash->fc = CPACF_KIMD_SHA_512;
+		hash->digestlen = 64;
+		memcpy(hash->param.klmd_384_512.h, icv_sha_512, 64);
+		break;
+	default:
+		/* EdDSA signs the message itself, in one pass. */
+		return ZPC_ERROR_EC_INVALID_CURVE;
+	}
+
+	return 0;
+}
+
+static void __ec_hash_update(struct ecdsa_hash *hash,
+				const unsigned char *msg, size_t msg_len)
+{
+	size_t blksize = hash->fc == CPACF_KIMD_SHA_256 ? 64 : 128, n;
+
+	if (msg_len == 0)
+		return;
+
+	hash->msglen += msg_len;
+
+	if (hash->buflen > 0) {
+		n = blksize - hash->buflen;
+		if (n > msg_len)
+			n = msg_len;
+		memcpy(hash->buf + hash->buflen, msg, n);
+		hash->buflen += n;
+		msg += n;
+		msg_len -= n;
+		if (hash->buflen < blksize)
+			return;
+
+		cpacf_kimd(hash->fc, &hash->param, hash->buf, blksize);
+		hash->buflen = 0;
+	}
+
+	n = msg_len / blksize * blksize;
+	if (n > 0)
+		cpacf_kimd(hash->fc, &hash->param, msg, n);
+
+	memcpy(hash->buf, msg + n, msg_len - n);
+	hash->buflen = msg_len - n;
+}
+
+/* The digest is left in the parameter block. */
+static const unsigned char *__ec_hash_final(struct ecdsa_hash *hash,
+				unsigned int *digest_len)
+{
+	*digest_len = hash->digestlen;
+
+	if (hash->fc == CPACF_KIMD_SHA_256) {
+		hash->param.klmd_224_256.mbl = hash->msglen * 8;
+		cpacf_klmd(CPACF_KLMD_SHA_256, &hash->param, hash->buf,
+		    hash->buflen);
+		return hash->param.klmd_224_256.h;
+	}
+
+	hash->param.klmd_384_512.mbl = (u128)hash->msglen * 8;
+	cpacf_klmd(CPACF_KLMD_SHA_512, &hash->param, hash->buf, hash->buflen);
+	return hash->param.klmd_384_512.h;
 }
 
 static void __copy_hash_to_sign_param(struct zpc_ecdsa_ctx *ctx,
@@ -509,10 +966,9 @@ static void __copy_pubkey_to_verify_param(struct zpc_ecdsa_ctx *ctx)
 	}
 }
 
-static void __copy_protkey_to_sign_param(struct zpc_ecdsa_ctx *ctx)
+static void __copy_protkey_to_sign_param(struct zpc_ecdsa_ctx *ctx,
+		const u8 *protkey)
 {
-	u8 *protkey = (unsigned char *)&ctx->ec_key->prot.protkey;
-
 	switch (ctx->ec_key->curve) {
 	case ZPC_EC_CURVE_P256:
 		memcpy(ctx->p256_sign_param.prot, protkey, 32);
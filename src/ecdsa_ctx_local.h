@@ -11,12 +11,23 @@
 # include "zpc/ecc_key.h"
 
 # include "misc.h"
+# include "ctx_pool.h"
 # include "cpacf.h"
 
 /*
  * Internal ecc_ctx interfaces.
  */
 
+/* State of a message hashed for a sign or verify operation. */
+struct ecdsa_hash {
+	struct cpacf_klmd_param param;
+	u8 buf[128];		/* trailing partial block */
+	size_t buflen;
+	unsigned long long msglen;	/* bytes hashed so far */
+	unsigned int fc;	/* kimd/klmd function code, 0 if not started */
+	unsigned int digestlen;
+};
+
 struct zpc_ecdsa_ctx {
 	union {
 		unsigned char signbuf[4096];
@@ -37,9 +48,18 @@ struct zpc_ecdsa_ctx {
 	};
 
 	struct zpc_ec_key *ec_key;
+	unsigned long long key_gen;	/* ec_key->prot_gen of the sign param */
 	int key_set;
 
 	unsigned int fc_sign;
 	unsigned int fc_verify;
+
+	struct ecdsa_hash hash;	/* streamed message */
+
+	struct stats_ctx stats;
+	struct ctx_pool_mark pool;
 };
+
+void ecdsa_ctx_reset_state(struct zpc_ecdsa_ctx *);
+
 #endif
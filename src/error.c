@@ -104,6 +104,10 @@ zpc_error_string(int err)
 		"HMAC key generation via sysfs attributes failed.",
 		"Creating a block-sized HMAC key failed.",
 		"Creating a full-xts key via sysfs attributes failed",
+		"The protected key is being re-derived, try again.",
+		"The invocation counter of the gcm context is exhausted.",
+		"The call does not fit the state of the multi-part ccm operation.",
+		"Invalid PKCS#7 padding.",
 		"LAST"
 	};
 	const char *rc;
@@ -7,8 +7,13 @@
 
 #include "aes_key_local.h"
 #include "cpacf.h"
+#include "ctx_pool.h"
+#include "drbg.h"
+#include "parallel.h"
 #include "globals.h"
 #include "misc.h"
+#include "stats.h"
+#include "pkey_io.h"
 #include "debug.h"
 
 #include <assert.h>
@@ -54,6 +59,7 @@
                          * and MSA4) */
 
 /* STFLE (store facility list extended) */
+#ifndef ZPC_SOFT_CPACF
 static inline unsigned long
 stfle(u64 flist[], u8 nmemb)
 {
@@ -70,6 +76,9 @@ stfle(u64 flist[], u8 nmemb)
 
 	return r0 + 1;
 }
+#else
+# define stfle(flist, nmemb)	cpacf_soft_stfle((flist), (nmemb))
+#endif
 
 /*
  * libzpc is initialized iff pkeyfd >= 0.
@@ -114,11 +123,13 @@ static void zpc_init(void)
 	int rc, err = -1;
 	int aes_ecb_km = 0;
 	int aes_cbc_kmc = 0;
+	int aes_ctr_kmctr = 0;
 	int aes_gcm_kma = 0;
 	int aes_cmac_kmac = 0, aes_cmac_pcc = 0, hmac_kmac = 0;
 	int aes_ccm_kmac = 0, aes_ccm_kma = 0;
 	int aes_xts_km = 0, aes_xts_pcc = 0, aes_xts_full_km = 0;
 	int ecc_kdsa = 0;
+	int drbg_km = 0, trng_prno = 0;
 	int aes_cca = 0, aes_ep11 = 0, ecdsa_cca = 0, ecdsa_ep11 = 0;
 	int uv_pvsecrets = 0;
 	char *env;
@@ -139,6 +150,7 @@ static void zpc_init(void)
 		    && debuglong < INT_MAX)
 			debug = (int)debuglong;
 	}
+	trace_init();
 
 	/* Init CCA library structure. */
 	rc = pthread_mutex_init(&ccalock, NULL);
@@ -184,17 +196,22 @@ static void zpc_init(void)
 		uv_pvsecrets = 1;
 
 	/* Open pkey device */
-	pkeyfd = open("/dev/pkey", O_RDWR);
+	pkeyfd = pkey_io_open();
 	if (pkeyfd < 0) {
-		DEBUG("opening /dev/pkey failed");
+		DEBUG("opening pkey device failed");
 		goto ret;
 	}
-	DEBUG("opened /dev/pkey: file descriptor %d", pkeyfd);
+	if (pkey_io_has_pvsecrets())
+		uv_pvsecrets = 1;
 
+#ifndef ZPC_SOFT_CPACF
 	/* Check for STFLE. */
 	hwcap = getauxval(AT_HWCAP);
 	if (!(hwcap & HWCAP_S390_STFLE))
 		goto ret;
+#else
+	UNUSED(hwcap);
+#endif
 
 	/* Query number of u64s returned by stfle. */
 	facility_list_nmemb = stfle(&tmp, 1);
@@ -239,6 +256,10 @@ static void zpc_init(void)
 			& MASK64(CPACF_KM_FXTS_ENCRYPTED_AES_256))) {
 			aes_xts_full_km = 1;
 		}
+		if (status_word[OFF64(CPACF_KM_AES_256)]
+		    & MASK64(CPACF_KM_AES_256)) {
+			drbg_km = 1;
+		}
 
 		memset(status_word, 0, sizeof(status_word));
 		cpacf_kmc(CPACF_KMC_QUERY, &status_word, NULL, NULL, 0);
@@ -307,6 +328,43 @@ static void zpc_init(void)
 		}
 	}
 
+	/* Check MSA4. */
+	if (facility_list_nmemb >= OFF64(MSA4) + 1
+	    && (facility_list[OFF64(MSA4)] & MASK64(MSA4))) {
+		DEBUG("detected message-security-assist extension 4");
+
+		memset(status_word, 0, sizeof(status_word));
+		cpacf_kmctr(CPACF_KMCTR_QUERY, &status_word, NULL, NULL, 0,
+		    NULL);
+		DEBUG("status word kmctr: 0x%016llx:0x%016llx", status_word[0],
+		    status_word[1]);
+
+		if ((status_word[OFF64(CPACF_KMCTR_ENCRYPTED_AES_128)]
+		    & MASK64(CPACF_KMCTR_ENCRYPTED_AES_128))
+		    && (status_word[OFF64(CPACF_KMCTR_ENCRYPTED_AES_192)]
+		    & MASK64(CPACF_KMCTR_ENCRYPTED_AES_192))
+		    && (status_word[OFF64(CPACF_KMCTR_ENCRYPTED_AES_256)]
+		    & MASK64(CPACF_KMCTR_ENCRYPTED_AES_256))) {
+			aes_ctr_kmctr = 1;
+		}
+	}
+
+	/* Check MSA5. */
+	if (facility_list_nmemb >= OFF64(MSA5) + 1
+	    && (facility_list[OFF64(MSA5)] & MASK64(MSA5))) {
+		DEBUG("detected message-security-assist extension 5");
+
+		memset(status_word, 0, sizeof(status_word));
+		cpacf_prno(CPACF_PRNO_QUERY, &status_word, NULL, 0, NULL, 0);
+		DEBUG("status word prno: 0x%016llx:0x%016llx", status_word[0],
+		    status_word[1]);
+
+		if (status_word[OFF64(CPACF_PRNO_TRNG)]
+		    & MASK64(CPACF_PRNO_TRNG)) {
+			trng_prno = 1;
+		}
+	}
+
 	/* Check MSA8. */
 	if (facility_list_nmemb >= OFF64(MSA8) + 1
 	    && (facility_list[OFF64(MSA8)] & MASK64(MSA8))) {
@@ -369,6 +427,10 @@ static void zpc_init(void)
 		hwcaps.aes_cbc = 1;
 		DEBUG("detected aes-cbc instruction set extensions");
 	}
+	if (aes_ctr_kmctr == 1) {
+		hwcaps.aes_ctr = 1;
+		DEBUG("detected aes-ctr instruction set extensions");
+	}
 	if (aes_xts_km == 1 && aes_xts_pcc) {
 		hwcaps.aes_xts = 1;
 		DEBUG("detected aes-xts instruction set extensions");
@@ -397,6 +459,14 @@ static void zpc_init(void)
 		hwcaps.ecc_kdsa = 1;
 		DEBUG("detected ecc-kdsa instruction set extensions");
 	}
+	if (drbg_km == 1) {
+		hwcaps.drbg = 1;
+		DEBUG("detected aes instruction set extensions for the drbg");
+	}
+	if (trng_prno == 1) {
+		hwcaps.trng = 1;
+		DEBUG("detected trng instruction set extensions");
+	}
 
 	/* Software capabilities via host libs */
 	if (aes_cca == 1) {
@@ -428,9 +498,16 @@ static void zpc_init(void)
 
 	err = 0;
 ret:
+	/* Init statistics after the CPACF queries, so they are not counted. */
+	stats_init();
+	drbg_init();
+	ctx_pool_init();
+	par_init();
+	aes_key_init();
+
 	if (err) {
 		if (pkeyfd >= 0) {
-			close(pkeyfd);
+			pkey_io_close(pkeyfd);
 			pkeyfd = -1;
 		}
 	}
@@ -449,8 +526,14 @@ static void zpc_fini(void)
 	if (init != 1)
 		return;
 
+	par_fini();
+	ctx_pool_fini();
+	drbg_fini();
+	stats_fini();
+	aes_key_fini();
+
 	if (pkeyfd >= 0) {
-		close(pkeyfd);
+		pkey_io_close(pkeyfd);
 		pkeyfd = -1;
 	}
 
@@ -474,6 +557,8 @@ static void zpc_fini(void)
 	rc = pthread_mutex_destroy(&ccalock);
 	assert(rc == 0);
 
+	trace_fini();
+
 	DEBUG("return");
 
 	rc = pthread_mutex_destroy(&debuglock);
@@ -23,9 +23,12 @@ struct hwcaps {
 	int aes_cbc;
 	int aes_xts;
 	int aes_xts_full;
+	int aes_ctr;
 	int aes_cmac;
 	int hmac_kmac;
 	int ecc_kdsa;
+	int drbg;	/* clear-key AES-256 for the drbg */
+	int trng;
 };
 
 struct swcaps {
@@ -21,7 +21,9 @@
 
 #include "cpacf.h"
 #include "globals.h"
+#include "iov.h"
 #include "misc.h"
+#include "stats.h"
 #include "debug.h"
 #include "zkey/pkey.h"
 
@@ -29,6 +31,15 @@
 static void __hmac_init(struct zpc_hmac *hmac);
 static void __hmac_update_protkey(struct zpc_hmac *, u8 *);
 static int __hmac_kmac_crypt(struct zpc_hmac *, u8 *, size_t, const u8 *, size_t);
+static int __hmac_kmac_crypt_prot(struct zpc_hmac *, u8 *, size_t,
+		const u8 *, size_t);
+static int __hmac_update(struct zpc_hmac *, const u8 *, size_t);
+static int __hmac_final(struct zpc_hmac *, u8 *, size_t, const u8 *, size_t);
+static int __hmac_cryptv(struct zpc_hmac *, const u8 *, size_t,
+		const struct iovec *, int, u8 *, size_t);
+static int __hmac_batch(struct zpc_hmac *, const struct zpc_hmac_msg *,
+		size_t, size_t, u8 *);
+static int __hmac_msg(struct zpc_hmac *, u8 *, size_t, const u8 *, size_t);
 static void __hmac_reset(struct zpc_hmac *);
 static void __hmac_reset_state(struct zpc_hmac *);
 
@@ -78,9 +89,7 @@ int zpc_hmac_alloc(struct zpc_hmac **hmac)
 
 int zpc_hmac_set_key(struct zpc_hmac *hmac, struct zpc_hmac_key *hmac_key)
 {
-	int rc, rv;
-
-	UNUSED(rv);
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -108,9 +117,6 @@ int zpc_hmac_set_key(struct zpc_hmac *hmac, struct zpc_hmac_key *hmac_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
-	assert(rv == 0);
-
 	rc = hmac_key_check(hmac_key);
 	if (rc)
 		goto ret;
@@ -122,8 +128,7 @@ int zpc_hmac_set_key(struct zpc_hmac *hmac, struct zpc_hmac_key *hmac_key)
 		goto ret;
 	}
 
-	hmac_key->refcount++;
-	DEBUG("hmac key at %p: refcount %llu", hmac_key, hmac_key->refcount);
+	hmac_key_ref(hmac_key);
 
 	if (hmac->key_set) {
 		/* If another key is already set, unset it and decrease  refcount. */
@@ -142,8 +147,6 @@ int zpc_hmac_set_key(struct zpc_hmac *hmac, struct zpc_hmac_key *hmac_key)
 
 	rc = 0;
 ret:
-	rv = pthread_mutex_unlock(&hmac_key->lock);
-	assert(rv == 0);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -203,10 +206,8 @@ static int is_valid_taglen(struct zpc_hmac *hmac, size_t taglen)
 int zpc_hmac_sign(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
 		const u8 * m, size_t mlen)
 {
-	struct hmac_protkey *protkey;
-	int rc, rv;
-
-	UNUSED(rv);
+	struct stats_op st = { 0 };
+	int rc;
 
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
@@ -224,6 +225,10 @@ int zpc_hmac_sign(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
 		rc = ZPC_ERROR_ARG2NULL;
 		goto ret;
 	}
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
 	if (!hmac->key_set) {
 		rc = ZPC_ERROR_KEYNOTSET;
 		goto ret;
@@ -237,42 +242,14 @@ int zpc_hmac_sign(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
 		__hmac_init(hmac);
 	}
 
-	if (mlen > 0 && mlen % hmac->blksize != 0 && tag == NULL) {
-		rc = ZPC_ERROR_ARG5RANGE;
-		goto ret;
-	}
-
-	rc = -1;
-
-	protkey = &hmac->hmac_key->prot;
-
-	for (;;) {
-
-		rc = __hmac_kmac_crypt(hmac, tag, taglen, m, mlen);
-		if (rc == 0) {
-			break;
-		} else {
-			if (hmac->hmac_key->rand_protk) {
-				rc = ZPC_ERROR_PROTKEYONLY;
-				goto ret;
-			}
-			if (rc == ZPC_ERROR_WKVPMISMATCH) {
-				rv = pthread_mutex_lock(&hmac->hmac_key->lock);
-				assert(rv == 0);
-				DEBUG
-					("hmac context at %p: re-derive protected key from pvsecret ID from hmac key at %p",
-					hmac, hmac->hmac_key);
-				rc = hmac_key_sec2prot(hmac->hmac_key);
-				__hmac_update_protkey(hmac, protkey->protkey);
-				rv = pthread_mutex_unlock(&hmac->hmac_key->lock);
-				assert(rv == 0);
-			}
-			if (rc)
-				break;
-		}
-	}
+	stats_op_begin(&st, &hmac->stats, ZPC_STATS_OP_HMAC);
+	if (tag != NULL)
+		rc = __hmac_final(hmac, tag, taglen, m, mlen);
+	else
+		rc = __hmac_update(hmac, m, mlen);
 
 ret:
+	stats_op_end(&st, mlen);
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
 }
@@ -280,12 +257,10 @@ ret:
 int zpc_hmac_verify(struct zpc_hmac *hmac, const u8 * tag, size_t taglen,
 		const u8 * m, size_t mlen)
 {
-	struct hmac_protkey *protkey;
-	int rc, rv;
+	struct stats_op st = { 0 };
+	int rc;
 	u8 tmp[64];
 
-	UNUSED(rv);
-
 	if (pkeyfd < 0) {
 		rc = ZPC_ERROR_DEVPKEY;
 		goto ret;
@@ -302,6 +277,10 @@ int zpc_hmac_verify(struct zpc_hmac *hmac, const u8 * tag, size_t taglen,
 		rc = ZPC_ERROR_ARG2NULL;
 		goto ret;
 	}
+	if (mlen > 0 && m == NULL) {
+		rc = ZPC_ERROR_ARG4NULL;
+		goto ret;
+	}
 	if (!hmac->key_set) {
 		rc = ZPC_ERROR_KEYNOTSET;
 		goto ret;
@@ -315,47 +294,135 @@ int zpc_hmac_verify(struct zpc_hmac *hmac, const u8 * tag, size_t taglen,
 		__hmac_init(hmac);
 	}
 
-	if (mlen > 0 && mlen % hmac->blksize != 0 && tag == NULL) {
-		rc = ZPC_ERROR_ARG5RANGE;
+	stats_op_begin(&st, &hmac->stats, ZPC_STATS_OP_HMAC);
+	if (tag != NULL) {
+		rc = __hmac_final(hmac, tmp, sizeof(tmp), m, mlen);
+		if (rc == 0 && memcmp_consttime(tmp, tag, taglen) != 0)
+			rc = ZPC_ERROR_TAGMISMATCH;
+		memzero_secure(tmp, sizeof(tmp));
+	} else {
+		rc = __hmac_update(hmac, m, mlen);
+	}
+
+ret:
+	stats_op_end(&st, mlen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_hmac_signv(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
+		const struct iovec *m, int iovcnt)
+{
+	int rc;
+
+	rc = __hmac_cryptv(hmac, tag, taglen, m, iovcnt, tag, taglen);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_hmac_verifyv(struct zpc_hmac *hmac, const u8 * tag, size_t taglen,
+		const struct iovec *m, int iovcnt)
+{
+	u8 tmp[64];
+	int rc;
+
+	rc = __hmac_cryptv(hmac, tag, taglen, m, iovcnt,
+				tag == NULL ? NULL : tmp, tag == NULL ? 0 : sizeof(tmp));
+	if (rc == 0 && tag != NULL && memcmp_consttime(tmp, tag, taglen) != 0)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_hmac_sign_batch(struct zpc_hmac *hmac,
+		const struct zpc_hmac_msg *msgs, size_t nmsgs, size_t taglen)
+{
+	int rc;
+
+	rc = __hmac_batch(hmac, msgs, nmsgs, taglen, NULL);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_hmac_verify_batch(struct zpc_hmac *hmac,
+		const struct zpc_hmac_msg *msgs, size_t nmsgs, size_t taglen,
+		u8 * valid)
+{
+	int rc;
+
+	if (valid == NULL && nmsgs > 0)
+		rc = ZPC_ERROR_ARG5NULL;
+	else
+		rc = __hmac_batch(hmac, msgs, nmsgs, taglen, valid);
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int zpc_hmac_get_stats(const struct zpc_hmac *hmac,
+		struct zpc_stats_counters *stats)
+{
+	int rc;
+
+	if (hmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (stats == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
 		goto ret;
 	}
 
-	rc = -1;
+	stats_ctx_get(&hmac->stats, stats);
+	rc = 0;
+ret:
+	return rc;
+}
 
-	protkey = &hmac->hmac_key->prot;
+/*
+ * Drop a partial hmac, keep the key (context pool).
+ */
+void hmac_reset_state(struct zpc_hmac *hmac)
+{
+	__hmac_reset_state(hmac);
+}
 
-	for (;;) {
+int zpc_hmac_dup(struct zpc_hmac **hmac, const struct zpc_hmac *src)
+{
+	struct zpc_hmac *new_hmac = NULL;
+	int rc;
 
-		rc = __hmac_kmac_crypt(hmac, tag == NULL ? NULL : tmp,
-					tag == NULL ? 0 : sizeof(tmp), m, mlen);
-		if (rc == 0) {
-			if (tag != NULL) {
-				rc = memcmp_consttime(tmp, tag, taglen);
-				if (rc != 0)
-					rc = ZPC_ERROR_TAGMISMATCH;
-			}
-			break;
-		} else {
-			if (hmac->hmac_key->rand_protk) {
-				rc = ZPC_ERROR_PROTKEYONLY;
-				goto ret;
-			}
-			if (rc == ZPC_ERROR_WKVPMISMATCH) {
-				rv = pthread_mutex_lock(&hmac->hmac_key->lock);
-				assert(rv == 0);
-				DEBUG
-					("hmac context at %p: re-derive protected key from pvsecret ID from hmac key at %p",
-					hmac, hmac->hmac_key);
-				rc = hmac_key_sec2prot(hmac->hmac_key);
-				__hmac_update_protkey(hmac, protkey->protkey);
-				rv = pthread_mutex_unlock(&hmac->hmac_key->lock);
-				assert(rv == 0);
-			}
-			if (rc)
-				break;
-		}
+	if (pkeyfd < 0) {
+		rc = ZPC_ERROR_DEVPKEY;
+		goto ret;
+	}
+	if (!hwcaps.hmac_kmac) {
+		rc = ZPC_ERROR_HWCAPS;
+		goto ret;
+	}
+	if (hmac == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+	if (src == NULL) {
+		rc = ZPC_ERROR_ARG2NULL;
+		goto ret;
+	}
+
+	new_hmac = malloc(sizeof(*new_hmac));
+	if (new_hmac == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto ret;
 	}
+	memcpy(new_hmac, src, sizeof(*new_hmac));
+	memset(&new_hmac->stats, 0, sizeof(new_hmac->stats));
+	memset(&new_hmac->pool, 0, sizeof(new_hmac->pool));
 
+	if (new_hmac->key_set)
+		hmac_key_ref(new_hmac->hmac_key);
+
+	DEBUG("hmac context at %p: copy of %p", new_hmac, src);
+	*hmac = new_hmac;
+	rc = 0;
 ret:
 	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
 	return rc;
@@ -422,15 +489,232 @@ static void __hmac_update_protkey(struct zpc_hmac *hmac, u8 *protkey)
  */
 static void __hmac_init(struct zpc_hmac *hmac)
 {
+	u8 protkey[MAXHMACPROTKEYSIZE];
+
 	memset(&hmac->param_kmac, 0, sizeof(hmac->param_kmac));
 
-	__hmac_update_protkey(hmac, hmac->hmac_key->prot.protkey);
+	hmac_key_get_prot(hmac->hmac_key, protkey, sizeof(protkey),
+	    &hmac->key_gen);
+	__hmac_update_protkey(hmac, protkey);
+	memzero_secure(protkey, sizeof(protkey));
 
 	hmac->blksize = hfunc2blksize[hmac->hmac_key->hfunc];
 	hmac->fc = hfunc2fc[hmac->hmac_key->hfunc];
 	hmac->initialized = 1;
 }
 
+/*
+ * Argument checks of signv and verifyv. The buffers are passed to
+ * __hmac_update one by one, blocks spanning buffers are collected in
+ * the context. For the final operation, the mac is stored in buf.
+ */
+static int __hmac_cryptv(struct zpc_hmac *hmac, const u8 * tag, size_t taglen,
+		const struct iovec *in, int iovcnt, u8 * buf, size_t buflen)
+{
+	struct stats_op st = { 0 };
+	size_t inlen;
+	int rc, i;
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.hmac_kmac)
+		return ZPC_ERROR_HWCAPS;
+	if (hmac == NULL)
+		return ZPC_ERROR_ARG1NULL;
+	if (taglen > 0 && tag == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (iovcnt < 0)
+		return ZPC_ERROR_ARG5RANGE;
+	if (iovcnt > 0 && in == NULL)
+		return ZPC_ERROR_ARG4NULL;
+	if (iov_len(in, iovcnt, &inlen) != 0)
+		return ZPC_ERROR_ARG4RANGE;
+	if (!hmac->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (tag != NULL && !is_valid_taglen(hmac, taglen))
+		return ZPC_ERROR_TAGSIZE;
+
+	if (!hmac->initialized) {
+		__hmac_init(hmac);
+	}
+
+	stats_op_begin(&st, &hmac->stats, ZPC_STATS_OP_HMAC);
+	rc = 0;
+	for (i = 0; i < iovcnt && rc == 0; i++)
+		rc = __hmac_update(hmac, in[i].iov_base, in[i].iov_len);
+	if (rc == 0 && tag != NULL)
+		rc = __hmac_final(hmac, buf, buflen, NULL, 0);
+	stats_op_end(&st, inlen);
+	return rc;
+}
+
+/*
+ * The context and all messages are checked once for the whole batch. The
+ * parmblock is initialized for each message: resetting the state after a
+ * final kmac clears the protected key of the sha-224/256 layout. If valid
+ * is NULL, the macs are stored, otherwise they are verified and the
+ * result is stored in the valid bitmap.
+ */
+static int __hmac_batch(struct zpc_hmac *hmac, const struct zpc_hmac_msg *msgs,
+		size_t nmsgs, size_t taglen, u8 * valid)
+{
+	struct stats_op st = { 0 };
+	size_t i, bytes = 0;
+	int rc, mismatch = 0;
+	u8 tmp[64];
+
+	if (pkeyfd < 0)
+		return ZPC_ERROR_DEVPKEY;
+	if (!hwcaps.hmac_kmac)
+		return ZPC_ERROR_HWCAPS;
+	if (hmac == NULL)
+		return ZPC_ERROR_ARG1NULL;
+	if (nmsgs > 0 && msgs == NULL)
+		return ZPC_ERROR_ARG2NULL;
+	if (!hmac->key_set)
+		return ZPC_ERROR_KEYNOTSET;
+	if (!is_valid_taglen(hmac, taglen))
+		return ZPC_ERROR_TAGSIZE;
+
+	for (i = 0; i < nmsgs; i++) {
+		if ((msgs[i].msglen > 0 && msgs[i].msg == NULL)
+		    || msgs[i].mac == NULL)
+			return ZPC_ERROR_ARG2NULL;
+	}
+
+	if (valid != NULL)
+		memset(valid, 0, (nmsgs + 7) / 8);
+
+	__hmac_reset_state(hmac);
+
+	stats_op_begin(&st, &hmac->stats, ZPC_STATS_OP_HMAC);
+	rc = 0;
+	for (i = 0; i < nmsgs; i++) {
+		rc = __hmac_msg(hmac, tmp, sizeof(tmp), msgs[i].msg,
+				msgs[i].msglen);
+		if (rc)
+			break;
+		bytes += msgs[i].msglen;
+
+		if (valid == NULL)
+			memcpy(msgs[i].mac, tmp, taglen);
+		else if (memcmp_consttime(tmp, msgs[i].mac, taglen) == 0)
+			valid[i / 8] |= (u8)(1 << (i % 8));
+		else
+			mismatch = 1;
+	}
+	stats_op_end(&st, bytes);
+
+	memzero_secure(tmp, sizeof(tmp));
+	if (rc == 0 && mismatch)
+		rc = ZPC_ERROR_TAGMISMATCH;
+	return rc;
+}
+
+/* One message of a batch. */
+static int __hmac_msg(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
+		const u8 * m, size_t mlen)
+{
+	int rc;
+
+	__hmac_init(hmac);
+	rc = __hmac_kmac_crypt_prot(hmac, tag, taglen, m, mlen);
+	if (rc != 0)
+		__hmac_reset_state(hmac);
+	return rc;
+}
+
+/*
+ * Absorb a chunk of any length. Whole blocks are passed to kmac from the
+ * caller's buffer, only a trailing partial block is kept in the context.
+ */
+static int __hmac_update(struct zpc_hmac *hmac, const u8 * in, size_t inlen)
+{
+	size_t n, blksize = hmac->blksize;
+	int rc;
+
+	if (inlen == 0)
+		return 0;
+
+	if (hmac->buflen > 0) {
+		n = blksize - hmac->buflen;
+		if (n > inlen)
+			n = inlen;
+		memcpy(hmac->buf + hmac->buflen, in, n);
+		hmac->buflen += n;
+		in += n;
+		inlen -= n;
+
+		if (hmac->buflen < blksize)
+			return 0;
+
+		rc = __hmac_kmac_crypt_prot(hmac, NULL, 0, hmac->buf, blksize);
+		if (rc)
+			return rc;
+		hmac->buflen = 0;
+	}
+
+	n = inlen - inlen % blksize;
+	if (n > 0) {
+		rc = __hmac_kmac_crypt_prot(hmac, NULL, 0, in, n);
+		if (rc)
+			return rc;
+	}
+
+	if (inlen > n)
+		memcpy(hmac->buf, in + n, inlen - n);
+	hmac->buflen = inlen - n;
+	return 0;
+}
+
+/*
+ * Last chunk and mac. The final kmac takes data of any length, so
+ * without a kept partial block the chunk is passed as is.
+ */
+static int __hmac_final(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
+		const u8 * in, size_t inlen)
+{
+	int rc;
+
+	if (hmac->buflen == 0)
+		return __hmac_kmac_crypt_prot(hmac, tag, taglen, in, inlen);
+
+	rc = __hmac_update(hmac, in, inlen);
+	if (rc)
+		return rc;
+	return __hmac_kmac_crypt_prot(hmac, tag, taglen, hmac->buf,
+			hmac->buflen);
+}
+
+/* __hmac_kmac_crypt with protected key re-derivation. */
+static int __hmac_kmac_crypt_prot(struct zpc_hmac *hmac, u8 * tag,
+		size_t taglen, const u8 * in, size_t inlen)
+{
+	u8 protkey[MAXHMACPROTKEYSIZE];
+	int rc;
+
+	for (;;) {
+
+		rc = __hmac_kmac_crypt(hmac, tag, taglen, in, inlen);
+		if (rc == 0) {
+			break;
+		} else {
+			if (hmac->hmac_key->rand_protk)
+				return ZPC_ERROR_PROTKEYONLY;
+			if (rc == ZPC_ERROR_WKVPMISMATCH) {
+				rc = hmac_key_update_prot(hmac->hmac_key, protkey,
+				    sizeof(protkey), &hmac->key_gen);
+				__hmac_update_protkey(hmac, protkey);
+				memzero_secure(protkey, sizeof(protkey));
+			}
+			if (rc)
+				break;
+		}
+	}
+
+	return rc;
+}
+
 static int __hmac_kmac_crypt(struct zpc_hmac *hmac, u8 * tag, size_t taglen,
 		const u8 * in, size_t inlen)
 {
@@ -500,4 +784,6 @@ static void __hmac_reset_state(struct zpc_hmac *hmac)
 	memset(&hmac->param_kmac.hmac_224_256.imbl, 0, sizeof(hmac->param_kmac.hmac_224_256.imbl));
 	memset(&hmac->param_kmac.hmac_384_512.h, 0, sizeof(hmac->param_kmac.hmac_384_512.h));
 	memset(&hmac->param_kmac.hmac_384_512.imbl, 0, sizeof(hmac->param_kmac.hmac_384_512.imbl));
+	memzero_secure(hmac->buf, sizeof(hmac->buf));
+	hmac->buflen = 0;
 }
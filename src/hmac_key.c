@@ -15,6 +15,9 @@
 #include "globals.h"
 #include "debug.h"
 #include "misc.h"
+#include "stats.h"
+#include "pkey_io.h"
+#include "seqlock.h"
 #include "zkey/pkey.h"
 
 #include <assert.h>
@@ -29,7 +32,10 @@
 #include "hmac_key_local.h"
 
 static void __hmac_key_reset(struct zpc_hmac_key *);
-static int hmac_key_pvsec2prot(struct zpc_hmac_key *hmac_key);
+static int hmac_key_pvsec2prot(struct zpc_hmac_key *hmac_key,
+		struct hmac_protkey *prot);
+static void hmac_key_set_prot(struct zpc_hmac_key *hmac_key,
+		const struct hmac_protkey *prot);
 static int hmac_key_blob_is_valid_pvsecret_id(struct zpc_hmac_key *hmac_key,
 		const unsigned char *id);
 static int hmac_key_generate(struct hmac_genprotk *genprotk);
@@ -167,10 +173,10 @@ int zpc_hmac_key_set_type(struct zpc_hmac_key *hmac_key, int type)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
+	rv = stats_mutex_lock(&hmac_key->lock);
 	assert(rv == 0);
 
-	if (hmac_key->refcount != 1) {
+	if (__atomic_load_n(&hmac_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -216,10 +222,10 @@ int zpc_hmac_key_set_hash_function(struct zpc_hmac_key *hmac_key, zpc_hmac_hashf
 		break;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
+	rv = stats_mutex_lock(&hmac_key->lock);
 	assert(rv == 0);
 
-	if (hmac_key->refcount != 1) {
+	if (__atomic_load_n(&hmac_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -353,10 +359,10 @@ int zpc_hmac_key_import_clear(struct zpc_hmac_key *hmac_key, const unsigned char
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
+	rv = stats_mutex_lock(&hmac_key->lock);
 	assert(rv == 0);
 
-	if (hmac_key->refcount != 1) {
+	if (__atomic_load_n(&hmac_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -418,7 +424,7 @@ int zpc_hmac_key_export(struct zpc_hmac_key *hmac_key, unsigned char *buf,
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
+	rv = stats_mutex_lock(&hmac_key->lock);
 	assert(rv == 0);
 
 	if (hmac_key->rand_protk) {
@@ -472,10 +478,10 @@ int zpc_hmac_key_import(struct zpc_hmac_key *hmac_key, const unsigned char *buf,
 		return ZPC_ERROR_ARG3RANGE;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
+	rv = stats_mutex_lock(&hmac_key->lock);
 	assert(rv == 0);
 
-	if (hmac_key->refcount != 1) {
+	if (__atomic_load_n(&hmac_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -528,10 +534,10 @@ int zpc_hmac_key_generate(struct zpc_hmac_key *hmac_key)
 		return rc;
 	}
 
-	rv = pthread_mutex_lock(&hmac_key->lock);
+	rv = stats_mutex_lock(&hmac_key->lock);
 	assert(rv == 0);
 
-	if (hmac_key->refcount != 1) {
+	if (__atomic_load_n(&hmac_key->refcount, __ATOMIC_RELAXED) != 1) {
 		rc = ZPC_ERROR_OBJINUSE;
 		goto ret;
 	}
@@ -559,7 +565,7 @@ int zpc_hmac_key_generate(struct zpc_hmac_key *hmac_key)
 	}
 
 	DEBUG("hmac key at %p: key set to generated random protected key", hmac_key);
-	memcpy(&hmac_key->prot, &genprotk.protkey, sizeof(hmac_key->prot));
+	hmac_key_set_prot(hmac_key, &genprotk.protkey);
 	hmac_key->rand_protk = 1;
 	hmac_key->key_set = 1;
 
@@ -575,7 +581,8 @@ ret:
 
 void zpc_hmac_key_free(struct zpc_hmac_key **hmac_key)
 {
-	int rv, free_obj = 0;
+	unsigned long long refcount;
+	int rv;
 
 	UNUSED(rv);
 
@@ -584,30 +591,27 @@ void zpc_hmac_key_free(struct zpc_hmac_key **hmac_key)
 	if (*hmac_key == NULL)
 		return;
 
-	rv = pthread_mutex_lock(&(*hmac_key)->lock);
-	assert(rv == 0);
-
-	if ((*hmac_key)->refcount == 0)
-		goto ret;
-
-	(*hmac_key)->refcount--;
-	DEBUG("hmac key at %p: refcount %llu", *hmac_key, (*hmac_key)->refcount);
+	refcount = __atomic_load_n(&(*hmac_key)->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0)
+			goto ret;
+	} while (!__atomic_compare_exchange_n(&(*hmac_key)->refcount, &refcount,
+	    refcount - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	DEBUG("hmac key at %p: refcount %llu", *hmac_key, refcount - 1);
 
-	if ((*hmac_key)->refcount == 0) {
-		free_obj = 1;
+	if (refcount == 1) {
+		rv = stats_mutex_lock(&(*hmac_key)->lock);
+		assert(rv == 0);
 		__hmac_key_reset(*hmac_key);
-	}
-
-ret:
-	rv = pthread_mutex_unlock(&(*hmac_key)->lock);
-	assert(rv == 0);
+		rv = pthread_mutex_unlock(&(*hmac_key)->lock);
+		assert(rv == 0);
 
-	if (free_obj == 1) {
 		rv = pthread_mutex_destroy(&(*hmac_key)->lock);
 		assert(rv == 0);
 
 		free(*hmac_key);
 	}
+ret:
 	*hmac_key = NULL;
 	DEBUG("return");
 }
@@ -621,14 +625,16 @@ static void __hmac_key_reset(struct zpc_hmac_key *hmac_key)
 	assert(hmac_key != NULL);
 
 	memset(&hmac_key->cur, 0, sizeof(hmac_key->cur));
+	seq_write_begin(&hmac_key->prot_seq);
 	memset(&hmac_key->prot, 0, sizeof(hmac_key->prot));
+	seq_write_end(&hmac_key->prot_seq);
 	hmac_key->key_set = 0;
 	hmac_key->keysize = 0;
 	hmac_key->keysize_set = 0;
 	hmac_key->type = 0;
 	hmac_key->type_set = 0;
 	hmac_key->rand_protk = 0;
-	hmac_key->refcount = 1;
+	__atomic_store_n(&hmac_key->refcount, 1, __ATOMIC_RELAXED);
 }
 
 static u16 hmacprotkeylen_from_pvsectype(u16 pvsectype)
@@ -681,7 +687,7 @@ static int hmac_key_blob_is_valid_pvsecret_id(struct zpc_hmac_key *hmac_key,
 	io.keylen = sizeof(struct uvrsecrettoken);
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_VERIFYKEY2, &io);
 	if (rc != 0) {
 		DEBUG("hmac key at %p: PKEY_VERIFYKEY2 ioctl failed, errno = %d",
 			hmac_key, errno);
@@ -771,7 +777,8 @@ static int hmac_key_generate(struct hmac_genprotk *genprotk)
  * (Re)derive protected key from a retrievable secret ID.
  * Caller must hold hmac_key's wr lock.
  */
-static int hmac_key_pvsec2prot(struct zpc_hmac_key *hmac_key)
+static int hmac_key_pvsec2prot(struct zpc_hmac_key *hmac_key,
+		struct hmac_protkey *prot)
 {
 	struct pkey_kblob2pkey3 io;
 	unsigned char buf[sizeof(struct uvrsecrettoken)] = { 0, };
@@ -783,11 +790,11 @@ static int hmac_key_pvsec2prot(struct zpc_hmac_key *hmac_key)
 	io.key = buf;
 	io.keylen = sizeof(struct uvrsecrettoken);
 	io.pkeytype = hmac_key->type;
-	io.pkeylen = sizeof(hmac_key->prot.protkey);
-	io.pkey = (unsigned char *)&hmac_key->prot.protkey;
+	io.pkeylen = sizeof(prot->protkey);
+	io.pkey = (unsigned char *)&prot->protkey;
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
 		DEBUG("hmac key at %p: PKEY_KBLOB2PROTK3 ioctl failed, errno = %d",
 			hmac_key, errno);
@@ -803,9 +810,18 @@ static int hmac_key_pvsec2prot(struct zpc_hmac_key *hmac_key)
  */
 int hmac_key_sec2prot(struct zpc_hmac_key *hmac_key)
 {
+	struct hmac_protkey prot;
+	int rc;
+
 	switch (hmac_key->type) {
 	case ZPC_HMAC_KEY_TYPE_PVSECRET:
-		return hmac_key_pvsec2prot(hmac_key);
+		/* Derive aside, readers keep using the current protected key. */
+		memcpy(&prot, &hmac_key->prot, sizeof(prot));
+		rc = hmac_key_pvsec2prot(hmac_key, &prot);
+		if (rc == 0)
+			hmac_key_set_prot(hmac_key, &prot);
+		memzero_secure(&prot, sizeof(prot));
+		return rc;
 	default:
 		break;
 	}
@@ -813,10 +829,90 @@ int hmac_key_sec2prot(struct zpc_hmac_key *hmac_key)
 	return ZPC_ERROR_KEYTYPE;
 }
 
+/*
+ * Install a new protected key. The generation tells contexts with an
+ * older copy that they can just update it.
+ * Caller must hold hmac_key's lock.
+ */
+static void hmac_key_set_prot(struct zpc_hmac_key *hmac_key,
+		const struct hmac_protkey *prot)
+{
+	seq_write_begin(&hmac_key->prot_seq);
+	memcpy(&hmac_key->prot, prot, sizeof(hmac_key->prot));
+	hmac_key->prot_gen++;
+	seq_write_end(&hmac_key->prot_seq);
+}
+
+/*
+ * Take a reference. Does not take hmac_key's lock.
+ */
+void hmac_key_ref(struct zpc_hmac_key *hmac_key)
+{
+	unsigned long long refcount;
+
+	refcount = __atomic_add_fetch(&hmac_key->refcount, 1, __ATOMIC_RELAXED);
+	DEBUG("hmac key at %p: refcount %llu", hmac_key, refcount);
+}
+
+/*
+ * Copy the first len bytes of the protected key and its generation.
+ * Does not take hmac_key's lock.
+ */
+void hmac_key_get_prot(const struct zpc_hmac_key *hmac_key,
+		void *protkey, size_t len, unsigned long long *gen)
+{
+	unsigned int seq;
+
+	assert(len <= sizeof(hmac_key->prot.protkey));
+
+	do {
+		seq = seq_read_begin(&hmac_key->prot_seq);
+		memcpy(protkey, hmac_key->prot.protkey, len);
+		*gen = hmac_key->prot_gen;
+	} while (seq_read_retry(&hmac_key->prot_seq, seq));
+}
+
+/*
+ * Update a context's copy of the protected key after a wrapping key
+ * verification pattern mismatch. Only a re-derivation takes hmac_key's
+ * lock.
+ */
+int hmac_key_update_prot(struct zpc_hmac_key *hmac_key, void *protkey,
+		size_t len, unsigned long long *gen)
+{
+	unsigned long long cur;
+	int rc = 0, rv;
+
+	UNUSED(rv);
+
+	hmac_key_get_prot(hmac_key, protkey, len, &cur);
+	if (cur != *gen) {
+		/* Another context re-derived it already. */
+		*gen = cur;
+		return 0;
+	}
+
+	rv = stats_mutex_lock(&hmac_key->lock);
+	assert(rv == 0);
+
+	if (hmac_key->prot_gen == *gen) {
+		DEBUG("hmac key at %p: re-derive protected key", hmac_key);
+		stats_inc(STATS_REDERIVE);
+		rc = hmac_key_sec2prot(hmac_key);
+	}
+	memcpy(protkey, hmac_key->prot.protkey, len);
+	*gen = hmac_key->prot_gen;
+
+	rv = pthread_mutex_unlock(&hmac_key->lock);
+	assert(rv == 0);
+	return rc;
+}
+
 int hmac_key_clr2prot(struct zpc_hmac_key *hmac_key,
 		const unsigned char *key, size_t keylen)
 {
 	struct pkey_kblob2pkey3 io;
+	struct hmac_protkey prot;
 	unsigned char buf[sizeof(struct clearkeytoken) + 128];
 	struct clearkeytoken *clrtok = (struct clearkeytoken *)&buf;
 	int rc;
@@ -839,14 +935,16 @@ int hmac_key_clr2prot(struct zpc_hmac_key *hmac_key,
 	memset(&io, 0, sizeof(io));
 	io.key = buf;
 	io.keylen = sizeof(struct clearkeytoken) + keylen;
-	io.pkeylen = sizeof(hmac_key->prot.protkey);
-	io.pkey = (unsigned char *)&hmac_key->prot.protkey;
+	memcpy(&prot, &hmac_key->prot, sizeof(prot));
+	io.pkeylen = sizeof(prot.protkey);
+	io.pkey = (unsigned char *)&prot.protkey;
 
 	errno = 0;
-	rc = ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
+	rc = pkey_ioctl(pkeyfd, PKEY_KBLOB2PROTK3, &io);
 	if (rc != 0) {
 		DEBUG("hmac key at %p: PKEY_KBLOB2PROTK3 ioctl failed, errno = %d",
 			hmac_key, errno);
+		memzero_secure(&prot, sizeof(prot));
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
 	}
 
@@ -854,9 +952,12 @@ int hmac_key_clr2prot(struct zpc_hmac_key *hmac_key,
 		DEBUG("hmac key at %p: PKEY_KBLOB2PROTK3 ioctl returned unexpected "
 			"protected key type %d. Expected %d.",
 			hmac_key, io.pkeytype, clrtok->keytype);
+		memzero_secure(&prot, sizeof(prot));
 		return ZPC_ERROR_IOCTLBLOB2PROTK3;
 	}
 
+	hmac_key_set_prot(hmac_key, &prot);
+	memzero_secure(&prot, sizeof(prot));
 	return 0;
 }
 
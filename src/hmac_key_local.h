@@ -26,6 +26,8 @@ struct hmac_key {
 struct zpc_hmac_key {
 	struct hmac_key cur; /* current pvsecret ID */
 	struct hmac_protkey prot;
+	unsigned long long prot_gen;	/* incremented when prot changes */
+	unsigned int prot_seq;	/* seqlock.h counter of prot and prot_gen */
 	int key_set;
 
 	int keysize;
@@ -39,11 +41,16 @@ struct zpc_hmac_key {
 
 	int rand_protk;
 
-	unsigned long long refcount;
-	pthread_mutex_t lock;
+	unsigned long long refcount;	/* atomic */
+	pthread_mutex_t lock;	/* writers, readers of prot use prot_seq */
 };
 
 int hmac_key_sec2prot(struct zpc_hmac_key *);
+void hmac_key_ref(struct zpc_hmac_key *);
+void hmac_key_get_prot(const struct zpc_hmac_key *, void *protkey,
+		size_t len, unsigned long long *gen);
+int hmac_key_update_prot(struct zpc_hmac_key *, void *protkey,
+		size_t len, unsigned long long *gen);
 int hmac_key_check(const struct zpc_hmac_key *);
 int hmac_key_clr2prot(struct zpc_hmac_key *hmac_key, const unsigned char *key,
 		size_t keylen);
@@ -11,6 +11,7 @@
 # include "zpc/hmac_key.h"
 
 # include "misc.h"
+# include "ctx_pool.h"
 # include "cpacf.h"
 
 /*
@@ -20,15 +21,24 @@
 struct zpc_hmac {
 	struct cpacf_kmac_hmac_param param_kmac;
 	struct zpc_hmac_key *hmac_key;
+	unsigned long long key_gen;	/* hmac_key->prot_gen of param_kmac */
 
 	unsigned int fc;
 	int ikp;
 
+	u8 buf[128];		/* trailing partial block */
+	size_t buflen;
+
 	int key_set;
 
 	int initialized;
 
 	int blksize;
+
+	struct stats_ctx stats;
+	struct ctx_pool_mark pool;
 };
 
+void hmac_reset_state(struct zpc_hmac *);
+
 #endif
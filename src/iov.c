@@ -0,0 +1,156 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "iov.h"
+#include "misc.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Position in a segment array. */
+struct iov_cur {
+	const struct iovec *iov;
+	int iovcnt;
+	int i;
+	size_t off;
+};
+
+/* Bytes left in the current segment, skipping empty segments. */
+static size_t
+iov_avail(struct iov_cur *cur)
+{
+	while (cur->i < cur->iovcnt && cur->off == cur->iov[cur->i].iov_len) {
+		cur->i++;
+		cur->off = 0;
+	}
+	return cur->i < cur->iovcnt ? cur->iov[cur->i].iov_len - cur->off : 0;
+}
+
+static u8 *
+iov_ptr(const struct iov_cur *cur)
+{
+	return (u8 *)cur->iov[cur->i].iov_base + cur->off;
+}
+
+static void
+iov_gather(struct iov_cur *cur, u8 *buf, size_t n)
+{
+	size_t k;
+
+	while (n > 0) {
+		k = iov_avail(cur);
+		assert(k > 0);
+		if (k > n)
+			k = n;
+		memcpy(buf, iov_ptr(cur), k);
+		cur->off += k;
+		buf += k;
+		n -= k;
+	}
+}
+
+static void
+iov_scatter(struct iov_cur *cur, const u8 *buf, size_t n)
+{
+	size_t k;
+
+	while (n > 0) {
+		k = iov_avail(cur);
+		assert(k > 0);
+		if (k > n)
+			k = n;
+		memcpy(iov_ptr(cur), buf, k);
+		cur->off += k;
+		buf += k;
+		n -= k;
+	}
+}
+
+/*
+ * Sum up the segment lengths. Returns -1 if a segment with a non-zero
+ * length has no base or if the sum overflows.
+ */
+int
+iov_len(const struct iovec *iov, int iovcnt, size_t *len)
+{
+	size_t sum = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > 0 && iov[i].iov_base == NULL)
+			return -1;
+		if (iov[i].iov_len > SIZE_MAX - sum)
+			return -1;
+		sum += iov[i].iov_len;
+	}
+
+	*len = sum;
+	return 0;
+}
+
+/*
+ * Walk len bytes of in and out (NULL for operations without output,
+ * otherwise of the same total length). len - tail must be a multiple
+ * of blksize.
+ */
+int
+iov_walk(const struct iovec *out, const struct iovec *in, int iovcnt,
+    size_t len, size_t blksize, size_t tail, iov_fn_t fn, void *arg)
+{
+	struct iov_cur icur = { in, iovcnt, 0, 0 };
+	struct iov_cur ocur = { out, iovcnt, 0, 0 };
+	u8 buf[IOV_BUF_MAX];
+	size_t body, n;
+	int rc = 0;
+
+	assert(blksize > 0 && blksize <= IOV_BUF_MAX);
+	assert(tail <= IOV_BUF_MAX && tail <= len);
+	assert((len - tail) % blksize == 0);
+
+	body = len - tail;
+	while (body > 0) {
+		n = iov_avail(&icur);
+		if (out != NULL && iov_avail(&ocur) < n)
+			n = iov_avail(&ocur);
+		if (n > body)
+			n = body;
+		n = n / blksize * blksize;
+
+		if (n > 0) {
+			/* Whole blocks in place. */
+			rc = fn(arg, out != NULL ? iov_ptr(&ocur) : NULL,
+			    iov_ptr(&icur), n, 0);
+			if (rc)
+				goto ret;
+			icur.off += n;
+			if (out != NULL)
+				ocur.off += n;
+		} else {
+			/* A block straddles segments. */
+			n = blksize;
+			iov_gather(&icur, buf, n);
+			rc = fn(arg, out != NULL ? buf : NULL, buf, n, 0);
+			if (rc)
+				goto ret;
+			if (out != NULL)
+				iov_scatter(&ocur, buf, n);
+		}
+		body -= n;
+	}
+
+	iov_gather(&icur, buf, tail);
+	rc = fn(arg, out != NULL ? buf : NULL, buf, tail, 1);
+	if (rc)
+		goto ret;
+	if (out != NULL)
+		iov_scatter(&ocur, buf, tail);
+
+ret:
+	memzero_secure(buf, sizeof(buf));
+	return rc;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef IOV_H
+# define IOV_H
+
+/*
+ * Internal scatter-gather interface for the *v entry points.
+ *
+ * iov_walk passes the input segments to a callback in multiples of the
+ * block size. Runs of whole blocks within a segment (of both the input
+ * and the output) are passed directly from and to the caller's memory.
+ * A block that straddles segments is gathered into a stack buffer,
+ * processed there and scattered to the output. The last tail bytes are
+ * passed in one final call, which is made even if tail is 0.
+ */
+
+# include "misc.h"
+
+# include <sys/uio.h>
+
+/* Maximum block size and tail length. */
+# define IOV_BUF_MAX	256
+
+typedef int (*iov_fn_t)(void *arg, u8 *out, const u8 *in, size_t len,
+    int last);
+
+int iov_len(const struct iovec *iov, int iovcnt, size_t *len);
+int iov_walk(const struct iovec *out, const struct iovec *in, int iovcnt,
+    size_t len, size_t blksize, size_t tail, iov_fn_t fn, void *arg);
+
+#endif
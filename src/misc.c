@@ -10,33 +10,50 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/random.h>
 
 static int ishexdigit(const char);
 static unsigned char hexdigit2byte(char);
 static char byte2hexdigit(unsigned char);
 
+/* Read from the kernel, falling back to /dev/urandom. */
 int
-local_rng(u8 *output, size_t bytes)
+local_rng(u8 *out, size_t len)
 {
-	int ranfd;
-	int rlen;
-	unsigned int totallen = 0;
-
-	ranfd = open("/dev/prandom", O_RDONLY);
-	if (ranfd < 0)
-		ranfd = open("/dev/urandom", O_RDONLY);
-	if (ranfd >= 0) {
-		do {
-			rlen = read(ranfd, output + totallen, bytes - totallen);
-			totallen += rlen;
-		} while (totallen < bytes);
-		close(ranfd);
-		return 0;
+	ssize_t n;
+	int fd;
+
+	while (len > 0) {
+		n = getrandom(out, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == ENOSYS)
+			break;
+		if (n <= 0)
+			return -1;
+		out += n;
+		len -= n;
 	}
+	if (len == 0)
+		return 0;
 
-	return -1;
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		return -1;
+	while (len > 0) {
+		n = read(fd, out, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		out += n;
+		len -= n;
+	}
+	close(fd);
+	return len == 0 ? 0 : -1;
 }
 
 int
@@ -89,6 +106,32 @@ buf2hexstr(char *hex, size_t hexlen, const unsigned char *buf, size_t buflen)
 	hex[2 * i] = '\0';
 }
 
+/*
+ * Check and strip the PKCS#7 padding of a 16 byte block in constant
+ * time. The block is zeroed if the padding is invalid. Returns 0 and
+ * the length of the data in front of the padding, or non-zero.
+ */
+int
+pkcs7_unpad(u8 blk[16], size_t *len)
+{
+	unsigned int padlen = blk[15], bad, i;
+	u8 diff = 0, mask;
+
+	bad = (padlen - 1) >= 16;	/* padlen is 1 to 16 */
+	for (i = 0; i < 16; i++) {
+		mask = 0 - (u8)((15 - i) < padlen);
+		diff |= mask & (blk[i] ^ padlen);
+	}
+	bad |= diff != 0;
+
+	mask = (u8)bad - 1;
+	for (i = 0; i < 16; i++)
+		blk[i] &= mask;
+
+	*len = (16 - padlen) & ((size_t)0 - (1 - bad));
+	return bad;
+}
+
 static int
 ishexdigit(const char d)
 {
@@ -116,3 +159,30 @@ byte2hexdigit(unsigned char b)
 
 	return (b >= 10 ? b + loff : b + noff);
 }
+
+#if !defined(__s390x__)
+/*
+ * Portable versions of the functions in misc_asm.S.
+ */
+
+void
+memzero_secure(void *buf, size_t buflen)
+{
+	volatile u8 *p = buf;
+
+	while (buflen--)
+		*p++ = 0;
+}
+
+int
+memcmp_consttime(const void *buf1, const void *buf2, size_t buflen)
+{
+	const volatile u8 *p1 = buf1, *p2 = buf2;
+	u8 diff = 0;
+
+	while (buflen--)
+		diff |= *p1++ ^ *p2++;
+
+	return diff != 0;
+}
+#endif
@@ -0,0 +1,372 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "zpc/parallel.h"
+#include "zpc/error.h"
+
+#include "parallel.h"
+#include "globals.h"
+#include "misc.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAR_THREADS_MAX	256
+
+struct par_job {
+	par_fn_t fn;
+	void *arg;
+	size_t n;
+	size_t next;		/* next chunk to claim */
+	int rc;			/* first error */
+
+	unsigned int busy;	/* workers on the job, protected by par_lock */
+	struct par_job *next_job;
+};
+
+/* Serializes zpc_parallel_set_threads. Taken before par_lock. */
+static pthread_mutex_t par_cfg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t *par_threads;
+
+/* Protects the fields below. */
+static pthread_mutex_t par_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t par_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t par_done = PTHREAD_COND_INITIALIZER;
+static struct par_job *par_jobs;	/* jobs with unclaimed chunks */
+static int par_stop;
+
+/* Read without lock to decide whether an operation is split. */
+static unsigned int par_nthreads;
+
+static void par_job_do(struct par_job *);
+static void par_job_unlink(struct par_job *);
+static void *par_worker(void *);
+static void par_threads_stop(void);
+static void par_atfork_child(void);
+
+int
+zpc_parallel_set_threads(unsigned int nthreads)
+{
+	pthread_t *threads = NULL;
+	unsigned int i;
+	int rc, rv;
+
+	UNUSED(rv);
+
+	if (nthreads > PAR_THREADS_MAX) {
+		rc = ZPC_ERROR_ARG1RANGE;
+		DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+		return rc;
+	}
+
+	if (nthreads > 0) {
+		threads = calloc(nthreads, sizeof(*threads));
+		if (threads == NULL) {
+			rc = ZPC_ERROR_MALLOC;
+			DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+			return rc;
+		}
+	}
+
+	rv = pthread_mutex_lock(&par_cfg_lock);
+	assert(rv == 0);
+
+	par_threads_stop();
+
+	rv = pthread_mutex_lock(&par_lock);
+	assert(rv == 0);
+	par_stop = 0;
+	rv = pthread_mutex_unlock(&par_lock);
+	assert(rv == 0);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, par_worker, NULL) != 0)
+			break;
+	}
+	par_threads = threads;
+	__atomic_store_n(&par_nthreads, i, __ATOMIC_RELAXED);
+
+	if (i < nthreads) {
+		DEBUG("creating worker thread %u failed", i);
+		par_threads_stop();
+		rc = ZPC_ERROR_MALLOC;
+	} else {
+		DEBUG("thread pool: %u workers", nthreads);
+		rc = 0;
+	}
+
+	rv = pthread_mutex_unlock(&par_cfg_lock);
+	assert(rv == 0);
+
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+int
+zpc_parallel_get_threads(unsigned int *nthreads)
+{
+	int rc;
+
+	if (nthreads == NULL) {
+		rc = ZPC_ERROR_ARG1NULL;
+		goto ret;
+	}
+
+	*nthreads = __atomic_load_n(&par_nthreads, __ATOMIC_RELAXED);
+	rc = 0;
+ret:
+	DEBUG("return %d (%s)", rc, zpc_error_string(rc));
+	return rc;
+}
+
+/*
+ * Number of chunks of chunk bytes at the front of len bytes to be done
+ * in parallel, leaving at least tail bytes to the caller. 0 if the pool
+ * is off or there would be less than two chunks.
+ */
+size_t
+par_nchunks(size_t len, size_t chunk, size_t tail)
+{
+	size_t n;
+
+	if (__atomic_load_n(&par_nthreads, __ATOMIC_RELAXED) == 0)
+		return 0;
+	if (len <= tail)
+		return 0;
+
+	n = (len - tail) / chunk;
+	return n < 2 ? 0 : n;
+}
+
+int
+par_run(par_fn_t fn, void *arg, size_t n)
+{
+	struct par_job job;
+	int rv;
+
+	UNUSED(rv);
+
+	memset(&job, 0, sizeof(job));
+	job.fn = fn;
+	job.arg = arg;
+	job.n = n;
+
+	rv = pthread_mutex_lock(&par_lock);
+	assert(rv == 0);
+	job.next_job = par_jobs;
+	par_jobs = &job;
+	rv = pthread_cond_broadcast(&par_work);
+	assert(rv == 0);
+	rv = pthread_mutex_unlock(&par_lock);
+	assert(rv == 0);
+
+	par_job_do(&job);
+
+	/* All chunks are claimed, wait for the workers' ones. */
+	rv = pthread_mutex_lock(&par_lock);
+	assert(rv == 0);
+	par_job_unlink(&job);
+	while (job.busy > 0) {
+		rv = pthread_cond_wait(&par_done, &par_lock);
+		assert(rv == 0);
+	}
+	rv = pthread_mutex_unlock(&par_lock);
+	assert(rv == 0);
+
+	return job.rc;
+}
+
+/*
+ * XTS arithmetic in GF(2^128) with the little-endian block convention of
+ * IEEE 1619: t := t * alpha^n, the tweak n blocks further on.
+ */
+static inline void
+xts_mul_alpha(u8 t[16])
+{
+	u8 carry = t[15] >> 7;
+	int i;
+
+	for (i = 15; i > 0; i--)
+		t[i] = (t[i] << 1) | (t[i - 1] >> 7);
+	t[0] = (t[0] << 1) ^ (carry ? 0x87 : 0);
+}
+
+static void
+xts_gf_mul(u8 out[16], const u8 a[16], const u8 b[16])
+{
+	u8 r[16], v[16];
+	int i, j;
+
+	memset(r, 0, sizeof(r));
+	memcpy(v, a, 16);
+	for (i = 0; i < 128; i++) {
+		if ((b[i / 8] >> (i % 8)) & 1) {
+			for (j = 0; j < 16; j++)
+				r[j] ^= v[j];
+		}
+		xts_mul_alpha(v);
+	}
+	memcpy(out, r, 16);
+}
+
+void
+xts_mul_alpha_pow(u8 t[16], u64 n)
+{
+	u8 base[16];
+
+	memset(base, 0, sizeof(base));
+	base[0] = 0x02;	/* alpha */
+	for (; n > 0; n >>= 1) {
+		if (n & 1)
+			xts_gf_mul(t, t, base);
+		if (n > 1)
+			xts_gf_mul(base, base, base);
+	}
+}
+
+void
+par_init(void)
+{
+	if (pthread_atfork(NULL, NULL, par_atfork_child) != 0)
+		DEBUG("registering thread pool fork handler failed");
+}
+
+void
+par_fini(void)
+{
+	int rv;
+
+	UNUSED(rv);
+
+	rv = pthread_mutex_lock(&par_cfg_lock);
+	assert(rv == 0);
+	par_threads_stop();
+	rv = pthread_mutex_unlock(&par_cfg_lock);
+	assert(rv == 0);
+}
+
+static void
+par_job_do(struct par_job *job)
+{
+	size_t i;
+	int rc, zero;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n) {
+		/* After an error, the remaining chunks are only claimed. */
+		if (__atomic_load_n(&job->rc, __ATOMIC_RELAXED) != 0)
+			continue;
+
+		rc = job->fn(job->arg, i);
+		if (rc != 0) {
+			zero = 0;
+			__atomic_compare_exchange_n(&job->rc, &zero, rc, 0,
+			    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Called with par_lock held. */
+static void
+par_job_unlink(struct par_job *job)
+{
+	struct par_job **p;
+
+	for (p = &par_jobs; *p != NULL; p = &(*p)->next_job) {
+		if (*p == job) {
+			*p = job->next_job;
+			break;
+		}
+	}
+}
+
+static void *
+par_worker(void *unused)
+{
+	struct par_job *job;
+	int rv;
+
+	UNUSED(unused);
+	UNUSED(rv);
+
+	rv = pthread_mutex_lock(&par_lock);
+	assert(rv == 0);
+	for (;;) {
+		while (par_jobs == NULL && !par_stop) {
+			rv = pthread_cond_wait(&par_work, &par_lock);
+			assert(rv == 0);
+		}
+		if (par_stop)
+			break;
+
+		job = par_jobs;
+		job->busy++;
+		rv = pthread_mutex_unlock(&par_lock);
+		assert(rv == 0);
+
+		par_job_do(job);
+
+		rv = pthread_mutex_lock(&par_lock);
+		assert(rv == 0);
+		par_job_unlink(job);
+		if (--job->busy == 0) {
+			rv = pthread_cond_broadcast(&par_done);
+			assert(rv == 0);
+		}
+	}
+	rv = pthread_mutex_unlock(&par_lock);
+	assert(rv == 0);
+
+	return NULL;
+}
+
+/* Called with par_cfg_lock held. */
+static void
+par_threads_stop(void)
+{
+	unsigned int i, n;
+	int rv;
+
+	UNUSED(rv);
+
+	n = __atomic_load_n(&par_nthreads, __ATOMIC_RELAXED);
+	__atomic_store_n(&par_nthreads, 0, __ATOMIC_RELAXED);
+
+	rv = pthread_mutex_lock(&par_lock);
+	assert(rv == 0);
+	par_stop = 1;
+	rv = pthread_cond_broadcast(&par_work);
+	assert(rv == 0);
+	rv = pthread_mutex_unlock(&par_lock);
+	assert(rv == 0);
+
+	for (i = 0; i < n; i++) {
+		rv = pthread_join(par_threads[i], NULL);
+		assert(rv == 0);
+	}
+
+	free(par_threads);
+	par_threads = NULL;
+}
+
+/*
+ * The workers are not copied to a child. Jobs still run there,
+ * on the calling threads only.
+ */
+static void
+par_atfork_child(void)
+{
+	pthread_mutex_init(&par_cfg_lock, NULL);
+	pthread_mutex_init(&par_lock, NULL);
+	pthread_cond_init(&par_work, NULL);
+	pthread_cond_init(&par_done, NULL);
+	par_jobs = NULL;
+	par_threads = NULL;
+	__atomic_store_n(&par_nthreads, 0, __ATOMIC_RELAXED);
+}
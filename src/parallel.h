@@ -0,0 +1,40 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef PARALLEL_H
+# define PARALLEL_H
+
+/*
+ * Internal thread pool interface for bulk operations.
+ *
+ * par_run calls fn(arg, i) for i = 0, ..., n - 1. A job is put on the
+ * pool's job list, then the calling thread and any idle workers claim
+ * chunk indices from the job's counter until all are claimed, so a
+ * worker that finishes early takes over what is left. par_run returns
+ * when all chunks are done, with the first non-zero return value of fn.
+ *
+ * A chunk function works on a private copy of the context, so a
+ * protected key re-derivation of one chunk does not disturb the others.
+ * The context itself is only read while a job runs.
+ */
+
+# include "misc.h"
+
+/* Chunk size [bytes] of byte-stream operations. */
+# define PAR_CHUNK		(256 * 1024)
+
+typedef int (*par_fn_t)(void *arg, size_t i);
+
+size_t par_nchunks(size_t len, size_t chunk, size_t tail);
+int par_run(par_fn_t fn, void *arg, size_t n);
+
+void xts_mul_alpha_pow(u8 t[16], u64 n);
+
+void par_init(void);
+void par_fini(void);
+
+#endif
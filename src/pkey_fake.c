@@ -0,0 +1,629 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "zpc/aes_key.h"
+#include "zpc/aes_xts_key.h"
+#include "zpc/ecc_key.h"
+#include "zpc/hmac_key.h"
+
+#include "pkey_fake.h"
+#include "cpacf_soft.h"
+#include "misc.h"
+#include "zkey/pkey.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+/* Clear key length of a protected key, see fake_keylen. */
+struct fake_keyinfo {
+	u32 pkeytype;	/* PKEY_KEYTYPE_* of the protected key */
+	size_t len;	/* clear key field length */
+	size_t vlen;	/* significant (right-aligned) bytes of the field */
+};
+
+static const struct {
+	u16 secret_type;
+	struct fake_keyinfo info;
+} fake_secrets[] = {
+	{ ZPC_AES_SECRET_AES_128, { PKEY_KEYTYPE_AES_128, 16, 16 } },
+	{ ZPC_AES_SECRET_AES_192, { PKEY_KEYTYPE_AES_192, 24, 24 } },
+	{ ZPC_AES_SECRET_AES_256, { PKEY_KEYTYPE_AES_256, 32, 32 } },
+	{ ZPC_XTS_SECRET_AES_XTS_128, { PKEY_KEYTYPE_AES_XTS_128, 32, 32 } },
+	{ ZPC_XTS_SECRET_AES_XTS_256, { PKEY_KEYTYPE_AES_XTS_256, 64, 64 } },
+	{ ZPC_HMAC_SECRET_HMAC_SHA_256, { PKEY_KEYTYPE_HMAC_512, 64, 64 } },
+	{ ZPC_HMAC_SECRET_HMAC_SHA_512, { PKEY_KEYTYPE_HMAC_1024, 128, 128 } },
+	{ ZPC_EC_SECRET_ECDSA_P256, { PKEY_KEYTYPE_ECC_P256, 32, 32 } },
+	{ ZPC_EC_SECRET_ECDSA_P384, { PKEY_KEYTYPE_ECC_P384, 48, 48 } },
+	{ ZPC_EC_SECRET_ECDSA_P521, { PKEY_KEYTYPE_ECC_P521, 80, 66 } },
+	{ ZPC_EC_SECRET_EDDSA_ED25519, { PKEY_KEYTYPE_ECC_ED25519, 32, 32 } },
+	{ ZPC_EC_SECRET_EDDSA_ED448, { PKEY_KEYTYPE_ECC_ED448, 64, 57 } },
+};
+
+/* Clear key field length per PKEY_KEYTYPE_* value, 0 if unsupported. */
+static size_t fake_keylen(u32 pkeytype)
+{
+	switch (pkeytype) {
+	case PKEY_KEYTYPE_AES_128:
+		return 16;
+	case PKEY_KEYTYPE_AES_192:
+		return 24;
+	case PKEY_KEYTYPE_AES_256:
+	case PKEY_KEYTYPE_ECC_P256:
+	case PKEY_KEYTYPE_ECC_ED25519:
+	case PKEY_KEYTYPE_AES_XTS_128:
+		return 32;
+	case PKEY_KEYTYPE_ECC_P384:
+		return 48;
+	case PKEY_KEYTYPE_ECC_ED448:
+	case PKEY_KEYTYPE_AES_XTS_256:
+	case PKEY_KEYTYPE_HMAC_512:
+		return 64;
+	case PKEY_KEYTYPE_ECC_P521:
+		return 80;
+	case PKEY_KEYTYPE_HMAC_1024:
+		return 128;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static u32 aes_keytype(size_t keylen)
+{
+	switch (keylen) {
+	case 16:
+		return PKEY_KEYTYPE_AES_128;
+	case 24:
+		return PKEY_KEYTYPE_AES_192;
+	default:
+		return PKEY_KEYTYPE_AES_256;
+	}
+}
+
+/*
+ * Deterministic byte stream derived from a label and some data
+ * (FNV-1a seeded splitmix64). Used to mask secure key material and to
+ * derive UV secrets. This is NOT a cryptographic construction.
+ */
+static void fake_stream(u8 *out, size_t outlen, const char *label,
+    const u8 *data, size_t datalen)
+{
+	u64 h = 0xcbf29ce484222325ULL, z = 0;
+	size_t i;
+
+	for (i = 0; label[i] != '\0'; i++)
+		h = (h ^ (u8)label[i]) * 0x100000001b3ULL;
+	for (i = 0; i < datalen; i++)
+		h = (h ^ data[i]) * 0x100000001b3ULL;
+
+	for (i = 0; i < outlen; i++) {
+		if (i % 8 == 0) {
+			h += 0x9e3779b97f4a7c15ULL;
+			z = h;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			z ^= z >> 31;
+		}
+		out[i] = (u8)(z >> (8 * (i % 8)));
+	}
+}
+
+/* Mask (or unmask) secure key material with the fake master key. */
+static void fake_mask(const struct pkey_model_cfg *cfg, u8 *out,
+    const u8 *in, size_t len)
+{
+	u8 mask[32];
+	size_t i;
+
+	fake_stream(mask, len, "master key", cfg->mkvp, sizeof(cfg->mkvp));
+	for (i = 0; i < len; i++)
+		out[i] = in[i] ^ mask[i];
+	memzero_secure(mask, sizeof(mask));
+}
+
+/* Wrap a clear key field: WKa(K) || WKaVP. */
+static int fake_wrap(u8 *pkey, u32 *pkeylen, const u8 *clr, size_t len)
+{
+	if (*pkeylen < len + CPACF_SOFT_WKVPLEN)
+		return EINVAL;
+
+	cpacf_soft_wrap(pkey, pkey + len, clr, len);
+	*pkeylen = len + CPACF_SOFT_WKVPLEN;
+	return 0;
+}
+
+static int fake_apqns_valid(const struct pkey_model_cfg *cfg,
+    const struct pkey_apqn *apqns, u32 apqn_entries)
+{
+	u32 i;
+
+	if (apqn_entries == 0)
+		return 1;
+	if (apqns == NULL)
+		return 0;
+
+	for (i = 0; i < apqn_entries; i++) {
+		if (apqns[i].card < cfg->apqns && apqns[i].domain == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int fake_mkvp_matches(const struct pkey_model_cfg *cfg, u32 type,
+    const u8 *mkvp)
+{
+	switch (type) {
+	case PKEY_TYPE_CCA_DATA:
+	case PKEY_TYPE_CCA_CIPHER:
+	case PKEY_TYPE_CCA_ECC:
+		return memcmp(mkvp, cfg->mkvp, MKVP_LEN_CCA) == 0;
+	default:
+		return memcmp(mkvp, cfg->mkvp, MKVP_LEN_EP11) == 0;
+	}
+}
+
+static int fake_secret(const struct pkey_model_cfg *cfg,
+    const struct uvrsecrettoken *tok, u8 *clr, struct fake_keyinfo *info)
+{
+	size_t i;
+
+	if (!cfg->pvsecrets)
+		return ENODEV;
+
+	for (i = 0; i < NMEMB(fake_secrets); i++) {
+		if (fake_secrets[i].secret_type == tok->secret_type)
+			break;
+	}
+	if (i == NMEMB(fake_secrets))
+		return EINVAL;
+
+	*info = fake_secrets[i].info;
+	if (tok->secret_len != info->len + CPACF_SOFT_WKVPLEN)
+		return EINVAL;
+
+	if (clr != NULL) {
+		memset(clr, 0, info->len);
+		fake_stream(clr + info->len - info->vlen, info->vlen,
+		    "uv secret", (const u8 *)tok, sizeof(*tok));
+		/* Keep ECDSA private keys below the group order. */
+		switch (info->pkeytype) {
+		case PKEY_KEYTYPE_ECC_P256:
+		case PKEY_KEYTYPE_ECC_P384:
+			clr[0] &= 0x7f;
+			break;
+		case PKEY_KEYTYPE_ECC_P521:
+			clr[info->len - info->vlen] = 0;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Unmask the clear AES key of a fake CCA or EP11 secure key token.
+ * *type is set to the token's enum pkey_key_type value.
+ */
+static int fake_unmask_token(const struct pkey_model_cfg *cfg, const u8 *key,
+    u32 keylen, u8 *clr, size_t *clrlen, u32 *type)
+{
+	const struct aesdatakeytoken *data;
+	const struct aescipherkeytoken *cipher;
+	const struct ep11keytoken *ep11;
+	const u8 *mkvp;
+	size_t bits;
+
+	if (is_cca_aes_data_key(key, keylen)) {
+		data = (const struct aesdatakeytoken *)key;
+		mkvp = (const u8 *)&data->mkvp;
+		bits = data->bitsize;
+		*type = PKEY_TYPE_CCA_DATA;
+		key = data->key;
+	} else if (is_cca_aes_cipher_key(key, keylen)) {
+		cipher = (const struct aescipherkeytoken *)key;
+		if (!(cipher->kmf1 & KMF1_XPRT_CPAC))
+			return EINVAL;
+		mkvp = cipher->kvp;
+		bits = cipher->pl;
+		*type = PKEY_TYPE_CCA_CIPHER;
+		key = cipher->varpart;
+	} else if (is_ep11_aes_key_with_header(key, keylen)
+	    || is_ep11_aes_key(key, keylen)) {
+		if (is_ep11_aes_key_with_header(key, keylen)) {
+			bits = ((const struct ep11kblob_header *)key)->bitlen;
+			key += sizeof(struct ep11kblob_header);
+			*type = TOKVER_EP11_AES_WITH_HEADER;
+		} else {
+			bits = ((const struct ep11keytoken *)key)->head.keybitlen;
+			*type = PKEY_TYPE_EP11;
+		}
+		ep11 = (const struct ep11keytoken *)key;
+		if (!(ep11->attr & XCP_BLOB_PROTKEY_EXTRACTABLE))
+			return EINVAL;
+		mkvp = ep11->wkvp;
+		key = ep11->encrypted_key_data;
+	} else {
+		return EINVAL;
+	}
+
+	if (bits != 128 && bits != 192 && bits != 256)
+		return EINVAL;
+	if (!fake_mkvp_matches(cfg, *type, mkvp))
+		return ENODEV;
+
+	*clrlen = bits / 8;
+	fake_mask(cfg, clr, key, *clrlen);
+	return 0;
+}
+
+/* Build a fake secure key token of the given type from a clear AES key. */
+static int fake_mktoken(const struct pkey_model_cfg *cfg, u32 type, u32 size,
+    u32 flags, const u8 *clr, u8 *key, u32 *keylen)
+{
+	struct aesdatakeytoken *data;
+	struct aescipherkeytoken *cipher;
+	struct ep11kblob_header *hdr;
+	struct ep11keytoken *ep11;
+	size_t len;
+
+	if (size != 128 && size != 192 && size != 256)
+		return EINVAL;
+
+	switch (type) {
+	case PKEY_TYPE_CCA_DATA:
+		len = AESDATA_KEY_SIZE;
+		break;
+	case PKEY_TYPE_CCA_CIPHER:
+		len = AESCIPHER_KEY_SIZE;
+		break;
+	case PKEY_TYPE_EP11:
+		len = EP11_KEY_SIZE;
+		break;
+	case TOKVER_EP11_AES_WITH_HEADER:
+		len = sizeof(struct ep11kblob_header) + EP11_KEY_SIZE;
+		break;
+	default:
+		return EINVAL;
+	}
+	if (key == NULL || *keylen < len)
+		return EINVAL;
+
+	memset(key, 0, len);
+
+	switch (type) {
+	case PKEY_TYPE_CCA_DATA:
+		data = (struct aesdatakeytoken *)key;
+		data->type = TOKEN_TYPE_CCA_INTERNAL;
+		data->version = TOKEN_VERSION_AESDATA;
+		memcpy(&data->mkvp, cfg->mkvp, MKVP_LEN_CCA);
+		fake_mask(cfg, data->key, clr, size / 8);
+		data->bitsize = size;
+		data->keysize = size / 8;
+		break;
+	case PKEY_TYPE_CCA_CIPHER:
+		cipher = (struct aescipherkeytoken *)key;
+		cipher->type = TOKEN_TYPE_CCA_INTERNAL;
+		cipher->length = AESCIPHER_KEY_SIZE;
+		cipher->version = TOKEN_VERSION_AESCIPHER;
+		cipher->kms = 0x03;
+		cipher->kvptype = 0x01;
+		memcpy(cipher->kvp, cfg->mkvp, MKVP_LEN_CCA);
+		cipher->kwm = 0x02;
+		cipher->kwh = 0x02;
+		cipher->pfv = 0x01;
+		cipher->adv = 0x01;
+		cipher->adl = 26;
+		cipher->pl = size;
+		cipher->at = 0x02;
+		cipher->kt = 0x0001;
+		cipher->kufc = 2;
+		cipher->kmfc = 3;
+		/* Without flags, the kernel allows the export to CPACF. */
+		cipher->kmf1 = flags ? (u16)(flags & 0xff00) : KMF1_XPRT_CPAC;
+		fake_mask(cfg, cipher->varpart, clr, size / 8);
+		break;
+	default:
+		ep11 = (struct ep11keytoken *)key;
+		if (type == TOKVER_EP11_AES_WITH_HEADER) {
+			hdr = (struct ep11kblob_header *)key;
+			hdr->type = TOKEN_TYPE_NON_CCA;
+			hdr->len = len;
+			hdr->version = TOKVER_EP11_AES_WITH_HEADER;
+			hdr->bitlen = size;
+			ep11 = (struct ep11keytoken *)(key + sizeof(*hdr));
+		} else {
+			ep11->head.type = TOKEN_TYPE_NON_CCA;
+			ep11->head.length = len;
+			ep11->head.version = TOKEN_VERSION_EP11_AES;
+			ep11->head.keybitlen = size;
+		}
+		memcpy(ep11->wkvp, cfg->mkvp, MKVP_LEN_EP11);
+		ep11->attr = flags ? flags : XCP_BLOB_PROTKEY_EXTRACTABLE;
+		ep11->version = EP11_STRUCT_MAGIC;
+		fake_mask(cfg, ep11->encrypted_key_data, clr, size / 8);
+		break;
+	}
+
+	*keylen = len;
+	return 0;
+}
+
+/*
+ * Get the clear key field and protected key type of any key blob that
+ * can be converted to a protected key.
+ */
+static int fake_blob2clr(const struct pkey_model_cfg *cfg, const u8 *key,
+    u32 keylen, u8 *clr, size_t *clrlen, u32 *pkeytype)
+{
+	const struct clearkeytoken *clrtok = (const struct clearkeytoken *)key;
+	const struct tokenheader *hdr = (const struct tokenheader *)key;
+	struct fake_keyinfo info;
+	u32 type;
+	int rc;
+
+	if (key == NULL || keylen < sizeof(*hdr))
+		return EINVAL;
+
+	if (hdr->type == TOKEN_TYPE_NON_CCA
+	    && hdr->version == TOKEN_VERSION_CLEAR_KEY) {
+		if (keylen < sizeof(*clrtok))
+			return EINVAL;
+		*clrlen = fake_keylen(clrtok->keytype);
+		if (*clrlen == 0 || clrtok->len != *clrlen
+		    || keylen < sizeof(*clrtok) + *clrlen)
+			return EINVAL;
+		memcpy(clr, clrtok->clearkey, *clrlen);
+		*pkeytype = clrtok->keytype;
+		return 0;
+	}
+
+	if (hdr->type == TOKEN_TYPE_NON_CCA
+	    && hdr->version == TOKVER_UV_SECRET) {
+		if (keylen < sizeof(struct uvrsecrettoken))
+			return EINVAL;
+		rc = fake_secret(cfg, (const struct uvrsecrettoken *)key, clr,
+		    &info);
+		if (rc)
+			return rc;
+		*clrlen = info.len;
+		*pkeytype = info.pkeytype;
+		return 0;
+	}
+
+	rc = fake_unmask_token(cfg, key, keylen, clr, clrlen, &type);
+	if (rc)
+		return rc;
+	*pkeytype = aes_keytype(*clrlen);
+	return 0;
+}
+
+static int fake_clr2seck2(const struct pkey_model_cfg *cfg,
+    struct pkey_clr2seck2 *io)
+{
+	if (!fake_apqns_valid(cfg, io->apqns, io->apqn_entries))
+		return ENODEV;
+
+	return fake_mktoken(cfg, io->type, io->size, io->keygenflags,
+	    io->clrkey.clrkey, io->key, &io->keylen);
+}
+
+static int fake_genseck2(const struct pkey_model_cfg *cfg,
+    struct pkey_genseck2 *io)
+{
+	u8 clr[32];
+	int rc;
+
+	if (!fake_apqns_valid(cfg, io->apqns, io->apqn_entries))
+		return ENODEV;
+	if (local_rng(clr, sizeof(clr)) != 0)
+		return EIO;
+
+	rc = fake_mktoken(cfg, io->type, io->size, io->keygenflags, clr,
+	    io->key, &io->keylen);
+	memzero_secure(clr, sizeof(clr));
+	return rc;
+}
+
+static int fake_genprotk(struct pkey_genprotk *io)
+{
+	u8 clr[32];
+	size_t len;
+	u32 pkeylen = sizeof(io->protkey.protkey);
+	int rc;
+
+	switch (io->keytype) {
+	case PKEY_KEYTYPE_AES_128:
+	case PKEY_KEYTYPE_AES_192:
+	case PKEY_KEYTYPE_AES_256:
+		break;
+	default:
+		return EINVAL;
+	}
+
+	len = fake_keylen(io->keytype);
+	if (local_rng(clr, len) != 0)
+		return EIO;
+
+	rc = fake_wrap(io->protkey.protkey, &pkeylen, clr, len);
+	memzero_secure(clr, sizeof(clr));
+	if (rc)
+		return rc;
+
+	io->protkey.type = io->keytype;
+	io->protkey.len = pkeylen;
+	return 0;
+}
+
+static int fake_kblob2protk2(const struct pkey_model_cfg *cfg,
+    struct pkey_kblob2pkey2 *io)
+{
+	u8 clr[32];
+	size_t clrlen;
+	u32 type, pkeylen = sizeof(io->protkey.protkey);
+	int rc;
+
+	if (!fake_apqns_valid(cfg, io->apqns, io->apqn_entries))
+		return ENODEV;
+
+	rc = fake_unmask_token(cfg, io->key, io->keylen, clr, &clrlen, &type);
+	if (rc == 0)
+		rc = fake_wrap(io->protkey.protkey, &pkeylen, clr, clrlen);
+	memzero_secure(clr, sizeof(clr));
+	if (rc)
+		return rc;
+
+	io->protkey.type = aes_keytype(clrlen);
+	io->protkey.len = pkeylen;
+	return 0;
+}
+
+static int fake_kblob2protk3(const struct pkey_model_cfg *cfg,
+    struct pkey_kblob2pkey3 *io)
+{
+	u8 clr[CPACF_SOFT_MAX_KEYLEN];
+	size_t clrlen;
+	u32 pkeytype, pkeylen = io->pkeylen;
+	int rc;
+
+	if (!fake_apqns_valid(cfg, io->apqns, io->apqn_entries))
+		return ENODEV;
+	if (io->pkey == NULL)
+		return EINVAL;
+
+	rc = fake_blob2clr(cfg, io->key, io->keylen, clr, &clrlen, &pkeytype);
+	if (rc == 0)
+		rc = fake_wrap(io->pkey, &pkeylen, clr, clrlen);
+	memzero_secure(clr, sizeof(clr));
+	if (rc)
+		return rc;
+
+	io->pkeytype = pkeytype;
+	io->pkeylen = pkeylen;
+	return 0;
+}
+
+static int fake_verifykey2(const struct pkey_model_cfg *cfg,
+    struct pkey_verifykey2 *io)
+{
+	const struct tokenheader *hdr = (const struct tokenheader *)io->key;
+	struct fake_keyinfo info;
+	u8 clr[32];
+	size_t clrlen;
+	u32 type;
+	int rc;
+
+	if (io->key == NULL || io->keylen < sizeof(*hdr))
+		return EINVAL;
+
+	if (hdr->type == TOKEN_TYPE_NON_CCA
+	    && hdr->version == TOKVER_UV_SECRET) {
+		if (io->keylen < sizeof(struct uvrsecrettoken))
+			return EINVAL;
+		return fake_secret(cfg, (const struct uvrsecrettoken *)io->key,
+		    NULL, &info);
+	}
+
+	rc = fake_unmask_token(cfg, io->key, io->keylen, clr, &clrlen, &type);
+	memzero_secure(clr, sizeof(clr));
+	if (rc)
+		return rc;
+
+	io->cardnr = 0;
+	io->domain = 0;
+	io->type = type;
+	io->size = clrlen * 8;
+	io->flags = PKEY_FLAGS_MATCH_CUR_MKVP;
+	return 0;
+}
+
+static int fake_apqns4kt(const struct pkey_model_cfg *cfg,
+    struct pkey_apqns4keytype *io)
+{
+	u32 i, n;
+
+	switch ((u32)io->type) {
+	case PKEY_TYPE_CCA_DATA:
+	case PKEY_TYPE_CCA_CIPHER:
+	case PKEY_TYPE_CCA_ECC:
+	case PKEY_TYPE_EP11:
+	case PKEY_TYPE_EP11_ECC:
+	case TOKVER_EP11_AES_WITH_HEADER:
+		break;
+	default:
+		return EINVAL;
+	}
+
+	n = 0;
+	if (((io->flags & PKEY_FLAGS_MATCH_CUR_MKVP)
+	    && fake_mkvp_matches(cfg, io->type, io->cur_mkvp))
+	    || ((io->flags & PKEY_FLAGS_MATCH_ALT_MKVP)
+	    && fake_mkvp_matches(cfg, io->type, io->alt_mkvp)))
+		n = cfg->apqns;
+
+	if (io->apqn_entries == 0) {
+		io->apqn_entries = n;
+		return 0;
+	}
+	if (io->apqn_entries < n) {
+		io->apqn_entries = n;
+		return ENOSPC;
+	}
+	if (io->apqns == NULL)
+		return EINVAL;
+
+	for (i = 0; i < n; i++) {
+		io->apqns[i].card = i;
+		io->apqns[i].domain = 0;
+	}
+	io->apqn_entries = n;
+	return 0;
+}
+
+int pkey_fake_ioctl(const struct pkey_model_cfg *cfg, unsigned long request,
+    void *arg)
+{
+	int rc;
+
+	switch (request) {
+	case PKEY_CLR2SECK2:
+		rc = fake_clr2seck2(cfg, arg);
+		break;
+	case PKEY_GENSECK2:
+		rc = fake_genseck2(cfg, arg);
+		break;
+	case PKEY_GENPROTK:
+		rc = fake_genprotk(arg);
+		break;
+	case PKEY_KBLOB2PROTK2:
+		rc = fake_kblob2protk2(cfg, arg);
+		break;
+	case PKEY_KBLOB2PROTK3:
+		rc = fake_kblob2protk3(cfg, arg);
+		break;
+	case PKEY_VERIFYKEY2:
+		rc = fake_verifykey2(cfg, arg);
+		break;
+	case PKEY_APQNS4KT:
+		rc = fake_apqns4kt(cfg, arg);
+		break;
+	default:
+		rc = ENOTTY;
+		break;
+	}
+
+	if (rc) {
+		errno = rc;
+		return -1;
+	}
+
+	return 0;
+}
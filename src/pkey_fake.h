@@ -0,0 +1,30 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef PKEY_FAKE_H
+# define PKEY_FAKE_H
+
+/*
+ * Data path of the fake pkey device (build option SOFT_CPACF).
+ *
+ * Executes the pkey ioctls used by libzpc without a crypto card:
+ * secure keys are fake CCA and EP11 AES key tokens, whose key material
+ * is masked with a value derived from the configured MKVP, and protected
+ * keys are wrapped with the emulated wrapping key of the software CPACF
+ * backend. UV retrievable secrets (if enabled) map every secret ID to a
+ * key derived from the ID. EC secure keys are not supported.
+ *
+ * Returns 0 on success. Otherwise, -1 is returned and errno is set,
+ * like ioctl(2).
+ */
+
+# include "pkey_model.h"
+
+int pkey_fake_ioctl(const struct pkey_model_cfg *cfg, unsigned long request,
+    void *arg);
+
+#endif
@@ -0,0 +1,514 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "pkey_io.h"
+#include "globals.h"
+#include "debug.h"
+#include "misc.h"
+#include "stats.h"
+#include "zkey/pkey.h"
+
+#ifdef ZPC_SOFT_CPACF
+# include "cpacf_soft.h"
+# include "pkey_fake.h"
+# include "pkey_model.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#define ENV_PKEY	"ZPC_PKEY"
+
+#define RETRY_MIN_NS	1000000ULL		/* 1 ms */
+#define RETRY_MAX_NS	1000000000ULL		/* 1 s */
+
+static __thread unsigned int backoff_seed;
+
+static int dev_open(const char *arg)
+{
+	UNUSED(arg);
+
+	return open(PKEYDEVICE, O_RDWR);
+}
+
+static int dev_ioctl(int fd, unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+static void dev_close(int fd)
+{
+	close(fd);
+}
+
+static const struct pkey_io_ops dev_ops = {
+	.name = PKEYDEVICE,
+	.open = dev_open,
+	.ioctl = dev_ioctl,
+	.close = dev_close,
+};
+
+#ifdef ZPC_SOFT_CPACF
+
+/* Device options of both fake transports. */
+static struct pkey_model_cfg fake_cfg;
+/* Wrapping key epoch the emulated wrapping key belongs to. */
+static u32 fake_epoch;
+
+static int is_derivation(unsigned long request)
+{
+	return request == PKEY_KBLOB2PROTK2 || request == PKEY_KBLOB2PROTK3
+	    || request == PKEY_GENPROTK;
+}
+
+/*
+ * The kernel answers APQN lists from its cached card information, so
+ * such requests are neither delayed nor rejected by the model.
+ */
+static int is_modeled(unsigned long request)
+{
+	return request != PKEY_APQNS4KT;
+}
+
+/*
+ * Replace the emulated wrapping key if the model moved to a newer
+ * epoch. Requests admitted under an older epoch do not move it back.
+ */
+static void fake_sync_epoch(u32 epoch)
+{
+	u32 seen = __atomic_load_n(&fake_epoch, __ATOMIC_ACQUIRE);
+
+	while ((int)(epoch - seen) > 0) {
+		if (__atomic_compare_exchange_n(&fake_epoch, &seen, epoch, 0,
+		    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			DEBUG("pkey fake: wrapping key epoch %u", epoch);
+			cpacf_soft_wk_rotate();
+			break;
+		}
+	}
+}
+
+/* In-process fake. */
+
+static struct pkey_model fake_model;
+
+static int fake_open(const char *arg)
+{
+	int fd, rc;
+
+	rc = pkey_model_parse(&fake_cfg, arg);
+	if (rc) {
+		DEBUG("pkey fake: invalid options '%s'", arg);
+		return -1;
+	}
+	rc = pkey_model_init(&fake_model, &fake_cfg, fake_sync_epoch);
+	if (rc)
+		return -1;
+
+	/* Reserve a file descriptor, so pkeyfd behaves as usual. */
+	fd = open("/dev/null", O_RDWR);
+	if (fd < 0)
+		pkey_model_fini(&fake_model);
+	return fd;
+}
+
+static int fake_ioctl(int fd, unsigned long request, void *arg)
+{
+	u32 epoch;
+	int err;
+
+	UNUSED(fd);
+
+	if (is_modeled(request)) {
+		err = pkey_model_admit(&fake_model, is_derivation(request),
+		    &epoch);
+		if (err) {
+			errno = err;
+			return -1;
+		}
+		fake_sync_epoch(epoch);
+	}
+
+	return pkey_fake_ioctl(&fake_cfg, request, arg);
+}
+
+static void fake_close(int fd)
+{
+	DEBUG("pkey fake: %lu requests, %lu derivations, %lu busy, epoch %u",
+	    fake_model.nreqs, fake_model.nderivs, fake_model.nbusy,
+	    fake_model.epoch);
+	close(fd);
+	pkey_model_fini(&fake_model);
+}
+
+static const struct pkey_io_ops fake_ops = {
+	.name = "fake",
+	.open = fake_open,
+	.ioctl = fake_ioctl,
+	.close = fake_close,
+};
+
+/*
+ * Fake whose model is provided by zpc_pkeyd. One connection per thread,
+ * plus a watch connection on which the daemon reports wrapping key
+ * replacements that are not triggered by this process' requests.
+ */
+
+static struct sockaddr_un unix_addr;
+static pthread_key_t unix_key;
+static int unix_watch_fd = -1;
+static pthread_t unix_watcher;
+
+static void unix_thread_exit(void *p)
+{
+	close((int)(intptr_t)p - 1);
+}
+
+static int unix_connect(void)
+{
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void unix_disconnect(int fd)
+{
+	pthread_setspecific(unix_key, NULL);
+	close(fd);
+}
+
+static int unix_send(int fd, const struct pkey_model_msg *msg)
+{
+	size_t off;
+	ssize_t n;
+
+	for (off = 0; off < sizeof(*msg); off += n) {
+		n = send(fd, (const u8 *)msg + off, sizeof(*msg) - off,
+		    MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int unix_recv(int fd, struct pkey_model_msg *msg)
+{
+	size_t off;
+	ssize_t n;
+
+	for (off = 0; off < sizeof(*msg); off += n) {
+		n = recv(fd, (u8 *)msg + off, sizeof(*msg) - off, 0);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			return -1;
+	}
+
+	return msg->magic == PKEY_MODEL_MAGIC ? 0 : -1;
+}
+
+static void *unix_watch(void *arg)
+{
+	struct pkey_model_msg msg;
+	int fd = (int)(intptr_t)arg;
+
+	/* Ends when unix_close shuts the connection down. */
+	while (unix_recv(fd, &msg) == 0)
+		fake_sync_epoch(msg.epoch);
+
+	return NULL;
+}
+
+static int unix_watch_start(void)
+{
+	struct pkey_model_msg msg;
+	int fd, rc;
+
+	fd = unix_connect();
+	if (fd < 0)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = PKEY_MODEL_MAGIC;
+	msg.op = PKEY_MODEL_OP_WATCH;
+	if (unix_send(fd, &msg) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	rc = pthread_create(&unix_watcher, NULL, unix_watch,
+	    (void *)(intptr_t)fd);
+	if (rc) {
+		close(fd);
+		return -1;
+	}
+
+	unix_watch_fd = fd;
+	return 0;
+}
+
+static void unix_close(int fd);
+
+static int unix_open(const char *arg)
+{
+	const char *opts;
+	size_t pathlen;
+	int fd, rc;
+
+	opts = strchr(arg, ',');
+	pathlen = opts != NULL ? (size_t)(opts - arg) : strlen(arg);
+	if (pathlen == 0 || pathlen >= sizeof(unix_addr.sun_path)) {
+		DEBUG("pkey unix: invalid socket path");
+		return -1;
+	}
+
+	rc = pkey_model_parse(&fake_cfg, opts != NULL ? opts + 1 : NULL);
+	if (rc) {
+		DEBUG("pkey unix: invalid options '%s'", opts + 1);
+		return -1;
+	}
+
+	memset(&unix_addr, 0, sizeof(unix_addr));
+	unix_addr.sun_family = AF_UNIX;
+	memcpy(unix_addr.sun_path, arg, pathlen);
+
+	rc = pthread_key_create(&unix_key, unix_thread_exit);
+	if (rc)
+		return -1;
+
+	/* Fail early if no daemon listens. */
+	fd = unix_connect();
+	if (fd < 0) {
+		DEBUG("pkey unix: connecting to %s failed, errno = %d",
+		    unix_addr.sun_path, errno);
+		pthread_key_delete(unix_key);
+		return -1;
+	}
+	rc = pthread_setspecific(unix_key, (void *)(intptr_t)(fd + 1));
+	if (rc) {
+		close(fd);
+		pthread_key_delete(unix_key);
+		return -1;
+	}
+
+	rc = unix_watch_start();
+	if (rc) {
+		DEBUG("pkey unix: starting watcher failed");
+		unix_disconnect(fd);
+		pthread_key_delete(unix_key);
+		return -1;
+	}
+
+	fd = open("/dev/null", O_RDWR);
+	if (fd < 0)
+		unix_close(-1);
+	return fd;
+}
+
+static int unix_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct pkey_model_msg msg;
+	void *p;
+
+	UNUSED(fd);
+
+	if (!is_modeled(request))
+		return pkey_fake_ioctl(&fake_cfg, request, arg);
+
+	p = pthread_getspecific(unix_key);
+	if (p != NULL) {
+		fd = (int)(intptr_t)p - 1;
+	} else {
+		fd = unix_connect();
+		if (fd < 0) {
+			errno = EIO;
+			return -1;
+		}
+		pthread_setspecific(unix_key, (void *)(intptr_t)(fd + 1));
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = PKEY_MODEL_MAGIC;
+	msg.op = is_derivation(request) ? PKEY_MODEL_OP_DERIVE
+	    : PKEY_MODEL_OP_REQUEST;
+
+	if (unix_send(fd, &msg) != 0 || unix_recv(fd, &msg) != 0) {
+		/* Reconnect with the next request. */
+		unix_disconnect(fd);
+		errno = EIO;
+		return -1;
+	}
+	if (msg.err) {
+		errno = msg.err;
+		return -1;
+	}
+
+	fake_sync_epoch(msg.epoch);
+	return pkey_fake_ioctl(&fake_cfg, request, arg);
+}
+
+static void unix_close(int fd)
+{
+	void *p;
+
+	if (unix_watch_fd >= 0) {
+		shutdown(unix_watch_fd, SHUT_RDWR);
+		pthread_join(unix_watcher, NULL);
+		close(unix_watch_fd);
+		unix_watch_fd = -1;
+	}
+
+	p = pthread_getspecific(unix_key);
+	if (p != NULL)
+		unix_disconnect((int)(intptr_t)p - 1);
+	pthread_key_delete(unix_key);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+static const struct pkey_io_ops unix_ops = {
+	.name = "unix",
+	.open = unix_open,
+	.ioctl = unix_ioctl,
+	.close = unix_close,
+};
+
+#endif
+
+static const struct pkey_io_ops *pkey_io = &dev_ops;
+
+/*
+ * Open the pkey transport selected by ZPC_PKEY.
+ * Returns a file descriptor to be passed to pkey_ioctl, or -1.
+ */
+int pkey_io_open(void)
+{
+	const struct pkey_io_ops *ops;
+	const char *env, *arg = NULL;
+	int fd;
+
+	env = getenv(ENV_PKEY);
+	if (env == NULL || env[0] == '\0' || strcmp(env, "dev") == 0) {
+		ops = &dev_ops;
+#ifdef ZPC_SOFT_CPACF
+	} else if (strcmp(env, "fake") == 0) {
+		ops = &fake_ops;
+	} else if (strncmp(env, "fake:", 5) == 0) {
+		ops = &fake_ops;
+		arg = env + 5;
+	} else if (strncmp(env, "unix:", 5) == 0) {
+		ops = &unix_ops;
+		arg = env + 5;
+#endif
+	} else {
+		DEBUG("unsupported %s value '%s'", ENV_PKEY, env);
+		return -1;
+	}
+
+	fd = ops->open(arg);
+	if (fd < 0) {
+		DEBUG("opening pkey transport %s failed", ops->name);
+		return -1;
+	}
+
+	pkey_io = ops;
+	DEBUG("opened pkey transport %s: file descriptor %d", ops->name, fd);
+	return fd;
+}
+
+int pkey_ioctl(int fd, unsigned long request, void *arg)
+{
+	return pkey_io->ioctl(fd, request, arg);
+}
+
+/*
+ * Delay before repeating a request for the attempt-th time: doubles
+ * from 1 ms up to 1 s. The upper half is random, so that threads which
+ * failed at the same time do not all retry at the same time again.
+ */
+u64 pkey_backoff_ns(unsigned int attempt)
+{
+	u64 d;
+
+	d = RETRY_MIN_NS << (attempt < 10 ? attempt : 10);
+	if (d > RETRY_MAX_NS)
+		d = RETRY_MAX_NS;
+
+	if (backoff_seed == 0)
+		backoff_seed = (unsigned int)(stats_now()
+		    ^ (u64)syscall(SYS_gettid)) | 1;
+	return d / 2 + (u64)rand_r(&backoff_seed) % (d / 2 + 1);
+}
+
+/*
+ * pkey_ioctl for requests that fail with EBUSY or EAGAIN while the
+ * crypto cards are busy: such requests are repeated after
+ * pkey_backoff_ns until budget_ns nanoseconds were spent sleeping.
+ * A budget of 0 makes a single attempt.
+ */
+int pkey_ioctl_retry(int fd, unsigned long request, void *arg, u64 budget_ns)
+{
+	struct timespec ts;
+	u64 slept = 0, ns;
+	unsigned int i;
+	int rc;
+
+	for (i = 0;; i++) {
+		if (i > 0)
+			stats_inc(STATS_IOCTL_RETRIES);
+		rc = pkey_ioctl(fd, request, arg);
+		if (rc == 0 || (errno != EBUSY && errno != EAGAIN)
+		    || slept >= budget_ns)
+			break;
+
+		ns = pkey_backoff_ns(i);
+		stats_inc(STATS_IOCTL_SLEEPS);
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		nanosleep(&ts, NULL);
+		slept += ns;
+	}
+
+	return rc;
+}
+
+void pkey_io_close(int fd)
+{
+	pkey_io->close(fd);
+}
+
+/* Returns 1 if the transport emulates UV retrievable secrets. */
+int pkey_io_has_pvsecrets(void)
+{
+#ifdef ZPC_SOFT_CPACF
+	if (pkey_io != &dev_ops)
+		return fake_cfg.pvsecrets;
+#endif
+	return 0;
+}
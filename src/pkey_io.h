@@ -0,0 +1,55 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef PKEY_IO_H
+# define PKEY_IO_H
+
+# include "misc.h"
+
+/*
+ * pkey transport.
+ *
+ * All requests to the pkey device go through pkey_ioctl, which has the
+ * semantics of ioctl(2). The transport is selected once at library
+ * initialization via the ZPC_PKEY environment variable:
+ *
+ *   unset, "dev"      the pkey kernel device /dev/pkey (default)
+ *   "fake[:OPTS]"     an in-process fake device
+ *   "unix:PATH[,OPTS]"
+ *                     a fake device whose timing and failure model is
+ *                     provided by a zpc_pkeyd daemon listening on the
+ *                     unix socket PATH, and so is shared by all processes
+ *                     connected to the daemon
+ *
+ * The fake transports are only available with the software CPACF
+ * backend (build option SOFT_CPACF): they produce protected keys
+ * wrapped with its emulated wrapping key. See pkey_model.h for OPTS.
+ */
+
+/*
+ * Retry budgets for pkey_ioctl_retry. Re-derivations of a protected
+ * key after a wrapping key change hold the key's lock, so they give up
+ * early rather than stall the key's other users.
+ */
+# define PKEY_RETRY_BUDGET_NS	10000000000ULL	/* 10 s */
+# define PKEY_RETRY_LOCKED_NS	100000000ULL	/* 100 ms */
+
+struct pkey_io_ops {
+	const char *name;
+	int (*open)(const char *arg);
+	int (*ioctl)(int fd, unsigned long request, void *arg);
+	void (*close)(int fd);
+};
+
+int pkey_io_open(void);
+int pkey_ioctl(int fd, unsigned long request, void *arg);
+int pkey_ioctl_retry(int fd, unsigned long request, void *arg, u64 budget_ns);
+u64 pkey_backoff_ns(unsigned int attempt);
+void pkey_io_close(int fd);
+int pkey_io_has_pvsecrets(void);
+
+#endif
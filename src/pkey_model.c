@@ -0,0 +1,350 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "pkey_model.h"
+#include "misc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const u8 default_mkvp[16] = {
+	0x5a, 0x50, 0x43, 0x46, 0x41, 0x4b, 0x45, 0x00,
+	0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+};
+
+static int parse_ulong(unsigned long *val, const char *str)
+{
+	char *endptr;
+
+	errno = 0;
+	*val = strtoul(str, &endptr, 0);
+	if (errno != 0 || *str == '\0' || *endptr != '\0')
+		return -1;
+
+	return 0;
+}
+
+int pkey_model_parse(struct pkey_model_cfg *cfg, const char *opts)
+{
+	char *buf, *tok, *val, *saveptr = NULL;
+	unsigned long ul;
+	size_t len;
+	int rc = 0;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->busy_burst = 1;
+	cfg->busy_errno = EBUSY;
+	cfg->apqns = 1;
+	memcpy(cfg->mkvp, default_mkvp, sizeof(cfg->mkvp));
+
+	if (opts == NULL || opts[0] == '\0')
+		return 0;
+
+	buf = strdup(opts);
+	if (buf == NULL)
+		return ENOMEM;
+
+	for (tok = strtok_r(buf, ",", &saveptr); tok != NULL;
+	    tok = strtok_r(NULL, ",", &saveptr)) {
+		val = strchr(tok, '=');
+		if (val == NULL) {
+			rc = EINVAL;
+			break;
+		}
+		*val++ = '\0';
+
+		if (strcmp(tok, "busy_errno") == 0) {
+			if (strcmp(val, "EBUSY") == 0)
+				cfg->busy_errno = EBUSY;
+			else if (strcmp(val, "EAGAIN") == 0)
+				cfg->busy_errno = EAGAIN;
+			else
+				rc = EINVAL;
+		} else if (strcmp(tok, "mkvp") == 0) {
+			len = sizeof(cfg->mkvp);
+			if (hexstr2buf(cfg->mkvp, &len, val) != 0)
+				rc = EINVAL;
+		} else if (parse_ulong(&ul, val) != 0) {
+			rc = EINVAL;
+		} else if (strcmp(tok, "latency_us") == 0) {
+			cfg->latency_us = ul;
+		} else if (strcmp(tok, "jitter_us") == 0) {
+			cfg->jitter_us = ul;
+		} else if (strcmp(tok, "slots") == 0) {
+			cfg->slots = ul;
+		} else if (strcmp(tok, "busy_every") == 0) {
+			cfg->busy_every = ul;
+		} else if (strcmp(tok, "busy_burst") == 0) {
+			cfg->busy_burst = ul;
+		} else if (strcmp(tok, "rotate_every") == 0) {
+			cfg->rotate_every = ul;
+		} else if (strcmp(tok, "rotate_ms") == 0) {
+			cfg->rotate_ms = ul;
+		} else if (strcmp(tok, "apqns") == 0) {
+			if (ul < 1 || ul > PKEY_MODEL_MAX_APQNS)
+				rc = EINVAL;
+			cfg->apqns = ul;
+		} else if (strcmp(tok, "pvsecrets") == 0) {
+			cfg->pvsecrets = (ul != 0);
+		} else {
+			rc = EINVAL;
+		}
+
+		if (rc != 0)
+			break;
+	}
+
+	if (cfg->jitter_us > cfg->latency_us)
+		cfg->jitter_us = cfg->latency_us;
+
+	free(buf);
+	return rc;
+}
+
+/* Replace the wrapping key every rotate_ms milliseconds. */
+static void *model_timer(void *arg)
+{
+	struct pkey_model *model = arg;
+	struct timespec deadline;
+	u32 epoch;
+	int rc;
+
+	UNUSED(rc);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	rc = pthread_mutex_lock(&model->lock);
+	assert(rc == 0);
+
+	while (!model->stop) {
+		deadline.tv_sec += model->cfg.rotate_ms / 1000;
+		deadline.tv_nsec += (model->cfg.rotate_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		while (!model->stop && pthread_cond_timedwait(&model->epoch_cond,
+		    &model->lock, &deadline) != ETIMEDOUT)
+			;
+		if (model->stop)
+			break;
+
+		epoch = ++model->epoch;
+		pthread_cond_broadcast(&model->epoch_cond);
+
+		if (model->on_rotate != NULL) {
+			rc = pthread_mutex_unlock(&model->lock);
+			assert(rc == 0);
+			model->on_rotate(epoch);
+			rc = pthread_mutex_lock(&model->lock);
+			assert(rc == 0);
+		}
+	}
+
+	rc = pthread_mutex_unlock(&model->lock);
+	assert(rc == 0);
+	return NULL;
+}
+
+/*
+ * Initialize a model. If rotate_ms is set, a timer thread replaces the
+ * wrapping key periodically and calls on_rotate (if not NULL) with the
+ * new epoch.
+ */
+int pkey_model_init(struct pkey_model *model, const struct pkey_model_cfg *cfg,
+    void (*on_rotate)(u32 epoch))
+{
+	pthread_condattr_t attr;
+	int rc;
+
+	memset(model, 0, sizeof(*model));
+	model->cfg = *cfg;
+	model->on_rotate = on_rotate;
+
+	if (local_rng((u8 *)&model->rng, sizeof(model->rng)) != 0
+	    || model->rng == 0)
+		model->rng = 0x9e3779b97f4a7c15ULL;
+
+	rc = pthread_mutex_init(&model->lock, NULL);
+	if (rc)
+		goto err_lock;
+	rc = pthread_cond_init(&model->cond, NULL);
+	if (rc)
+		goto err_cond;
+	rc = pthread_condattr_init(&attr);
+	if (rc)
+		goto err_condattr;
+	rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (rc == 0)
+		rc = pthread_cond_init(&model->epoch_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (rc)
+		goto err_condattr;
+
+	if (cfg->rotate_ms > 0) {
+		rc = pthread_create(&model->timer, NULL, model_timer, model);
+		if (rc)
+			goto err_timer;
+		model->timer_running = 1;
+	}
+
+	return 0;
+
+err_timer:
+	pthread_cond_destroy(&model->epoch_cond);
+err_condattr:
+	pthread_cond_destroy(&model->cond);
+err_cond:
+	pthread_mutex_destroy(&model->lock);
+err_lock:
+	return rc;
+}
+
+void pkey_model_fini(struct pkey_model *model)
+{
+	int rc;
+
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&model->lock);
+	assert(rc == 0);
+	model->stop = 1;
+	pthread_cond_broadcast(&model->epoch_cond);
+	rc = pthread_mutex_unlock(&model->lock);
+	assert(rc == 0);
+
+	if (model->timer_running) {
+		pthread_join(model->timer, NULL);
+		model->timer_running = 0;
+	}
+
+	pthread_cond_destroy(&model->epoch_cond);
+	pthread_cond_destroy(&model->cond);
+	pthread_mutex_destroy(&model->lock);
+}
+
+/*
+ * Wait until the wrapping key epoch differs from seen and store it in
+ * *epoch. Returns 0, or ECANCELED if the model is being finalized.
+ */
+int pkey_model_wait_epoch(struct pkey_model *model, u32 seen, u32 *epoch)
+{
+	int rc, err = 0;
+
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&model->lock);
+	assert(rc == 0);
+
+	while (!model->stop && model->epoch == seen) {
+		rc = pthread_cond_wait(&model->epoch_cond, &model->lock);
+		assert(rc == 0);
+	}
+	if (model->stop)
+		err = ECANCELED;
+	*epoch = model->epoch;
+
+	rc = pthread_mutex_unlock(&model->lock);
+	assert(rc == 0);
+	return err;
+}
+
+/* xorshift64. Caller must hold model's lock. */
+static u64 model_rand(struct pkey_model *model)
+{
+	u64 x = model->rng;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	model->rng = x;
+	return x;
+}
+
+/*
+ * Admit a request to the modeled device. Blocks for the request's
+ * service time and returns 0 if the request is to be executed, or an
+ * errno value if it fails. *epoch is set to the wrapping key epoch under
+ * which a derivation is to be executed: it changes whenever the modeled
+ * wrapping key is replaced.
+ */
+int pkey_model_admit(struct pkey_model *model, int derive, u32 *epoch)
+{
+	const struct pkey_model_cfg *cfg = &model->cfg;
+	struct timespec ts;
+	unsigned long us = 0;
+	int rc, err = 0;
+
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&model->lock);
+	assert(rc == 0);
+
+	model->nreqs++;
+
+	if (model->burst_left > 0) {
+		model->burst_left--;
+		err = cfg->busy_errno;
+	} else if (cfg->busy_every > 0 && model->nreqs % cfg->busy_every == 0) {
+		model->burst_left = cfg->busy_burst > 0 ? cfg->busy_burst - 1 : 0;
+		err = cfg->busy_errno;
+	}
+	if (err) {
+		/* A busy device rejects the request right away. */
+		model->nbusy++;
+		*epoch = model->epoch;
+		rc = pthread_mutex_unlock(&model->lock);
+		assert(rc == 0);
+		return err;
+	}
+
+	while (cfg->slots > 0 && model->inservice >= cfg->slots) {
+		rc = pthread_cond_wait(&model->cond, &model->lock);
+		assert(rc == 0);
+	}
+	model->inservice++;
+
+	if (cfg->latency_us > 0) {
+		us = cfg->latency_us;
+		if (cfg->jitter_us > 0)
+			us += model_rand(model) % (2 * cfg->jitter_us + 1)
+			    - cfg->jitter_us;
+	}
+
+	if (derive) {
+		model->nderivs++;
+		if (cfg->rotate_every > 0
+		    && model->nderivs % cfg->rotate_every == 0) {
+			model->epoch++;
+			pthread_cond_broadcast(&model->epoch_cond);
+		}
+	}
+	*epoch = model->epoch;
+
+	rc = pthread_mutex_unlock(&model->lock);
+	assert(rc == 0);
+
+	if (us > 0) {
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = (us % 1000000) * 1000;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+	}
+
+	rc = pthread_mutex_lock(&model->lock);
+	assert(rc == 0);
+	model->inservice--;
+	pthread_cond_signal(&model->cond);
+	rc = pthread_mutex_unlock(&model->lock);
+	assert(rc == 0);
+
+	return 0;
+}
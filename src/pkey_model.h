@@ -0,0 +1,105 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef PKEY_MODEL_H
+# define PKEY_MODEL_H
+
+/*
+ * Timing and failure model of a pkey device (see pkey_io.h).
+ *
+ * The model decides how long a pkey request takes, whether it fails
+ * with EBUSY/EAGAIN and when the wrapping key is replaced. It does not
+ * look at the request's data, so it can be shared by the in-process
+ * fake and by the zpc_pkeyd daemon, which arbitrates one model between
+ * several processes.
+ *
+ * Options are given as a comma-separated list of name=value pairs:
+ *   latency_us=N    mean service time of a request [us]
+ *   jitter_us=N     uniformly distributed +/- deviation from latency_us
+ *   slots=N         max. number of requests in service at a time
+ *                   (0: unlimited)
+ *   busy_every=N    every N-th request starts a burst of failures
+ *   busy_burst=N    number of consecutive failures per burst (default 1)
+ *   busy_errno=E    EBUSY (default) or EAGAIN
+ *   rotate_every=N  replace the wrapping key every N derivations
+ *   rotate_ms=N     replace the wrapping key every N milliseconds
+ *   apqns=N         number of emulated APQNs (default 1)
+ *   mkvp=HEX        master key verification pattern of the APQNs
+ *   pvsecrets=0|1   emulate UV retrievable secrets
+ */
+
+# include "misc.h"
+
+# include <pthread.h>
+
+# define PKEY_MODEL_MAX_APQNS	256
+
+struct pkey_model_cfg {
+	unsigned long latency_us;
+	unsigned long jitter_us;
+	unsigned int slots;
+	unsigned long busy_every;
+	unsigned long busy_burst;
+	int busy_errno;
+	unsigned long rotate_every;
+	unsigned long rotate_ms;
+	unsigned int apqns;
+	u8 mkvp[16];
+	int pvsecrets;
+};
+
+struct pkey_model {
+	struct pkey_model_cfg cfg;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* service slot released */
+	pthread_cond_t epoch_cond;	/* epoch changed or stop */
+	unsigned int inservice;
+	unsigned long burst_left;
+	u64 rng;
+
+	/* rotate_ms timer, calls on_rotate after each rotation */
+	pthread_t timer;
+	int timer_running;
+	int stop;
+	void (*on_rotate)(u32 epoch);
+
+	/* statistics */
+	unsigned long nreqs;
+	unsigned long nderivs;
+	unsigned long nbusy;
+	u32 epoch;
+};
+
+/*
+ * Message exchanged between a unix socket client and zpc_pkeyd:
+ * the client sends it with magic and op set. For PKEY_MODEL_OP_REQUEST
+ * and PKEY_MODEL_OP_DERIVE, the daemon answers once with err and epoch
+ * set. For PKEY_MODEL_OP_WATCH, the daemon sends the current epoch and
+ * then a message each time the epoch changes.
+ */
+# define PKEY_MODEL_MAGIC	0x7a706b64	/* "zpkd" */
+
+# define PKEY_MODEL_OP_REQUEST	0
+# define PKEY_MODEL_OP_DERIVE	1	/* request derives a protected key */
+# define PKEY_MODEL_OP_WATCH	2
+
+struct pkey_model_msg {
+	u32 magic;
+	u32 op;
+	int err;	/* 0 or errno value */
+	u32 epoch;	/* wrapping key epoch */
+};
+
+int pkey_model_parse(struct pkey_model_cfg *cfg, const char *opts);
+int pkey_model_init(struct pkey_model *model, const struct pkey_model_cfg *cfg,
+    void (*on_rotate)(u32 epoch));
+void pkey_model_fini(struct pkey_model *model);
+int pkey_model_admit(struct pkey_model *model, int derive, u32 *epoch);
+int pkey_model_wait_epoch(struct pkey_model *model, u32 seen, u32 *epoch);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef SEQLOCK_H
+# define SEQLOCK_H
+
+/*
+ * Sequence counter for data that is read much more often than written,
+ * like the protected key of a key object.
+ *
+ * Writers are serialized by a lock of their own. They make the counter
+ * odd while they change the data. Readers take no lock: they copy the
+ * data and retry if the counter was odd or has changed meanwhile, so
+ * they never return a torn copy.
+ *
+ *	do {
+ *		seq = seq_read_begin(&obj->seq);
+ *		memcpy(copy, obj->data, len);
+ *	} while (seq_read_retry(&obj->seq, seq));
+ */
+
+static inline void
+seq_write_begin(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+seq_write_end(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int
+seq_read_begin(const unsigned int *seq)
+{
+	unsigned int s;
+
+	while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+	return s;
+}
+
+static inline int
+seq_read_retry(const unsigned int *seq, unsigned int s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != s;
+}
+
+#endif
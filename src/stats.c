@@ -0,0 +1,309 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "zpc/stats.h"
+#include "zpc/error.h"
+
+#include "stats.h"
+#include "globals.h"
+#include "misc.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENV_STATS	"ZPC_STATS"
+
+int stats_enabled;
+__thread struct stats_thread *stats_self;
+__thread struct stats_ctx *stats_cur;
+
+/* Protects the fields below. */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static int stats_key_created;
+static struct stats_thread *stats_threads;	/* blocks of live threads */
+static struct stats_thread stats_retired;	/* sum of exited threads */
+static struct stats_thread stats_base;		/* sum at last reset */
+
+static void
+stats_fold(struct stats_thread *sum, const struct stats_thread *t)
+{
+	size_t i, j;
+
+	for (i = 0; i < NMEMB(t->cnt); i++)
+		sum->cnt[i] += __atomic_load_n(&t->cnt[i], __ATOMIC_RELAXED);
+
+	for (i = 0; i < NMEMB(t->op); i++) {
+		sum->op[i].calls += __atomic_load_n(&t->op[i].calls,
+		    __ATOMIC_RELAXED);
+		sum->op[i].bytes += __atomic_load_n(&t->op[i].bytes,
+		    __ATOMIC_RELAXED);
+		for (j = 0; j < NMEMB(t->op[i].latency); j++) {
+			sum->op[i].latency[j] +=
+			    __atomic_load_n(&t->op[i].latency[j],
+			    __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Sum up all blocks. Caller holds stats_lock. */
+static void
+stats_sum(struct stats_thread *sum)
+{
+	const struct stats_thread *t;
+
+	memcpy(sum, &stats_retired, sizeof(*sum));
+	for (t = stats_threads; t != NULL; t = t->next)
+		stats_fold(sum, t);
+}
+
+static void
+stats_thread_exit(void *p)
+{
+	struct stats_thread *self = p, **t;
+	int rc;
+
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&stats_lock);
+	assert(rc == 0);
+
+	for (t = &stats_threads; *t != NULL; t = &(*t)->next) {
+		if (*t == self) {
+			*t = self->next;
+			break;
+		}
+	}
+	stats_fold(&stats_retired, self);
+
+	rc = pthread_mutex_unlock(&stats_lock);
+	assert(rc == 0);
+
+	stats_self = NULL;
+	free(self);
+}
+
+struct stats_thread *
+stats_thread_new(void)
+{
+	struct stats_thread *self;
+	int rc;
+
+	UNUSED(rc);
+
+	if (!stats_key_created)
+		return NULL;
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return NULL;
+
+	if (pthread_setspecific(stats_key, self) != 0) {
+		free(self);
+		return NULL;
+	}
+
+	rc = pthread_mutex_lock(&stats_lock);
+	assert(rc == 0);
+	self->next = stats_threads;
+	stats_threads = self;
+	rc = pthread_mutex_unlock(&stats_lock);
+	assert(rc == 0);
+
+	stats_self = self;
+	return self;
+}
+
+/*
+ * Log-linear bucket index: values below ZPC_STATS_HIST_SUB_BUCKETS map
+ * to themselves, larger values to the sub-bucket of their power of two.
+ */
+unsigned int
+stats_hist_bucket(u64 ns)
+{
+	unsigned int e, i;
+
+	if (ns < ZPC_STATS_HIST_SUB_BUCKETS)
+		return (unsigned int)ns;
+
+	e = 63 - __builtin_clzll(ns);
+	i = (e - 2) * ZPC_STATS_HIST_SUB_BUCKETS
+	    + ((ns >> (e - 3)) & (ZPC_STATS_HIST_SUB_BUCKETS - 1));
+	return i < ZPC_STATS_HIST_BUCKETS ? i : ZPC_STATS_HIST_BUCKETS - 1;
+}
+
+void
+stats_ctx_get(const struct stats_ctx *ctx, struct zpc_stats_counters *counters)
+{
+	u64 cnt[STATS_CNT_NMEMB];
+	size_t i;
+
+	for (i = 0; i < NMEMB(cnt); i++)
+		cnt[i] = __atomic_load_n(&ctx->cnt[i], __ATOMIC_RELAXED);
+
+	counters->ops = cnt[STATS_OPS];
+	counters->bytes = cnt[STATS_BYTES];
+	counters->cpacf_calls = cnt[STATS_CPACF_CALLS];
+	counters->cpacf_partial = cnt[STATS_CPACF_PARTIAL];
+	counters->wkvp_mismatch = cnt[STATS_WKVP_MISMATCH];
+	counters->rederive = cnt[STATS_REDERIVE];
+	counters->ioctl_retries = cnt[STATS_IOCTL_RETRIES];
+	counters->ioctl_sleeps = cnt[STATS_IOCTL_SLEEPS];
+	counters->lock_waits = cnt[STATS_LOCK_WAITS];
+	counters->lock_wait_ns = cnt[STATS_LOCK_WAIT_NS];
+}
+
+void
+stats_init(void)
+{
+	char *env;
+
+	if (pthread_key_create(&stats_key, stats_thread_exit) != 0) {
+		DEBUG("creating statistics key failed");
+		return;
+	}
+	stats_key_created = 1;
+
+	env = getenv(ENV_STATS);
+	if (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0) {
+		DEBUG("statistics enabled");
+		__atomic_store_n(&stats_enabled, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Threads may still be running when the library is unloaded,
+ * so their blocks are not freed.
+ */
+void
+stats_fini(void)
+{
+	__atomic_store_n(&stats_enabled, 0, __ATOMIC_RELAXED);
+
+	if (stats_key_created) {
+		stats_key_created = 0;
+		pthread_key_delete(stats_key);
+	}
+}
+
+int
+zpc_stats_enable(int enable)
+{
+	int old;
+
+	old = __atomic_exchange_n(&stats_enabled, enable ? 1 : 0,
+	    __ATOMIC_RELAXED);
+
+	DEBUG("statistics %s", enable ? "enabled" : "disabled");
+	return old;
+}
+
+int
+zpc_stats_get(struct zpc_stats *stats)
+{
+	struct stats_thread *sum;
+	struct stats_ctx total;
+	size_t i, j;
+	int rc;
+
+	UNUSED(rc);
+
+	if (stats == NULL)
+		return ZPC_ERROR_ARG1NULL;
+
+	sum = malloc(sizeof(*sum));
+	if (sum == NULL)
+		return ZPC_ERROR_MALLOC;
+
+	rc = pthread_mutex_lock(&stats_lock);
+	assert(rc == 0);
+
+	stats_sum(sum);
+
+	for (i = 0; i < NMEMB(total.cnt); i++)
+		total.cnt[i] = sum->cnt[i] - stats_base.cnt[i];
+	stats_ctx_get(&total, &stats->total);
+
+	for (i = 0; i < NMEMB(stats->op); i++) {
+		stats->op[i].calls = sum->op[i].calls - stats_base.op[i].calls;
+		stats->op[i].bytes = sum->op[i].bytes - stats_base.op[i].bytes;
+		for (j = 0; j < NMEMB(stats->op[i].latency); j++) {
+			stats->op[i].latency[j] = sum->op[i].latency[j]
+			    - stats_base.op[i].latency[j];
+		}
+	}
+
+	rc = pthread_mutex_unlock(&stats_lock);
+	assert(rc == 0);
+
+	free(sum);
+	return 0;
+}
+
+void
+zpc_stats_reset(void)
+{
+	int rc;
+
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&stats_lock);
+	assert(rc == 0);
+	stats_sum(&stats_base);
+	rc = pthread_mutex_unlock(&stats_lock);
+	assert(rc == 0);
+}
+
+unsigned long long
+zpc_stats_hist_value(unsigned int bucket)
+{
+	if (bucket >= ZPC_STATS_HIST_BUCKETS)
+		bucket = ZPC_STATS_HIST_BUCKETS - 1;
+	if (bucket < ZPC_STATS_HIST_SUB_BUCKETS)
+		return bucket;
+
+	return (unsigned long long)(ZPC_STATS_HIST_SUB_BUCKETS
+	    + bucket % ZPC_STATS_HIST_SUB_BUCKETS)
+	    << (bucket / ZPC_STATS_HIST_SUB_BUCKETS - 1);
+}
+
+unsigned long long
+zpc_stats_hist_percentile(const unsigned long long *hist, double percentile)
+{
+	unsigned long long total = 0, rank, seen = 0;
+	unsigned int i;
+
+	if (hist == NULL)
+		return 0;
+
+	for (i = 0; i < ZPC_STATS_HIST_BUCKETS; i++)
+		total += hist[i];
+	if (total == 0)
+		return 0;
+
+	if (percentile < 0.0)
+		percentile = 0.0;
+	if (percentile > 100.0)
+		percentile = 100.0;
+
+	/* nearest rank */
+	rank = (unsigned long long)(percentile / 100.0 * (double)total);
+	if ((double)rank < percentile / 100.0 * (double)total)
+		rank++;
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < ZPC_STATS_HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return zpc_stats_hist_value(i);
+}
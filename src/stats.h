@@ -0,0 +1,214 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef STATS_H
+# define STATS_H
+
+/*
+ * Internal statistics interface.
+ *
+ * Each thread counts into its own block, which is only written by that
+ * thread. Updates are relaxed atomic loads and stores, so they neither
+ * bounce cache lines between threads nor tear for readers summing up
+ * the blocks in zpc_stats_get. Events that happen during an operation
+ * on a context are also counted in the context's stats_ctx, which is
+ * updated the same way (a context is used by one thread at a time).
+ */
+
+# include "zpc/stats.h"
+
+# include "misc.h"
+
+# include <errno.h>
+# include <pthread.h>
+# include <time.h>
+
+/* Counter indices, in the order of struct zpc_stats_counters. */
+enum stats_cnt {
+	STATS_OPS = 0,
+	STATS_BYTES,
+	STATS_CPACF_CALLS,
+	STATS_CPACF_PARTIAL,
+	STATS_WKVP_MISMATCH,
+	STATS_REDERIVE,
+	STATS_IOCTL_RETRIES,
+	STATS_IOCTL_SLEEPS,
+	STATS_LOCK_WAITS,
+	STATS_LOCK_WAIT_NS,
+	STATS_CNT_NMEMB
+};
+
+struct stats_ctx {
+	u64 cnt[STATS_CNT_NMEMB];
+};
+
+struct stats_op_hist {
+	u64 calls;
+	u64 bytes;
+	u64 latency[ZPC_STATS_HIST_BUCKETS];
+};
+
+struct stats_thread {
+	u64 cnt[STATS_CNT_NMEMB];
+	struct stats_op_hist op[ZPC_STATS_OP_NMEMB];
+	struct stats_thread *next;
+};
+
+/* Operation in progress, see stats_op_begin. */
+struct stats_op {
+	struct stats_ctx *ctx;	/* NULL: not recorded */
+	struct stats_ctx *prev;
+	zpc_stats_op_t op;
+	u64 t0;
+};
+
+extern int stats_enabled;
+extern __thread struct stats_thread *stats_self;
+extern __thread struct stats_ctx *stats_cur;
+
+void stats_init(void);
+void stats_fini(void);
+struct stats_thread *stats_thread_new(void);
+unsigned int stats_hist_bucket(u64 ns);
+void stats_ctx_get(const struct stats_ctx *ctx,
+    struct zpc_stats_counters *counters);
+
+static inline int
+stats_on(void)
+{
+	return __atomic_load_n(&stats_enabled, __ATOMIC_RELAXED);
+}
+
+static inline u64
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+/* Add n to a counter that only the calling thread writes. */
+static inline void
+stats_put(u64 *cnt, u64 n)
+{
+	__atomic_store_n(cnt, __atomic_load_n(cnt, __ATOMIC_RELAXED) + n,
+	    __ATOMIC_RELAXED);
+}
+
+static inline struct stats_thread *
+stats_thread(void)
+{
+	struct stats_thread *self = stats_self;
+
+	return self != NULL ? self : stats_thread_new();
+}
+
+static inline void
+stats_add(enum stats_cnt cnt, u64 n)
+{
+	struct stats_thread *self;
+
+	if (!stats_on())
+		return;
+
+	self = stats_thread();
+	if (self != NULL)
+		stats_put(&self->cnt[cnt], n);
+	if (stats_cur != NULL)
+		stats_put(&stats_cur->cnt[cnt], n);
+}
+
+static inline void
+stats_inc(enum stats_cnt cnt)
+{
+	stats_add(cnt, 1);
+}
+
+/* Count a CPACF instruction and its partial completions. */
+static inline void
+stats_cpacf(unsigned long partial, int wkvp_mismatch)
+{
+	if (!stats_on())
+		return;
+
+	stats_add(STATS_CPACF_CALLS, 1);
+	if (partial)
+		stats_add(STATS_CPACF_PARTIAL, partial);
+	if (wkvp_mismatch)
+		stats_add(STATS_WKVP_MISMATCH, 1);
+}
+
+/*
+ * Start recording an operation on the context whose counters are ctx.
+ * Every stats_op_begin must be matched by a stats_op_end.
+ */
+static inline void
+stats_op_begin(struct stats_op *op, struct stats_ctx *ctx,
+    zpc_stats_op_t type)
+{
+	op->ctx = NULL;
+	if (!stats_on())
+		return;
+
+	op->ctx = ctx;
+	op->prev = stats_cur;
+	op->op = type;
+	stats_cur = ctx;
+	op->t0 = stats_now();
+}
+
+static inline void
+stats_op_end(struct stats_op *op, size_t bytes)
+{
+	struct stats_thread *self;
+	struct stats_op_hist *hist;
+	u64 ns;
+
+	if (op->ctx == NULL)
+		return;
+
+	ns = stats_now() - op->t0;
+	stats_cur = op->prev;
+
+	stats_put(&op->ctx->cnt[STATS_OPS], 1);
+	stats_put(&op->ctx->cnt[STATS_BYTES], bytes);
+
+	self = stats_thread();
+	if (self == NULL)
+		return;
+
+	stats_put(&self->cnt[STATS_OPS], 1);
+	stats_put(&self->cnt[STATS_BYTES], bytes);
+	hist = &self->op[op->op];
+	stats_put(&hist->calls, 1);
+	stats_put(&hist->bytes, bytes);
+	stats_put(&hist->latency[stats_hist_bucket(ns)], 1);
+}
+
+/* pthread_mutex_lock that records the time spent waiting for the lock. */
+static inline int
+stats_mutex_lock(pthread_mutex_t *lock)
+{
+	u64 t0;
+	int rc;
+
+	if (!stats_on())
+		return pthread_mutex_lock(lock);
+
+	rc = pthread_mutex_trylock(lock);
+	if (rc != EBUSY)
+		return rc;
+
+	t0 = stats_now();
+	rc = pthread_mutex_lock(lock);
+	stats_add(STATS_LOCK_WAITS, 1);
+	stats_add(STATS_LOCK_WAIT_NS, stats_now() - t0);
+	return rc;
+}
+
+#endif
@@ -0,0 +1,752 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "trace.h"
+#include "globals.h"
+#include "misc.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#define TRACE_RING_SIZE		512	/* records per thread, power of 2 */
+#define TRACE_ARGS		8	/* argument words per record */
+#define TRACE_STRLEN		128	/* bytes for %s arguments per record */
+#define TRACE_LINELEN		1024
+#define TRACE_DRAIN_MS		10
+
+#define TRACE_STR_NULL		UINT64_MAX
+
+/* Argument type of a conversion specification. */
+enum trace_arg {
+	TRACE_ARG_NONE = 0,	/* %% */
+	TRACE_ARG_INT,
+	TRACE_ARG_LONG,
+	TRACE_ARG_LLONG,
+	TRACE_ARG_SIZE,
+	TRACE_ARG_INTMAX,
+	TRACE_ARG_PTRDIFF,
+	TRACE_ARG_DOUBLE,
+	TRACE_ARG_LDOUBLE,
+	TRACE_ARG_PTR,
+	TRACE_ARG_STR,
+	TRACE_ARG_BAD		/* unsupported, e.g. %n */
+};
+
+struct trace_spec {
+	size_t len;		/* length including the '%' */
+	enum trace_arg arg;
+	int sign;		/* signed integer conversion */
+	int nstar;		/* '*' width/precision arguments */
+	int prec;		/* literal precision or -1 */
+	int prec_star;		/* precision is a '*' argument */
+};
+
+struct trace_rec {
+	u64 ns;
+	const struct trace_site *site;
+	const char *fmt;
+	unsigned int nargs;	/* arguments recorded */
+	u64 arg[TRACE_ARGS];	/* %s: offset into str */
+	char str[TRACE_STRLEN];
+};
+
+/*
+ * Single producer (the owning thread), single consumer (the drainer,
+ * serialized by trace_lock) ring. head and tail are free-running.
+ */
+struct trace_ring {
+	u64 head;		/* written by the owner */
+	u64 dropped;		/* written by the owner */
+	int dead;		/* owner has exited */
+	unsigned long long tid;
+
+	u64 tail __attribute__((aligned(256)));	/* written by the drainer */
+	u64 end;		/* head at start of a drain */
+	u64 reported;		/* dropped records reported */
+	struct trace_ring *next;
+
+	struct trace_rec rec[TRACE_RING_SIZE];
+};
+
+static int trace_running;	/* messages go to the rings */
+static __thread struct trace_ring *trace_self;
+
+/* Protects the fields below and serializes draining. */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+static struct trace_ring *trace_rings;
+static pthread_key_t trace_key;
+static int trace_key_created;
+static pthread_t trace_thread;
+static int trace_drainer;	/* drainer thread is running */
+static int trace_stop;
+
+static void
+trace_spec_parse(const char *p, struct trace_spec *spec)
+{
+	const char *s = p + 1;
+	int l = 0, longdbl = 0;
+
+	spec->nstar = 0;
+	spec->prec = -1;
+	spec->prec_star = 0;
+	spec->sign = 0;
+
+	while (*s != '\0' && strchr("-+ #0'", *s) != NULL)
+		s++;
+	if (*s == '*') {
+		spec->nstar++;
+		s++;
+	} else {
+		while (*s >= '0' && *s <= '9')
+			s++;
+	}
+	if (*s == '.') {
+		s++;
+		if (*s == '*') {
+			spec->nstar++;
+			spec->prec_star = 1;
+			s++;
+		} else {
+			spec->prec = 0;
+			while (*s >= '0' && *s <= '9')
+				spec->prec = spec->prec * 10 + (*s++ - '0');
+		}
+	}
+
+	switch (*s) {
+	case 'h':
+		s += (s[1] == 'h') ? 2 : 1;
+		break;
+	case 'l':
+		if (s[1] == 'l') {
+			l = TRACE_ARG_LLONG;
+			s += 2;
+		} else {
+			l = TRACE_ARG_LONG;
+			s++;
+		}
+		break;
+	case 'q':
+		l = TRACE_ARG_LLONG;
+		s++;
+		break;
+	case 'z':
+		l = TRACE_ARG_SIZE;
+		s++;
+		break;
+	case 'j':
+		l = TRACE_ARG_INTMAX;
+		s++;
+		break;
+	case 't':
+		l = TRACE_ARG_PTRDIFF;
+		s++;
+		break;
+	case 'L':
+		longdbl = 1;
+		s++;
+		break;
+	default:
+		break;
+	}
+
+	switch (*s) {
+	case 'd':
+	case 'i':
+		spec->sign = 1;
+		/* fall-through */
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		spec->arg = l ? (enum trace_arg)l : TRACE_ARG_INT;
+		break;
+	case 'c':
+		spec->arg = l ? TRACE_ARG_BAD : TRACE_ARG_INT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec->arg = longdbl ? TRACE_ARG_LDOUBLE : TRACE_ARG_DOUBLE;
+		break;
+	case 's':
+		spec->arg = l ? TRACE_ARG_BAD : TRACE_ARG_STR;
+		break;
+	case 'p':
+		spec->arg = TRACE_ARG_PTR;
+		break;
+	case '%':
+		spec->arg = TRACE_ARG_NONE;
+		break;
+	default:
+		spec->arg = TRACE_ARG_BAD;
+		break;
+	}
+	if (*s != '\0')
+		s++;
+
+	spec->len = s - p;
+}
+
+/* Store a %s argument in the record's string buffer. */
+static u64
+trace_str(struct trace_rec *rec, size_t *used, const char *str, int prec)
+{
+	size_t len, off = *used;
+
+	if (str == NULL)
+		return TRACE_STR_NULL;
+
+	len = prec >= 0 ? strnlen(str, prec) : strlen(str);
+	if (off >= sizeof(rec->str))
+		off = sizeof(rec->str) - 1;	/* the terminating NUL */
+	if (len > sizeof(rec->str) - 1 - off)
+		len = sizeof(rec->str) - 1 - off;
+
+	memcpy(rec->str + off, str, len);
+	rec->str[off + len] = '\0';
+	*used = off + len + 1;
+	return off;
+}
+
+/*
+ * Record the arguments of fmt. Recording stops at the first argument
+ * that does not fit or cannot be recorded.
+ */
+static void
+trace_args(struct trace_rec *rec, const char *fmt, va_list ap)
+{
+	struct trace_spec spec;
+	size_t used = 0;
+	unsigned int n = 0;
+	const char *p;
+	double d;
+	int i, prec;
+
+	for (p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%')) {
+		trace_spec_parse(p, &spec);
+		p += spec.len;
+
+		if (spec.arg == TRACE_ARG_NONE)
+			continue;
+		if (spec.arg == TRACE_ARG_BAD
+		    || n + spec.nstar + 1 > TRACE_ARGS)
+			break;
+
+		prec = spec.prec;
+		for (i = 0; i < spec.nstar; i++) {
+			prec = va_arg(ap, int);
+			rec->arg[n++] = (u64)(long long)prec;
+		}
+		if (!spec.prec_star)
+			prec = spec.prec;
+
+		switch (spec.arg) {
+		case TRACE_ARG_INT:
+			rec->arg[n] = spec.sign ? (u64)(long long)va_arg(ap, int)
+			    : (u64)va_arg(ap, unsigned int);
+			break;
+		case TRACE_ARG_LONG:
+			rec->arg[n] = spec.sign ? (u64)(long long)va_arg(ap, long)
+			    : (u64)va_arg(ap, unsigned long);
+			break;
+		case TRACE_ARG_LLONG:
+			rec->arg[n] = spec.sign ? (u64)va_arg(ap, long long)
+			    : (u64)va_arg(ap, unsigned long long);
+			break;
+		case TRACE_ARG_SIZE:
+			rec->arg[n] = (u64)va_arg(ap, size_t);
+			break;
+		case TRACE_ARG_INTMAX:
+			rec->arg[n] = (u64)va_arg(ap, intmax_t);
+			break;
+		case TRACE_ARG_PTRDIFF:
+			rec->arg[n] = (u64)va_arg(ap, ptrdiff_t);
+			break;
+		case TRACE_ARG_DOUBLE:
+			d = va_arg(ap, double);
+			memcpy(&rec->arg[n], &d, sizeof(d));
+			break;
+		case TRACE_ARG_LDOUBLE:
+			d = (double)va_arg(ap, long double);
+			memcpy(&rec->arg[n], &d, sizeof(d));
+			break;
+		case TRACE_ARG_PTR:
+			rec->arg[n] = (u64)(uintptr_t)va_arg(ap, void *);
+			break;
+		case TRACE_ARG_STR:
+			rec->arg[n] = trace_str(rec, &used,
+			    va_arg(ap, const char *), prec);
+			break;
+		default:
+			break;
+		}
+		n++;
+	}
+
+	rec->nargs = n;
+}
+
+static size_t
+trace_put(size_t off, int len)
+{
+	if (len < 0)
+		return off;
+	off += len;
+	return off < TRACE_LINELEN ? off : TRACE_LINELEN - 1;
+}
+
+static const char *
+trace_basename(const char *file)
+{
+	const char *p = strrchr(file, '/');
+
+	return p != NULL ? p + 1 : file;
+}
+
+/*
+ * Print one argument using its conversion specification. The spec is
+ * from a DEBUG format string, which the compiler checked.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#define TRACE_SNPRINTF(buf, size, spec, nstar, w, val)			\
+	((nstar) == 0 ? snprintf(buf, size, spec, val)			\
+	 : (nstar) == 1 ? snprintf(buf, size, spec, w[0], val)		\
+	 : snprintf(buf, size, spec, w[0], w[1], val))
+
+static int
+trace_format_arg(char *buf, size_t size, const char *spec,
+    const struct trace_spec *s, const struct trace_rec *rec, unsigned int n)
+{
+	int w[2] = { 0, 0 }, i;
+	u64 v;
+	double d;
+
+	for (i = 0; i < s->nstar; i++)
+		w[i] = (int)rec->arg[n++];
+	v = rec->arg[n];
+
+	switch (s->arg) {
+	case TRACE_ARG_INT:
+		if (strchr("cdi", spec[s->len - 1]) != NULL)
+			return TRACE_SNPRINTF(buf, size, spec, s->nstar, w, (int)v);
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (unsigned int)v);
+	case TRACE_ARG_LONG:
+		if (s->sign)
+			return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+			    (long)v);
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (unsigned long)v);
+	case TRACE_ARG_LLONG:
+		if (s->sign)
+			return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+			    (long long)v);
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (unsigned long long)v);
+	case TRACE_ARG_SIZE:
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w, (size_t)v);
+	case TRACE_ARG_INTMAX:
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (intmax_t)v);
+	case TRACE_ARG_PTRDIFF:
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (ptrdiff_t)v);
+	case TRACE_ARG_DOUBLE:
+		memcpy(&d, &v, sizeof(d));
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w, d);
+	case TRACE_ARG_LDOUBLE:
+		memcpy(&d, &v, sizeof(d));
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (long double)d);
+	case TRACE_ARG_PTR:
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    (void *)(uintptr_t)v);
+	case TRACE_ARG_STR:
+		return TRACE_SNPRINTF(buf, size, spec, s->nstar, w,
+		    v == TRACE_STR_NULL ? "(null)" : rec->str + v);
+	default:
+		return 0;
+	}
+}
+#undef TRACE_SNPRINTF
+#pragma GCC diagnostic pop
+
+/* Format a record the way the synchronous path prints it. */
+static void
+trace_format(char *buf, const struct trace_ring *ring,
+    const struct trace_rec *rec)
+{
+	struct trace_spec s;
+	char spec[32];
+	const char *p, *q;
+	unsigned int n = 0;
+	size_t off;
+
+	off = trace_put(0, snprintf(buf, TRACE_LINELEN,
+	    "libzpc %d.%d.%d: pid %llu: tid %llu: %s: %s:%d: ",
+	    ZPC_VERSION_MAJOR, ZPC_VERSION_MINOR, ZPC_VERSION_PATCH,
+	    (unsigned long long)getpid(), ring->tid, rec->site->func,
+	    trace_basename(rec->site->file), rec->site->line));
+
+	for (p = rec->fmt; *p != '\0';) {
+		q = strchr(p, '%');
+		if (q == NULL)
+			q = p + strlen(p);
+		if (q > p) {
+			off = trace_put(off, snprintf(buf + off,
+			    TRACE_LINELEN - off, "%.*s", (int)(q - p), p));
+			p = q;
+			continue;
+		}
+
+		trace_spec_parse(p, &s);
+		if (s.arg == TRACE_ARG_NONE) {
+			off = trace_put(off, snprintf(buf + off,
+			    TRACE_LINELEN - off, "%%"));
+		} else if (s.arg == TRACE_ARG_BAD || s.len >= sizeof(spec)
+		    || n + s.nstar + 1 > rec->nargs) {
+			/* not recorded: print the specification itself */
+			off = trace_put(off, snprintf(buf + off,
+			    TRACE_LINELEN - off, "%.*s", (int)s.len, p));
+			n = rec->nargs;
+		} else {
+			memcpy(spec, p, s.len);
+			spec[s.len] = '\0';
+			off = trace_put(off, trace_format_arg(buf + off,
+			    TRACE_LINELEN - off, spec, &s, rec, n));
+			n += s.nstar + 1;
+		}
+		p += s.len;
+	}
+
+	snprintf(buf + off, TRACE_LINELEN - off, "\n");
+}
+
+/*
+ * Print all records written to the rings so far, in time order,
+ * and free the rings of exited threads. Caller holds trace_lock.
+ */
+static void
+trace_drain(void)
+{
+	struct trace_ring *ring, *min, **r;
+	const struct trace_rec *rec;
+	char buf[TRACE_LINELEN];
+	u64 dropped;
+	int rc;
+
+	UNUSED(rc);
+
+	for (ring = trace_rings; ring != NULL; ring = ring->next)
+		ring->end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	rc = pthread_mutex_lock(&debuglock);
+	assert(rc == 0);
+
+	for (;;) {
+		min = NULL;
+		for (ring = trace_rings; ring != NULL; ring = ring->next) {
+			if (ring->tail == ring->end)
+				continue;
+			if (min == NULL || ring->rec[ring->tail
+			    & (TRACE_RING_SIZE - 1)].ns < min->rec[min->tail
+			    & (TRACE_RING_SIZE - 1)].ns)
+				min = ring;
+		}
+		if (min == NULL)
+			break;
+
+		rec = &min->rec[min->tail & (TRACE_RING_SIZE - 1)];
+		trace_format(buf, min, rec);
+		fputs(buf, stderr);
+		__atomic_store_n(&min->tail, min->tail + 1, __ATOMIC_RELEASE);
+	}
+
+	for (ring = trace_rings; ring != NULL; ring = ring->next) {
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped == ring->reported)
+			continue;
+		fprintf(stderr, "libzpc %d.%d.%d: pid %llu: tid %llu: "
+		    "%llu debug messages dropped\n", ZPC_VERSION_MAJOR,
+		    ZPC_VERSION_MINOR, ZPC_VERSION_PATCH,
+		    (unsigned long long)getpid(), ring->tid,
+		    (unsigned long long)(dropped - ring->reported));
+		ring->reported = dropped;
+	}
+
+	rc = pthread_mutex_unlock(&debuglock);
+	assert(rc == 0);
+
+	for (r = &trace_rings; *r != NULL;) {
+		ring = *r;
+		if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE)
+		    && ring->tail == __atomic_load_n(&ring->head,
+		    __ATOMIC_ACQUIRE)) {
+			*r = ring->next;
+			free(ring);
+		} else {
+			r = &ring->next;
+		}
+	}
+}
+
+static void *
+trace_drain_thread(void *arg)
+{
+	struct timespec ts;
+	int rc;
+
+	UNUSED(arg);
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&trace_lock);
+	assert(rc == 0);
+
+	while (!trace_stop) {
+		trace_drain();
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += TRACE_DRAIN_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&trace_cond, &trace_lock, &ts);
+	}
+
+	rc = pthread_mutex_unlock(&trace_lock);
+	assert(rc == 0);
+	return NULL;
+}
+
+static void
+trace_thread_exit(void *p)
+{
+	struct trace_ring *ring = p;
+	int rc;
+
+	UNUSED(rc);
+
+	trace_self = NULL;
+
+	rc = pthread_mutex_lock(&trace_lock);
+	assert(rc == 0);
+
+	__atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+	/* Without a drainer, nobody else would print and free the ring. */
+	if (!trace_drainer)
+		trace_drain();
+
+	rc = pthread_mutex_unlock(&trace_lock);
+	assert(rc == 0);
+}
+
+static struct trace_ring *
+trace_ring_new(void)
+{
+	struct trace_ring *ring;
+	int rc;
+
+	UNUSED(rc);
+
+	if (!trace_key_created)
+		return NULL;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+
+	ring->tid = (unsigned long long)syscall(SYS_gettid);
+
+	if (pthread_setspecific(trace_key, ring) != 0) {
+		free(ring);
+		return NULL;
+	}
+
+	rc = pthread_mutex_lock(&trace_lock);
+	assert(rc == 0);
+	ring->next = trace_rings;
+	trace_rings = ring;
+	rc = pthread_mutex_unlock(&trace_lock);
+	assert(rc == 0);
+
+	trace_self = ring;
+	return ring;
+}
+
+static void
+trace_sync(const struct trace_site *site, const char *fmt, va_list ap)
+{
+	int rc;
+
+	UNUSED(rc);
+
+	rc = pthread_mutex_lock(&debuglock);
+	assert(rc == 0);
+
+	fprintf(stderr, "libzpc %d.%d.%d: pid %llu: tid %llu: %s: %s:%d: ",
+	    ZPC_VERSION_MAJOR, ZPC_VERSION_MINOR, ZPC_VERSION_PATCH,
+	    (unsigned long long)getpid(),
+	    (unsigned long long)syscall(SYS_gettid),
+	    site->func, trace_basename(site->file), site->line);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+
+	rc = pthread_mutex_unlock(&debuglock);
+	assert(rc == 0);
+}
+
+void
+trace_log(const struct trace_site *site, const char *fmt, ...)
+{
+	struct trace_ring *ring = NULL;
+	struct trace_rec *rec;
+	struct timespec ts;
+	u64 head, used;
+	va_list ap;
+
+	va_start(ap, fmt);
+
+	if (__atomic_load_n(&trace_running, __ATOMIC_ACQUIRE)) {
+		ring = trace_self;
+		if (ring == NULL)
+			ring = trace_ring_new();
+	}
+	if (ring == NULL) {
+		trace_sync(site, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	head = ring->head;
+	used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (used >= TRACE_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1,
+		    __ATOMIC_RELAXED);
+		va_end(ap);
+		return;
+	}
+
+	rec = &ring->rec[head & (TRACE_RING_SIZE - 1)];
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->ns = (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+	rec->site = site;
+	rec->fmt = fmt;
+	trace_args(rec, fmt, ap);
+	va_end(ap);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	/* Do not wait for the next period if the ring is filling up. */
+	if (used + 1 == TRACE_RING_SIZE / 2)
+		pthread_cond_signal(&trace_cond);
+}
+
+static void
+trace_atfork_prepare(void)
+{
+	pthread_mutex_lock(&trace_lock);
+}
+
+static void
+trace_atfork_parent(void)
+{
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/* The child has no drainer: it writes its messages synchronously. */
+static void
+trace_atfork_child(void)
+{
+	__atomic_store_n(&trace_running, 0, __ATOMIC_RELEASE);
+	trace_drainer = 0;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void
+trace_init(void)
+{
+	sigset_t all, old;
+	int rc;
+
+	if (!debug)
+		return;
+
+	if (pthread_key_create(&trace_key, trace_thread_exit) != 0)
+		return;
+	trace_key_created = 1;
+
+	if (pthread_atfork(trace_atfork_prepare, trace_atfork_parent,
+	    trace_atfork_child) != 0)
+		return;
+
+	/* Signals are for the application's threads. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(&trace_thread, NULL, trace_drain_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc != 0)
+		return;
+
+	trace_drainer = 1;
+	__atomic_store_n(&trace_running, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Records written by other threads after the final drain are lost.
+ * Their rings are not freed since those threads may still be running.
+ */
+void
+trace_fini(void)
+{
+	int rc;
+
+	UNUSED(rc);
+
+	__atomic_store_n(&trace_running, 0, __ATOMIC_RELEASE);
+
+	if (trace_drainer) {
+		rc = pthread_mutex_lock(&trace_lock);
+		assert(rc == 0);
+		trace_stop = 1;
+		pthread_cond_signal(&trace_cond);
+		rc = pthread_mutex_unlock(&trace_lock);
+		assert(rc == 0);
+
+		pthread_join(trace_thread, NULL);
+	}
+
+	rc = pthread_mutex_lock(&trace_lock);
+	assert(rc == 0);
+	trace_drain();
+	trace_drainer = 0;
+	rc = pthread_mutex_unlock(&trace_lock);
+	assert(rc == 0);
+
+	if (trace_key_created) {
+		trace_key_created = 0;
+		pthread_key_delete(trace_key);
+	}
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef TRACE_H
+# define TRACE_H
+
+/*
+ * Debug trace records (ZPC_DEBUG).
+ *
+ * trace_log stores a binary record - call site, format string and the
+ * raw arguments - in the calling thread's ring buffer. Only the owning
+ * thread writes a ring and only the drainer reads it, so recording a
+ * message takes no lock and makes no system call. A background thread
+ * formats the records and writes them to stderr. If a ring is full,
+ * records are dropped and the number of dropped records is reported.
+ *
+ * Before trace_init and after trace_fini, or if the rings cannot be
+ * set up, messages are written synchronously under debuglock.
+ */
+
+/* Call site, a static object at each DEBUG invocation. */
+struct trace_site {
+	const char *func;
+	const char *file;
+	int line;
+};
+
+void trace_init(void);
+void trace_fini(void);
+void trace_log(const struct trace_site *site, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
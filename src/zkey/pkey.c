@@ -29,6 +29,7 @@
 #include "lib/util_panic.h"
 
 #include "pkey.h"
+#include "pkey_io.h"
 #include "utils.h"
 
 /**
@@ -338,8 +339,8 @@ int alloc_apqns_from_mkvp(int pkeyfd, struct pkey_apqn **apqns, size_t *napqns,
 		apqns4keytype.apqns = *apqns;
 		apqns4keytype.apqn_entries = *napqns;
 
-		rc = ioctl(pkeyfd, PKEY_APQNS4KT, &apqns4keytype);
-		if (rc && (*napqns == 0 || (*napqns > 0 && rc != ENOSPC))) {
+		rc = pkey_ioctl(pkeyfd, PKEY_APQNS4KT, &apqns4keytype);
+		if (rc && (*napqns == 0 || errno != ENOSPC)) {
 			rc = ZPC_ERROR_IOCTLAPQNS4KT;
 			goto ret;
 		} else if (rc == 0 && apqns4keytype.apqn_entries == 0) {
@@ -0,0 +1,14 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Build test for aes_ctr.h.
+ */
+#include "zpc/aes_ctr.h"
+#include "zpc/aes_ctr.h"
+
+int b_aes_ctr_not_empty;
@@ -0,0 +1,14 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Build test for ctx_pool.h.
+ */
+#include "zpc/ctx_pool.h"
+#include "zpc/ctx_pool.h"
+
+int b_ctx_pool_not_empty;
@@ -19,6 +19,11 @@
 #include "zpc/aes_cmac.h"
 #include "zpc/ecc_key.h"
 #include "zpc/ecdsa_ctx.h"
+#include "zpc/stats.h"
+#include "zpc/ctx_pool.h"
+#include "zpc/parallel.h"
+#include "zpc/aes_ctr.h"
+#include "zpc/aes_gmac.h"
 
 #ifndef ZPC_ERROR_H
 # error "ZPC_ERROR_H undefined."
@@ -50,5 +55,11 @@
 #ifndef ZPC_ECC_KEY_H
 # error "ZPC_ECC_KEY_H undefined."
 #endif
+#ifndef ZPC_STATS_H
+# error "ZPC_STATS_H undefined."
+#endif
+#ifndef ZPC_CTX_POOL_H
+# error "ZPC_CTX_POOL_H undefined."
+#endif
 
 int b_headers_not_empty;
@@ -0,0 +1,14 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * Build test for stats.h.
+ */
+#include "zpc/stats.h"
+#include "zpc/stats.h"
+
+int b_stats_not_empty;
@@ -15,6 +15,7 @@
 #include "aes_cbc_local.h"  /* de-opaquify struct zpc_aes_cbc */
 
 #include <json-c/json.h>
+#include <algorithm>
 #include <stdio.h>
 #include <thread>
 #include <unistd.h>
@@ -362,6 +363,235 @@ ret:
 	EXPECT_EQ(aes_key, nullptr);
 }
 
+TEST(aes_cbc, encryptv)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cbc *aes_cbc;
+	struct iovec miov[16], civ[16];
+	u8 iv[16], m[320], c[320], c2[320];
+	int rc, size, iovcnt;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CBC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_alloc(&aes_cbc);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_key(aes_cbc, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(m, 0x5a, sizeof(m));
+	iovcnt = testlib_iov_split(miov, 16, m, sizeof(m), 0);
+	(void)testlib_iov_split(civ, iovcnt, c2, sizeof(c2), 3);
+
+	rc = zpc_aes_cbc_encryptv(aes_cbc, civ, miov, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encrypt(aes_cbc, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encryptv(aes_cbc, civ, miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decryptv(aes_cbc, miov, civ, iovcnt);
+	EXPECT_EQ(rc, 0);
+	memset(c, 0x5a, sizeof(c));
+	EXPECT_TRUE(memcmp(m, c, sizeof(m)) == 0);
+
+	zpc_aes_cbc_free(&aes_cbc);
+	EXPECT_EQ(aes_cbc, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_cbc, pad)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cbc *aes_cbc;
+	u8 iv[16], m[100], m2[128], ref[128], c[128], c2[128], blk[16];
+	const size_t lens[] = { 0, 1, 15, 16, 17, 100 };
+	const size_t chunks[] = { 1, 15, 16, 17, 3, 32, 5 };
+	size_t len, clen, off, n, i, j, k, padlen;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CBC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_alloc(&aes_cbc);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_key(aes_cbc, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(iv, 0xa5, sizeof(iv));
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = i * 7;
+
+	for (k = 0; k < NMEMB(lens); k++) {
+		/* Reference: pad by hand, then encrypt in one call. */
+		padlen = 16 - lens[k] % 16;
+		clen = lens[k] + padlen;
+		memcpy(ref, m, lens[k]);
+		memset(ref + lens[k], (int)padlen, padlen);
+		rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_cbc_encrypt(aes_cbc, ref, ref, clen);
+		EXPECT_EQ(rc, 0);
+
+		rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+		EXPECT_EQ(rc, 0);
+		for (off = 0, len = 0, i = 0; off < lens[k]; off += n, i++) {
+			n = std::min(chunks[i % NMEMB(chunks)], lens[k] - off);
+			rc = zpc_aes_cbc_encrypt_pad_update(aes_cbc,
+			    c + len, &j, m + off, n);
+			EXPECT_EQ(rc, 0);
+			len += j;
+		}
+		rc = zpc_aes_cbc_encrypt_pad_final(aes_cbc, c + len, &j);
+		EXPECT_EQ(rc, 0);
+		EXPECT_EQ(j, 16UL);
+		len += j;
+		EXPECT_EQ(len, clen);
+		EXPECT_TRUE(memcmp(c, ref, len) == 0);
+
+		rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+		EXPECT_EQ(rc, 0);
+		for (off = 0, len = 0, i = 0; off < clen; off += n, i++) {
+			n = std::min(chunks[i % NMEMB(chunks)], clen - off);
+			rc = zpc_aes_cbc_decrypt_pad_update(aes_cbc,
+			    m2 + len, &j, c + off, n);
+			EXPECT_EQ(rc, 0);
+			len += j;
+		}
+		rc = zpc_aes_cbc_decrypt_pad_final(aes_cbc, m2 + len, &j);
+		EXPECT_EQ(rc, 0);
+		len += j;
+		EXPECT_EQ(len, lens[k]);
+		EXPECT_TRUE(memcmp(m2, m, len) == 0);
+	}
+
+	/* Invalid padding: 0, more than 16, inconsistent bytes. */
+	for (k = 0; k < 3; k++) {
+		memset(blk, 0x02, sizeof(blk));
+		blk[15] = k == 0 ? 0x00 : k == 1 ? 0x11 : 0x03;
+		rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_cbc_encrypt(aes_cbc, c2, blk, sizeof(blk));
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_cbc_decrypt_pad_update(aes_cbc, m2, &len, c2,
+		    sizeof(blk));
+		EXPECT_EQ(rc, 0);
+		EXPECT_EQ(len, 0UL);
+		rc = zpc_aes_cbc_decrypt_pad_final(aes_cbc, m2, &len);
+		EXPECT_EQ(rc, ZPC_ERROR_PADDING);
+		memset(blk, 0, sizeof(blk));
+		EXPECT_TRUE(memcmp(m2, blk, sizeof(blk)) == 0);
+	}
+
+	/* Ciphertext not a positive multiple of the block size. */
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt_pad_final(aes_cbc, m2, &len);
+	EXPECT_EQ(rc, ZPC_ERROR_CLEN);
+	rc = zpc_aes_cbc_decrypt_pad_update(aes_cbc, m2, &len, c, 15);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt_pad_final(aes_cbc, m2, &len);
+	EXPECT_EQ(rc, ZPC_ERROR_CLEN);
+
+	zpc_aes_cbc_free(&aes_cbc);
+	EXPECT_EQ(aes_cbc, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_cbc, dup)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cbc *aes_cbc1, *aes_cbc2;
+	u8 iv[16], m[96], c[96], c1[96], c2[96];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CBC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_alloc(&aes_cbc1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_key(aes_cbc1, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_cbc_dup(NULL, aes_cbc1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_cbc_dup(&aes_cbc2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(m, 0x5a, sizeof(m));
+
+	rc = zpc_aes_cbc_set_iv(aes_cbc1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encrypt(aes_cbc1, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Both contexts continue the chain after the first 32 bytes. */
+	rc = zpc_aes_cbc_set_iv(aes_cbc1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encrypt(aes_cbc1, c1, m, 32);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_dup(&aes_cbc2, aes_cbc1);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	rc = zpc_aes_cbc_encrypt(aes_cbc1, c1 + 32, m + 32, 64);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encrypt(aes_cbc2, c2 + 32, m + 32, 64);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c + 32, c1 + 32, 64) == 0);
+	EXPECT_TRUE(memcmp(c + 32, c2 + 32, 64) == 0);
+
+	zpc_aes_cbc_free(&aes_cbc1);
+	EXPECT_EQ(aes_cbc1, nullptr);
+	zpc_aes_cbc_free(&aes_cbc2);
+	EXPECT_EQ(aes_cbc2, nullptr);
+}
+
 TEST(aes_cbc, pc)
 {
 	struct zpc_aes_key *aes_key1, *aes_key2;
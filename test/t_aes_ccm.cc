@@ -16,6 +16,7 @@
 
 #include <json-c/json.h>
 #include <stdio.h>
+#include <algorithm>
 #include <thread>
 #include <unistd.h>
 
@@ -1582,3 +1583,269 @@ ret:
 
 	free(key);
 }
+
+TEST(aes_ccm, multipart)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ccm *aes_ccm;
+	const char *mkvp, *apqns[257];
+	const size_t chunks[] = { 1, 3, 16, 17, 31, 64, 100 };
+	const size_t lens[] = { 0, 1, 15, 16, 17, 255, 1000 };
+	u8 iv[11], key[32], tag1[16], tag2[16];
+	u8 aad[1000], m[1000], c1[1000], c2[1000], m2[1000];
+	size_t i, j, k, off, n, aadlen, mlen;
+	unsigned int flags;
+	int rc, size, type;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_AES_SW_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, size, flags);
+
+	for (i = 0; i < sizeof(m); i++) {
+		aad[i] = (u8)(i * 7);
+		m[i] = (u8)(i * 13 + 1);
+	}
+	memset(iv, 0x5a, sizeof(iv));
+	memset(key, 0xa5, sizeof(key));
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_alloc(&aes_ccm);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_type(aes_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_aes_key_set_mkvp(aes_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_aes_key_set_apqns(aes_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_set_flags(aes_key, flags);
+	EXPECT_EQ(rc, 0);
+
+	if (type != ZPC_AES_KEY_TYPE_PVSECRET) {
+		rc = zpc_aes_key_import_clear(aes_key, key);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = testlib_set_aes_key_from_pvsecret(aes_key, size);
+		if (rc)
+			goto ret;
+	}
+
+	rc = zpc_aes_ccm_set_key(aes_ccm, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	/* No operation started. */
+	rc = zpc_aes_ccm_update_aad(aes_ccm, aad, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+	rc = zpc_aes_ccm_set_iv(aes_ccm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_update_aad(aes_ccm, aad, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_CCM_STATE);
+	rc = zpc_aes_ccm_encrypt_final(aes_ccm, tag1);
+	EXPECT_EQ(rc, ZPC_ERROR_CCM_STATE);
+	rc = zpc_aes_ccm_init(aes_ccm, 0, 0, 5);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+
+	/* Multi-part equals one-shot for all length and chunk combinations. */
+	for (i = 0; i < NMEMB(lens); i++) {
+		for (j = 0; j < NMEMB(lens); j++) {
+			for (k = 0; k < NMEMB(chunks); k++) {
+				aadlen = lens[i];
+				mlen = lens[j];
+
+				rc = zpc_aes_ccm_encrypt(aes_ccm, c1, tag1, 12,
+				    aad, aadlen, m, mlen);
+				EXPECT_EQ(rc, 0);
+
+				rc = zpc_aes_ccm_init(aes_ccm, aadlen, mlen, 12);
+				EXPECT_EQ(rc, 0);
+				for (off = 0; off < aadlen; off += n) {
+					n = std::min(chunks[k], aadlen - off);
+					rc = zpc_aes_ccm_update_aad(aes_ccm,
+					    aad + off, n);
+					EXPECT_EQ(rc, 0);
+				}
+				for (off = 0; off < mlen; off += n) {
+					n = std::min(chunks[k], mlen - off);
+					rc = zpc_aes_ccm_encrypt_update(aes_ccm,
+					    c2 + off, m + off, n);
+					EXPECT_EQ(rc, 0);
+				}
+				rc = zpc_aes_ccm_encrypt_final(aes_ccm, tag2);
+				EXPECT_EQ(rc, 0);
+				EXPECT_TRUE(memcmp(c1, c2, mlen) == 0);
+				EXPECT_TRUE(memcmp(tag1, tag2, 12) == 0);
+
+				rc = zpc_aes_ccm_init(aes_ccm, aadlen, mlen, 12);
+				EXPECT_EQ(rc, 0);
+				for (off = 0; off < aadlen; off += n) {
+					n = std::min(chunks[k], aadlen - off);
+					rc = zpc_aes_ccm_update_aad(aes_ccm,
+					    aad + off, n);
+					EXPECT_EQ(rc, 0);
+				}
+				for (off = 0; off < mlen; off += n) {
+					n = std::min(chunks[k], mlen - off);
+					rc = zpc_aes_ccm_decrypt_update(aes_ccm,
+					    m2 + off, c2 + off, n);
+					EXPECT_EQ(rc, 0);
+				}
+				rc = zpc_aes_ccm_decrypt_final(aes_ccm, tag2);
+				EXPECT_EQ(rc, 0);
+				EXPECT_TRUE(memcmp(m, m2, mlen) == 0);
+			}
+		}
+	}
+
+	/* Tag mismatch. */
+	rc = zpc_aes_ccm_init(aes_ccm, 17, 17, 12);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_update_aad(aes_ccm, aad, 17);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_decrypt_update(aes_ccm, m2, c2, 17);
+	EXPECT_EQ(rc, 0);
+	tag2[0] ^= 1;
+	rc = zpc_aes_ccm_decrypt_final(aes_ccm, tag2);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+
+	/* State errors. */
+	rc = zpc_aes_ccm_init(aes_ccm, 17, 17, 12);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_encrypt_update(aes_ccm, c2, m, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_CCM_STATE);
+	rc = zpc_aes_ccm_update_aad(aes_ccm, aad, 18);
+	EXPECT_EQ(rc, ZPC_ERROR_AADLEN);
+	rc = zpc_aes_ccm_update_aad(aes_ccm, aad, 17);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_encrypt_update(aes_ccm, c2, m, 18);
+	EXPECT_EQ(rc, ZPC_ERROR_MLEN);
+	rc = zpc_aes_ccm_encrypt_update(aes_ccm, c2, m, 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_decrypt_update(aes_ccm, m2, c2, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_CCM_STATE);
+	rc = zpc_aes_ccm_encrypt_final(aes_ccm, tag1);
+	EXPECT_EQ(rc, ZPC_ERROR_CCM_STATE);
+	/* A one-shot operation aborts the multi-part operation. */
+	rc = zpc_aes_ccm_encrypt(aes_ccm, c1, tag1, 12, aad, 17, m, 17);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_encrypt_update(aes_ccm, c2, m, 16);
+	EXPECT_EQ(rc, ZPC_ERROR_CCM_STATE);
+
+ret:
+	zpc_aes_ccm_free(&aes_ccm);
+	EXPECT_EQ(aes_ccm, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+/*
+ * A multi-part call that changed the context before it found an outdated
+ * protected key cannot be repeated: it must not return ZPC_ERROR_AGAIN,
+ * even for a non-blocking key.
+ */
+TEST(aes_ccm, multipart_nonblock)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ccm *aes_ccm;
+	const char *mkvp, *apqns[257];
+	u8 iv[11], key[32], tag1[16], tag2[16];
+	u8 aad[5], m[100], c1[100], c2[100];
+	unsigned int flags;
+	size_t i;
+	int rc, size, type;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, size, flags);
+
+	if (type == ZPC_AES_KEY_TYPE_PVSECRET)
+		GTEST_SKIP_("Skipping multipart_nonblock test. Not applicable for PVSECRET type keys.");
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)(i * 13 + 1);
+	memset(aad, 0x3c, sizeof(aad));
+	memset(iv, 0x5a, sizeof(iv));
+	memset(key, 0xa5, sizeof(key));
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_alloc(&aes_ccm);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_type(aes_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_aes_key_set_mkvp(aes_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_aes_key_set_apqns(aes_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_set_flags(aes_key, flags);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_import_clear(aes_key, key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_nonblock(aes_key, 1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ccm_set_key(aes_ccm, aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_set_iv(aes_ccm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ccm_encrypt(aes_ccm, c1, tag1, 12, aad, sizeof(aad), m,
+	    sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ccm_init(aes_ccm, sizeof(aad), sizeof(m), 12);
+	EXPECT_EQ(rc, 0);
+
+	/* The aad is buffered before its block is MACed. */
+	memset(aes_key->prot.protkey, 0, sizeof(aes_key->prot.protkey));    /* force WKaVP mismatch */
+	memset(aes_ccm->param_kma.protkey, 0, sizeof(aes_ccm->param_kma.protkey));
+	memset(aes_ccm->param_kmac.protkey, 0, sizeof(aes_ccm->param_kmac.protkey));
+	rc = zpc_aes_ccm_update_aad(aes_ccm, aad, sizeof(aad));
+	EXPECT_EQ(rc, 0);
+
+	memcpy(c2, m, sizeof(m));
+	rc = zpc_aes_ccm_encrypt_update(aes_ccm, c2, c2, sizeof(c2));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ccm_encrypt_final(aes_ccm, tag2);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c1, c2, sizeof(c1)) == 0);
+	EXPECT_TRUE(memcmp(tag1, tag2, 12) == 0);
+
+	zpc_aes_ccm_free(&aes_ccm);
+	EXPECT_EQ(aes_ccm, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
@@ -16,6 +16,7 @@
 
 #include <json-c/json.h>
 #include <stdio.h>
+#include <algorithm>
 #include <thread>
 #include <unistd.h>
 
@@ -273,6 +274,257 @@ ret:
 	EXPECT_EQ(aes_key, nullptr);
 }
 
+TEST(aes_cmac, signv)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cmac *aes_cmac;
+	struct iovec miov[16];
+	u8 m[333], tag[16], tag2[16];
+	int rc, size, iovcnt;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_alloc(&aes_cmac);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_set_key(aes_cmac, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0x5a, sizeof(m));
+	iovcnt = testlib_iov_split(miov, 16, m, sizeof(m), 0);
+
+	rc = zpc_aes_cmac_signv(aes_cmac, tag2, 4, miov, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+
+	rc = zpc_aes_cmac_sign(aes_cmac, tag, sizeof(tag), m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_signv(aes_cmac, tag2, sizeof(tag2), miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+
+	rc = zpc_aes_cmac_verifyv(aes_cmac, tag, sizeof(tag), miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	tag[0] ^= 1;
+	rc = zpc_aes_cmac_verifyv(aes_cmac, tag, sizeof(tag), miov, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+
+	zpc_aes_cmac_free(&aes_cmac);
+	EXPECT_EQ(aes_cmac, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_cmac, dup)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cmac *aes_cmac1, *aes_cmac2;
+	u8 m[333], tag[16], tag1[16], tag2[16];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_alloc(&aes_cmac1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_set_key(aes_cmac1, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_cmac_dup(NULL, aes_cmac1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_cmac_dup(&aes_cmac2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	memset(m, 0x5a, sizeof(m));
+
+	rc = zpc_aes_cmac_sign(aes_cmac1, tag, sizeof(tag), m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Fork after a common prefix. */
+	rc = zpc_aes_cmac_sign(aes_cmac1, NULL, 0, m, 128);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_dup(&aes_cmac2, aes_cmac1);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	rc = zpc_aes_cmac_sign(aes_cmac1, tag1, sizeof(tag1), m + 128,
+	    sizeof(m) - 128);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_sign(aes_cmac2, tag2, sizeof(tag2), m + 128,
+	    sizeof(m) - 128);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(tag, tag1, sizeof(tag)) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+
+	zpc_aes_cmac_free(&aes_cmac1);
+	EXPECT_EQ(aes_cmac1, nullptr);
+	zpc_aes_cmac_free(&aes_cmac2);
+	EXPECT_EQ(aes_cmac2, nullptr);
+}
+
+TEST(aes_cmac, batch)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cmac *aes_cmac;
+	struct zpc_aes_cmac_msg msgs[20];
+	u8 m[300], tags[20][12], tag[12], valid[3];
+	size_t i;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_alloc(&aes_cmac);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_set_key(aes_cmac, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)i;
+	for (i = 0; i < NMEMB(msgs); i++) {
+		msgs[i].msg = m + i;
+		msgs[i].msglen = i * 15;
+		msgs[i].mac = tags[i];
+	}
+
+	rc = zpc_aes_cmac_sign_batch(aes_cmac, msgs, NMEMB(msgs), 7);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+	msgs[3].msg = NULL;
+	rc = zpc_aes_cmac_sign_batch(aes_cmac, msgs, NMEMB(msgs), 12);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	msgs[3].msg = m + 3;
+	rc = zpc_aes_cmac_verify_batch(aes_cmac, msgs, NMEMB(msgs), 12, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG5NULL);
+
+	/* An unfinished message in the context is discarded. */
+	rc = zpc_aes_cmac_sign(aes_cmac, NULL, 0, m, 32);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_sign_batch(aes_cmac, msgs, NMEMB(msgs), 12);
+	EXPECT_EQ(rc, 0);
+
+	for (i = 0; i < NMEMB(msgs); i++) {
+		rc = zpc_aes_cmac_sign(aes_cmac, tag, sizeof(tag), msgs[i].msg,
+		    msgs[i].msglen);
+		EXPECT_EQ(rc, 0);
+		EXPECT_TRUE(memcmp(tag, tags[i], sizeof(tag)) == 0);
+	}
+
+	rc = zpc_aes_cmac_verify_batch(aes_cmac, msgs, NMEMB(msgs), 12, valid);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(valid[0], 0xff);
+	EXPECT_EQ(valid[1], 0xff);
+	EXPECT_EQ(valid[2], 0x0f);
+
+	tags[0][0] ^= 1;
+	tags[9][11] ^= 1;
+	tags[19][5] ^= 1;
+	rc = zpc_aes_cmac_verify_batch(aes_cmac, msgs, NMEMB(msgs), 12, valid);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+	EXPECT_EQ(valid[0], 0xfe);
+	EXPECT_EQ(valid[1], 0xfd);
+	EXPECT_EQ(valid[2], 0x07);
+
+	zpc_aes_cmac_free(&aes_cmac);
+	EXPECT_EQ(aes_cmac, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_cmac, sign_chunks)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cmac *aes_cmac;
+	const size_t chunks[] = { 1, 7, 15, 16, 17, 33, 1000 };
+	const size_t lens[] = { 0, 1, 16, 31, 32, 1000, 4099 };
+	u8 m[4099], tag1[16], tag2[16];
+	size_t i, j, off, n;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_alloc(&aes_cmac);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cmac_set_key(aes_cmac, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)(i * 3);
+
+	/* Intermediate chunks of any length. */
+	for (i = 0; i < NMEMB(lens); i++) {
+		rc = zpc_aes_cmac_sign(aes_cmac, tag1, sizeof(tag1), m, lens[i]);
+		EXPECT_EQ(rc, 0);
+
+		for (j = 0; j < NMEMB(chunks); j++) {
+			for (off = 0; off < lens[i]; off += n) {
+				n = std::min(chunks[j], lens[i] - off);
+				if (off + n == lens[i])
+					break;
+				rc = zpc_aes_cmac_sign(aes_cmac, NULL, 0, m + off, n);
+				EXPECT_EQ(rc, 0);
+			}
+			rc = zpc_aes_cmac_sign(aes_cmac, tag2, sizeof(tag2), m + off,
+			    lens[i] - off);
+			EXPECT_EQ(rc, 0);
+			EXPECT_TRUE(memcmp(tag1, tag2, sizeof(tag1)) == 0);
+
+			for (off = 0; off < lens[i]; off += n) {
+				n = std::min(chunks[j], lens[i] - off);
+				rc = zpc_aes_cmac_verify(aes_cmac, NULL, 0, m + off, n);
+				EXPECT_EQ(rc, 0);
+			}
+			rc = zpc_aes_cmac_verify(aes_cmac, tag1, sizeof(tag1), NULL, 0);
+			EXPECT_EQ(rc, 0);
+		}
+	}
+
+	zpc_aes_cmac_free(&aes_cmac);
+	EXPECT_EQ(aes_cmac, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
 TEST(aes_cmac, pc)
 {
 	struct zpc_aes_key *aes_key1, *aes_key2;
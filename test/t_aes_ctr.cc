@@ -0,0 +1,373 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "testlib.h"
+
+#include "gtest/gtest.h"
+#include "zpc/aes_ctr.h"
+#include "zpc/aes_ecb.h"
+#include "zpc/error.h"
+
+#include "aes_key_local.h"  /* de-opaquify struct zpc_aes_key */
+#include "aes_ctr_local.h"  /* de-opaquify struct zpc_aes_ctr */
+
+#include <string.h>
+
+/*
+ * Reference: encrypt the counter blocks iv, iv + 1, ... with ECB
+ * and xor them to m.
+ */
+static void
+__ctr_ref(struct zpc_aes_key *aes_key, const u8 iv[16], u8 *c, const u8 *m,
+    size_t mlen)
+{
+	struct zpc_aes_ecb *aes_ecb;
+	u8 ctr[16], ks[16];
+	size_t i, j;
+	int rc, k;
+
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memcpy(ctr, iv, 16);
+	for (i = 0; i < mlen; i += 16) {
+		rc = zpc_aes_ecb_encrypt(aes_ecb, ks, ctr, 16);
+		EXPECT_EQ(rc, 0);
+		for (j = 0; j < 16 && i + j < mlen; j++)
+			c[i + j] = m[i + j] ^ ks[j];
+		for (k = 15; k >= 0 && ++ctr[k] == 0; k--)
+			;
+	}
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+}
+
+static struct zpc_aes_key *
+__aes_key_new(int size)
+{
+	struct zpc_aes_key *aes_key;
+	int rc;
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	return aes_key;
+}
+
+TEST(aes_ctr, alloc)
+{
+	struct zpc_aes_ctr *aes_ctr;
+	int rc;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	rc = zpc_aes_ctr_alloc(NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+
+	aes_ctr = NULL;
+	rc = zpc_aes_ctr_alloc(&aes_ctr);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+
+	aes_ctr = (struct zpc_aes_ctr *)&aes_ctr;
+	rc = zpc_aes_ctr_alloc(&aes_ctr);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+}
+
+TEST(aes_ctr, free)
+{
+	struct zpc_aes_ctr *aes_ctr;
+	int rc;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	zpc_aes_ctr_free(NULL);
+
+	aes_ctr = NULL;
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+
+	rc = zpc_aes_ctr_alloc(&aes_ctr);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+}
+
+TEST(aes_ctr, set_key_iv)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ctr *aes_ctr;
+	u8 iv[16], m[16], c[16];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	memset(iv, 0, sizeof(iv));
+	memset(m, 0, sizeof(m));
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_alloc(&aes_ctr);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ctr_set_key(aes_ctr, aes_key);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ctr_set_key(NULL, aes_key);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_ctr_set_iv(NULL, iv);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_ctr_seek(NULL, 0);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+
+	rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+	rc = zpc_aes_ctr_seek(aes_ctr, 0);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c, m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_ctr_set_key(aes_ctr, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ctr_seek(aes_ctr, 0);
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c, m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+
+	rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, NULL, m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c, NULL, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG3NULL);
+	rc = zpc_aes_ctr_decrypt(aes_ctr, NULL, c, sizeof(c));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_ctr_decrypt(aes_ctr, m, NULL, sizeof(c));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG3NULL);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, NULL, NULL, 0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Unset iv, then key. */
+	rc = zpc_aes_ctr_set_iv(aes_ctr, NULL);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c, m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+	rc = zpc_aes_ctr_set_key(aes_ctr, NULL);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c, m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_ctr, encrypt)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ctr *aes_ctr;
+	u8 iv[16], m[4200], c[4200], c2[4200], m2[4200];
+	const size_t lens[] = { 0, 1, 15, 16, 17, 100, 4096, 4200 };
+	size_t i, j;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)(i * 13 + 1);
+	/* The counter wraps in the low 64 bits within the first blocks. */
+	memset(iv, 0xff, sizeof(iv));
+	iv[0] = 0x12;
+	iv[15] = 0xfd;
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_ctr_alloc(&aes_ctr);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_set_key(aes_ctr, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	__ctr_ref(aes_key, iv, c, m, sizeof(m));
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_ctr_encrypt(aes_ctr, c2, m, lens[i]);
+		EXPECT_EQ(rc, 0);
+		EXPECT_TRUE(memcmp(c, c2, lens[i]) == 0);
+
+		rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_ctr_decrypt(aes_ctr, m2, c2, lens[i]);
+		EXPECT_EQ(rc, 0);
+		EXPECT_TRUE(memcmp(m, m2, lens[i]) == 0);
+	}
+
+	/* Stream in pieces of odd sizes, in-place. */
+	memcpy(c2, m, sizeof(m));
+	rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+	EXPECT_EQ(rc, 0);
+	for (i = 0, j = 1; i < sizeof(m); i += j, j = j * 3 + 1) {
+		if (j > sizeof(m) - i)
+			j = sizeof(m) - i;
+		rc = zpc_aes_ctr_encrypt(aes_ctr, c2 + i, c2 + i, j);
+		EXPECT_EQ(rc, 0);
+	}
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_ctr, seek)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ctr *aes_ctr1, *aes_ctr2;
+	u8 iv[16], m[1024], c[1024], c2[1024];
+	const size_t offs[] = { 0, 1, 16, 33, 500, 1000 };
+	size_t i, len;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)(i * 5 + 7);
+	memset(iv, 0x3c, sizeof(iv));
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_ctr_alloc(&aes_ctr1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_set_key(aes_ctr1, aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_set_iv(aes_ctr1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr1, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Any range, in any order, from any context. */
+	rc = zpc_aes_ctr_dup(&aes_ctr2, aes_ctr1);
+	EXPECT_EQ(rc, 0);
+	for (i = sizeof(offs) / sizeof(offs[0]); i-- > 0;) {
+		len = i + 1 < sizeof(offs) / sizeof(offs[0]) ?
+		    offs[i + 1] - offs[i] : sizeof(m) - offs[i];
+
+		rc = zpc_aes_ctr_seek(i % 2 ? aes_ctr1 : aes_ctr2, offs[i]);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_ctr_encrypt(i % 2 ? aes_ctr1 : aes_ctr2,
+		    c2 + offs[i], m + offs[i], len);
+		EXPECT_EQ(rc, 0);
+	}
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+
+	/* Seek within the current block. */
+	rc = zpc_aes_ctr_seek(aes_ctr1, 40);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr1, c2, m + 40, 3);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_seek(aes_ctr1, 37);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr1, c2, m + 37, 20);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c + 37, c2, 20) == 0);
+
+	zpc_aes_ctr_free(&aes_ctr1);
+	EXPECT_EQ(aes_ctr1, nullptr);
+	zpc_aes_ctr_free(&aes_ctr2);
+	EXPECT_EQ(aes_ctr2, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_ctr, dup)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ctr *aes_ctr1, *aes_ctr2;
+	u8 iv[16], m[96], c[96], c1[96], c2[96];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_ctr_alloc(&aes_ctr1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_set_key(aes_ctr1, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ctr_dup(NULL, aes_ctr1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_ctr_dup(&aes_ctr2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(m, 0x5a, sizeof(m));
+
+	rc = zpc_aes_ctr_set_iv(aes_ctr1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr1, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Both contexts continue the stream after the first 21 bytes. */
+	rc = zpc_aes_ctr_set_iv(aes_ctr1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr1, c1, m, 21);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_dup(&aes_ctr2, aes_ctr1);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	rc = zpc_aes_ctr_encrypt(aes_ctr1, c1 + 21, m + 21, 75);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr2, c2 + 21, m + 21, 75);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c + 21, c1 + 21, 75) == 0);
+	EXPECT_TRUE(memcmp(c + 21, c2 + 21, 75) == 0);
+
+	zpc_aes_ctr_free(&aes_ctr1);
+	EXPECT_EQ(aes_ctr1, nullptr);
+	zpc_aes_ctr_free(&aes_ctr2);
+	EXPECT_EQ(aes_ctr2, nullptr);
+}
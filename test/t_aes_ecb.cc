@@ -15,7 +15,10 @@
 #include "aes_ecb_local.h"  /* de-opaquify struct zpc_aes_ecb */
 
 #include <json-c/json.h>
+#include <algorithm>
+#include <poll.h>
 #include <stdio.h>
+#include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
 
@@ -270,6 +273,162 @@ ret:
 	EXPECT_EQ(aes_key, nullptr);
 }
 
+TEST(aes_ecb, encryptv)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ecb *aes_ecb;
+	struct iovec miov[16], civ[16];
+	u8 m[320], c[320], c2[320];
+	int rc, size, iovcnt;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0x5a, sizeof(m));
+	iovcnt = testlib_iov_split(miov, 16, m, sizeof(m), 0);
+	(void)testlib_iov_split(civ, iovcnt, c2, sizeof(c2), 3);
+
+	rc = zpc_aes_ecb_encryptv(NULL, civ, miov, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_ecb_encryptv(aes_ecb, NULL, miov, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_ecb_encryptv(aes_ecb, civ, NULL, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG3NULL);
+	rc = zpc_aes_ecb_encryptv(aes_ecb, civ, miov, -1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG4RANGE);
+	rc = zpc_aes_ecb_encryptv(aes_ecb, civ, miov, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2RANGE);
+
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_encryptv(aes_ecb, civ, miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+
+	rc = zpc_aes_ecb_decryptv(aes_ecb, miov, civ, iovcnt);
+	EXPECT_EQ(rc, 0);
+	memset(c, 0x5a, sizeof(c));
+	EXPECT_TRUE(memcmp(m, c, sizeof(m)) == 0);
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_ecb, pad)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ecb *aes_ecb;
+	u8 m[100], m2[128], ref[128], c[128], c2[128], blk[16];
+	const size_t lens[] = { 0, 1, 15, 16, 17, 100 };
+	const size_t chunks[] = { 1, 15, 16, 17, 3, 32, 5 };
+	size_t len, clen, off, n, i, j, k, padlen;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = i * 7;
+
+	for (k = 0; k < NMEMB(lens); k++) {
+		/* Reference: pad by hand, then encrypt in one call. */
+		padlen = 16 - lens[k] % 16;
+		clen = lens[k] + padlen;
+		memcpy(ref, m, lens[k]);
+		memset(ref + lens[k], (int)padlen, padlen);
+		rc = zpc_aes_ecb_encrypt(aes_ecb, ref, ref, clen);
+		EXPECT_EQ(rc, 0);
+
+		for (off = 0, len = 0, i = 0; off < lens[k]; off += n, i++) {
+			n = std::min(chunks[i % NMEMB(chunks)], lens[k] - off);
+			rc = zpc_aes_ecb_encrypt_pad_update(aes_ecb,
+			    c + len, &j, m + off, n);
+			EXPECT_EQ(rc, 0);
+			len += j;
+		}
+		rc = zpc_aes_ecb_encrypt_pad_final(aes_ecb, c + len, &j);
+		EXPECT_EQ(rc, 0);
+		EXPECT_EQ(j, 16UL);
+		len += j;
+		EXPECT_EQ(len, clen);
+		EXPECT_TRUE(memcmp(c, ref, len) == 0);
+
+		for (off = 0, len = 0, i = 0; off < clen; off += n, i++) {
+			n = std::min(chunks[i % NMEMB(chunks)], clen - off);
+			rc = zpc_aes_ecb_decrypt_pad_update(aes_ecb,
+			    m2 + len, &j, c + off, n);
+			EXPECT_EQ(rc, 0);
+			len += j;
+		}
+		rc = zpc_aes_ecb_decrypt_pad_final(aes_ecb, m2 + len, &j);
+		EXPECT_EQ(rc, 0);
+		len += j;
+		EXPECT_EQ(len, lens[k]);
+		EXPECT_TRUE(memcmp(m2, m, len) == 0);
+	}
+
+	/* Invalid padding: 0, more than 16, inconsistent bytes. */
+	for (k = 0; k < 3; k++) {
+		memset(blk, 0x02, sizeof(blk));
+		blk[15] = k == 0 ? 0x00 : k == 1 ? 0x11 : 0x03;
+		rc = zpc_aes_ecb_encrypt(aes_ecb, c2, blk, sizeof(blk));
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_ecb_decrypt_pad_update(aes_ecb, m2, &len, c2,
+		    sizeof(blk));
+		EXPECT_EQ(rc, 0);
+		EXPECT_EQ(len, 0UL);
+		rc = zpc_aes_ecb_decrypt_pad_final(aes_ecb, m2, &len);
+		EXPECT_EQ(rc, ZPC_ERROR_PADDING);
+		memset(blk, 0, sizeof(blk));
+		EXPECT_TRUE(memcmp(m2, blk, sizeof(blk)) == 0);
+	}
+
+	/* Ciphertext not a positive multiple of the block size. */
+	rc = zpc_aes_ecb_decrypt_pad_final(aes_ecb, m2, &len);
+	EXPECT_EQ(rc, ZPC_ERROR_CLEN);
+	rc = zpc_aes_ecb_decrypt_pad_update(aes_ecb, m2, &len, c, 15);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_decrypt_pad_final(aes_ecb, m2, &len);
+	EXPECT_EQ(rc, ZPC_ERROR_CLEN);
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
 TEST(aes_ecb, pc)
 {
 	struct zpc_aes_key *aes_key1, *aes_key2;
@@ -868,6 +1027,174 @@ ret:
 	free(ct);
 }
 
+TEST(aes_ecb, rederive_protected_key_nonblock)
+{
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	const char *mkvp, *apqns[257];
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ecb *aes_ecb;
+	struct pollfd pfd;
+	unsigned int flags;
+	u8 m[64], c[64], c2[64];
+	int type, size, rc, fd;
+
+	size = testlib_env_aes_key_size();
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, size, flags);
+
+	if (type == ZPC_AES_KEY_TYPE_PVSECRET)
+		GTEST_SKIP_("Skipping rederive_protected_key_nonblock test. Not applicable for PVSECRET type keys.");
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_type(aes_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_aes_key_set_mkvp(aes_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_aes_key_set_apqns(aes_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_set_flags(aes_key, flags);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_nonblock(aes_key, 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_get_eventfd(aes_key, &fd);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0x5a, sizeof(m));
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	memset(aes_ecb->param.protkey, 0, sizeof(aes_ecb->param.protkey));    /* force WKaVP mismatch */
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c2, m, sizeof(m));
+	if (rc == ZPC_ERROR_AGAIN) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		rc = poll(&pfd, 1, 30 * 1000);
+		EXPECT_EQ(rc, 1);
+		rc = zpc_aes_ecb_encrypt(aes_ecb, c2, m, sizeof(m));
+	}
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c2, c, sizeof(c)) == 0);
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_ecb, rederive_protected_key_nonblock_fork)
+{
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	const char *mkvp, *apqns[257];
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ecb *aes_ecb;
+	struct pollfd pfd;
+	unsigned int flags;
+	u8 m[64], c[64], c2[64];
+	int type, size, rc, fd, i, status;
+	pid_t pid;
+
+	size = testlib_env_aes_key_size();
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, size, flags);
+
+	if (type == ZPC_AES_KEY_TYPE_PVSECRET)
+		GTEST_SKIP_("Skipping rederive_protected_key_nonblock_fork test. Not applicable for PVSECRET type keys.");
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_type(aes_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_aes_key_set_mkvp(aes_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_aes_key_set_apqns(aes_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_set_flags(aes_key, flags);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_nonblock(aes_key, 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_get_eventfd(aes_key, &fd);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0x5a, sizeof(m));
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Fork while the background re-derivation may still be queued. */
+	memset(aes_key->prot.protkey, 0, sizeof(aes_key->prot.protkey));
+	memset(aes_ecb->param.protkey, 0, sizeof(aes_ecb->param.protkey));    /* force WKaVP mismatch */
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c2, m, sizeof(m));
+	EXPECT_TRUE(rc == 0 || rc == ZPC_ERROR_AGAIN);
+
+	pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0) {
+		for (i = 0; i < 100; i++) {
+			rc = zpc_aes_ecb_encrypt(aes_ecb, c2, m, sizeof(m));
+			if (rc != ZPC_ERROR_AGAIN)
+				break;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			(void)poll(&pfd, 1, 100);
+		}
+		_exit(rc == 0 && memcmp(c2, c, sizeof(c)) == 0 ? 0 : 1);
+	}
+	rc = waitpid(pid, &status, 0);
+	EXPECT_EQ(rc, pid);
+	EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
 TEST(aes_ecb, reencipher)
 {
 	TESTLIB_ENV_AES_KEY_CHECK();
@@ -15,6 +15,7 @@
 #include "aes_gcm_local.h"  /* de-opaquify struct zpc_aes_gcm */
 
 #include <json-c/json.h>
+#include <algorithm>
 #include <stdio.h>
 #include <thread>
 #include <unistd.h>
@@ -343,6 +344,84 @@ ret:
 	EXPECT_EQ(aes_key, nullptr);
 }
 
+TEST(aes_gcm, create_iv_fixed)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm;
+	const u8 fixed[4] = { 0xde, 0xad, 0xbe, 0xef };
+	u8 iv[16], m[64], c[64], tag[16];
+	unsigned long long counter;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_alloc(&aes_gcm);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_key(aes_gcm, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_set_iv_fixed(NULL, fixed, sizeof(fixed), 0);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_gcm_set_iv_fixed(aes_gcm, fixed, 3, 0);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG3RANGE);
+	rc = zpc_aes_gcm_get_iv_counter(aes_gcm, &counter);
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+	rc = zpc_aes_gcm_get_iv_counter(aes_gcm, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	rc = zpc_aes_gcm_set_iv_fixed(aes_gcm, fixed, sizeof(fixed), 41);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_create_iv(aes_gcm, iv, 16);
+	EXPECT_EQ(rc, ZPC_ERROR_IVSIZE);
+
+	rc = zpc_aes_gcm_create_iv(aes_gcm, iv, 12);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(iv, fixed, sizeof(fixed)) == 0);
+	EXPECT_EQ(iv[11], 41);
+	rc = zpc_aes_gcm_encrypt(aes_gcm, c, tag, sizeof(tag), NULL, 0, m,
+	    sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_create_iv(aes_gcm, iv, 12);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(iv[11], 42);
+
+	rc = zpc_aes_gcm_get_iv_counter(aes_gcm, &counter);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(counter, 43ULL);
+
+	rc = zpc_aes_gcm_set_iv_fixed(aes_gcm, fixed, sizeof(fixed),
+	    0xfffffffffffffffeULL);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_create_iv(aes_gcm, iv, 12);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_create_iv(aes_gcm, iv, 12);
+	EXPECT_EQ(rc, ZPC_ERROR_GCM_IV_EXHAUSTED);
+
+	/* Back to random ivs. */
+	rc = zpc_aes_gcm_set_iv_fixed(aes_gcm, NULL, 0, 0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_create_iv(aes_gcm, iv, 16);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_gcm_free(&aes_gcm);
+	EXPECT_EQ(aes_gcm, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
 TEST(aes_gcm, encrypt)
 {
 	struct zpc_aes_key *aes_key;
@@ -479,6 +558,257 @@ ret:
 	EXPECT_EQ(aes_key, nullptr);
 }
 
+TEST(aes_gcm, encryptv)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm;
+	struct iovec miov[16], civ[16];
+	u8 iv[12], aad[21], m[333], c[333], c2[333], tag[16], tag2[16];
+	int rc, size, iovcnt;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_alloc(&aes_gcm);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_key(aes_gcm, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(aad, 0x3c, sizeof(aad));
+	memset(m, 0x5a, sizeof(m));
+	iovcnt = testlib_iov_split(miov, 16, m, sizeof(m), 0);
+	(void)testlib_iov_split(civ, iovcnt, c2, sizeof(c2), 3);
+
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm, c, tag, sizeof(tag), aad, sizeof(aad),
+	    m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encryptv(aes_gcm, civ, tag2, sizeof(tag2), aad,
+	    sizeof(aad), miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_decryptv(aes_gcm, miov, tag, sizeof(tag), aad,
+	    sizeof(aad), civ, iovcnt);
+	EXPECT_EQ(rc, 0);
+	memset(c, 0x5a, sizeof(c));
+	EXPECT_TRUE(memcmp(m, c, sizeof(m)) == 0);
+
+	tag[0] ^= 1;
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_decryptv(aes_gcm, miov, tag, sizeof(tag), aad,
+	    sizeof(aad), civ, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+
+	zpc_aes_gcm_free(&aes_gcm);
+	EXPECT_EQ(aes_gcm, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_gcm, stream_chunks)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm;
+	u8 iv[12], aad[77], m[333], c[333], c2[333], m2[333], tag[16], tag2[16];
+	const size_t chunks[] = { 1, 15, 16, 17, 3, 32, 5 };
+	size_t off, n, i;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_alloc(&aes_gcm);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_key(aes_gcm, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(iv, 0xa5, sizeof(iv));
+	for (i = 0; i < sizeof(aad); i++)
+		aad[i] = i;
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = i * 7;
+
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm, c, tag, sizeof(tag), aad, sizeof(aad),
+	    m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* aad in odd chunks, then the payload in odd chunks, in-place. */
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	for (off = 0, i = 0; off < sizeof(aad); off += n, i++) {
+		n = std::min(chunks[i % NMEMB(chunks)], sizeof(aad) - off);
+		rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad + off, n,
+		    NULL, 0);
+		EXPECT_EQ(rc, 0);
+	}
+	memcpy(c2, m, sizeof(m));
+	for (off = 0, i = 0; off < sizeof(m); off += n, i++) {
+		n = std::min(chunks[i % NMEMB(chunks)], sizeof(m) - off);
+		if (off + n < sizeof(m))
+			rc = zpc_aes_gcm_encrypt(aes_gcm, c2 + off, NULL, 0,
+			    NULL, 0, c2 + off, n);
+		else
+			rc = zpc_aes_gcm_encrypt(aes_gcm, c2 + off, tag2,
+			    sizeof(tag2), NULL, 0, c2 + off, n);
+		EXPECT_EQ(rc, 0);
+	}
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+
+	/* Last aad chunk with the first payload chunk, tag on its own. */
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, 40, NULL, 0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_decrypt(aes_gcm, m2, NULL, 0, aad + 40,
+	    sizeof(aad) - 40, c, 100);
+	EXPECT_EQ(rc, 0);
+	for (off = 100, i = 0; off < sizeof(c); off += n, i++) {
+		n = std::min(chunks[i % NMEMB(chunks)], sizeof(c) - off);
+		rc = zpc_aes_gcm_decrypt(aes_gcm, m2 + off, NULL, 0, NULL, 0,
+		    c + off, n);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, tag, sizeof(tag), NULL, 0,
+	    NULL, 0);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, m2, sizeof(m)) == 0);
+
+	tag[0] ^= 1;
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_decrypt(aes_gcm, m2, NULL, 0, aad, sizeof(aad), c, 7);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_decrypt(aes_gcm, m2 + 7, tag, sizeof(tag), NULL, 0,
+	    c + 7, sizeof(c) - 7);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+
+	zpc_aes_gcm_free(&aes_gcm);
+	EXPECT_EQ(aes_gcm, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_gcm, dup)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm1, *aes_gcm2;
+	u8 iv[12], aad[64], m[64], m2[64], c[64], c2[64], tag[16], tag2[16];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_alloc(&aes_gcm1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_key(aes_gcm1, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_dup(NULL, aes_gcm1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_gcm_dup(&aes_gcm2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(aad, 0x3c, sizeof(aad));
+	memset(m, 0x5a, sizeof(m));
+
+	rc = zpc_aes_gcm_set_iv(aes_gcm1, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm1, c, tag, sizeof(tag), aad,
+	    sizeof(aad), m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Fork after a common aad header. */
+	rc = zpc_aes_gcm_set_iv(aes_gcm1, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm1, NULL, NULL, 0, aad, 32, NULL, 0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_dup(&aes_gcm2, aes_gcm1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_encrypt(aes_gcm2, c2, tag2, sizeof(tag2), aad + 32,
+	    32, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+	rc = zpc_aes_gcm_decrypt(aes_gcm1, m2, tag, sizeof(tag), aad + 32,
+	    32, c, sizeof(c));
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, m2, sizeof(m)) == 0);
+
+	zpc_aes_gcm_free(&aes_gcm2);
+	EXPECT_EQ(aes_gcm2, nullptr);
+
+	/* An internally created iv is not copied. */
+	rc = zpc_aes_gcm_create_iv(aes_gcm1, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_dup(&aes_gcm2, aes_gcm1);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	rc = zpc_aes_gcm_encrypt(aes_gcm2, c2, tag2, sizeof(tag2), aad,
+	    sizeof(aad), m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+	rc = zpc_aes_gcm_set_iv(aes_gcm2, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm2, c2, tag2, sizeof(tag2), aad,
+	    sizeof(aad), m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm1, c, tag, sizeof(tag), aad,
+	    sizeof(aad), m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+
+	zpc_aes_gcm_free(&aes_gcm1);
+	EXPECT_EQ(aes_gcm1, nullptr);
+	zpc_aes_gcm_free(&aes_gcm2);
+	EXPECT_EQ(aes_gcm2, nullptr);
+}
+
 TEST(aes_gcm, pc)
 {
 	struct zpc_aes_key *aes_key1, *aes_key2;
@@ -736,8 +1066,6 @@ TEST(aes_gcm, stream_inplace_kat1)
 
 	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad, 32, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad + 32, aadlen - 31, NULL, 0);   /* Works iff aadlen - 32 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad + 32, aadlen - 32, NULL, 0);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, NULL, 0, buf, 16);
@@ -760,8 +1088,6 @@ TEST(aes_gcm, stream_inplace_kat1)
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, aad + 32, aadlen - 32, buf, 16);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, NULL, 0, NULL, 0, buf + 16, msglen - 16);   /* Works iff msglen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG8RANGE);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, mac, taglen, NULL, 0, buf + 16, msglen - 16);
 	EXPECT_EQ(rc, 0);
 
@@ -776,8 +1102,6 @@ TEST(aes_gcm, stream_inplace_kat1)
 
 	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 15, NULL, 0);    /* Works iff aadlen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, tag, taglen, NULL, 0, buf + 16, msglen - 16);
@@ -793,12 +1117,10 @@ TEST(aes_gcm, stream_inplace_kat1)
 
 	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 16, NULL, 0);    /* Works iff aadlen - 16 == 0 mod 16 */
+	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, NULL, 0, buf, 16);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, NULL, 0, NULL, 0, buf + 16, msglen - 16);   /* Works iff msglen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG8RANGE);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, tag, taglen, NULL, 0, buf + 16, msglen - 16);
 	EXPECT_EQ(rc, 0);
 
@@ -896,9 +1218,9 @@ TEST(aes_gcm, stream_inplace_kat2)
 	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, ivlen);
 	EXPECT_EQ(rc, 0);
 
-	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad, aadlen, NULL, 0); /* Works iff aadlen == 0 mod 16 */
+	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad, aadlen, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, NULL, 0, buf, msglen);  /* Works iff msglen == 0 mod 16 */
+	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, NULL, 0, buf, msglen);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, mac, taglen, NULL, 0, NULL, 0);
 	EXPECT_EQ(rc, 0);
@@ -912,9 +1234,9 @@ TEST(aes_gcm, stream_inplace_kat2)
 	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, ivlen);
 	EXPECT_EQ(rc, 0);
 
-	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, aadlen, NULL, 0); /* Works iff aadlen == 0 mod 16 */
+	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, aadlen, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, NULL, 0, buf, msglen);  /* Works iff msglen == 0 mod 16 */
+	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, NULL, 0, buf, msglen);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, tag, taglen, NULL, 0, NULL, 0);
 	EXPECT_EQ(rc, 0);
@@ -934,6 +1256,161 @@ TEST(aes_gcm, stream_inplace_kat2)
 	free(tag);
 }
 
+TEST(aes_gcm, batch)
+{
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size_t keylen, ivlen, msglen, ctlen, taglen, aadlen;
+	unsigned char buf[3][64], mac[3][16], iv2[60], ct2[64], tag2[16];
+	struct zpc_aes_gcm_msg msgs[3];
+	const char *mkvp, *apqns[257];
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm;
+	unsigned int flags;
+	int type, rc, i;
+
+	const char *keystr = "c4b03435b91fc52e09eff27e4dc3fb42";
+	const char *ivstr = "5046e7e08f0747e1efccb09e";
+	const char *aadstr = "75fc9078b488e9503dcb568c882c9eec24d80b04f0958c82aac8484f025c90434148db8e9bfe29c7e071b797457cb1695a5e5a6317b83690ba0538fb11e325ca";
+	const char *msgstr = "8e887b224e8b89c82e9a641cf579e6879e1111c7";
+	const char *ctstr = "b6786812574a254eb43b1cb1d1753564c6b520e9";
+	const char *tagstr = "ad8c09610d508f3d0f03cc523c0d5fcc";
+
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_AES_SW_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, 128, flags);
+
+	if (type == ZPC_AES_KEY_TYPE_PVSECRET)
+		GTEST_SKIP_("Skipping batch test. KATs cannot be performed with UV secrets.");
+
+	u8 *key = testlib_hexstr2buf(keystr, &keylen);
+	ASSERT_NE(key, nullptr);
+	u8 *iv = testlib_hexstr2buf(ivstr, &ivlen);
+	ASSERT_NE(iv, nullptr);
+	u8 *aad = testlib_hexstr2buf(aadstr, &aadlen);
+	ASSERT_NE(aad, nullptr);
+	u8 *msg = testlib_hexstr2buf(msgstr, &msglen);
+	ASSERT_NE(msg, nullptr);
+	u8 *ct = testlib_hexstr2buf(ctstr, &ctlen);
+	ASSERT_NE(ct, nullptr);
+	u8 *tag = testlib_hexstr2buf(tagstr, &taglen);
+	ASSERT_NE(tag, nullptr);
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_alloc(&aes_gcm);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_type(aes_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_aes_key_set_mkvp(aes_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_aes_key_set_apqns(aes_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_set_flags(aes_key, flags);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, keylen * 8);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_import_clear(aes_key, key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_seal_batch(NULL, msgs, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_gcm_seal_batch(aes_gcm, NULL, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_gcm_seal_batch(aes_gcm, msgs, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_gcm_set_key(aes_gcm, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gcm_seal_batch(aes_gcm, NULL, 0);
+	EXPECT_EQ(rc, 0);
+
+	/* Reference for a non-96-bit iv: single encrypt call. */
+	memset(iv2, 0xa5, sizeof(iv2));
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv2, sizeof(iv2));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm, ct2, tag2, sizeof(tag2), aad, aadlen,
+	    msg, msglen);
+	EXPECT_EQ(rc, 0);
+
+	/* Seal */
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < 3; i++) {
+		memcpy(buf[i], msg, msglen);
+		msgs[i].iv = iv;
+		msgs[i].ivlen = ivlen;
+		msgs[i].aad = aad;
+		msgs[i].aadlen = aadlen;
+		msgs[i].in = buf[i];
+		msgs[i].out = buf[i];
+		msgs[i].len = msglen;
+		msgs[i].tag = mac[i];
+		msgs[i].taglen = taglen;
+	}
+	msgs[1].iv = iv2;
+	msgs[1].ivlen = sizeof(iv2);
+	msgs[2].taglen = 5;
+
+	rc = zpc_aes_gcm_seal_batch(aes_gcm, msgs, 3);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+	EXPECT_EQ(msgs[0].rc, 0);
+	EXPECT_EQ(msgs[1].rc, 0);
+	EXPECT_EQ(msgs[2].rc, ZPC_ERROR_TAGSIZE);
+
+	EXPECT_TRUE(memcmp(buf[0], ct, ctlen) == 0);
+	EXPECT_TRUE(memcmp(mac[0], tag, taglen) == 0);
+	EXPECT_TRUE(memcmp(buf[1], ct2, msglen) == 0);
+	EXPECT_TRUE(memcmp(mac[1], tag2, sizeof(tag2)) == 0);
+
+	/* The batch leaves no iv set. */
+	rc = zpc_aes_gcm_encrypt(aes_gcm, buf[2], mac[2], taglen, NULL, 0,
+	    buf[2], msglen);
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+
+	/* Open */
+	msgs[2].taglen = taglen;
+	memcpy(buf[2], buf[0], msglen);
+	memcpy(mac[2], mac[0], taglen);
+	mac[2][0] ^= 1;
+
+	rc = zpc_aes_gcm_open_batch(aes_gcm, msgs, 3);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+	EXPECT_EQ(msgs[0].rc, 0);
+	EXPECT_EQ(msgs[1].rc, 0);
+	EXPECT_EQ(msgs[2].rc, ZPC_ERROR_TAGMISMATCH);
+
+	EXPECT_TRUE(memcmp(buf[0], msg, msglen) == 0);
+	EXPECT_TRUE(memcmp(buf[1], msg, msglen) == 0);
+
+	zpc_aes_gcm_free(&aes_gcm);
+	EXPECT_EQ(aes_gcm, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	free(key);
+	free(iv);
+	free(aad);
+	free(msg);
+	free(ct);
+	free(tag);
+}
+
 TEST(aes_gcm, wycheproof_kat)
 {
 	int type;
@@ -1338,8 +1815,6 @@ TEST(aes_gcm, rederive_protected_key2)
 	memset(aes_gcm->param.protkey, 0, sizeof(aes_gcm->param.protkey));    /* force WKaVP mismatch */
 	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad, 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 15, NULL, 0);   /* Works iff aadlen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, mac, taglen, NULL, 0, buf + 16, msglen - 16);
@@ -1366,8 +1841,6 @@ TEST(aes_gcm, rederive_protected_key2)
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, NULL, 0, NULL, 0, buf + 16, msglen - 16);   /* Works iff msglen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG8RANGE);
 	memset(aes_gcm->param.protkey, 0, sizeof(aes_gcm->param.protkey));    /* force WKaVP mismatch */
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, mac, taglen, NULL, 0, buf + 16, msglen - 16);
 	EXPECT_EQ(rc, 0);
@@ -1393,8 +1866,6 @@ TEST(aes_gcm, rederive_protected_key2)
 
 	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 15, NULL, 0);    /* Works iff aadlen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
 	memset(aes_gcm->param.protkey, 0, sizeof(aes_gcm->param.protkey));    /* force WKaVP mismatch */
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
@@ -1420,8 +1891,6 @@ TEST(aes_gcm, rederive_protected_key2)
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, NULL, 0, NULL, 0, buf + 16, msglen - 16);   /* Works iff msglen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG8RANGE);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, tag, taglen, NULL, 0, buf + 16, msglen - 16);
 	EXPECT_EQ(rc, 0);
 
@@ -1532,8 +2001,6 @@ TEST(aes_gcm, reencipher)
 	memset(aes_gcm->param.protkey, 0, sizeof(aes_gcm->param.protkey));    /* force WKaVP mismatch */
 	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad, 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 15, NULL, 0);   /* Works iff aadlen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, mac, taglen, NULL, 0, buf + 16, msglen - 16);
@@ -1558,8 +2025,6 @@ TEST(aes_gcm, reencipher)
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, NULL, 0, NULL, 0, buf + 16, msglen - 16);   /* Works iff msglen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG8RANGE);
 	memset(&aes_key->prot, 0, sizeof(aes_key->prot));    /* destroy cached protected key */
 	memset(aes_gcm->param.protkey, 0, sizeof(aes_gcm->param.protkey));    /* force WKaVP mismatch */
 	rc = zpc_aes_gcm_encrypt(aes_gcm, buf + 16, mac, taglen, NULL, 0, buf + 16, msglen - 16);
@@ -1578,8 +2043,6 @@ TEST(aes_gcm, reencipher)
 
 	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad, 16, NULL, 0);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, NULL, NULL, 0, aad + 16, aadlen - 15, NULL, 0);    /* Works iff aadlen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
 	memset(&aes_key->prot, 0, sizeof(aes_key->prot));    /* destroy cached protected key */
 	memset(aes_gcm->param.protkey, 0, sizeof(aes_gcm->param.protkey));    /* force WKaVP mismatch */
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
@@ -1603,8 +2066,6 @@ TEST(aes_gcm, reencipher)
 	EXPECT_EQ(rc, 0);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf, NULL, 0, aad + 16, aadlen - 16, buf, 16);
 	EXPECT_EQ(rc, 0);
-	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, NULL, 0, NULL, 0, buf + 16, msglen - 16);   /* Works iff msglen - 16 == 0 mod 16 */
-	EXPECT_EQ(rc, ZPC_ERROR_ARG8RANGE);
 	rc = zpc_aes_gcm_decrypt(aes_gcm, buf + 16, tag, taglen, NULL, 0, buf + 16, msglen - 16);
 	EXPECT_EQ(rc, 0);
 
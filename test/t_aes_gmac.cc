@@ -0,0 +1,300 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "testlib.h"
+
+#include "gtest/gtest.h"
+#include "zpc/aes_gmac.h"
+#include "zpc/aes_gcm.h"
+#include "zpc/error.h"
+
+#include "aes_key_local.h"  /* de-opaquify struct zpc_aes_key */
+#include "aes_gmac_local.h"  /* de-opaquify struct zpc_aes_gmac */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Reference: AES-GCM with the message as aad and no plaintext. */
+static void
+__gmac_ref(struct zpc_aes_key *aes_key, const u8 *iv, size_t ivlen,
+    const u8 *msg, size_t msglen, u8 mac[16])
+{
+	struct zpc_aes_gcm *aes_gcm;
+	int rc;
+
+	rc = zpc_aes_gcm_alloc(&aes_gcm);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_key(aes_gcm, aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_iv(aes_gcm, iv, ivlen);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm, NULL, mac, 16, msg, msglen, NULL, 0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_gcm_free(&aes_gcm);
+	EXPECT_EQ(aes_gcm, nullptr);
+}
+
+static struct zpc_aes_key *
+__aes_key_new(int size)
+{
+	struct zpc_aes_key *aes_key;
+	int rc;
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	return aes_key;
+}
+
+TEST(aes_gmac, alloc)
+{
+	struct zpc_aes_gmac *aes_gmac;
+	int rc;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GMAC_HW_CAPS_CHECK();
+
+	rc = zpc_aes_gmac_alloc(NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+
+	aes_gmac = NULL;
+	rc = zpc_aes_gmac_alloc(&aes_gmac);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_gmac_free(&aes_gmac);
+	EXPECT_EQ(aes_gmac, nullptr);
+
+	aes_gmac = (struct zpc_aes_gmac *)&aes_gmac;
+	rc = zpc_aes_gmac_alloc(&aes_gmac);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_gmac_free(&aes_gmac);
+	EXPECT_EQ(aes_gmac, nullptr);
+}
+
+TEST(aes_gmac, free)
+{
+	struct zpc_aes_gmac *aes_gmac;
+	int rc;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GMAC_HW_CAPS_CHECK();
+
+	zpc_aes_gmac_free(NULL);
+
+	aes_gmac = NULL;
+	zpc_aes_gmac_free(&aes_gmac);
+	EXPECT_EQ(aes_gmac, nullptr);
+
+	rc = zpc_aes_gmac_alloc(&aes_gmac);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_gmac_free(&aes_gmac);
+	EXPECT_EQ(aes_gmac, nullptr);
+}
+
+TEST(aes_gmac, args)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gmac *aes_gmac;
+	u8 iv[12], msg[16], mac[16];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	memset(iv, 0, sizeof(iv));
+	memset(msg, 0, sizeof(msg));
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_gmac_alloc(&aes_gmac);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gmac_set_key(NULL, aes_key);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_gmac_set_iv(aes_gmac, iv, sizeof(iv));
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+	rc = zpc_aes_gmac_update(aes_gmac, msg, sizeof(msg));
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_gmac_set_key(aes_gmac, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gmac_set_iv(aes_gmac, iv, 0);
+	EXPECT_EQ(rc, ZPC_ERROR_IVSIZE);
+	rc = zpc_aes_gmac_update(aes_gmac, msg, sizeof(msg));
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+	rc = zpc_aes_gmac_final(aes_gmac, mac, sizeof(mac));
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+
+	rc = zpc_aes_gmac_set_iv(aes_gmac, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_update(aes_gmac, NULL, sizeof(msg));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_gmac_update(aes_gmac, NULL, 0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_final(aes_gmac, NULL, sizeof(mac));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_gmac_final(aes_gmac, mac, 0);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+	rc = zpc_aes_gmac_final(aes_gmac, mac, 10);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+	rc = zpc_aes_gmac_final(aes_gmac, mac, 17);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+	rc = zpc_aes_gmac_verify(aes_gmac, NULL, sizeof(mac));
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	/* The iv is used up by final. */
+	rc = zpc_aes_gmac_final(aes_gmac, mac, 8);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_verify(aes_gmac, mac, 8);
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+
+	zpc_aes_gmac_free(&aes_gmac);
+	EXPECT_EQ(aes_gmac, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_gmac, stream)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gmac *aes_gmac;
+	const size_t lens[] = { 0, 1, 15, 16, 17, 100, 4096, 5003 };
+	const size_t ivlens[] = { 12, 1, 16, 60 };
+	u8 iv[60], msg[5003], mac[16], mac2[16];
+	size_t i, j, k, n;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = (u8)(i * 11 + 5);
+	memset(iv, 0xc3, sizeof(iv));
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_gmac_alloc(&aes_gmac);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_set_key(aes_gmac, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	for (k = 0; k < sizeof(ivlens) / sizeof(ivlens[0]); k++) {
+		for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+			__gmac_ref(aes_key, iv, ivlens[k], msg, lens[i], mac);
+
+			/* One chunk. */
+			rc = zpc_aes_gmac_set_iv(aes_gmac, iv, ivlens[k]);
+			EXPECT_EQ(rc, 0);
+			rc = zpc_aes_gmac_update(aes_gmac, msg, lens[i]);
+			EXPECT_EQ(rc, 0);
+			rc = zpc_aes_gmac_final(aes_gmac, mac2, sizeof(mac2));
+			EXPECT_EQ(rc, 0);
+			EXPECT_TRUE(memcmp(mac, mac2, sizeof(mac)) == 0);
+
+			/* Chunks of growing odd lengths. */
+			rc = zpc_aes_gmac_set_iv(aes_gmac, iv, ivlens[k]);
+			EXPECT_EQ(rc, 0);
+			for (j = 0, n = 1; j < lens[i]; j += n, n = n * 2 + 1) {
+				if (n > lens[i] - j)
+					n = lens[i] - j;
+				rc = zpc_aes_gmac_update(aes_gmac, msg + j, n);
+				EXPECT_EQ(rc, 0);
+			}
+			rc = zpc_aes_gmac_verify(aes_gmac, mac, 12);
+			EXPECT_EQ(rc, 0);
+		}
+	}
+
+	/* Wrong mac, wrong message. */
+	__gmac_ref(aes_key, iv, 12, msg, 100, mac);
+	rc = zpc_aes_gmac_set_iv(aes_gmac, iv, 12);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_update(aes_gmac, msg, 100);
+	EXPECT_EQ(rc, 0);
+	mac[3] ^= 1;
+	rc = zpc_aes_gmac_verify(aes_gmac, mac, 16);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+	mac[3] ^= 1;
+
+	rc = zpc_aes_gmac_set_iv(aes_gmac, iv, 12);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_update(aes_gmac, msg, 99);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_verify(aes_gmac, mac, 16);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+
+	zpc_aes_gmac_free(&aes_gmac);
+	EXPECT_EQ(aes_gmac, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(aes_gmac, dup)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gmac *aes_gmac1, *aes_gmac2;
+	u8 iv[12], msg[96], mac[16], mac1[16], mac2[16];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GMAC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(msg, 0x5a, sizeof(msg));
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_gmac_alloc(&aes_gmac1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_set_key(aes_gmac1, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_gmac_dup(NULL, aes_gmac1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_gmac_dup(&aes_gmac2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	__gmac_ref(aes_key, iv, sizeof(iv), msg, sizeof(msg), mac);
+
+	/* Both contexts continue the message after the first 21 bytes. */
+	rc = zpc_aes_gmac_set_iv(aes_gmac1, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_update(aes_gmac1, msg, 21);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_dup(&aes_gmac2, aes_gmac1);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	rc = zpc_aes_gmac_update(aes_gmac1, msg + 21, 75);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_final(aes_gmac1, mac1, 16);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_update(aes_gmac2, msg + 21, 75);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gmac_final(aes_gmac2, mac2, 16);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(mac, mac1, 16) == 0);
+	EXPECT_TRUE(memcmp(mac, mac2, 16) == 0);
+
+	zpc_aes_gmac_free(&aes_gmac1);
+	EXPECT_EQ(aes_gmac1, nullptr);
+	zpc_aes_gmac_free(&aes_gmac2);
+	EXPECT_EQ(aes_gmac2, nullptr);
+}
@@ -814,3 +814,35 @@ TEST(aes_key, import_old)
 	zpc_aes_key_free(&aes_key2);
 	EXPECT_EQ(aes_key2, nullptr);
 }
+
+TEST(aes_key, nonblock)
+{
+	struct zpc_aes_key *aes_key;
+	int rc, fd, fd2;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_nonblock(NULL, 1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_key_get_eventfd(NULL, &fd);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_key_get_eventfd(aes_key, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	rc = zpc_aes_key_set_nonblock(aes_key, 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_get_eventfd(aes_key, &fd);
+	EXPECT_EQ(rc, 0);
+	EXPECT_GE(fd, 0);
+	rc = zpc_aes_key_get_eventfd(aes_key, &fd2);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(fd2, fd);
+	rc = zpc_aes_key_set_nonblock(aes_key, 0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
@@ -490,6 +490,236 @@ ret:
 	EXPECT_EQ(aes_key2, nullptr);
 }
 
+TEST(aes_xts, encryptv)
+{
+	struct zpc_aes_key *aes_key1, *aes_key2;
+	struct zpc_aes_xts *aes_xts;
+	struct iovec miov[16], civ[16];
+	u8 iv[16], m[333], c[333], c2[333];
+	int rc, size, iovcnt;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_XTS_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	TESTLIB_AES_XTS_KEY_SIZE_CHECK(size);
+
+	rc = zpc_aes_key_alloc(&aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_alloc(&aes_key2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_alloc(&aes_xts);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key1, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key2, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_set_key(aes_xts, aes_key1, aes_key2);
+	EXPECT_EQ(rc, 0);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(m, 0x5a, sizeof(m));
+	/* The stolen block straddles segments. */
+	iovcnt = testlib_iov_split(miov, 16, m, sizeof(m), 0);
+	(void)testlib_iov_split(civ, iovcnt, c2, sizeof(c2), 3);
+
+	rc = zpc_aes_xts_set_iv(aes_xts, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt(aes_xts, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_set_iv(aes_xts, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encryptv(aes_xts, civ, miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+
+	rc = zpc_aes_xts_set_iv(aes_xts, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_decryptv(aes_xts, miov, civ, iovcnt);
+	EXPECT_EQ(rc, 0);
+	memset(c, 0x5a, sizeof(c));
+	EXPECT_TRUE(memcmp(m, c, sizeof(m)) == 0);
+
+	zpc_aes_xts_free(&aes_xts);
+	EXPECT_EQ(aes_xts, nullptr);
+	zpc_aes_key_free(&aes_key1);
+	EXPECT_EQ(aes_key1, nullptr);
+	zpc_aes_key_free(&aes_key2);
+	EXPECT_EQ(aes_key2, nullptr);
+}
+
+TEST(aes_xts, dup)
+{
+	struct zpc_aes_key *aes_key1, *aes_key2;
+	struct zpc_aes_xts *aes_xts1, *aes_xts2;
+	u8 iv[16], m[96], c[96], c1[96], c2[96];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_XTS_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	TESTLIB_AES_XTS_KEY_SIZE_CHECK(size);
+
+	rc = zpc_aes_key_alloc(&aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_alloc(&aes_key2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_alloc(&aes_xts1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key1, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key2, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_set_key(aes_xts1, aes_key1, aes_key2);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_xts_dup(NULL, aes_xts1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_xts_dup(&aes_xts2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(m, 0x5a, sizeof(m));
+
+	rc = zpc_aes_xts_set_iv(aes_xts1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt(aes_xts1, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Both contexts continue with the tweak after the first 32 bytes. */
+	rc = zpc_aes_xts_set_iv(aes_xts1, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt(aes_xts1, c1, m, 32);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_dup(&aes_xts2, aes_xts1);
+	EXPECT_EQ(rc, 0);
+	zpc_aes_key_free(&aes_key1);
+	EXPECT_EQ(aes_key1, nullptr);
+	zpc_aes_key_free(&aes_key2);
+	EXPECT_EQ(aes_key2, nullptr);
+
+	rc = zpc_aes_xts_encrypt(aes_xts1, c1 + 32, m + 32, 64);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt(aes_xts2, c2 + 32, m + 32, 64);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c + 32, c1 + 32, 64) == 0);
+	EXPECT_TRUE(memcmp(c + 32, c2 + 32, 64) == 0);
+
+	zpc_aes_xts_free(&aes_xts1);
+	EXPECT_EQ(aes_xts1, nullptr);
+	zpc_aes_xts_free(&aes_xts2);
+	EXPECT_EQ(aes_xts2, nullptr);
+}
+
+TEST(aes_xts, sectors)
+{
+	struct zpc_aes_key *aes_key1, *aes_key2;
+	struct zpc_aes_xts *aes_xts;
+	u8 iv[16], m[4 * 520], c[4 * 520], c1[4 * 520], m1[4 * 520];
+	const size_t ss = 520;	/* not a multiple of 16: ciphertext stealing */
+	const unsigned long long first = 0x1ff;
+	size_t k;
+	int rc, size, j;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_XTS_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	TESTLIB_AES_XTS_KEY_SIZE_CHECK(size);
+
+	rc = zpc_aes_key_alloc(&aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_alloc(&aes_key2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_alloc(&aes_xts);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key1, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key2, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key2);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, m, ss, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_xts_set_key(aes_xts, aes_key1, aes_key2);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_xts_encrypt_sectors(NULL, c, m, ss, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, NULL, m, ss, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, NULL, ss, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG3NULL);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, m, 15, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG4RANGE);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, m, ss, ~0ULL, 2);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG5RANGE);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, m, ss, 0, SIZE_MAX);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG6RANGE);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, m, ss, first, 0);
+	EXPECT_EQ(rc, 0);
+
+	for (k = 0; k < sizeof(m); k++)
+		m[k] = k;
+
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c, m, ss, first, 4);
+	EXPECT_EQ(rc, 0);
+
+	/* Same as setting the little-endian sector number as iv per sector. */
+	for (k = 0; k < 4; k++) {
+		memset(iv, 0, sizeof(iv));
+		for (j = 0; j < 8; j++)
+			iv[j] = ((first + k) >> (8 * j)) & 0xff;
+		rc = zpc_aes_xts_set_iv(aes_xts, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_xts_encrypt(aes_xts, c1 + k * ss, m + k * ss, ss);
+		EXPECT_EQ(rc, 0);
+	}
+	EXPECT_TRUE(memcmp(c, c1, sizeof(c)) == 0);
+
+	rc = zpc_aes_xts_decrypt_sectors(aes_xts, m1, c, ss, first, 4);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, m1, sizeof(m)) == 0);
+
+	/* In-place, sectors processed in two requests. */
+	memcpy(m1, m, sizeof(m1));
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, m1, m1, ss, first, 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, m1 + ss, m1 + ss, ss,
+	    first + 1, 3);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, m1, sizeof(c)) == 0);
+
+	zpc_aes_xts_free(&aes_xts);
+	EXPECT_EQ(aes_xts, nullptr);
+	zpc_aes_key_free(&aes_key1);
+	EXPECT_EQ(aes_key1, nullptr);
+	zpc_aes_key_free(&aes_key2);
+	EXPECT_EQ(aes_key2, nullptr);
+}
+
 TEST(aes_xts, pc)
 {
 	struct zpc_aes_key *aes_key1, *aes_key2;
@@ -15,6 +15,7 @@
 
 #include "zpc/aes_xts_full.h"
 #include "zpc/aes_xts.h"
+#include "zpc/aes_ecb.h"
 #include "zpc/error.h"
 
 #include "aes_xts_full_local.h"  /* de-opaquify struct zpc_aes_xts_full */
@@ -294,6 +295,86 @@ ret:
 	EXPECT_EQ(xts_key, nullptr);
 }
 
+TEST(aes_xts_full, sectors)
+{
+	struct zpc_aes_xts_key *xts_key;
+	struct zpc_aes_xts_full *xts_full;
+	u8 iv[16], m[4 * 520], c[4 * 520], c1[4 * 520], m1[4 * 520];
+	const size_t ss = 520;	/* not a multiple of 16: ciphertext stealing */
+	const unsigned long long first = 0x1ff;
+	size_t k;
+	int rc, size, type, j;
+
+	TESTLIB_ENV_AES_XTS_KEY_CHECK();
+
+	TESTLIB_AES_XTS_FULL_HW_CAPS_CHECK();
+
+	type = testlib_env_aes_xts_key_type();
+	size = testlib_env_aes_xts_key_size();
+
+	TESTLIB_AES_XTS_FULL_KERNEL_CAPS_CHECK();
+
+	TESTLIB_AES_XTS_FULL_SW_CAPS_CHECK(type);
+
+	TESTLIB_AES_XTS_KEY_SIZE_CHECK(size);
+
+	rc = zpc_aes_xts_key_alloc(&xts_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_full_alloc(&xts_full);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_xts_key_set_type(xts_key, type);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_key_set_size(xts_key, size);
+	EXPECT_EQ(rc, 0);
+
+	rc = testlib_set_aes_xts_key_from_pvsecret(xts_key, size);
+	if (rc)
+		goto ret;
+
+	rc = zpc_aes_xts_full_encrypt_sectors(xts_full, c, m, ss, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_xts_full_set_key(xts_full, xts_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_xts_full_encrypt_sectors(NULL, c, m, ss, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_xts_full_encrypt_sectors(xts_full, c, m, 15, first, 4);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG4RANGE);
+	rc = zpc_aes_xts_full_encrypt_sectors(xts_full, c, m, ss, ~0ULL, 2);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG5RANGE);
+
+	for (k = 0; k < sizeof(m); k++)
+		m[k] = k;
+
+	rc = zpc_aes_xts_full_encrypt_sectors(xts_full, c, m, ss, first, 4);
+	EXPECT_EQ(rc, 0);
+
+	/* Same as setting the little-endian sector number as iv per sector. */
+	for (k = 0; k < 4; k++) {
+		memset(iv, 0, sizeof(iv));
+		for (j = 0; j < 8; j++)
+			iv[j] = ((first + k) >> (8 * j)) & 0xff;
+		rc = zpc_aes_xts_full_set_iv(xts_full, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_xts_full_encrypt(xts_full, c1 + k * ss, m + k * ss,
+		    ss);
+		EXPECT_EQ(rc, 0);
+	}
+	EXPECT_TRUE(memcmp(c, c1, sizeof(c)) == 0);
+
+	rc = zpc_aes_xts_full_decrypt_sectors(xts_full, m1, c, ss, first, 4);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, m1, sizeof(m)) == 0);
+
+ret:
+	zpc_aes_xts_full_free(&xts_full);
+	EXPECT_EQ(xts_full, nullptr);
+	zpc_aes_xts_key_free(&xts_key);
+	EXPECT_EQ(xts_key, nullptr);
+}
+
 TEST(aes_xts_full, pc)
 {
 	struct zpc_aes_xts_key *aes_key1, *aes_key2, *aes_key3, *aes_key4;
@@ -771,6 +852,191 @@ TEST(aes_xts_full, stream_inplace_kat3)
 	free(ct);
 }
 
+TEST(aes_xts_full, mixed_with_xts_keys)
+{
+	TESTLIB_ENV_AES_XTS_KEY_CHECK();
+
+	TESTLIB_AES_XTS_FULL_HW_CAPS_CHECK();
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_XTS_HW_CAPS_CHECK();
+
+	size_t keylen, msglen, ctlen, ivlen;
+	unsigned char buf[4096], buf2[64];
+	const char *mkvp, *apqns[257];
+	struct zpc_aes_xts_key *xts_key;
+	struct zpc_aes_xts_full *xts_full;
+	struct zpc_aes_key *aes_key1, *aes_key2, *aes_key[8];
+	struct zpc_aes_xts *aes_xts;
+	struct zpc_aes_ecb *aes_ecb;
+	unsigned int flags;
+	int type, xts_type, rc, i, j;
+
+	const char *keystr = "88dfd7c83cb121968feb417520555b36c0f63b662570eac12ea96cbe188ad5b1a44db23ac6470316cba0041cadf248f6d9a7713f454e663f3e3987585cebbf96";
+	const char *ivstr = "0ee84632b838dd528f1d96c76439805c";
+	const char *msgstr = "ec36551c70efcdf85de7a39988978263ad261e83996dad219a0058e02187384f2d0754ff9cfa000bec448fafd2cfa738";
+	const char *ctstr = "a55d533c9c5885562b92d4582ea69db8e2ba9c0b967a9f0167700b043525a47bafe7d630774eaf4a1dc9fbcf94a1fda4";
+
+	xts_type = testlib_env_aes_xts_key_type();
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_XTS_FULL_KERNEL_CAPS_CHECK();
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_AES_SW_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, 256, flags);
+
+	if (type == ZPC_AES_KEY_TYPE_PVSECRET)
+		GTEST_SKIP_("Skipping mixed_with_xts_keys test. KATs cannot be performed with UV secrets.");
+
+	u8 *key1 = testlib_hexstr2buf(keystr, &keylen);
+	ASSERT_NE(key1, nullptr);
+	u8 *key2 = key1 + keylen / 2;
+	u8 *iv = testlib_hexstr2buf(ivstr, &ivlen);
+	ASSERT_NE(iv, nullptr);
+	u8 *msg = testlib_hexstr2buf(msgstr, &msglen);
+	ASSERT_NE(msg, nullptr);
+	u8 *ct = testlib_hexstr2buf(ctstr, &ctlen);
+	ASSERT_NE(ct, nullptr);
+
+	rc = zpc_aes_xts_key_alloc(&xts_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_full_alloc(&xts_full);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_alloc(&aes_xts);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+
+	/* See stream_inplace_kat1 for why the type is not set for pvsecrets. */
+	if (xts_type != ZPC_AES_XTS_KEY_TYPE_PVSECRET) {
+		rc = zpc_aes_xts_key_set_type(xts_key, xts_type);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_xts_key_set_size(xts_key, (keylen * 8) / 2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_key_import_clear(xts_key, key1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_alloc(&aes_key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_alloc(&aes_key2);
+	EXPECT_EQ(rc, 0);
+	for (i = 0; i < (int)NMEMB(aes_key); i++) {
+		rc = zpc_aes_key_alloc(&aes_key[i]);
+		EXPECT_EQ(rc, 0);
+	}
+
+	for (i = -2; i < (int)NMEMB(aes_key); i++) {
+		struct zpc_aes_key *k = i == -2 ? aes_key1 :
+		    i == -1 ? aes_key2 : aes_key[i];
+
+		rc = zpc_aes_key_set_type(k, type);
+		EXPECT_EQ(rc, 0);
+		if (mkvp != NULL) {
+			rc = zpc_aes_key_set_mkvp(k, mkvp);
+			EXPECT_EQ(rc, 0);
+		} else {
+			rc = zpc_aes_key_set_apqns(k, apqns);
+			EXPECT_EQ(rc, 0);
+		}
+		rc = zpc_aes_key_set_flags(k, flags);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_key_set_size(k, (keylen * 8) / 2);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_import_clear(aes_key1, key1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_import_clear(aes_key2, key2);
+	EXPECT_EQ(rc, 0);
+	for (i = 0; i < (int)NMEMB(aes_key); i++) {
+		rc = zpc_aes_key_generate(aes_key[i]);
+		EXPECT_EQ(rc, 0);
+	}
+
+	rc = zpc_aes_xts_set_key(aes_xts, aes_key1, aes_key2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_full_set_key(xts_full, xts_key);
+	EXPECT_EQ(rc, 0);
+
+	/*
+	 * XTS with the same key halves as the XTS-full key, surrounded by a
+	 * varying number of unrelated single-key operations, followed by
+	 * XTS-full, all on one thread: the XTS-full key halves must not get
+	 * mixed up, wherever they end up in any per-thread key cache.
+	 */
+	for (i = 0; i <= (int)NMEMB(aes_key); i++) {
+		for (j = 0; j < i; j++) {
+			rc = zpc_aes_ecb_set_key(aes_ecb, aes_key[j]);
+			EXPECT_EQ(rc, 0);
+			rc = zpc_aes_ecb_encrypt(aes_ecb, buf2, buf2, sizeof(buf2));
+			EXPECT_EQ(rc, 0);
+		}
+
+		memcpy(buf, msg, msglen);
+
+		rc = zpc_aes_xts_set_iv(aes_xts, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_xts_encrypt(aes_xts, buf, buf, msglen);
+		EXPECT_EQ(rc, 0);
+
+		EXPECT_TRUE(memcmp(buf, ct, ctlen) == 0);
+
+		for (j = 0; j < i; j++) {
+			rc = zpc_aes_ecb_set_key(aes_ecb, aes_key[j]);
+			EXPECT_EQ(rc, 0);
+			rc = zpc_aes_ecb_encrypt(aes_ecb, buf2, buf2, sizeof(buf2));
+			EXPECT_EQ(rc, 0);
+		}
+
+		/* Encrypt */
+		memcpy(buf, msg, msglen);
+
+		rc = zpc_aes_xts_full_set_iv(xts_full, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_xts_full_encrypt(xts_full, buf, buf, msglen);
+		EXPECT_EQ(rc, 0);
+
+		EXPECT_TRUE(memcmp(buf, ct, ctlen) == 0);
+
+		/* Decrypt */
+		rc = zpc_aes_xts_full_set_iv(xts_full, iv);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_aes_xts_full_decrypt(xts_full, buf, buf, ctlen);
+		EXPECT_EQ(rc, 0);
+
+		EXPECT_TRUE(memcmp(buf, msg, msglen) == 0);
+	}
+
+	for (i = 0; i < (int)NMEMB(aes_key); i++) {
+		zpc_aes_key_free(&aes_key[i]);
+		EXPECT_EQ(aes_key[i], nullptr);
+	}
+	zpc_aes_key_free(&aes_key1);
+	EXPECT_EQ(aes_key1, nullptr);
+	zpc_aes_key_free(&aes_key2);
+	EXPECT_EQ(aes_key2, nullptr);
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_xts_free(&aes_xts);
+	EXPECT_EQ(aes_xts, nullptr);
+	zpc_aes_xts_full_free(&xts_full);
+	EXPECT_EQ(xts_full, nullptr);
+	zpc_aes_xts_key_free(&xts_key);
+	EXPECT_EQ(xts_key, nullptr);
+
+	free(key1);
+	free(iv);
+	free(msg);
+	free(ct);
+}
+
 TEST(aes_xts_full, nist_kat)
 {
 	TESTLIB_ENV_AES_XTS_KEY_CHECK();
@@ -0,0 +1,334 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "testlib.h"
+
+#include "gtest/gtest.h"
+#include "zpc/ctx_pool.h"
+#include "zpc/aes_gcm.h"
+#include "zpc/hmac.h"
+#include "zpc/error.h"
+
+#include <string.h>
+#include <thread>
+
+static void __acquire_release(struct zpc_ctx_pool *, int);
+
+TEST(ctx_pool, alloc)
+{
+	struct zpc_ctx_pool *pool;
+	struct zpc_aes_key *aes_key;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_alloc_aes(NULL, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_HMAC, aes_key);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2RANGE);
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_AES_GCM, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG3NULL);
+	rc = zpc_ctx_pool_alloc_hmac(&pool, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_ctx_pool_alloc_ecdsa(&pool, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	/* The key is checked when the pool is allocated. */
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, ZPC_ERROR_KEYNOTSET);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	zpc_ctx_pool_free(&pool);
+	EXPECT_EQ(pool, nullptr);
+	zpc_ctx_pool_free(&pool);
+	zpc_ctx_pool_free(NULL);
+
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(ctx_pool, aes_gcm)
+{
+	struct zpc_ctx_pool *pool;
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm1, *aes_gcm2, *aes_gcm3;
+	u8 iv[12], m[64], c[64], c2[64], tag[16], tag2[16];
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	/* The pool keeps the key referenced. */
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+
+	rc = zpc_ctx_pool_acquire(NULL, (void **)&aes_gcm1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_ctx_pool_acquire(pool, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm2);
+	EXPECT_EQ(rc, 0);
+	EXPECT_NE(aes_gcm1, aes_gcm2);
+
+	memset(iv, 0xa5, sizeof(iv));
+	memset(m, 0x5a, sizeof(m));
+	rc = zpc_aes_gcm_set_iv(aes_gcm1, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm1, c, tag, sizeof(tag), NULL, 0, m,
+	    sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_iv(aes_gcm2, iv, sizeof(iv));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_encrypt(aes_gcm2, c2, tag2, sizeof(tag2), NULL, 0, m,
+	    sizeof(m));
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c, c2, sizeof(c)) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, sizeof(tag)) == 0);
+
+	rc = zpc_ctx_pool_release(pool, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+	rc = zpc_ctx_pool_release(pool, aes_gcm2);
+	EXPECT_EQ(rc, 0);
+
+	/* A released context is handed out again, without an iv. */
+	rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm3);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(aes_gcm3, aes_gcm2);
+	rc = zpc_aes_gcm_encrypt(aes_gcm3, c2, tag2, sizeof(tag2), NULL, 0, m,
+	    sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_IVNOTSET);
+
+	rc = zpc_ctx_pool_release(pool, aes_gcm1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool, aes_gcm3);
+	EXPECT_EQ(rc, 0);
+
+	zpc_ctx_pool_free(&pool);
+	EXPECT_EQ(pool, nullptr);
+}
+
+TEST(ctx_pool, release)
+{
+	struct zpc_ctx_pool *pool, *pool2;
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_gcm *aes_gcm1, *aes_gcm2, *aes_gcm3, *aes_gcm4;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_alloc_aes(&pool2, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_acquire(pool2, (void **)&aes_gcm2);
+	EXPECT_EQ(rc, 0);
+
+	/* Contexts of another pool, not of a pool and copies are refused. */
+	rc = zpc_ctx_pool_release(pool, aes_gcm2);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2RANGE);
+	rc = zpc_aes_gcm_alloc(&aes_gcm3);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_gcm_set_key(aes_gcm3, aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool, aes_gcm3);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2RANGE);
+	zpc_aes_gcm_free(&aes_gcm3);
+	rc = zpc_aes_gcm_dup(&aes_gcm3, aes_gcm1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool, aes_gcm3);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2RANGE);
+	zpc_aes_gcm_free(&aes_gcm3);
+
+	/* A context is released once. */
+	rc = zpc_ctx_pool_release(pool, aes_gcm1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool, aes_gcm1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2RANGE);
+
+	/* So it is handed out once. */
+	rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm3);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm4);
+	EXPECT_EQ(rc, 0);
+	EXPECT_NE(aes_gcm3, aes_gcm4);
+
+	rc = zpc_ctx_pool_release(pool, aes_gcm3);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool, aes_gcm4);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool2, aes_gcm2);
+	EXPECT_EQ(rc, 0);
+
+	zpc_ctx_pool_free(&pool);
+	EXPECT_EQ(pool, nullptr);
+	zpc_ctx_pool_free(&pool2);
+	EXPECT_EQ(pool2, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+TEST(ctx_pool, hmac)
+{
+	struct zpc_ctx_pool *pool;
+	struct zpc_hmac_key *hmac_key;
+	struct zpc_hmac *hmac;
+	u8 clearkey[32], m[128], tag[64], tag2[64];
+	int rc;
+	zpc_hmac_hashfunc_t hfunc;
+
+	TESTLIB_ENV_HMAC_KEY_CHECK();
+
+	TESTLIB_HMAC_HW_CAPS_CHECK();
+
+	hfunc = testlib_env_hmac_hashfunc();
+
+	TESTLIB_HMAC_KERNEL_CAPS_CHECK();
+
+	rc = zpc_hmac_key_alloc(&hmac_key);
+	EXPECT_EQ(rc, 0);
+	memset(clearkey, 0xa5, sizeof(clearkey));
+	rc = zpc_hmac_key_set_hash_function(hmac_key, hfunc);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_key_import_clear(hmac_key, clearkey, sizeof(clearkey));
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_alloc_hmac(&pool, hmac_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0x5a, sizeof(m));
+	rc = zpc_ctx_pool_acquire(pool, (void **)&hmac);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_sign(hmac, tag, 32, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	/* Leave a partial hmac behind. */
+	rc = zpc_hmac_sign(hmac, NULL, 0, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ctx_pool_release(pool, hmac);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_acquire(pool, (void **)&hmac);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_sign(hmac, tag2, 32, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(tag, tag2, 32) == 0);
+	rc = zpc_ctx_pool_release(pool, hmac);
+	EXPECT_EQ(rc, 0);
+
+	zpc_ctx_pool_free(&pool);
+	EXPECT_EQ(pool, nullptr);
+	zpc_hmac_key_free(&hmac_key);
+	EXPECT_EQ(hmac_key, nullptr);
+}
+
+TEST(ctx_pool, threads)
+{
+	struct zpc_ctx_pool *pool;
+	struct zpc_aes_key *aes_key;
+	std::thread *t[8];
+	int rc, i, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_GCM_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ctx_pool_alloc_aes(&pool, ZPC_CTX_POOL_AES_GCM, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	for (i = 0; i < 8; i++)
+		t[i] = new std::thread(__acquire_release, pool, 1000);
+	for (i = 0; i < 8; i++) {
+		t[i]->join();
+		delete t[i];
+	}
+
+	zpc_ctx_pool_free(&pool);
+	EXPECT_EQ(pool, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+}
+
+/* Hold up to 40 contexts, more than a thread's free list. */
+static void
+__acquire_release(struct zpc_ctx_pool *pool, int n)
+{
+	struct zpc_aes_gcm *aes_gcm[40];
+	u8 iv[12], m[64], c[64], tag[16];
+	int rc, i, j, k;
+
+	memset(iv, 0, sizeof(iv));
+	memset(m, 0, sizeof(m));
+
+	for (i = 0; i < n; i++) {
+		k = 1 + i % 40;
+		for (j = 0; j < k; j++) {
+			rc = zpc_ctx_pool_acquire(pool, (void **)&aes_gcm[j]);
+			EXPECT_EQ(rc, 0);
+			rc = zpc_aes_gcm_set_iv(aes_gcm[j], iv, sizeof(iv));
+			EXPECT_EQ(rc, 0);
+			rc = zpc_aes_gcm_encrypt(aes_gcm[j], c, tag, sizeof(tag),
+			    NULL, 0, m, sizeof(m));
+			EXPECT_EQ(rc, 0);
+		}
+		for (j = 0; j < k; j++) {
+			rc = zpc_ctx_pool_release(pool, aes_gcm[k - 1 - j]);
+			EXPECT_EQ(rc, 0);
+		}
+	}
+}
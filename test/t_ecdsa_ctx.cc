@@ -555,6 +555,195 @@ ret:
 	EXPECT_EQ(ec_ctx2, nullptr);
 }
 
+TEST(ecdsa_ctx, sv_message)
+{
+	struct zpc_ec_key *ec_key;
+	struct zpc_ecdsa_ctx *ec_ctx;
+	const char *mkvp, *apqns[257];
+	u8 *msg = NULL, signature[200];
+	const u8 *digest_abc, *digest_a;
+	unsigned int sig_len, digest_len, flags;
+	size_t msg_len = 1000000, off, n, i;
+	int rc, type;
+	zpc_ec_curve_t curve;
+	const size_t chunks[] = { 1, 63, 64, 65, 127, 128, 129, 1000, 4097 };
+	/* FIPS 180-2 "abc" and one million 'a' */
+	const u8 sha256_abc[] = {
+		0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde,
+		0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+		0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+	};
+	const u8 sha256_a[] = {
+		0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2,
+		0x84, 0xd7, 0x3e, 0x67, 0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+		0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0,
+	};
+	const u8 sha384_abc[] = {
+		0xcb, 0x00, 0x75, 0x3f, 0x45, 0xa3, 0x5e, 0x8b, 0xb5, 0xa0, 0x3d, 0x69,
+		0x9a, 0xc6, 0x50, 0x07, 0x27, 0x2c, 0x32, 0xab, 0x0e, 0xde, 0xd1, 0x63,
+		0x1a, 0x8b, 0x60, 0x5a, 0x43, 0xff, 0x5b, 0xed, 0x80, 0x86, 0x07, 0x2b,
+		0xa1, 0xe7, 0xcc, 0x23, 0x58, 0xba, 0xec, 0xa1, 0x34, 0xc8, 0x25, 0xa7,
+	};
+	const u8 sha384_a[] = {
+		0x9d, 0x0e, 0x18, 0x09, 0x71, 0x64, 0x74, 0xcb, 0x08, 0x6e, 0x83, 0x4e,
+		0x31, 0x0a, 0x4a, 0x1c, 0xed, 0x14, 0x9e, 0x9c, 0x00, 0xf2, 0x48, 0x52,
+		0x79, 0x72, 0xce, 0xc5, 0x70, 0x4c, 0x2a, 0x5b, 0x07, 0xb8, 0xb3, 0xdc,
+		0x38, 0xec, 0xc4, 0xeb, 0xae, 0x97, 0xdd, 0xd8, 0x7f, 0x3d, 0x89, 0x85,
+	};
+	const u8 sha512_abc[] = {
+		0xdd, 0xaf, 0x35, 0xa1, 0x93, 0x61, 0x7a, 0xba, 0xcc, 0x41, 0x73, 0x49,
+		0xae, 0x20, 0x41, 0x31, 0x12, 0xe6, 0xfa, 0x4e, 0x89, 0xa9, 0x7e, 0xa2,
+		0x0a, 0x9e, 0xee, 0xe6, 0x4b, 0x55, 0xd3, 0x9a, 0x21, 0x92, 0x99, 0x2a,
+		0x27, 0x4f, 0xc1, 0xa8, 0x36, 0xba, 0x3c, 0x23, 0xa3, 0xfe, 0xeb, 0xbd,
+		0x45, 0x4d, 0x44, 0x23, 0x64, 0x3c, 0xe8, 0x0e, 0x2a, 0x9a, 0xc9, 0x4f,
+		0xa5, 0x4c, 0xa4, 0x9f,
+	};
+	const u8 sha512_a[] = {
+		0xe7, 0x18, 0x48, 0x3d, 0x0c, 0xe7, 0x69, 0x64, 0x4e, 0x2e, 0x42, 0xc7,
+		0xbc, 0x15, 0xb4, 0x63, 0x8e, 0x1f, 0x98, 0xb1, 0x3b, 0x20, 0x44, 0x28,
+		0x56, 0x32, 0xa8, 0x03, 0xaf, 0xa9, 0x73, 0xeb, 0xde, 0x0f, 0xf2, 0x44,
+		0x87, 0x7e, 0xa6, 0x0a, 0x4c, 0xb0, 0x43, 0x2c, 0xe5, 0x77, 0xc3, 0x1b,
+		0xeb, 0x00, 0x9c, 0x5c, 0x2c, 0x49, 0xaa, 0x2e, 0x4e, 0xad, 0xb2, 0x17,
+		0xad, 0x8c, 0xc0, 0x9b,
+	};
+
+	TESTLIB_ENV_EC_KEY_CHECK();
+
+	TESTLIB_EC_HW_CAPS_CHECK();
+
+	curve = testlib_env_ec_key_curve();
+	type = testlib_env_ec_key_type();
+	flags = testlib_env_ec_key_flags();
+	mkvp = testlib_env_ec_key_mkvp();
+	(void)testlib_env_ec_key_apqns(apqns);
+
+	TESTLIB_EC_SW_CAPS_CHECK(type);
+
+	TESTLIB_EC_KERNEL_CAPS_CHECK(type, mkvp, apqns);
+
+	switch (curve) {
+	case ZPC_EC_CURVE_P256:
+		digest_abc = sha256_abc;
+		digest_a = sha256_a;
+		digest_len = sizeof(sha256_a);
+		break;
+	case ZPC_EC_CURVE_P384:
+		digest_abc = sha384_abc;
+		digest_a = sha384_a;
+		digest_len = sizeof(sha384_a);
+		break;
+	case ZPC_EC_CURVE_P521:
+		digest_abc = sha512_abc;
+		digest_a = sha512_a;
+		digest_len = sizeof(sha512_a);
+		break;
+	default:
+		digest_abc = digest_a = NULL;
+		digest_len = 0;
+		break;
+	}
+
+	msg = (u8 *)malloc(msg_len);
+	ASSERT_NE(msg, nullptr);
+	memset(msg, 'a', msg_len);
+
+	rc = zpc_ec_key_alloc(&ec_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_ctx_alloc(&ec_ctx);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ec_key_set_type(ec_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_ec_key_set_mkvp(ec_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_ec_key_set_apqns(ec_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_ec_key_set_curve(ec_key, curve);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ec_key_set_flags(ec_key, flags);
+	EXPECT_EQ(rc, 0);
+
+	if (type != ZPC_EC_KEY_TYPE_PVSECRET) {
+		rc = zpc_ec_key_generate(ec_key);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = testlib_set_ec_key_from_pvsecret(ec_key, type, curve);
+		if (rc)
+			goto ret;
+	}
+
+	rc = zpc_ecdsa_ctx_set_key(ec_ctx, ec_key);
+	EXPECT_EQ(rc, 0);
+
+	/* One-shot sign, verify the digest. */
+	sig_len = sizeof(signature);
+	rc = zpc_ecdsa_sign_message(ec_ctx, (const u8 *)"abc", 3, signature,
+	    &sig_len);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_verify_message(ec_ctx, (const u8 *)"abc", 3, signature,
+	    sig_len);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_verify_message(ec_ctx, (const u8 *)"abd", 3, signature,
+	    sig_len);
+	EXPECT_EQ(rc, ZPC_ERROR_EC_SIGNATURE_INVALID);
+
+	if (digest_len == 0) {
+		/* EdDSA: no streaming. */
+		rc = zpc_ecdsa_message_init(ec_ctx);
+		EXPECT_EQ(rc, ZPC_ERROR_EC_INVALID_CURVE);
+		goto ret;
+	}
+
+	rc = zpc_ecdsa_verify(ec_ctx, digest_abc, digest_len, signature,
+	    sig_len);
+	EXPECT_EQ(rc, 0);
+
+	/* Streamed sign in odd chunks, verify the digest and the message. */
+	rc = zpc_ecdsa_message_init(ec_ctx);
+	EXPECT_EQ(rc, 0);
+	for (off = 0, i = 0; off < msg_len; off += n, i++) {
+		n = chunks[i % NMEMB(chunks)];
+		if (n > msg_len - off)
+			n = msg_len - off;
+		rc = zpc_ecdsa_message_update(ec_ctx, msg + off, n);
+		EXPECT_EQ(rc, 0);
+	}
+	sig_len = 0;
+	rc = zpc_ecdsa_sign_message_final(ec_ctx, NULL, &sig_len);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_sign_message_final(ec_ctx, signature, &sig_len);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_ecdsa_verify(ec_ctx, digest_a, digest_len, signature, sig_len);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_verify_message(ec_ctx, msg, msg_len, signature, sig_len);
+	EXPECT_EQ(rc, 0);
+
+	/* Streamed verify, the last chunk altered. */
+	rc = zpc_ecdsa_message_update(ec_ctx, msg, msg_len - 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_message_update(ec_ctx, (const u8 *)"b", 1);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_verify_message_final(ec_ctx, signature, sig_len);
+	EXPECT_EQ(rc, ZPC_ERROR_EC_SIGNATURE_INVALID);
+
+	/* The empty message. */
+	rc = zpc_ecdsa_sign_message_final(ec_ctx, signature, &sig_len);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_ecdsa_verify_message(ec_ctx, NULL, 0, signature, sig_len);
+	EXPECT_EQ(rc, 0);
+
+ret:
+	free(msg);
+	zpc_ecdsa_ctx_free(&ec_ctx);
+	EXPECT_EQ(ec_ctx, nullptr);
+	zpc_ec_key_free(&ec_key);
+	EXPECT_EQ(ec_key, nullptr);
+}
+
 TEST(ecdsa_ctx, wycheproof_kat)
 {
 	int type;
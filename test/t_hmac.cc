@@ -7,6 +7,7 @@
 
 #include <json-c/json.h>
 #include <stdio.h>
+#include <algorithm>
 #include <thread>
 #include <unistd.h>
 
@@ -272,6 +273,297 @@ ret:
 	EXPECT_EQ(hmac_key2, nullptr);
 }
 
+TEST(hmac, signv)
+{
+	struct zpc_hmac_key *hmac_key;
+	struct zpc_hmac *hmac;
+	struct iovec miov[16];
+	u8 clearkey[32], m[333], tag[64], tag2[64];
+	int rc, iovcnt;
+	zpc_hmac_hashfunc_t hfunc;
+
+	TESTLIB_ENV_HMAC_KEY_CHECK();
+
+	TESTLIB_HMAC_HW_CAPS_CHECK();
+
+	hfunc = testlib_env_hmac_hashfunc();
+
+	TESTLIB_HMAC_KERNEL_CAPS_CHECK();
+
+	rc = zpc_hmac_key_alloc(&hmac_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_alloc(&hmac);
+	EXPECT_EQ(rc, 0);
+
+	memset(clearkey, 0xa5, sizeof(clearkey));
+	rc = zpc_hmac_key_set_hash_function(hmac_key, hfunc);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_key_import_clear(hmac_key, clearkey, sizeof(clearkey));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_set_key(hmac, hmac_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0x5a, sizeof(m));
+	iovcnt = testlib_iov_split(miov, 16, m, sizeof(m), 0);
+
+	rc = zpc_hmac_sign(hmac, tag, hfunc2tagsize[hfunc], m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_signv(hmac, tag2, hfunc2tagsize[hfunc], miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(tag, tag2, hfunc2tagsize[hfunc]) == 0);
+
+	rc = zpc_hmac_verifyv(hmac, tag, hfunc2tagsize[hfunc], miov, iovcnt);
+	EXPECT_EQ(rc, 0);
+	tag[0] ^= 1;
+	rc = zpc_hmac_verifyv(hmac, tag, hfunc2tagsize[hfunc], miov, iovcnt);
+	EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+
+	zpc_hmac_free(&hmac);
+	EXPECT_EQ(hmac, nullptr);
+	zpc_hmac_key_free(&hmac_key);
+	EXPECT_EQ(hmac_key, nullptr);
+}
+
+TEST(hmac, dup)
+{
+	struct zpc_hmac_key *hmac_key;
+	struct zpc_hmac *hmac1, *hmac2;
+	u8 clearkey[32], m[333], tag[64], tag1[64], tag2[64];
+	int rc;
+	zpc_hmac_hashfunc_t hfunc;
+
+	TESTLIB_ENV_HMAC_KEY_CHECK();
+
+	TESTLIB_HMAC_HW_CAPS_CHECK();
+
+	hfunc = testlib_env_hmac_hashfunc();
+
+	TESTLIB_HMAC_KERNEL_CAPS_CHECK();
+
+	rc = zpc_hmac_key_alloc(&hmac_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_alloc(&hmac1);
+	EXPECT_EQ(rc, 0);
+
+	memset(clearkey, 0xa5, sizeof(clearkey));
+	rc = zpc_hmac_key_set_hash_function(hmac_key, hfunc);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_key_import_clear(hmac_key, clearkey, sizeof(clearkey));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_set_key(hmac1, hmac_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_hmac_dup(NULL, hmac1);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_hmac_dup(&hmac2, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	memset(m, 0x5a, sizeof(m));
+
+	rc = zpc_hmac_sign(hmac1, tag, hfunc2tagsize[hfunc], m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+
+	/* Fork after a common prefix of a multiple of the block size. */
+	rc = zpc_hmac_sign(hmac1, NULL, 0, m, 256);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_dup(&hmac2, hmac1);
+	EXPECT_EQ(rc, 0);
+	zpc_hmac_key_free(&hmac_key);
+	EXPECT_EQ(hmac_key, nullptr);
+
+	rc = zpc_hmac_sign(hmac1, tag1, hfunc2tagsize[hfunc], m + 256,
+	    sizeof(m) - 256);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_sign(hmac2, tag2, hfunc2tagsize[hfunc], m + 256,
+	    sizeof(m) - 256);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(tag, tag1, hfunc2tagsize[hfunc]) == 0);
+	EXPECT_TRUE(memcmp(tag, tag2, hfunc2tagsize[hfunc]) == 0);
+
+	zpc_hmac_free(&hmac1);
+	EXPECT_EQ(hmac1, nullptr);
+	zpc_hmac_free(&hmac2);
+	EXPECT_EQ(hmac2, nullptr);
+}
+
+TEST(hmac, batch)
+{
+	struct zpc_hmac_key *hmac_key;
+	struct zpc_hmac *hmac;
+	struct zpc_hmac_msg msgs[20];
+	u8 clearkey[32], m[300], tags[20][64], tag[64], tag0[64], valid[3];
+	size_t i, taglen;
+	int rc, h;
+	zpc_hmac_hashfunc_t hfunc;
+	const zpc_hmac_hashfunc_t hfuncs[] = {
+		ZPC_HMAC_HASHFUNC_SHA_224, ZPC_HMAC_HASHFUNC_SHA_256,
+		ZPC_HMAC_HASHFUNC_SHA_384, ZPC_HMAC_HASHFUNC_SHA_512,
+	};
+
+	TESTLIB_ENV_HMAC_KEY_CHECK();
+
+	TESTLIB_HMAC_HW_CAPS_CHECK();
+
+	TESTLIB_HMAC_KERNEL_CAPS_CHECK();
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)i;
+	memset(clearkey, 0xa5, sizeof(clearkey));
+
+	for (h = 0; h < (int)NMEMB(hfuncs); h++) {
+		hfunc = hfuncs[h];
+		taglen = hfunc2tagsize[hfunc];
+
+		rc = zpc_hmac_key_alloc(&hmac_key);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_hmac_alloc(&hmac);
+		EXPECT_EQ(rc, 0);
+
+		rc = zpc_hmac_key_set_hash_function(hmac_key, hfunc);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_hmac_key_import_clear(hmac_key, clearkey,
+		    sizeof(clearkey));
+		EXPECT_EQ(rc, 0);
+		rc = zpc_hmac_set_key(hmac, hmac_key);
+		EXPECT_EQ(rc, 0);
+
+		for (i = 0; i < NMEMB(msgs); i++) {
+			msgs[i].msg = m + i;
+			msgs[i].msglen = i * 15;
+			msgs[i].mac = tags[i];
+		}
+
+		rc = zpc_hmac_sign_batch(hmac, msgs, NMEMB(msgs), 7);
+		EXPECT_EQ(rc, ZPC_ERROR_TAGSIZE);
+		msgs[3].mac = NULL;
+		rc = zpc_hmac_sign_batch(hmac, msgs, NMEMB(msgs), taglen);
+		EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+		msgs[3].mac = tags[3];
+		rc = zpc_hmac_verify_batch(hmac, msgs, NMEMB(msgs), taglen,
+		    NULL);
+		EXPECT_EQ(rc, ZPC_ERROR_ARG5NULL);
+
+		/* A mac computed before the batch. */
+		rc = zpc_hmac_sign(hmac, tag0, taglen, m, sizeof(m));
+		EXPECT_EQ(rc, 0);
+
+		/* An unfinished message in the context is discarded. */
+		rc = zpc_hmac_sign(hmac, NULL, 0, m, 128);
+		EXPECT_EQ(rc, 0);
+		rc = zpc_hmac_sign_batch(hmac, msgs, NMEMB(msgs), taglen);
+		EXPECT_EQ(rc, 0);
+
+		/* The same mac after the batch. */
+		rc = zpc_hmac_sign(hmac, tag, taglen, m, sizeof(m));
+		EXPECT_EQ(rc, 0);
+		EXPECT_TRUE(memcmp(tag, tag0, taglen) == 0);
+
+		for (i = 0; i < NMEMB(msgs); i++) {
+			rc = zpc_hmac_sign(hmac, tag, taglen, msgs[i].msg,
+			    msgs[i].msglen);
+			EXPECT_EQ(rc, 0);
+			EXPECT_TRUE(memcmp(tag, tags[i], taglen) == 0);
+		}
+
+		rc = zpc_hmac_verify_batch(hmac, msgs, NMEMB(msgs), taglen,
+		    valid);
+		EXPECT_EQ(rc, 0);
+		EXPECT_EQ(valid[0], 0xff);
+		EXPECT_EQ(valid[1], 0xff);
+		EXPECT_EQ(valid[2], 0x0f);
+
+		tags[0][0] ^= 1;
+		tags[9][taglen - 1] ^= 1;
+		tags[19][5] ^= 1;
+		rc = zpc_hmac_verify_batch(hmac, msgs, NMEMB(msgs), taglen,
+		    valid);
+		EXPECT_EQ(rc, ZPC_ERROR_TAGMISMATCH);
+		EXPECT_EQ(valid[0], 0xfe);
+		EXPECT_EQ(valid[1], 0xfd);
+		EXPECT_EQ(valid[2], 0x07);
+
+		rc = zpc_hmac_sign(hmac, tag, taglen, m, sizeof(m));
+		EXPECT_EQ(rc, 0);
+		EXPECT_TRUE(memcmp(tag, tag0, taglen) == 0);
+
+		zpc_hmac_free(&hmac);
+		EXPECT_EQ(hmac, nullptr);
+		zpc_hmac_key_free(&hmac_key);
+		EXPECT_EQ(hmac_key, nullptr);
+	}
+}
+
+TEST(hmac, sign_chunks)
+{
+	struct zpc_hmac_key *hmac_key;
+	struct zpc_hmac *hmac;
+	const size_t chunks[] = { 1, 7, 63, 64, 65, 129, 1000 };
+	const size_t lens[] = { 0, 1, 64, 127, 128, 1000, 4099 };
+	u8 clearkey[32], m[4099], tag1[64], tag2[64];
+	size_t i, j, off, n, taglen;
+	int rc;
+	zpc_hmac_hashfunc_t hfunc;
+
+	TESTLIB_ENV_HMAC_KEY_CHECK();
+
+	TESTLIB_HMAC_HW_CAPS_CHECK();
+
+	hfunc = testlib_env_hmac_hashfunc();
+
+	TESTLIB_HMAC_KERNEL_CAPS_CHECK();
+
+	taglen = hfunc2tagsize[hfunc];
+
+	rc = zpc_hmac_key_alloc(&hmac_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_alloc(&hmac);
+	EXPECT_EQ(rc, 0);
+
+	memset(clearkey, 0xa5, sizeof(clearkey));
+	rc = zpc_hmac_key_set_hash_function(hmac_key, hfunc);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_key_import_clear(hmac_key, clearkey, sizeof(clearkey));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_hmac_set_key(hmac, hmac_key);
+	EXPECT_EQ(rc, 0);
+
+	for (i = 0; i < sizeof(m); i++)
+		m[i] = (u8)(i * 3);
+
+	/* Intermediate chunks of any length. */
+	for (i = 0; i < NMEMB(lens); i++) {
+		rc = zpc_hmac_sign(hmac, tag1, taglen, m, lens[i]);
+		EXPECT_EQ(rc, 0);
+
+		for (j = 0; j < NMEMB(chunks); j++) {
+			for (off = 0; off < lens[i]; off += n) {
+				n = std::min(chunks[j], lens[i] - off);
+				if (off + n == lens[i])
+					break;
+				rc = zpc_hmac_sign(hmac, NULL, 0, m + off, n);
+				EXPECT_EQ(rc, 0);
+			}
+			rc = zpc_hmac_sign(hmac, tag2, taglen, m + off,
+			    lens[i] - off);
+			EXPECT_EQ(rc, 0);
+			EXPECT_TRUE(memcmp(tag1, tag2, taglen) == 0);
+
+			for (off = 0; off < lens[i]; off += n) {
+				n = std::min(chunks[j], lens[i] - off);
+				rc = zpc_hmac_verify(hmac, NULL, 0, m + off, n);
+				EXPECT_EQ(rc, 0);
+			}
+			rc = zpc_hmac_verify(hmac, tag1, taglen, NULL, 0);
+			EXPECT_EQ(rc, 0);
+		}
+	}
+
+	zpc_hmac_free(&hmac);
+	EXPECT_EQ(hmac, nullptr);
+	zpc_hmac_key_free(&hmac_key);
+	EXPECT_EQ(hmac_key, nullptr);
+}
+
 TEST(hmac, pc)
 {
 	struct zpc_hmac_key *hmac_key1, *hmac_key2, *hmac_key3;
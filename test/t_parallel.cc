@@ -0,0 +1,449 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "testlib.h"
+
+#include "gtest/gtest.h"
+#include "zpc/parallel.h"
+#include "zpc/aes_ecb.h"
+#include "zpc/aes_cbc.h"
+#include "zpc/aes_xts.h"
+#include "zpc/aes_ctr.h"
+#include "zpc/error.h"
+#include "aes_key_local.h"  /* de-opaquify struct zpc_aes_key */
+#include "aes_cbc_local.h"  /* de-opaquify struct zpc_aes_cbc */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* More than a few chunks and not a multiple of the block size. */
+#define BULKLEN		(5 * 256 * 1024 + 3 * 16 + 7)
+
+static u8 *
+__bulk_alloc(void)
+{
+	u8 *buf;
+	size_t i;
+
+	buf = (u8 *)malloc(BULKLEN);
+	for (i = 0; buf != NULL && i < BULKLEN; i++)
+		buf[i] = (u8)(i * 7 + 3);
+	return buf;
+}
+
+static struct zpc_aes_key *
+__aes_key_new(int size)
+{
+	struct zpc_aes_key *aes_key;
+	int rc;
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	return aes_key;
+}
+
+TEST(parallel, set_threads)
+{
+	unsigned int n;
+	int rc;
+
+	rc = zpc_parallel_get_threads(NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_parallel_set_threads(257);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1RANGE);
+
+	rc = zpc_parallel_get_threads(&n);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(n, 0U);
+
+	rc = zpc_parallel_set_threads(4);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_parallel_get_threads(&n);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(n, 4U);
+
+	rc = zpc_parallel_set_threads(2);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_parallel_get_threads(&n);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(n, 2U);
+
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_parallel_get_threads(&n);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(n, 0U);
+}
+
+TEST(parallel, aes_ecb)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ecb *aes_ecb;
+	const size_t len = BULKLEN & ~(size_t)15;
+	u8 *m, *c1, *c2;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	m = __bulk_alloc();
+	c1 = __bulk_alloc();
+	c2 = __bulk_alloc();
+	ASSERT_TRUE(m != NULL && c1 != NULL && c2 != NULL);
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c1, m, len);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_parallel_set_threads(3);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c2, m, len);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c1, c2, len) == 0);
+
+	/* In-place. */
+	rc = zpc_aes_ecb_decrypt(aes_ecb, c2, c2, len);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, c2, len) == 0);
+
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+	free(m);
+	free(c1);
+	free(c2);
+}
+
+TEST(parallel, aes_cbc)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cbc *aes_cbc;
+	const size_t len = BULKLEN & ~(size_t)15;
+	u8 iv[16], *m, *c, *m1, *m2;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CBC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	m = __bulk_alloc();
+	c = __bulk_alloc();
+	m1 = __bulk_alloc();
+	m2 = __bulk_alloc();
+	ASSERT_TRUE(m != NULL && c != NULL && m1 != NULL && m2 != NULL);
+	memset(iv, 0x5a, sizeof(iv));
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_cbc_alloc(&aes_cbc);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_key(aes_cbc, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encrypt(aes_cbc, c, m, len);
+	EXPECT_EQ(rc, 0);
+
+	/* Serial reference, then two calls to check the chaining value. */
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt(aes_cbc, m1, c, len - 64);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt(aes_cbc, m1 + len - 64, c + len - 64, 64);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, m1, len) == 0);
+
+	rc = zpc_parallel_set_threads(3);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt(aes_cbc, m2, c, len - 64);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt(aes_cbc, m2 + len - 64, c + len - 64, 64);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, m2, len) == 0);
+
+	/* In-place. */
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt(aes_cbc, c, c, len);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, c, len) == 0);
+
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_cbc_free(&aes_cbc);
+	EXPECT_EQ(aes_cbc, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+	free(m);
+	free(c);
+	free(m1);
+	free(m2);
+}
+
+/*
+ * A chunk may fail after others wrote their output: in-place decryption
+ * must not return ZPC_ERROR_AGAIN then, even for a non-blocking key.
+ */
+TEST(parallel, aes_cbc_nonblock)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_cbc *aes_cbc;
+	const size_t len = BULKLEN & ~(size_t)15;
+	const char *mkvp, *apqns[257];
+	unsigned int flags;
+	u8 iv[16], *m, *c;
+	int type, size, rc;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CBC_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+	type = testlib_env_aes_key_type();
+	flags = testlib_env_aes_key_flags();
+	mkvp = testlib_env_aes_key_mkvp();
+	(void)testlib_env_aes_key_apqns(apqns);
+
+	TESTLIB_AES_KERNEL_CAPS_CHECK(type);
+
+	TESTLIB_APQN_CAPS_CHECK(apqns, mkvp, type, size, flags);
+
+	if (type == ZPC_AES_KEY_TYPE_PVSECRET)
+		GTEST_SKIP_("Skipping aes_cbc_nonblock test. Not applicable for PVSECRET type keys.");
+
+	m = __bulk_alloc();
+	c = __bulk_alloc();
+	ASSERT_TRUE(m != NULL && c != NULL);
+	memset(iv, 0x5a, sizeof(iv));
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_type(aes_key, type);
+	EXPECT_EQ(rc, 0);
+	if (mkvp != NULL) {
+		rc = zpc_aes_key_set_mkvp(aes_key, mkvp);
+		EXPECT_EQ(rc, 0);
+	} else {
+		rc = zpc_aes_key_set_apqns(aes_key, apqns);
+		EXPECT_EQ(rc, 0);
+	}
+	rc = zpc_aes_key_set_flags(aes_key, flags);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_nonblock(aes_key, 1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_cbc_alloc(&aes_cbc);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_key(aes_cbc, aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_encrypt(aes_cbc, c, m, len);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_parallel_set_threads(3);
+	EXPECT_EQ(rc, 0);
+
+	memset(aes_key->prot.protkey, 0, sizeof(aes_key->prot.protkey));    /* force WKaVP mismatch */
+	memset(aes_cbc->param.protkey, 0, sizeof(aes_cbc->param.protkey));
+	rc = zpc_aes_cbc_set_iv(aes_cbc, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_cbc_decrypt(aes_cbc, c, c, len);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, c, len) == 0);
+
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_cbc_free(&aes_cbc);
+	EXPECT_EQ(aes_cbc, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+	free(m);
+	free(c);
+}
+
+TEST(parallel, aes_xts)
+{
+	struct zpc_aes_key *aes_key1, *aes_key2;
+	struct zpc_aes_xts *aes_xts;
+	u8 iv[16], iv1[16], iv2[16], *m, *c1, *c2;
+	const size_t ss = 4096 + 8;
+	const size_t nsectors = BULKLEN / ss;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_XTS_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	TESTLIB_AES_XTS_KEY_SIZE_CHECK(size);
+
+	m = __bulk_alloc();
+	c1 = __bulk_alloc();
+	c2 = __bulk_alloc();
+	ASSERT_TRUE(m != NULL && c1 != NULL && c2 != NULL);
+	memset(iv, 0xa5, sizeof(iv));
+
+	aes_key1 = __aes_key_new(size);
+	aes_key2 = __aes_key_new(size);
+	rc = zpc_aes_xts_alloc(&aes_xts);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_set_key(aes_xts, aes_key1, aes_key2);
+	EXPECT_EQ(rc, 0);
+
+	/* Serial references. */
+	rc = zpc_aes_xts_set_iv(aes_xts, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt(aes_xts, c1, m, BULKLEN);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_get_intermediate_iv(aes_xts, iv1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_parallel_set_threads(3);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_xts_set_iv(aes_xts, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt(aes_xts, c2, m, BULKLEN);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_get_intermediate_iv(aes_xts, iv2);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c1, c2, BULKLEN) == 0);
+	EXPECT_TRUE(memcmp(iv1, iv2, sizeof(iv1)) == 0);
+
+	/* In-place. */
+	rc = zpc_aes_xts_set_iv(aes_xts, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_decrypt(aes_xts, c2, c2, BULKLEN);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, c2, BULKLEN) == 0);
+
+	/* Sectors. */
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c1, m, ss, 1000, nsectors);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_get_intermediate_iv(aes_xts, iv1);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_parallel_set_threads(3);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_encrypt_sectors(aes_xts, c2, m, ss, 1000, nsectors);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_xts_get_intermediate_iv(aes_xts, iv2);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c1, c2, nsectors * ss) == 0);
+	EXPECT_TRUE(memcmp(iv1, iv2, sizeof(iv1)) == 0);
+
+	rc = zpc_aes_xts_decrypt_sectors(aes_xts, c2, c2, ss, 1000, nsectors);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, c2, nsectors * ss) == 0);
+
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_xts_free(&aes_xts);
+	EXPECT_EQ(aes_xts, nullptr);
+	zpc_aes_key_free(&aes_key1);
+	EXPECT_EQ(aes_key1, nullptr);
+	zpc_aes_key_free(&aes_key2);
+	EXPECT_EQ(aes_key2, nullptr);
+	free(m);
+	free(c1);
+	free(c2);
+}
+
+TEST(parallel, aes_ctr)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ctr *aes_ctr;
+	u8 iv[16], *m, *c1, *c2;
+	int rc, size;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_CTR_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	m = __bulk_alloc();
+	c1 = __bulk_alloc();
+	c2 = __bulk_alloc();
+	ASSERT_TRUE(m != NULL && c1 != NULL && c2 != NULL);
+	memset(iv, 0xff, sizeof(iv));
+
+	aes_key = __aes_key_new(size);
+	rc = zpc_aes_ctr_alloc(&aes_ctr);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_set_key(aes_ctr, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c1, m, BULKLEN);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_parallel_set_threads(3);
+	EXPECT_EQ(rc, 0);
+
+	/* Not block aligned start, then the rest. */
+	rc = zpc_aes_ctr_seek(aes_ctr, 5);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c2 + 5, m + 5, BULKLEN - 5 - 20);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_encrypt(aes_ctr, c2 + BULKLEN - 20, m + BULKLEN - 20,
+	    20);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(c1 + 5, c2 + 5, BULKLEN - 5) == 0);
+
+	/* In-place. */
+	rc = zpc_aes_ctr_set_iv(aes_ctr, iv);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ctr_decrypt(aes_ctr, c1, c1, BULKLEN);
+	EXPECT_EQ(rc, 0);
+	EXPECT_TRUE(memcmp(m, c1, BULKLEN) == 0);
+
+	rc = zpc_parallel_set_threads(0);
+	EXPECT_EQ(rc, 0);
+
+	zpc_aes_ctr_free(&aes_ctr);
+	EXPECT_EQ(aes_ctr, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+	free(m);
+	free(c1);
+	free(c2);
+}
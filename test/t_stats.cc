@@ -0,0 +1,213 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "testlib.h"
+
+#include "gtest/gtest.h"
+#include "zpc/aes_ecb.h"
+#include "zpc/stats.h"
+#include "zpc/error.h"
+
+#include "aes_ecb_local.h"  /* de-opaquify struct zpc_aes_ecb */
+
+#include <string.h>
+#include <thread>
+
+static void __encrypt_ecb(struct zpc_aes_key *, int);
+
+TEST(stats, hist)
+{
+	unsigned long long hist[ZPC_STATS_HIST_BUCKETS];
+	unsigned int i;
+
+	for (i = 0; i < ZPC_STATS_HIST_SUB_BUCKETS; i++)
+		EXPECT_EQ(zpc_stats_hist_value(i), i);
+	for (i = 1; i < ZPC_STATS_HIST_BUCKETS; i++)
+		EXPECT_GT(zpc_stats_hist_value(i), zpc_stats_hist_value(i - 1));
+	EXPECT_EQ(zpc_stats_hist_value(ZPC_STATS_HIST_BUCKETS),
+	    zpc_stats_hist_value(ZPC_STATS_HIST_BUCKETS - 1));
+
+	memset(hist, 0, sizeof(hist));
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 50.0), 0ULL);
+	EXPECT_EQ(zpc_stats_hist_percentile(NULL, 50.0), 0ULL);
+
+	hist[10] = 90;
+	hist[20] = 9;
+	hist[30] = 1;
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 0.0), zpc_stats_hist_value(10));
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 50.0), zpc_stats_hist_value(10));
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 90.0), zpc_stats_hist_value(10));
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 99.0), zpc_stats_hist_value(20));
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 99.9), zpc_stats_hist_value(30));
+	EXPECT_EQ(zpc_stats_hist_percentile(hist, 100.0), zpc_stats_hist_value(30));
+}
+
+TEST(stats, get)
+{
+	struct zpc_stats *stats;
+	int rc;
+
+	rc = zpc_stats_get(NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+
+	stats = (struct zpc_stats *)malloc(sizeof(*stats));
+	ASSERT_NE(stats, nullptr);
+
+	zpc_stats_reset();
+	rc = zpc_stats_get(stats);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(stats->total.ops, 0ULL);
+
+	free(stats);
+}
+
+TEST(stats, aes_ecb)
+{
+	struct zpc_stats_counters counters;
+	struct zpc_aes_key *aes_key;
+	struct zpc_aes_ecb *aes_ecb;
+	struct zpc_stats *stats;
+	u8 m[64], c[64];
+	int rc, size, enabled;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	stats = (struct zpc_stats *)malloc(sizeof(*stats));
+	ASSERT_NE(stats, nullptr);
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ecb_get_stats(NULL, &counters);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG1NULL);
+	rc = zpc_aes_ecb_get_stats(aes_ecb, NULL);
+	EXPECT_EQ(rc, ZPC_ERROR_ARG2NULL);
+
+	enabled = zpc_stats_enable(1);
+	zpc_stats_reset();
+
+	memset(m, 0, sizeof(m));
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c, m, sizeof(m));
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_decrypt(aes_ecb, m, c, sizeof(c));
+	EXPECT_EQ(rc, 0);
+
+	rc = zpc_aes_ecb_get_stats(aes_ecb, &counters);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(counters.ops, 2ULL);
+	EXPECT_EQ(counters.bytes, 2 * sizeof(m));
+	EXPECT_GE(counters.cpacf_calls, 2ULL);
+	EXPECT_EQ(counters.wkvp_mismatch, 0ULL);
+
+	/* A random protected key cannot be re-derived. */
+	memset(aes_ecb->param.protkey, 0, sizeof(aes_ecb->param.protkey));
+	rc = zpc_aes_ecb_encrypt(aes_ecb, c, m, sizeof(m));
+	EXPECT_EQ(rc, ZPC_ERROR_PROTKEYONLY);
+
+	rc = zpc_aes_ecb_get_stats(aes_ecb, &counters);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(counters.ops, 3ULL);
+	EXPECT_EQ(counters.wkvp_mismatch, 1ULL);
+	EXPECT_EQ(counters.rederive, 0ULL);
+
+	rc = zpc_stats_get(stats);
+	EXPECT_EQ(rc, 0);
+	EXPECT_GE(stats->total.ops, 3ULL);
+	EXPECT_GE(stats->op[ZPC_STATS_OP_AES_ECB].calls, 3ULL);
+	EXPECT_GE(stats->op[ZPC_STATS_OP_AES_ECB].bytes, 3 * sizeof(m));
+	EXPECT_NE(zpc_stats_hist_percentile(stats->op[ZPC_STATS_OP_AES_ECB].latency,
+	    100.0), 0ULL);
+
+	zpc_stats_enable(enabled);
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+	free(stats);
+}
+
+TEST(stats, threads)
+{
+	struct zpc_aes_key *aes_key;
+	struct zpc_stats *stats;
+	std::thread *t[8];
+	int rc, i, size, enabled;
+
+	TESTLIB_ENV_AES_KEY_CHECK();
+
+	TESTLIB_AES_ECB_HW_CAPS_CHECK();
+
+	size = testlib_env_aes_key_size();
+
+	stats = (struct zpc_stats *)malloc(sizeof(*stats));
+	ASSERT_NE(stats, nullptr);
+
+	rc = zpc_aes_key_alloc(&aes_key);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_set_size(aes_key, size);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_key_generate(aes_key);
+	EXPECT_EQ(rc, 0);
+
+	enabled = zpc_stats_enable(1);
+	zpc_stats_reset();
+
+	/* Counters of exited threads must not get lost. */
+	for (i = 0; i < 8; i++)
+		t[i] = new std::thread(__encrypt_ecb, aes_key, 100);
+	for (i = 0; i < 8; i++) {
+		t[i]->join();
+		delete t[i];
+	}
+
+	zpc_stats_enable(enabled);
+
+	rc = zpc_stats_get(stats);
+	EXPECT_EQ(rc, 0);
+	EXPECT_EQ(stats->op[ZPC_STATS_OP_AES_ECB].calls, 8 * 100ULL);
+	EXPECT_EQ(stats->op[ZPC_STATS_OP_AES_ECB].bytes, 8 * 100 * 64ULL);
+
+	zpc_aes_key_free(&aes_key);
+	EXPECT_EQ(aes_key, nullptr);
+	free(stats);
+}
+
+static void
+__encrypt_ecb(struct zpc_aes_key *aes_key, int n)
+{
+	struct zpc_aes_ecb *aes_ecb;
+	u8 m[64], c[64];
+	int rc, i;
+
+	rc = zpc_aes_ecb_alloc(&aes_ecb);
+	EXPECT_EQ(rc, 0);
+	rc = zpc_aes_ecb_set_key(aes_ecb, aes_key);
+	EXPECT_EQ(rc, 0);
+
+	memset(m, 0, sizeof(m));
+	for (i = 0; i < n; i++) {
+		rc = zpc_aes_ecb_encrypt(aes_ecb, c, m, sizeof(m));
+		EXPECT_EQ(rc, 0);
+	}
+
+	zpc_aes_ecb_free(&aes_ecb);
+	EXPECT_EQ(aes_ecb, nullptr);
+}
@@ -1370,3 +1370,32 @@ int testlib_set_aes_xts_key_from_pvsecret(struct zpc_aes_xts_key *aes_key, int k
 
 	return rc;
 }
+
+/*
+ * Split buf into at most iovmax segments, starting with segment lengths
+ * that are not block-aligned and include empty segments. The split is
+ * shifted by skew bytes so that in- and output can be split differently.
+ * Returns the number of segments.
+ */
+int
+testlib_iov_split(struct iovec *iov, int iovmax, unsigned char *buf,
+    size_t buflen, size_t skew)
+{
+	static const size_t seglen[] = { 1, 0, 30, 17, 0, 64, 5 };
+	size_t off = 0, len;
+	int i;
+
+	for (i = 0; i < iovmax - 1 && off < buflen; i++) {
+		len = i < (int)NMEMB(seglen) ? seglen[i] : 16;
+		if (i == 0)
+			len += skew;
+		if (len > buflen - off)
+			len = buflen - off;
+		iov[i].iov_base = buf + off;
+		iov[i].iov_len = len;
+		off += len;
+	}
+	iov[i].iov_base = buf + off;
+	iov[i].iov_len = buflen - off;
+	return i + 1;
+}
@@ -17,6 +17,7 @@ extern "C" {
 # endif
 
 # include <stddef.h>
+# include <sys/uio.h>
 
 #include "zpc/ecc_key.h"
 #include "zpc/hmac.h"
@@ -106,6 +107,28 @@ do {                                                                           \
         }                                                                      \
 } while (0)
 
+# define TESTLIB_AES_CTR_HW_CAPS_CHECK()                                       \
+do {                                                                           \
+        int rc;                                                                \
+        struct zpc_aes_ctr *ctx;                                               \
+                                                                               \
+        rc = zpc_aes_ctr_alloc(&ctx);                                          \
+        switch (rc) {                                                          \
+        case ZPC_ERROR_DEVPKEY:                                                \
+            GTEST_SKIP_("HW_CAPS check (AES-CTR): opening /dev/pkey failed."); \
+            break;                                                             \
+        case ZPC_ERROR_HWCAPS:                                                 \
+            GTEST_SKIP_("HW_CAPS check (AES-CTR): no hw capabilities for AES-CTR."); \
+            break;                                                             \
+        case ZPC_ERROR_MALLOC:                                                 \
+            GTEST_SKIP_("HW_CAPS check (AES-CTR): cannot allocate AES ctx object."); \
+            break;                                                             \
+        default:                                                               \
+            zpc_aes_ctr_free(&ctx);                                            \
+            break;                                                             \
+        }                                                                      \
+} while (0)
+
 # define TESTLIB_AES_CMAC_HW_CAPS_CHECK()                                      \
 do {                                                                           \
         int rc;                                                                \
@@ -172,6 +195,28 @@ do {                                                                           \
         }                                                                      \
 } while (0)
 
+# define TESTLIB_AES_GMAC_HW_CAPS_CHECK()                                      \
+do {                                                                           \
+        int rc;                                                                \
+        struct zpc_aes_gmac *ctx;                                              \
+                                                                               \
+        rc = zpc_aes_gmac_alloc(&ctx);                                         \
+        switch (rc) {                                                          \
+        case ZPC_ERROR_DEVPKEY:                                                \
+            GTEST_SKIP_("HW_CAPS check (AES-GMAC): opening /dev/pkey failed."); \
+            break;                                                             \
+        case ZPC_ERROR_HWCAPS:                                                 \
+            GTEST_SKIP_("HW_CAPS check (AES-GMAC): no hw capabilities for AES-GMAC."); \
+            break;                                                             \
+        case ZPC_ERROR_MALLOC:                                                 \
+            GTEST_SKIP_("HW_CAPS check (AES-GMAC): cannot allocate AES ctx object."); \
+            break;                                                             \
+        default:                                                               \
+            zpc_aes_gmac_free(&ctx);                                           \
+            break;                                                             \
+        }                                                                      \
+} while (0)
+
 # define TESTLIB_AES_XTS_HW_CAPS_CHECK()                                       \
 do {                                                                           \
         int rc;                                                                \
@@ -833,6 +878,7 @@ int testlib_set_aes_xts_key_from_pvsecret(struct zpc_aes_xts_key *aes_key, int k
 unsigned char *testlib_hexstr2buf(const char *, size_t *);
 unsigned char *testlib_hexstr2fixedbuf(const char *hexstr, size_t tolen);
 char *testlib_buf2hexstr(const unsigned char *, size_t);
+int testlib_iov_split(struct iovec *, int, unsigned char *, size_t, size_t);
 
 # ifdef __cplusplus
 /* *INDENT-OFF* */
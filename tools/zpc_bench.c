@@ -0,0 +1,1214 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * zpc_bench - throughput and latency of the libzpc ciphers, MACs and
+ * signatures.
+ *
+ * For each algorithm, message size, thread count, buffer mode (in-place
+ * or out-of-place) and key mode (one key shared by all threads or one key
+ * per thread), all threads call the algorithm's one-shot operation in a
+ * loop for a fixed duration. The results are written as JSON: operations
+ * and bytes per second, CPU cycles per byte (from the CPU cycle counter
+ * of perf_event_open(2), null if not available) and the 50th, 99th and
+ * 99.9th percentile of the operation latency.
+ */
+
+#include <zpc/aes_key.h>
+#include <zpc/aes_ecb.h>
+#include <zpc/aes_cbc.h>
+#include <zpc/aes_xts.h>
+#include <zpc/aes_xts_key.h>
+#include <zpc/aes_xts_full.h>
+#include <zpc/aes_cmac.h>
+#include <zpc/aes_ccm.h>
+#include <zpc/aes_gcm.h>
+#include <zpc/hmac_key.h>
+#include <zpc/hmac.h>
+#include <zpc/ecc_key.h>
+#include <zpc/ecdsa_ctx.h>
+#include <zpc/error.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_SIZES	"16,64,256,1K,4K,16K,64K,256K,1M,4M,16M,64M"
+#define MAX_SIZES	64
+#define MAX_THREADS	1024
+#define MAX_APQNS	256
+/* Latency samples kept per thread (reservoir sampling beyond). */
+#define LAT_SAMPLES	65536
+
+enum alg_id {
+	ALG_AES_ECB,
+	ALG_AES_CBC,
+	ALG_AES_XTS,
+	ALG_AES_XTS_FULL,
+	ALG_AES_CMAC,
+	ALG_AES_CCM,
+	ALG_AES_GCM,
+	ALG_HMAC,
+	ALG_ECDSA_SIGN,
+	ALG_ECDSA_VERIFY,
+	ALG_NMEMB
+};
+
+static const char *const alg_names[ALG_NMEMB] = {
+	"aes-ecb", "aes-cbc", "aes-xts", "aes-xts-full", "aes-cmac",
+	"aes-ccm", "aes-gcm", "hmac", "ecdsa-sign", "ecdsa-verify",
+};
+
+/* Command line options. */
+static struct {
+	int algs[ALG_NMEMB];
+	size_t sizes[MAX_SIZES];
+	size_t nsizes;
+	unsigned int threads[MAX_SIZES];
+	size_t nthreads;
+	double duration;
+	int inplace[2];		/* run out-of-place, in-place */
+	int perthread[2];	/* run shared key, per-thread keys */
+	int clear;
+
+	int aes_type;
+	int aes_size;
+	const char *apqns[MAX_APQNS + 1];
+	const char *mkvp;
+	unsigned char aes_secret[64];
+	size_t aes_secretlen;
+	unsigned char xts_secret[64];
+	size_t xts_secretlen;
+	unsigned char hmac_secret[64];
+	size_t hmac_secretlen;
+	zpc_hmac_hashfunc_t hash;
+
+	int ec_type;
+	zpc_ec_curve_t curve;
+	unsigned char ec_secret[64];
+	size_t ec_secretlen;
+	unsigned char ec_pub[132];
+	size_t ec_publen;
+} opt;
+
+/* The keys of one shared or per-thread key set. */
+struct keys {
+	struct zpc_aes_key *aes1;
+	struct zpc_aes_key *aes2;
+	struct zpc_aes_xts_key *xts;
+	struct zpc_hmac_key *hmac;
+	struct zpc_ec_key *ec;
+};
+
+struct run {
+	enum alg_id alg;
+	size_t msglen;
+	unsigned int nthreads;
+	int inplace;
+	int perthread;
+
+	pthread_barrier_t start;
+	volatile int stop;
+};
+
+struct worker {
+	pthread_t thread;
+	struct run *run;
+
+	struct keys own;
+	struct keys *keys;
+	void *ctx;
+	unsigned char *in, *out;
+	unsigned char sig[132];
+	unsigned int siglen;
+
+	unsigned long long ops;
+	unsigned long long *lat;
+	size_t nlat;
+	uint64_t rng;
+	long long cycles;	/* -1: not available */
+	int rc;
+};
+
+static const int curve2hashlen[] = { 32, 48, 64, 64, 64 };
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [OPTIONS]\n"
+	    "  -a, --algorithms LIST  comma-separated list of aes-ecb, aes-cbc,\n"
+	    "                         aes-xts, aes-xts-full, aes-cmac, aes-ccm,\n"
+	    "                         aes-gcm, hmac, ecdsa-sign, ecdsa-verify\n"
+	    "                         (default: all)\n"
+	    "  -s, --sizes LIST       message sizes [bytes, K, M suffixes]\n"
+	    "                         (default: " DEFAULT_SIZES ")\n"
+	    "  -t, --threads LIST     thread counts (default: 1)\n"
+	    "  -d, --duration SEC     duration of each run (default: 1)\n"
+	    "  -b, --buffers MODE     out, in or both: out-of-place and/or\n"
+	    "                         in-place operation (default: out)\n"
+	    "  -k, --keys MODE        shared, per-thread or both (default: shared)\n"
+	    "  -o, --output FILE      write JSON to FILE (default: stdout)\n"
+	    "  -c, --clear            import random clear keys instead of\n"
+	    "                         generating keys\n"
+	    "      --key-type TYPE    AES key type: cca-data, cca-cipher, ep11\n"
+	    "                         (default) or pvsecret\n"
+	    "      --key-size BITS    AES key size: 128, 192 or 256 (default)\n"
+	    "      --mkvp MKVP        AES/EC master key verification pattern\n"
+	    "      --apqns LIST       AES/EC APQNs, e.g. 03.0039,04.0039\n"
+	    "      --aes-secret ID    AES retrievable secret ID [hex]\n"
+	    "      --xts-secret ID    full-XTS retrievable secret ID [hex]\n"
+	    "      --hmac-secret ID   HMAC retrievable secret ID [hex]\n"
+	    "      --hash FUNC        HMAC hash function: sha224, sha256 (default),\n"
+	    "                         sha384 or sha512\n"
+	    "      --ec-key-type TYPE EC key type: cca, ep11 (default) or pvsecret\n"
+	    "      --curve CURVE      p256 (default), p384, p521, ed25519, ed448\n"
+	    "      --ec-secret ID     EC retrievable secret ID [hex]\n"
+	    "      --ec-pubkey KEY    EC public key of the secret [hex]\n"
+	    "  -h, --help             print this help\n", prog);
+}
+
+static int parse_hex(unsigned char *buf, size_t *buflen, size_t max,
+    const char *str)
+{
+	size_t i, len = strlen(str);
+	unsigned int byte;
+
+	if (len >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		str += 2;
+		len -= 2;
+	}
+	if (len == 0 || len % 2 != 0 || len / 2 > max)
+		return -1;
+
+	for (i = 0; i < len / 2; i++) {
+		if (sscanf(str + 2 * i, "%2x", &byte) != 1)
+			return -1;
+		buf[i] = byte;
+	}
+
+	*buflen = len / 2;
+	return 0;
+}
+
+static int parse_size(size_t *size, const char *str)
+{
+	unsigned long long val;
+	char *endptr;
+
+	errno = 0;
+	val = strtoull(str, &endptr, 10);
+	if (errno != 0 || endptr == str)
+		return -1;
+
+	switch (*endptr) {
+	case 'G':
+	case 'g':
+		val <<= 10;
+		/* fall through */
+	case 'M':
+	case 'm':
+		val <<= 10;
+		/* fall through */
+	case 'K':
+	case 'k':
+		val <<= 10;
+		endptr++;
+		break;
+	}
+	if (*endptr != '\0' || val == 0)
+		return -1;
+
+	*size = val;
+	return 0;
+}
+
+/* Split a comma-separated list in place. Returns the number of elements. */
+static size_t split(char *str, char **elems, size_t max)
+{
+	char *tok, *saveptr = NULL;
+	size_t n = 0;
+
+	for (tok = strtok_r(str, ",", &saveptr); tok != NULL && n < max;
+	    tok = strtok_r(NULL, ",", &saveptr))
+		elems[n++] = tok;
+
+	return n;
+}
+
+static int parse_args(int argc, char *argv[], FILE **out)
+{
+	enum {
+		OPT_KEY_TYPE = 256, OPT_KEY_SIZE, OPT_MKVP, OPT_APQNS,
+		OPT_AES_SECRET, OPT_XTS_SECRET, OPT_HMAC_SECRET, OPT_HASH,
+		OPT_EC_KEY_TYPE, OPT_CURVE, OPT_EC_SECRET, OPT_EC_PUBKEY,
+	};
+	static const struct option longopts[] = {
+		{"algorithms", required_argument, NULL, 'a'},
+		{"sizes", required_argument, NULL, 's'},
+		{"threads", required_argument, NULL, 't'},
+		{"duration", required_argument, NULL, 'd'},
+		{"buffers", required_argument, NULL, 'b'},
+		{"keys", required_argument, NULL, 'k'},
+		{"output", required_argument, NULL, 'o'},
+		{"clear", no_argument, NULL, 'c'},
+		{"key-type", required_argument, NULL, OPT_KEY_TYPE},
+		{"key-size", required_argument, NULL, OPT_KEY_SIZE},
+		{"mkvp", required_argument, NULL, OPT_MKVP},
+		{"apqns", required_argument, NULL, OPT_APQNS},
+		{"aes-secret", required_argument, NULL, OPT_AES_SECRET},
+		{"xts-secret", required_argument, NULL, OPT_XTS_SECRET},
+		{"hmac-secret", required_argument, NULL, OPT_HMAC_SECRET},
+		{"hash", required_argument, NULL, OPT_HASH},
+		{"ec-key-type", required_argument, NULL, OPT_EC_KEY_TYPE},
+		{"curve", required_argument, NULL, OPT_CURVE},
+		{"ec-secret", required_argument, NULL, OPT_EC_SECRET},
+		{"ec-pubkey", required_argument, NULL, OPT_EC_PUBKEY},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0},
+	};
+	char sizes[] = DEFAULT_SIZES;
+	char *elems[MAX_SIZES];
+	const char *outfile = NULL;
+	size_t i, j, n;
+	int c, all = 1;
+
+	opt.nsizes = 0;
+	opt.threads[0] = 1;
+	opt.nthreads = 1;
+	opt.duration = 1.0;
+	opt.inplace[0] = 1;
+	opt.perthread[0] = 1;
+	opt.aes_type = ZPC_AES_KEY_TYPE_EP11;
+	opt.aes_size = 256;
+	opt.hash = ZPC_HMAC_HASHFUNC_SHA_256;
+	opt.ec_type = ZPC_EC_KEY_TYPE_EP11;
+	opt.curve = ZPC_EC_CURVE_P256;
+
+	while ((c = getopt_long(argc, argv, "a:s:t:d:b:k:o:ch", longopts,
+	    NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			all = 0;
+			n = split(optarg, elems, MAX_SIZES);
+			for (i = 0; i < n; i++) {
+				for (j = 0; j < ALG_NMEMB; j++) {
+					if (strcmp(elems[i], alg_names[j]) == 0)
+						break;
+				}
+				if (j == ALG_NMEMB) {
+					fprintf(stderr, "unknown algorithm '%s'\n",
+					    elems[i]);
+					return -1;
+				}
+				opt.algs[j] = 1;
+			}
+			break;
+		case 's':
+			n = split(optarg, elems, MAX_SIZES);
+			for (i = 0; i < n; i++) {
+				if (parse_size(&opt.sizes[i], elems[i]) != 0) {
+					fprintf(stderr, "invalid size '%s'\n",
+					    elems[i]);
+					return -1;
+				}
+			}
+			opt.nsizes = n;
+			break;
+		case 't':
+			n = split(optarg, elems, MAX_SIZES);
+			for (i = 0; i < n; i++) {
+				opt.threads[i] = strtoul(elems[i], NULL, 10);
+				if (opt.threads[i] < 1
+				    || opt.threads[i] > MAX_THREADS) {
+					fprintf(stderr, "invalid thread count "
+					    "'%s'\n", elems[i]);
+					return -1;
+				}
+			}
+			opt.nthreads = n;
+			break;
+		case 'd':
+			opt.duration = strtod(optarg, NULL);
+			if (!(opt.duration > 0)) {
+				fprintf(stderr, "invalid duration '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+			opt.inplace[0] = strcmp(optarg, "in") != 0;
+			opt.inplace[1] = strcmp(optarg, "out") != 0;
+			if (strcmp(optarg, "in") != 0 && strcmp(optarg, "out") != 0
+			    && strcmp(optarg, "both") != 0) {
+				fprintf(stderr, "invalid buffer mode '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'k':
+			opt.perthread[0] = strcmp(optarg, "per-thread") != 0;
+			opt.perthread[1] = strcmp(optarg, "shared") != 0;
+			if (strcmp(optarg, "shared") != 0
+			    && strcmp(optarg, "per-thread") != 0
+			    && strcmp(optarg, "both") != 0) {
+				fprintf(stderr, "invalid key mode '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'c':
+			opt.clear = 1;
+			break;
+		case OPT_KEY_TYPE:
+			if (strcmp(optarg, "cca-data") == 0)
+				opt.aes_type = ZPC_AES_KEY_TYPE_CCA_DATA;
+			else if (strcmp(optarg, "cca-cipher") == 0)
+				opt.aes_type = ZPC_AES_KEY_TYPE_CCA_CIPHER;
+			else if (strcmp(optarg, "ep11") == 0)
+				opt.aes_type = ZPC_AES_KEY_TYPE_EP11;
+			else if (strcmp(optarg, "pvsecret") == 0)
+				opt.aes_type = ZPC_AES_KEY_TYPE_PVSECRET;
+			else {
+				fprintf(stderr, "invalid key type '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_KEY_SIZE:
+			opt.aes_size = atoi(optarg);
+			if (opt.aes_size != 128 && opt.aes_size != 192
+			    && opt.aes_size != 256) {
+				fprintf(stderr, "invalid key size '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_MKVP:
+			opt.mkvp = optarg;
+			break;
+		case OPT_APQNS:
+			n = split(optarg, (char **)opt.apqns, MAX_APQNS);
+			opt.apqns[n] = NULL;
+			break;
+		case OPT_AES_SECRET:
+		case OPT_XTS_SECRET:
+		case OPT_HMAC_SECRET:
+		case OPT_EC_SECRET:
+			if (parse_hex(c == OPT_AES_SECRET ? opt.aes_secret
+			    : c == OPT_XTS_SECRET ? opt.xts_secret
+			    : c == OPT_HMAC_SECRET ? opt.hmac_secret
+			    : opt.ec_secret,
+			    c == OPT_AES_SECRET ? &opt.aes_secretlen
+			    : c == OPT_XTS_SECRET ? &opt.xts_secretlen
+			    : c == OPT_HMAC_SECRET ? &opt.hmac_secretlen
+			    : &opt.ec_secretlen,
+			    sizeof(opt.aes_secret), optarg) != 0) {
+				fprintf(stderr, "invalid secret ID '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_HASH:
+			if (strcmp(optarg, "sha224") == 0)
+				opt.hash = ZPC_HMAC_HASHFUNC_SHA_224;
+			else if (strcmp(optarg, "sha256") == 0)
+				opt.hash = ZPC_HMAC_HASHFUNC_SHA_256;
+			else if (strcmp(optarg, "sha384") == 0)
+				opt.hash = ZPC_HMAC_HASHFUNC_SHA_384;
+			else if (strcmp(optarg, "sha512") == 0)
+				opt.hash = ZPC_HMAC_HASHFUNC_SHA_512;
+			else {
+				fprintf(stderr, "invalid hash '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_EC_KEY_TYPE:
+			if (strcmp(optarg, "cca") == 0)
+				opt.ec_type = ZPC_EC_KEY_TYPE_CCA;
+			else if (strcmp(optarg, "ep11") == 0)
+				opt.ec_type = ZPC_EC_KEY_TYPE_EP11;
+			else if (strcmp(optarg, "pvsecret") == 0)
+				opt.ec_type = ZPC_EC_KEY_TYPE_PVSECRET;
+			else {
+				fprintf(stderr, "invalid EC key type '%s'\n",
+				    optarg);
+				return -1;
+			}
+			break;
+		case OPT_CURVE:
+			if (strcmp(optarg, "p256") == 0)
+				opt.curve = ZPC_EC_CURVE_P256;
+			else if (strcmp(optarg, "p384") == 0)
+				opt.curve = ZPC_EC_CURVE_P384;
+			else if (strcmp(optarg, "p521") == 0)
+				opt.curve = ZPC_EC_CURVE_P521;
+			else if (strcmp(optarg, "ed25519") == 0)
+				opt.curve = ZPC_EC_CURVE_ED25519;
+			else if (strcmp(optarg, "ed448") == 0)
+				opt.curve = ZPC_EC_CURVE_ED448;
+			else {
+				fprintf(stderr, "invalid curve '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_EC_PUBKEY:
+			if (parse_hex(opt.ec_pub, &opt.ec_publen,
+			    sizeof(opt.ec_pub), optarg) != 0) {
+				fprintf(stderr, "invalid public key '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind != argc) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (all) {
+		for (i = 0; i < ALG_NMEMB; i++)
+			opt.algs[i] = 1;
+	}
+	if (opt.nsizes == 0) {
+		opt.nsizes = split(sizes, elems, MAX_SIZES);
+		for (i = 0; i < opt.nsizes; i++)
+			parse_size(&opt.sizes[i], elems[i]);
+	}
+
+	*out = stdout;
+	if (outfile != NULL) {
+		*out = fopen(outfile, "w");
+		if (*out == NULL) {
+			perror(outfile);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64 */
+static uint64_t rand64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static void fill_random(unsigned char *buf, size_t len, uint64_t *state)
+{
+	uint64_t r;
+	size_t i;
+
+	for (i = 0; i < len; i += sizeof(r)) {
+		r = rand64(state);
+		memcpy(buf + i, &r, len - i < sizeof(r) ? len - i : sizeof(r));
+	}
+}
+
+/* CPU cycles spent by the calling thread, user and kernel. */
+static int cycles_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int aes_key_new(struct zpc_aes_key **key, int size, uint64_t *rng)
+{
+	unsigned char clear[32];
+	int rc;
+
+	rc = zpc_aes_key_alloc(key);
+	if (rc)
+		return rc;
+	rc = zpc_aes_key_set_type(*key, opt.aes_type);
+	if (rc)
+		goto err;
+	rc = zpc_aes_key_set_size(*key, size);
+	if (rc)
+		goto err;
+
+	if (opt.aes_type == ZPC_AES_KEY_TYPE_PVSECRET) {
+		rc = zpc_aes_key_import(*key, opt.aes_secret, opt.aes_secretlen);
+		goto err;
+	}
+
+	if (opt.mkvp != NULL)
+		rc = zpc_aes_key_set_mkvp(*key, opt.mkvp);
+	else
+		rc = zpc_aes_key_set_apqns(*key, opt.apqns);
+	if (rc)
+		goto err;
+
+	if (opt.clear) {
+		fill_random(clear, sizeof(clear), rng);
+		rc = zpc_aes_key_import_clear(*key, clear);
+		memset(clear, 0, sizeof(clear));
+	} else {
+		rc = zpc_aes_key_generate(*key);
+	}
+err:
+	if (rc)
+		zpc_aes_key_free(key);
+	return rc;
+}
+
+static int xts_key_new(struct zpc_aes_xts_key **key, uint64_t *rng)
+{
+	unsigned char clear[64];
+	int rc;
+
+	rc = zpc_aes_xts_key_alloc(key);
+	if (rc)
+		return rc;
+	rc = zpc_aes_xts_key_set_size(*key, opt.aes_size);
+	if (rc)
+		goto err;
+
+	if (opt.xts_secretlen > 0) {
+		rc = zpc_aes_xts_key_set_type(*key, ZPC_AES_XTS_KEY_TYPE_PVSECRET);
+		if (rc == 0)
+			rc = zpc_aes_xts_key_import(*key, opt.xts_secret,
+			    opt.xts_secretlen);
+	} else if (opt.clear) {
+		fill_random(clear, sizeof(clear), rng);
+		rc = zpc_aes_xts_key_import_clear(*key, clear);
+		memset(clear, 0, sizeof(clear));
+	} else {
+		rc = zpc_aes_xts_key_generate(*key);
+	}
+err:
+	if (rc)
+		zpc_aes_xts_key_free(key);
+	return rc;
+}
+
+static int hmac_key_new(struct zpc_hmac_key **key, uint64_t *rng)
+{
+	unsigned char clear[128];
+	int rc;
+
+	rc = zpc_hmac_key_alloc(key);
+	if (rc)
+		return rc;
+	rc = zpc_hmac_key_set_hash_function(*key, opt.hash);
+	if (rc)
+		goto err;
+
+	if (opt.hmac_secretlen > 0) {
+		rc = zpc_hmac_key_set_type(*key, ZPC_HMAC_KEY_TYPE_PVSECRET);
+		if (rc == 0)
+			rc = zpc_hmac_key_import(*key, opt.hmac_secret,
+			    opt.hmac_secretlen);
+	} else if (opt.clear) {
+		fill_random(clear, sizeof(clear), rng);
+		rc = zpc_hmac_key_import_clear(*key, clear,
+		    opt.hash <= ZPC_HMAC_HASHFUNC_SHA_256 ? 64 : 128);
+		memset(clear, 0, sizeof(clear));
+	} else {
+		rc = zpc_hmac_key_generate(*key);
+	}
+err:
+	if (rc)
+		zpc_hmac_key_free(key);
+	return rc;
+}
+
+static int ec_key_new(struct zpc_ec_key **key)
+{
+	int rc;
+
+	rc = zpc_ec_key_alloc(key);
+	if (rc)
+		return rc;
+	rc = zpc_ec_key_set_type(*key, opt.ec_type);
+	if (rc)
+		goto err;
+	rc = zpc_ec_key_set_curve(*key, opt.curve);
+	if (rc)
+		goto err;
+
+	if (opt.ec_type == ZPC_EC_KEY_TYPE_PVSECRET) {
+		rc = zpc_ec_key_import(*key, opt.ec_secret, opt.ec_secretlen);
+		if (rc == 0 && opt.ec_publen > 0)
+			rc = zpc_ec_key_import_clear(*key, opt.ec_pub,
+			    opt.ec_publen, NULL, 0);
+		goto err;
+	}
+
+	if (opt.mkvp != NULL)
+		rc = zpc_ec_key_set_mkvp(*key, opt.mkvp);
+	else
+		rc = zpc_ec_key_set_apqns(*key, opt.apqns);
+	if (rc == 0)
+		rc = zpc_ec_key_generate(*key);
+err:
+	if (rc)
+		zpc_ec_key_free(key);
+	return rc;
+}
+
+/* Create the keys needed by alg. */
+static int keys_new(struct keys *keys, enum alg_id alg, uint64_t *rng)
+{
+	int rc;
+
+	memset(keys, 0, sizeof(*keys));
+
+	switch (alg) {
+	case ALG_AES_XTS:
+		if (opt.aes_size == 192)
+			return ZPC_ERROR_KEYSIZE;
+		rc = aes_key_new(&keys->aes2, opt.aes_size, rng);
+		if (rc)
+			return rc;
+		/* fall through */
+	case ALG_AES_ECB:
+	case ALG_AES_CBC:
+	case ALG_AES_CMAC:
+	case ALG_AES_CCM:
+	case ALG_AES_GCM:
+		rc = aes_key_new(&keys->aes1, opt.aes_size, rng);
+		if (rc)
+			zpc_aes_key_free(&keys->aes2);
+		return rc;
+	case ALG_AES_XTS_FULL:
+		if (opt.aes_size == 192)
+			return ZPC_ERROR_KEYSIZE;
+		return xts_key_new(&keys->xts, rng);
+	case ALG_HMAC:
+		return hmac_key_new(&keys->hmac, rng);
+	case ALG_ECDSA_VERIFY:
+		if (opt.ec_type == ZPC_EC_KEY_TYPE_PVSECRET && opt.ec_publen == 0)
+			return ZPC_ERROR_EC_PUBKEY_NOTSET;
+		/* fall through */
+	default:
+		return ec_key_new(&keys->ec);
+	}
+}
+
+static void keys_free(struct keys *keys)
+{
+	zpc_aes_key_free(&keys->aes1);
+	zpc_aes_key_free(&keys->aes2);
+	zpc_aes_xts_key_free(&keys->xts);
+	zpc_hmac_key_free(&keys->hmac);
+	zpc_ec_key_free(&keys->ec);
+}
+
+static int ctx_new(struct worker *w)
+{
+	struct keys *k = w->keys;
+	int rc;
+
+	switch (w->run->alg) {
+	case ALG_AES_ECB:
+		rc = zpc_aes_ecb_alloc((struct zpc_aes_ecb **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_ecb_set_key(w->ctx, k->aes1);
+		return rc;
+	case ALG_AES_CBC:
+		rc = zpc_aes_cbc_alloc((struct zpc_aes_cbc **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_cbc_set_key(w->ctx, k->aes1);
+		return rc;
+	case ALG_AES_XTS:
+		rc = zpc_aes_xts_alloc((struct zpc_aes_xts **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_xts_set_key(w->ctx, k->aes1, k->aes2);
+		return rc;
+	case ALG_AES_XTS_FULL:
+		rc = zpc_aes_xts_full_alloc((struct zpc_aes_xts_full **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_xts_full_set_key(w->ctx, k->xts);
+		return rc;
+	case ALG_AES_CMAC:
+		rc = zpc_aes_cmac_alloc((struct zpc_aes_cmac **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_cmac_set_key(w->ctx, k->aes1);
+		return rc;
+	case ALG_AES_CCM:
+		rc = zpc_aes_ccm_alloc((struct zpc_aes_ccm **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_ccm_set_key(w->ctx, k->aes1);
+		return rc;
+	case ALG_AES_GCM:
+		rc = zpc_aes_gcm_alloc((struct zpc_aes_gcm **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_aes_gcm_set_key(w->ctx, k->aes1);
+		return rc;
+	case ALG_HMAC:
+		rc = zpc_hmac_alloc((struct zpc_hmac **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_hmac_set_key(w->ctx, k->hmac);
+		return rc;
+	default:
+		rc = zpc_ecdsa_ctx_alloc((struct zpc_ecdsa_ctx **)&w->ctx);
+		if (rc == 0)
+			rc = zpc_ecdsa_ctx_set_key(w->ctx, k->ec);
+		if (rc == 0 && w->run->alg == ALG_ECDSA_VERIFY) {
+			/* Verify a valid signature. */
+			w->siglen = sizeof(w->sig);
+			rc = zpc_ecdsa_sign(w->ctx, w->in, w->run->msglen,
+			    w->sig, &w->siglen);
+		}
+		return rc;
+	}
+}
+
+static void ctx_free(struct worker *w)
+{
+	if (w->ctx == NULL)
+		return;
+
+	switch (w->run->alg) {
+	case ALG_AES_ECB:
+		zpc_aes_ecb_free((struct zpc_aes_ecb **)&w->ctx);
+		break;
+	case ALG_AES_CBC:
+		zpc_aes_cbc_free((struct zpc_aes_cbc **)&w->ctx);
+		break;
+	case ALG_AES_XTS:
+		zpc_aes_xts_free((struct zpc_aes_xts **)&w->ctx);
+		break;
+	case ALG_AES_XTS_FULL:
+		zpc_aes_xts_full_free((struct zpc_aes_xts_full **)&w->ctx);
+		break;
+	case ALG_AES_CMAC:
+		zpc_aes_cmac_free((struct zpc_aes_cmac **)&w->ctx);
+		break;
+	case ALG_AES_CCM:
+		zpc_aes_ccm_free((struct zpc_aes_ccm **)&w->ctx);
+		break;
+	case ALG_AES_GCM:
+		zpc_aes_gcm_free((struct zpc_aes_gcm **)&w->ctx);
+		break;
+	case ALG_HMAC:
+		zpc_hmac_free((struct zpc_hmac **)&w->ctx);
+		break;
+	default:
+		zpc_ecdsa_ctx_free((struct zpc_ecdsa_ctx **)&w->ctx);
+		break;
+	}
+}
+
+/* One operation of the worker's algorithm. */
+static int op(struct worker *w)
+{
+	static const unsigned char iv[16] = { 0 };
+	unsigned char mac[64];
+	size_t len = w->run->msglen;
+	unsigned int siglen;
+	int rc;
+
+	switch (w->run->alg) {
+	case ALG_AES_ECB:
+		return zpc_aes_ecb_encrypt(w->ctx, w->out, w->in, len);
+	case ALG_AES_CBC:
+		rc = zpc_aes_cbc_set_iv(w->ctx, iv);
+		if (rc == 0)
+			rc = zpc_aes_cbc_encrypt(w->ctx, w->out, w->in, len);
+		return rc;
+	case ALG_AES_XTS:
+		rc = zpc_aes_xts_set_iv(w->ctx, iv);
+		if (rc == 0)
+			rc = zpc_aes_xts_encrypt(w->ctx, w->out, w->in, len);
+		return rc;
+	case ALG_AES_XTS_FULL:
+		rc = zpc_aes_xts_full_set_iv(w->ctx, iv);
+		if (rc == 0)
+			rc = zpc_aes_xts_full_encrypt(w->ctx, w->out, w->in, len);
+		return rc;
+	case ALG_AES_CMAC:
+		return zpc_aes_cmac_sign(w->ctx, mac, 16, w->in, len);
+	case ALG_AES_CCM:
+		/* 7-byte nonce: 8-byte length field. */
+		rc = zpc_aes_ccm_set_iv(w->ctx, iv, 7);
+		if (rc == 0)
+			rc = zpc_aes_ccm_encrypt(w->ctx, w->out, mac, 16, NULL, 0,
+			    w->in, len);
+		return rc;
+	case ALG_AES_GCM:
+		rc = zpc_aes_gcm_set_iv(w->ctx, iv, 12);
+		if (rc == 0)
+			rc = zpc_aes_gcm_encrypt(w->ctx, w->out, mac, 16, NULL, 0,
+			    w->in, len);
+		return rc;
+	case ALG_HMAC:
+		return zpc_hmac_sign(w->ctx, mac,
+		    opt.hash <= ZPC_HMAC_HASHFUNC_SHA_256 ? 32 : 64, w->in, len);
+	case ALG_ECDSA_SIGN:
+		siglen = sizeof(w->sig);
+		return zpc_ecdsa_sign(w->ctx, w->in, len, w->sig, &siglen);
+	default:
+		return zpc_ecdsa_verify(w->ctx, w->in, len, w->sig, w->siglen);
+	}
+}
+
+static void record_latency(struct worker *w, unsigned long long ns)
+{
+	uint64_t i;
+
+	if (w->nlat < LAT_SAMPLES) {
+		w->lat[w->nlat++] = ns;
+		return;
+	}
+
+	/* Reservoir sampling: keep each sample with equal probability. */
+	i = rand64(&w->rng) % w->ops;
+	if (i < LAT_SAMPLES)
+		w->lat[i] = ns;
+}
+
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	struct run *run = w->run;
+	unsigned long long t0, t1;
+	long long cycles = -1;
+	int fd, rc;
+
+	/* Setup. */
+	rc = 0;
+	if (run->perthread) {
+		rc = keys_new(&w->own, run->alg, &w->rng);
+		w->keys = &w->own;
+	}
+	if (rc == 0)
+		rc = ctx_new(w);
+	/* Warm up: derive protected keys, fault in buffers. */
+	if (rc == 0)
+		rc = op(w);
+	w->rc = rc;
+
+	fd = cycles_open();
+
+	pthread_barrier_wait(&run->start);
+
+	if (fd >= 0)
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+
+	while (w->rc == 0 && !__atomic_load_n(&run->stop, __ATOMIC_RELAXED)) {
+		t0 = now_ns();
+		w->rc = op(w);
+		t1 = now_ns();
+
+		if (w->rc == 0) {
+			w->ops++;
+			record_latency(w, t1 - t0);
+		}
+	}
+
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+			cycles = -1;
+		close(fd);
+	}
+	w->cycles = cycles;
+
+	ctx_free(w);
+	if (run->perthread)
+		keys_free(&w->own);
+	return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of n sorted samples. */
+static unsigned long long percentile(const unsigned long long *s, size_t n,
+    double p)
+{
+	size_t rank;
+
+	rank = (size_t)ceil(p * n);
+	return s[rank > 0 ? rank - 1 : 0];
+}
+
+static const char *aes_type_name(int type)
+{
+	switch (type) {
+	case ZPC_AES_KEY_TYPE_CCA_DATA:
+		return "cca-data";
+	case ZPC_AES_KEY_TYPE_CCA_CIPHER:
+		return "cca-cipher";
+	case ZPC_AES_KEY_TYPE_EP11:
+		return "ep11";
+	default:
+		return "pvsecret";
+	}
+}
+
+static void print_key(FILE *out, enum alg_id alg)
+{
+	static const char *const curves[] = {
+		"p256", "p384", "p521", "ed25519", "ed448"
+	};
+	static const char *const hashes[] = {
+		"sha224", "sha256", "sha384", "sha512"
+	};
+
+	switch (alg) {
+	case ALG_AES_XTS_FULL:
+		fprintf(out, "\"key_type\": \"%s\", \"key_bits\": %d",
+		    opt.xts_secretlen > 0 ? "pvsecret" : "protected",
+		    opt.aes_size);
+		break;
+	case ALG_HMAC:
+		fprintf(out, "\"key_type\": \"%s\", \"hash\": \"%s\"",
+		    opt.hmac_secretlen > 0 ? "pvsecret" : "protected",
+		    hashes[opt.hash]);
+		break;
+	case ALG_ECDSA_SIGN:
+	case ALG_ECDSA_VERIFY:
+		fprintf(out, "\"key_type\": \"%s\", \"curve\": \"%s\"",
+		    opt.ec_type == ZPC_EC_KEY_TYPE_CCA ? "cca"
+		    : opt.ec_type == ZPC_EC_KEY_TYPE_EP11 ? "ep11" : "pvsecret",
+		    curves[opt.curve]);
+		break;
+	default:
+		fprintf(out, "\"key_type\": \"%s\", \"key_bits\": %d",
+		    aes_type_name(opt.aes_type), opt.aes_size);
+		break;
+	}
+}
+
+/*
+ * Execute one run and print its result object. inplace is -1 for
+ * algorithms without output buffer. Returns 0 if the run was executed,
+ * or the error code of the setup.
+ */
+static int bench(FILE *out, int *first, enum alg_id alg, size_t msglen,
+    unsigned int nthreads, int inplace, int perthread)
+{
+	struct worker *workers;
+	struct keys shared;
+	struct run run;
+	unsigned long long t0, t1, ops = 0, *lat = NULL;
+	long long cycles = 0;
+	size_t i, nlat = 0;
+	uint64_t seed;
+	double secs, bytes;
+	int rc = 0;
+
+	memset(&run, 0, sizeof(run));
+	run.alg = alg;
+	run.msglen = msglen;
+	run.nthreads = nthreads;
+	run.inplace = inplace;
+	run.perthread = perthread;
+
+	seed = now_ns() | 1;
+	memset(&shared, 0, sizeof(shared));
+	if (!perthread) {
+		rc = keys_new(&shared, alg, &seed);
+		if (rc)
+			return rc;
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (workers == NULL) {
+		keys_free(&shared);
+		return ZPC_ERROR_MALLOC;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &workers[i];
+
+		w->run = &run;
+		w->keys = &shared;
+		w->rng = rand64(&seed) | 1;
+		w->in = malloc(msglen);
+		w->out = inplace != 0 ? w->in : malloc(msglen);
+		w->lat = malloc(LAT_SAMPLES * sizeof(*w->lat));
+		if (w->in == NULL || w->out == NULL || w->lat == NULL) {
+			rc = ZPC_ERROR_MALLOC;
+			break;
+		}
+		fill_random(w->in, msglen, &w->rng);
+	}
+	if (rc)
+		goto out;
+
+	pthread_barrier_init(&run.start, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, work,
+		    &workers[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_barrier_wait(&run.start);
+	t0 = now_ns();
+	do {
+		usleep(1000);
+		t1 = now_ns();
+	} while ((t1 - t0) / 1e9 < opt.duration);
+	__atomic_store_n(&run.stop, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	t1 = now_ns();
+	pthread_barrier_destroy(&run.start);
+
+	lat = malloc(nthreads * LAT_SAMPLES * sizeof(*lat));
+	if (lat == NULL) {
+		rc = ZPC_ERROR_MALLOC;
+		goto out;
+	}
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &workers[i];
+
+		if (w->rc && rc == 0)
+			rc = w->rc;
+		ops += w->ops;
+		memcpy(lat + nlat, w->lat, w->nlat * sizeof(*lat));
+		nlat += w->nlat;
+		if (w->cycles < 0 || cycles < 0)
+			cycles = -1;
+		else
+			cycles += w->cycles;
+	}
+	qsort(lat, nlat, sizeof(*lat), cmp_ull);
+
+	secs = (t1 - t0) / 1e9;
+	bytes = (double)ops * msglen;
+
+	fprintf(out, "%s\n    {\"algorithm\": \"%s\", ", *first ? "" : ",",
+	    alg_names[alg]);
+	print_key(out, alg);
+	fprintf(out, ", \"msg_bytes\": %zu, \"threads\": %u, "
+	    "\"in_place\": %s, \"key_mode\": \"%s\",\n"
+	    "     \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+	    "\"bytes_per_sec\": %.1f, \"cycles_per_byte\": ",
+	    msglen, nthreads,
+	    inplace < 0 ? "null" : inplace ? "true" : "false",
+	    perthread ? "per-thread" : "shared", ops, secs, ops / secs,
+	    bytes / secs);
+	if (cycles >= 0 && bytes > 0)
+		fprintf(out, "%.3f", cycles / bytes);
+	else
+		fprintf(out, "null");
+	if (nlat > 0) {
+		fprintf(out, ",\n     \"latency_ns\": {\"p50\": %llu, "
+		    "\"p99\": %llu, \"p999\": %llu}",
+		    percentile(lat, nlat, 0.50), percentile(lat, nlat, 0.99),
+		    percentile(lat, nlat, 0.999));
+	}
+	if (rc)
+		fprintf(out, ", \"error\": \"%s\"", zpc_error_string(rc));
+	fprintf(out, "}");
+	fflush(out);
+	*first = 0;
+	rc = 0;
+out:
+	for (i = 0; i < nthreads; i++) {
+		if (workers[i].out != workers[i].in)
+			free(workers[i].out);
+		free(workers[i].in);
+		free(workers[i].lat);
+	}
+	free(workers);
+	free(lat);
+	keys_free(&shared);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *out;
+	size_t s, t, nsizes, msglen;
+	int a, b, k, rc, nobuf, first = 1;
+
+	if (parse_args(argc, argv, &out) != 0)
+		return EXIT_FAILURE;
+
+	fprintf(out, "{\n  \"duration_s\": %.3f,\n  \"results\": [",
+	    opt.duration);
+
+	for (a = 0; a < ALG_NMEMB; a++) {
+		if (!opt.algs[a])
+			continue;
+
+		/* Signatures take a fixed-length hash or message. */
+		nsizes = a >= ALG_ECDSA_SIGN ? 1 : opt.nsizes;
+		/* MACs and signatures have no output buffer. */
+		nobuf = a == ALG_AES_CMAC || a == ALG_HMAC || a >= ALG_ECDSA_SIGN;
+
+		for (s = 0; s < nsizes; s++) {
+			msglen = a >= ALG_ECDSA_SIGN
+			    ? (size_t)curve2hashlen[opt.curve] : opt.sizes[s];
+			for (t = 0; t < opt.nthreads; t++) {
+				for (b = 0; b < 2; b++) {
+					if (!opt.inplace[b]
+					    || (nobuf && b == 1 && opt.inplace[0]))
+						continue;
+					for (k = 0; k < 2; k++) {
+						if (!opt.perthread[k])
+							continue;
+
+						rc = bench(out, &first, a, msglen,
+						    opt.threads[t], nobuf ? -1 : b, k);
+						if (rc) {
+							fprintf(stderr, "%s: skipped: "
+							    "%s\n", alg_names[a],
+							    zpc_error_string(rc));
+							goto next_alg;
+						}
+					}
+				}
+			}
+		}
+next_alg:
+		;
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout)
+		fclose(out);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright IBM Corp. 2026
+ *
+ * libzpc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * zpc_pkeyd - timing and failure model of a pkey device shared by
+ * several processes.
+ *
+ * Processes using libzpc with ZPC_PKEY=unix:<socket> ask the daemon for
+ * admission before each pkey request. The daemon applies one pkey_model
+ * (latency, service slots, EBUSY/EAGAIN bursts, wrapping key rotation)
+ * to the requests of all clients, see pkey_model.h.
+ */
+
+#include "pkey_model.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static struct pkey_model model;
+static volatile sig_atomic_t stop;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-o OPTIONS] SOCKET\n"
+	    "  -o OPTIONS  comma-separated pkey model options, e.g.\n"
+	    "              latency_us=200,jitter_us=50,slots=4,\n"
+	    "              busy_every=100,busy_burst=3,busy_errno=EAGAIN,\n"
+	    "              rotate_every=1000,rotate_ms=5000\n", prog);
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int xfer(int fd, void *buf, size_t len, int out)
+{
+	size_t off;
+	ssize_t n;
+
+	for (off = 0; off < len; off += n) {
+		if (out)
+			n = send(fd, (char *)buf + off, len - off, MSG_NOSIGNAL);
+		else
+			n = recv(fd, (char *)buf + off, len - off, 0);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Report the current epoch and every change of it. */
+static void watch(int fd, struct pkey_model_msg *msg)
+{
+	u32 epoch;
+
+	pthread_mutex_lock(&model.lock);
+	epoch = model.epoch;
+	pthread_mutex_unlock(&model.lock);
+
+	do {
+		msg->err = 0;
+		msg->epoch = epoch;
+		if (xfer(fd, msg, sizeof(*msg), 1) != 0)
+			break;
+	} while (pkey_model_wait_epoch(&model, epoch, &epoch) == 0);
+}
+
+static void *serve(void *arg)
+{
+	struct pkey_model_msg msg;
+	int fd = (int)(long)arg;
+	u32 epoch;
+
+	for (;;) {
+		if (xfer(fd, &msg, sizeof(msg), 0) != 0
+		    || msg.magic != PKEY_MODEL_MAGIC)
+			break;
+
+		if (msg.op == PKEY_MODEL_OP_WATCH) {
+			watch(fd, &msg);
+			break;
+		}
+
+		msg.err = pkey_model_admit(&model,
+		    msg.op == PKEY_MODEL_OP_DERIVE, &epoch);
+		msg.epoch = epoch;
+
+		if (xfer(fd, &msg, sizeof(msg), 1) != 0)
+			break;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pkey_model_cfg cfg;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	const char *opts = NULL;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int c, fd, cfd;
+
+	while ((c = getopt(argc, argv, "o:h")) != -1) {
+		switch (c) {
+		case 'o':
+			opts = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (pkey_model_parse(&cfg, opts) != 0) {
+		fprintf(stderr, "%s: invalid options '%s'\n", argv[0], opts);
+		return EXIT_FAILURE;
+	}
+	if (pkey_model_init(&model, &cfg, NULL) != 0) {
+		fprintf(stderr, "%s: initializing model failed\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, argv[optind]);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+	unlink(addr.sun_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+	    || listen(fd, SOMAXCONN) != 0) {
+		perror(addr.sun_path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	/* No SA_RESTART: a signal interrupts accept. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (!stop) {
+		cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (cfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			break;
+		}
+		if (pthread_create(&thread, &attr, serve, (void *)(long)cfd) != 0)
+			close(cfd);
+	}
+
+	pthread_attr_destroy(&attr);
+	close(fd);
+	unlink(addr.sun_path);
+
+	pthread_mutex_lock(&model.lock);
+	fprintf(stderr, "requests %lu derivations %lu busy %lu epoch %u\n",
+	    model.nreqs, model.nderivs, model.nbusy, model.epoch);
+	pthread_mutex_unlock(&model.lock);
+
+	return EXIT_SUCCESS;
+}